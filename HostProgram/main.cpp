@@ -5,13 +5,20 @@
 //
 
 #include <cstdio>
+#include <cstring>
 #include <thread>
+#include <random>
 
 #include <libSLR/defines.h>
 #include <libSLR/MemoryAllocators/ArenaAllocator.h>
 #include <libSLR/BasicTypes/spectrum_base.h>
 #include <libSLR/Core/renderer.h>
 #include <libSLR/Core/RenderSettings.h>
+#include <libSLR/Core/ImageSensor.h>
+#include <libSLR/Core/camera.h>
+#include <libSLR/Core/DistributedRendering.h>
+#include <libSLR/Core/BVHCache.h>
+#include <libSLR/Core/TextureCache.h>
 #include <libSLR/Scene/Scene.h>
 #include <libSLRSceneGraph/declarations.h>
 #include <libSLRSceneGraph/Scene/Scene.h>
@@ -25,6 +32,16 @@ int main(int argc, const char * argv[]) {
         return -1;
     }
     
+    // JP: シーンを読む代わりにモデルをメッシュキャッシュに変換する。
+    // EN: convert a model to a mesh cache instead of reading a scene.
+    if (strcmp(argv[1], "--convert-mesh") == 0) {
+        if (argc < 4) {
+            fprintf(stderr, "Usage: --convert-mesh <source model> <mesh cache>\n");
+            return -1;
+        }
+        return SLRSceneGraph::writeMeshCache(argv[2], argv[3]) ? 0 : -1;
+    }
+    
     // print launching time
     using namespace std::chrono;
     std::time_t ctimeLaunch = system_clock::to_time_t(system_clock::now());
@@ -32,8 +49,32 @@ int main(int argc, const char * argv[]) {
     
     SLR::initializeColorSystem();
     
+    // JP: レンダリングせずにシーンスクリプトを繰り返し読み込み、各段階の時間を表示する。
+    // EN: repeatedly read a scene script without rendering, and print the time of each stage.
+    if (strcmp(argv[1], "--benchmark-script") == 0) {
+        if (argc < 3) {
+            fprintf(stderr, "Usage: --benchmark-script <scene> [iterations]\n");
+            return -1;
+        }
+        uint32_t numIterations = argc >= 4 ? std::max(atoi(argv[3]), 1) : 5;
+        return SLRSceneGraph::benchmarkScript(argv[2], numIterations) ? 0 : -1;
+    }
+    
     StopWatch stopwatch;
     
+    // JP: テクスチャーはシーンの読み込み中に読まれるため、テクスチャーキャッシュの設定はシーンより先に解釈する。
+    //     --texture-cache を指定すると大きな画像テクスチャーをそのディレクトリにタイル状のファイルとして変換し、必要なタイルだけを読み込む。
+    //     --texture-cache-size はタイルが使う物理メモリーの上限(MB)。
+    // EN: interpret texture cache settings before the scene since textures are read while reading the scene.
+    //     --texture-cache makes large image textures converted into tiled files in the directory and only the required tiles read.
+    //     --texture-cache-size is the limit (in MB) of physical memory used by the tiles.
+    for (int i = 2; i < argc; ++i) {
+        if (strcmp(argv[i], "--texture-cache") == 0 && i + 1 < argc)
+            SLR::TextureCache::setDirectory(argv[++i]);
+        else if (strcmp(argv[i], "--texture-cache-size") == 0 && i + 1 < argc)
+            SLR::TextureCache::setCapacity((uint64_t)std::max(atoi(argv[++i]), 1) * 1024 * 1024);
+    }
+    
     // read a scene
     stopwatch.start();
     SLRSceneGraph::SceneRef scene = createShared<SLRSceneGraph::Scene>();
@@ -45,25 +86,156 @@ int main(int argc, const char * argv[]) {
     }
     printf("read scene: %g [s]\n", stopwatch.stop() * 1e-3f);
     
-    // setup render settings
-    SLR::RenderSettings settings;
+    // JP: シーンファイルを書き換えずにチェックポイントから再開できるようにする。
+    //     --coordinator と --worker で分散レンダリングのコーディネーターとワーカーとして動作する。
+    //     --units はサンプル数を等分するパスの範囲の数、--unit-timeout はワーカーからのハートビートが途絶えてよい秒数。
+    //     --progress-fd を指定すると進捗を端末に描画する代わりにそのファイル記述子へJSON Linesで書き出す。
+    //     --bvh-cache を指定すると構築した加速構造をそのディレクトリに保存し、以降の実行で再利用する。
+    //     --image-format で出力画像の形式を bmp, exr, spectral-exr から選ぶ。
+    // EN: allow resuming from a checkpoint without editing the scene file.
+    //     --coordinator and --worker make this run as the coordinator and a worker of distributed rendering.
+    //     --units is the number of pass ranges dividing the sample count evenly, and --unit-timeout is the number of seconds heartbeats from a worker may stall.
+    //     --progress-fd makes progress written to the file descriptor as JSON Lines instead of being drawn on the terminal.
+    //     --bvh-cache makes built accelerators saved in the directory and reused in later runs.
+    //     --image-format selects the format of output images from bmp, exr and spectral-exr.
 #ifdef DEBUG
-    settings.addItem(SLR::RenderSettingItem::NumThreads, 1);
+    int32_t numThreads = 1;
 #else
-    settings.addItem(SLR::RenderSettingItem::NumThreads, (int32_t)std::thread::hardware_concurrency());
+    int32_t numThreads = (int32_t)std::thread::hardware_concurrency();
 #endif
+    int32_t coordinatorPort = -1;
+    uint32_t numUnits = 0;
+    float unitTimeout = 0.0f;
+    std::string workerHost;
+    uint16_t workerPort = 0;
+    int32_t progressFD = -1;
+    SLR::ImageFileFormat imageFileFormat = SLR::ImageFileFormat::BMP;
+    for (int i = 2; i < argc; ++i) {
+        if (strcmp(argv[i], "--resume") == 0 && i + 1 < argc) {
+            context.resumePath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            numThreads = std::max(atoi(argv[++i]), 1);
+        }
+        else if (strcmp(argv[i], "--progress-fd") == 0 && i + 1 < argc) {
+            progressFD = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--bvh-cache") == 0 && i + 1 < argc) {
+            SLR::BVHCache::setDirectory(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--image-format") == 0 && i + 1 < argc) {
+            const char* format = argv[++i];
+            if (strcmp(format, "bmp") == 0) {
+                imageFileFormat = SLR::ImageFileFormat::BMP;
+            }
+            else if (strcmp(format, "exr") == 0) {
+                imageFileFormat = SLR::ImageFileFormat::EXR;
+            }
+            else if (strcmp(format, "spectral-exr") == 0) {
+                imageFileFormat = SLR::ImageFileFormat::SpectralEXR;
+            }
+            else {
+                fprintf(stderr, "Unknown image format: %s\n", format);
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--coordinator") == 0 && i + 1 < argc) {
+            coordinatorPort = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--units") == 0 && i + 1 < argc) {
+            numUnits = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--unit-timeout") == 0 && i + 1 < argc) {
+            unitTimeout = (float)atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--worker") == 0 && i + 1 < argc) {
+            std::string address = argv[++i];
+            size_t colonPos = address.rfind(':');
+            if (colonPos == std::string::npos) {
+                fprintf(stderr, "The coordinator address must be specified as host:port.\n");
+                return -1;
+            }
+            workerHost = address.substr(0, colonPos);
+            workerPort = (uint16_t)atoi(address.substr(colonPos + 1).c_str());
+        }
+    }
+    if (coordinatorPort >= 0 && numUnits == 0) {
+        fprintf(stderr, "The number of units must be specified with --units for the coordinator.\n");
+        return -1;
+    }
+    
+    // setup render settings
+    SLR::RenderSettings settings;
+    settings.addItem(SLR::RenderSettingItem::NumThreads, numThreads);
     settings.addItem(SLR::RenderSettingItem::ImageWidth, context.width);
     settings.addItem(SLR::RenderSettingItem::ImageHeight, context.height);
     settings.addItem(SLR::RenderSettingItem::TimeStart, context.timeStart);
     settings.addItem(SLR::RenderSettingItem::TimeEnd, context.timeEnd);
     settings.addItem(SLR::RenderSettingItem::Brightness, context.brightness);
     settings.addItem(SLR::RenderSettingItem::RNGSeed, context.rngSeed);
+    settings.addItem(SLR::RenderSettingItem::TimeLimit, context.timeLimit);
+    settings.addItem(SLR::RenderSettingItem::TargetNoise, context.targetNoise);
+    settings.addItem(SLR::RenderSettingItem::CheckpointPath, context.checkpointPath);
+    settings.addItem(SLR::RenderSettingItem::CheckpointInterval, context.checkpointInterval);
+    settings.addItem(SLR::RenderSettingItem::ResumePath, context.resumePath);
+    settings.addItem(SLR::RenderSettingItem::ProgressFD, progressFD);
+    settings.addItem(SLR::RenderSettingItem::ExportInterval, context.exportInterval);
+    settings.addItem(SLR::RenderSettingItem::ExportTimeInterval, context.exportTimeInterval);
+    settings.addItem(SLR::RenderSettingItem::ValidateMISWeights, false);
+    settings.addItem(SLR::RenderSettingItem::PassRangeIndex, 0);
+    settings.addItem(SLR::RenderSettingItem::NumPassRanges, 1);
     
     scene->prepareForRendering();
     SLR::Scene* rawScene = scene->getRaw();
     SLR::ArenaAllocator sceneMem;
     rawScene->build(&sceneMem);
-    context.renderer->render(*rawScene, settings);
+    rawScene->getCamera()->getSensor()->setImageFileFormat(imageFileFormat);
+    if (coordinatorPort >= 0) {
+        // JP: 合算した結果はレンダラーと同じ規約で出力する。ピクセルごとのサンプル数を持つ場合はセンサーがそれで割る。
+        // EN: output the summed result with the same convention as the renderers. The sensor divides pixels by their sample counts if it has them.
+        SLR::RenderCoordinator coordinator(coordinatorPort, numUnits, context.rngSeed, unitTimeout);
+        if (!coordinator.isListening()) {
+            printf("Failed to listen on port %d.\n", coordinatorPort);
+            exit(-1);
+        }
+        SLR::ImageSensor* sensor = rawScene->getCamera()->getSensor();
+        uint32_t numPasses;
+        stopwatch.start();
+        if (!coordinator.run(sensor, &numPasses)) {
+            printf("Distributed rendering failed.\n");
+            exit(-1);
+        }
+        std::string filename = std::string("distributed.") + sensor->imageFileExtension();
+        sensor->saveImage(filename, sensor->varianceEstimationEnabled() ? context.brightness : context.brightness / numPasses);
+        printf("%u units, %u passes: %s, %g[s]\n", numUnits, numPasses, filename.c_str(), stopwatch.stop() * 1e-3f);
+    }
+    else if (!workerHost.empty()) {
+        // JP: 同じディレクトリで複数のワーカーを動かせるよう、チェックポイントのファイル名を一意にする。
+        //     各単位はシーンのサンプル数のうち単位に割り当てられたパスの範囲のみをレンダリングし、
+        //     それ以外はシーンの設定通りとして乱数シードとチェックポイントの設定を置き換える。
+        // EN: make the checkpoint file name unique so that multiple workers can run in the same directory.
+        //     Each unit renders only the range of passes assigned to the unit out of the scene's sample count,
+        //     otherwise it is rendered as configured in the scene, replacing the RNG seed and the checkpoint settings.
+        char checkpointPath[64];
+        snprintf(checkpointPath, sizeof(checkpointPath), "worker_%08x.slrckpt", std::random_device()());
+        SLR::RenderWorker worker(workerHost, workerPort, checkpointPath);
+        bool success = worker.run([&](const SLR::RenderUnit &unit, const std::string &unitCheckpointPath) {
+            SLR::RenderSettings unitSettings = settings;
+            unitSettings.addItem(SLR::RenderSettingItem::RNGSeed, unit.rngSeed);
+            unitSettings.addItem(SLR::RenderSettingItem::PassRangeIndex, (int32_t)unit.index);
+            unitSettings.addItem(SLR::RenderSettingItem::NumPassRanges, (int32_t)unit.numUnits);
+            unitSettings.addItem(SLR::RenderSettingItem::CheckpointPath, unitCheckpointPath);
+            unitSettings.addItem(SLR::RenderSettingItem::CheckpointInterval, INFINITY);
+            unitSettings.addItem(SLR::RenderSettingItem::ResumePath, std::string(""));
+            context.renderer->render(*rawScene, unitSettings);
+            return true;
+        });
+        if (!success)
+            printf("Lost the connection to the coordinator.\n");
+    }
+    else {
+        context.renderer->render(*rawScene, settings);
+    }
     rawScene->destory();
     
     return 0;
@@ -0,0 +1,357 @@
+//
+//  accelerator_tests.cpp
+//
+//  Created by 渡部 心 on 2017/06/26.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#include <gtest/gtest.h>
+#include <chrono>
+
+#include <libSLR/Core/geometry.h>
+#include <libSLR/Core/transform.h>
+#include <libSLR/Core/RenderStatistics.h>
+#include <libSLR/Core/BVHCache.h>
+#include <libSLR/Core/surface_object.h>
+#include <libSLR/Accelerator/SBVH.h>
+#include <libSLR/Accelerator/QBVH.h>
+#include <libSLR/MemoryAllocators/ArenaAllocator.h>
+#include <libSLR/BasicTypes/spectrum_types.h>
+#include <libSLR/BasicTypes/spectrum_library.h>
+#include <libSLR/Scene/Scene.h>
+#include <libSLR/Scene/node.h>
+#include <libSLR/Scene/TriangleMeshNode.h>
+#include <libSLR/Texture/constant_textures.h>
+#include <libSLR/SurfaceMaterial/basic_surface_materials.h>
+#include <libSLR/SurfaceMaterial/basic_emitter_surface_properties.h>
+#include <libSLR/RNG/XORShiftRNG.h>
+
+// JP: 起伏のある格子状の地形と、その上の小さな光源からなるシーン。
+// EN: a scene consisting of bumpy grid terrain and a small light above it.
+struct PacketTraversalScene {
+    static const uint32_t GridSize = 256;
+    
+    SLR::ArenaAllocator mem;
+    std::unique_ptr<SLR::Scene> scene;
+    
+    static SLR::TriangleMeshNode* createGrid(const SLR::SurfaceMaterial* mat) {
+        using namespace SLR;
+        const uint32_t numVertsPerSide = GridSize + 1;
+        TriangleMeshNode* node = new TriangleMeshNode(numVertsPerSide * numVertsPerSide, 1, false, -1);
+        for (int iz = 0; iz < numVertsPerSide; ++iz) {
+            for (int ix = 0; ix < numVertsPerSide; ++ix) {
+                float x = -1.0f + 2.0f * ix / GridSize;
+                float z = -1.0f + 2.0f * iz / GridSize;
+                float y = 0.1f * std::sin(13.0f * x) * std::cos(11.0f * z);
+                node->setVertex(iz * numVertsPerSide + ix, Vertex(Point3D(x, y, z), Normal3D(0, 1, 0), Tangent3D(1, 0, 0),
+                                                                  TexCoord2D((float)ix / GridSize, (float)iz / GridSize)));
+            }
+        }
+        
+        std::unique_ptr<uint32_t[]> indices(new uint32_t[6 * GridSize * GridSize]);
+        for (int iz = 0; iz < GridSize; ++iz) {
+            for (int ix = 0; ix < GridSize; ++ix) {
+                uint32_t* tri = &indices[6 * (iz * GridSize + ix)];
+                uint32_t base = iz * numVertsPerSide + ix;
+                tri[0] = base;
+                tri[1] = base + numVertsPerSide;
+                tri[2] = base + numVertsPerSide + 1;
+                tri[3] = base;
+                tri[4] = base + numVertsPerSide + 1;
+                tri[5] = base + 1;
+            }
+        }
+        node->getMaterialGroupArray()[0].material = mat;
+        node->getMaterialGroupArray()[0].setTriangles(indices, 2 * GridSize * GridSize);
+        return node;
+    }
+    
+    PacketTraversalScene() {
+        using namespace SLR;
+        float values[2] = {0.5f, 0.5f};
+        const SpectrumTexture* reflectance = new ConstantSpectrumTexture(new RegularContinuousSpectrum(360, 830, values, 2));
+        const FloatTexture* sigma = nullptr;
+        const SurfaceMaterial* diffuse = new DiffuseReflectionSurfaceMaterial(reflectance, sigma);
+        const SurfaceMaterial* light = new EmitterSurfaceMaterial(diffuse, new DiffuseEmitterSurfaceProperty(reflectance));
+        
+        InternalNode* root = new InternalNode(new StaticTransform());
+        root->addChildNode(createGrid(diffuse));
+        InternalNode* lightNode = new InternalNode(new StaticTransform(translate(0.0f, 2.0f, 0.0f) * scale(0.01f)));
+        lightNode->addChildNode(createGrid(light));
+        root->addChildNode(lightNode);
+        
+        scene = std::unique_ptr<Scene>(new Scene(root));
+        scene->build(&mem);
+    }
+};
+
+static void expectSameResult(bool hitA, const SLR::SurfaceInteraction &siA, bool hitB, const SLR::SurfaceInteraction &siB) {
+    EXPECT_EQ(hitA, hitB);
+    if (hitA && hitB) {
+        EXPECT_EQ(siA.getDistance(), siB.getDistance());
+    }
+}
+
+// JP: カメラからの光線とシャドウレイについて、束による交差判定が1本ずつの判定と同じ結果になることを確かめ、両者の処理速度を比べる。
+// EN: check that packet intersection gives the same results as one-by-one intersection for camera rays and shadow rays, and compare the speeds of both.
+TEST(AcceleratorTest, PacketTraversal) {
+    using namespace SLR;
+    PacketTraversalScene testScene;
+    const Scene &scene = *testScene.scene;
+    
+    // JP: 4x4ピクセルのタイルを1つの束とするピンホールカメラの光線。
+    // EN: pinhole camera rays where each 4x4 pixel tile forms a packet.
+    const uint32_t ImageSize = 512;
+    const uint32_t TileSize = 4;
+    const uint32_t PacketSize = TileSize * TileSize;
+    const uint32_t numRays = ImageSize * ImageSize;
+    const Point3D eye(0.0f, 1.0f, -2.0f);
+    const Point3D lightPos(0.0f, 2.0f, 0.0f);
+    std::vector<Ray> primaryRays(numRays);
+    for (int ty = 0; ty < ImageSize / TileSize; ++ty) {
+        for (int tx = 0; tx < ImageSize / TileSize; ++tx) {
+            for (int i = 0; i < PacketSize; ++i) {
+                float px = (tx * TileSize + i % TileSize + 0.5f) / ImageSize;
+                float py = (ty * TileSize + i / TileSize + 0.5f) / ImageSize;
+                Vector3D dir = normalize(Vector3D(px - 0.5f, -0.3f - 0.7f * py, 1.0f));
+                primaryRays[(ty * (ImageSize / TileSize) + tx) * PacketSize + i] = Ray(eye, dir, 0.0f);
+            }
+        }
+    }
+    
+    auto run = [&](bool usePacket, std::vector<Ray> &rays, std::vector<RaySegment> &segments, std::vector<SurfaceInteraction> &sis, std::vector<uint8_t> &hits) {
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < numRays; ++i)
+            sis[i] = SurfaceInteraction();
+        if (usePacket) {
+            const uint32_t fullMask = (1u << PacketSize) - 1;
+            for (int base = 0; base < numRays; base += PacketSize) {
+                uint32_t hitMask = scene.intersectPacket(&rays[base], &segments[base], &sis[base], fullMask);
+                for (int i = 0; i < PacketSize; ++i)
+                    hits[base + i] = (hitMask >> i) & 0x1;
+            }
+        }
+        else {
+            for (int i = 0; i < numRays; ++i)
+                hits[i] = scene.intersect(rays[i], segments[i], &sis[i]);
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        return std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() * 1e-6;
+    };
+    
+    std::vector<RaySegment> segments(numRays);
+    std::vector<SurfaceInteraction> singleSIs(numRays), packetSIs(numRays);
+    std::vector<uint8_t> singleHits(numRays), packetHits(numRays);
+    double primarySingleTime = run(false, primaryRays, segments, singleSIs, singleHits);
+    segments.assign(numRays, RaySegment());
+    double primaryPacketTime = run(true, primaryRays, segments, packetSIs, packetHits);
+    uint32_t numPrimaryHits = 0;
+    for (int i = 0; i < numRays; ++i) {
+        expectSameResult(singleHits[i], singleSIs[i], packetHits[i], packetSIs[i]);
+        numPrimaryHits += singleHits[i];
+    }
+    EXPECT_GT(numPrimaryHits, numRays / 2);
+    
+    // JP: 可視点から光源の中心へのシャドウレイ。光源に当たらない光線のみ遮蔽物に当たる。
+    // EN: shadow rays from visible points to the center of the light. Only rays which do not reach the light hit occluders.
+    std::vector<Ray> shadowRays(numRays);
+    std::vector<RaySegment> shadowSegments(numRays);
+    for (int i = 0; i < numRays; ++i) {
+        Point3D org = singleHits[i] ? primaryRays[i].org + singleSIs[i].getDistance() * primaryRays[i].dir : eye;
+        Vector3D dir = lightPos - org;
+        float dist = dir.length();
+        shadowRays[i] = Ray(org, dir / dist, 0.0f);
+        shadowSegments[i] = RaySegment(Ray::Epsilon, dist * (1 - Ray::Epsilon));
+    }
+    segments = shadowSegments;
+    double shadowSingleTime = run(false, shadowRays, segments, singleSIs, singleHits);
+    segments = shadowSegments;
+    double shadowPacketTime = run(true, shadowRays, segments, packetSIs, packetHits);
+    for (int i = 0; i < numRays; ++i)
+        expectSameResult(singleHits[i], singleSIs[i], packetHits[i], packetSIs[i]);
+    
+    printf("Ray throughput (%u triangles, %u rays, packets of %u rays):\n", 4 * PacketTraversalScene::GridSize * PacketTraversalScene::GridSize, numRays, PacketSize);
+    printf("%10s %16s %16s\n", "rays", "single[Mrays/s]", "packet[Mrays/s]");
+    printf("%10s %16.3f %16.3f\n", "primary", numRays / primarySingleTime * 1e-6, numRays / primaryPacketTime * 1e-6);
+    printf("%10s %16.3f %16.3f\n", "shadow", numRays / shadowSingleTime * 1e-6, numRays / shadowPacketTime * 1e-6);
+}
+
+// JP: 統計が結び付けられたスレッドでの交差判定が、辿ったノードと判定したプリミティブを数えることを確かめる。
+// EN: check that intersection on a thread with bound statistics counts visited nodes and tested primitives.
+TEST(AcceleratorTest, TraversalStatistics) {
+    using namespace SLR;
+    PacketTraversalScene testScene;
+    const Scene &scene = *testScene.scene;
+    
+    RenderStatistics stats(2);
+    Ray ray(Point3D(0.0f, 1.0f, -2.0f), normalize(Vector3D(0.0f, -1.0f, 2.0f)), 0.0f);
+    RaySegment segment;
+    SurfaceInteraction si;
+    EXPECT_TRUE(scene.intersect(ray, segment, &si));
+    EXPECT_EQ(stats.threadStatistics(0)->counters[(uint32_t)StatCounter::BVHNodesVisited], 0);
+    {
+        ScopedThreadStatistics scopedStats(stats.threadStatistics(1));
+        segment = RaySegment();
+        si = SurfaceInteraction();
+        EXPECT_TRUE(scene.intersect(ray, segment, &si));
+    }
+    EXPECT_EQ(currentThreadStatistics(), nullptr);
+    
+    stats.finishPass();
+    EXPECT_GT(stats.counter(StatCounter::BVHNodesVisited), 0);
+    EXPECT_GT(stats.counter(StatCounter::PrimitivesTested), 0);
+    EXPECT_EQ(stats.threadStatistics(1)->counters[(uint32_t)StatCounter::BVHNodesVisited], 0);
+    EXPECT_EQ(stats.numPasses(), 1);
+}
+
+// JP: キャッシュから読み込んだSBVHが構築したものと同じ交差判定結果を与え、キーや内容が一致しないキャッシュは拒否されることを確かめる。
+// EN: check that an SBVH loaded from a cache gives the same intersection results as the built one,
+//     and that a cache with a mismatched key or contents is rejected.
+TEST(AcceleratorTest, BVHCache) {
+    using namespace SLR;
+    float values[2] = {0.5f, 0.5f};
+    const SpectrumTexture* reflectance = new ConstantSpectrumTexture(new RegularContinuousSpectrum(360, 830, values, 2));
+    const FloatTexture* sigma = nullptr;
+    const SurfaceMaterial* diffuse = new DiffuseReflectionSurfaceMaterial(reflectance, sigma);
+    
+    ArenaAllocator mem;
+    TriangleMeshNode* grid = PacketTraversalScene::createGrid(diffuse);
+    RenderingData data(nullptr);
+    grid->createRenderingData(&mem, nullptr, &data);
+    const std::vector<SurfaceObject*> &objs = data.surfObjs;
+    
+    const std::string path = "accelerator_test.slrbvh";
+    uint64_t key = BVHCache::computeKey(objs);
+    SBVH built(objs);
+    ASSERT_TRUE(BVHCache::store(path, key, built, objs));
+    std::unique_ptr<SBVH> loaded(BVHCache::load(path, key, objs));
+    ASSERT_NE(loaded, nullptr);
+    EXPECT_EQ(loaded->costForIntersect(), built.costForIntersect());
+    EXPECT_EQ(BVHCache::load(path, key + 1, objs), nullptr);
+    
+    QBVH builtQBVH(built);
+    QBVH loadedQBVH(*loaded);
+    XORShiftRNG rng(1509761209);
+    for (int i = 0; i < 4096; ++i) {
+        Point3D org(2 * rng.getFloat0cTo1o() - 1, 1.0f, 2 * rng.getFloat0cTo1o() - 1);
+        Vector3D dir = normalize(Vector3D(rng.getFloat0cTo1o() - 0.5f, -1.0f, rng.getFloat0cTo1o() - 0.5f));
+        Ray ray(org, dir, 0.0f);
+        SurfaceInteraction siBuilt, siLoaded;
+        uint32_t idxBuilt, idxLoaded;
+        bool hitBuilt = builtQBVH.intersect(ray, RaySegment(), &siBuilt, &idxBuilt);
+        bool hitLoaded = loadedQBVH.intersect(ray, RaySegment(), &siLoaded, &idxLoaded);
+        expectSameResult(hitBuilt, siBuilt, hitLoaded, siLoaded);
+    }
+    
+    // JP: 途中で切れたキャッシュは読み込まない。
+    // EN: a truncated cache is not loaded.
+    FILE* fp = fopen(path.c_str(), "rb");
+    ASSERT_NE(fp, nullptr);
+    std::vector<uint8_t> contents;
+    uint8_t buffer[4096];
+    size_t numRead;
+    while ((numRead = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+        contents.insert(contents.end(), buffer, buffer + numRead);
+    fclose(fp);
+    fp = fopen(path.c_str(), "wb");
+    fwrite(contents.data(), 1, contents.size() - sizeof(uint32_t), fp);
+    fclose(fp);
+    EXPECT_EQ(BVHCache::load(path, key, objs), nullptr);
+    std::remove(path.c_str());
+    
+    // JP: 頂点を動かすとキーが変わる。
+    // EN: moving a vertex changes the key.
+    grid->setVertex(0, Vertex(Point3D(-1.0f, 0.5f, -1.0f), Normal3D(0, 1, 0), Tangent3D(1, 0, 0), TexCoord2D(0, 0)));
+    EXPECT_NE(BVHCache::computeKey(objs), key);
+    
+    grid->destroyRenderingData(&mem);
+    delete grid;
+}
+
+// JP: まとめた交差判定が1本ずつの判定と同じ距離と法線を返し、プリミティブ番号が交差した物体を指すことを確かめる。
+// EN: check that batch intersection returns the same distances and normals as one-by-one intersection, and that primitive IDs point to the hit objects.
+TEST(AcceleratorTest, BatchQuery) {
+    using namespace SLR;
+    float values[2] = {0.5f, 0.5f};
+    const SpectrumTexture* reflectance = new ConstantSpectrumTexture(new RegularContinuousSpectrum(360, 830, values, 2));
+    const FloatTexture* sigma = nullptr;
+    const SurfaceMaterial* diffuse = new DiffuseReflectionSurfaceMaterial(reflectance, sigma);
+    
+    ArenaAllocator mem;
+    TriangleMeshNode* grid = PacketTraversalScene::createGrid(diffuse);
+    RenderingData data(nullptr);
+    grid->createRenderingData(&mem, nullptr, &data);
+    std::vector<SurfaceObject*> &objs = data.surfObjs;
+    SurfaceObjectAggregate aggregate(objs);
+    
+    // JP: 象限の混ざった光線。一部は上を向き、一部は距離の上限を持つ。
+    // EN: rays with mixed octants. Some of them point upward, and some have a distance limit.
+    const uint32_t numRays = 10000;
+    std::vector<float> orgX(numRays), orgY(numRays), orgZ(numRays);
+    std::vector<float> dirX(numRays), dirY(numRays), dirZ(numRays);
+    std::vector<float> distMax(numRays);
+    XORShiftRNG rng(2837640173);
+    for (int i = 0; i < numRays; ++i) {
+        orgX[i] = 2 * rng.getFloat0cTo1o() - 1;
+        orgY[i] = 0.5f + 0.5f * rng.getFloat0cTo1o();
+        orgZ[i] = 2 * rng.getFloat0cTo1o() - 1;
+        float dy = rng.getFloat0cTo1o() < 0.1f ? 1.0f : -1.0f;
+        Vector3D dir = normalize(Vector3D(2 * rng.getFloat0cTo1o() - 1, dy, 2 * rng.getFloat0cTo1o() - 1));
+        dirX[i] = dir.x;
+        dirY[i] = dir.y;
+        dirZ[i] = dir.z;
+        distMax[i] = i % 4 == 0 ? 0.5f : INFINITY;
+    }
+    RayBatch rays;
+    rays.orgX = orgX.data();
+    rays.orgY = orgY.data();
+    rays.orgZ = orgZ.data();
+    rays.dirX = dirX.data();
+    rays.dirY = dirY.data();
+    rays.dirZ = dirZ.data();
+    rays.distMax = distMax.data();
+    rays.numRays = numRays;
+    
+    std::vector<float> dists(numRays), normalX(numRays), normalY(numRays), normalZ(numRays);
+    std::vector<uint32_t> primIDs(numRays);
+    RayBatchHits hits;
+    hits.dist = dists.data();
+    hits.primIDs = primIDs.data();
+    hits.normalX = normalX.data();
+    hits.normalY = normalY.data();
+    hits.normalZ = normalZ.data();
+    aggregate.intersectBatch(rays, hits, 4);
+    
+    std::vector<float> serialDists(numRays);
+    RayBatchHits serialHits;
+    serialHits.dist = serialDists.data();
+    aggregate.intersectBatch(rays, serialHits, 1);
+    
+    uint32_t numHits = 0;
+    for (int i = 0; i < numRays; ++i) {
+        Ray ray(Point3D(orgX[i], orgY[i], orgZ[i]), Vector3D(dirX[i], dirY[i], dirZ[i]), 0.0f);
+        SurfaceInteraction si;
+        bool hit = aggregate.intersect(ray, RaySegment(0.0f, distMax[i]), &si);
+        EXPECT_EQ(dists[i], serialDists[i]);
+        EXPECT_EQ(primIDs[i] != UINT32_MAX, hit);
+        if (!hit) {
+            EXPECT_EQ(dists[i], INFINITY);
+            continue;
+        }
+        ++numHits;
+        EXPECT_EQ(dists[i], si.getDistance());
+        EXPECT_EQ(normalX[i], si.getGeometricNormal().x);
+        EXPECT_EQ(normalY[i], si.getGeometricNormal().y);
+        EXPECT_EQ(normalZ[i], si.getGeometricNormal().z);
+        
+        ASSERT_LT(primIDs[i], objs.size());
+        SurfaceInteraction siObj;
+        EXPECT_TRUE(objs[primIDs[i]]->intersect(ray, RaySegment(0.0f, distMax[i]), &siObj));
+        EXPECT_EQ(siObj.getDistance(), dists[i]);
+    }
+    EXPECT_GT(numHits, numRays / 4);
+    EXPECT_LT(numHits, numRays);
+    
+    grid->destroyRenderingData(&mem);
+    delete grid;
+}
@@ -0,0 +1,380 @@
+//
+//  checkpoint_tests.cpp
+//
+//  Created by 渡部 心 on 2017/06/18.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include <libSLR/Core/light_path_sampler.h>
+#include <libSLR/Core/ImageSensor.h>
+#include <libSLR/Core/PassScheduler.h>
+#include <libSLR/Core/RenderSettings.h>
+#include <libSLR/BasicTypes/spectrum_library.h>
+#include <libSLR/Renderer/PTRenderer.h>
+#include <libSLR/Renderer/BPTRenderer.h>
+
+#include "test_scene.h"
+
+// JP: 簡略化したレンダラー。各スレッドのサンプラーで主バッファと分離されたバッファに寄与を加算する。
+// EN: a simplified renderer which adds contributions to the main and the separated buffers using each thread's sampler.
+struct CheckpointTestRenderer {
+    static const uint32_t Width = 16;
+    static const uint32_t Height = 16;
+    static const uint32_t NumThreads = 2;
+    
+    SLR::ImageSensor sensor;
+    SLR::LightPathSampler* samplers[NumThreads];
+    SLR::RenderSettings settings;
+    
+    CheckpointTestRenderer(SLR::LightPathSamplerType type, uint32_t numPasses, const std::string &checkpointPath, const std::string &resumePath) :
+    sensor(1.0f) {
+        using namespace SLR;
+        for (int i = 0; i < NumThreads; ++i)
+            samplers[i] = createLightPathSampler(type, 1509761209, 123456789 + i);
+        settings.addItem(RenderSettingItem::Brightness, 1.0f);
+        settings.addItem(RenderSettingItem::TimeLimit, 0.0f);
+        settings.addItem(RenderSettingItem::TargetNoise, 0.0f);
+        settings.addItem(RenderSettingItem::CheckpointPath, checkpointPath);
+        settings.addItem(RenderSettingItem::CheckpointInterval, 0.0f);
+        settings.addItem(RenderSettingItem::ResumePath, resumePath);
+        settings.addItem(RenderSettingItem::ExportInterval, 0);
+        settings.addItem(RenderSettingItem::ExportTimeInterval, 0.0f);
+        settings.addItem(RenderSettingItem::PassRangeIndex, 0);
+        settings.addItem(RenderSettingItem::NumPassRanges, 1);
+        
+        sensor.init(Width, Height);
+        sensor.addSeparatedBuffers(NumThreads);
+        
+        PassScheduler scheduler(settings, numPasses);
+        scheduler.begin(&sensor, samplers, NumThreads);
+        for (uint32_t s = scheduler.numPasses(); s < scheduler.maxNumPasses(); ++s) {
+            // JP: 行ごとに固定のスレッドに割り当てて、実行順序に依らない結果にする。
+            // EN: assign each row to a fixed thread to make the result independent of the execution order.
+            for (int py = 0; py < Height; ++py) {
+                uint32_t threadID = py % NumThreads;
+                LightPathSampler &sampler = *samplers[threadID];
+                for (int px = 0; px < Width; ++px) {
+                    sampler.startPixelSample(px, py, s);
+                    PixelPosition p = sampler.getPixelPositionSample(px, py);
+                    float pdf;
+                    WavelengthSamples wls = WavelengthSamples::createWithEqualOffsets(sampler.getWavelengthSample(), sampler.getWLSelectionSample(), &pdf);
+                    sensor.add(p.x, p.y, wls, SampledSpectrum(sampler.getBSDFSample().uDir[0] / pdf));
+                    // JP: 自由行程サンプラーはどのサンプラーでも疑似乱数を消費する。
+                    // EN: the free-path sampler consumes the PRNG in every sampler.
+                    float u = sampler.getFreePathSampler().getSample();
+                    sensor.add(threadID, Width * u, p.y, wls, SampledSpectrum(u / pdf));
+                }
+            }
+            if (!scheduler.finishPass(&sensor))
+                break;
+        }
+    }
+    ~CheckpointTestRenderer() {
+        for (int i = 0; i < NumThreads; ++i)
+            delete samplers[i];
+    }
+    
+    void dumpState(std::vector<uint8_t>* state) const {
+        FILE* fp = tmpfile();
+        ASSERT_TRUE(sensor.writeState(fp));
+        for (int i = 0; i < NumThreads; ++i)
+            ASSERT_TRUE(samplers[i]->writeState(fp));
+        state->resize(ftell(fp));
+        rewind(fp);
+        ASSERT_EQ(fread(state->data(), state->size(), 1, fp), 1);
+        fclose(fp);
+    }
+};
+
+TEST(CheckpointTest, ResumeIsBitIdentical) {
+    using namespace SLR;
+    
+    const LightPathSamplerType types[] = {LightPathSamplerType::Independent, LightPathSamplerType::Sobol, LightPathSamplerType::Halton};
+    const char* checkpointPath = "checkpoint_test.slrckpt";
+    for (int t = 0; t < lengthof(types); ++t) {
+        std::vector<uint8_t> uninterrupted, resumed;
+        {
+            CheckpointTestRenderer renderer(types[t], 13, "", "");
+            renderer.dumpState(&uninterrupted);
+        }
+        // JP: 5パスで中断したとみなし、書き出されたチェックポイントから13パスまで再開する。
+        // EN: regard rendering as interrupted at 5 passes, and resume up to 13 passes from the written checkpoint.
+        {
+            CheckpointTestRenderer renderer(types[t], 5, checkpointPath, "");
+        }
+        {
+            CheckpointTestRenderer renderer(types[t], 13, "", checkpointPath);
+            renderer.dumpState(&resumed);
+        }
+        std::remove(checkpointPath);
+        
+        ASSERT_EQ(uninterrupted.size(), resumed.size());
+        EXPECT_TRUE(uninterrupted == resumed);
+    }
+}
+
+TEST(CheckpointTest, MismatchedCheckpointIsRejected) {
+    using namespace SLR;
+    
+    const char* checkpointPath = "checkpoint_test.slrckpt";
+    {
+        CheckpointTestRenderer renderer(LightPathSamplerType::Independent, 3, checkpointPath, "");
+    }
+    
+    // JP: 解像度が異なるセンサーには復元せず、最初からレンダリングできる状態を保つ。
+    // EN: the state must not be restored to a sensor with a different resolution, keeping it ready to render from scratch.
+    RenderSettings settings;
+    settings.addItem(RenderSettingItem::Brightness, 1.0f);
+    settings.addItem(RenderSettingItem::TimeLimit, 0.0f);
+    settings.addItem(RenderSettingItem::TargetNoise, 0.0f);
+    settings.addItem(RenderSettingItem::CheckpointPath, std::string(""));
+    settings.addItem(RenderSettingItem::CheckpointInterval, 0.0f);
+    settings.addItem(RenderSettingItem::ResumePath, std::string(checkpointPath));
+    settings.addItem(RenderSettingItem::ExportInterval, 0);
+    settings.addItem(RenderSettingItem::ExportTimeInterval, 0.0f);
+    settings.addItem(RenderSettingItem::PassRangeIndex, 0);
+    settings.addItem(RenderSettingItem::NumPassRanges, 1);
+    ImageSensor sensor(1.0f);
+    sensor.init(8, 8);
+    sensor.addSeparatedBuffers(CheckpointTestRenderer::NumThreads);
+    LightPathSampler* samplers[CheckpointTestRenderer::NumThreads];
+    for (int i = 0; i < CheckpointTestRenderer::NumThreads; ++i)
+        samplers[i] = createLightPathSampler(LightPathSamplerType::Independent, 1509761209, 123456789 + i);
+    PassScheduler scheduler(settings, 3);
+    scheduler.begin(&sensor, samplers, CheckpointTestRenderer::NumThreads);
+    EXPECT_EQ(scheduler.numPasses(), 0);
+    for (int i = 0; i < CheckpointTestRenderer::NumThreads; ++i)
+        delete samplers[i];
+    
+    // JP: 解像度が壊れたチェックポイントは、巨大なセンサーを確保せずに拒否する。
+    // EN: a checkpoint with a corrupted resolution is rejected without allocating a huge sensor.
+    FILE* fp = fopen(checkpointPath, "r+b");
+    ASSERT_NE(fp, nullptr);
+    const uint32_t hugeResolution[2] = {1u << 30, 1u << 30};
+    fseek(fp, sizeof(char) * 8 + sizeof(uint32_t) * 6 + sizeof(float), SEEK_SET);
+    fwrite(hugeResolution, sizeof(hugeResolution), 1, fp);
+    fseek(fp, 0, SEEK_SET);
+    ImageSensor corruptedSensor(1.0f);
+    uint32_t numPasses;
+    EXPECT_FALSE(PassScheduler::readCheckpointSensor(fp, &corruptedSensor, &numPasses));
+    fclose(fp);
+    std::remove(checkpointPath);
+}
+
+TEST(CheckpointTest, ExportIntervalInPasses) {
+    using namespace SLR;
+    
+    RenderSettings settings;
+    settings.addItem(RenderSettingItem::Brightness, 1.0f);
+    settings.addItem(RenderSettingItem::TimeLimit, 0.0f);
+    settings.addItem(RenderSettingItem::TargetNoise, 0.0f);
+    settings.addItem(RenderSettingItem::CheckpointPath, std::string(""));
+    settings.addItem(RenderSettingItem::CheckpointInterval, 0.0f);
+    settings.addItem(RenderSettingItem::ResumePath, std::string(""));
+    settings.addItem(RenderSettingItem::ExportInterval, 3);
+    settings.addItem(RenderSettingItem::ExportTimeInterval, 0.0f);
+    settings.addItem(RenderSettingItem::PassRangeIndex, 0);
+    settings.addItem(RenderSettingItem::NumPassRanges, 1);
+    ImageSensor sensor(1.0f);
+    sensor.init(8, 8);
+    
+    // JP: 3パスごとと最後のパスで出力する。
+    // EN: export every 3 passes and at the last pass.
+    PassScheduler scheduler(settings, 10);
+    scheduler.begin(&sensor, nullptr, 0);
+    std::vector<uint32_t> exportedPasses;
+    for (uint32_t s = 0; s < scheduler.maxNumPasses(); ++s) {
+        bool finished = !scheduler.finishPass(&sensor);
+        if (scheduler.shouldExport(finished)) {
+            exportedPasses.push_back(s + 1);
+            if (finished)
+                break;
+            scheduler.advanceExport();
+        }
+    }
+    EXPECT_EQ(exportedPasses, (std::vector<uint32_t>{3, 6, 9, 10}));
+    EXPECT_EQ(scheduler.numExportedImages(), 3);
+}
+
+TEST(CheckpointTest, ExportCountIsRestored) {
+    using namespace SLR;
+    
+    const char* checkpointPath = "checkpoint_test.slrckpt";
+    RenderSettings settings;
+    settings.addItem(RenderSettingItem::Brightness, 1.0f);
+    settings.addItem(RenderSettingItem::TimeLimit, 0.0f);
+    settings.addItem(RenderSettingItem::TargetNoise, 0.0f);
+    settings.addItem(RenderSettingItem::CheckpointPath, std::string(checkpointPath));
+    settings.addItem(RenderSettingItem::CheckpointInterval, 0.0f);
+    settings.addItem(RenderSettingItem::ResumePath, std::string(""));
+    settings.addItem(RenderSettingItem::ExportInterval, 0);
+    settings.addItem(RenderSettingItem::ExportTimeInterval, 0.001f);
+    settings.addItem(RenderSettingItem::PassRangeIndex, 0);
+    settings.addItem(RenderSettingItem::NumPassRanges, 1);
+    ImageSensor sensor(1.0f);
+    sensor.init(8, 8);
+    
+    // JP: 各パスが出力の時間間隔より長くかかるため、2の冪以外のパスでも出力される。
+    // EN: each pass takes longer than the export time interval, so images are exported at non-power-of-two passes too.
+    uint32_t numExports = 0;
+    {
+        PassScheduler scheduler(settings, 5);
+        scheduler.begin(&sensor, nullptr, 0);
+        for (uint32_t s = 0; s < scheduler.maxNumPasses(); ++s) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            bool finished = !scheduler.finishPass(&sensor);
+            if (scheduler.shouldExport(finished)) {
+                ++numExports;
+                if (finished)
+                    break;
+                scheduler.advanceExport();
+            }
+        }
+    }
+    EXPECT_EQ(numExports, 5);
+    
+    // JP: 再開後の画像の番号は、時間間隔による出力も含めて続きから始まる。
+    // EN: the image index after resuming continues from the exports including those by the time interval.
+    settings.addItem(RenderSettingItem::CheckpointPath, std::string(""));
+    settings.addItem(RenderSettingItem::ResumePath, std::string(checkpointPath));
+    PassScheduler scheduler(settings, 8);
+    sensor.clear();
+    scheduler.begin(&sensor, nullptr, 0);
+    EXPECT_EQ(scheduler.numPasses(), 5);
+    EXPECT_EQ(scheduler.numExportedImages(), numExports);
+    std::remove(checkpointPath);
+}
+
+TEST(CheckpointTest, TimeLimitCountsTimeBeforeResume) {
+    using namespace SLR;
+    
+    const char* checkpointPath = "checkpoint_test.slrckpt";
+    RenderSettings settings;
+    settings.addItem(RenderSettingItem::Brightness, 1.0f);
+    settings.addItem(RenderSettingItem::TimeLimit, 0.35f);
+    settings.addItem(RenderSettingItem::TargetNoise, 0.0f);
+    settings.addItem(RenderSettingItem::CheckpointPath, std::string(checkpointPath));
+    settings.addItem(RenderSettingItem::CheckpointInterval, 0.0f);
+    settings.addItem(RenderSettingItem::ResumePath, std::string(""));
+    settings.addItem(RenderSettingItem::ExportInterval, 0);
+    settings.addItem(RenderSettingItem::ExportTimeInterval, 0.0f);
+    settings.addItem(RenderSettingItem::PassRangeIndex, 0);
+    settings.addItem(RenderSettingItem::NumPassRanges, 1);
+    ImageSensor sensor(1.0f);
+    sensor.init(8, 8);
+    
+    // JP: 各パスに0.1秒かかるので、4パス目が制限時間を超えると予測して3パスで止まる。
+    // EN: each pass takes 0.1 seconds, so rendering stops after 3 passes predicting that the 4th pass exceeds the time limit.
+    {
+        PassScheduler scheduler(settings, 100);
+        scheduler.begin(&sensor, nullptr, 0);
+        while (true) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            if (!scheduler.finishPass(&sensor))
+                break;
+        }
+        EXPECT_EQ(scheduler.numPasses(), 3);
+    }
+    
+    // JP: 再開後の制限時間は中断前の時間を含めて数えるので、1パスで止まる。
+    // EN: the time limit after resuming counts the time before interruption, so rendering stops after one pass.
+    settings.addItem(RenderSettingItem::CheckpointPath, std::string(""));
+    settings.addItem(RenderSettingItem::ResumePath, std::string(checkpointPath));
+    PassScheduler scheduler(settings, 100);
+    sensor.clear();
+    scheduler.begin(&sensor, nullptr, 0);
+    EXPECT_EQ(scheduler.numPasses(), 3);
+    EXPECT_GE(scheduler.elapsedTime(), 0.3f);
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        if (!scheduler.finishPass(&sensor))
+            break;
+    }
+    EXPECT_EQ(scheduler.numPasses(), 4);
+    std::remove(checkpointPath);
+}
+
+// JP: 実際のレンダラーで書き出されたチェックポイントから、センサーの蓄積状態のみを取り出す。
+// EN: extract only the accumulation state of the sensor from a checkpoint written by an actual renderer.
+static void readCheckpointedSensorState(const char* path, uint32_t expectedNumPasses, std::vector<uint8_t>* state) {
+    using namespace SLR;
+    FILE* fp = fopen(path, "rb");
+    ASSERT_NE(fp, nullptr) << path;
+    ImageSensor sensor(1.0f);
+    uint32_t numPasses;
+    bool success = PassScheduler::readCheckpointSensor(fp, &sensor, &numPasses);
+    fclose(fp);
+    ASSERT_TRUE(success) << path;
+    ASSERT_EQ(numPasses, expectedNumPasses) << path;
+    
+    fp = tmpfile();
+    ASSERT_TRUE(sensor.writeState(fp));
+    state->resize(ftell(fp));
+    rewind(fp);
+    ASSERT_EQ(fread(state->data(), state->size(), 1, fp), 1);
+    fclose(fp);
+}
+
+// JP: 実際のPT/BPTを複数スレッドで動かし、途中のチェックポイントから再開した結果が中断しない場合と一致することを確かめる。
+//     タイルを処理するスレッドは実行ごとに変わるため、サンプラーや分離されたバッファがスレッドに結びついていると一致しない。
+//     1スレッドでの結果とも比べ、スレッド数にも依らないことを確かめる。
+// EN: drive the actual PT/BPT with multiple threads, and check that the result resumed from an intermediate checkpoint matches the uninterrupted one.
+//     The thread processing a tile changes from run to run, so they don't match if samplers or separated buffers are tied to threads.
+//     Comparing with the result by a single thread also checks that it doesn't depend on the number of threads.
+TEST(CheckpointTest, ResumeIsBitIdenticalWithThreads) {
+    using namespace SLR;
+    
+    const uint32_t NumThreads = 4;
+    const uint32_t NumPasses = 6;
+    const char* checkpointPaths[] = {"uninterrupted.slrckpt", "interrupted.slrckpt", "resumed.slrckpt", "single.slrckpt"};
+    TestCornellBox cornellBox;
+    for (int r = 0; r < 2; ++r) {
+        std::unique_ptr<Renderer> renderers[2];
+        if (r == 0) {
+            renderers[0].reset(new PTRenderer(NumPasses));
+            renderers[1].reset(new PTRenderer(3));
+        }
+        else {
+            renderers[0].reset(new BPTRenderer(NumPasses));
+            renderers[1].reset(new BPTRenderer(3));
+        }
+        
+        RenderSettings settings = TestCornellBox::createSettings(NumThreads, 32, 24);
+        settings.addItem(RenderSettingItem::CheckpointPath, std::string(checkpointPaths[0]));
+        renderers[0]->render(cornellBox.scene(), settings);
+        
+        // JP: 3パスで中断したとみなし、書き出されたチェックポイントから6パスまで再開する。
+        // EN: regard rendering as interrupted at 3 passes, and resume up to 6 passes from the written checkpoint.
+        settings.addItem(RenderSettingItem::CheckpointPath, std::string(checkpointPaths[1]));
+        renderers[1]->render(cornellBox.scene(), settings);
+        settings.addItem(RenderSettingItem::CheckpointPath, std::string(checkpointPaths[2]));
+        settings.addItem(RenderSettingItem::ResumePath, std::string(checkpointPaths[1]));
+        renderers[0]->render(cornellBox.scene(), settings);
+        
+        RenderSettings singleSettings = TestCornellBox::createSettings(1, 32, 24);
+        singleSettings.addItem(RenderSettingItem::CheckpointPath, std::string(checkpointPaths[3]));
+        renderers[0]->render(cornellBox.scene(), singleSettings);
+        
+        std::vector<uint8_t> uninterrupted, resumed, single;
+        readCheckpointedSensorState(checkpointPaths[0], NumPasses, &uninterrupted);
+        readCheckpointedSensorState(checkpointPaths[2], NumPasses, &resumed);
+        readCheckpointedSensorState(checkpointPaths[3], NumPasses, &single);
+        for (const char* path : checkpointPaths)
+            std::remove(path);
+        for (int i = 0; i < 8; ++i) {
+            char path[16];
+            for (const char* ext : {"bmp", "json"}) {
+                snprintf(path, sizeof(path), "%03u.%s", i, ext);
+                std::remove(path);
+            }
+        }
+        
+        ASSERT_FALSE(uninterrupted.empty());
+        EXPECT_TRUE(uninterrupted == resumed) << "renderer: " << r;
+        EXPECT_TRUE(uninterrupted == single) << "renderer: " << r;
+    }
+}
@@ -0,0 +1,276 @@
+//
+//  distributed_tests.cpp
+//
+//  Created by 渡部 心 on 2017/06/26.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <thread>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <libSLR/Core/light_path_sampler.h>
+#include <libSLR/Core/ImageSensor.h>
+#include <libSLR/Core/PassScheduler.h>
+#include <libSLR/Core/RenderSettings.h>
+#include <libSLR/Core/DistributedRendering.h>
+#include <libSLR/BasicTypes/spectrum_library.h>
+#include <libSLR/RNG/XORShiftRNG.h>
+
+static const uint32_t s_numTestPasses = 12;
+
+// JP: 作業単位1つ分の簡略化したレンダリング。単位の乱数シードで初期化したサンプラーで、単位のパスの範囲の寄与を加算し、最後にチェックポイントを書き出す。
+// EN: simplified rendering of a work unit. This adds contributions of the unit's range of passes using samplers initialized by the unit's RNG seed
+//     and writes a checkpoint at the end.
+static void renderTestUnit(const SLR::RenderUnit &unit, const std::string &checkpointPath) {
+    using namespace SLR;
+    const uint32_t Width = 16;
+    const uint32_t Height = 16;
+    const uint32_t NumThreads = 2;
+    
+    ImageSensor sensor(1.0f);
+    sensor.init(Width, Height);
+    sensor.addSeparatedBuffers(NumThreads);
+    XORShiftRNG topRand(unit.rngSeed);
+    LightPathSampler* samplers[NumThreads];
+    for (int i = 0; i < NumThreads; ++i)
+        samplers[i] = createLightPathSampler(LightPathSamplerType::Independent, unit.rngSeed, topRand.getUInt());
+    
+    RenderSettings settings;
+    settings.addItem(RenderSettingItem::Brightness, 1.0f);
+    settings.addItem(RenderSettingItem::TimeLimit, 0.0f);
+    settings.addItem(RenderSettingItem::TargetNoise, 0.0f);
+    settings.addItem(RenderSettingItem::CheckpointPath, checkpointPath);
+    settings.addItem(RenderSettingItem::CheckpointInterval, INFINITY);
+    settings.addItem(RenderSettingItem::ResumePath, std::string(""));
+    settings.addItem(RenderSettingItem::ExportInterval, 0);
+    settings.addItem(RenderSettingItem::ExportTimeInterval, 0.0f);
+    settings.addItem(RenderSettingItem::PassRangeIndex, (int32_t)unit.index);
+    settings.addItem(RenderSettingItem::NumPassRanges, (int32_t)unit.numUnits);
+    
+    PassScheduler scheduler(settings, s_numTestPasses);
+    scheduler.begin(&sensor, samplers, NumThreads);
+    for (uint32_t s = scheduler.numPasses(); s < scheduler.maxNumPasses(); ++s) {
+        for (int py = 0; py < Height; ++py) {
+            uint32_t threadID = py % NumThreads;
+            LightPathSampler &sampler = *samplers[threadID];
+            for (int px = 0; px < Width; ++px) {
+                sampler.startPixelSample(px, py, s);
+                PixelPosition p = sampler.getPixelPositionSample(px, py);
+                float pdf;
+                WavelengthSamples wls = WavelengthSamples::createWithEqualOffsets(sampler.getWavelengthSample(), sampler.getWLSelectionSample(), &pdf);
+                sensor.add(p.x, p.y, wls, SampledSpectrum(sampler.getBSDFSample().uDir[0] / pdf));
+                float u = sampler.getBSDFSample().uDir[1];
+                sensor.add(threadID, Width * u, p.y, wls, SampledSpectrum(u / pdf));
+            }
+        }
+        scheduler.finishPass(&sensor);
+    }
+    
+    for (int i = 0; i < NumThreads; ++i)
+        delete samplers[i];
+}
+
+static bool sensorsEqual(const SLR::ImageSensor &a, const SLR::ImageSensor &b, uint32_t numSeparated) {
+    if (a.width() != b.width() || a.height() != b.height())
+        return false;
+    for (int y = 0; y < a.height(); ++y) {
+        for (int x = 0; x < a.width(); ++x) {
+            if (!(a.pixel(x, y) == b.pixel(x, y)))
+                return false;
+            for (int i = 0; i < numSeparated; ++i) {
+                if (!(a.pixel(i, x, y) == b.pixel(i, x, y)))
+                    return false;
+            }
+        }
+    }
+    return true;
+}
+
+// JP: 途中で落ちるワーカーを含む複数のワーカーで分散レンダリングし、全ての単位を1つのプロセスで順に合算した結果と一致することを確かめる。
+// EN: render in a distributed manner with multiple workers including one which fails on the way,
+//     and check that the result matches summing all the units in order in a single process.
+TEST(DistributedRenderingTest, MatchesSequentialMerge) {
+    using namespace SLR;
+    const uint32_t NumUnits = 8;
+    const int32_t BaseSeed = 1509761209;
+    
+    ImageSensor reference(1.0f);
+    uint32_t numRefPasses = 0;
+    for (uint32_t i = 0; i < NumUnits; ++i) {
+        const std::string path = "distributed_test_reference.slrckpt";
+        renderTestUnit(RenderUnit{i, NumUnits, renderUnitSeed(BaseSeed, i)}, path);
+        FILE* fp = fopen(path.c_str(), "rb");
+        ASSERT_NE(fp, nullptr);
+        ImageSensor unitSensor(1.0f);
+        uint32_t numPasses;
+        ASSERT_TRUE(PassScheduler::readCheckpointSensor(fp, &unitSensor, &numPasses));
+        fclose(fp);
+        std::remove(path.c_str());
+        ASSERT_TRUE(reference.accumulate(unitSensor));
+        numRefPasses += numPasses;
+    }
+    EXPECT_EQ(renderUnitSeed(BaseSeed, 0), BaseSeed);
+    EXPECT_EQ(numRefPasses, s_numTestPasses);
+    
+    RenderCoordinator coordinator(0, NumUnits, BaseSeed);
+    ASSERT_TRUE(coordinator.isListening());
+    
+    // JP: 最初のワーカーは最初の単位を受け取った後に接続を切る。他のワーカーはそれを待ってから接続する。
+    // EN: the first worker closes the connection after receiving its first unit. The other workers connect after that.
+    std::atomic<bool> faultyWorkerDone(false);
+    bool faultyResult = true;
+    std::thread faultyThread([&]() {
+        RenderWorker worker("localhost", coordinator.port(), "distributed_test_faulty.slrckpt");
+        faultyResult = worker.run([](const RenderUnit &unit, const std::string &path) { return false; });
+        faultyWorkerDone = true;
+    });
+    
+    const uint32_t NumWorkers = 3;
+    bool workerResults[NumWorkers];
+    std::vector<std::thread> workerThreads;
+    for (int i = 0; i < NumWorkers; ++i) {
+        workerThreads.emplace_back([&, i]() {
+            while (!faultyWorkerDone)
+                std::this_thread::yield();
+            RenderWorker worker("localhost", coordinator.port(), "distributed_test_worker" + std::to_string(i) + ".slrckpt");
+            workerResults[i] = worker.run([](const RenderUnit &unit, const std::string &path) {
+                renderTestUnit(unit, path);
+                return true;
+            });
+        });
+    }
+    
+    ImageSensor merged(1.0f);
+    uint32_t numPasses = 0;
+    EXPECT_TRUE(coordinator.run(&merged, &numPasses));
+    faultyThread.join();
+    for (int i = 0; i < NumWorkers; ++i)
+        workerThreads[i].join();
+    
+    EXPECT_FALSE(faultyResult);
+    for (int i = 0; i < NumWorkers; ++i)
+        EXPECT_TRUE(workerResults[i]);
+    EXPECT_EQ(coordinator.numReassignments(), 1);
+    EXPECT_EQ(numPasses, numRefPasses);
+    EXPECT_TRUE(sensorsEqual(merged, reference, 2));
+}
+
+// JP: パスの範囲はサンプル数を隙間なく覆い、空の範囲でもパス数0のチェックポイントが書き出される。
+// EN: pass ranges cover the sample count without gaps, and a checkpoint with zero passes is written even for an empty range.
+TEST(DistributedRenderingTest, PassRangesCoverSampleCount) {
+    using namespace SLR;
+    const uint32_t NumUnits = 16;
+    const char* path = "distributed_test_range.slrckpt";
+    
+    uint32_t nextPass = 0;
+    for (uint32_t i = 0; i < NumUnits; ++i) {
+        renderTestUnit(RenderUnit{i, NumUnits, renderUnitSeed(1509761209, i)}, path);
+        FILE* fp = fopen(path, "rb");
+        ASSERT_NE(fp, nullptr) << "unit: " << i;
+        ImageSensor unitSensor(1.0f);
+        uint32_t numPasses;
+        ASSERT_TRUE(PassScheduler::readCheckpointSensor(fp, &unitSensor, &numPasses));
+        fclose(fp);
+        std::remove(path);
+        EXPECT_EQ(numPasses, (i + 1) * s_numTestPasses / NumUnits - i * s_numTestPasses / NumUnits) << "unit: " << i;
+        nextPass += numPasses;
+    }
+    EXPECT_EQ(nextPass, s_numTestPasses);
+}
+
+// JP: 単位のレンダリングがタイムアウトより長くかかっても、ハートビートが届く限り単位は割り当て直されない。
+// EN: even if rendering a unit takes longer than the timeout, the unit is not reassigned as long as heartbeats arrive.
+TEST(DistributedRenderingTest, HeartbeatsKeepSlowUnitsAlive) {
+    using namespace SLR;
+    const uint32_t NumUnits = 2;
+    
+    RenderCoordinator coordinator(0, NumUnits, 1509761209, 0.2f);
+    ASSERT_TRUE(coordinator.isListening());
+    bool workerResult = false;
+    std::thread workerThread([&]() {
+        RenderWorker worker("localhost", coordinator.port(), "distributed_test_slow.slrckpt");
+        workerResult = worker.run([](const RenderUnit &unit, const std::string &path) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(600));
+            renderTestUnit(unit, path);
+            return true;
+        });
+        // JP: 割り当て直された単位が残ってもテストが止まらないよう、遅延のないワーカーで残りを処理する。
+        // EN: finish the rest with a worker without delay so that the test doesn't hang on reassigned units.
+        if (!workerResult) {
+            RenderWorker worker("localhost", coordinator.port(), "distributed_test_slow.slrckpt");
+            worker.run([](const RenderUnit &unit, const std::string &path) {
+                renderTestUnit(unit, path);
+                return true;
+            });
+        }
+    });
+    
+    ImageSensor merged(1.0f);
+    uint32_t numPasses = 0;
+    EXPECT_TRUE(coordinator.run(&merged, &numPasses));
+    workerThread.join();
+    EXPECT_TRUE(workerResult);
+    EXPECT_EQ(coordinator.numReassignments(), 0);
+    EXPECT_EQ(numPasses, s_numTestPasses);
+}
+
+// JP: 単位を受け取った後に何も送らなくなったワーカーは、タイムアウトで単位を失ったものとして扱われる。
+//     プロトコルのハンドシェイクだけを行う生のソケットでそのようなワーカーを模す。
+// EN: a worker which stops sending anything after receiving a unit is regarded as having lost the unit by the timeout.
+//     Such a worker is emulated by a raw socket which only performs the protocol handshake.
+TEST(DistributedRenderingTest, StalledWorkerIsReassigned) {
+    using namespace SLR;
+    const uint32_t NumUnits = 2;
+    
+    RenderCoordinator coordinator(0, NumUnits, 1509761209, 0.2f);
+    ASSERT_TRUE(coordinator.isListening());
+    
+    std::atomic<bool> stalledWorkerReceivedUnit(false);
+    std::atomic<bool> renderingDone(false);
+    std::thread stalledThread([&]() {
+        int s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(coordinator.port());
+        if (connect(s, (const sockaddr*)&addr, sizeof(addr)) == 0) {
+            const char magic[8] = {'S', 'L', 'R', 'D', 'I', 'S', 'T', '\0'};
+            const uint32_t version = 2;
+            char unitMessage[20];
+            if (send(s, magic, sizeof(magic), 0) == sizeof(magic) &&
+                send(s, &version, sizeof(version), 0) == sizeof(version) &&
+                recv(s, unitMessage, sizeof(unitMessage), MSG_WAITALL) == sizeof(unitMessage))
+                stalledWorkerReceivedUnit = true;
+        }
+        while (!renderingDone)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        close(s);
+    });
+    
+    bool workerResult = false;
+    std::thread workerThread([&]() {
+        while (!stalledWorkerReceivedUnit)
+            std::this_thread::yield();
+        RenderWorker worker("localhost", coordinator.port(), "distributed_test_healthy.slrckpt");
+        workerResult = worker.run([](const RenderUnit &unit, const std::string &path) {
+            renderTestUnit(unit, path);
+            return true;
+        });
+    });
+    
+    ImageSensor merged(1.0f);
+    uint32_t numPasses = 0;
+    EXPECT_TRUE(coordinator.run(&merged, &numPasses));
+    renderingDone = true;
+    stalledThread.join();
+    workerThread.join();
+    EXPECT_TRUE(workerResult);
+    EXPECT_EQ(coordinator.numReassignments(), 1);
+    EXPECT_EQ(numPasses, s_numTestPasses);
+}
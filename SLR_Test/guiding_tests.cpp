@@ -0,0 +1,192 @@
+//
+//  guiding_tests.cpp
+//
+//  Created by 渡部 心 on 2017/06/24.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#include <gtest/gtest.h>
+
+#include <libSLR/Core/SDTree.h>
+#include <libSLR/Core/geometry.h>
+#include <libSLR/Core/distributions.h>
+#include <libSLR/RNG/XORShiftRNG.h>
+
+// JP: サンプルした方向の確率密度が評価した確率密度と一致し、確率密度の球面上の積分が1になることを確かめる。
+// EN: check that the PDFs of sampled directions match evaluated PDFs, and that the PDF integrates to 1 over the sphere.
+TEST(DirectionalQuadTreeTest, PDFConsistency) {
+    using namespace SLR;
+    XORShiftRNG rng(1234567891);
+    
+    // JP: 一方向に集中した分布と弱い一様な分布を記録し、細分化を繰り返す。
+    // EN: record a distribution concentrated around a direction plus a weak uniform one, and repeat refinement.
+    const Vector3D axis = normalize(Vector3D(0.3f, -0.5f, 0.8f));
+    ReferenceFrame frame((Normal3D(axis)));
+    DirectionalQuadTree tree;
+    for (int it = 0; it < 4; ++it) {
+        for (int i = 0; i < 100000; ++i) {
+            if (i % 4 == 0)
+                tree.record(uniformSampleSphere(rng.getFloat0cTo1o(), rng.getFloat0cTo1o()), 1.0f);
+            else
+                tree.record(frame.fromLocal(uniformSampleCone(rng.getFloat0cTo1o(), rng.getFloat0cTo1o(), 0.98f)), 1.0f);
+        }
+        if (it < 3) {
+            DirectionalQuadTree learned = tree;
+            tree.refine(learned, 0.01f, 20);
+        }
+    }
+    EXPECT_GT(tree.numNodes(), 1);
+    
+    for (int i = 0; i < 10000; ++i) {
+        float dirPDF;
+        Vector3D dir = tree.sample(rng.getFloat0cTo1o(), rng.getFloat0cTo1o(), &dirPDF);
+        EXPECT_NEAR(dir.length(), 1.0f, 1e-4f);
+        float evaluatedPDF = tree.evaluatePDF(dir);
+        EXPECT_NEAR(evaluatedPDF / dirPDF, 1.0f, 1e-2f) << "dir: " << dir.toString();
+    }
+    
+    double integral = 0;
+    const uint32_t numSamples = 1000000;
+    for (int i = 0; i < numSamples; ++i)
+        integral += tree.evaluatePDF(uniformSampleSphere(rng.getFloat0cTo1o(), rng.getFloat0cTo1o())) * (4 * M_PI);
+    integral /= numSamples;
+    EXPECT_NEAR(integral, 1.0, 0.02);
+}
+
+
+
+// JP: 床に並んだ点における、小さな光源と弱い環境光からの拡散反射を推定する合成的な被積分関数。
+//     光源の方向は点ごとに異なるため、空間と方向の両方の学習が必要になる。
+//     積分の参照値は解析的に求まる(天頂角βの方向にある半頂角αの一様な円錐からのcosで重み付けた立体角は π sin^2(α) cos(β))。
+// EN: a synthetic integrand estimating diffuse reflection from a small light and weak ambient light at points lying on a floor.
+//     The direction of the light differs per point, so learning in both space and direction is required.
+//     The reference of the integral is analytic (cosine-weighted solid angle of a uniform cone with half angle alpha in the direction with zenith angle beta is pi sin^2(alpha) cos(beta)).
+struct SyntheticGuidingIntegrand {
+    static const uint32_t NumPointsX = 16;
+    static const uint32_t NumPointsY = 16;
+    static const uint32_t NumSamplesPerPass = 16;
+    static const uint32_t NumTrainingPasses = 32;
+    static const uint32_t NumPasses = 128;
+    
+    static constexpr float Albedo = 0.8f;
+    static constexpr float LightRadiance = 100.0f;
+    static constexpr float AmbientRadiance = 0.1f;
+    static constexpr float CosLightHalfAngle = 0.995f;
+    
+    static SLR::Point3D point(uint32_t ix, uint32_t iy) {
+        return SLR::Point3D(-0.4f + 0.8f * (ix + 0.5f) / NumPointsX, -0.4f + 0.8f * (iy + 0.5f) / NumPointsY, 0.0f);
+    }
+    
+    static SLR::Vector3D lightDirection(const SLR::Point3D &p) {
+        return normalize(SLR::Point3D(0.3f, -0.2f, 1.0f) - p);
+    }
+    
+    static float incidentRadiance(const SLR::Point3D &p, const SLR::Vector3D &dir) {
+        return dot(dir, lightDirection(p)) > CosLightHalfAngle ? LightRadiance : AmbientRadiance;
+    }
+    
+    static double reference(const SLR::Point3D &p) {
+        double sin2Alpha = 1 - CosLightHalfAngle * CosLightHalfAngle;
+        double projSolidAngle = sin2Alpha * lightDirection(p).z;
+        return Albedo * (LightRadiance * projSolidAngle + AmbientRadiance * (1 - projSolidAngle));
+    }
+    
+    struct Result {
+        double rmse;
+        uint32_t numLeaves;
+    };
+    
+    // JP: 法線を+zとするランバート反射を、BSDFのみ、またはBSDFとSD-treeの1サンプルMISで推定する。
+    //     レンダラーと同様に、学習中のパスの推定値も最終的な結果に含める。
+    // EN: estimate Lambertian reflection with the normal +z by the BSDF only, or one-sample MIS of the BSDF and an SD-tree.
+    //     As in the renderers, estimates of the passes during training are included in the final result.
+    static Result run(bool guided) {
+        using namespace SLR;
+        XORShiftRNG rng(2718281829);
+        SDTree tree(Point3D::Zero, 1.0f, 1000);
+        const float bsdfFrac = SDTree::BSDFSamplingFraction;
+        
+        std::vector<double> accum(NumPointsX * NumPointsY, 0.0);
+        uint32_t iterationStartPass = 0;
+        for (uint32_t s = 0; s < NumPasses; ++s) {
+            bool train = guided && s < NumTrainingPasses;
+            for (int iy = 0; iy < NumPointsY; ++iy) {
+                for (int ix = 0; ix < NumPointsX; ++ix) {
+                    Point3D p = point(ix, iy);
+                    uint32_t leafIdx = 0;
+                    const DirectionalQuadTree* guide = nullptr;
+                    if (guided) {
+                        leafIdx = tree.findLeaf(p);
+                        guide = &tree.getSamplingDistribution(leafIdx);
+                        if (!guide->hasDistribution())
+                            guide = nullptr;
+                    }
+                    
+                    double sum = 0;
+                    for (int i = 0; i < NumSamplesPerPass; ++i) {
+                        float uSel = rng.getFloat0cTo1o();
+                        float u0 = rng.getFloat0cTo1o();
+                        float u1 = rng.getFloat0cTo1o();
+                        Vector3D dir;
+                        float dirPDF;
+                        if (guide && uSel >= bsdfFrac) {
+                            float guidePDF;
+                            dir = guide->sample(u0, u1, &guidePDF);
+                            dirPDF = bsdfFrac * std::max(dir.z, 0.0f) / M_PI + (1 - bsdfFrac) * guidePDF;
+                        }
+                        else {
+                            dir = cosineSampleHemisphere(u0, u1);
+                            dirPDF = dir.z / M_PI;
+                            if (guide)
+                                dirPDF = bsdfFrac * dirPDF + (1 - bsdfFrac) * guide->evaluatePDF(dir);
+                        }
+                        if (dir.z <= 0 || dirPDF <= 0)
+                            continue;
+                        
+                        float Li = incidentRadiance(p, dir);
+                        sum += Albedo / M_PI * Li * dir.z / dirPDF;
+                        if (train)
+                            tree.record(leafIdx, dir, Li / dirPDF);
+                    }
+                    accum[iy * NumPointsX + ix] += sum / NumSamplesPerPass;
+                }
+            }
+            if (train && ((s + 1) & s) == 0) {
+                tree.update(s + 1 - iterationStartPass, 1);
+                iterationStartPass = s + 1;
+            }
+        }
+        
+        double sumSqError = 0;
+        for (int iy = 0; iy < NumPointsY; ++iy) {
+            for (int ix = 0; ix < NumPointsX; ++ix) {
+                double diff = accum[iy * NumPointsX + ix] / NumPasses - reference(point(ix, iy));
+                sumSqError += diff * diff;
+            }
+        }
+        
+        Result result;
+        result.rmse = std::sqrt(sumSqError / (NumPointsX * NumPointsY));
+        result.numLeaves = tree.numLeaves();
+        return result;
+    }
+};
+
+TEST(PathGuidingTest, SyntheticIntegrandRMSEBelowUnguided) {
+    SyntheticGuidingIntegrand::Result unguided = SyntheticGuidingIntegrand::run(false);
+    SyntheticGuidingIntegrand::Result guided = SyntheticGuidingIntegrand::run(true);
+    
+    printf("RMSE at equal sample counts (%ux%u points, %u passes x %u samples, %u training passes):\n",
+           SyntheticGuidingIntegrand::NumPointsX, SyntheticGuidingIntegrand::NumPointsY,
+           SyntheticGuidingIntegrand::NumPasses, SyntheticGuidingIntegrand::NumSamplesPerPass, SyntheticGuidingIntegrand::NumTrainingPasses);
+    printf("%10s %12s\n", "method", "RMSE");
+    printf("%10s %12.6f\n", "unguided", unguided.rmse);
+    printf("%10s %12.6f (%u spatial leaves)\n", "guided", guided.rmse, guided.numLeaves);
+    
+    // JP: 同じサンプル数での誤差のみを確かめる。この被積分関数の評価はレイトレーシングに比べて非常に安価なため、
+    //     時間あたりの誤差はレンダラーの性能を表さない。
+    // EN: only the error at the same number of samples is checked. Evaluating this integrand is far cheaper than ray tracing,
+    //     so error per time would not represent the renderer's performance.
+    EXPECT_GT(guided.numLeaves, 1);
+    EXPECT_LT(guided.rmse, unguided.rmse);
+}
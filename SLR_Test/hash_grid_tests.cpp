@@ -0,0 +1,63 @@
+//
+//  hash_grid_tests.cpp
+//
+//  Created by 渡部 心 on 2017/06/20.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#include <gtest/gtest.h>
+
+#include <libSLR/Core/PointHashGrid.h>
+#include <libSLR/RNG/XORShiftRNG.h>
+
+struct HashGridTestPoint {
+    SLR::Point3D position;
+    uint32_t index;
+};
+
+// JP: 複数の配列に分かれた点に対する格子の探索結果が総当たりの探索結果と一致することを確かめる。
+// EN: check that the results of grid queries over points split into multiple arrays match the results of brute-force search.
+TEST(PointHashGridTest, QueryMatchesBruteForce) {
+    using namespace SLR;
+    XORShiftRNG rng(2147095123);
+    
+    const uint32_t numChunks = 3;
+    const uint32_t numPointsPerChunk = 100000;
+    std::vector<std::vector<HashGridTestPoint>> chunks(numChunks);
+    for (int i = 0; i < numChunks; ++i) {
+        for (int j = 0; j < numPointsPerChunk; ++j) {
+            Point3D p(2 * rng.getFloat0cTo1o() - 1, 2 * rng.getFloat0cTo1o() - 1, 2 * rng.getFloat0cTo1o() - 1);
+            chunks[i].push_back(HashGridTestPoint{p, i * numPointsPerChunk + j});
+        }
+    }
+    std::vector<std::pair<const HashGridTestPoint*, uint32_t>> chunkRefs;
+    for (int i = 0; i < numChunks; ++i)
+        chunkRefs.emplace_back(chunks[i].data(), (uint32_t)chunks[i].size());
+    
+    // JP: 奇数番目の点はフィルターで除外する。
+    // EN: odd-indexed points are excluded by the filter.
+    const float radius = 0.05f;
+    PointHashGrid<HashGridTestPoint> grid;
+    grid.build(chunkRefs, radius, 4, [](const HashGridTestPoint &pt) { return pt.index % 2 == 0; });
+    EXPECT_EQ(grid.numPoints(), numChunks * numPointsPerChunk / 2);
+    
+    for (int q = 0; q < 200; ++q) {
+        Point3D p(2 * rng.getFloat0cTo1o() - 1, 2 * rng.getFloat0cTo1o() - 1, 2 * rng.getFloat0cTo1o() - 1);
+        
+        std::vector<uint32_t> found;
+        auto collect = [&found](const HashGridTestPoint &pt) { found.push_back(pt.index); };
+        grid.query(p, collect);
+        std::sort(found.begin(), found.end());
+        
+        std::vector<uint32_t> reference;
+        for (int i = 0; i < numChunks; ++i) {
+            for (int j = 0; j < numPointsPerChunk; ++j) {
+                const HashGridTestPoint &pt = chunks[i][j];
+                if (pt.index % 2 == 0 && sqDistance(pt.position, p) <= radius * radius)
+                    reference.push_back(pt.index);
+            }
+        }
+        
+        EXPECT_EQ(found, reference) << "query: " << q;
+    }
+}
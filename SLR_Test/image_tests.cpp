@@ -0,0 +1,187 @@
+//
+//  image_tests.cpp
+//
+//  Created by 渡部 心 on 2017/07/01.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#include <gtest/gtest.h>
+#include <thread>
+
+#include <libSLR/Core/image_2d.h>
+#include <libSLR/Core/TextureCache.h>
+#include <libSLR/Core/ImageExporter.h>
+#include <libSLR/RNG/XORShiftRNG.h>
+
+// JP: 行のまとまりを複数のスレッドから順不同で設定した画像が、線形なデータから一度に作った画像と一致することを確かめる。
+// EN: check that an image whose chunks of rows are set from multiple threads in arbitrary order matches an image made from linear data at once.
+TEST(ImageTest, SetRowsMatchesLinearData) {
+    using namespace SLR;
+    DefaultAllocator &defMem = DefaultAllocator::instance();
+    XORShiftRNG rng(1209581723);
+    
+    // JP: タイルの幅で割り切れない大きさにする。
+    // EN: use a size not divisible by the tile width.
+    const uint32_t width = 301;
+    const uint32_t height = 203;
+    std::vector<RGBA8x4> linearData(width * height);
+    for (int i = 0; i < linearData.size(); ++i) {
+        uint32_t value = rng.getUInt();
+        linearData[i] = RGBA8x4{uint8_t(value), uint8_t(value >> 8), uint8_t(value >> 16), uint8_t(128 + (value >> 25))};
+    }
+    
+    const ImageStoreMode modes[] = {ImageStoreMode::AsIs, ImageStoreMode::NormalTexture, ImageStoreMode::AlphaTexture};
+    for (ImageStoreMode mode : modes) {
+        TiledImage2D reference(linearData.data(), width, height, ColorFormat::RGBA8x4, &defMem, mode, SpectrumType::Reflectance);
+        
+        TiledImage2D chunked(width, height, ColorFormat::RGBA8x4, &defMem, mode, SpectrumType::Reflectance);
+        const uint32_t rowsPerChunk = 37;
+        const uint32_t numChunks = (height + rowsPerChunk - 1) / rowsPerChunk;
+        std::vector<std::thread> threads;
+        for (int c = numChunks - 1; c >= 0; --c) {
+            uint32_t yBegin = c * rowsPerChunk;
+            uint32_t numRows = std::min(rowsPerChunk, height - yBegin);
+            threads.emplace_back([&, yBegin, numRows]() {
+                chunked.setRows(linearData.data() + yBegin * width, yBegin, numRows);
+            });
+        }
+        for (std::thread &thread : threads)
+            thread.join();
+        
+        ASSERT_EQ(chunked.format(), reference.format());
+        size_t stride = sizesOfColorFormats[(uint32_t)reference.format()];
+        uint32_t numMismatches = 0;
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                if (std::memcmp(&chunked.get<uint8_t>(x, y), &reference.get<uint8_t>(x, y), stride) != 0)
+                    ++numMismatches;
+            }
+        }
+        EXPECT_EQ(numMismatches, 0);
+    }
+}
+
+// JP: タイル状のファイルに変換した画像が元の画像と一致し、容量を超えてタイルを追い出した後も同じ値を返すことを確かめる。
+// EN: check that an image converted into a tiled file matches the source image, and returns the same values even after evicting tiles beyond the capacity.
+TEST(ImageTest, PagedImageMatchesSource) {
+    using namespace SLR;
+    DefaultAllocator &defMem = DefaultAllocator::instance();
+    XORShiftRNG rng(3141592653);
+    
+    const uint32_t width = 301;
+    const uint32_t height = 203;
+    std::vector<RGBA8x4> linearData(width * height);
+    for (int i = 0; i < linearData.size(); ++i) {
+        uint32_t value = rng.getUInt();
+        linearData[i] = RGBA8x4{uint8_t(value), uint8_t(value >> 8), uint8_t(value >> 16), uint8_t(value >> 24)};
+    }
+    TiledImage2D source(linearData.data(), width, height, ColorFormat::RGBA8x4, &defMem, ImageStoreMode::AsIs, SpectrumType::Reflectance);
+    
+    std::string path = "paged_image_test.slrtex";
+    ASSERT_TRUE(PagedImage2D::write(path, source));
+    std::unique_ptr<PagedImage2D> paged(PagedImage2D::open(path));
+    ASSERT_NE(paged.get(), nullptr);
+    EXPECT_EQ(paged->width(), width);
+    EXPECT_EQ(paged->height(), height);
+    EXPECT_EQ(paged->format(), source.format());
+    
+    // JP: タイル4枚分の容量で全体を2回読み、追い出しを起こす。
+    // EN: read the entire image twice with the capacity of four tiles to cause eviction.
+    uint64_t prevCapacity = TextureCache::capacity();
+    uint64_t prevNumEvictedTiles = TextureCache::numEvictedTiles();
+    TextureCache::setCapacity(4 * paged->tileSize());
+    size_t stride = sizesOfColorFormats[(uint32_t)source.format()];
+    uint32_t numMismatches = 0;
+    for (int pass = 0; pass < 2; ++pass) {
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                if (std::memcmp(&paged->get<uint8_t>(x, y), &source.get<uint8_t>(x, y), stride) != 0)
+                    ++numMismatches;
+            }
+        }
+    }
+    EXPECT_EQ(numMismatches, 0);
+    EXPECT_GT(TextureCache::numEvictedTiles(), prevNumEvictedTiles);
+    EXPECT_LE(TextureCache::residentBytes(), TextureCache::capacity());
+    TextureCache::setCapacity(prevCapacity);
+    
+    paged.reset();
+    std::remove(path.c_str());
+}
+
+// JP: 別のスレッドで書き出した画像が、同期的に書き出した画像と一致することを確かめる。
+// EN: check that an image written on another thread matches an image written synchronously.
+TEST(ImageTest, ExporterMatchesSaveImage) {
+    using namespace SLR;
+    XORShiftRNG rng(2718281828);
+    
+    ImageSensor sensor(1.0f);
+    sensor.init(67, 45);
+    sensor.addSeparatedBuffers(2);
+    for (int i = 0; i < 10000; ++i) {
+        float pdf;
+        WavelengthSamples wls = WavelengthSamples::createWithEqualOffsets(rng.getFloat0cTo1o(), rng.getFloat0cTo1o(), &pdf);
+        sensor.add(sensor.width() * rng.getFloat0cTo1o(), sensor.height() * rng.getFloat0cTo1o(), wls, SampledSpectrum(rng.getFloat0cTo1o() / pdf));
+        sensor.add(i % 2, sensor.width() * rng.getFloat0cTo1o(), sensor.height() * rng.getFloat0cTo1o(), wls, SampledSpectrum(rng.getFloat0cTo1o() / pdf));
+    }
+    
+    sensor.saveImage("exporter_test_sync.bmp", 0.5f);
+    {
+        ImageExporter exporter;
+        exporter.exportImage(sensor, "exporter_test_async.bmp", 0.5f);
+        // JP: 確定後のセンサーへの変更は書き出す画像に影響しない。
+        // EN: changes to the sensor after resolving don't affect the image to be written.
+        sensor.clear();
+    }
+    
+    auto readFile = [](const char* path) {
+        std::vector<uint8_t> data;
+        FILE* fp = fopen(path, "rb");
+        if (fp) {
+            int c;
+            while ((c = fgetc(fp)) != EOF)
+                data.push_back((uint8_t)c);
+            fclose(fp);
+        }
+        return data;
+    };
+    std::vector<uint8_t> syncData = readFile("exporter_test_sync.bmp");
+    std::vector<uint8_t> asyncData = readFile("exporter_test_async.bmp");
+    std::remove("exporter_test_sync.bmp");
+    std::remove("exporter_test_async.bmp");
+    ASSERT_FALSE(syncData.empty());
+    EXPECT_TRUE(syncData == asyncData);
+}
+
+// JP: サンプル数と分離されたバッファのスケールを含めて、複製から確定した値が元のセンサーから確定した値と一致することを確かめる。
+// EN: check that values resolved from the copy match those resolved from the original sensor including sample counts and scales of separated buffers.
+TEST(ImageTest, CopyForResolveMatchesSource) {
+    using namespace SLR;
+    XORShiftRNG rng(1414213562);
+    
+    ImageSensor sensor(1.0f);
+    sensor.init(45, 67);
+    sensor.addSeparatedBuffers(2);
+    sensor.enableVarianceEstimation();
+    for (int i = 0; i < 10000; ++i) {
+        float pdf;
+        WavelengthSamples wls = WavelengthSamples::createWithEqualOffsets(rng.getFloat0cTo1o(), rng.getFloat0cTo1o(), &pdf);
+        sensor.addPixelSample(sensor.width() * rng.getFloat0cTo1o(), sensor.height() * rng.getFloat0cTo1o(), wls, SampledSpectrum(rng.getFloat0cTo1o() / pdf));
+        sensor.add(i % 2, sensor.width() * rng.getFloat0cTo1o(), sensor.height() * rng.getFloat0cTo1o(), wls, SampledSpectrum(rng.getFloat0cTo1o() / pdf));
+    }
+    
+    const float scaleSeparated[] = {0.25f, 2.0f};
+    const size_t numValues = (size_t)sensor.width() * sensor.height() * ImageSensor::numImageChannels(sensor.imageFileFormat());
+    std::vector<float> expected(numValues);
+    sensor.resolve(0.5f, scaleSeparated, expected.data());
+    
+    // JP: 構成の異なる複製先も元のセンサーに合わせて作り直される。
+    // EN: a copy destination with a different configuration is rebuilt to match the original sensor.
+    ImageSensor copy(1.0f);
+    copy.init(8, 8);
+    copy.copyForResolve(sensor);
+    sensor.clear();
+    std::vector<float> resolved(numValues);
+    copy.resolve(0.5f, scaleSeparated, resolved.data());
+    EXPECT_TRUE(expected == resolved);
+}
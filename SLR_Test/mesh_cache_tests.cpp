@@ -0,0 +1,282 @@
+//
+//  mesh_cache_tests.cpp
+//
+//  Created by 渡部 心 on 2017/06/28.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <dirent.h>
+
+#include <libSLR/Core/geometry.h>
+#include <libSLR/Core/transform.h>
+#include <libSLR/Core/MeshCache.h>
+#include <libSLR/MemoryAllocators/ArenaAllocator.h>
+#include <libSLR/BasicTypes/spectrum_types.h>
+#include <libSLR/BasicTypes/spectrum_library.h>
+#include <libSLR/Scene/Scene.h>
+#include <libSLR/Scene/node.h>
+#include <libSLR/Scene/TriangleMeshNode.h>
+#include <libSLR/Texture/constant_textures.h>
+#include <libSLR/SurfaceMaterial/basic_surface_materials.h>
+#include <libSLR/RNG/XORShiftRNG.h>
+
+// JP: 起伏のある格子状のメッシュを作る。
+// EN: create bumpy grid mesh.
+static void createGridMesh(uint32_t gridSize, std::vector<SLR::Vertex>* vertices, std::vector<uint32_t>* indices) {
+    using namespace SLR;
+    const uint32_t numVertsPerSide = gridSize + 1;
+    vertices->clear();
+    for (int iz = 0; iz < numVertsPerSide; ++iz) {
+        for (int ix = 0; ix < numVertsPerSide; ++ix) {
+            float x = -1.0f + 2.0f * ix / gridSize;
+            float z = -1.0f + 2.0f * iz / gridSize;
+            float y = 0.1f * std::sin(13.0f * x) * std::cos(11.0f * z);
+            vertices->push_back(Vertex(Point3D(x, y, z), Normal3D(0, 1, 0), Tangent3D(1, 0, 0),
+                                       TexCoord2D((float)ix / gridSize, (float)iz / gridSize)));
+        }
+    }
+    indices->clear();
+    for (int iz = 0; iz < gridSize; ++iz) {
+        for (int ix = 0; ix < gridSize; ++ix) {
+            uint32_t base = iz * numVertsPerSide + ix;
+            uint32_t tris[] = {
+                base, base + numVertsPerSide, base + numVertsPerSide + 1,
+                base, base + numVertsPerSide + 1, base + 1
+            };
+            indices->insert(indices->end(), tris, tris + 6);
+        }
+    }
+}
+
+static bool writeGridCache(const std::string &path, uint32_t gridSize) {
+    std::vector<SLR::Vertex> vertices;
+    std::vector<uint32_t> indices;
+    createGridMesh(gridSize, &vertices, &indices);
+    
+    SLR::MeshCacheWriter writer;
+    writer.setSource(1234, 5678);
+    writer.addMaterial(std::vector<uint8_t>{1, 2, 3, 4, 5});
+    writer.addMesh("grid", vertices.data(), (uint32_t)vertices.size(), indices.data(), (uint32_t)indices.size() / 3, 0);
+    const float identity[16] = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1};
+    writer.addNode("root", identity, std::vector<uint32_t>{}, 1);
+    writer.addNode("child", identity, std::vector<uint32_t>{0}, 0);
+    return writer.write(path);
+}
+
+// JP: 書き出したキャッシュを読み込んで内容が一致し、頂点配列がページ境界に揃っていることを確かめる。
+// EN: check that a written cache is read back with the same contents and its vertex arrays are aligned to page boundaries.
+TEST(MeshCacheTest, RoundTrip) {
+    using namespace SLR;
+    const std::string path = "mesh_cache_test.slrmesh";
+    const uint32_t GridSize = 16;
+    ASSERT_TRUE(writeGridCache(path, GridSize));
+    
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+    createGridMesh(GridSize, &vertices, &indices);
+    {
+        std::shared_ptr<MeshCache> cache = MeshCache::open(path);
+        ASSERT_NE(cache, nullptr);
+        EXPECT_EQ(cache->sourceFileSize(), 1234);
+        EXPECT_EQ(cache->sourceModifiedTime(), 5678);
+        
+        ASSERT_EQ(cache->numMeshes(), 1);
+        const MeshCache::Mesh &mesh = cache->mesh(0);
+        EXPECT_STREQ(mesh.name, "grid");
+        ASSERT_EQ(mesh.numVertices, vertices.size());
+        ASSERT_EQ(mesh.numTriangles, indices.size() / 3);
+        EXPECT_EQ(mesh.materialIndex, 0);
+        EXPECT_EQ((uintptr_t)mesh.positions % MeshCache::Alignment, 0);
+        EXPECT_EQ((uintptr_t)mesh.indices % MeshCache::Alignment, 0);
+        for (int i = 0; i < vertices.size(); ++i) {
+            EXPECT_EQ(mesh.positions[i], vertices[i].position);
+            EXPECT_EQ(mesh.texCoords[i].u, vertices[i].texCoord.u);
+            EXPECT_EQ(mesh.texCoords[i].v, vertices[i].texCoord.v);
+        }
+        for (int i = 0; i < indices.size(); ++i)
+            EXPECT_EQ(mesh.indices[i], indices[i]);
+        EXPECT_EQ(mesh.bounds.minP.x, -1.0f);
+        EXPECT_EQ(mesh.bounds.maxP.z, 1.0f);
+        
+        ASSERT_EQ(cache->numNodes(), 2);
+        EXPECT_STREQ(cache->node(0).name, "root");
+        EXPECT_EQ(cache->node(0).numChildren, 1);
+        EXPECT_EQ(cache->node(1).numMeshes, 1);
+        EXPECT_EQ(cache->node(1).meshIndices[0], 0);
+        
+        ASSERT_EQ(cache->numMaterials(), 1);
+        uint64_t size;
+        const uint8_t* data = cache->materialData(0, &size);
+        ASSERT_EQ(size, 5);
+        EXPECT_EQ(data[4], 5);
+    }
+    std::remove(path.c_str());
+}
+
+// JP: バージョンが異なるキャッシュ、途中で切れたキャッシュ、範囲外の頂点添字を含むキャッシュを拒否することを確かめる。
+// EN: check that a cache with a different version, a truncated cache and a cache with out-of-range vertex indices are rejected.
+TEST(MeshCacheTest, RejectsInvalidFiles) {
+    using namespace SLR;
+    const std::string path = "mesh_cache_test_invalid.slrmesh";
+    EXPECT_EQ(MeshCache::open(path), nullptr);
+    
+    ASSERT_TRUE(writeGridCache(path, 4));
+    FILE* fp = fopen(path.c_str(), "rb");
+    ASSERT_NE(fp, nullptr);
+    std::vector<uint8_t> contents;
+    uint8_t buffer[4096];
+    size_t numRead;
+    while ((numRead = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+        contents.insert(contents.end(), buffer, buffer + numRead);
+    fclose(fp);
+    
+    auto writeContents = [&path](const std::vector<uint8_t> &data) {
+        FILE* fp = fopen(path.c_str(), "wb");
+        fwrite(data.data(), 1, data.size(), fp);
+        fclose(fp);
+    };
+    
+    std::vector<uint8_t> modified = contents;
+    uint32_t version = MeshCache::Version + 1;
+    std::memcpy(&modified[8], &version, sizeof(version));
+    writeContents(modified);
+    EXPECT_EQ(MeshCache::open(path), nullptr);
+    
+    modified = contents;
+    modified.resize(contents.size() - 4);
+    writeContents(modified);
+    EXPECT_EQ(MeshCache::open(path), nullptr);
+    
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+    createGridMesh(4, &vertices, &indices);
+    indices[5] = (uint32_t)vertices.size();
+    MeshCacheWriter writer;
+    writer.addMaterial(std::vector<uint8_t>{0});
+    writer.addMesh("grid", vertices.data(), (uint32_t)vertices.size(), indices.data(), (uint32_t)indices.size() / 3, 0);
+    ASSERT_TRUE(writer.write(path));
+    EXPECT_EQ(MeshCache::open(path), nullptr);
+    
+    std::remove(path.c_str());
+}
+
+// JP: キャッシュを参照するメッシュと自身の配列を持つメッシュの交差判定が、変換の有無に関わらず一致することを確かめる。
+// EN: check that intersection with a mesh referencing a cache matches a mesh with its own arrays, with or without a transform.
+TEST(MeshCacheTest, IntersectionMatchesOwnedArrays) {
+    using namespace SLR;
+    const std::string path = "mesh_cache_test_intersection.slrmesh";
+    const uint32_t GridSize = 32;
+    ASSERT_TRUE(writeGridCache(path, GridSize));
+    std::shared_ptr<const MeshCache> cache = MeshCache::open(path);
+    ASSERT_NE(cache, nullptr);
+    
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+    createGridMesh(GridSize, &vertices, &indices);
+    
+    float values[2] = {0.5f, 0.5f};
+    const SpectrumTexture* reflectance = new ConstantSpectrumTexture(new RegularContinuousSpectrum(360, 830, values, 2));
+    const FloatTexture* sigma = nullptr;
+    const SurfaceMaterial* diffuse = new DiffuseReflectionSurfaceMaterial(reflectance, sigma);
+    
+    auto createScene = [&](bool useCache, const StaticTransform &tf, ArenaAllocator* mem) {
+        TriangleMeshNode* mesh;
+        if (useCache) {
+            mesh = new TriangleMeshNode(cache, 0, false, -1);
+        }
+        else {
+            mesh = new TriangleMeshNode((uint32_t)vertices.size(), 1, false, -1);
+            for (int i = 0; i < vertices.size(); ++i)
+                mesh->setVertex(i, vertices[i]);
+            std::unique_ptr<uint32_t[]> meshIndices(new uint32_t[indices.size()]);
+            std::copy(indices.begin(), indices.end(), meshIndices.get());
+            mesh->getMaterialGroupArray()[0].setTriangles(meshIndices, (uint32_t)indices.size() / 3);
+        }
+        mesh->getMaterialGroupArray()[0].material = diffuse;
+        
+        InternalNode* root = new InternalNode(new StaticTransform());
+        InternalNode* tfNode = new InternalNode(new StaticTransform(tf));
+        tfNode->addChildNode(mesh);
+        root->addChildNode(tfNode);
+        Scene* scene = new Scene(root);
+        scene->build(mem);
+        return std::unique_ptr<Scene>(scene);
+    };
+    
+    const StaticTransform transforms[] = {
+        StaticTransform(),
+        StaticTransform(translate(0.2f, 0.1f, -0.3f) * rotateY(0.5f) * scale(1.5f))
+    };
+    for (int t = 0; t < 2; ++t) {
+        ArenaAllocator memOwned, memCache;
+        std::unique_ptr<Scene> sceneOwned = createScene(false, transforms[t], &memOwned);
+        std::unique_ptr<Scene> sceneCache = createScene(true, transforms[t], &memCache);
+        
+        XORShiftRNG rng(1509761209);
+        const uint32_t NumRays = 4096;
+        uint32_t numHits = 0;
+        for (int i = 0; i < NumRays; ++i) {
+            Point3D org(4 * rng.getFloat0cTo1o() - 2, 1.0f, 4 * rng.getFloat0cTo1o() - 2);
+            Vector3D dir = normalize(Vector3D(rng.getFloat0cTo1o() - 0.5f, -1.0f, rng.getFloat0cTo1o() - 0.5f));
+            Ray ray(org, dir, 0.0f);
+            RaySegment segOwned, segCache;
+            SurfaceInteraction siOwned, siCache;
+            bool hitOwned = sceneOwned->intersect(ray, segOwned, &siOwned);
+            bool hitCache = sceneCache->intersect(ray, segCache, &siCache);
+            EXPECT_EQ(hitOwned, hitCache);
+            if (hitOwned && hitCache) {
+                EXPECT_EQ(siOwned.getDistance(), siCache.getDistance());
+                ++numHits;
+            }
+        }
+        EXPECT_GT(numHits, 0);
+    }
+    
+    cache = nullptr;
+    std::remove(path.c_str());
+}
+
+TEST(MeshCacheTest, AtomicWriteKeepsOriginalOnFailure) {
+    using namespace SLR;
+    
+    const std::string path = "atomic_write_test.bin";
+    auto readAll = [&path]() {
+        std::string contents;
+        FILE* fp = fopen(path.c_str(), "rb");
+        if (fp == nullptr)
+            return contents;
+        char buf[64];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+            contents.append(buf, n);
+        fclose(fp);
+        return contents;
+    };
+    auto countTemporaryFiles = [&path]() {
+        uint32_t count = 0;
+        DIR* dir = opendir(".");
+        while (dirent* entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name.size() > path.size() && name.compare(0, path.size() + 1, path + ".") == 0)
+                ++count;
+        }
+        closedir(dir);
+        return count;
+    };
+    
+    ASSERT_TRUE(writeFileAtomically(path, [](FILE* fp) { return fputs("first", fp) >= 0; }));
+    EXPECT_EQ(readAll(), "first");
+    
+    // JP: 書き込みが失敗した場合は元のファイルが残り、一時ファイルも残らない。
+    // EN: the original file survives a failed write, and no temporary file is left.
+    EXPECT_FALSE(writeFileAtomically(path, [](FILE* fp) { fputs("broken", fp); return false; }));
+    EXPECT_EQ(readAll(), "first");
+    EXPECT_EQ(countTemporaryFiles(), 0);
+    
+    ASSERT_TRUE(writeFileAtomically(path, [](FILE* fp) { return fputs("second", fp) >= 0; }));
+    EXPECT_EQ(readAll(), "second");
+    EXPECT_EQ(countTemporaryFiles(), 0);
+    std::remove(path.c_str());
+}
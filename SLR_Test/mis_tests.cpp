@@ -0,0 +1,182 @@
+//
+//  mis_tests.cpp
+//
+//  Created by 渡部 心 on 2017/06/19.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#include <gtest/gtest.h>
+
+#include <libSLR/Core/bidirectional_mis_weights.h>
+#include <libSLR/BasicTypes/CompensatedSum.h>
+#include <libSLR/RNG/XORShiftRNG.h>
+#include <libSLR/Renderer/BPTRenderer.h>
+#include <libSLR/Renderer/VolumetricBPTRenderer.h>
+#include "test_scene.h"
+
+// JP: BPTRenderer / VolumetricBPTRendererの頂点のうち、MISウェイトの計算に用いる量のみを持つ頂点。
+// EN: a vertex having only the quantities used for MIS weight calculation in BPTRenderer / VolumetricBPTRenderer.
+struct MISTestVertex {
+    float PDF;
+    float revPDF;
+    bool isDelta;
+    float partialSum;
+};
+
+// JP: サブパスの全頂点を辿る、以前の実装によるウェイトの逆数への寄与。
+// EN: the contribution to the reciprocal of the weight by the previous implementation walking all the vertices of the subpath.
+static void referenceExtendAndShorten(float extend1stPDF, float extend2ndPDF,
+                                      const std::vector<MISTestVertex> &subPathToShorten, uint32_t numVertices, uint32_t minNumVertices,
+                                      SLR::FloatSum* recMISWeight) {
+    if (numVertices > minNumVertices) {
+        const MISTestVertex &endVtx = subPathToShorten[numVertices - 1];
+        float PDFRatio = extend1stPDF / endVtx.PDF;
+        bool shortenIsDeltaSampled = endVtx.isDelta;
+        if (!shortenIsDeltaSampled)
+            *recMISWeight += PDFRatio * PDFRatio;
+        bool prevIsDeltaSampled = shortenIsDeltaSampled;
+        
+        if (numVertices - 1 > minNumVertices) {
+            const MISTestVertex &newVtx = subPathToShorten[numVertices - 2];
+            PDFRatio *= extend2ndPDF / newVtx.PDF;
+            shortenIsDeltaSampled = newVtx.isDelta;
+            if (!shortenIsDeltaSampled && !prevIsDeltaSampled)
+                *recMISWeight += PDFRatio * PDFRatio;
+            prevIsDeltaSampled = shortenIsDeltaSampled;
+            
+            for (int i = numVertices - 2; i > minNumVertices; --i) {
+                const MISTestVertex &newVtx = subPathToShorten[i - 1];
+                PDFRatio *= newVtx.revPDF / newVtx.PDF;
+                shortenIsDeltaSampled = newVtx.isDelta;
+                if (!shortenIsDeltaSampled && !prevIsDeltaSampled)
+                    *recMISWeight += PDFRatio * PDFRatio;
+                prevIsDeltaSampled = shortenIsDeltaSampled;
+            }
+        }
+    }
+}
+
+// JP: サブパス生成時と同じ順序で部分和を蓄積する。
+// EN: accumulate partial sums in the same order as subpath generation.
+static void generateSubPath(SLR::XORShiftRNG &rng, uint32_t numVertices, uint32_t minNumVertices, std::vector<MISTestVertex>* vertices) {
+    // JP: 最長のサブパスでも確率密度比の積がオーバーフローしない範囲で確率密度を選ぶ。
+    // EN: choose PDFs in a range where products of PDF ratios don't overflow even for the longest subpath.
+    const auto randomPDF = [&rng]() {
+        return std::pow(10.0f, rng.getFloat0cTo1o() - 0.5f);
+    };
+    vertices->clear();
+    for (int i = 0; i < numVertices; ++i) {
+        MISTestVertex vtx;
+        vtx.PDF = randomPDF();
+        vtx.revPDF = randomPDF();
+        vtx.isDelta = rng.getFloat0cTo1o() < 0.2f;
+        vtx.partialSum = 0.0f;
+        vertices->push_back(vtx);
+        
+        if (vertices->size() - 1 > minNumVertices) {
+            MISTestVertex &vtxNextToLast = (*vertices)[vertices->size() - 2];
+            float prevPartialSum = vertices->size() > 2 ? (*vertices)[vertices->size() - 3].partialSum : 0.0f;
+            vtxNextToLast.partialSum = SLR::calcPartialMISWeightSum(prevPartialSum, vtxNextToLast.PDF, vtxNextToLast.revPDF,
+                                                                    vtxNextToLast.isDelta, vertices->back().isDelta);
+        }
+    }
+}
+
+static float recursiveExtendAndShorten(float extend1stPDF, float extend2ndPDF,
+                                       const std::vector<MISTestVertex> &subPathToShorten, uint32_t numVertices, uint32_t minNumVertices) {
+    if (numVertices <= minNumVertices)
+        return 0.0f;
+    const MISTestVertex &endVtx = subPathToShorten[numVertices - 1];
+    float nextToEndPDF = 1.0f;
+    bool nextToEndIsDelta = false;
+    if (numVertices - 1 > minNumVertices) {
+        nextToEndPDF = subPathToShorten[numVertices - 2].PDF;
+        nextToEndIsDelta = subPathToShorten[numVertices - 2].isDelta;
+    }
+    float partialSum = numVertices > minNumVertices + 2 ? subPathToShorten[numVertices - 3].partialSum : 0.0f;
+    return SLR::calcShortenedMISWeightSum(extend1stPDF, extend2ndPDF, numVertices, minNumVertices,
+                                          endVtx.PDF, endVtx.isDelta, nextToEndPDF, nextToEndIsDelta, partialSum);
+}
+
+TEST(BPTMISWeightTest, RecursiveMatchesReference) {
+    using namespace SLR;
+    
+    // JP: 全ての接続(s, t)について、再帰的に求めたウェイトが全頂点を辿るウェイトと一致することを確かめる。
+    // EN: check that the recursively computed weight matches the weight walking all the vertices for every connection (s, t).
+    const uint32_t MaxNumVertices = 16;
+    const uint32_t minLightVertices = 0;
+    const uint32_t minEyeVertices = 1;
+    XORShiftRNG rng(1509761209);
+    std::vector<MISTestVertex> lightVertices, eyeVertices;
+    uint32_t numComparisons = 0;
+    for (int trial = 0; trial < 256; ++trial) {
+        generateSubPath(rng, 1 + trial % MaxNumVertices, minLightVertices, &lightVertices);
+        generateSubPath(rng, 1 + (trial * 7) % MaxNumVertices, minEyeVertices, &eyeVertices);
+        for (int t = 1; t <= eyeVertices.size(); ++t) {
+            for (int s = 0; s <= lightVertices.size(); ++s) {
+                float lExtend1stPDF = std::pow(10.0f, rng.getFloat0cTo1o() - 0.5f);
+                float lExtend2ndPDF = std::pow(10.0f, rng.getFloat0cTo1o() - 0.5f);
+                float eExtend1stPDF = std::pow(10.0f, rng.getFloat0cTo1o() - 0.5f);
+                float eExtend2ndPDF = std::pow(10.0f, rng.getFloat0cTo1o() - 0.5f);
+                
+                FloatSum refRecMISWeight = 1;
+                referenceExtendAndShorten(lExtend1stPDF, lExtend2ndPDF, eyeVertices, t, minEyeVertices, &refRecMISWeight);
+                referenceExtendAndShorten(eExtend1stPDF, eExtend2ndPDF, lightVertices, s, minLightVertices, &refRecMISWeight);
+                float refWeight = 1.0f / refRecMISWeight;
+                
+                FloatSum recMISWeight = 1;
+                recMISWeight += recursiveExtendAndShorten(lExtend1stPDF, lExtend2ndPDF, eyeVertices, t, minEyeVertices);
+                recMISWeight += recursiveExtendAndShorten(eExtend1stPDF, eExtend2ndPDF, lightVertices, s, minLightVertices);
+                float weight = 1.0f / recMISWeight;
+                
+                EXPECT_NEAR(weight, refWeight, 1e-5f * std::max(refWeight, 1e-30f) + 1e-30f) << "s: " << s << ", t: " << t;
+                ++numComparisons;
+            }
+        }
+    }
+    EXPECT_GT(numComparisons, 0);
+}
+
+// JP: レンダラーが書き出した統計のJSONからカウンターの値を読む。
+// EN: read the value of a counter from the statistics JSON written by a renderer.
+static uint64_t readStatCounter(const char* path, const char* name) {
+    std::string json;
+    FILE* fp = fopen(path, "r");
+    if (fp == nullptr)
+        return 0;
+    int c;
+    while ((c = fgetc(fp)) != EOF)
+        json.push_back((char)c);
+    fclose(fp);
+    std::string key = std::string("\"") + name + "\": ";
+    size_t pos = json.find(key);
+    if (pos == std::string::npos)
+        return 0;
+    return std::strtoull(json.c_str() + pos + key.size(), nullptr, 10);
+}
+
+// JP: 小さなシーンを実際のBPT/VBPTのカーネルでレンダリングし、全ての接続のウェイトが全頂点を辿る以前の計算と一致することを確かめる。
+// EN: render a small scene with the actual BPT/VBPT kernels, and check that the weights of all connections match the previous calculation walking all the vertices.
+TEST(BPTMISWeightTest, KernelMatchesWalk) {
+    using namespace SLR;
+    
+    TestCornellBox cornellBox;
+    RenderSettings settings = TestCornellBox::createSettings(2, 32, 24);
+    settings.addItem(RenderSettingItem::ValidateMISWeights, true);
+    
+    std::unique_ptr<Renderer> renderers[] = {
+        std::unique_ptr<Renderer>(new BPTRenderer(2)),
+        std::unique_ptr<Renderer>(new VolumetricBPTRenderer(2))
+    };
+    for (int i = 0; i < 2; ++i) {
+        renderers[i]->render(cornellBox.scene(), settings);
+        // JP: 2sppでは1パス目と最後のパスで画像と統計が出力される。
+        // EN: an image and statistics are exported at the first and the last pass with 2spp.
+        uint64_t numValidations = readStatCounter("001.json", "misWeightValidations");
+        uint64_t numMismatches = readStatCounter("001.json", "misWeightMismatches");
+        EXPECT_GT(numValidations, 1000u) << "renderer: " << i;
+        EXPECT_EQ(numMismatches, 0u) << "renderer: " << i;
+        for (const char* path : {"000.bmp", "000.json", "001.bmp", "001.json"})
+            std::remove(path);
+    }
+}
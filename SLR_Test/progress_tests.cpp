@@ -0,0 +1,69 @@
+//
+//  progress_tests.cpp
+//
+//  Created by 渡部 心 on 2017/06/27.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#include <gtest/gtest.h>
+
+#include <libSLR/Core/ProgressReporter.h>
+
+// JP: 複数のスレッドが各自のカウンターを更新し、JSON Linesの出力に全スレッドの合計が現れることを確かめる。
+// EN: check that multiple threads update their own counters and the sum of all the threads appears in the JSON Lines output.
+TEST(ProgressReporterTest, JSONLinesOutput) {
+    using namespace SLR;
+    const uint32_t NumThreads = 4;
+    const uint32_t NumWorksPerThread = 100000;
+    
+    FILE* fp = tmpfile();
+    ASSERT_NE(fp, nullptr);
+    {
+        ProgressReporter reporter(NumThreads, fileno(fp));
+        reporter.pushJob("Rendering \"test\"", NumThreads * NumWorksPerThread);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < NumThreads; ++i) {
+            threads.emplace_back([&reporter, i]() {
+                for (int j = 0; j < NumWorksPerThread; ++j)
+                    reporter.update(i);
+            });
+        }
+        for (int i = 0; i < NumThreads; ++i)
+            threads[i].join();
+        
+        // JP: 完了扱いにした作業は入れ子のジョブにのみ加算される。
+        // EN: works regarded as done are added only to the nested job.
+        reporter.pushJob("Nested", 2 * NumWorksPerThread);
+        reporter.update(0, NumWorksPerThread);
+        reporter.skipRemainingWork();
+        reporter.popJob();
+        reporter.popJob();
+        reporter.finish();
+    }
+    
+    fseek(fp, 0, SEEK_SET);
+    std::vector<std::string> lines;
+    char buffer[1024];
+    while (fgets(buffer, sizeof(buffer), fp))
+        lines.push_back(buffer);
+    fclose(fp);
+    
+    ASSERT_GE(lines.size(), 2);
+    EXPECT_EQ(lines.back(), "{\"finished\":true}\n");
+    
+    // JP: 入れ子のジョブが終わった時点の行は両方のジョブを含む。完了数は総数で頭打ちになる。
+    // EN: the line at the end of the nested job contains both the jobs. The number of done works is capped by the total.
+    char expected[256];
+    snprintf(expected, sizeof(expected),
+             "\"jobs\":[{\"title\":\"Rendering \\\"test\\\"\",\"done\":%u,\"total\":%u,",
+             NumThreads * NumWorksPerThread, NumThreads * NumWorksPerThread);
+    std::string nestedLine;
+    for (const std::string &line : lines) {
+        if (line.find("\"Nested\"") != std::string::npos)
+            nestedLine = line;
+    }
+    ASSERT_FALSE(nestedLine.empty());
+    EXPECT_NE(nestedLine.find(expected), std::string::npos) << nestedLine;
+    snprintf(expected, sizeof(expected), "{\"title\":\"Nested\",\"done\":%u,\"total\":%u,", 2 * NumWorksPerThread, 2 * NumWorksPerThread);
+    EXPECT_NE(nestedLine.find(expected), std::string::npos) << nestedLine;
+}
@@ -0,0 +1,194 @@
+//
+//  sampler_tests.cpp
+//
+//  Created by 渡部 心 on 2017/06/10.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#include <gtest/gtest.h>
+
+#include <libSLR/Core/light_path_sampler.h>
+
+static const SLR::LightPathSamplerType s_samplerTypes[] = {
+    SLR::LightPathSamplerType::Independent,
+    SLR::LightPathSamplerType::Sobol,
+    SLR::LightPathSamplerType::Halton,
+};
+
+static const char* s_samplerNames[] = {
+    "Independent",
+    "Sobol",
+    "Halton",
+};
+
+TEST(LightPathSamplerTest, SampleRange) {
+    using namespace SLR;
+
+    for (int t = 0; t < lengthof(s_samplerTypes); ++t) {
+        std::unique_ptr<LightPathSampler> sampler(createLightPathSampler(s_samplerTypes[t], 1509761209, 123456789));
+        for (int s = 0; s < 1024; ++s) {
+            sampler->startPixelSample(s % 7, s % 11, s);
+            PixelPosition p = sampler->getPixelPositionSample(3, 5);
+            EXPECT_TRUE(p.x >= 3 && p.x < 4 && p.y >= 5 && p.y < 6);
+            float u = sampler->getWavelengthSample();
+            EXPECT_TRUE(u >= 0 && u < 1);
+            // JP: 多数のバウンスを跨いでも値域を保つことを確かめる。
+            // EN: check the range is kept over many bounces.
+            for (int b = 0; b < 64; ++b) {
+                BSDFSample fsSample = sampler->getBSDFSample();
+                EXPECT_TRUE(fsSample.uComponent >= 0 && fsSample.uComponent < 1);
+                EXPECT_TRUE(fsSample.uDir[0] >= 0 && fsSample.uDir[0] < 1);
+                EXPECT_TRUE(fsSample.uDir[1] >= 0 && fsSample.uDir[1] < 1);
+                float uRR = sampler->getPathTerminationSample();
+                EXPECT_TRUE(uRR >= 0 && uRR < 1);
+            }
+        }
+    }
+}
+
+TEST(LightPathSamplerTest, SequenceIsIndependentOfThread) {
+    using namespace SLR;
+
+    // JP: 同じピクセル・サンプル番号なら、別のスレッド(疑似乱数のシード)でも同じ値を返さなければならない。
+    // EN: The same pixel and sample index must give the same values even in another thread (PRNG seed).
+    for (int t = 1; t < lengthof(s_samplerTypes); ++t) {
+        std::unique_ptr<LightPathSampler> samplerA(createLightPathSampler(s_samplerTypes[t], 1509761209, 1));
+        std::unique_ptr<LightPathSampler> samplerB(createLightPathSampler(s_samplerTypes[t], 1509761209, 2));
+        for (int s = 0; s < 64; ++s) {
+            samplerA->startPixelSample(12, 34, s);
+            samplerB->startPixelSample(12, 34, s);
+            PixelPosition pA = samplerA->getPixelPositionSample(12, 34);
+            PixelPosition pB = samplerB->getPixelPositionSample(12, 34);
+            EXPECT_EQ(pA.x, pB.x);
+            EXPECT_EQ(pA.y, pB.y);
+            BSDFSample fsA = samplerA->getBSDFSample();
+            BSDFSample fsB = samplerB->getBSDFSample();
+            EXPECT_EQ(fsA.uDir[0], fsB.uDir[0]);
+            EXPECT_EQ(fsA.uDir[1], fsB.uDir[1]);
+        }
+    }
+}
+
+TEST(LightPathSamplerTest, SobolStratification) {
+    using namespace SLR;
+
+    // JP: 2次元の組は(0, 2)列であるため、最初の2^m個の点は全ての基本区間にちょうど1点ずつ入る。
+    // EN: 2D pairs form a (0, 2)-sequence, so the first 2^m points fall into every elementary interval exactly once.
+    const uint32_t log2NumSamples = 8;
+    const uint32_t NumSamples = 1 << log2NumSamples;
+    std::unique_ptr<LightPathSampler> sampler(createLightPathSampler(LightPathSamplerType::Sobol, 1509761209, 1));
+    std::vector<PixelPosition> points;
+    for (int s = 0; s < NumSamples; ++s) {
+        sampler->startPixelSample(7, 9, s);
+        points.push_back(sampler->getPixelPositionSample(0, 0));
+    }
+    std::vector<uint32_t> counts(NumSamples);
+    for (int log2X = 0; log2X <= log2NumSamples; ++log2X) {
+        uint32_t numX = 1 << log2X;
+        uint32_t numY = NumSamples / numX;
+        std::fill(counts.begin(), counts.end(), 0);
+        for (const PixelPosition &p : points)
+            ++counts[uint32_t(p.y * numY) * numX + uint32_t(p.x * numX)];
+        for (uint32_t c : counts)
+            EXPECT_EQ(c, 1);
+    }
+}
+
+// JP: 解析的に積分値が分かる被積分関数を画素ごとに積分し、解析的な参照値に対するRMSEをspp毎に計測する。
+//     カメラに関する次元に加えて数バウンス分の次元(光源選択・光源上の位置・BSDF・ロシアンルーレット)を消費する。
+//     シーンをレンダリングした参照画像との比較ではなく、サンプラーの次元配置を通した合成的な被積分関数である。
+// EN: integrate an integrand with a known analytic integral for each pixel and measure RMSE against the analytic reference for each spp.
+//     The integrand consumes the camera dimensions and dimensions for several bounces
+//     (light selection, position on a light, BSDF and Russian roulette).
+//     This is a synthetic integrand driven through the samplers' dimension layout, not a comparison with a rendered reference image.
+struct SyntheticPathIntegrand {
+    static const uint32_t Width = 32;
+    static const uint32_t Height = 32;
+    static const uint32_t NumBounces = 2;
+    static const uint32_t MaxLog2SPP = 10;
+
+    static float imageFunction(float x, float y) {
+        return 1.0f + 0.5f * std::sin(0.7f * x) * std::cos(0.3f * y);
+    }
+    static double referencePixel(uint32_t px, uint32_t py) {
+        double ix = (std::cos(0.7 * px) - std::cos(0.7 * (px + 1))) / 0.7;
+        double iy = (std::sin(0.3 * (py + 1)) - std::sin(0.3 * py)) / 0.3;
+        return 1.0 + 0.5 * ix * iy;
+    }
+    // JP: [0, 1)上の積分が1になる滑らかな関数と不連続な関数。
+    // EN: a smooth and a discontinuous function whose integrals over [0, 1) are 1.
+    static float smooth(float u, float phase) {
+        return 1.0f + 0.5f * std::cos(2 * M_PI * (u + phase));
+    }
+    static float step(float u) {
+        return u < 0.5f ? 1.5f : 0.5f;
+    }
+
+    static float integrand(SLR::LightPathSampler &sampler, uint32_t px, uint32_t py) {
+        using namespace SLR;
+        PixelPosition p = sampler.getPixelPositionSample(px, py);
+        float value = imageFunction(p.x, p.y);
+        value *= smooth(sampler.getWavelengthSample(), 0.1f);
+        LensPosSample lensSample = sampler.getLensPosSample();
+        value *= smooth(lensSample.uPos[0], 0.2f) * smooth(lensSample.uPos[1], 0.3f);
+        for (int b = 0; b < NumBounces; ++b) {
+            value *= step(sampler.getLightSelectionSample());
+            SurfaceLightPosSample lpSample = sampler.getSurfaceLightPosSample();
+            value *= smooth(lpSample.uPos[0], 0.6f) * step(lpSample.uPos[1]);
+            BSDFSample fsSample = sampler.getBSDFSample();
+            value *= step(fsSample.uComponent) * smooth(fsSample.uDir[0], 0.4f) * smooth(fsSample.uDir[1], 0.7f);
+            value *= smooth(sampler.getPathTerminationSample(), 0.5f);
+        }
+        return value;
+    }
+
+    static void run(SLR::LightPathSamplerType type, double rmses[MaxLog2SPP + 1]) {
+        using namespace SLR;
+        std::unique_ptr<LightPathSampler> sampler(createLightPathSampler(type, 1509761209, 9876543));
+        std::vector<double> accum(Width * Height, 0.0);
+        uint32_t nextLog2SPP = 0;
+        for (uint32_t s = 0; s < (1 << MaxLog2SPP); ++s) {
+            for (int py = 0; py < Height; ++py) {
+                for (int px = 0; px < Width; ++px) {
+                    sampler->startPixelSample(px, py, s);
+                    accum[py * Width + px] += integrand(*sampler, px, py);
+                }
+            }
+            if (s + 1 == (1 << nextLog2SPP)) {
+                double sumSqError = 0;
+                for (int py = 0; py < Height; ++py) {
+                    for (int px = 0; px < Width; ++px) {
+                        double diff = accum[py * Width + px] / (s + 1) - referencePixel(px, py);
+                        sumSqError += diff * diff;
+                    }
+                }
+                rmses[nextLog2SPP++] = std::sqrt(sumSqError / (Width * Height));
+            }
+        }
+    }
+};
+
+TEST(LightPathSamplerTest, SyntheticIntegrandRMSEBelowIndependent) {
+    using namespace SLR;
+
+    double rmses[lengthof(s_samplerTypes)][SyntheticPathIntegrand::MaxLog2SPP + 1];
+    for (int t = 0; t < lengthof(s_samplerTypes); ++t)
+        SyntheticPathIntegrand::run(s_samplerTypes[t], rmses[t]);
+
+    printf("RMSE vs spp (%ux%u image, %u bounces):\n", SyntheticPathIntegrand::Width, SyntheticPathIntegrand::Height, SyntheticPathIntegrand::NumBounces);
+    printf("%6s", "spp");
+    for (int t = 0; t < lengthof(s_samplerTypes); ++t)
+        printf(" %12s", s_samplerNames[t]);
+    printf("\n");
+    for (int i = 0; i <= SyntheticPathIntegrand::MaxLog2SPP; ++i) {
+        printf("%6u", 1 << i);
+        for (int t = 0; t < lengthof(s_samplerTypes); ++t)
+            printf(" %12.6f", rmses[t][i]);
+        printf("\n");
+    }
+
+    // JP: 最大sppにおいて低食い違い量サンプラーの誤差が独立サンプラーより小さいことを確かめる。
+    // EN: check that the low-discrepancy samplers have smaller error than the independent sampler at the maximum spp.
+    for (int t = 1; t < lengthof(s_samplerTypes); ++t)
+        EXPECT_LT(rmses[t][SyntheticPathIntegrand::MaxLog2SPP], rmses[0][SyntheticPathIntegrand::MaxLog2SPP]);
+}
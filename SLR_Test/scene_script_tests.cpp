@@ -0,0 +1,522 @@
+//
+//  scene_script_tests.cpp
+//
+//  Created by 渡部 心 on 2017/07/05.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <set>
+#include <dirent.h>
+
+#include <libSLR/Core/geometry.h>
+#include <libSLR/Core/MeshCache.h>
+#include <libSLRSceneGraph/declarations.h>
+#include <libSLRSceneGraph/Scene/Scene.h>
+#include <libSLRSceneGraph/API.h>
+#include <libSLRSceneGraph/Parser/SceneParsingDriver.h>
+#include <libSLRSceneGraph/Parser/SceneBytecode.h>
+
+static bool writeScript(const std::string &path, const std::string &source) {
+    std::ofstream ofs(path);
+    ofs << source;
+    return (bool)ofs;
+}
+
+static bool runScript(const std::string &path) {
+    SLRSceneGraph::SceneRef scene = createShared<SLRSceneGraph::Scene>();
+    SLRSceneGraph::RenderingContext context;
+    return SLRSceneGraph::readScene(path, scene, &context);
+}
+
+// JP: 三角形一つと、プロパティを持たない材質一つからなるメッシュキャッシュ。
+// EN: a mesh cache consisting of a triangle and a material without properties.
+static bool writeTriangleCache(const std::string &path) {
+    using namespace SLR;
+    const Vertex vertices[] = {
+        Vertex(Point3D(0, 0, 0), Normal3D(0, 1, 0), Tangent3D(1, 0, 0), TexCoord2D(0, 0)),
+        Vertex(Point3D(1, 0, 0), Normal3D(0, 1, 0), Tangent3D(1, 0, 0), TexCoord2D(1, 0)),
+        Vertex(Point3D(0, 0, 1), Normal3D(0, 1, 0), Tangent3D(1, 0, 0), TexCoord2D(0, 1)),
+    };
+    const uint32_t indices[] = {0, 1, 2};
+    
+    MeshCacheWriter writer;
+    writer.addMaterial(std::vector<uint8_t>(sizeof(uint32_t), 0));
+    writer.addMesh("triangle", vertices, 3, indices, 1, 0);
+    const float identity[16] = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1};
+    writer.addNode("root", identity, std::vector<uint32_t>{0}, 0);
+    return writer.write(path);
+}
+
+// JP: 材質生成関数やメッシュのコールバックはload3DModelを呼んだ時点のループ変数を参照する。
+//     後の値を参照するとタプルの範囲外へのアクセスとなりスクリプトの実行が失敗する。
+// EN: the material function and the mesh callback see the loop variable as of calling load3DModel.
+//     Seeing a later value results in an out-of-range tuple access, and executing the script fails.
+TEST(SceneScriptTest, ModelCallbacksSeeVariablesAtCall) {
+    const std::string cachePath = "scene_script_test.slrmesh";
+    const std::string scriptPath = "scene_script_test.txt";
+    ASSERT_TRUE(writeTriangleCache(cachePath));
+    ASSERT_TRUE(writeScript(scriptPath,
+                            "for (i = 0; i < 3; ++i) {\n"
+                            "    function mat(name, attrs) {\n"
+                            "        reflectances = (0.25, 0.5, 0.75);\n"
+                            "        r = reflectances[i];\n"
+                            "        return createSurfaceMaterial(\"matte\", (SpectrumTexture(Spectrum(r, r, r)),));\n"
+                            "    }\n"
+                            "    function proc(name, mesh, minP, maxP) {\n"
+                            "        visibilities = (true, false, true);\n"
+                            "        return visibilities[i];\n"
+                            "    }\n"
+                            "    addChild(root, load3DModel(\"" + cachePath + "\", \"matProc\": mat));\n"
+                            "    addChild(root, load3DModel(\"" + cachePath + "\", \"meshProc\": proc));\n"
+                            "}\n"));
+    
+    EXPECT_TRUE(runScript(scriptPath));
+    
+    std::remove(scriptPath.c_str());
+    std::remove(cachePath.c_str());
+}
+
+static SLRSceneGraph::FunctionPrototypeRef compileScriptFile(const std::string &path, SLRSceneGraph::ExecuteContext &context, std::string* message) {
+    using namespace SLRSceneGraph;
+    TypeInfo::init();
+    SceneParsingDriver parser;
+    StatementsRef statements = parser.parse(path);
+    if (!statements) {
+        *message = "Failed to parse: " + path;
+        return nullptr;
+    }
+    ErrorMessage errMsg;
+    FunctionPrototypeRef script = compileScript(statements, context.globals, &errMsg);
+    if (!script)
+        *message = errMsg.message;
+    return script;
+}
+
+static bool executeScript(const SLRSceneGraph::FunctionPrototype &script, SLRSceneGraph::ExecuteContext &context, std::string* message) {
+    using namespace SLRSceneGraph;
+    ErrorMessage errMsg;
+    Element result;
+    if (!executeFunction(script, nullptr, context, &result, &errMsg)) {
+        *message = errMsg.message;
+        return false;
+    }
+    return true;
+}
+
+// JP: ソースをコンパイルして実行する。グローバル変数は実行後もcontextに残るので結果の確認に使える。
+// EN: compiles and executes a source. Global variables remain in the context after execution, so they can be used to check the results.
+static bool runSource(const std::string &source, SLRSceneGraph::ExecuteContext &context, std::string* message) {
+    const std::string path = "scene_script_test.txt";
+    if (!writeScript(path, source)) {
+        *message = "Failed to write: " + path;
+        return false;
+    }
+    SLRSceneGraph::FunctionPrototypeRef script = compileScriptFile(path, context, message);
+    std::remove(path.c_str());
+    return script && executeScript(*script, context, message);
+}
+
+static int32_t integerGlobal(const SLRSceneGraph::ExecuteContext &context, const std::string &name) {
+    const SLRSceneGraph::Element &value = context.globals.at(name);
+    EXPECT_EQ(value.type, SLRSceneGraph::Type::Integer) << name;
+    return value.type == SLRSceneGraph::Type::Integer ? value.raw<SLRSceneGraph::TypeMap::Integer>() : 0;
+}
+
+// JP: 引数の値を順に記録する組み込み関数。
+// EN: a builtin function recording argument values in order.
+static SLRSceneGraph::Element createRecordFunction(std::vector<SLRSceneGraph::Element>* records) {
+    using namespace SLRSceneGraph;
+    return Element::create<TypeMap::Function>(std::vector<ArgInfo>{{"value", Type::Any}},
+                                              [records](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
+                                                  records->push_back(args.at("value"));
+                                                  return Element();
+                                              });
+}
+
+// JP: トップレベルのブロックの外で代入した変数はグローバル変数、ブロックの中で初めて代入した変数はブロックのローカル変数になる。
+//     関数の中での代入はグローバル変数を書き換えない。
+// EN: variables assigned outside blocks at the top level become global variables,
+//     and variables first assigned in a block become locals of the block.
+//     Assignments in a function don't overwrite global variables.
+TEST(SceneScriptTest, GlobalsAndBlockLocals) {
+    using namespace SLRSceneGraph;
+    std::string message;
+    
+    ExecuteContext context;
+    ASSERT_TRUE(runSource("a = 1;\n"
+                          "{\n"
+                          "    b = 2;\n"
+                          "    a = a + b;\n"
+                          "}\n"
+                          "for (i = 0; i < 3; ++i) {\n"
+                          "    t = i;\n"
+                          "    a += t;\n"
+                          "}\n"
+                          "function f() {\n"
+                          "    a = 100;\n"
+                          "    return a;\n"
+                          "}\n"
+                          "c = f();\n", context, &message)) << message;
+    EXPECT_EQ(integerGlobal(context, "a"), 6);
+    EXPECT_EQ(integerGlobal(context, "i"), 3);
+    EXPECT_EQ(integerGlobal(context, "c"), 100);
+    EXPECT_FALSE(context.globals.exists("b"));
+    EXPECT_FALSE(context.globals.exists("t"));
+    
+    // JP: ブロックのローカル変数はブロックの外からは見えない。
+    // EN: locals of a block are not visible from outside of the block.
+    ExecuteContext outsideContext;
+    EXPECT_FALSE(runSource("{\n"
+                           "    u = 1;\n"
+                           "}\n"
+                           "v = u;\n", outsideContext, &message));
+    EXPECT_NE(message.find("u"), std::string::npos) << message;
+}
+
+// JP: 一方の分岐でのみ代入される変数は読み出し時に定義済みかを確かめる。
+// EN: a variable assigned only in one branch is checked for being defined when read.
+TEST(SceneScriptTest, VariablesDefinedInOneBranch) {
+    using namespace SLRSceneGraph;
+    const std::string functions =
+    "function f(flag) {\n"
+    "    if (flag)\n"
+    "        v = 1;\n"
+    "    return v;\n"
+    "}\n"
+    "function g(flag) {\n"
+    "    if (flag)\n"
+    "        w = 1;\n"
+    "    else\n"
+    "        w = 2;\n"
+    "    return w;\n"
+    "}\n";
+    std::string message;
+    
+    ExecuteContext context;
+    ASSERT_TRUE(runSource(functions +
+                          "a = f(true);\n"
+                          "b = g(true);\n"
+                          "c = g(false);\n", context, &message)) << message;
+    EXPECT_EQ(integerGlobal(context, "a"), 1);
+    EXPECT_EQ(integerGlobal(context, "b"), 1);
+    EXPECT_EQ(integerGlobal(context, "c"), 2);
+    
+    ExecuteContext undefinedContext;
+    EXPECT_FALSE(runSource(functions +
+                           "a = f(false);\n", undefinedContext, &message));
+    EXPECT_EQ(message, "Undefined variable: v");
+}
+
+// JP: 既定値は関数を定義した時点で評価され、位置でも名前でも引数を上書きできる。
+// EN: default values are evaluated at the time of defining a function, and arguments can be overridden by position or by name.
+TEST(SceneScriptTest, FunctionDefaultValues) {
+    using namespace SLRSceneGraph;
+    std::string message;
+    
+    ExecuteContext context;
+    ASSERT_TRUE(runSource("d = 3;\n"
+                          "function f(x, y = d * 2) {\n"
+                          "    return x * 100 + y;\n"
+                          "}\n"
+                          "d = 100;\n"
+                          "a = f(1);\n"
+                          "b = f(1, 2);\n"
+                          "c = f(\"y\": 5, \"x\": 1);\n"
+                          "e = f(\"x\": 2);\n", context, &message)) << message;
+    EXPECT_EQ(integerGlobal(context, "a"), 106);
+    EXPECT_EQ(integerGlobal(context, "b"), 102);
+    EXPECT_EQ(integerGlobal(context, "c"), 105);
+    EXPECT_EQ(integerGlobal(context, "e"), 206);
+    
+    ExecuteContext missingContext;
+    EXPECT_FALSE(runSource("function f(x, y = 1) {\n"
+                           "    return x + y;\n"
+                           "}\n"
+                           "a = f(\"y\": 2);\n", missingContext, &message));
+}
+
+// JP: 呼び出し箇所は前回対応付けた関数と引数の型を覚えている。
+//     引数の型や関数が変わった場合は対応付けをやり直し、古い対応付けを使ってはならない。
+// EN: a call site remembers the function and the argument types mapped last time.
+//     It needs to redo the mapping and must not use the old one when the argument types or the function change.
+TEST(SceneScriptTest, ArgumentMappingCache) {
+    using namespace SLRSceneGraph;
+    std::vector<Element> records;
+    std::string message;
+    
+    ExecuteContext context;
+    context.globals["record"] = createRecordFunction(&records);
+    context.globals["kind"] =
+    Element::create<TypeMap::Function>(std::vector<std::vector<ArgInfo>>{
+                                           {{"value", Type::Integer}},
+                                           {{"value", Type::String}}
+                                       },
+                                       std::vector<Function::Procedure>{
+                                           [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
+                                               return Element::create<TypeMap::String>("Integer");
+                                           },
+                                           [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
+                                               return Element::create<TypeMap::String>("String");
+                                           }
+                                       });
+    ASSERT_TRUE(runSource("values = (1, 2, \"three\", 4);\n"
+                          "function f(a, b) {\n"
+                          "    return a * 10 + b;\n"
+                          "}\n"
+                          "function g(b, a) {\n"
+                          "    return a * 10 + b;\n"
+                          "}\n"
+                          "for (k = 0; k < 4; ++k) {\n"
+                          "    record(kind(values[k]));\n"
+                          "    h = f;\n"
+                          "    if (k == 1)\n"
+                          "        h = g;\n"
+                          "    record(h(\"a\": 1, \"b\": 2));\n"
+                          "}\n", context, &message)) << message;
+    
+    const char* expectedKinds[] = {"Integer", "Integer", "String", "Integer"};
+    ASSERT_EQ(records.size(), 8);
+    for (int i = 0; i < 4; ++i) {
+        ASSERT_EQ(records[2 * i].type, Type::String);
+        EXPECT_EQ(records[2 * i].raw<TypeMap::String>(), expectedKinds[i]) << i;
+        ASSERT_EQ(records[2 * i + 1].type, Type::Integer);
+        EXPECT_EQ(records[2 * i + 1].raw<TypeMap::Integer>(), 12) << i;
+    }
+}
+
+// JP: 前置のデクリメントは変数を減らしてから値を返す。
+// EN: the prefix decrement decreases a variable and then returns the value.
+TEST(SceneScriptTest, PrefixDecrement) {
+    using namespace SLRSceneGraph;
+    std::string message;
+    
+    ExecuteContext context;
+    ASSERT_TRUE(runSource("a = 5;\n"
+                          "b = --a;\n"
+                          "n = 0;\n"
+                          "for (k = 3; k > 0 && n < 10; --k)\n"
+                          "    ++n;\n"
+                          "function f(x) {\n"
+                          "    y = --x;\n"
+                          "    return x * 10 + y;\n"
+                          "}\n"
+                          "c = f(5);\n", context, &message)) << message;
+    EXPECT_EQ(integerGlobal(context, "a"), 4);
+    EXPECT_EQ(integerGlobal(context, "b"), 4);
+    EXPECT_EQ(integerGlobal(context, "n"), 3);
+    EXPECT_EQ(integerGlobal(context, "k"), 0);
+    EXPECT_EQ(integerGlobal(context, "c"), 44);
+}
+
+// JP: 組み込み関数がスクリプトの関数を呼び返すと、レジスターの配列が伸びて再確保され得る。
+//     呼び出し元のフレームはその後も正しく参照できなければならない。
+// EN: when a builtin function calls back a function of the script, the register array can grow and be reallocated.
+//     The frame of the caller needs to be still accessed correctly after that.
+TEST(SceneScriptTest, BuiltinCallingBackIntoScript) {
+    using namespace SLRSceneGraph;
+    size_t capacityBeforeCall = 0;
+    size_t capacityAfterCall = 0;
+    std::string message;
+    
+    ExecuteContext context;
+    context.globals["apply"] =
+    Element::create<TypeMap::Function>(std::vector<ArgInfo>{{"func", Type::Function}, {"value", Type::Any}},
+                                       [&](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
+                                           ParameterList params;
+                                           params.add("", args.at("value"));
+                                           capacityBeforeCall = context.registers.capacity();
+                                           Element result = args.at("func").raw<TypeMap::Function>()(params, context, err);
+                                           capacityAfterCall = context.registers.capacity();
+                                           return result;
+                                       });
+    ASSERT_TRUE(runSource("function depth(n) {\n"
+                          "    if (n == 0)\n"
+                          "        return 0;\n"
+                          "    return depth(n - 1) + 1;\n"
+                          "}\n"
+                          "function outer(v) {\n"
+                          "    before = v * 2;\n"
+                          "    r = apply(depth, v);\n"
+                          "    return before + r;\n"
+                          "}\n"
+                          "result = outer(300);\n", context, &message)) << message;
+    EXPECT_GT(capacityAfterCall, capacityBeforeCall);
+    EXPECT_EQ(integerGlobal(context, "result"), 900);
+}
+
+struct StubShape {
+    std::set<std::string> keys;
+    uint32_t numUnnamed = 0;
+};
+
+// JP: バイトコードからグローバル変数の関数の呼び出しを集め、名前ごとに渡されるキーと名前無し引数の最大数を求める。
+// EN: collects calls of functions in global variables from bytecode, and finds the keys and the maximum number of unnamed arguments for each name.
+static void collectGlobalCalls(const SLRSceneGraph::FunctionPrototype &prototype, const SLRSceneGraph::GlobalVariables &globals,
+                               std::map<std::string, StubShape>* shapes, std::set<std::string>* definedFunctions) {
+    using namespace SLRSceneGraph;
+    for (const Instruction &inst : prototype.code) {
+        if (inst.op == OpCode::MakeFunction && (inst.a & GlobalBit)) {
+            definedFunctions->insert(globals.name(inst.a & ~GlobalBit));
+            continue;
+        }
+        if (inst.op != OpCode::Call || !(inst.b & GlobalBit))
+            continue;
+        const ArgumentSite &site = prototype.argumentSites[inst.c];
+        StubShape &shape = (*shapes)[globals.name(inst.b & ~GlobalBit)];
+        uint32_t numUnnamed = 0;
+        for (int i = 0; i < site.numArgs; ++i) {
+            if (!site.keys[i].empty())
+                shape.keys.insert(site.keys[i]);
+            else if (site.keyRegisters[i] == NoRegister)
+                ++numUnnamed;
+        }
+        shape.numUnnamed = std::max(shape.numUnnamed, numUnnamed);
+    }
+    for (const FunctionPrototypeRef &child : prototype.prototypes)
+        collectGlobalCalls(*child, globals, shapes, definedFunctions);
+}
+
+// JP: 代わりの組み込み関数。アセットやシーンには触れず、呼び出し箇所から集めた任意の引数を受け付けて数値を返す。
+//     モデルの読み込みと走査はスクリプトのコールバックを呼び返し、タプルの操作は制御フローに影響するので実際に行う。
+// EN: stub builtin functions. They don't touch assets or the scene, and accept any arguments collected from call sites and return a number.
+//     Model loading and scanning call back the callbacks of the script, and tuple operations are actually performed since they affect control flow.
+static void registerStubFunctions(const std::map<std::string, StubShape> &shapes, const std::set<std::string> &definedFunctions,
+                                  SLRSceneGraph::GlobalVariables &globals, uint32_t* numCallbacks) {
+    using namespace SLRSceneGraph;
+    const Element nullFunction = Element::createFromReference<TypeMap::Function>(nullptr);
+    globals["numElements"] =
+    Element::create<TypeMap::Function>(std::vector<ArgInfo>{{"tuple", Type::Tuple}},
+                                       [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
+                                           return Element((int32_t)args.at("tuple").raw<TypeMap::Tuple>().numParams());
+                                       });
+    globals["addItem"] =
+    Element::create<TypeMap::Function>(std::vector<ArgInfo>{{"tuple", Type::Tuple}, {"key", Type::String, Element::create<TypeMap::String>("")}, {"item", Type::Any}},
+                                       [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
+                                           auto tuple = args.at("tuple").rawRef<TypeMap::Tuple>();
+                                           tuple->add(args.at("key").raw<TypeMap::String>(), args.at("item"));
+                                           return Element::createFromReference<TypeMap::Tuple>(tuple);
+                                       });
+    globals["load3DModel"] =
+    Element::create<TypeMap::Function>(std::vector<ArgInfo>{{"path", Type::String}, {"matProc", Type::Function, nullFunction}, {"meshProc", Type::Function, nullFunction}},
+                                       [numCallbacks](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
+                                           auto matProc = args.at("matProc").rawRef<TypeMap::Function>();
+                                           auto meshProc = args.at("meshProc").rawRef<TypeMap::Function>();
+                                           if (matProc) {
+                                               ParameterListRef textures = createShared<ParameterList>();
+                                               textures->add("", Element::create<TypeMap::String>("texture.png"));
+                                               ParameterListRef color = createShared<ParameterList>();
+                                               for (int i = 0; i < 3; ++i)
+                                                   color->add("", Element(0.5));
+                                               const char* textureKeys[] = {"specular textures", "emissive textures", "height textures", "normal textures"};
+                                               // JP: テクスチャーを持つ材質と持たない材質の両方を生成させる。
+                                               // EN: make the function create both a material with a texture and one without.
+                                               for (int m = 0; m < 2; ++m) {
+                                                   ParameterListRef attrs = createShared<ParameterList>();
+                                                   attrs->add("diffuse textures", m == 0 ?
+                                                              Element::createFromReference<TypeMap::Tuple>(textures) : Element::create<TypeMap::Tuple>());
+                                                   for (const char* key : textureKeys)
+                                                       attrs->add(key, Element::create<TypeMap::Tuple>());
+                                                   attrs->add("diffuse color", Element::createFromReference<TypeMap::Tuple>(color));
+                                                   ParameterList params;
+                                                   params.add("", Element::create<TypeMap::String>("material"));
+                                                   params.add("", Element::createFromReference<TypeMap::Tuple>(attrs));
+                                                   (*matProc)(params, context, err);
+                                                   if (err->error)
+                                                       return Element();
+                                                   ++*numCallbacks;
+                                               }
+                                           }
+                                           if (meshProc) {
+                                               ParameterList params;
+                                               params.add("", Element::create<TypeMap::String>("mesh"));
+                                               params.add("", Element(0.0));
+                                               params.add("", Element(SLR::Point3D(-1, -1, -1)));
+                                               params.add("", Element(SLR::Point3D(1, 1, 1)));
+                                               (*meshProc)(params, context, err);
+                                               if (err->error)
+                                                   return Element();
+                                               ++*numCallbacks;
+                                           }
+                                           return Element(0.0);
+                                       });
+    globals["scanXZFromYPlus"] =
+    Element::create<TypeMap::Function>(std::vector<ArgInfo>{{"node", Type::Any}, {"numX", Type::Integer}, {"numY", Type::Integer},
+                                                            {"randomness", Type::RealNumber, Element(0.0)}, {"callback", Type::Function}},
+                                       [numCallbacks](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
+                                           const Function &callback = args.at("callback").raw<TypeMap::Function>();
+                                           for (int i = 0; i < 4; ++i) {
+                                               ParameterList params;
+                                               params.add("", Element(SLR::Point3D(0.25f * i, 0.0f, -0.25f * i)));
+                                               params.add("", Element(SLR::Vector3D(1, 0, 0)));
+                                               params.add("", Element(SLR::Vector3D(0, 0, 1)));
+                                               params.add("", Element(SLR::Normal3D(0, 1, 0)));
+                                               callback(params, context, err);
+                                               if (err->error)
+                                                   return Element();
+                                               ++*numCallbacks;
+                                           }
+                                           return Element();
+                                       });
+    
+    for (const auto &it : shapes) {
+        const std::string &name = it.first;
+        if (globals.exists(name) || definedFunctions.count(name))
+            continue;
+        std::vector<ArgInfo> signature;
+        for (const std::string &key : it.second.keys)
+            signature.push_back(ArgInfo{key, Type::Any, Element(0.0)});
+        for (int i = 0; i < it.second.numUnnamed; ++i)
+            signature.push_back(ArgInfo{"#" + std::to_string(i), Type::Any, Element(0.0)});
+        globals[name] =
+        Element::create<TypeMap::Function>(signature,
+                                           [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
+                                               return Element(0.5);
+                                           });
+    }
+}
+
+// JP: 付属のシーンファイルは全て、組み込み関数を代わりのものに置き換えた状態でコンパイルして最後まで実行できる。
+// EN: all the bundled scene files can be compiled and executed to the end with builtin functions replaced by stubs.
+TEST(SceneScriptTest, TestScenesRunWithStubs) {
+    using namespace SLRSceneGraph;
+    std::string sourcePath = __FILE__;
+    std::string sceneDir = sourcePath.substr(0, sourcePath.find_last_of("/") + 1) + "../TestScenes/";
+    
+    std::vector<std::string> scenePaths;
+    DIR* dir = opendir(sceneDir.c_str());
+    ASSERT_NE(dir, nullptr) << sceneDir;
+    while (dirent* entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name.size() > 4 && name.compare(name.size() - 4, 4, ".txt") == 0)
+            scenePaths.push_back(sceneDir + name);
+    }
+    closedir(dir);
+    std::sort(scenePaths.begin(), scenePaths.end());
+    ASSERT_FALSE(scenePaths.empty());
+    
+    uint32_t numCallbacks = 0;
+    for (const std::string &path : scenePaths) {
+        std::string message;
+        ExecuteContext context;
+        // JP: readSceneと同様にルートノードはコンパイル前に定義しておく。
+        // EN: define the root node before compiling as readScene does.
+        context.globals["root"] = Element(0.0);
+        FunctionPrototypeRef script = compileScriptFile(path, context, &message);
+        ASSERT_NE(script, nullptr) << path << ": " << message;
+        
+        std::map<std::string, StubShape> shapes;
+        std::set<std::string> definedFunctions;
+        collectGlobalCalls(*script, context.globals, &shapes, &definedFunctions);
+        registerStubFunctions(shapes, definedFunctions, context.globals, &numCallbacks);
+        
+        EXPECT_TRUE(executeScript(*script, context, &message)) << path << ": " << message;
+        EXPECT_TRUE(context.registers.empty()) << path;
+    }
+    // JP: マテリアル生成関数やコールバックも実行されている。
+    // EN: material functions and callbacks are executed as well.
+    EXPECT_GT(numCallbacks, 0);
+}
@@ -0,0 +1,107 @@
+//
+//  test_scene.h
+//
+//  Created by 渡部 心 on 2017/07/03.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#ifndef __SLR_Test_test_scene__
+#define __SLR_Test_test_scene__
+
+#include <libSLR/defines.h>
+#include <libSLR/declarations.h>
+#include <libSLR/BasicTypes/spectrum_library.h>
+#include <libSLR/BasicTypes/spectrum_types.h>
+#include <libSLR/Core/geometry.h>
+#include <libSLR/Core/transform.h>
+#include <libSLR/Core/RenderSettings.h>
+#include <libSLR/MemoryAllocators/ArenaAllocator.h>
+#include <libSLR/Scene/Scene.h>
+#include <libSLR/Scene/node.h>
+#include <libSLR/Scene/TriangleMeshNode.h>
+#include <libSLR/Scene/camera_nodes.h>
+#include <libSLR/Texture/constant_textures.h>
+#include <libSLR/SurfaceMaterial/basic_surface_materials.h>
+#include <libSLR/SurfaceMaterial/basic_emitter_surface_properties.h>
+
+// JP: レンダラーを実際に動かすテストのための小さなコーネルボックス。鏡面の壁でデルタ関数による頂点も生じる。
+//     シーンを構成するノードやマテリアルはテストの間だけ使うので解放しない。
+// EN: a small Cornell box for tests driving actual renderers. A specular wall also produces vertices sampled by delta functions.
+//     Nodes and materials composing the scene are used only during a test, so they are not released.
+class TestCornellBox {
+    SLR::ArenaAllocator m_mem;
+    std::unique_ptr<SLR::Scene> m_scene;
+    
+    static const SLR::SpectrumTexture* constantTexture(float value) {
+        float values[2] = {value, value};
+        return new SLR::ConstantSpectrumTexture(new SLR::RegularContinuousSpectrum(360, 830, values, 2));
+    }
+    
+    static SLR::TriangleMeshNode* createQuad(const SLR::Point3D &p0, const SLR::Point3D &p1, const SLR::Point3D &p2, const SLR::Point3D &p3,
+                                             const SLR::Normal3D &n, const SLR::SurfaceMaterial* material) {
+        using namespace SLR;
+        TriangleMeshNode* node = new TriangleMeshNode(4, 1, false, -1);
+        Vector3D t = normalize(p1 - p0);
+        const Point3D ps[4] = {p0, p1, p2, p3};
+        for (int i = 0; i < 4; ++i)
+            node->setVertex(i, Vertex(ps[i], n, Tangent3D(t.x, t.y, t.z), TexCoord2D(i == 1 || i == 2, i >= 2)));
+        std::unique_ptr<uint32_t[]> indices(new uint32_t[6]{0, 1, 2, 0, 2, 3});
+        MaterialGroupInTriangleMesh &group = node->getMaterialGroupArray()[0];
+        group.material = material;
+        group.setTriangles(indices, 2);
+        return node;
+    }
+public:
+    TestCornellBox() {
+        using namespace SLR;
+        const FloatTexture* sigma = nullptr;
+        const SurfaceMaterial* white = new DiffuseReflectionSurfaceMaterial(constantTexture(0.75f), sigma);
+        const SurfaceMaterial* red = new DiffuseReflectionSurfaceMaterial(constantTexture(0.5f), sigma);
+        const SurfaceMaterial* mirror = new SpecularReflectionSurfaceMaterial(constantTexture(0.9f), constantTexture(0.2f), constantTexture(3.0f));
+        const SurfaceMaterial* light = new EmitterSurfaceMaterial(white, new DiffuseEmitterSurfaceProperty(constantTexture(20.0f)));
+        
+        InternalNode* root = new InternalNode(new StaticTransform());
+        root->addChildNode(createQuad(Point3D(-1.5, 0, 2.55), Point3D(-1.5, 0, -2.55), Point3D(-1.5, 2.5, -2.55), Point3D(-1.5, 2.5, 2.55), Normal3D(1, 0, 0), red));
+        root->addChildNode(createQuad(Point3D(1.5, 0, -2.55), Point3D(1.5, 0, 2.55), Point3D(1.5, 2.5, 2.55), Point3D(1.5, 2.5, -2.55), Normal3D(-1, 0, 0), mirror));
+        root->addChildNode(createQuad(Point3D(-1.5, 0, 2.55), Point3D(1.5, 0, 2.55), Point3D(1.5, 0, -2.55), Point3D(-1.5, 0, -2.55), Normal3D(0, 1, 0), white));
+        root->addChildNode(createQuad(Point3D(-1.5, 2.5, -2.55), Point3D(1.5, 2.5, -2.55), Point3D(1.5, 2.5, 2.55), Point3D(-1.5, 2.5, 2.55), Normal3D(0, -1, 0), white));
+        root->addChildNode(createQuad(Point3D(-1.5, 0, -2.55), Point3D(1.5, 0, -2.55), Point3D(1.5, 2.5, -2.55), Point3D(-1.5, 2.5, -2.55), Normal3D(0, 0, 1), white));
+        root->addChildNode(createQuad(Point3D(-0.5, 2.49, -0.5), Point3D(0.5, 2.49, -0.5), Point3D(0.5, 2.49, 0.5), Point3D(-0.5, 2.49, 0.5), Normal3D(0, -1, 0), light));
+        InternalNode* cameraNode = new InternalNode(new StaticTransform(translate(0.0f, 1.25f, 6.5f) * rotateY((float)M_PI)));
+        cameraNode->addChildNode(new PerspectiveCameraNode(1.0f, 4.0f / 3, 0.48f, 0.0f, 1.0f, 6.3f));
+        root->addChildNode(cameraNode);
+        
+        m_scene.reset(new Scene(root));
+        m_scene->build(&m_mem);
+    }
+    
+    const SLR::Scene &scene() const { return *m_scene; }
+    
+    // JP: 画像を出力する以外の機能を全て無効にした設定。
+    // EN: settings disabling all the features except for image export.
+    static SLR::RenderSettings createSettings(int32_t numThreads, int32_t width, int32_t height) {
+        using namespace SLR;
+        RenderSettings settings;
+        settings.addItem(RenderSettingItem::NumThreads, numThreads);
+        settings.addItem(RenderSettingItem::ImageWidth, width);
+        settings.addItem(RenderSettingItem::ImageHeight, height);
+        settings.addItem(RenderSettingItem::TimeStart, 0.0f);
+        settings.addItem(RenderSettingItem::TimeEnd, 0.0f);
+        settings.addItem(RenderSettingItem::Brightness, 1.0f);
+        settings.addItem(RenderSettingItem::RNGSeed, (int32_t)1509761209);
+        settings.addItem(RenderSettingItem::TimeLimit, 0.0f);
+        settings.addItem(RenderSettingItem::TargetNoise, 0.0f);
+        settings.addItem(RenderSettingItem::CheckpointPath, std::string(""));
+        settings.addItem(RenderSettingItem::CheckpointInterval, 0.0f);
+        settings.addItem(RenderSettingItem::ResumePath, std::string(""));
+        settings.addItem(RenderSettingItem::ProgressFD, (int32_t)-1);
+        settings.addItem(RenderSettingItem::ExportInterval, (int32_t)0);
+        settings.addItem(RenderSettingItem::ExportTimeInterval, 0.0f);
+        settings.addItem(RenderSettingItem::PassRangeIndex, (int32_t)0);
+        settings.addItem(RenderSettingItem::NumPassRanges, (int32_t)1);
+        settings.addItem(RenderSettingItem::ValidateMISWeights, false);
+        return settings;
+    }
+};
+
+#endif /* __SLR_Test_test_scene__ */
@@ -13,6 +13,7 @@
 #include "../Core/accelerator.h"
 #include "../Accelerator/SBVH.h"
 #include <nmmintrin.h>
+#include <bitset>
 
 namespace SLR {
     inline __m128 _mm_sel_ps(const __m128 &mask, const __m128 &t, const __m128 &f) {
@@ -38,6 +39,27 @@ namespace SLR {
             }
         };
         
+        // JP: 光線の束の判定のために、光線ごとにSIMDレジスターへ展開しておく値。
+        // EN: values expanded into SIMD registers per ray for testing a packet of rays.
+        struct PacketRay {
+            __m128 org_x, org_y, org_z;
+            __m128 invDir_x, invDir_y, invDir_z;
+            bool dirIsPositive[3];
+            
+            void set(const Ray &ray) {
+                const Vector3D invRayDir = ray.dir.reciprocal();
+                org_x = _mm_set_ps1(ray.org.x);
+                org_y = _mm_set_ps1(ray.org.y);
+                org_z = _mm_set_ps1(ray.org.z);
+                invDir_x = _mm_set_ps1(invRayDir.x);
+                invDir_y = _mm_set_ps1(invRayDir.y);
+                invDir_z = _mm_set_ps1(invRayDir.z);
+                dirIsPositive[0] = invRayDir.x > 0.0f;
+                dirIsPositive[1] = invRayDir.y > 0.0f;
+                dirIsPositive[2] = invRayDir.z > 0.0f;
+            }
+        };
+        
         struct Node {
             __m128 min_x;
             __m128 min_y;
@@ -73,6 +95,20 @@ namespace SLR {
                 
                 return _mm_movemask_ps(_mm_cmple_ps(tNear, tFar));
             }
+            
+            uint32_t intersect(const PacketRay &ray, const RaySegment &segment) const {
+                __m128 tNear = _mm_set_ps1(segment.distMin);
+                __m128 tFar = _mm_set_ps1(segment.distMax);
+                
+                tNear = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(ray.dirIsPositive[0] ? min_x : max_x, ray.org_x), ray.invDir_x), tNear);
+                tNear = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(ray.dirIsPositive[1] ? min_y : max_y, ray.org_y), ray.invDir_y), tNear);
+                tNear = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(ray.dirIsPositive[2] ? min_z : max_z, ray.org_z), ray.invDir_z), tNear);
+                tFar = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(ray.dirIsPositive[0] ? max_x : min_x, ray.org_x), ray.invDir_x), tFar);
+                tFar = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(ray.dirIsPositive[1] ? max_y : min_y, ray.org_y), ray.invDir_y), tFar);
+                tFar = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(ray.dirIsPositive[2] ? max_z : min_z, ray.org_z), ray.invDir_z), tFar);
+                
+                return _mm_movemask_ps(_mm_cmple_ps(tNear, tFar));
+            }
         };
         
         uint32_t m_depth;
@@ -291,6 +327,10 @@ namespace SLR {
             return m_bounds;
         }
         
+        const std::vector<const SurfaceObject*> &leafObjects() const override {
+            return m_objLists;
+        }
+        
         bool intersect(const Ray &ray, const RaySegment &segment, SurfaceInteraction* si, uint32_t* closestIndex) const override {
             *closestIndex = UINT32_MAX;
             bool dirIsPositive[] = {ray.dir.x >= 0, ray.dir.y >= 0, ray.dir.z >= 0};
@@ -300,8 +340,11 @@ namespace SLR {
             uint32_t idxStack[StackSize];
             uint32_t depth = 0;
             idxStack[depth++] = 0;
+            uint32_t numNodes = 0;
+            uint32_t numPrimitives = 0;
             while (depth > 0) {
                 const Node &node = m_nodes[idxStack[--depth]];
+                ++numNodes;
                 uint32_t hitFlags = node.intersect(ray, isectRange);
                 if (hitFlags == 0)
                     continue;
@@ -330,6 +373,7 @@ namespace SLR {
                     const Children &child = children[i];
                     if (!child.isValid() || !child.isLeafNode)
                         continue;
+                    numPrimitives += child.numLeaves;
                     for (uint32_t j = 0; j < child.numLeaves; ++j) {
                         if (m_objLists[child.idx + j]->intersect(ray, isectRange, si)) {
                             *closestIndex = child.idx + j;
@@ -338,8 +382,91 @@ namespace SLR {
                     }
                 }
             }
+            recordTraversal(numNodes, numPrimitives);
             return *closestIndex != UINT32_MAX;
         }
+        
+        // JP: 光線の束を一緒に辿る。各ノードでは束の中で有効な光線ごとに4つの子の箱をSIMDで判定し、子ごとに交差した光線のマスクを作る。
+        //     マスクが空になった子は辿らない。子を辿る順番は束の先頭の有効な光線の方向で決めるため、方向が揃った束で効率が良い。
+        // EN: traverse with a packet of rays together. At each node, four child boxes are tested with SIMD for each active ray in the packet,
+        //     producing a mask of rays hitting each child. Children with empty masks are not traversed.
+        //     The order to visit children is determined by the direction of the first active ray in the packet, so this is efficient for packets with aligned directions.
+        uint32_t intersectPacket(const Ray* rays, RaySegment* segments, SurfaceInteraction* sis, uint32_t* closestIndices, uint32_t activeMask) const override {
+            PacketRay packetRays[32];
+            uint32_t firstRay = 32;
+            for (uint32_t i = 0; i < 32 && (activeMask >> i) != 0; ++i) {
+                if (((activeMask >> i) & 0x1) == 0)
+                    continue;
+                packetRays[i].set(rays[i]);
+                closestIndices[i] = UINT32_MAX;
+                if (firstRay == 32)
+                    firstRay = i;
+            }
+            if (firstRay == 32)
+                return 0;
+            const bool* dirIsPositive = packetRays[firstRay].dirIsPositive;
+            
+            uint32_t hitMask = 0;
+            const uint32_t StackSize = 64;
+            uint32_t idxStack[StackSize];
+            uint32_t maskStack[StackSize];
+            uint32_t depth = 0;
+            idxStack[depth] = 0;
+            maskStack[depth] = activeMask;
+            ++depth;
+            uint32_t numNodes = 0;
+            uint32_t numPrimitives = 0;
+            while (depth > 0) {
+                --depth;
+                const Node &node = m_nodes[idxStack[depth]];
+                uint32_t nodeMask = maskStack[depth];
+                
+                uint32_t childMasks[4] = {0, 0, 0, 0};
+                for (uint32_t r = 0; r < 32 && (nodeMask >> r) != 0; ++r) {
+                    if (((nodeMask >> r) & 0x1) == 0)
+                        continue;
+                    ++numNodes;
+                    uint32_t hitFlags = node.intersect(packetRays[r], segments[r]);
+                    for (int c = 0; c < 4; ++c)
+                        childMasks[c] |= ((hitFlags >> c) & 0x1) << r;
+                }
+                
+                const uint32_t OrderTable[] = {
+                    0x0123, 0x0132, 0x1023, 0x1032,
+                    0x2301, 0x3201, 0x2310, 0x3210
+                };
+                uint32_t encodedOrder = OrderTable[4 * dirIsPositive[node.topAxis] + 2 * dirIsPositive[node.leftAxis] + 1 * dirIsPositive[node.rightAxis]];
+                uint32_t order[4] = {(encodedOrder >> 0) & 0xF, (encodedOrder >> 4) & 0xF, (encodedOrder >> 8) & 0xF, (encodedOrder >> 12) & 0xF};
+                
+                for (int i = 3; i >= 0; --i) {
+                    const Children &child = node.children[order[i]];
+                    uint32_t childMask = childMasks[order[i]];
+                    if (childMask == 0 || !child.isValid() || child.isLeafNode)
+                        continue;
+                    SLRAssert(depth < StackSize, "QBVH::intersectPacket: stack overflow");
+                    idxStack[depth] = child.idx;
+                    maskStack[depth] = childMask;
+                    ++depth;
+                }
+                for (int i = 0; i < 4; ++i) {
+                    const Children &child = node.children[order[i]];
+                    uint32_t childMask = childMasks[order[i]];
+                    if (childMask == 0 || !child.isValid() || !child.isLeafNode)
+                        continue;
+                    numPrimitives += child.numLeaves * (uint32_t)std::bitset<32>(childMask).count();
+                    for (uint32_t j = 0; j < child.numLeaves; ++j) {
+                        uint32_t objHitMask = m_objLists[child.idx + j]->intersectPacket(rays, segments, sis, childMask);
+                        for (uint32_t r = 0; r < 32 && (objHitMask >> r) != 0; ++r) {
+                            if (((objHitMask >> r) & 0x1) != 0)
+                                closestIndices[r] = child.idx + j;
+                        }
+                        hitMask |= objHitMask;
+                    }
+                }
+            }
+            recordTraversal(numNodes, numPrimitives);
+            return hitMask;
+        }
     };
 }
 
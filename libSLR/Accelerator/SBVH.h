@@ -17,6 +17,7 @@ namespace SLR {
     // Spatial Splits in Bounding Volume Hierarchies
     class SLR_API SBVH : public Accelerator {
         friend class QBVH;
+        friend class BVHCache;
         
         struct Node {
             BoundingBox3D bbox;
@@ -348,6 +349,10 @@ namespace SLR {
 #undef PRINT_PROCESSING_TIME
         }
         
+        // JP: BVHCacheが読み込んだ内容で初期化する。
+        // EN: BVHCache initializes this with the loaded contents.
+        SBVH() { }
+        
         float calcSAHCost() const {
             const float Ci = 1.2f;
             const float Cl = 0.0f;
@@ -377,6 +382,10 @@ namespace SLR {
         }
         
     public:
+        // JP: 構築の結果が変わる変更をした場合は更新する。BVHキャッシュのキーに含まれる。
+        // EN: update this on a change which alters build results. This is included in the key of BVH caches.
+        static const uint32_t BuildRevision = 1;
+        
         SBVH(const std::vector<SurfaceObject*> &objs) {
             std::chrono::system_clock::time_point tpStart, tpEnd;
             double elapsed;
@@ -415,6 +424,10 @@ namespace SLR {
             return m_bounds;
         }
         
+        const std::vector<const SurfaceObject*> &leafObjects() const override {
+            return m_objLists;
+        }
+        
         bool intersect(const Ray &ray, const RaySegment &segment, SurfaceInteraction* si, uint32_t* closestIndex) const override {
             *closestIndex = UINT32_MAX;
             bool dirIsPositive[] = {ray.dir.x >= 0, ray.dir.y >= 0, ray.dir.z >= 0};
@@ -424,8 +437,11 @@ namespace SLR {
             uint32_t idxStack[StackSize];
             uint32_t depth = 0;
             idxStack[depth++] = 0;
+            uint32_t numNodes = 0;
+            uint32_t numPrimitives = 0;
             while (depth > 0) {
                 const Node &node = m_nodes[idxStack[--depth]];
+                ++numNodes;
                 if (!node.bbox.intersect(ray, isectRange))
                     continue;
                 if (node.numLeaves == 0) {
@@ -435,6 +451,7 @@ namespace SLR {
                     idxStack[depth++] = positiveDir ? node.c0 : node.c1;
                 }
                 else {
+                    numPrimitives += node.numLeaves;
                     for (uint32_t i = 0; i < node.numLeaves; ++i) {
 #ifdef DEBUG
                         if (Accelerator::traceTraverse) {
@@ -449,6 +466,7 @@ namespace SLR {
                     }
                 }
             }
+            recordTraversal(numNodes, numPrimitives);
             return *closestIndex != UINT32_MAX;
         }
     };    
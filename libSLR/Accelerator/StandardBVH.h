@@ -253,6 +253,10 @@ namespace SLR {
             return m_bounds;
         }
         
+        const std::vector<const SurfaceObject*> &leafObjects() const override {
+            return m_objLists;
+        }
+        
         bool intersect(const Ray &ray, const RaySegment &segment, SurfaceInteraction* si, uint32_t* closestIndex) const override {
             *closestIndex = UINT32_MAX;
             bool dirIsPositive[] = {ray.dir.x >= 0, ray.dir.y >= 0, ray.dir.z >= 0};
@@ -262,8 +266,11 @@ namespace SLR {
             uint32_t idxStack[StackSize];
             uint32_t depth = 0;
             idxStack[depth++] = 0;
+            uint32_t numNodes = 0;
+            uint32_t numPrimitives = 0;
             while (depth > 0) {
                 const Node &node = m_nodes[idxStack[--depth]];
+                ++numNodes;
                 if (!node.bbox.intersect(ray, isectRange))
                     continue;
                 if (node.numLeaves == 0) {
@@ -273,6 +280,7 @@ namespace SLR {
                     idxStack[depth++] = positiveDir ? node.c0 : node.c1;
                 }
                 else {
+                    numPrimitives += node.numLeaves;
                     for (uint32_t i = 0; i < node.numLeaves; ++i) {
                         if (m_objLists[node.offsetFirstLeaf + i]->intersect(ray, isectRange, si)) {
                             *closestIndex = node.offsetFirstLeaf + i;
@@ -281,6 +289,7 @@ namespace SLR {
                     }
                 }
             }
+            recordTraversal(numNodes, numPrimitives);
             return *closestIndex != UINT32_MAX;
         }
     };
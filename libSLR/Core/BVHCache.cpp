@@ -0,0 +1,172 @@
+//
+//  BVHCache.cpp
+//
+//  Created by 渡部 心 on 2017/06/29.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#include "BVHCache.h"
+
+#include <cstring>
+#include <unordered_map>
+#include "MappedFile.h"
+#include "surface_object.h"
+#include "../Accelerator/SBVH.h"
+
+namespace SLR {
+    static const char s_BVHCacheMagic[8] = {'S', 'L', 'R', 'B', 'V', 'H', '\0', '\0'};
+    
+    struct BVHCache::FileHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t nodeSize;
+        uint64_t key;
+        uint64_t fileSize;
+        uint32_t numObjects;
+        uint32_t numNodes;
+        uint32_t numLeafRefs;
+        uint32_t depth;
+        float cost;
+        float minP[3];
+        float maxP[3];
+        uint32_t reserved;
+        uint64_t nodesOffset;
+        uint64_t leafRefsOffset;
+    };
+    
+    std::string BVHCache::s_directory;
+    
+    std::string BVHCache::cachePath(uint64_t key) {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.slrbvh", (unsigned long long)key);
+        if (s_directory.empty() || s_directory.back() == '/')
+            return s_directory + name;
+        return s_directory + "/" + name;
+    }
+    
+    uint64_t BVHCache::computeKey(const std::vector<SurfaceObject*> &objs) {
+        uint32_t values[] = {Version, SBVH::BuildRevision, (uint32_t)sizeof(SBVH::Node), (uint32_t)objs.size()};
+        uint64_t key = hashFNV1a64(values, sizeof(values));
+        for (int i = 0; i < objs.size(); ++i) {
+            uint64_t objHash = objs[i]->geometryHash();
+            key = hashFNV1a64(&objHash, sizeof(objHash), key);
+        }
+        return key;
+    }
+    
+    SBVH* BVHCache::load(const std::string &path, uint64_t key, const std::vector<SurfaceObject*> &objs) {
+        typedef SBVH::Node Node;
+        
+        MappedFile file;
+        if (!file.open(path))
+            return nullptr;
+        const uint8_t* data = file.data();
+        uint64_t size = file.size();
+        auto inRange = [size](uint64_t offset, uint64_t rangeSize) {
+            return offset <= size && rangeSize <= size - offset && offset % sizeof(uint32_t) == 0;
+        };
+        
+        if (size < sizeof(FileHeader))
+            return nullptr;
+        const FileHeader &header = *(const FileHeader*)data;
+        if (std::memcmp(header.magic, s_BVHCacheMagic, sizeof(s_BVHCacheMagic)) != 0 ||
+            header.version != Version || header.nodeSize != sizeof(Node) || header.key != key || header.fileSize != size ||
+            header.numObjects != objs.size() || header.numNodes == 0)
+            return nullptr;
+        if (!inRange(header.nodesOffset, (uint64_t)header.numNodes * sizeof(Node)) ||
+            !inRange(header.leafRefsOffset, (uint64_t)header.numLeafRefs * sizeof(uint32_t)))
+            return nullptr;
+        
+        // JP: 子は親より後ろに並ぶことを確かめて、走査が必ず終わるようにする。
+        // EN: check that children are placed after their parents so that traversal always terminates.
+        const Node* nodes = (const Node*)(data + header.nodesOffset);
+        for (uint32_t i = 0; i < header.numNodes; ++i) {
+            const Node &node = nodes[i];
+            if (node.numLeaves == 0) {
+                if (node.c0 <= i || node.c1 <= i || node.c0 >= header.numNodes || node.c1 >= header.numNodes ||
+                    (uint32_t)node.axis > 2)
+                    return nullptr;
+            }
+            else {
+                if (node.offsetFirstLeaf > header.numLeafRefs || node.numLeaves > header.numLeafRefs - node.offsetFirstLeaf)
+                    return nullptr;
+            }
+        }
+        const uint32_t* leafRefs = (const uint32_t*)(data + header.leafRefsOffset);
+        for (uint32_t i = 0; i < header.numLeafRefs; ++i) {
+            if (leafRefs[i] >= header.numObjects)
+                return nullptr;
+        }
+        
+        SBVH* sbvh = new SBVH();
+        sbvh->m_depth = header.depth;
+        sbvh->m_cost = header.cost;
+        sbvh->m_bounds = BoundingBox3D(Point3D(header.minP[0], header.minP[1], header.minP[2]),
+                                       Point3D(header.maxP[0], header.maxP[1], header.maxP[2]));
+        sbvh->m_nodes.assign(nodes, nodes + header.numNodes);
+        sbvh->m_objLists.resize(header.numLeafRefs);
+        for (uint32_t i = 0; i < header.numLeafRefs; ++i)
+            sbvh->m_objLists[i] = objs[leafRefs[i]];
+        
+        return sbvh;
+    }
+    
+    bool BVHCache::store(const std::string &path, uint64_t key, const SBVH &sbvh, const std::vector<SurfaceObject*> &objs) {
+        typedef SBVH::Node Node;
+        
+        std::unordered_map<const SurfaceObject*, uint32_t> objIndices;
+        for (uint32_t i = 0; i < objs.size(); ++i)
+            objIndices.emplace(objs[i], i);
+        std::vector<uint32_t> leafRefs(sbvh.m_objLists.size());
+        for (int i = 0; i < leafRefs.size(); ++i)
+            leafRefs[i] = objIndices.at(sbvh.m_objLists[i]);
+        
+        FileHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, s_BVHCacheMagic, sizeof(s_BVHCacheMagic));
+        header.version = Version;
+        header.nodeSize = sizeof(Node);
+        header.key = key;
+        header.numObjects = (uint32_t)objs.size();
+        header.numNodes = (uint32_t)sbvh.m_nodes.size();
+        header.numLeafRefs = (uint32_t)leafRefs.size();
+        header.depth = sbvh.m_depth;
+        header.cost = sbvh.m_cost;
+        for (int i = 0; i < 3; ++i) {
+            header.minP[i] = sbvh.m_bounds.minP[i];
+            header.maxP[i] = sbvh.m_bounds.maxP[i];
+        }
+        header.nodesOffset = sizeof(FileHeader);
+        header.leafRefsOffset = header.nodesOffset + header.numNodes * sizeof(Node);
+        header.fileSize = header.leafRefsOffset + header.numLeafRefs * sizeof(uint32_t);
+        
+        return writeFileAtomically(path, [&](FILE* fp) {
+            bool success = true;
+            success &= fwrite(&header, sizeof(header), 1, fp) == 1;
+            success &= fwrite(sbvh.m_nodes.data(), sizeof(Node), sbvh.m_nodes.size(), fp) == sbvh.m_nodes.size();
+            success &= leafRefs.empty() || fwrite(leafRefs.data(), sizeof(uint32_t), leafRefs.size(), fp) == leafRefs.size();
+            return success;
+        });
+    }
+    
+    SBVH* BVHCache::buildSBVH(const std::vector<SurfaceObject*> &objs) {
+        if (s_directory.empty() || objs.size() < MinNumObjects)
+            return new SBVH(objs);
+        
+        std::chrono::system_clock::time_point tpStart = std::chrono::system_clock::now();
+        uint64_t key = computeKey(objs);
+        std::string path = cachePath(key);
+        SBVH* sbvh = load(path, key, objs);
+        if (sbvh) {
+            double elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now() - tpStart).count();
+            printf("cached BVH: %s, num nodes: %u, depth: %u, cost: %g, time: %g[s]\n",
+                   path.c_str(), (uint32_t)sbvh->m_nodes.size(), sbvh->m_depth, sbvh->m_cost, elapsed * 0.001f);
+            return sbvh;
+        }
+        
+        sbvh = new SBVH(objs);
+        if (!store(path, key, *sbvh, objs))
+            printf("Failed to write a BVH cache: %s\n", path.c_str());
+        return sbvh;
+    }
+}
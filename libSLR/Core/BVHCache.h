@@ -0,0 +1,63 @@
+//
+//  BVHCache.h
+//
+//  Created by 渡部 心 on 2017/06/29.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#ifndef __SLR_BVHCache__
+#define __SLR_BVHCache__
+
+#include "../defines.h"
+#include "../declarations.h"
+
+namespace SLR {
+    static const uint64_t FNV1aOffsetBasis64 = 14695981039346656037ULL;
+    static const uint64_t FNV1aPrime64 = 1099511628211ULL;
+    
+    // JP: FNV-1aによる64ビットのハッシュ。以前の値をhashに渡すと続けて計算する。
+    // EN: 64-bit hash by FNV-1a. Passing a previous value as hash continues the calculation.
+    inline uint64_t hashFNV1a64(const void* data, size_t size, uint64_t hash = FNV1aOffsetBasis64) {
+        const uint8_t* bytes = (const uint8_t*)data;
+        for (size_t i = 0; i < size; ++i)
+            hash = (hash ^ bytes[i]) * FNV1aPrime64;
+        return hash;
+    }
+    
+    // JP: 構築したSBVHをファイルに保存し、後の実行で再構築する代わりにメモリーマップして読み込む。
+    //     キーは形式のバージョン、構築方法の版、全てのオブジェクトの幾何ハッシュから計算するため、
+    //     同じ幾何が同じ順に並んだ集合であれば、アニメーションの別のフレームや別の実行でも同じキャッシュを用いる。
+    // EN: stores built SBVHs to files, and loads them by memory-mapping instead of rebuilding in later runs.
+    //     The key is calculated from the format version, the build revision and the geometry hashes of all the objects,
+    //     so the same cache is used in another frame of an animation or another run for a set of the same geometry in the same order.
+    class SLR_API BVHCache {
+        struct FileHeader;
+        
+        static std::string s_directory;
+        
+        static std::string cachePath(uint64_t key);
+    public:
+        static const uint32_t Version = 1;
+        // JP: これより少ないオブジェクトの加速構造は構築の方が速いのでキャッシュしない。
+        // EN: accelerators with fewer objects than this are not cached because building is faster.
+        static const uint32_t MinNumObjects = 1024;
+        
+        // JP: キャッシュを置くディレクトリ。空の場合(既定)はキャッシュを用いない。
+        // EN: the directory to put caches. Caches are not used if empty (default).
+        static void setDirectory(const std::string &directory) { s_directory = directory; }
+        static const std::string &directory() { return s_directory; }
+        
+        static uint64_t computeKey(const std::vector<SurfaceObject*> &objs);
+        
+        // JP: キャッシュを読み込み、内容を検証する。存在しない場合や検証に失敗した場合はnullptrを返す。
+        // EN: loads a cache and validates its contents. This returns nullptr if it doesn't exist or the validation fails.
+        static SBVH* load(const std::string &path, uint64_t key, const std::vector<SurfaceObject*> &objs);
+        static bool store(const std::string &path, uint64_t key, const SBVH &sbvh, const std::vector<SurfaceObject*> &objs);
+        
+        // JP: キャッシュが有効であればそこから読み込み、そうでなければSBVHを構築してキャッシュに書き出す。
+        // EN: loads from a cache if it is available, otherwise this builds an SBVH and writes it to a cache.
+        static SBVH* buildSBVH(const std::vector<SurfaceObject*> &objs);
+    };
+}
+
+#endif /* __SLR_BVHCache__ */
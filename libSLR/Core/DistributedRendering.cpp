@@ -0,0 +1,470 @@
+//
+//  DistributedRendering.cpp
+//
+//  Created by 渡部 心 on 2017/06/26.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#include "DistributedRendering.h"
+
+#include "ImageSensor.h"
+#include "PassScheduler.h"
+#include <cstring>
+#include <new>
+
+#if defined(SLR_Platform_Windows)
+#   include <winsock2.h>
+#   include <ws2tcpip.h>
+#else
+#   include <sys/types.h>
+#   include <sys/socket.h>
+#   include <sys/time.h>
+#   include <netinet/in.h>
+#   include <netinet/tcp.h>
+#   include <netdb.h>
+#   include <poll.h>
+#   include <unistd.h>
+#endif
+
+namespace SLR {
+#if defined(SLR_Platform_Windows)
+    typedef SOCKET socket_t;
+    static const socket_t s_invalidSocket = INVALID_SOCKET;
+    
+    static void closeSocket(socket_t s) {
+        closesocket(s);
+    }
+    
+    static int pollSocket(socket_t s, int timeoutMS) {
+        WSAPOLLFD pfd = {s, POLLRDNORM, 0};
+        return WSAPoll(&pfd, 1, timeoutMS);
+    }
+    
+    static void setReceiveTimeout(socket_t s, float seconds) {
+        DWORD timeout = (DWORD)(seconds * 1000);
+        setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+    }
+    
+    static bool initializeSockets() {
+        static bool initialized = false;
+        if (!initialized) {
+            WSADATA wsaData;
+            initialized = WSAStartup(MAKEWORD(2, 2), &wsaData) == 0;
+        }
+        return initialized;
+    }
+    
+    static const int s_sendFlags = 0;
+#else
+    typedef int socket_t;
+    static const socket_t s_invalidSocket = -1;
+    
+    static void closeSocket(socket_t s) {
+        close(s);
+    }
+    
+    static int pollSocket(socket_t s, int timeoutMS) {
+        pollfd pfd = {s, POLLIN, 0};
+        return poll(&pfd, 1, timeoutMS);
+    }
+    
+    static void setReceiveTimeout(socket_t s, float seconds) {
+        timeval timeout;
+        timeout.tv_sec = (time_t)seconds;
+        timeout.tv_usec = (suseconds_t)((seconds - timeout.tv_sec) * 1e6f);
+        setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    }
+    
+    static bool initializeSockets() {
+        return true;
+    }
+
+#   if defined(MSG_NOSIGNAL)
+    static const int s_sendFlags = MSG_NOSIGNAL;
+#   else
+    static const int s_sendFlags = 0;
+#   endif
+#endif
+
+    // JP: 接続の切れたソケットへの送信でプロセスが終了しないようにする。
+    // EN: prevent the process from being terminated by sending to a disconnected socket.
+    static void disableSigPipe(socket_t s) {
+#if defined(SO_NOSIGPIPE)
+        int value = 1;
+        setsockopt(s, SOL_SOCKET, SO_NOSIGPIPE, &value, sizeof(value));
+#endif
+    }
+    
+    static bool sendAll(socket_t s, const void* data, size_t size) {
+        const char* ptr = (const char*)data;
+        while (size > 0) {
+            int chunk = (int)std::min<size_t>(size, 1 << 20);
+            int sent = (int)send(s, ptr, chunk, s_sendFlags);
+            if (sent <= 0)
+                return false;
+            ptr += sent;
+            size -= sent;
+        }
+        return true;
+    }
+    
+    static bool receiveAll(socket_t s, void* data, size_t size) {
+        char* ptr = (char*)data;
+        while (size > 0) {
+            int chunk = (int)std::min<size_t>(size, 1 << 20);
+            int received = (int)recv(s, ptr, chunk, 0);
+            if (received <= 0)
+                return false;
+            ptr += received;
+            size -= received;
+        }
+        return true;
+    }
+    
+    
+    
+    static const char s_protocolMagic[8] = {'S', 'L', 'R', 'D', 'I', 'S', 'T', '\0'};
+    static const uint32_t s_protocolVersion = 2;
+    static const float s_helloTimeout = 10.0f;
+    // JP: タイムアウトが無制限の場合のハートビートの間隔[s]。
+    // EN: heartbeat interval [s] when the timeout is unlimited.
+    static const float s_defaultHeartbeatInterval = 10.0f;
+    // JP: 受信前に明らかに不正な結果の大きさを拒否するための上限。
+    //     これ以下でも確保できない大きさは、受信処理で単位の喪失として扱う。
+    // EN: upper limit to reject obviously invalid result sizes before receiving.
+    //     Sizes below this which cannot be allocated are treated as a lost unit while receiving.
+    static const uint64_t s_maxResultSize = 1ull << 40;
+    
+    enum class MessageType : uint32_t {
+        Finish = 0,
+        Unit,
+    };
+    
+    struct UnitMessage {
+        MessageType type;
+        uint32_t index;
+        uint32_t numUnits;
+        int32_t rngSeed;
+        float heartbeatInterval;
+    };
+    
+    enum class WorkerMessageType : uint32_t {
+        Result = 0,
+        Heartbeat,
+    };
+    
+    // JP: valueは結果の場合は続くデータの大きさ、ハートビートの場合は単位のレンダリングの経過時間[ms]。
+    // EN: value is the size of the following data for a result, and the elapsed time [ms] rendering the unit for a heartbeat.
+    struct WorkerMessage {
+        uint32_t index;
+        WorkerMessageType type;
+        uint64_t value;
+    };
+    
+    SLR_API int32_t renderUnitSeed(int32_t baseSeed, uint32_t unitIndex) {
+        return (int32_t)((uint32_t)baseSeed ^ (0x9E3779B9u * unitIndex));
+    }
+    
+    
+    
+    struct RenderCoordinator::Connection {
+        socket_t socket;
+        std::string address;
+    };
+    
+    RenderCoordinator::RenderCoordinator(uint16_t port, uint32_t numUnits, int32_t baseSeed, float unitTimeout) :
+    m_numUnits(numUnits), m_baseSeed(baseSeed), m_unitTimeout(unitTimeout), m_listenSocket(-1), m_port(0),
+    m_numMergedUnits(0), m_numPasses(0), m_numReassignments(0), m_sensor(nullptr), m_failed(false) {
+        if (!initializeSockets())
+            return;
+        
+        socket_t s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (s == s_invalidSocket)
+            return;
+        int reuse = 1;
+        setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+        
+        sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(port);
+        socklen_t addrLen = sizeof(addr);
+        if (bind(s, (const sockaddr*)&addr, sizeof(addr)) != 0 || listen(s, 16) != 0 ||
+            getsockname(s, (sockaddr*)&addr, &addrLen) != 0) {
+            closeSocket(s);
+            return;
+        }
+        m_listenSocket = (int64_t)s;
+        m_port = ntohs(addr.sin_port);
+    }
+    
+    RenderCoordinator::~RenderCoordinator() {
+        if (m_listenSocket >= 0)
+            closeSocket((socket_t)m_listenSocket);
+    }
+    
+    void RenderCoordinator::finishUnit(uint32_t unitIndex, std::unique_ptr<ImageSensor> &result, uint32_t numPasses) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_finishedUnits[unitIndex])
+            return;
+        m_finishedUnits[unitIndex] = true;
+        m_numPasses += numPasses;
+        m_unmergedResults[unitIndex] = std::move(result);
+        
+        // JP: 浮動小数点数の加算の順序を固定するため、番号の連続した結果だけを合算する。
+        // EN: sum up only results with consecutive indices to fix the order of floating-point additions.
+        while (!m_unmergedResults.empty() && m_unmergedResults.begin()->first == m_numMergedUnits) {
+            if (!m_sensor->accumulate(*m_unmergedResults.begin()->second)) {
+                printf("Unit %u has a sensor configuration different from the others.\n", m_numMergedUnits);
+                m_failed = true;
+            }
+            m_unmergedResults.erase(m_unmergedResults.begin());
+            ++m_numMergedUnits;
+        }
+        printf("Unit %u finished: %u / %u units merged\n", unitIndex, m_numMergedUnits, m_numUnits);
+        m_condVar.notify_all();
+    }
+    
+    void RenderCoordinator::serveWorker(Connection* connection) {
+        socket_t s = connection->socket;
+        disableSigPipe(s);
+        int keepAlive = 1;
+        setsockopt(s, SOL_SOCKET, SO_KEEPALIVE, (const char*)&keepAlive, sizeof(keepAlive));
+        
+        setReceiveTimeout(s, s_helloTimeout);
+        char magic[sizeof(s_protocolMagic)];
+        uint32_t version;
+        if (!receiveAll(s, magic, sizeof(magic)) || !receiveAll(s, &version, sizeof(version)) ||
+            std::memcmp(magic, s_protocolMagic, sizeof(magic)) != 0 || version != s_protocolVersion) {
+            printf("Rejected a connection from %s: protocol mismatch\n", connection->address.c_str());
+            closeSocket(s);
+            return;
+        }
+        setReceiveTimeout(s, m_unitTimeout);
+        printf("Worker connected: %s\n", connection->address.c_str());
+        
+        while (true) {
+            uint32_t unitIdx;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_condVar.wait(lock, [this]() { return !m_pendingUnits.empty() || m_numMergedUnits == m_numUnits || m_failed; });
+                if (m_pendingUnits.empty() || m_failed) {
+                    UnitMessage msg = {MessageType::Finish, 0, 0};
+                    sendAll(s, &msg, sizeof(msg));
+                    break;
+                }
+                unitIdx = m_pendingUnits.front();
+                m_pendingUnits.pop_front();
+            }
+            
+            float heartbeatInterval = m_unitTimeout > 0 ? 0.25f * m_unitTimeout : s_defaultHeartbeatInterval;
+            UnitMessage msg = {MessageType::Unit, unitIdx, m_numUnits, renderUnitSeed(m_baseSeed, unitIdx), heartbeatInterval};
+            bool success = sendAll(s, &msg, sizeof(msg));
+            // JP: 受信のタイムアウトはメッセージごとに働くので、ハートビートが届く限り単位のレンダリングを待ち続ける。
+            // EN: the receive timeout applies to each message, so rendering of the unit is awaited as long as heartbeats arrive.
+            WorkerMessage header;
+            uint64_t elapsedMS = 0;
+            while (success) {
+                success = receiveAll(s, &header, sizeof(header)) && header.index == unitIdx;
+                if (!success || header.type != WorkerMessageType::Heartbeat)
+                    break;
+                elapsedMS = header.value;
+            }
+            success = success && header.type == WorkerMessageType::Result && header.value <= s_maxResultSize;
+            std::vector<uint8_t> data;
+            // JP: 壊れたメッセージや悪意のあるメッセージが確保できない大きさを要求しても、
+            //     コーディネーターを止めずに単位を失ったものとして割り当て直す。
+            // EN: even if a corrupted or malicious message requests a size which cannot be allocated,
+            //     reassign the unit as lost without stopping the coordinator.
+            if (success) {
+                try {
+                    data.resize(header.value);
+                }
+                catch (const std::bad_alloc &) {
+                    success = false;
+                }
+                success = success && receiveAll(s, data.data(), data.size());
+            }
+            
+            // JP: 一時ファイルを介して、チェックポイントと同じ読み込み処理でセンサーの状態を取り出す。
+            //     センサーは受信したデータに収まらない解像度を拒否する。
+            // EN: extract the sensor state with the same reading procedure as checkpoints through a temporary file.
+            //     The sensor rejects a resolution which does not fit in the received data.
+            std::unique_ptr<ImageSensor> result(new ImageSensor(1.0f));
+            uint32_t numPasses = 0;
+            if (success) {
+                FILE* fp = tmpfile();
+                success = fp != nullptr;
+                if (success) {
+                    success = (fwrite(data.data(), 1, data.size(), fp) == data.size() &&
+                               fseek(fp, 0, SEEK_SET) == 0 &&
+                               PassScheduler::readCheckpointSensor(fp, result.get(), &numPasses));
+                    fclose(fp);
+                }
+            }
+            
+            if (!success) {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                if (!m_finishedUnits[unitIdx]) {
+                    m_pendingUnits.push_front(unitIdx);
+                    ++m_numReassignments;
+                }
+                printf("Lost unit %u on %s after %g[s], reassigning it.\n", unitIdx, connection->address.c_str(), elapsedMS * 0.001f);
+                m_condVar.notify_all();
+                break;
+            }
+            finishUnit(unitIdx, result, numPasses);
+        }
+        closeSocket(s);
+    }
+    
+    bool RenderCoordinator::run(ImageSensor* sensor, uint32_t* numPasses) {
+        if (!isListening())
+            return false;
+        
+        m_sensor = sensor;
+        m_pendingUnits.clear();
+        for (uint32_t i = 0; i < m_numUnits; ++i)
+            m_pendingUnits.push_back(i);
+        m_finishedUnits.assign(m_numUnits, false);
+        m_unmergedResults.clear();
+        m_numMergedUnits = 0;
+        m_numPasses = 0;
+        m_numReassignments = 0;
+        m_failed = false;
+        printf("Distributed rendering: %u units, listening on port %u\n", m_numUnits, m_port);
+        
+        std::vector<std::unique_ptr<Connection>> connections;
+        std::vector<std::thread> threads;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                if (m_numMergedUnits == m_numUnits || m_failed)
+                    break;
+            }
+            if (pollSocket((socket_t)m_listenSocket, 100) <= 0)
+                continue;
+            
+            sockaddr_storage addr;
+            socklen_t addrLen = sizeof(addr);
+            socket_t s = accept((socket_t)m_listenSocket, (sockaddr*)&addr, &addrLen);
+            if (s == s_invalidSocket)
+                continue;
+            char host[NI_MAXHOST], service[NI_MAXSERV];
+            std::string address = "unknown";
+            if (getnameinfo((const sockaddr*)&addr, addrLen, host, sizeof(host), service, sizeof(service), NI_NUMERICHOST | NI_NUMERICSERV) == 0)
+                address = std::string(host) + ":" + service;
+            
+            connections.emplace_back(new Connection{s, address});
+            threads.emplace_back(&RenderCoordinator::serveWorker, this, connections.back().get());
+        }
+        
+        m_condVar.notify_all();
+        for (int i = 0; i < threads.size(); ++i)
+            threads[i].join();
+        
+        *numPasses = m_numPasses;
+        if (m_numReassignments > 0)
+            printf("Reassigned units: %u\n", m_numReassignments);
+        return !m_failed;
+    }
+    
+    
+    
+    bool RenderWorker::run(const RenderFunction &renderUnit) const {
+        if (!initializeSockets())
+            return false;
+        
+        addrinfo hints;
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* addrs;
+        if (getaddrinfo(m_host.c_str(), std::to_string(m_port).c_str(), &hints, &addrs) != 0) {
+            printf("Failed to resolve the coordinator: %s\n", m_host.c_str());
+            return false;
+        }
+        socket_t s = s_invalidSocket;
+        for (addrinfo* addr = addrs; addr != nullptr; addr = addr->ai_next) {
+            s = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+            if (s == s_invalidSocket)
+                continue;
+            if (connect(s, addr->ai_addr, (socklen_t)addr->ai_addrlen) == 0)
+                break;
+            closeSocket(s);
+            s = s_invalidSocket;
+        }
+        freeaddrinfo(addrs);
+        if (s == s_invalidSocket) {
+            printf("Failed to connect to the coordinator: %s:%u\n", m_host.c_str(), m_port);
+            return false;
+        }
+        disableSigPipe(s);
+        int keepAlive = 1;
+        setsockopt(s, SOL_SOCKET, SO_KEEPALIVE, (const char*)&keepAlive, sizeof(keepAlive));
+        
+        bool finished = false;
+        bool success = (sendAll(s, s_protocolMagic, sizeof(s_protocolMagic)) &&
+                        sendAll(s, &s_protocolVersion, sizeof(s_protocolVersion)));
+        while (success) {
+            UnitMessage msg;
+            if (!receiveAll(s, &msg, sizeof(msg)))
+                break;
+            if (msg.type == MessageType::Finish) {
+                finished = true;
+                break;
+            }
+            
+            printf("Rendering unit %u / %u (seed: %d)\n", msg.index, msg.numUnits, msg.rngSeed);
+            std::remove(m_checkpointPath.c_str());
+            
+            // JP: レンダリングの間、コーディネーターが単位を失ったと判断しないようにハートビートを送り続ける。
+            // EN: keep sending heartbeats during rendering so that the coordinator doesn't regard the unit as lost.
+            std::mutex heartbeatMutex;
+            std::condition_variable heartbeatCondVar;
+            bool rendering = true;
+            std::thread heartbeatThread([&]() {
+                using namespace std::chrono;
+                system_clock::time_point unitStart = system_clock::now();
+                std::unique_lock<std::mutex> lock(heartbeatMutex);
+                while (!heartbeatCondVar.wait_for(lock, duration<float>(msg.heartbeatInterval), [&]() { return !rendering; })) {
+                    uint64_t elapsedMS = duration_cast<milliseconds>(system_clock::now() - unitStart).count();
+                    WorkerMessage heartbeat = {msg.index, WorkerMessageType::Heartbeat, elapsedMS};
+                    if (!sendAll(s, &heartbeat, sizeof(heartbeat)))
+                        break;
+                }
+            });
+            bool rendered = renderUnit(RenderUnit{msg.index, msg.numUnits, msg.rngSeed}, m_checkpointPath);
+            {
+                std::unique_lock<std::mutex> lock(heartbeatMutex);
+                rendering = false;
+            }
+            heartbeatCondVar.notify_all();
+            heartbeatThread.join();
+            if (!rendered)
+                break;
+            
+            FILE* fp = fopen(m_checkpointPath.c_str(), "rb");
+            if (fp == nullptr)
+                break;
+            std::vector<uint8_t> data;
+            success = fseek(fp, 0, SEEK_END) == 0;
+            long size = ftell(fp);
+            success &= size >= 0 && fseek(fp, 0, SEEK_SET) == 0;
+            if (success) {
+                data.resize(size);
+                success = fread(data.data(), 1, data.size(), fp) == data.size();
+            }
+            fclose(fp);
+            std::remove(m_checkpointPath.c_str());
+            
+            WorkerMessage header = {msg.index, WorkerMessageType::Result, data.size()};
+            success = (success &&
+                       sendAll(s, &header, sizeof(header)) &&
+                       sendAll(s, data.data(), data.size()));
+        }
+        closeSocket(s);
+        return finished;
+    }
+}
@@ -0,0 +1,117 @@
+//
+//  DistributedRendering.h
+//
+//  Created by 渡部 心 on 2017/06/26.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#ifndef __SLR_DistributedRendering__
+#define __SLR_DistributedRendering__
+
+#include "../defines.h"
+#include "../declarations.h"
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+namespace SLR {
+    // JP: 分散レンダリングの作業単位。シーンのサンプル数を単位の数で等分したパスの範囲のうち、index番目の範囲を表す。
+    //     範囲はRenderSettingItem::PassRangeIndex/NumPassRangesとしてレンダラーに渡す。
+    //     サンプル数の決まらないプログレッシブモードでは、各単位がシーンの設定通りにレンダリングする。
+    // EN: a work unit of distributed rendering. This represents the index-th range of passes dividing the scene's sample count evenly by the number of units.
+    //     The range is passed to the renderer as RenderSettingItem::PassRangeIndex/NumPassRanges.
+    //     In progressive mode where the sample count is not determined, each unit renders as configured in the scene.
+    struct RenderUnit {
+        uint32_t index;
+        uint32_t numUnits;
+        int32_t rngSeed;
+    };
+    
+    // JP: 単位の乱数シードは基本シードと単位の番号のみから決まる。単位0は基本シードそのものを用いるので、単位が1つなら通常のレンダリングと一致する。
+    // EN: the RNG seed of a unit is determined only by the base seed and the unit index. Unit 0 uses the base seed itself,
+    //     so a single unit matches the ordinary rendering.
+    SLR_API int32_t renderUnitSeed(int32_t baseSeed, uint32_t unitIndex);
+    
+    
+    
+    // JP: 分散レンダリングのコーディネーター。TCPで接続してきたワーカーに作業単位を配り、
+    //     ワーカーが返すチェックポイントからセンサーの蓄積状態を取り出して合算する。
+    //     ワーカーはレンダリング中に定期的にハートビートを送る。接続が切れた場合やハートビートと結果が時間内に届かない場合、
+    //     その単位は別のワーカーに割り当て直される。
+    //     合算は単位の番号順に行うので、ワーカーの数や割り当て、障害の有無によらず結果は同じになる。
+    //     ワーカーとはバイト順の同じ計算機の間で通信することを前提とする。
+    // EN: the coordinator of distributed rendering. This hands out work units to workers connecting over TCP,
+    //     extracts the accumulation states of the sensor from checkpoints returned by the workers and sums them up.
+    //     Workers periodically send heartbeats while rendering. When a worker's connection is lost or neither heartbeats nor its result arrive in time,
+    //     its unit is reassigned to another worker.
+    //     Summation is done in the order of unit indices, so the result is the same regardless of the number of workers, assignment and failures.
+    //     Communication with workers assumes machines with the same byte order.
+    class SLR_API RenderCoordinator {
+        struct Connection;
+        
+        uint32_t m_numUnits;
+        int32_t m_baseSeed;
+        float m_unitTimeout;
+        int64_t m_listenSocket;
+        uint16_t m_port;
+        
+        std::mutex m_mutex;
+        std::condition_variable m_condVar;
+        std::deque<uint32_t> m_pendingUnits;
+        std::vector<bool> m_finishedUnits;
+        std::map<uint32_t, std::unique_ptr<ImageSensor>> m_unmergedResults;
+        uint32_t m_numMergedUnits;
+        uint32_t m_numPasses;
+        uint32_t m_numReassignments;
+        ImageSensor* m_sensor;
+        bool m_failed;
+        
+        void serveWorker(Connection* connection);
+        void finishUnit(uint32_t unitIndex, std::unique_ptr<ImageSensor> &result, uint32_t numPasses);
+    public:
+        // JP: portが0の場合は空いているポートを用いる。unitTimeoutはワーカーからのメッセージが途絶えてよい秒数で、0なら無制限。
+        //     ワーカーにはその4分の1の間隔でハートビートを送らせるので、単位のレンダリング時間はunitTimeoutに制限されない。
+        // EN: an available port is used if port is 0. unitTimeout is the number of seconds messages from a worker may stall, unlimited if 0.
+        //     Workers are made to send heartbeats at a quarter of that interval, so the rendering time of a unit is not limited by unitTimeout.
+        RenderCoordinator(uint16_t port, uint32_t numUnits, int32_t baseSeed, float unitTimeout = 0.0f);
+        ~RenderCoordinator();
+        
+        bool isListening() const { return m_listenSocket >= 0; }
+        uint16_t port() const { return m_port; }
+        
+        // JP: 全ての単位が合算されるまでワーカーを受け付ける。sensorはinit()されていない状態で渡し、最初の結果に合わせて構成される。
+        //     numPassesには全単位の合計パス数が返る。
+        // EN: accept workers until all the units are summed up. sensor should be passed un-init()-ed and is configured according to the first result.
+        //     The total number of passes of all the units is returned in numPasses.
+        bool run(ImageSensor* sensor, uint32_t* numPasses);
+        
+        uint32_t numReassignments() const { return m_numReassignments; }
+    };
+    
+    
+    
+    // JP: 分散レンダリングのワーカー。コーディネーターから作業単位を受け取り、renderUnitで単位をレンダリングして
+    //     checkpointPathに書き出されたチェックポイントを送り返す。コーディネーターが終了を告げるまで繰り返す。
+    //     レンダリング中は別のスレッドから経過時間を含むハートビートを送る。
+    // EN: the worker of distributed rendering. This receives work units from the coordinator, renders a unit with renderUnit
+    //     and sends back the checkpoint written to checkpointPath. This repeats until the coordinator tells it to finish.
+    //     While rendering, heartbeats with the elapsed time are sent from another thread.
+    class SLR_API RenderWorker {
+        std::string m_host;
+        uint16_t m_port;
+        std::string m_checkpointPath;
+    public:
+        typedef std::function<bool(const RenderUnit &unit, const std::string &checkpointPath)> RenderFunction;
+        
+        RenderWorker(const std::string &host, uint16_t port, const std::string &checkpointPath) :
+        m_host(host), m_port(port), m_checkpointPath(checkpointPath) {}
+        
+        // JP: renderUnitがfalseを返した場合は接続を切り、その単位は別のワーカーに割り当て直される。
+        //     コーディネーターが全ての単位の完了を告げた場合にtrueを返す。
+        // EN: if renderUnit returns false, the connection is closed and the unit is reassigned to another worker.
+        //     This returns true when the coordinator tells that all the units are completed.
+        bool run(const RenderFunction &renderUnit) const;
+    };
+}
+
+#endif /* __SLR_DistributedRendering__ */
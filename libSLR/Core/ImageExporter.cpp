@@ -0,0 +1,34 @@
+//
+//  ImageExporter.cpp
+//
+//  Created by 渡部 心 on 2017/07/02.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#include "ImageExporter.h"
+
+namespace SLR {
+    void ImageExporter::exportImage(const ImageSensor &sensor, const std::string &filepath, float scale, float* scaleSeparated) {
+        wait();
+        
+        m_snapshot.copyForResolve(sensor);
+        if (scaleSeparated)
+            m_scaleSeparated.assign(scaleSeparated, scaleSeparated + sensor.numSeparatedBuffers());
+        else
+            m_scaleSeparated.clear();
+        
+        m_thread = std::thread([this, filepath, scale]() {
+            ImageFileFormat format = m_snapshot.imageFileFormat();
+            uint32_t width = m_snapshot.width();
+            uint32_t height = m_snapshot.height();
+            m_channels.resize((size_t)width * height * ImageSensor::numImageChannels(format));
+            m_snapshot.resolve(scale, m_scaleSeparated.empty() ? nullptr : m_scaleSeparated.data(), m_channels.data());
+            ImageSensor::writeImage(filepath, format, width, height, m_channels.data());
+        });
+    }
+    
+    void ImageExporter::wait() {
+        if (m_thread.joinable())
+            m_thread.join();
+    }
+}
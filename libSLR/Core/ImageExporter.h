@@ -0,0 +1,44 @@
+//
+//  ImageExporter.h
+//
+//  Created by 渡部 心 on 2017/07/02.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#ifndef __SLR_ImageExporter__
+#define __SLR_ImageExporter__
+
+#include "../defines.h"
+#include "../declarations.h"
+#include "ImageSensor.h"
+#include <thread>
+
+namespace SLR {
+    // JP: レンダリング中の画像の書き出しを次のパスと並行して行う。
+    //     exportImage()は呼び出したスレッドでセンサーのバッファを複製するだけで、
+    //     ピクセルの値の確定・トーンマップ・圧縮・ファイルへの書き込みは別のスレッドで行う。
+    //     複製を置く領域は1つなので、前の書き出しが終わっていなければ終わるまで待つ。
+    // EN: exports images during rendering in parallel with the next pass.
+    //     exportImage() only copies the buffers of the sensor on the calling thread,
+    //     and resolving pixel values, tone mapping, compression and writing to the file are performed on another thread.
+    //     There is a single storage for the copy, so this waits for the previous export if it hasn't finished.
+    class SLR_API ImageExporter {
+        ImageSensor m_snapshot;
+        std::vector<float> m_scaleSeparated;
+        std::vector<float> m_channels;
+        std::thread m_thread;
+        
+        ImageExporter(const ImageExporter &) = delete;
+        ImageExporter &operator=(const ImageExporter &) = delete;
+    public:
+        ImageExporter() : m_snapshot(1.0f) { }
+        ~ImageExporter() { wait(); }
+        
+        void exportImage(const ImageSensor &sensor, const std::string &filepath, float scale, float* scaleSeparated = nullptr);
+        // JP: 進行中の書き出しの完了を待つ。
+        // EN: waits for the completion of the ongoing export.
+        void wait();
+    };
+}
+
+#endif /* __SLR_ImageExporter__ */
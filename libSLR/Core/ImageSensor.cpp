@@ -8,6 +8,15 @@
 #include "ImageSensor.h"
 
 #include "../Helper/bmp_exporter.h"
+#include "../Helper/ThreadPool.h"
+#include <cstring>
+#include <mutex>
+#include <condition_variable>
+#include <half.h>
+#include <ImfOutputFile.h>
+#include <ImfChannelList.h>
+#include <ImfFrameBuffer.h>
+#include <ImfHeader.h>
 
 namespace SLR {
     static const uint32_t s_log2_tileWidth = 3;
@@ -15,11 +24,11 @@ namespace SLR {
     static const uint32_t s_localMask = (1 << s_log2_tileWidth) - 1;
     
     ImageSensor::ImageSensor(float sensitivity) :
-    m_data(nullptr), m_separatedData(nullptr), m_numSeparated(0), m_sensitivity(sensitivity)
+    m_data(nullptr), m_separatedData(nullptr), m_numSeparated(0), m_halfData(nullptr), m_sampleCounts(nullptr), m_passSnapshot(nullptr), m_evenPassSum(nullptr), m_numPasses(0), m_sensitivity(sensitivity), m_fileFormat(ImageFileFormat::BMP)
     {}
     
     ImageSensor::ImageSensor(uint32_t width, uint32_t height, float sensitivity) :
-    m_data(nullptr), m_separatedData(nullptr), m_numSeparated(0), m_sensitivity(sensitivity) {
+    m_data(nullptr), m_separatedData(nullptr), m_numSeparated(0), m_halfData(nullptr), m_sampleCounts(nullptr), m_passSnapshot(nullptr), m_evenPassSum(nullptr), m_numPasses(0), m_sensitivity(sensitivity), m_fileFormat(ImageFileFormat::BMP) {
         init(width, height);
     }
     
@@ -31,6 +40,14 @@ namespace SLR {
                 SLR_freealign(m_separatedData[i]);
             SLR_freealign(m_separatedData);
         }
+        if (m_halfData)
+            SLR_freealign(m_halfData);
+        if (m_sampleCounts)
+            SLR_freealign(m_sampleCounts);
+        if (m_passSnapshot)
+            SLR_freealign(m_passSnapshot);
+        if (m_evenPassSum)
+            SLR_freealign(m_evenPassSum);
     }
     
     void ImageSensor::init(uint32_t width, uint32_t height) {
@@ -38,6 +55,28 @@ namespace SLR {
         m_height = height;
         if (m_data)
             SLR_freealign(m_data);
+        if (m_halfData)
+            SLR_freealign(m_halfData);
+        m_halfData = nullptr;
+        if (m_sampleCounts)
+            SLR_freealign(m_sampleCounts);
+        m_sampleCounts = nullptr;
+        if (m_passSnapshot)
+            SLR_freealign(m_passSnapshot);
+        m_passSnapshot = nullptr;
+        if (m_evenPassSum)
+            SLR_freealign(m_evenPassSum);
+        m_evenPassSum = nullptr;
+        m_numPasses = 0;
+        // JP: 同じセンサーで繰り返しレンダリングできるよう、分離されたバッファも解放する。
+        // EN: also release the separated buffers so that the same sensor can be used for repeated rendering.
+        if (m_separatedData) {
+            for (int i = 0; i < m_numSeparated; ++i)
+                SLR_freealign(m_separatedData[i]);
+            SLR_freealign(m_separatedData);
+        }
+        m_separatedData = nullptr;
+        m_numSeparated = 0;
         
         m_numTileX = (width + (s_tileWidth - 1)) >> s_log2_tileWidth;
         m_numTileY = (height + (s_tileWidth - 1)) >> s_log2_tileWidth;
@@ -61,7 +100,43 @@ namespace SLR {
         }
         clearSeparatedBuffers();
     }
-
+    
+    void ImageSensor::enableVarianceEstimation() {
+        if (m_halfData)
+            return;
+        m_halfData = (uint8_t*)SLR_memalign(m_allocSize, SLR_L1_Cacheline_Size);
+        SLRAssert(m_halfData, "Failed to allocate a half buffer.");
+        size_t numPixels = m_allocSize / sizeof(SpectrumStorage);
+        m_sampleCounts = (uint32_t*)SLR_memalign(sizeof(uint32_t) * numPixels, SLR_L1_Cacheline_Size);
+        SLRAssert(m_sampleCounts, "Failed to allocate sample counts.");
+        for (int i = 0; i < numPixels; ++i) {
+            *((SpectrumStorage*)m_halfData + i) = SpectrumStorage(0.0);
+            m_sampleCounts[i] = 0;
+        }
+    }
+    
+    void ImageSensor::enablePassVarianceEstimation() {
+        if (m_passSnapshot)
+            return;
+        size_t numPixels = m_allocSize / sizeof(SpectrumStorage);
+        m_passSnapshot = (DiscretizedSpectrum*)SLR_memalign(sizeof(DiscretizedSpectrum) * numPixels, SLR_L1_Cacheline_Size);
+        m_evenPassSum = (DiscretizedSpectrum*)SLR_memalign(sizeof(DiscretizedSpectrum) * numPixels, SLR_L1_Cacheline_Size);
+        SLRAssert(m_passSnapshot && m_evenPassSum, "Failed to allocate buffers for error estimation.");
+        for (int i = 0; i < numPixels; ++i) {
+            m_passSnapshot[i] = DiscretizedSpectrum(0.0f);
+            m_evenPassSum[i] = DiscretizedSpectrum(0.0f);
+        }
+        m_numPasses = 0;
+    }
+    
+    size_t ImageSensor::pixelIndex(uint32_t x, uint32_t y) const {
+        uint32_t tx = x >> s_log2_tileWidth;
+        uint32_t ty = y >> s_log2_tileWidth;
+        uint32_t lx = x & s_localMask;
+        uint32_t ly = y & s_localMask;
+        return (ty * m_numTileX + tx) * s_tileWidth * s_tileWidth + ly * s_tileWidth + lx;
+    }
+    
     uint32_t ImageSensor::tileWidth() const {
         return s_tileWidth;
     }
@@ -75,6 +150,19 @@ namespace SLR {
             SpectrumStorage &dst = *((SpectrumStorage*)m_data + i);
             dst = SpectrumStorage(0.0);
         }
+        if (m_halfData) {
+            for (int i = 0; i < m_allocSize / sizeof(SpectrumStorage); ++i) {
+                *((SpectrumStorage*)m_halfData + i) = SpectrumStorage(0.0);
+                m_sampleCounts[i] = 0;
+            }
+        }
+        if (m_passSnapshot) {
+            for (int i = 0; i < m_allocSize / sizeof(SpectrumStorage); ++i) {
+                m_passSnapshot[i] = DiscretizedSpectrum(0.0f);
+                m_evenPassSum[i] = DiscretizedSpectrum(0.0f);
+            }
+            m_numPasses = 0;
+        }
     }
     
     void ImageSensor::clearSeparatedBuffers() {
@@ -86,6 +174,17 @@ namespace SLR {
         }
     }
     
+    void ImageSensor::mergeSeparatedBuffers(float scale) {
+        for (int i = 0; i < m_allocSize / sizeof(SpectrumStorage); ++i) {
+            SpectrumStorage &dst = *((SpectrumStorage*)m_data + i);
+            for (int b = 0; b < m_numSeparated; ++b) {
+                SpectrumStorage &src = *((SpectrumStorage*)m_separatedData[b] + i);
+                dst.getValue() += src.getValue().result * scale;
+                src = SpectrumStorage(0.0);
+            }
+        }
+    }
+    
     DiscretizedSpectrum ImageSensor::pixel(uint32_t x, uint32_t y) const {
         uint32_t tx = x >> s_log2_tileWidth;
         uint32_t ty = y >> s_log2_tileWidth;
@@ -136,49 +235,424 @@ namespace SLR {
         pixel(idx, ipx, ipy).add(wls, contribution);
     }
     
-    void ImageSensor::saveImage(const std::string &filepath, float scale, float* scaleSeparated) const {
-        struct BMP_RGB {
-            uint8_t B, G, R;
-        };
+    void ImageSensor::addSplats(uint32_t idx, const std::vector<SensorSplat> &splats) {
+        for (const SensorSplat &splat : splats)
+            add(idx, splat.px, splat.py, splat.wls, splat.contribution);
+    }
+    
+    void ImageSensor::addPixelSample(float px, float py, const WavelengthSamples &wls, const SampledSpectrum &contribution) {
+        SLRAssert(m_halfData, "Variance estimation is not enabled.");
+        uint32_t ipx = std::min((uint32_t)px, m_width - 1);
+        uint32_t ipy = std::min((uint32_t)py, m_height - 1);
+        SLRAssert(contribution.allFinite(), "invalid value: (%u, %u), %s", ipx, ipy, contribution.toString().c_str());
+        size_t idx = pixelIndex(ipx, ipy);
+        ((SpectrumStorage*)m_data + idx)->add(wls, contribution);
+        if ((m_sampleCounts[idx]++ & 1) == 0)
+            ((SpectrumStorage*)m_halfData + idx)->add(wls, contribution);
+    }
+    
+    uint32_t ImageSensor::sampleCount(uint32_t x, uint32_t y) const {
+        return m_sampleCounts ? m_sampleCounts[pixelIndex(x, y)] : 0;
+    }
+    
+    // JP: 推定値Iとその半分のサンプルによる推定値Aの差を輝度の平方根で正規化する。
+    // EN: normalize the difference between an estimate I and an estimate A by the half of the samples by the square root of the intensity.
+    static float estimateError(const DiscretizedSpectrum &I, const DiscretizedSpectrum &A) {
+        float rgbI[3], rgbA[3];
+        I.getRGB(rgbI);
+        A.getRGB(rgbA);
+        float sumI = 0.0f, sumDiff = 0.0f;
+        for (int c = 0; c < 3; ++c) {
+            sumI += std::max(rgbI[c], 0.0f);
+            sumDiff += std::fabs(rgbI[c] - rgbA[c]);
+        }
+        if (sumDiff == 0.0f)
+            return 0.0f;
+        return sumI > 0.0f ? sumDiff / std::sqrt(sumI) : INFINITY;
+    }
+    
+    float ImageSensor::estimateTileError(uint32_t tx, uint32_t ty, float scale) const {
+        SLRAssert(m_halfData, "Variance estimation is not enabled.");
+        scale *= std::isinf(m_sensitivity) ? 1.0f : m_sensitivity;
+        float maxError = 0.0f;
+        for (int ly = 0; ly < s_tileWidth; ++ly) {
+            uint32_t y = ty * s_tileWidth + ly;
+            if (y >= m_height)
+                break;
+            for (int lx = 0; lx < s_tileWidth; ++lx) {
+                uint32_t x = tx * s_tileWidth + lx;
+                if (x >= m_width)
+                    break;
+                size_t idx = pixelIndex(x, y);
+                uint32_t numSamples = m_sampleCounts[idx];
+                if (numSamples < 2)
+                    return INFINITY;
+                uint32_t numHalfSamples = (numSamples + 1) / 2;
+                
+                DiscretizedSpectrum I = ((SpectrumStorage*)m_data + idx)->getValue().result * (scale / numSamples);
+                DiscretizedSpectrum A = ((SpectrumStorage*)m_halfData + idx)->getValue().result * (scale / numHalfSamples);
+                maxError = std::max(maxError, estimateError(I, A));
+            }
+        }
+        return maxError;
+    }
+    
+    void ImageSensor::finishPass() {
+        SLRAssert(m_passSnapshot, "Pass variance estimation is not enabled.");
+        bool evenPass = (m_numPasses & 1) == 0;
+        for (int i = 0; i < m_height; ++i) {
+            for (int j = 0; j < m_width; ++j) {
+                size_t idx = pixelIndex(j, i);
+                CompensatedSum<DiscretizedSpectrum> pixSum = pixel(j, i).getValue().result;
+                for (int b = 0; b < m_numSeparated; ++b)
+                    pixSum += pixel(b, j, i).getValue().result;
+                if (evenPass)
+                    m_evenPassSum[idx] += pixSum.result - m_passSnapshot[idx];
+                m_passSnapshot[idx] = pixSum.result;
+            }
+        }
+        ++m_numPasses;
+    }
+    
+    float ImageSensor::estimateImageError(float scale) const {
+        SLRAssert(m_passSnapshot, "Pass variance estimation is not enabled.");
+        if (m_numPasses < 2)
+            return INFINITY;
+        scale *= std::isinf(m_sensitivity) ? 1.0f : m_sensitivity;
+        uint32_t numEvenPasses = (m_numPasses + 1) / 2;
+        double sumError = 0.0;
+        for (int i = 0; i < m_height; ++i) {
+            for (int j = 0; j < m_width; ++j) {
+                size_t idx = pixelIndex(j, i);
+                float error = estimateError(m_passSnapshot[idx] * (scale / m_numPasses), m_evenPassSum[idx] * (scale / numEvenPasses));
+                if (std::isinf(error))
+                    return INFINITY;
+                sumError += error;
+            }
+        }
+        return float(sumError / (m_width * m_height));
+    }
+    
+    bool ImageSensor::writeState(FILE* fp) const {
+        const uint32_t header[] = {m_width, m_height, m_numSeparated,
+            m_halfData != nullptr, m_passSnapshot != nullptr, m_numPasses};
+        size_t numPixels = m_allocSize / sizeof(SpectrumStorage);
+        if (fwrite(header, sizeof(header), 1, fp) != 1)
+            return false;
+        if (fwrite(m_data, m_allocSize, 1, fp) != 1)
+            return false;
+        for (int b = 0; b < m_numSeparated; ++b) {
+            if (fwrite(m_separatedData[b], m_allocSize, 1, fp) != 1)
+                return false;
+        }
+        if (m_halfData) {
+            if (fwrite(m_halfData, m_allocSize, 1, fp) != 1 ||
+                fwrite(m_sampleCounts, sizeof(uint32_t) * numPixels, 1, fp) != 1)
+                return false;
+        }
+        if (m_passSnapshot) {
+            if (fwrite(m_passSnapshot, sizeof(DiscretizedSpectrum) * numPixels, 1, fp) != 1 ||
+                fwrite(m_evenPassSum, sizeof(DiscretizedSpectrum) * numPixels, 1, fp) != 1)
+                return false;
+        }
+        return true;
+    }
+    
+    bool ImageSensor::readState(FILE* fp) {
+        uint32_t header[6];
+        if (fread(header, sizeof(header), 1, fp) != 1)
+            return false;
+        if (m_data == nullptr) {
+            // JP: 壊れたヘッダーで巨大な確保をしないよう、全てのバッファがファイルの残りに収まる場合のみ受け付ける。
+            // EN: accept the header only if all the buffers fit in the rest of the file to avoid a huge allocation from a corrupted header.
+            long curPos = ftell(fp);
+            if (curPos < 0 || fseek(fp, 0, SEEK_END) != 0)
+                return false;
+            long endPos = ftell(fp);
+            if (endPos < 0 || fseek(fp, curPos, SEEK_SET) != 0)
+                return false;
+            uint64_t numTiles = (((uint64_t)header[0] + (s_tileWidth - 1)) >> s_log2_tileWidth) * (((uint64_t)header[1] + (s_tileWidth - 1)) >> s_log2_tileWidth);
+            uint64_t numBuffers = 1 + (uint64_t)header[2] + (header[3] ? 1 : 0);
+            if (numTiles > (uint64_t)(endPos - curPos) / (sizeof(SpectrumStorage) * s_tileWidth * s_tileWidth * numBuffers))
+                return false;
+            
+            init(header[0], header[1]);
+            if (header[2] > 0)
+                addSeparatedBuffers(header[2]);
+            if (header[3])
+                enableVarianceEstimation();
+            if (header[4])
+                enablePassVarianceEstimation();
+        }
+        if (header[0] != m_width || header[1] != m_height || header[2] != m_numSeparated ||
+            header[3] != (m_halfData != nullptr) || header[4] != (m_passSnapshot != nullptr))
+            return false;
         
+        size_t numPixels = m_allocSize / sizeof(SpectrumStorage);
+        bool success = fread(m_data, m_allocSize, 1, fp) == 1;
+        for (int b = 0; b < m_numSeparated && success; ++b)
+            success = fread(m_separatedData[b], m_allocSize, 1, fp) == 1;
+        if (m_halfData && success) {
+            success = (fread(m_halfData, m_allocSize, 1, fp) == 1 &&
+                       fread(m_sampleCounts, sizeof(uint32_t) * numPixels, 1, fp) == 1);
+        }
+        if (m_passSnapshot && success) {
+            success = (fread(m_passSnapshot, sizeof(DiscretizedSpectrum) * numPixels, 1, fp) == 1 &&
+                       fread(m_evenPassSum, sizeof(DiscretizedSpectrum) * numPixels, 1, fp) == 1);
+        }
+        if (!success) {
+            clear();
+            clearSeparatedBuffers();
+            return false;
+        }
+        m_numPasses = header[5];
+        return true;
+    }
+    
+    bool ImageSensor::accumulate(const ImageSensor &sensor) {
+        if (m_data == nullptr) {
+            init(sensor.m_width, sensor.m_height);
+            if (sensor.m_numSeparated > 0)
+                addSeparatedBuffers(sensor.m_numSeparated);
+            if (sensor.m_halfData)
+                enableVarianceEstimation();
+            if (sensor.m_passSnapshot)
+                enablePassVarianceEstimation();
+        }
+        if (sensor.m_width != m_width || sensor.m_height != m_height || (sensor.m_numSeparated > 0) != (m_numSeparated > 0) ||
+            (sensor.m_halfData != nullptr) != (m_halfData != nullptr) || (sensor.m_passSnapshot != nullptr) != (m_passSnapshot != nullptr))
+            return false;
+        
+        // JP: 分離されたバッファの数はスレッド数などに依存しうる。画像は全ての分離されたバッファの和で決まるので、数が異なる場合は巡回的に畳み込む。
+        // EN: the number of separated buffers may depend on the number of threads and so on.
+        //     The image is determined by the sum of all the separated buffers, so they are folded cyclically when the numbers differ.
+        size_t numPixels = m_allocSize / sizeof(SpectrumStorage);
+        for (int i = 0; i < numPixels; ++i) {
+            ((SpectrumStorage*)m_data + i)->getValue() += ((SpectrumStorage*)sensor.m_data + i)->getValue().result;
+            for (int b = 0; b < sensor.m_numSeparated; ++b)
+                ((SpectrumStorage*)m_separatedData[b % m_numSeparated] + i)->getValue() += ((SpectrumStorage*)sensor.m_separatedData[b] + i)->getValue().result;
+            if (m_halfData) {
+                ((SpectrumStorage*)m_halfData + i)->getValue() += ((SpectrumStorage*)sensor.m_halfData + i)->getValue().result;
+                m_sampleCounts[i] += sensor.m_sampleCounts[i];
+            }
+            if (m_passSnapshot) {
+                m_passSnapshot[i] += sensor.m_passSnapshot[i];
+                m_evenPassSum[i] += sensor.m_evenPassSum[i];
+            }
+        }
+        m_numPasses += sensor.m_numPasses;
+        return true;
+    }
+    
+    void ImageSensor::copyForResolve(const ImageSensor &sensor) {
+        if (m_data == nullptr || sensor.m_width != m_width || sensor.m_height != m_height || sensor.m_numSeparated != m_numSeparated ||
+            (sensor.m_sampleCounts != nullptr) != (m_sampleCounts != nullptr)) {
+            init(sensor.m_width, sensor.m_height);
+            if (sensor.m_numSeparated > 0)
+                addSeparatedBuffers(sensor.m_numSeparated);
+            if (sensor.m_sampleCounts)
+                enableVarianceEstimation();
+        }
+        m_sensitivity = sensor.m_sensitivity;
+        m_fileFormat = sensor.m_fileFormat;
+        
+        std::memcpy(m_data, sensor.m_data, m_allocSize);
+        for (int b = 0; b < m_numSeparated; ++b)
+            std::memcpy(m_separatedData[b], sensor.m_separatedData[b], m_allocSize);
+        if (m_sampleCounts)
+            std::memcpy(m_sampleCounts, sensor.m_sampleCounts, sizeof(uint32_t) * (m_allocSize / sizeof(SpectrumStorage)));
+    }
+    
+    // JP: 画像を行のまとまりに分けて複数のスレッドで処理する。まとまりの行数はEXRのZIP圧縮の単位に合わせる。
+    //     書き出しのたびにスレッドを作らず、同時に複数の書き出しが走ってもスレッド数がコア数を超えないよう、全ての書き出しで1つのプールを共有する。
+    //     終了時にワーカーの終了を待たないよう、プールは意図的に破棄しない。
+    // EN: process an image on multiple threads by dividing it into chunks of rows. The number of rows in a chunk matches the unit of ZIP compression of EXR.
+    //     All exports share one pool so that threads are not created for every export and their number doesn't exceed the number of cores even with concurrent exports.
+    //     The pool is intentionally not destroyed so as not to wait for the workers at exit.
+    static void parallelForRows(uint32_t height, const std::function<void(uint32_t, uint32_t)> &func) {
+        static ThreadPool* s_pool = new ThreadPool();
+        const uint32_t RowsPerChunk = 16;
+        uint32_t numRemainingChunks = (height + RowsPerChunk - 1) / RowsPerChunk;
+        std::mutex mutex;
+        std::condition_variable condVar;
+        for (uint32_t yBegin = 0; yBegin < height; yBegin += RowsPerChunk) {
+            uint32_t yEnd = std::min(yBegin + RowsPerChunk, height);
+            s_pool->enqueue([&, yBegin, yEnd](uint32_t threadID) {
+                func(yBegin, yEnd);
+                // JP: 待っているスレッドがこの関数を抜けて状態を破棄しうるので、ロックを持ったまま通知する。
+                // EN: notify while holding the lock since the waiting thread can leave this function and destroy the state.
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--numRemainingChunks == 0)
+                    condVar.notify_all();
+            });
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        condVar.wait(lock, [&]() { return numRemainingChunks == 0; });
+    }
+    
+    uint32_t ImageSensor::numImageChannels(ImageFileFormat format) {
+#ifdef SLR_Use_Spectral_Representation
+        if (format == ImageFileFormat::SpectralEXR)
+            return 3 + DiscretizedSpectrum::NumStrata;
+#endif
+        return 3;
+    }
+    
+    void ImageSensor::resolve(float scale, const float* scaleSeparated, float* channels) const {
         float* scales = (float*)alloca(sizeof(float) * m_numSeparated);
         float sensitivity = std::isinf(m_sensitivity) ? 1.0f : m_sensitivity;
         for (int i = 0; i < m_numSeparated; ++i)
             scales[i] = (scaleSeparated ? scaleSeparated[i] : scale) * sensitivity;
         scale *= sensitivity;
         
+        const uint32_t numChannels = numImageChannels(m_fileFormat);
+        parallelForRows(m_height, [&](uint32_t yBegin, uint32_t yEnd) {
+            for (int i = yBegin; i < yEnd; ++i) {
+                for (int j = 0; j < m_width; ++j) {
+                    float pixScale = scale;
+                    if (m_sampleCounts) {
+                        uint32_t numSamples = m_sampleCounts[pixelIndex(j, i)];
+                        pixScale = numSamples > 0 ? scale / numSamples : 0.0f;
+                    }
+                    CompensatedSum<DiscretizedSpectrum> pixSum = pixel(j, i) * pixScale;
+                    for (int b = 0; b < m_numSeparated; ++b)
+                        pixSum += pixel(b, j, i) * scales[b];
+                    DiscretizedSpectrum pix = pixSum.result;
+                    if (pix.hasInf())
+                        printf("(%u, %u): has an infinite value!\n%s\n", j, i, pix.toString().c_str());
+                    if (pix.hasNaN())
+                        printf("(%u, %u): has NaN!\n%s\n", j, i, pix.toString().c_str());
+                    if (pix.hasMinus())
+                        printf("(%u, %u): has a minus value!\n%s\n", j, i, pix.toString().c_str());
+                    
+                    float* dst = channels + ((size_t)i * m_width + j) * numChannels;
+                    pix.getRGB(dst);
+#ifdef SLR_Use_Spectral_Representation
+                    for (int c = 3; c < numChannels; ++c)
+                        dst[c] = pix.values[c - 3];
+#endif
+                }
+            }
+        });
+    }
+    
+    static void writeBMP(const std::string &filepath, uint32_t width, uint32_t height, const float* channels) {
+        struct BMP_RGB {
+            uint8_t B, G, R;
+        };
+        
+        // JP: 行末の詰め物も含めて同じ画像からは同じファイルになるよう、0で初期化する。
+        // EN: initialize with zero so that the same image always results in the same file including the padding at the end of rows.
+        uint32_t byteWidth = 3 * width + width % 4;
+        uint8_t* bmp = (uint8_t*)calloc(height * byteWidth, 1);
+        parallelForRows(height, [&](uint32_t yBegin, uint32_t yEnd) {
+            for (int i = yBegin; i < yEnd; ++i) {
+                for (int j = 0; j < width; ++j) {
+                    const float* src = channels + 3 * ((size_t)i * width + j);
+                    float RGB[3];
+                    RGB[0] = src[0] < 0.0f ? 0.0f : src[0];
+                    RGB[1] = src[1] < 0.0f ? 0.0f : src[1];
+                    RGB[2] = src[2] < 0.0f ? 0.0f : src[2];
+                    
+                    float Y = sRGB_to_Luminance(RGB[0], RGB[1], RGB[2]);
+                    float scaleY = Y != 0 ? (1.0f - std::exp(-Y)) / Y : 0.0f;
+                    RGB[0] = std::min(scaleY * RGB[0], 1.0f);
+                    RGB[1] = std::min(scaleY * RGB[1], 1.0f);
+                    RGB[2] = std::min(scaleY * RGB[2], 1.0f);
+                    
+                    uint32_t idx = (height - i - 1) * byteWidth + 3 * j;
+                    BMP_RGB &dst = *(BMP_RGB*)(bmp + idx);
+                    dst.R = uint8_t(256 * std::min(sRGB_gamma(RGB[0]), 0.999f));
+                    dst.G = uint8_t(256 * std::min(sRGB_gamma(RGB[1]), 0.999f));
+                    dst.B = uint8_t(256 * std::min(sRGB_gamma(RGB[2]), 0.999f));
+                }
+            }
+        });
+        
+        saveBMP(filepath.c_str(), bmp, width, height);
+        free(bmp);
+    }
+    
+    // JP: 線形なsRGBの放射輝度をそのまま保存する。負の値も切り捨てない。
+    // EN: store the radiance in linear sRGB as is without clamping negative values.
+    static void writeEXR(const std::string &filepath, uint32_t numChannels, uint32_t width, uint32_t height, const float* channels) {
+        std::vector<half> pixels((size_t)width * height * numChannels);
+        parallelForRows(height, [&](uint32_t yBegin, uint32_t yEnd) {
+            for (size_t i = (size_t)yBegin * width * numChannels; i < (size_t)yEnd * width * numChannels; ++i)
+                pixels[i] = channels[i];
+        });
+        
+        // JP: 波長の層のチャンネルは中心波長で名前を付ける。(例: "S0.374,687500nm")
+        // EN: channels for the wavelength strata are named by their center wavelengths. (e.g. "S0.374,687500nm")
+        const uint32_t numStrataChannels = numChannels - 3;
+        std::vector<std::string> channelNames = {"R", "G", "B"};
+        for (int c = 0; c < numStrataChannels; ++c) {
+            double centerWavelength = WavelengthLowBound + (WavelengthHighBound - WavelengthLowBound) * (c + 0.5) / numStrataChannels;
+            // JP: 小数部だけを丸めると1000000になり得るため、全体を10^-6nm単位の整数に丸めてから分ける。
+            // EN: round the whole value to an integer in 10^-6 nm before splitting, since rounding only the fraction can give 1000000.
+            uint64_t centerWavelengthMicro = (uint64_t)std::llround(centerWavelength * 1e+6);
+            char name[32];
+            snprintf(name, sizeof(name), "S0.%u,%06unm", (uint32_t)(centerWavelengthMicro / 1000000), (uint32_t)(centerWavelengthMicro % 1000000));
+            channelNames.push_back(name);
+        }
+        
+        try {
+            Imf::Header header(width, height);
+            header.compression() = Imf::ZIP_COMPRESSION;
+            Imf::FrameBuffer frameBuffer;
+            for (int c = 0; c < numChannels; ++c) {
+                header.channels().insert(channelNames[c].c_str(), Imf::Channel(Imf::HALF));
+                frameBuffer.insert(channelNames[c].c_str(), Imf::Slice(Imf::HALF, (char*)&pixels[c], sizeof(half) * numChannels, sizeof(half) * numChannels * width));
+            }
+            Imf::OutputFile file(filepath.c_str(), header, std::thread::hardware_concurrency());
+            file.setFrameBuffer(frameBuffer);
+            file.writePixels(height);
+        }
+        catch (const std::exception &e) {
+            printf("Failed to write an EXR: %s\n%s\n", filepath.c_str(), e.what());
+        }
+    }
+    
+    void ImageSensor::writeImage(const std::string &filepath, ImageFileFormat format, uint32_t width, uint32_t height, const float* channels) {
+        if (format == ImageFileFormat::BMP)
+            writeBMP(filepath, width, height, channels);
+        else
+            writeEXR(filepath, numImageChannels(format), width, height, channels);
+    }
+    
+    void ImageSensor::saveImage(const std::string &filepath, float scale, float* scaleSeparated) const {
+        std::vector<float> channels((size_t)m_width * m_height * numImageChannels(m_fileFormat));
+        resolve(scale, scaleSeparated, channels.data());
+        writeImage(filepath, m_fileFormat, m_width, m_height, channels.data());
+    }
+    
+    void ImageSensor::saveSampleCountImage(const std::string &filepath) const {
+        struct BMP_RGB {
+            uint8_t B, G, R;
+        };
+        
+        uint32_t maxCount = 1;
+        for (int i = 0; i < m_height; ++i)
+            for (int j = 0; j < m_width; ++j)
+                maxCount = std::max(maxCount, sampleCount(j, i));
+        
         uint32_t byteWidth = 3 * m_width + m_width % 4;
         uint8_t* bmp = (uint8_t*)malloc(m_height * byteWidth);
         for (int i = 0; i < m_height; ++i) {
             for (int j = 0; j < m_width; ++j) {
-                CompensatedSum<DiscretizedSpectrum> pixSum = pixel(j, i) * scale;
-                for (int b = 0; b < m_numSeparated; ++b)
-                    pixSum += pixel(b, j, i) * scales[b];
-                DiscretizedSpectrum pix = pixSum.result;
-                if (pix.hasInf())
-                    printf("(%u, %u): has an infinite value!\n%s\n", j, i, pix.toString().c_str());
-                if (pix.hasNaN())
-                    printf("(%u, %u): has NaN!\n%s\n", j, i, pix.toString().c_str());
-                if (pix.hasMinus())
-                    printf("(%u, %u): has a minus value!\n%s\n", j, i, pix.toString().c_str());
-                
+                // JP: 青(少)から緑を経て赤(多)へのカラーマップ。
+                // EN: color map from blue (few) through green to red (many).
+                float t = (float)sampleCount(j, i) / maxCount;
                 float RGB[3];
-                pix.getRGB(RGB);
-                RGB[0] = RGB[0] < 0.0f ? 0.0f : RGB[0];
-                RGB[1] = RGB[1] < 0.0f ? 0.0f : RGB[1];
-                RGB[2] = RGB[2] < 0.0f ? 0.0f : RGB[2];
-                
-                float Y = sRGB_to_Luminance(RGB[0], RGB[1], RGB[2]);
-                float scaleY = Y != 0 ? (1.0f - std::exp(-Y)) / Y : 0.0f;
-                RGB[0] = std::min(scaleY * RGB[0], 1.0f);
-                RGB[1] = std::min(scaleY * RGB[1], 1.0f);
-                RGB[2] = std::min(scaleY * RGB[2], 1.0f);
+                RGB[0] = std::min(std::max(2 * t - 1, 0.0f), 1.0f);
+                RGB[1] = 1 - std::fabs(2 * t - 1);
+                RGB[2] = std::min(std::max(1 - 2 * t, 0.0f), 1.0f);
                 
                 uint32_t idx = (m_height - i - 1) * byteWidth + 3 * j;
                 BMP_RGB &dst = *(BMP_RGB*)(bmp + idx);
-                dst.R = uint8_t(256 * std::min(sRGB_gamma(RGB[0]), 0.999f));
-                dst.G = uint8_t(256 * std::min(sRGB_gamma(RGB[1]), 0.999f));
-                dst.B = uint8_t(256 * std::min(sRGB_gamma(RGB[2]), 0.999f));
+                dst.R = uint8_t(255 * RGB[0]);
+                dst.G = uint8_t(255 * RGB[1]);
+                dst.B = uint8_t(255 * RGB[2]);
             }
         }
         
@@ -15,17 +15,45 @@
 #include "../BasicTypes/CompensatedSum.h"
 
 namespace SLR {
+    enum class ImageFileFormat {
+        // JP: トーンマップとガンマ補正を施した8ビットの画像。
+        // EN: 8-bit image with tone mapping and gamma correction.
+        BMP = 0,
+        // JP: 線形な放射輝度をhalfで保存する。
+        // EN: linear radiance stored in half.
+        EXR,
+        // JP: EXRに加えて、波長の層ごとの値をチャンネルとして保存する。
+        // EN: EXR with additional channels for the values of the wavelength strata.
+        SpectralEXR,
+    };
+    
+    // JP: 後で分離されたバッファへ加算するために記録した寄与。
+    // EN: a contribution recorded to be added to a separated buffer later.
+    struct SensorSplat {
+        float px, py;
+        WavelengthSamples wls;
+        SampledSpectrum contribution;
+    };
+    
     class SLR_API ImageSensor {
         uint8_t* m_data;
         uint8_t** m_separatedData;
         uint32_t m_numSeparated;
+        uint8_t* m_halfData;
+        uint32_t* m_sampleCounts;
+        DiscretizedSpectrum* m_passSnapshot;
+        DiscretizedSpectrum* m_evenPassSum;
+        uint32_t m_numPasses;
         uint32_t m_width;
         uint32_t m_height;
         float m_sensitivity;
+        ImageFileFormat m_fileFormat;
         
         size_t m_numTileX;
         size_t m_numTileY;
         size_t m_allocSize;
+        
+        size_t pixelIndex(uint32_t x, uint32_t y) const;
     public:
         ImageSensor(float sensitivity);
         ImageSensor(uint32_t width, uint32_t height, float sensitivity);
@@ -33,12 +61,27 @@ namespace SLR {
         
         void init(uint32_t width, uint32_t height);
         void addSeparatedBuffers(uint32_t numBuffers);
+        // JP: ピクセルごとのサンプル数と、偶数番目のサンプルだけを蓄積する半分のバッファを確保する。
+        //     有効な場合、saveImage()は各ピクセルをそのサンプル数でも割る。
+        // EN: allocate per-pixel sample counts and a half buffer accumulating only even-numbered samples.
+        //     When enabled, saveImage() additionally divides each pixel by its own sample count.
+        void enableVarianceEstimation();
+        bool varianceEstimationEnabled() const { return m_halfData != nullptr; }
+        // JP: パス単位で画像全体の誤差を推定するためのバッファを確保する。
+        //     分離されたバッファも含めて評価するため、カーネル側の変更は不要。
+        // EN: allocate buffers to estimate the error of the entire image per pass.
+        //     This also takes the separated buffers into account and requires no change in kernels.
+        void enablePassVarianceEstimation();
         
         void clear();
         void clearSeparatedBuffers();
+        // JP: 分離されたバッファをscale倍して本体のバッファに加え、分離されたバッファをクリアする。
+        // EN: add the separated buffers multiplied by scale to the main buffer, then clear the separated buffers.
+        void mergeSeparatedBuffers(float scale);
         
         uint32_t width() const { return m_width; };
         uint32_t height() const { return m_height; };
+        uint32_t numSeparatedBuffers() const { return m_numSeparated; };
         uint32_t tileWidth() const;
         uint32_t tileHeight() const;
         uint32_t numTileX() const { return (uint32_t)m_numTileX; };
@@ -51,8 +94,66 @@ namespace SLR {
         
         void add(float px, float py, const WavelengthSamples &wls, const SampledSpectrum &contribution);
         void add(uint32_t idx, float px, float py, const WavelengthSamples &wls, const SampledSpectrum &contribution);
+        // JP: 記録した寄与を記録した順に分離されたバッファへ加算する。
+        // EN: add recorded contributions to a separated buffer in the recorded order.
+        void addSplats(uint32_t idx, const std::vector<SensorSplat> &splats);
+        // JP: 1ピクセルサンプル分の寄与を加算してサンプル数を数える。分散推定が有効な場合のみ使用できる。
+        // EN: add the contribution of a pixel sample and count it. Available only when variance estimation is enabled.
+        void addPixelSample(float px, float py, const WavelengthSamples &wls, const SampledSpectrum &contribution);
+        
+        uint32_t sampleCount(uint32_t x, uint32_t y) const;
+        // JP: 全サンプルと半分のサンプルによる推定値の差から、タイル内のピクセルの最大誤差を推定する。
+        //     誤差は輝度の平方根で正規化される。(Dammertz et al. 2010)
+        // EN: estimate the maximum error of pixels in a tile from the difference between the estimates by all samples and by the half.
+        //     The error is normalized by the square root of the intensity. (Dammertz et al. 2010)
+        float estimateTileError(uint32_t tx, uint32_t ty, float scale) const;
+        // JP: 全てのスレッドがパスを終えた後に呼ぶ。偶数番目のパスの寄与を別に蓄積する。
+        // EN: call after all threads finish a pass. This accumulates the contributions of even-numbered passes separately.
+        void finishPass();
+        // JP: 全パスと偶数番目のパスによる推定値の差から、ピクセルごとの誤差の平均を推定する。
+        // EN: estimate the average per-pixel error from the difference between the estimates by all passes and by even-numbered passes.
+        float estimateImageError(float scale) const;
+        
+        // JP: 蓄積状態(分離されたバッファ、誤差推定用のバッファを含む)をバイナリで書き出す。
+        // EN: write the accumulation state (including separated buffers and buffers for error estimation) in binary.
+        bool writeState(FILE* fp) const;
+        // JP: writeState()で書き出した状態を読み込む。解像度やバッファの構成が一致しない場合は何もせずfalseを返す。
+        //     まだinit()されていないセンサーは状態に合わせて構成される。
+        //     データの読み込みに失敗した場合はバッファをクリアしてfalseを返す。
+        // EN: read the state written by writeState(). This returns false without doing anything if the resolution or buffer configuration differs.
+        //     A sensor which has not been init()-ed yet is configured according to the state.
+        //     If reading the data fails, this clears the buffers and returns false.
+        bool readState(FILE* fp);
+        // JP: 別のセンサーの蓄積状態を全てのバッファに加算する。まだinit()されていないセンサーはsensorと同じ構成になる。
+        //     分離されたバッファの数は異なってもよい。それ以外の構成が一致しない場合は何もせずfalseを返す。
+        // EN: add the accumulation state of another sensor to all the buffers. A sensor which has not been init()-ed yet gets the same configuration as sensor.
+        //     The numbers of separated buffers may differ. This returns false without doing anything if the rest of the configuration differs.
+        bool accumulate(const ImageSensor &sensor);
+        // JP: resolve()が読むバッファと設定だけをsensorから複製し、必要なら構成も合わせる。
+        //     メモリーのコピーだけなのでresolve()よりずっと軽く、複製したセンサーは元のセンサーのレンダリングと並行してresolve()できる。
+        // EN: copies only the buffers and settings read by resolve() from sensor, matching the configuration if needed.
+        //     This is only memory copies, much lighter than resolve(), and the copy can be resolve()-ed in parallel with rendering into the original sensor.
+        void copyForResolve(const ImageSensor &sensor);
+        
+        // JP: saveImage()が書き出す形式。ファイル名の拡張子はimageFileExtension()に合わせる。
+        // EN: the format written by saveImage(). The extension of the file name should follow imageFileExtension().
+        void setImageFileFormat(ImageFileFormat format) { m_fileFormat = format; }
+        ImageFileFormat imageFileFormat() const { return m_fileFormat; }
+        const char* imageFileExtension() const { return m_fileFormat == ImageFileFormat::BMP ? "bmp" : "exr"; }
         
+        // JP: 形式に応じたピクセルあたりのチャンネル数。線形なRGBに続いて、SpectralEXRでは波長の層ごとの値が並ぶ。
+        // EN: the number of channels per pixel for a format. Linear RGB is followed by the values of the wavelength strata for SpectralEXR.
+        static uint32_t numImageChannels(ImageFileFormat format);
+        // JP: 露出を適用したピクセルの値を、現在の形式のチャンネルとしてchannelsに書き出す。複数のスレッドで行う。
+        // EN: writes the pixel values with exposure applied to channels as the channels of the current format. This is performed on multiple threads.
+        void resolve(float scale, const float* scaleSeparated, float* channels) const;
+        // JP: resolve()で得たチャンネルを画像ファイルに書き出す。センサーには触れないので、レンダリングと並行して呼べる。
+        // EN: writes channels obtained by resolve() to an image file. This doesn't touch sensors, so it can be called in parallel with rendering.
+        static void writeImage(const std::string &filepath, ImageFileFormat format, uint32_t width, uint32_t height, const float* channels);
+        // JP: ピクセルの変換とEXRの圧縮は複数のスレッドで行う。
+        // EN: pixel conversion and EXR compression are performed on multiple threads.
         void saveImage(const std::string &filepath, float scale = 1.0f, float* scaleSeparated = nullptr) const;
+        void saveSampleCountImage(const std::string &filepath) const;
     };    
 }
 
@@ -0,0 +1,147 @@
+//
+//  MappedFile.cpp
+//
+//  Created by 渡部 心 on 2017/06/29.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#include "MappedFile.h"
+
+#include <atomic>
+#if defined(SLR_Platform_Windows)
+#   include <windows.h>
+#else
+#   include <sys/types.h>
+#   include <sys/stat.h>
+#   include <sys/mman.h>
+#   include <fcntl.h>
+#   include <unistd.h>
+#endif
+
+namespace SLR {
+    MappedFile::MappedFile() : m_data(nullptr), m_size(0) {
+#if defined(SLR_Platform_Windows)
+        m_fileHandle = INVALID_HANDLE_VALUE;
+        m_mappingHandle = nullptr;
+#endif
+    }
+    
+    MappedFile::~MappedFile() {
+        close();
+    }
+    
+    bool MappedFile::open(const std::string &path) {
+        close();
+#if defined(SLR_Platform_Windows)
+        m_fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (m_fileHandle == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(m_fileHandle, &fileSize) || fileSize.QuadPart == 0) {
+            close();
+            return false;
+        }
+        m_mappingHandle = CreateFileMappingA(m_fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (m_mappingHandle == nullptr) {
+            close();
+            return false;
+        }
+        m_data = (const uint8_t*)MapViewOfFile(m_mappingHandle, FILE_MAP_READ, 0, 0, 0);
+        if (m_data == nullptr) {
+            close();
+            return false;
+        }
+        m_size = fileSize.QuadPart;
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+        void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED)
+            return false;
+        m_data = (const uint8_t*)data;
+        m_size = st.st_size;
+#endif
+        return true;
+    }
+    
+    void MappedFile::discard(uint64_t offset, uint64_t size) const {
+        if (offset >= m_size)
+            return;
+        size = std::min(size, m_size - offset);
+#if defined(SLR_Platform_Windows)
+        SYSTEM_INFO sysInfo;
+        GetSystemInfo(&sysInfo);
+        uint64_t pageSize = sysInfo.dwPageSize;
+#else
+        uint64_t pageSize = sysconf(_SC_PAGESIZE);
+#endif
+        uint64_t begin = (offset + pageSize - 1) / pageSize * pageSize;
+        uint64_t end = (offset + size) / pageSize * pageSize;
+        if (begin >= end)
+            return;
+#if defined(SLR_Platform_Windows)
+        // JP: ロックされていないページに対するVirtualUnlockはページをワーキングセットから外す。
+        // EN: VirtualUnlock on unlocked pages removes them from the working set.
+        VirtualUnlock((LPVOID)(m_data + begin), end - begin);
+#else
+        madvise((void*)(m_data + begin), end - begin, MADV_DONTNEED);
+#endif
+    }
+    
+    void MappedFile::close() {
+#if defined(SLR_Platform_Windows)
+        if (m_data)
+            UnmapViewOfFile(m_data);
+        if (m_mappingHandle)
+            CloseHandle(m_mappingHandle);
+        if (m_fileHandle != INVALID_HANDLE_VALUE)
+            CloseHandle(m_fileHandle);
+        m_fileHandle = INVALID_HANDLE_VALUE;
+        m_mappingHandle = nullptr;
+#else
+        if (m_data)
+            munmap((void*)m_data, m_size);
+#endif
+        m_data = nullptr;
+        m_size = 0;
+    }
+    
+    bool writeFileAtomically(const std::string &path, const std::function<bool(FILE*)> &writer) {
+        // JP: プロセスIDとプロセス内の通し番号で、同時に書く他のプロセスやスレッドと一時ファイルが重ならないようにする。
+        // EN: the process ID and a serial number in the process keep the temporary file distinct from other processes and threads writing at the same time.
+        static std::atomic<uint32_t> s_serial{0};
+#if defined(SLR_Platform_Windows)
+        uint64_t processID = GetCurrentProcessId();
+#else
+        uint64_t processID = getpid();
+#endif
+        std::string tmpPath = path + "." + std::to_string(processID) + "." + std::to_string(s_serial++) + ".tmp";
+        FILE* fp = fopen(tmpPath.c_str(), "wb");
+        if (fp == nullptr)
+            return false;
+        bool success = writer(fp);
+        success &= fclose(fp) == 0;
+        if (!success) {
+            std::remove(tmpPath.c_str());
+            return false;
+        }
+        
+        // JP: 既存のファイルを置き換えられない環境では、消してから置き換える。
+        // EN: remove the existing file first on environments where rename cannot replace it.
+        if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+            std::remove(path.c_str());
+            if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+                std::remove(tmpPath.c_str());
+                return false;
+            }
+        }
+        return true;
+    }
+}
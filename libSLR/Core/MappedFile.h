@@ -0,0 +1,53 @@
+//
+//  MappedFile.h
+//
+//  Created by 渡部 心 on 2017/06/29.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#ifndef __SLR_MappedFile__
+#define __SLR_MappedFile__
+
+#include "../defines.h"
+#include "../declarations.h"
+
+namespace SLR {
+    // JP: 読み込み専用でメモリーマップしたファイル。
+    // EN: a file memory-mapped for read only.
+    class SLR_API MappedFile {
+        const uint8_t* m_data;
+        uint64_t m_size;
+#if defined(SLR_Platform_Windows)
+        void* m_fileHandle;
+        void* m_mappingHandle;
+#endif
+
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+    public:
+        MappedFile();
+        ~MappedFile();
+        
+        // JP: 存在しないファイルや空のファイルの場合はfalseを返す。
+        // EN: this returns false for a nonexistent or empty file.
+        bool open(const std::string &path);
+        void close();
+        
+        // JP: 範囲に完全に含まれるページを物理メモリーから追い出す。内容は次のアクセスでファイルから再び読み込まれる。
+        // EN: evicts the pages entirely contained in the range from physical memory. Their contents are read from the file again on the next access.
+        void discard(uint64_t offset, uint64_t size) const;
+        
+        const uint8_t* data() const { return m_data; }
+        uint64_t size() const { return m_size; }
+    };
+    
+    // JP: 一意な名前の一時ファイルにwriterで書いてから置き換える。
+    //     書き込みの途中で中断されたり複数のプロセスが同じファイルを書いたりしても、壊れたファイルは見えない。
+    //     writerがfalseを返すか書き込みに失敗した場合は一時ファイルを消し、元のファイルを残す。
+    // EN: writes to a uniquely named temporary file with the writer and then replaces the file.
+    //     A broken file is never visible even if writing is interrupted or multiple processes write the same file.
+    //     If the writer returns false or writing fails, this removes the temporary file and keeps the original file.
+    SLR_API bool writeFileAtomically(const std::string &path, const std::function<bool(FILE*)> &writer);
+}
+
+#endif /* __SLR_MappedFile__ */
@@ -0,0 +1,314 @@
+//
+//  MeshCache.cpp
+//
+//  Created by 渡部 心 on 2017/06/28.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#include "MeshCache.h"
+
+#include <cstring>
+
+namespace SLR {
+    static const char s_meshCacheMagic[8] = {'S', 'L', 'R', 'M', 'E', 'S', 'H', '\0'};
+    
+    struct MeshCache::FileHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t alignment;
+        uint64_t fileSize;
+        uint64_t sourceFileSize;
+        int64_t sourceModifiedTime;
+        uint32_t numMeshes;
+        uint32_t numNodes;
+        uint32_t numMaterials;
+        uint32_t reserved;
+        uint64_t meshTableOffset;
+        uint64_t nodeTableOffset;
+        uint64_t materialTableOffset;
+    };
+    
+    struct MeshCache::MeshEntry {
+        uint64_t nameOffset;
+        uint64_t positionsOffset;
+        uint64_t normalsOffset;
+        uint64_t tangentsOffset;
+        uint64_t texCoordsOffset;
+        uint64_t indicesOffset;
+        uint32_t numVertices;
+        uint32_t numTriangles;
+        uint32_t materialIndex;
+        uint32_t reserved;
+        float minP[3];
+        float maxP[3];
+    };
+    
+    struct MeshCache::NodeEntry {
+        uint64_t nameOffset;
+        uint64_t meshIndicesOffset;
+        float transform[16];
+        uint32_t numMeshes;
+        uint32_t numChildren;
+    };
+    
+    struct MeshCache::MaterialEntry {
+        uint64_t dataOffset;
+        uint64_t dataSize;
+    };
+    
+    static_assert(sizeof(Point3D) == 3 * sizeof(float) && sizeof(Normal3D) == 3 * sizeof(float) &&
+                  sizeof(Tangent3D) == 3 * sizeof(float) && sizeof(TexCoord2D) == 2 * sizeof(float),
+                  "Vertex attributes are assumed to be tightly packed floats.");
+    
+    
+    
+    MeshCache::MeshCache() : m_data(nullptr), m_size(0) {
+    }
+    
+    // JP: 壊れたキャッシュでレンダラーが範囲外を参照しないよう、全てのオフセットと頂点添字を検証する。
+    // EN: validate all the offsets and vertex indices so that the renderer doesn't access out of range with a broken cache.
+    bool MeshCache::parse() {
+        auto inRange = [this](uint64_t offset, uint64_t size) {
+            return offset <= m_size && size <= m_size - offset && offset % sizeof(float) == 0;
+        };
+        auto getString = [this](uint64_t offset) -> const char* {
+            if (offset >= m_size || std::memchr(m_data + offset, '\0', m_size - offset) == nullptr)
+                return nullptr;
+            return (const char*)(m_data + offset);
+        };
+        
+        if (m_size < sizeof(FileHeader))
+            return false;
+        const FileHeader &header = *(const FileHeader*)m_data;
+        if (std::memcmp(header.magic, s_meshCacheMagic, sizeof(s_meshCacheMagic)) != 0 ||
+            header.version != Version || header.alignment != Alignment || header.fileSize != m_size)
+            return false;
+        if (!inRange(header.meshTableOffset, (uint64_t)header.numMeshes * sizeof(MeshEntry)) ||
+            !inRange(header.nodeTableOffset, (uint64_t)header.numNodes * sizeof(NodeEntry)) ||
+            !inRange(header.materialTableOffset, (uint64_t)header.numMaterials * sizeof(MaterialEntry)))
+            return false;
+        m_sourceFileSize = header.sourceFileSize;
+        m_sourceModifiedTime = header.sourceModifiedTime;
+        
+        const MeshEntry* meshEntries = (const MeshEntry*)(m_data + header.meshTableOffset);
+        m_meshes.resize(header.numMeshes);
+        for (int i = 0; i < header.numMeshes; ++i) {
+            const MeshEntry &entry = meshEntries[i];
+            Mesh &mesh = m_meshes[i];
+            uint64_t numVertices = entry.numVertices;
+            if (!inRange(entry.positionsOffset, numVertices * sizeof(Point3D)) ||
+                !inRange(entry.normalsOffset, numVertices * sizeof(Normal3D)) ||
+                !inRange(entry.tangentsOffset, numVertices * sizeof(Tangent3D)) ||
+                !inRange(entry.texCoordsOffset, numVertices * sizeof(TexCoord2D)) ||
+                !inRange(entry.indicesOffset, 3 * (uint64_t)entry.numTriangles * sizeof(uint32_t)) ||
+                entry.materialIndex >= header.numMaterials)
+                return false;
+            mesh.name = getString(entry.nameOffset);
+            if (mesh.name == nullptr)
+                return false;
+            mesh.positions = (const Point3D*)(m_data + entry.positionsOffset);
+            mesh.normals = (const Normal3D*)(m_data + entry.normalsOffset);
+            mesh.tangents = (const Tangent3D*)(m_data + entry.tangentsOffset);
+            mesh.texCoords = (const TexCoord2D*)(m_data + entry.texCoordsOffset);
+            mesh.indices = (const uint32_t*)(m_data + entry.indicesOffset);
+            mesh.numVertices = entry.numVertices;
+            mesh.numTriangles = entry.numTriangles;
+            mesh.materialIndex = entry.materialIndex;
+            mesh.bounds = BoundingBox3D(Point3D(entry.minP[0], entry.minP[1], entry.minP[2]), Point3D(entry.maxP[0], entry.maxP[1], entry.maxP[2]));
+            for (uint64_t j = 0; j < 3 * (uint64_t)mesh.numTriangles; ++j) {
+                if (mesh.indices[j] >= mesh.numVertices)
+                    return false;
+            }
+        }
+        
+        const NodeEntry* nodeEntries = (const NodeEntry*)(m_data + header.nodeTableOffset);
+        m_nodes.resize(header.numNodes);
+        for (int i = 0; i < header.numNodes; ++i) {
+            const NodeEntry &entry = nodeEntries[i];
+            Node &node = m_nodes[i];
+            if (!inRange(entry.meshIndicesOffset, (uint64_t)entry.numMeshes * sizeof(uint32_t)))
+                return false;
+            node.name = getString(entry.nameOffset);
+            if (node.name == nullptr)
+                return false;
+            node.transform = entry.transform;
+            node.meshIndices = (const uint32_t*)(m_data + entry.meshIndicesOffset);
+            node.numMeshes = entry.numMeshes;
+            node.numChildren = entry.numChildren;
+            for (int j = 0; j < node.numMeshes; ++j) {
+                if (node.meshIndices[j] >= header.numMeshes)
+                    return false;
+            }
+        }
+        
+        // JP: 行きがけ順の階層が全てのノードをちょうど覆うことを確かめる。
+        // EN: check that the pre-order hierarchy covers exactly all the nodes.
+        uint64_t numRemainingNodes = header.numNodes > 0 ? 1 : 0;
+        for (int i = 0; i < header.numNodes; ++i) {
+            if (numRemainingNodes == 0)
+                return false;
+            numRemainingNodes += (uint64_t)m_nodes[i].numChildren - 1;
+        }
+        if (numRemainingNodes != 0)
+            return false;
+        
+        const MaterialEntry* materialEntries = (const MaterialEntry*)(m_data + header.materialTableOffset);
+        m_materials.resize(header.numMaterials);
+        for (int i = 0; i < header.numMaterials; ++i) {
+            const MaterialEntry &entry = materialEntries[i];
+            if (!inRange(entry.dataOffset, entry.dataSize))
+                return false;
+            m_materials[i] = std::make_pair(m_data + entry.dataOffset, entry.dataSize);
+        }
+        
+        return true;
+    }
+    
+    std::shared_ptr<MeshCache> MeshCache::open(const std::string &path) {
+        std::shared_ptr<MeshCache> cache(new MeshCache());
+        if (!cache->m_file.open(path))
+            return nullptr;
+        cache->m_data = cache->m_file.data();
+        cache->m_size = cache->m_file.size();
+        if (!cache->parse())
+            return nullptr;
+        return cache;
+    }
+    
+    
+    
+    uint32_t MeshCacheWriter::addMesh(const std::string &name, const Vertex* vertices, uint32_t numVertices, const uint32_t* indices, uint32_t numTriangles, uint32_t materialIndex) {
+        m_meshes.emplace_back();
+        Mesh &mesh = m_meshes.back();
+        mesh.name = name;
+        mesh.positions.resize(numVertices);
+        mesh.normals.resize(numVertices);
+        mesh.tangents.resize(numVertices);
+        mesh.texCoords.resize(numVertices);
+        for (int i = 0; i < numVertices; ++i) {
+            mesh.positions[i] = vertices[i].position;
+            mesh.normals[i] = vertices[i].normal;
+            mesh.tangents[i] = vertices[i].tangent;
+            mesh.texCoords[i] = vertices[i].texCoord;
+        }
+        mesh.indices.assign(indices, indices + 3 * numTriangles);
+        mesh.materialIndex = materialIndex;
+        return (uint32_t)m_meshes.size() - 1;
+    }
+    
+    void MeshCacheWriter::addNode(const std::string &name, const float transform[16], const std::vector<uint32_t> &meshIndices, uint32_t numChildren) {
+        m_nodes.emplace_back();
+        Node &node = m_nodes.back();
+        node.name = name;
+        std::copy(transform, transform + 16, node.transform);
+        node.meshIndices = meshIndices;
+        node.numChildren = numChildren;
+    }
+    
+    uint32_t MeshCacheWriter::addMaterial(const std::vector<uint8_t> &data) {
+        m_materials.push_back(data);
+        return (uint32_t)m_materials.size() - 1;
+    }
+    
+    bool MeshCacheWriter::write(const std::string &path) const {
+        typedef MeshCache::FileHeader FileHeader;
+        typedef MeshCache::MeshEntry MeshEntry;
+        typedef MeshCache::NodeEntry NodeEntry;
+        typedef MeshCache::MaterialEntry MaterialEntry;
+        
+        // JP: 全ての領域の配置を先に決め、オフセットの昇順に書き出す。頂点属性と添字の配列はページ境界に揃える。
+        // EN: determine the placement of all the regions first, then write them in ascending order of offsets.
+        //     Arrays of vertex attributes and indices are aligned to page boundaries.
+        struct Chunk {
+            uint64_t offset;
+            const void* data;
+            uint64_t size;
+        };
+        std::vector<Chunk> chunks;
+        uint64_t fileSize = 0;
+        auto allocate = [&chunks, &fileSize](const void* data, uint64_t size, uint64_t alignment) {
+            uint64_t offset = (fileSize + alignment - 1) / alignment * alignment;
+            chunks.push_back(Chunk{offset, data, size});
+            fileSize = offset + size;
+            return offset;
+        };
+        
+        FileHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::vector<MeshEntry> meshEntries(m_meshes.size());
+        std::vector<NodeEntry> nodeEntries(m_nodes.size());
+        std::vector<MaterialEntry> materialEntries(m_materials.size());
+        std::memset(meshEntries.data(), 0, meshEntries.size() * sizeof(MeshEntry));
+        std::memset(nodeEntries.data(), 0, nodeEntries.size() * sizeof(NodeEntry));
+        
+        allocate(&header, sizeof(header), sizeof(uint64_t));
+        header.meshTableOffset = allocate(meshEntries.data(), meshEntries.size() * sizeof(MeshEntry), sizeof(uint64_t));
+        header.nodeTableOffset = allocate(nodeEntries.data(), nodeEntries.size() * sizeof(NodeEntry), sizeof(uint64_t));
+        header.materialTableOffset = allocate(materialEntries.data(), materialEntries.size() * sizeof(MaterialEntry), sizeof(uint64_t));
+        
+        for (int i = 0; i < m_meshes.size(); ++i) {
+            const Mesh &mesh = m_meshes[i];
+            MeshEntry &entry = meshEntries[i];
+            entry.nameOffset = allocate(mesh.name.c_str(), mesh.name.size() + 1, 1);
+            entry.numVertices = (uint32_t)mesh.positions.size();
+            entry.numTriangles = (uint32_t)mesh.indices.size() / 3;
+            entry.materialIndex = mesh.materialIndex;
+            
+            BoundingBox3D bounds;
+            for (int j = 0; j < mesh.positions.size(); ++j)
+                bounds.unify(mesh.positions[j]);
+            for (int j = 0; j < 3; ++j) {
+                entry.minP[j] = bounds.minP[j];
+                entry.maxP[j] = bounds.maxP[j];
+            }
+        }
+        for (int i = 0; i < m_nodes.size(); ++i) {
+            const Node &node = m_nodes[i];
+            NodeEntry &entry = nodeEntries[i];
+            entry.nameOffset = allocate(node.name.c_str(), node.name.size() + 1, 1);
+            entry.meshIndicesOffset = allocate(node.meshIndices.data(), node.meshIndices.size() * sizeof(uint32_t), sizeof(uint32_t));
+            std::copy(node.transform, node.transform + 16, entry.transform);
+            entry.numMeshes = (uint32_t)node.meshIndices.size();
+            entry.numChildren = node.numChildren;
+        }
+        for (int i = 0; i < m_materials.size(); ++i) {
+            const std::vector<uint8_t> &data = m_materials[i];
+            MaterialEntry &entry = materialEntries[i];
+            entry.dataOffset = allocate(data.data(), data.size(), sizeof(uint64_t));
+            entry.dataSize = data.size();
+        }
+        for (int i = 0; i < m_meshes.size(); ++i) {
+            const Mesh &mesh = m_meshes[i];
+            MeshEntry &entry = meshEntries[i];
+            entry.positionsOffset = allocate(mesh.positions.data(), mesh.positions.size() * sizeof(Point3D), MeshCache::Alignment);
+            entry.normalsOffset = allocate(mesh.normals.data(), mesh.normals.size() * sizeof(Normal3D), MeshCache::Alignment);
+            entry.tangentsOffset = allocate(mesh.tangents.data(), mesh.tangents.size() * sizeof(Tangent3D), MeshCache::Alignment);
+            entry.texCoordsOffset = allocate(mesh.texCoords.data(), mesh.texCoords.size() * sizeof(TexCoord2D), MeshCache::Alignment);
+            entry.indicesOffset = allocate(mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t), MeshCache::Alignment);
+        }
+        
+        std::memcpy(header.magic, s_meshCacheMagic, sizeof(s_meshCacheMagic));
+        header.version = MeshCache::Version;
+        header.alignment = MeshCache::Alignment;
+        header.fileSize = fileSize;
+        header.sourceFileSize = m_sourceFileSize;
+        header.sourceModifiedTime = m_sourceModifiedTime;
+        header.numMeshes = (uint32_t)m_meshes.size();
+        header.numNodes = (uint32_t)m_nodes.size();
+        header.numMaterials = (uint32_t)m_materials.size();
+        
+        return writeFileAtomically(path, [&](FILE* fp) {
+            bool success = true;
+            const uint8_t zeros[MeshCache::Alignment] = {};
+            uint64_t position = 0;
+            for (int i = 0; i < chunks.size() && success; ++i) {
+                const Chunk &chunk = chunks[i];
+                uint64_t padding = chunk.offset - position;
+                success &= padding == 0 || fwrite(zeros, padding, 1, fp) == 1;
+                success &= chunk.size == 0 || fwrite(chunk.data, chunk.size, 1, fp) == 1;
+                position = chunk.offset + chunk.size;
+            }
+            return success;
+        });
+    }
+}
@@ -0,0 +1,139 @@
+//
+//  MeshCache.h
+//
+//  Created by 渡部 心 on 2017/06/28.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#ifndef __SLR_MeshCache__
+#define __SLR_MeshCache__
+
+#include "../defines.h"
+#include "../declarations.h"
+#include "geometry.h"
+#include "MappedFile.h"
+
+namespace SLR {
+    // JP: 三角形メッシュのバイナリキャッシュ。
+    //     位置・法線・接線・テクスチャー座標を属性ごとの配列(SoA)として、三角形の頂点添字とともにページ境界に揃えて格納する。
+    //     ファイルはメモリーマップされ、レンダラーはその配列を複製せずに直接参照する。
+    //     メッシュの他にノードの階層と、内容を解釈しない材質のデータも格納する。
+    //     書き出した計算機とバイト順が同じ計算機で読み込むことを前提とする。
+    // EN: binary cache of triangle meshes.
+    //     Positions, normals, tangents and texture coordinates are stored as per-attribute arrays (SoA)
+    //     together with vertex indices of triangles, aligned to page boundaries.
+    //     The file is memory-mapped and the renderer references those arrays directly without copying.
+    //     It also stores the node hierarchy besides meshes, and material data whose contents are not interpreted.
+    //     Reading it on a machine with the same byte order as the writer is assumed.
+    class SLR_API MeshCache {
+    public:
+        static const uint32_t Version = 1;
+        static const uint32_t Alignment = 4096;
+        
+        struct Mesh {
+            const char* name;
+            const Point3D* positions;
+            const Normal3D* normals;
+            const Tangent3D* tangents;
+            const TexCoord2D* texCoords;
+            const uint32_t* indices;
+            uint32_t numVertices;
+            uint32_t numTriangles;
+            uint32_t materialIndex;
+            BoundingBox3D bounds;
+        };
+        
+        // JP: ノードは深さ優先の行きがけ順に並び、各ノードの子はその直後に続く。
+        // EN: nodes are arranged in depth-first pre-order, and the children of each node follow it immediately.
+        struct Node {
+            const char* name;
+            const float* transform; // 4x4 elements in the order of Matrix4x4(float[16])
+            const uint32_t* meshIndices;
+            uint32_t numMeshes;
+            uint32_t numChildren;
+        };
+    private:
+        struct FileHeader;
+        struct MeshEntry;
+        struct NodeEntry;
+        struct MaterialEntry;
+        friend class MeshCacheWriter;
+        
+        MappedFile m_file;
+        const uint8_t* m_data;
+        uint64_t m_size;
+        uint64_t m_sourceFileSize;
+        int64_t m_sourceModifiedTime;
+        std::vector<Mesh> m_meshes;
+        std::vector<Node> m_nodes;
+        std::vector<std::pair<const uint8_t*, uint64_t>> m_materials;
+        
+        MeshCache();
+        bool parse();
+    public:
+        
+        // JP: ファイルをマップして内容を検証する。失敗した場合やバージョンが異なる場合はnullptrを返す。
+        // EN: maps a file and validates its contents. This returns nullptr on failure or version mismatch.
+        static std::shared_ptr<MeshCache> open(const std::string &path);
+        
+        // JP: キャッシュを作った元のファイルの大きさと更新時刻。元のファイルが更新されたかの判定に用いる。
+        // EN: the size and the modification time of the file the cache was made from. These are used to detect updates of the source file.
+        uint64_t sourceFileSize() const { return m_sourceFileSize; }
+        int64_t sourceModifiedTime() const { return m_sourceModifiedTime; }
+        
+        uint32_t numMeshes() const { return (uint32_t)m_meshes.size(); }
+        const Mesh &mesh(uint32_t index) const { return m_meshes[index]; }
+        uint32_t numNodes() const { return (uint32_t)m_nodes.size(); }
+        const Node &node(uint32_t index) const { return m_nodes[index]; }
+        uint32_t numMaterials() const { return (uint32_t)m_materials.size(); }
+        const uint8_t* materialData(uint32_t index, uint64_t* size) const {
+            *size = m_materials[index].second;
+            return m_materials[index].first;
+        }
+    };
+    
+    
+    
+    // JP: メッシュキャッシュの書き出し。メッシュ・ノード・材質を追加してからwrite()を呼ぶ。ノードは行きがけ順に追加する。
+    // EN: writer of a mesh cache. Call write() after adding meshes, nodes and materials. Nodes should be added in pre-order.
+    class SLR_API MeshCacheWriter {
+        struct Mesh {
+            std::string name;
+            std::vector<Point3D> positions;
+            std::vector<Normal3D> normals;
+            std::vector<Tangent3D> tangents;
+            std::vector<TexCoord2D> texCoords;
+            std::vector<uint32_t> indices;
+            uint32_t materialIndex;
+        };
+        struct Node {
+            std::string name;
+            float transform[16];
+            std::vector<uint32_t> meshIndices;
+            uint32_t numChildren;
+        };
+        
+        std::vector<Mesh> m_meshes;
+        std::vector<Node> m_nodes;
+        std::vector<std::vector<uint8_t>> m_materials;
+        uint64_t m_sourceFileSize;
+        int64_t m_sourceModifiedTime;
+    public:
+        MeshCacheWriter() : m_sourceFileSize(0), m_sourceModifiedTime(0) {}
+        
+        void setSource(uint64_t fileSize, int64_t modifiedTime) {
+            m_sourceFileSize = fileSize;
+            m_sourceModifiedTime = modifiedTime;
+        }
+        
+        uint32_t addMesh(const std::string &name, const Vertex* vertices, uint32_t numVertices, const uint32_t* indices, uint32_t numTriangles, uint32_t materialIndex);
+        void addNode(const std::string &name, const float transform[16], const std::vector<uint32_t> &meshIndices, uint32_t numChildren);
+        uint32_t addMaterial(const std::vector<uint8_t> &data);
+        
+        // JP: 中断されても壊れたキャッシュが残らないよう、一時ファイルに書いてから置き換える。
+        // EN: this writes to a temporary file and then replaces so that an interruption doesn't leave a broken cache.
+        bool write(const std::string &path) const;
+    };
+}
+
+#endif /* __SLR_MeshCache__ */
@@ -0,0 +1,283 @@
+//
+//  PassScheduler.cpp
+//
+//  Created by 渡部 心 on 2017/06/17.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#include "PassScheduler.h"
+
+#include "RenderSettings.h"
+#include "ImageSensor.h"
+#include "light_path_sampler.h"
+#include "MappedFile.h"
+#include <cstring>
+
+namespace SLR {
+    static const char* s_defaultCheckpointPath = "checkpoint.slrckpt";
+    static const char s_checkpointMagic[8] = {'S', 'L', 'R', 'C', 'K', 'P', 'T', '\0'};
+    static const uint32_t s_checkpointVersion = 5;
+    
+    PassScheduler::PassScheduler(const RenderSettings &settings, uint32_t spp) :
+    m_estimateNoise(false), m_numPasses(0), m_nextExportPass(1), m_numExportedImages(0), m_timeExportDue(false), m_resumedTime(0.0f), m_lastError(INFINITY), m_terminationReason("sample count reached"),
+    m_samplers(nullptr), m_numSamplers(0) {
+        m_timeLimit = settings.getFloat(RenderSettingItem::TimeLimit);
+        m_targetNoise = settings.getFloat(RenderSettingItem::TargetNoise);
+        m_checkpointPath = settings.getString(RenderSettingItem::CheckpointPath);
+        m_checkpointInterval = settings.getFloat(RenderSettingItem::CheckpointInterval);
+        m_resumePath = settings.getString(RenderSettingItem::ResumePath);
+        m_brightness = settings.getFloat(RenderSettingItem::Brightness);
+        m_exportInterval = std::max(settings.getInt(RenderSettingItem::ExportInterval), 0);
+        m_exportTimeInterval = settings.getFloat(RenderSettingItem::ExportTimeInterval);
+        if (m_exportInterval > 0)
+            m_nextExportPass = m_exportInterval;
+        
+        // JP: プログレッシブモードではサンプル数は無制限とし、中断に備えてチェックポイントを常に書き出す。
+        // EN: In progressive mode, the sample count is unlimited and checkpoints are always written in case of preemption.
+        m_maxNumPasses = spp;
+        if (isProgressive()) {
+            m_maxNumPasses = UINT32_MAX;
+            if (m_checkpointPath.empty())
+                m_checkpointPath = s_defaultCheckpointPath;
+        }
+        
+        // JP: プログレッシブモードではパス数が決まらないため、範囲に分割しない。
+        // EN: progressive mode doesn't divide passes into ranges since the number of passes is not determined.
+        m_firstPass = 0;
+        uint32_t numRanges = std::max(settings.getInt(RenderSettingItem::NumPassRanges), 1);
+        uint32_t rangeIndex = std::min<uint32_t>(std::max(settings.getInt(RenderSettingItem::PassRangeIndex), 0), numRanges - 1);
+        if (numRanges > 1 && !isProgressive()) {
+            m_firstPass = (uint32_t)((uint64_t)spp * rangeIndex / numRanges);
+            m_maxNumPasses = (uint32_t)((uint64_t)spp * (rangeIndex + 1) / numRanges);
+        }
+        m_numPasses = m_firstPass;
+        advanceExportPass();
+    }
+    
+    void PassScheduler::begin(ImageSensor* sensor, LightPathSampler** samplers, uint32_t numSamplers, bool estimateNoise) {
+        m_samplers = samplers;
+        m_numSamplers = numSamplers;
+        m_estimateNoise = estimateNoise && m_targetNoise > 0;
+        if (m_estimateNoise)
+            sensor->enablePassVarianceEstimation();
+        
+        if (!m_resumePath.empty()) {
+            if (loadCheckpoint(sensor)) {
+                advanceExportPass();
+                printf("Resumed from %s: %u passes done in %g[s]\n", m_resumePath.c_str(), m_numPasses, m_resumedTime);
+                if (m_numPasses >= m_maxNumPasses)
+                    printf("The checkpoint already reaches the sample count.\n");
+            }
+            else {
+                printf("Failed to resume from %s, start from scratch.\n", m_resumePath.c_str());
+            }
+        }
+        
+        m_startTime = std::chrono::system_clock::now();
+        m_lastPassEndTime = m_startTime;
+        m_lastCheckpointTime = m_startTime;
+        m_lastExportTime = m_startTime;
+        
+        if (m_numPasses >= m_maxNumPasses && !m_checkpointPath.empty()) {
+            if (!saveCheckpoint(sensor, m_numExportedImages))
+                printf("Failed to write a checkpoint: %s\n", m_checkpointPath.c_str());
+        }
+        
+        if (m_timeLimit > 0)
+            printf("Time limit: %g[s]\n", m_timeLimit);
+        if (m_estimateNoise)
+            printf("Target noise: %g\n", m_targetNoise);
+    }
+    
+    bool PassScheduler::finishPass(ImageSensor* sensor) {
+        using namespace std::chrono;
+        ++m_numPasses;
+        
+        bool continueRendering = m_numPasses < m_maxNumPasses;
+        if (m_estimateNoise) {
+            sensor->finishPass();
+            m_lastError = sensor->estimateImageError(m_brightness);
+            if (m_lastError <= m_targetNoise) {
+                continueRendering = false;
+                m_terminationReason = "target noise reached";
+            }
+        }
+        
+        system_clock::time_point now = system_clock::now();
+        if (m_timeLimit > 0 && continueRendering) {
+            // JP: 次のパスが直前のパスと同じ時間かかると仮定し、制限時間を超えるなら打ち切る。
+            // EN: assume that the next pass takes the same time as the last pass, and stop if it would exceed the time limit.
+            float elapsed = m_resumedTime + duration_cast<milliseconds>(now - m_startTime).count() * 0.001f;
+            float lastPassTime = duration_cast<milliseconds>(now - m_lastPassEndTime).count() * 0.001f;
+            if (elapsed + lastPassTime > m_timeLimit) {
+                continueRendering = false;
+                m_terminationReason = "time limit reached";
+            }
+        }
+        m_lastPassEndTime = now;
+        
+        if (m_exportTimeInterval > 0) {
+            float sinceLastExport = duration_cast<milliseconds>(now - m_lastExportTime).count() * 0.001f;
+            m_timeExportDue = sinceLastExport >= m_exportTimeInterval;
+        }
+        
+        if (!m_checkpointPath.empty()) {
+            float sinceLastCheckpoint = duration_cast<milliseconds>(now - m_lastCheckpointTime).count() * 0.001f;
+            if (sinceLastCheckpoint >= m_checkpointInterval || !continueRendering) {
+                // JP: チェックポイントはこのパスの出力より前に書かれるため、このパスで行われる出力も数に含めておく。
+                //     そうしないと再開後の画像の番号が最後の画像と重なる。
+                // EN: the checkpoint is written before the export of this pass, so count that export in advance.
+                //     Otherwise the image index after resuming would collide with the last image.
+                uint32_t numExportedImages = m_numExportedImages + (shouldExport(!continueRendering) ? 1 : 0);
+                if (!saveCheckpoint(sensor, numExportedImages))
+                    printf("Failed to write a checkpoint: %s\n", m_checkpointPath.c_str());
+                m_lastCheckpointTime = system_clock::now();
+            }
+        }
+        
+        return continueRendering;
+    }
+    
+    float PassScheduler::elapsedTime() const {
+        using namespace std::chrono;
+        return m_resumedTime + duration_cast<milliseconds>(m_lastPassEndTime - m_startTime).count() * 0.001f;
+    }
+    
+    bool PassScheduler::shouldExport(bool finished) const {
+        return m_numPasses >= m_nextExportPass || finished || m_timeExportDue;
+    }
+    
+    void PassScheduler::advanceExportPass() {
+        while (m_nextExportPass <= m_numPasses && m_nextExportPass != 0)
+            m_nextExportPass += m_exportInterval > 0 ? m_exportInterval : m_nextExportPass;
+    }
+    
+    void PassScheduler::advanceExport() {
+        advanceExportPass();
+        ++m_numExportedImages;
+        m_timeExportDue = false;
+        m_lastExportTime = std::chrono::system_clock::now();
+    }
+    
+    // JP: 中断されても直前のチェックポイントが壊れないよう、一時ファイルに書いてから置き換える。
+    // EN: write to a temporary file and then replace so that the previous checkpoint survives an interruption.
+    bool PassScheduler::saveCheckpoint(const ImageSensor* sensor, uint32_t numExportedImages) const {
+        return writeFileAtomically(m_checkpointPath, [&](FILE* fp) {
+            bool success = true;
+            success &= fwrite(s_checkpointMagic, sizeof(s_checkpointMagic), 1, fp) == 1;
+            success &= fwrite(&s_checkpointVersion, sizeof(s_checkpointVersion), 1, fp) == 1;
+            success &= fwrite(&m_firstPass, sizeof(m_firstPass), 1, fp) == 1;
+            success &= fwrite(&m_numPasses, sizeof(m_numPasses), 1, fp) == 1;
+            success &= fwrite(&numExportedImages, sizeof(numExportedImages), 1, fp) == 1;
+            success &= fwrite(&m_numSamplers, sizeof(m_numSamplers), 1, fp) == 1;
+            uint32_t numRegions = (uint32_t)m_stateRegions.size();
+            success &= fwrite(&numRegions, sizeof(numRegions), 1, fp) == 1;
+            // JP: 再開後も時間制限が通算の時間に対して働くよう、ここまでのレンダリング時間を保存する。
+            // EN: save the rendering time so far so that the time limit applies to the total time after resuming.
+            float elapsed = elapsedTime();
+            success &= fwrite(&elapsed, sizeof(elapsed), 1, fp) == 1;
+            success &= sensor->writeState(fp);
+            for (int i = 0; i < m_stateRegions.size() && success; ++i) {
+                uint64_t size = m_stateRegions[i].second;
+                success &= fwrite(&size, sizeof(size), 1, fp) == 1;
+                success &= fwrite(m_stateRegions[i].first, size, 1, fp) == 1;
+            }
+            for (int i = 0; i < m_numSamplers && success; ++i)
+                success &= m_samplers[i]->writeState(fp);
+            return success;
+        });
+    }
+    
+    // JP: 構成の一致を先に確かめ、センサー・レンダラーの状態・サンプラーの順に復元する。
+    //     途中で失敗した場合はセンサーをクリアし、最初からレンダリングできる状態に戻す。
+    //     スレッドごとの状態を含むため、スレッド数は書き出し時と同じでなければならない。
+    // EN: check that the configuration matches first, then restore the sensor, the renderer states and the samplers in this order.
+    //     If it fails on the way, this clears the sensor so that rendering can start from scratch.
+    //     The number of threads must be the same as when written since the checkpoint contains per-thread states.
+    bool PassScheduler::loadCheckpoint(ImageSensor* sensor) {
+        FILE* fp = fopen(m_resumePath.c_str(), "rb");
+        if (fp == nullptr)
+            return false;
+        
+        char magic[sizeof(s_checkpointMagic)];
+        uint32_t version, firstPass, numPasses, numExportedImages, numSamplers, numRegions;
+        float elapsed;
+        bool success = (fread(magic, sizeof(magic), 1, fp) == 1 &&
+                        fread(&version, sizeof(version), 1, fp) == 1 &&
+                        fread(&firstPass, sizeof(firstPass), 1, fp) == 1 &&
+                        fread(&numPasses, sizeof(numPasses), 1, fp) == 1 &&
+                        fread(&numExportedImages, sizeof(numExportedImages), 1, fp) == 1 &&
+                        fread(&numSamplers, sizeof(numSamplers), 1, fp) == 1 &&
+                        fread(&numRegions, sizeof(numRegions), 1, fp) == 1 &&
+                        fread(&elapsed, sizeof(elapsed), 1, fp) == 1);
+        success = (success &&
+                   std::memcmp(magic, s_checkpointMagic, sizeof(magic)) == 0 &&
+                   version == s_checkpointVersion &&
+                   firstPass == m_firstPass &&
+                   numSamplers == m_numSamplers &&
+                   numRegions == m_stateRegions.size());
+        if (!success) {
+            fclose(fp);
+            return false;
+        }
+        
+        // JP: 失敗時に戻せるよう、登録された状態を退避しておく。
+        // EN: back up the registered states to restore them on failure.
+        std::vector<std::vector<uint8_t>> backups;
+        for (int i = 0; i < m_stateRegions.size(); ++i) {
+            const uint8_t* data = (const uint8_t*)m_stateRegions[i].first;
+            backups.emplace_back(data, data + m_stateRegions[i].second);
+        }
+        
+        success = sensor->readState(fp);
+        for (int i = 0; i < m_stateRegions.size() && success; ++i) {
+            uint64_t size;
+            success = (fread(&size, sizeof(size), 1, fp) == 1 &&
+                       size == m_stateRegions[i].second &&
+                       fread(m_stateRegions[i].first, size, 1, fp) == 1);
+        }
+        for (int i = 0; i < m_numSamplers && success; ++i)
+            success = m_samplers[i]->readState(fp);
+        fclose(fp);
+        
+        if (!success) {
+            sensor->clear();
+            sensor->clearSeparatedBuffers();
+            for (int i = 0; i < m_stateRegions.size(); ++i)
+                std::copy(backups[i].begin(), backups[i].end(), (uint8_t*)m_stateRegions[i].first);
+            return false;
+        }
+        m_numPasses = numPasses;
+        m_numExportedImages = numExportedImages;
+        m_resumedTime = elapsed;
+        return true;
+    }
+    
+    bool PassScheduler::readCheckpointSensor(FILE* fp, ImageSensor* sensor, uint32_t* numPasses) {
+        char magic[sizeof(s_checkpointMagic)];
+        uint32_t version, firstPass, numExportedImages, numSamplers, numRegions;
+        float elapsed;
+        bool success = (fread(magic, sizeof(magic), 1, fp) == 1 &&
+                        fread(&version, sizeof(version), 1, fp) == 1 &&
+                        fread(&firstPass, sizeof(firstPass), 1, fp) == 1 &&
+                        fread(numPasses, sizeof(*numPasses), 1, fp) == 1 &&
+                        fread(&numExportedImages, sizeof(numExportedImages), 1, fp) == 1 &&
+                        fread(&numSamplers, sizeof(numSamplers), 1, fp) == 1 &&
+                        fread(&numRegions, sizeof(numRegions), 1, fp) == 1 &&
+                        fread(&elapsed, sizeof(elapsed), 1, fp) == 1);
+        if (!success || std::memcmp(magic, s_checkpointMagic, sizeof(magic)) != 0 || version != s_checkpointVersion || *numPasses < firstPass)
+            return false;
+        *numPasses -= firstPass;
+        return sensor->readState(fp);
+    }
+    
+    void PassScheduler::printSummary() const {
+        using namespace std::chrono;
+        if (!isProgressive())
+            return;
+        printf("Progressive rendering: %u passes in %g[s] (%s)", m_numPasses, elapsedTime(), m_terminationReason);
+        if (m_estimateNoise)
+            printf(", noise: %g", m_lastError);
+        printf("\n");
+    }
+}
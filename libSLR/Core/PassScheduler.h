@@ -0,0 +1,115 @@
+//
+//  PassScheduler.h
+//
+//  Created by 渡部 心 on 2017/06/17.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#ifndef __SLR_PassScheduler__
+#define __SLR_PassScheduler__
+
+#include "../defines.h"
+#include "../declarations.h"
+
+namespace SLR {
+    // JP: レンダラーのパスループにおいて、パスの継続・画像の出力・チェックポイントの書き出しを判断する。
+    //     時間制限か目標ノイズ量が指定された場合はプログレッシブモードとなり、
+    //     サンプル数の代わりにそれらでレンダリングを打ち切る。
+    //     チェックポイントにはセンサーの蓄積状態、スレッドごとのサンプラーの状態、完了したパス数と
+    //     レンダラーが登録した状態が含まれ、そこから再開すると中断しなかった場合と同じ結果が得られる。
+    // EN: decides continuation of passes, image export and checkpoint writing in a renderer's pass loop.
+    //     When a time limit or a target noise level is specified, it runs in progressive mode
+    //     and terminates rendering by them instead of the sample count.
+    //     A checkpoint contains the accumulation state of the sensor, the per-thread sampler states, the number of completed passes
+    //     and states registered by the renderer, and resuming from it gives the same result as an uninterrupted run.
+    class SLR_API PassScheduler {
+        uint32_t m_firstPass;
+        uint32_t m_maxNumPasses;
+        float m_timeLimit;
+        float m_targetNoise;
+        bool m_estimateNoise;
+        std::string m_checkpointPath;
+        float m_checkpointInterval;
+        std::string m_resumePath;
+        float m_brightness;
+        uint32_t m_exportInterval;
+        float m_exportTimeInterval;
+        
+        std::chrono::system_clock::time_point m_startTime;
+        std::chrono::system_clock::time_point m_lastPassEndTime;
+        std::chrono::system_clock::time_point m_lastCheckpointTime;
+        std::chrono::system_clock::time_point m_lastExportTime;
+        float m_resumedTime;
+        uint32_t m_numPasses;
+        uint32_t m_nextExportPass;
+        uint32_t m_numExportedImages;
+        bool m_timeExportDue;
+        float m_lastError;
+        const char* m_terminationReason;
+        
+        LightPathSampler** m_samplers;
+        uint32_t m_numSamplers;
+        std::vector<std::pair<void*, size_t>> m_stateRegions;
+        
+        void advanceExportPass();
+        bool saveCheckpoint(const ImageSensor* sensor, uint32_t numExportedImages) const;
+        bool loadCheckpoint(ImageSensor* sensor);
+    public:
+        PassScheduler(const RenderSettings &settings, uint32_t spp);
+        
+        bool isProgressive() const { return m_timeLimit > 0 || m_targetNoise > 0; }
+        // JP: レンダリングするパスの範囲。分散レンダリングで範囲が指定されていなければ0からサンプル数まで。
+        //     センサーに蓄積されるのはこの範囲のパスのみなので、画像の出力ではfirstPass()を差し引いたパス数で割る。
+        // EN: the range of passes to render. This is from 0 to the sample count unless a range is specified for distributed rendering.
+        //     The sensor accumulates only the passes in this range, so image export divides by the number of passes minus firstPass().
+        uint32_t firstPass() const { return m_firstPass; }
+        uint32_t maxNumPasses() const { return m_maxNumPasses; }
+        const std::chrono::system_clock::time_point &startTime() const { return m_startTime; }
+        uint32_t nextExportPass() const { return m_nextExportPass; }
+        // JP: 完了したパス数。チェックポイントから再開した場合は最初のパスの番号となる。
+        // EN: the number of completed passes. This is the index of the first pass when resumed from a checkpoint.
+        uint32_t numPasses() const { return m_numPasses; }
+        // JP: 最後のパスまでのレンダリング時間[s]。チェックポイントから再開した場合は中断前の時間も含む。
+        // EN: rendering time [s] until the last pass. This includes the time before interruption when resumed from a checkpoint.
+        float elapsedTime() const;
+        // JP: これまでに出力された画像の数。時間間隔による出力も含み、チェックポイントから復元される。
+        // EN: the number of images exported so far including exports by the time interval. This is restored from a checkpoint.
+        uint32_t numExportedImages() const { return m_numExportedImages; }
+        
+        // JP: チェックポイントに含めるレンダラー固有の状態を登録する。begin()の前に呼ぶ。
+        // EN: register a renderer-specific state included in checkpoints. Call this before begin().
+        void addStateRegion(void* data, size_t size) { m_stateRegions.emplace_back(data, size); }
+        
+        // JP: 最初のパスの前に呼ぶ。目標ノイズ量が指定されている場合はセンサーの誤差推定を有効にする。
+        //     再開用のチェックポイントが指定されている場合は、センサー・サンプラー・登録された状態を復元する。
+        //     パスの範囲が空の場合は、何もレンダリングせずにチェックポイントを書き出す。
+        //     estimateNoiseがfalseの場合は目標ノイズ量による打ち切りを行わない。
+        // EN: call before the first pass. This enables error estimation of the sensor when a target noise level is specified.
+        //     If a checkpoint to resume from is specified, this restores the sensor, the samplers and the registered states.
+        //     If the range of passes is empty, this writes a checkpoint without rendering anything.
+        //     Termination by the target noise level is disabled when estimateNoise is false.
+        void begin(ImageSensor* sensor, LightPathSampler** samplers, uint32_t numSamplers, bool estimateNoise = true);
+        // JP: 各パスの後に呼ぶ。必要ならチェックポイントを書き出し、レンダリングを続けるかを返す。
+        // EN: call after each pass. This writes a checkpoint if necessary and returns whether rendering should continue.
+        bool finishPass(ImageSensor* sensor);
+        // JP: 現在のパスの後に画像を出力すべきかを返す。出力は最後のパスと、出力間隔のパスごと(0の場合は2の冪のパス)に行う。
+        //     出力の時間間隔が指定されている場合は、前の出力からその時間が経過した後のパスでも出力する。
+        //     時間間隔の判定はfinishPass()の時点で行う。
+        // EN: returns whether an image should be exported after the current pass.
+        //     Export happens at the last pass and every export interval passes (power-of-two passes if the interval is 0).
+        //     When an export time interval is specified, export also happens at the pass after that time has elapsed since the last export.
+        //     The time interval is evaluated at finishPass().
+        bool shouldExport(bool finished) const;
+        // JP: 画像を出力した後に呼ぶ。
+        // EN: call after exporting an image.
+        void advanceExport();
+        
+        void printSummary() const;
+        
+        // JP: チェックポイントからセンサーに蓄積されたパス数とセンサーの蓄積状態のみを読み込む。分散レンダリングで結果を集めるのに用いる。
+        // EN: read only the number of passes accumulated in the sensor and the accumulation state of the sensor from a checkpoint. This is used to gather results in distributed rendering.
+        static bool readCheckpointSensor(FILE* fp, ImageSensor* sensor, uint32_t* numPasses);
+    };
+}
+
+#endif /* __SLR_PassScheduler__ */
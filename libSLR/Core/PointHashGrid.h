@@ -0,0 +1,222 @@
+//
+//  PointHashGrid.h
+//
+//  Created by 渡部 心 on 2017/06/20.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#ifndef __SLR_PointHashGrid__
+#define __SLR_PointHashGrid__
+
+#include "../defines.h"
+#include "../declarations.h"
+#include "../BasicTypes/Point3D.h"
+#include "../Helper/ThreadPool.h"
+#include <atomic>
+
+namespace SLR {
+    // JP: 固定半径の近傍探索のための、点を空間ハッシュのセルごとに並べた格子。
+    //     セルの大きさは探索半径の2倍とし、探索は最寄りの2x2x2のセルのみを調べる。
+    //     構築はセルごとの個数の数え上げ・プレフィックス和・散布の3段階で、いずれも点数に対して並列に行う。
+    //     PointTypeはpositionを持つ型で、点自体は複製せず外部の配列への参照を格納する。
+    // EN: a grid of points sorted by spatial hash cell for fixed-radius neighbor search.
+    //     The cell size is twice the search radius, and a search looks up only the nearest 2x2x2 cells.
+    //     Construction consists of three stages: per-cell counting, prefix sum and scattering, all running in parallel over the points.
+    //     PointType is a type having position, and the grid stores references to external arrays instead of copying the points.
+    template <typename PointType>
+    class PointHashGrid {
+        static const uint32_t NumPointsPerJob = 1 << 16;
+        
+        float m_radius;
+        float m_sqRadius;
+        float m_invCellSize;
+        uint32_t m_cellMask;
+        std::vector<uint32_t> m_cellBegins;
+        std::vector<const PointType*> m_points;
+        
+        void calcCellCoordinates(const Point3D &p, int32_t* ix, int32_t* iy, int32_t* iz) const {
+            *ix = (int32_t)std::floor(p.x * m_invCellSize);
+            *iy = (int32_t)std::floor(p.y * m_invCellSize);
+            *iz = (int32_t)std::floor(p.z * m_invCellSize);
+        }
+        uint32_t calcCellIndex(int32_t ix, int32_t iy, int32_t iz) const {
+            return (((uint32_t)ix * 73856093) ^ ((uint32_t)iy * 19349663) ^ ((uint32_t)iz * 83492791)) & m_cellMask;
+        }
+    public:
+        PointHashGrid() : m_radius(0.0f), m_sqRadius(0.0f), m_invCellSize(0.0f), m_cellMask(0) {}
+        
+        // JP: 連続した点の配列の集合(例: スレッドごとの配列)から格子を構築する。
+        //     filterがfalseを返す点は格納しない。
+        // EN: build the grid from a set of contiguous point arrays (e.g. per-thread arrays).
+        //     Points for which filter returns false are not stored.
+        template <typename FilterType>
+        void build(const std::vector<std::pair<const PointType*, uint32_t>> &chunks, float radius, uint32_t numThreads, const FilterType &filter) {
+            m_radius = radius;
+            m_sqRadius = radius * radius;
+            m_invCellSize = 0.5f / radius;
+            
+            struct Range {
+                const PointType* points;
+                uint32_t numPoints;
+                uint32_t globalOffset;
+            };
+            std::vector<Range> ranges;
+            uint32_t numTotalPoints = 0;
+            for (int i = 0; i < chunks.size(); ++i) {
+                for (uint32_t begin = 0; begin < chunks[i].second; begin += NumPointsPerJob) {
+                    uint32_t numPoints = std::min(chunks[i].second - begin, NumPointsPerJob);
+                    ranges.push_back(Range{chunks[i].first + begin, numPoints, numTotalPoints});
+                    numTotalPoints += numPoints;
+                }
+            }
+            
+            uint32_t numCells = 1;
+            while (numCells < numTotalPoints)
+                numCells <<= 1;
+            m_cellMask = numCells - 1;
+            m_cellBegins.resize(numCells + 1);
+            
+            const uint32_t InvalidCell = 0xFFFFFFFF;
+            std::vector<uint32_t> cellIndices(numTotalPoints);
+            std::atomic<uint32_t>* counters = new std::atomic<uint32_t>[numCells];
+            const uint32_t numCellsPerJob = (numCells + numThreads - 1) / numThreads;
+            
+            // JP: セルごとの点の数を数える。
+            // EN: count points per cell.
+            {
+                ThreadPool threadPool(numThreads);
+                for (uint32_t begin = 0; begin < numCells; begin += numCellsPerJob) {
+                    uint32_t end = std::min(begin + numCellsPerJob, numCells);
+                    threadPool.enqueue([counters, begin, end](uint32_t threadID) {
+                        for (uint32_t c = begin; c < end; ++c)
+                            counters[c].store(0, std::memory_order_relaxed);
+                    });
+                }
+                threadPool.wait();
+            }
+            {
+                ThreadPool threadPool(numThreads);
+                for (int i = 0; i < ranges.size(); ++i) {
+                    const Range &range = ranges[i];
+                    threadPool.enqueue([this, &range, &cellIndices, counters, &filter, InvalidCell](uint32_t threadID) {
+                        for (uint32_t j = 0; j < range.numPoints; ++j) {
+                            const PointType &pt = range.points[j];
+                            uint32_t &cellIdx = cellIndices[range.globalOffset + j];
+                            if (!filter(pt)) {
+                                cellIdx = InvalidCell;
+                                continue;
+                            }
+                            int32_t ix, iy, iz;
+                            calcCellCoordinates(pt.position, &ix, &iy, &iz);
+                            cellIdx = calcCellIndex(ix, iy, iz);
+                            counters[cellIdx].fetch_add(1, std::memory_order_relaxed);
+                        }
+                    });
+                }
+                threadPool.wait();
+            }
+            
+            // JP: セルの範囲ごとに部分和を求めてから、各範囲の先頭にオフセットを加えて排他的プレフィックス和とする。
+            // EN: compute partial sums per range of cells, then add offsets to each range to get the exclusive prefix sum.
+            uint32_t numCellRanges = (numCells + numCellsPerJob - 1) / numCellsPerJob;
+            std::vector<uint32_t> rangeSums(numCellRanges);
+            {
+                ThreadPool threadPool(numThreads);
+                for (uint32_t r = 0; r < numCellRanges; ++r) {
+                    threadPool.enqueue([this, counters, r, numCellsPerJob, numCells, &rangeSums](uint32_t threadID) {
+                        uint32_t end = std::min((r + 1) * numCellsPerJob, numCells);
+                        uint32_t sum = 0;
+                        for (uint32_t c = r * numCellsPerJob; c < end; ++c) {
+                            m_cellBegins[c] = sum;
+                            sum += counters[c].load(std::memory_order_relaxed);
+                        }
+                        rangeSums[r] = sum;
+                    });
+                }
+                threadPool.wait();
+            }
+            uint32_t numStoredPoints = 0;
+            for (uint32_t r = 0; r < numCellRanges; ++r) {
+                uint32_t sum = rangeSums[r];
+                rangeSums[r] = numStoredPoints;
+                numStoredPoints += sum;
+            }
+            m_cellBegins[numCells] = numStoredPoints;
+            {
+                ThreadPool threadPool(numThreads);
+                for (uint32_t r = 0; r < numCellRanges; ++r) {
+                    threadPool.enqueue([this, counters, r, numCellsPerJob, numCells, &rangeSums](uint32_t threadID) {
+                        uint32_t end = std::min((r + 1) * numCellsPerJob, numCells);
+                        for (uint32_t c = r * numCellsPerJob; c < end; ++c) {
+                            m_cellBegins[c] += rangeSums[r];
+                            counters[c].store(m_cellBegins[c], std::memory_order_relaxed);
+                        }
+                    });
+                }
+                threadPool.wait();
+            }
+            
+            // JP: 各点をセルの範囲内の空いている位置へ散布する。
+            // EN: scatter each point to a vacant slot in the range of its cell.
+            m_points.resize(numStoredPoints);
+            {
+                ThreadPool threadPool(numThreads);
+                for (int i = 0; i < ranges.size(); ++i) {
+                    const Range &range = ranges[i];
+                    threadPool.enqueue([this, &range, &cellIndices, counters, InvalidCell](uint32_t threadID) {
+                        for (uint32_t j = 0; j < range.numPoints; ++j) {
+                            uint32_t cellIdx = cellIndices[range.globalOffset + j];
+                            if (cellIdx == InvalidCell)
+                                continue;
+                            m_points[counters[cellIdx].fetch_add(1, std::memory_order_relaxed)] = range.points + j;
+                        }
+                    });
+                }
+                threadPool.wait();
+            }
+            
+            delete[] counters;
+        }
+        
+        // JP: 探索半径内の各点についてprocessを呼ぶ。
+        // EN: call process for each point within the search radius.
+        template <typename ProcessType>
+        void query(const Point3D &p, ProcessType &process) const {
+            if (m_points.empty())
+                return;
+            
+            // JP: 点を含むセルと、各軸で点に近い側の隣接セルからなる2x2x2のセルを調べる。
+            //     異なるセルが同じハッシュになる場合に同じ点を重複して処理しないよう、調べたセルを記録する。
+            // EN: look up the 2x2x2 cells consisting of the cell containing the point and the adjacent cells on the nearer side on each axis.
+            //     Record the cells looked up so as not to process the same points twice when different cells have the same hash.
+            Point3D pScaled = p * m_invCellSize;
+            int32_t ix, iy, iz;
+            calcCellCoordinates(p, &ix, &iy, &iz);
+            int32_t bx = pScaled.x - ix < 0.5f ? ix - 1 : ix;
+            int32_t by = pScaled.y - iy < 0.5f ? iy - 1 : iy;
+            int32_t bz = pScaled.z - iz < 0.5f ? iz - 1 : iz;
+            uint32_t visitedCells[8];
+            uint32_t numVisitedCells = 0;
+            for (int i = 0; i < 8; ++i) {
+                uint32_t cellIdx = calcCellIndex(bx + (i & 1), by + ((i >> 1) & 1), bz + ((i >> 2) & 1));
+                bool visited = false;
+                for (int j = 0; j < numVisitedCells; ++j)
+                    visited |= visitedCells[j] == cellIdx;
+                if (visited)
+                    continue;
+                visitedCells[numVisitedCells++] = cellIdx;
+                
+                for (uint32_t j = m_cellBegins[cellIdx]; j < m_cellBegins[cellIdx + 1]; ++j) {
+                    const PointType &pt = *m_points[j];
+                    if (sqDistance(pt.position, p) <= m_sqRadius)
+                        process(pt);
+                }
+            }
+        }
+        
+        float radius() const { return m_radius; }
+        uint32_t numPoints() const { return (uint32_t)m_points.size(); }
+    };
+}
+
+#endif /* __SLR_PointHashGrid__ */
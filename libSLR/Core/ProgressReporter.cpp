@@ -7,8 +7,33 @@
 
 #include "ProgressReporter.h"
 
+#if defined(SLR_Platform_Windows)
+#   include <io.h>
+#else
+#   include <unistd.h>
+#endif
+
 namespace SLR {
-    ProgressReporter::ProgressReporter() : m_sleep(false), m_numLastLines(0), m_finishable(false) {
+    ProgressReporter::ProgressReporter(uint32_t numThreads, int32_t progressFD) :
+    m_numThreads(numThreads), m_jsonOutput(nullptr), m_sleep(false), m_numLastLines(0), m_finishable(false) {
+        m_threadCounters = (ThreadCounter*)SLR_memalign(sizeof(ThreadCounter) * m_numThreads, SLR_L1_Cacheline_Size);
+        for (int i = 0; i < m_numThreads; ++i)
+            new (m_threadCounters + i) ThreadCounter();
+        
+        // JP: 呼び出し側の記述子を閉じないよう複製したものに書き込む。
+        // EN: write to a duplicate so as not to close the caller's descriptor.
+        if (progressFD >= 0) {
+#if defined(SLR_Platform_Windows)
+            int fd = _dup(progressFD);
+            if (fd >= 0)
+                m_jsonOutput = _fdopen(fd, "w");
+#else
+            int fd = dup(progressFD);
+            if (fd >= 0)
+                m_jsonOutput = fdopen(fd, "w");
+#endif
+        }
+        
         m_printThread = std::thread([this]() {
             const std::chrono::milliseconds sleepDuration(250);
             while (!m_finishable) {
@@ -22,53 +47,105 @@ namespace SLR {
                             return !m_sleep;
                         });
                     }
-                
-                    const size_t entireLength = 64;
-                    char buffer[2 + entireLength];
                     
-                    if (m_numLastLines > 0)
-                        printf("\033[%uF", m_numLastLines);
+                    uint64_t numWorks = sumNumWorks();
+                    if (m_jsonOutput)
+                        printJSON(numWorks);
+                    else
+                        printBars(numWorks);
                     
-                    for (int i = (int32_t)m_jobStask.size() - 1; i >= 0; --i) {
-                        Job &job = m_jobStask[i];
-                        
-                        size_t headLength = job.title.length() + 1;
-                        const size_t tailLength = 1 + 6;
-                        size_t barLength = entireLength - (headLength + tailLength);
-                        
-                        snprintf(buffer, headLength + 1, "%s|", job.title.c_str());
-                        char* curPtr = buffer + headLength;
-                        
-                        float percentage = (float)job.numWorksDone / job.totalWork;
-                        uint32_t numFills = uint32_t(barLength * percentage);
-                        for (int i = 0; i < numFills; ++i)
-                            *(curPtr++) = '+';
-                        for (int i = 0; i < barLength - numFills; ++i)
-                            *(curPtr++) = '-';
-                        snprintf(curPtr, tailLength + 1, "|%5.1f%%", percentage * 100);
-                        curPtr += tailLength;
-                        *curPtr = '\0';
-                        
-                        bool printFinished = job.numWorksDone / job.totalWork;
-                        if (job.printFinished == false && printFinished) {
+                    for (Job &job : m_jobStask) {
+                        if (job.printFinished == false && numWorksDone(job, numWorks) >= job.totalWork) {
                             job.printFinished = true;
                             m_printCondVar.notify_one();
                         }
-                        
-                        printf("%s\n", buffer);
                     }
-                    m_numLastLines = (uint32_t)m_jobStask.size();
-                    
-                    fflush(stdout);
                 }
             }
-            printf("\n");
+            if (m_jsonOutput)
+                fprintf(m_jsonOutput, "{\"finished\":true}\n");
+            else
+                printf("\n");
         });
     }
     
+    ProgressReporter::~ProgressReporter() {
+        if (m_printThread.joinable())
+            finish();
+        if (m_jsonOutput)
+            fclose(m_jsonOutput);
+        SLR_freealign(m_threadCounters);
+    }
+    
+    uint64_t ProgressReporter::sumNumWorks() const {
+        uint64_t sum = 0;
+        for (int i = 0; i < m_numThreads; ++i)
+            sum += m_threadCounters[i].numWorksDone.load(std::memory_order_relaxed);
+        return sum;
+    }
+    
+    void ProgressReporter::printBars(uint64_t numWorks) {
+        const size_t entireLength = 64;
+        char buffer[2 + entireLength];
+        
+        if (m_numLastLines > 0)
+            printf("\033[%uF", m_numLastLines);
+        
+        for (int i = (int32_t)m_jobStask.size() - 1; i >= 0; --i) {
+            const Job &job = m_jobStask[i];
+            
+            size_t headLength = job.title.length() + 1;
+            const size_t tailLength = 1 + 6;
+            size_t barLength = entireLength - (headLength + tailLength);
+            
+            snprintf(buffer, headLength + 1, "%s|", job.title.c_str());
+            char* curPtr = buffer + headLength;
+            
+            float percentage = job.totalWork > 0 ? std::min((float)numWorksDone(job, numWorks) / job.totalWork, 1.0f) : 1.0f;
+            uint32_t numFills = uint32_t(barLength * percentage);
+            for (int i = 0; i < numFills; ++i)
+                *(curPtr++) = '+';
+            for (int i = 0; i < barLength - numFills; ++i)
+                *(curPtr++) = '-';
+            snprintf(curPtr, tailLength + 1, "|%5.1f%%", percentage * 100);
+            curPtr += tailLength;
+            *curPtr = '\0';
+            
+            printf("%s\n", buffer);
+        }
+        m_numLastLines = (uint32_t)m_jobStask.size();
+        
+        fflush(stdout);
+    }
+    
+    // JP: 1行が1つのJSONオブジェクトで、ジョブのスタックを外側から順に並べる。
+    // EN: each line is a JSON object, listing the job stack from the outermost.
+    //     {"time":12.3,"jobs":[{"title":"Rendering","done":120,"total":4096,"elapsed":12.3}, ...]}
+    void ProgressReporter::printJSON(uint64_t numWorks) {
+        if (m_jobStask.empty())
+            return;
+        auto now = std::chrono::system_clock::now();
+        double time = std::chrono::duration_cast<std::chrono::milliseconds>(now - m_jobStask.front().startTime).count() * 1e-3;
+        fprintf(m_jsonOutput, "{\"time\":%.3f,\"jobs\":[", time);
+        for (int i = 0; i < m_jobStask.size(); ++i) {
+            const Job &job = m_jobStask[i];
+            fprintf(m_jsonOutput, "%s{\"title\":\"", i > 0 ? "," : "");
+            for (char c : job.title) {
+                if (c == '"' || c == '\\')
+                    fputc('\\', m_jsonOutput);
+                fputc(c, m_jsonOutput);
+            }
+            double elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - job.startTime).count() * 1e-3;
+            fprintf(m_jsonOutput, "\",\"done\":%llu,\"total\":%llu,\"elapsed\":%.3f}",
+                    (unsigned long long)std::min(numWorksDone(job, numWorks), job.totalWork), (unsigned long long)job.totalWork, elapsed);
+        }
+        fprintf(m_jsonOutput, "]}\n");
+        fflush(m_jsonOutput);
+    }
+    
     void ProgressReporter::pushJob(const std::string &title, uint64_t totalWork, const std::chrono::system_clock::time_point &startTime) {
         std::lock_guard<std::mutex> lock(m_jobMutex);
-        m_jobStask.emplace_back(title, totalWork, startTime);
+        m_jobStask.emplace_back(title, totalWork, startTime, sumNumWorks());
     }
     
     void ProgressReporter::popJob() {
@@ -83,6 +160,10 @@ namespace SLR {
     
     void ProgressReporter::beginOtherThreadPrint() {
         std::lock_guard<std::mutex> lock(m_jobMutex);
+        // JP: JSON Linesの出力は他の出力と混ざらないので端末を消去する必要はない。
+        // EN: JSON Lines output doesn't get mixed with other output, so the terminal needn't be cleared.
+        if (m_jsonOutput)
+            return;
         printf("\033[%uF", m_numLastLines);
         for (int i = 0; i < m_numLastLines; ++i)
             printf("                                "
@@ -98,9 +179,12 @@ namespace SLR {
         m_printCondVar.notify_one();
     }
     
-    void ProgressReporter::update(uint64_t numWorks) {
-        for (Job &job : m_jobStask)
-            job.numWorksDone += numWorks;
+    void ProgressReporter::skipRemainingWork() {
+        std::lock_guard<std::mutex> lock(m_jobMutex);
+        Job &job = m_jobStask.back();
+        uint64_t numDone = numWorksDone(job, sumNumWorks());
+        if (numDone < job.totalWork)
+            job.numSkippedWorks += job.totalWork - numDone;
     }
     
     void ProgressReporter::finish() {
@@ -16,37 +16,67 @@
 #include <mutex>
 
 namespace SLR {
+    // JP: 進捗はスレッドごとのカウンターに記録し、表示用のスレッドのみがそれらを集計する。
+    //     progressFDが0以上の場合は端末の再描画の代わりに、そのファイル記述子へJSON Lines形式で進捗を書き出す。
+    // EN: progress is recorded in per-thread counters, and only the print thread aggregates them.
+    //     If progressFD is 0 or greater, progress is written to the file descriptor in JSON Lines format instead of redrawing the terminal.
     class SLR_API ProgressReporter {
         struct Job {
             std::string title;
             uint64_t totalWork;
             std::chrono::system_clock::time_point startTime;
-            std::atomic<uint64_t> numWorksDone;
+            // JP: ジョブ開始時点の全スレッドの作業数の合計と、完了扱いにした作業数。
+            // EN: the sum of the works of all the threads at the start of the job, and the number of works regarded as done.
+            uint64_t baseNumWorks;
+            uint64_t numSkippedWorks;
             bool printFinished;
             
-            Job(const Job& job) : title(job.title), totalWork(job.totalWork), startTime(job.startTime), numWorksDone(0), printFinished(false) {
-                numWorksDone += job.numWorksDone;
-            }
-            Job(const std::string &title_, uint64_t totalWork_, const std::chrono::system_clock::time_point &startTime_ = std::chrono::system_clock::now()) :
-            title(title_), totalWork(totalWork_), startTime(startTime_), numWorksDone(0), printFinished(false) { }
+            Job(const std::string &title_, uint64_t totalWork_, const std::chrono::system_clock::time_point &startTime_, uint64_t baseNumWorks_) :
+            title(title_), totalWork(totalWork_), startTime(startTime_), baseNumWorks(baseNumWorks_), numSkippedWorks(0), printFinished(false) { }
+        };
+        
+        // JP: 各カウンターはそれを持つスレッドのみが書き込み、キャッシュラインを他のスレッドと共有しない。
+        // EN: each counter is written only by its owner thread and doesn't share a cache line with other threads.
+        struct alignas(SLR_L1_Cacheline_Size) ThreadCounter {
+            std::atomic<uint64_t> numWorksDone;
+            
+            ThreadCounter() : numWorksDone(0) { }
         };
         
+        uint32_t m_numThreads;
+        ThreadCounter* m_threadCounters;
+        FILE* m_jsonOutput;
         std::mutex m_jobMutex;
         std::vector<Job> m_jobStask;
         std::condition_variable m_printCondVar;
         std::thread m_printThread;
         bool m_sleep;
         uint32_t m_numLastLines;
-        bool m_finishable;
+        std::atomic<bool> m_finishable;
+        
+        uint64_t sumNumWorks() const;
+        uint64_t numWorksDone(const Job &job, uint64_t numWorks) const {
+            return numWorks - job.baseNumWorks + job.numSkippedWorks;
+        }
+        void printBars(uint64_t numWorks);
+        void printJSON(uint64_t numWorks);
     public:
-        ProgressReporter();
-        ~ProgressReporter() {}
+        ProgressReporter(uint32_t numThreads = 1, int32_t progressFD = -1);
+        ~ProgressReporter();
 
         void pushJob(const std::string &title, uint64_t totalWork, const std::chrono::system_clock::time_point &startTime = std::chrono::system_clock::now());
         void popJob();
         void beginOtherThreadPrint();
         void endOtherThreadPrint();
-        void update(uint64_t numWorks = 1);
+        // JP: threadIDのスレッドのカウンターのみを更新するので、ロックも他のスレッドとの競合もない。
+        // EN: this updates only the counter of the thread threadID, so there is neither a lock nor contention with other threads.
+        void update(uint32_t threadID, uint64_t numWorks = 1) {
+            std::atomic<uint64_t> &counter = m_threadCounters[threadID].numWorksDone;
+            counter.store(counter.load(std::memory_order_relaxed) + numWorks, std::memory_order_relaxed);
+        }
+        // JP: 現在のジョブの残りの作業を完了扱いにする。
+        // EN: regard the remaining work of the current job as done.
+        void skipRemainingWork();
         void finish();
         std::chrono::system_clock::duration elapsed() const {
             return std::chrono::system_clock::now() - m_jobStask.front().startTime;
@@ -20,6 +20,21 @@ namespace SLR {
         TimeEnd,
         Brightness,
         RNGSeed,
+        TimeLimit,
+        TargetNoise,
+        CheckpointPath,
+        CheckpointInterval,
+        ResumePath,
+        ProgressFD,
+        ExportInterval,
+        ExportTimeInterval,
+        // JP: 検証用。BPT/VBPTの接続ごとのMISウェイトを全頂点を辿る計算とも比較し、統計に数える。
+        // EN: for validation. BPT/VBPT compare the MIS weight of every connection with the calculation walking all the vertices and count them in the statistics.
+        ValidateMISWeights,
+        // JP: 分散レンダリング用。サンプル数をNumPassRanges個の範囲に等分し、PassRangeIndex番目の範囲のパスのみをレンダリングする。
+        // EN: for distributed rendering. The sample count is divided evenly into NumPassRanges ranges, and only the passes in the PassRangeIndex-th range are rendered.
+        PassRangeIndex,
+        NumPassRanges,
     };
     
     class SLR_API RenderSettings {
@@ -0,0 +1,156 @@
+//
+//  RenderStatistics.cpp
+//
+//  Created by 渡部 心 on 2017/06/27.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#include "RenderStatistics.h"
+
+#if !defined(SLR_Platform_Windows)
+#   include <sys/resource.h>
+#endif
+#include "TextureCache.h"
+
+namespace SLR {
+    static thread_local ThreadStatistics* s_currentThreadStats = nullptr;
+    
+    ThreadStatistics* currentThreadStatistics() {
+        return s_currentThreadStats;
+    }
+    
+    ScopedThreadStatistics::ScopedThreadStatistics(ThreadStatistics* stats) : m_prevStats(s_currentThreadStats) {
+        s_currentThreadStats = stats;
+    }
+    
+    ScopedThreadStatistics::~ScopedThreadStatistics() {
+        s_currentThreadStats = m_prevStats;
+    }
+    
+    
+    
+    uint64_t peakResidentSetSize() {
+#if defined(SLR_Platform_Windows)
+        return 0;
+#else
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0)
+            return 0;
+        // JP: ru_maxrssの単位はmacOSではバイト、Linuxではキロバイト。
+        // EN: the unit of ru_maxrss is bytes on macOS and kilobytes on Linux.
+#   if defined(__APPLE__)
+        return usage.ru_maxrss;
+#   else
+        return (uint64_t)usage.ru_maxrss * 1024;
+#   endif
+#endif
+    }
+    
+    
+    
+    static const char* s_counterNames[] = {
+        "cameraRays",
+        "bounceRays",
+        "shadowRays",
+        "lightRays",
+        "bvhNodesVisited",
+        "primitivesTested",
+        "russianRouletteTerminations",
+        "nullCollisions",
+        "textureTileHits",
+        "textureTileFaults",
+        "misWeightValidations",
+        "misWeightMismatches",
+    };
+    static_assert(sizeof(s_counterNames) / sizeof(s_counterNames[0]) == (uint32_t)StatCounter::NumCounters, "The number of counter names is inconsistent.");
+    
+    static const char* s_phaseNames[] = {
+        "rendering",
+        "lightTracing",
+        "passFinalization",
+        "imageOutput",
+    };
+    static_assert(sizeof(s_phaseNames) / sizeof(s_phaseNames[0]) == (uint32_t)StatPhase::NumPhases, "The number of phase names is inconsistent.");
+    
+    RenderStatistics::RenderStatistics(uint32_t numThreads) : m_numThreads(numThreads), m_peakArenaBytes(0), m_numPasses(0) {
+        m_threadStats = (ThreadStatistics*)SLR_memalign(sizeof(ThreadStatistics) * m_numThreads, SLR_L1_Cacheline_Size);
+        for (int i = 0; i < m_numThreads; ++i)
+            new (m_threadStats + i) ThreadStatistics();
+        std::fill(std::begin(m_counters), std::end(m_counters), 0);
+        std::fill(std::begin(m_pathLengths), std::end(m_pathLengths), 0);
+        std::fill(std::begin(m_phaseTimes), std::end(m_phaseTimes), 0.0);
+    }
+    
+    RenderStatistics::~RenderStatistics() {
+        SLR_freealign(m_threadStats);
+    }
+    
+    void RenderStatistics::finishPass() {
+        for (int i = 0; i < m_numThreads; ++i) {
+            ThreadStatistics &stats = m_threadStats[i];
+            for (int j = 0; j < (uint32_t)StatCounter::NumCounters; ++j)
+                m_counters[j] += stats.counters[j];
+            for (int j = 0; j <= ThreadStatistics::MaxPathLength; ++j)
+                m_pathLengths[j] += stats.pathLengths[j];
+            m_peakArenaBytes = std::max(m_peakArenaBytes, stats.peakArenaBytes);
+            stats.clear();
+        }
+        ++m_numPasses;
+    }
+    
+    uint64_t RenderStatistics::numRays() const {
+        return (counter(StatCounter::CameraRays) + counter(StatCounter::BounceRays) +
+                counter(StatCounter::ShadowRays) + counter(StatCounter::LightRays));
+    }
+    
+    bool RenderStatistics::writeJSON(const std::string &filename, const char* rendererName) const {
+        FILE* fp = fopen(filename.c_str(), "w");
+        if (!fp)
+            return false;
+        
+        double renderTime = phaseTime(StatPhase::Rendering) + phaseTime(StatPhase::LightTracing);
+        uint64_t totalRays = numRays();
+        fprintf(fp, "{\n");
+        fprintf(fp, "  \"renderer\": \"%s\",\n", rendererName);
+        fprintf(fp, "  \"threads\": %u,\n", m_numThreads);
+        fprintf(fp, "  \"passes\": %u,\n", m_numPasses);
+        fprintf(fp, "  \"rays\": %llu,\n", (unsigned long long)totalRays);
+        fprintf(fp, "  \"raysPerSecond\": %.1f,\n", renderTime > 0 ? totalRays / renderTime : 0.0);
+        fprintf(fp, "  \"counters\": {\n");
+        for (int i = 0; i < (uint32_t)StatCounter::NumCounters; ++i)
+            fprintf(fp, "    \"%s\": %llu%s\n", s_counterNames[i], (unsigned long long)m_counters[i], i + 1 < (uint32_t)StatCounter::NumCounters ? "," : "");
+        fprintf(fp, "  },\n");
+        
+        // JP: 最後の要素以外は長さが添字に等しい経路の数で、最後の要素はそれ以上の長さの経路の数。
+        // EN: each element except the last is the number of paths whose length equals the index, the last is the number of longer paths.
+        uint32_t lastLength = 0;
+        for (int i = 0; i <= ThreadStatistics::MaxPathLength; ++i) {
+            if (m_pathLengths[i] > 0)
+                lastLength = i;
+        }
+        fprintf(fp, "  \"pathLengths\": [");
+        for (int i = 0; i <= lastLength; ++i)
+            fprintf(fp, "%s%llu", i > 0 ? ", " : "", (unsigned long long)m_pathLengths[i]);
+        fprintf(fp, "],\n");
+        
+        fprintf(fp, "  \"peakArenaBytesPerThread\": %llu,\n", (unsigned long long)m_peakArenaBytes);
+        
+        uint64_t tileHits = counter(StatCounter::TextureTileHits);
+        uint64_t tileAccesses = tileHits + counter(StatCounter::TextureTileFaults);
+        fprintf(fp, "  \"textureCache\": {\n");
+        fprintf(fp, "    \"hitRate\": %.6f,\n", tileAccesses > 0 ? (double)tileHits / tileAccesses : 0.0);
+        fprintf(fp, "    \"residentBytes\": %llu,\n", (unsigned long long)TextureCache::residentBytes());
+        fprintf(fp, "    \"capacityBytes\": %llu,\n", (unsigned long long)TextureCache::capacity());
+        fprintf(fp, "    \"evictedTiles\": %llu\n", (unsigned long long)TextureCache::numEvictedTiles());
+        fprintf(fp, "  },\n");
+        fprintf(fp, "  \"peakResidentSetBytes\": %llu,\n", (unsigned long long)peakResidentSetSize());
+        fprintf(fp, "  \"phaseSeconds\": {\n");
+        for (int i = 0; i < (uint32_t)StatPhase::NumPhases; ++i)
+            fprintf(fp, "    \"%s\": %.6f%s\n", s_phaseNames[i], m_phaseTimes[i], i + 1 < (uint32_t)StatPhase::NumPhases ? "," : "");
+        fprintf(fp, "  }\n");
+        fprintf(fp, "}\n");
+        
+        fclose(fp);
+        return true;
+    }
+}
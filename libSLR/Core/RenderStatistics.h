@@ -0,0 +1,134 @@
+//
+//  RenderStatistics.h
+//
+//  Created by 渡部 心 on 2017/06/27.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#ifndef __SLR_RenderStatistics__
+#define __SLR_RenderStatistics__
+
+#include "../defines.h"
+#include "../declarations.h"
+
+namespace SLR {
+    enum class StatCounter : uint32_t {
+        CameraRays = 0,
+        BounceRays,
+        ShadowRays,
+        LightRays,
+        BVHNodesVisited,
+        PrimitivesTested,
+        RussianRouletteTerminations,
+        NullCollisions,
+        TextureTileHits,
+        TextureTileFaults,
+        MISWeightValidations,
+        MISWeightMismatches,
+        NumCounters
+    };
+    
+    enum class StatPhase : uint32_t {
+        Rendering = 0,
+        LightTracing,
+        PassFinalization,
+        ImageOutput,
+        NumPhases
+    };
+    
+    // JP: 1つのスレッドの統計。それを持つスレッドのみが書き込むので更新にアトミック操作は要らない。
+    // EN: statistics of a thread. Only its owner thread writes to it, so updates need no atomic operations.
+    struct alignas(SLR_L1_Cacheline_Size) ThreadStatistics {
+        // JP: 経路長のヒストグラムの最後のビンはそれ以上の長さをまとめて数える。
+        // EN: the last bin of the path length histogram counts all the longer lengths together.
+        static const uint32_t MaxPathLength = 63;
+        
+        uint64_t counters[(uint32_t)StatCounter::NumCounters];
+        uint64_t pathLengths[MaxPathLength + 1];
+        uint64_t peakArenaBytes;
+        
+        ThreadStatistics() { clear(); }
+        
+        void clear() {
+            std::fill(std::begin(counters), std::end(counters), 0);
+            std::fill(std::begin(pathLengths), std::end(pathLengths), 0);
+            peakArenaBytes = 0;
+        }
+        void add(StatCounter counter, uint64_t n = 1) {
+            counters[(uint32_t)counter] += n;
+        }
+        void addPathLength(uint32_t length) {
+            ++pathLengths[std::min(length, MaxPathLength)];
+        }
+        void recordArenaUsage(size_t bytes) {
+            peakArenaBytes = std::max<uint64_t>(peakArenaBytes, bytes);
+        }
+    };
+    
+    // JP: プロセスの物理メモリー使用量の最大値。取得できない環境では0を返す。
+    // EN: the peak physical memory usage of the process. This returns 0 on an environment where it is unavailable.
+    SLR_API uint64_t peakResidentSetSize();
+    
+    // JP: 現在のスレッドに結び付けられた統計を返す。結び付けられていない場合はnullptr。
+    //     引数で統計を受け取らない交差判定などの内部ではこれを通して数える。
+    // EN: returns the statistics bound to the current thread, nullptr if not bound.
+    //     Code which doesn't receive statistics as an argument, like intersection routines, counts through this.
+    SLR_API ThreadStatistics* currentThreadStatistics();
+    
+    // JP: スコープの間、現在のスレッドに統計を結び付ける。
+    // EN: binds statistics to the current thread during the scope.
+    class SLR_API ScopedThreadStatistics {
+        ThreadStatistics* m_prevStats;
+    public:
+        ScopedThreadStatistics(ThreadStatistics* stats);
+        ~ScopedThreadStatistics();
+    };
+    
+    // JP: レンダリング全体の統計。スレッドごとの統計をパスの終わりに合算し、画像と並べてJSONとして出力する。
+    // EN: statistics of an entire rendering. This merges per-thread statistics at the end of each pass and writes them as JSON alongside images.
+    class SLR_API RenderStatistics {
+        uint32_t m_numThreads;
+        ThreadStatistics* m_threadStats;
+        
+        uint64_t m_counters[(uint32_t)StatCounter::NumCounters];
+        uint64_t m_pathLengths[ThreadStatistics::MaxPathLength + 1];
+        uint64_t m_peakArenaBytes;
+        double m_phaseTimes[(uint32_t)StatPhase::NumPhases];
+        uint32_t m_numPasses;
+    public:
+        RenderStatistics(uint32_t numThreads);
+        ~RenderStatistics();
+        
+        ThreadStatistics* threadStatistics(uint32_t threadID) { return &m_threadStats[threadID]; }
+        
+        // JP: スレッドごとの統計を合算してクリアする。ワーカースレッドが動いていない時に呼ぶ。
+        // EN: merges and clears per-thread statistics. Call this while worker threads are not running.
+        void finishPass();
+        void addPhaseTime(StatPhase phase, double seconds) { m_phaseTimes[(uint32_t)phase] += seconds; }
+        
+        uint64_t counter(StatCounter counter) const { return m_counters[(uint32_t)counter]; }
+        uint64_t numRays() const;
+        uint64_t numPathsOfLength(uint32_t length) const { return m_pathLengths[std::min(length, ThreadStatistics::MaxPathLength)]; }
+        uint64_t peakArenaBytes() const { return m_peakArenaBytes; }
+        double phaseTime(StatPhase phase) const { return m_phaseTimes[(uint32_t)phase]; }
+        uint32_t numPasses() const { return m_numPasses; }
+        
+        bool writeJSON(const std::string &filename, const char* rendererName) const;
+    };
+    
+    // JP: スコープの間の経過時間をフェーズの時間に加える。
+    // EN: adds the elapsed time during the scope to the time of a phase.
+    class ScopedPhaseTimer {
+        RenderStatistics* m_stats;
+        StatPhase m_phase;
+        std::chrono::high_resolution_clock::time_point m_start;
+    public:
+        ScopedPhaseTimer(RenderStatistics* stats, StatPhase phase) : m_stats(stats), m_phase(phase), m_start(std::chrono::high_resolution_clock::now()) { }
+        ~ScopedPhaseTimer() {
+            auto end = std::chrono::high_resolution_clock::now();
+            m_stats->addPhaseTime(m_phase, std::chrono::duration_cast<std::chrono::microseconds>(end - m_start).count() * 1e-6);
+        }
+    };
+}
+
+#endif /* __SLR_RenderStatistics__ */
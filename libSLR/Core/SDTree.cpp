@@ -0,0 +1,260 @@
+//
+//  SDTree.cpp
+//
+//  Created by 渡部 心 on 2017/06/24.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#include "SDTree.h"
+
+#include "../Helper/ThreadPool.h"
+
+namespace SLR {
+    static inline void atomicAdd(std::atomic<float> &dst, float value) {
+        float cur = dst.load(std::memory_order_relaxed);
+        while (!dst.compare_exchange_weak(cur, cur + value, std::memory_order_relaxed));
+    }
+    
+    // JP: 方向を[0, 1)^2の正規化された(cosθ, φ)に写す。この写像は面積を保つので、正方形上の密度を4πで割れば立体角あたりの密度となる。
+    // EN: map a direction to normalized (cos theta, phi) in [0, 1)^2. This mapping preserves area, so a density on the square divided by 4 pi is a density per solid angle.
+    static inline void directionToCanonical(const Vector3D &dir, float* x, float* y) {
+        float cosTheta = std::min(std::max(dir.z, -1.0f), 1.0f);
+        float phi = std::atan2(dir.y, dir.x);
+        if (phi < 0)
+            phi += 2 * M_PI;
+        *x = std::min(0.5f * (cosTheta + 1), 0.99999994f);
+        *y = std::min(float(phi / (2 * M_PI)), 0.99999994f);
+    }
+    
+    static inline Vector3D canonicalToDirection(float x, float y) {
+        float cosTheta = 2 * x - 1;
+        float sinTheta = std::sqrt(std::max(1 - cosTheta * cosTheta, 0.0f));
+        float phi = 2 * M_PI * y;
+        return Vector3D(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
+    }
+    
+    // JP: 象限の番号は x + 2 * y で、点を選ばれた象限の中の[0, 1)^2の座標に写し直す。
+    // EN: the quadrant index is x + 2 * y, and the point is remapped to [0, 1)^2 coordinates within the chosen quadrant.
+    static inline uint32_t selectQuadrant(float* x, float* y) {
+        uint32_t qx = *x >= 0.5f;
+        uint32_t qy = *y >= 0.5f;
+        *x = 2 * *x - qx;
+        *y = 2 * *y - qy;
+        return qx + 2 * qy;
+    }
+    
+    void DirectionalQuadTree::record(const Vector3D &dir, float value) {
+        float x, y;
+        directionToCanonical(dir, &x, &y);
+        uint32_t nodeIdx = 0;
+        while (true) {
+            Node &node = m_nodes[nodeIdx];
+            uint32_t q = selectQuadrant(&x, &y);
+            atomicAdd(node.sums[q], value);
+            if (node.children[q] == 0)
+                break;
+            nodeIdx = node.children[q];
+        }
+    }
+    
+    Vector3D DirectionalQuadTree::sample(float u0, float u1, float* dirPDF) const {
+        if (!hasDistribution()) {
+            *dirPDF = 1.0f / (4 * M_PI);
+            return canonicalToDirection(u0, u1);
+        }
+        
+        float pdf = 1.0f;
+        float baseX = 0.0f, baseY = 0.0f;
+        float size = 1.0f;
+        uint32_t nodeIdx = 0;
+        while (true) {
+            const Node &node = m_nodes[nodeIdx];
+            float sums[4];
+            for (int i = 0; i < 4; ++i)
+                sums[i] = node.sums[i].load(std::memory_order_relaxed);
+            float total = sums[0] + sums[1] + sums[2] + sums[3];
+            
+            // JP: まず左右の半分を選び、続いてその中の上下の象限を選ぶ。乱数は選択の度に区間へ写し直して再利用する。
+            // EN: choose the left or right half first, then the lower or upper quadrant in it. Random numbers are remapped to reuse them for each selection.
+            uint32_t qx, qy;
+            float probLeft = (sums[0] + sums[2]) / total;
+            if (u0 < probLeft) {
+                qx = 0;
+                u0 /= probLeft;
+            }
+            else {
+                qx = 1;
+                u0 = (u0 - probLeft) / (1 - probLeft);
+            }
+            float probLower = sums[qx] / (sums[qx] + sums[qx + 2]);
+            if (u1 < probLower) {
+                qy = 0;
+                u1 /= probLower;
+            }
+            else {
+                qy = 1;
+                u1 = (u1 - probLower) / (1 - probLower);
+            }
+            u0 = std::min(u0, 0.99999994f);
+            u1 = std::min(u1, 0.99999994f);
+            
+            uint32_t q = qx + 2 * qy;
+            pdf *= 4 * sums[q] / total;
+            size *= 0.5f;
+            baseX += qx * size;
+            baseY += qy * size;
+            if (node.children[q] == 0)
+                break;
+            nodeIdx = node.children[q];
+        }
+        
+        *dirPDF = pdf / (4 * M_PI);
+        return canonicalToDirection(baseX + u0 * size, baseY + u1 * size);
+    }
+    
+    float DirectionalQuadTree::evaluatePDF(const Vector3D &dir) const {
+        if (!hasDistribution())
+            return 1.0f / (4 * M_PI);
+        
+        float x, y;
+        directionToCanonical(dir, &x, &y);
+        float pdf = 1.0f;
+        uint32_t nodeIdx = 0;
+        while (true) {
+            const Node &node = m_nodes[nodeIdx];
+            uint32_t q = selectQuadrant(&x, &y);
+            float value = node.sums[q].load(std::memory_order_relaxed);
+            if (value <= 0.0f)
+                return 0.0f;
+            pdf *= 4 * value / node.sum();
+            if (node.children[q] == 0)
+                break;
+            nodeIdx = node.children[q];
+        }
+        
+        return pdf / (4 * M_PI);
+    }
+    
+    void DirectionalQuadTree::refine(const DirectionalQuadTree &src, float threshold, uint32_t maxDepth) {
+        m_nodes.clear();
+        m_nodes.emplace_back();
+        float total = src.sum();
+        if (total <= 0.0f)
+            return;
+        
+        // JP: 元の木に対応するノードが無い象限は、親の値が4つの象限に等分されているとみなす。
+        // EN: a quadrant without a corresponding node in the source tree is regarded as having its parent's value split equally into four quadrants.
+        struct Entry {
+            uint32_t nodeIdx;
+            int32_t srcNodeIdx;
+            float fraction;
+            uint32_t depth;
+        };
+        std::vector<Entry> stack;
+        stack.push_back(Entry{0, 0, 1.0f, 1});
+        while (!stack.empty()) {
+            Entry entry = stack.back();
+            stack.pop_back();
+            for (int q = 0; q < 4; ++q) {
+                float fraction;
+                int32_t srcChildIdx = -1;
+                if (entry.srcNodeIdx >= 0) {
+                    const Node &srcNode = src.m_nodes[entry.srcNodeIdx];
+                    fraction = srcNode.sums[q].load(std::memory_order_relaxed) / total;
+                    if (srcNode.children[q] != 0)
+                        srcChildIdx = srcNode.children[q];
+                }
+                else {
+                    fraction = entry.fraction / 4;
+                }
+                if (fraction <= threshold || entry.depth >= maxDepth)
+                    continue;
+                
+                uint32_t childIdx = (uint32_t)m_nodes.size();
+                m_nodes.emplace_back();
+                m_nodes[entry.nodeIdx].children[q] = childIdx;
+                stack.push_back(Entry{childIdx, srcChildIdx, fraction, entry.depth + 1});
+            }
+        }
+    }
+    
+    
+    
+    static const uint32_t s_maxSpatialDepth = 20;
+    static const uint32_t s_maxDirectionalDepth = 20;
+    static const float s_directionalThreshold = 0.01f;
+    
+    const float SDTree::BSDFSamplingFraction = 0.5f;
+    
+    SDTree::SDTree(const Point3D &center, float radius, float spatialThreshold) :
+    m_minP(center - Vector3D(radius, radius, radius)), m_size(2 * radius), m_spatialThreshold(spatialThreshold), m_numIterations(0) {
+        m_nodes.push_back(SpatialNode{0, 0, 0});
+        m_leaves.emplace_back();
+    }
+    
+    uint32_t SDTree::findLeaf(const Point3D &p) const {
+        Vector3D rel = (p - m_minP) / m_size;
+        float x = std::min(std::max(rel.x, 0.0f), 0.99999994f);
+        float y = std::min(std::max(rel.y, 0.0f), 0.99999994f);
+        float z = std::min(std::max(rel.z, 0.0f), 0.99999994f);
+        uint32_t nodeIdx = 0;
+        while (true) {
+            const SpatialNode &node = m_nodes[nodeIdx];
+            if (node.firstChild == 0)
+                return node.leafIndex;
+            uint32_t cx = x >= 0.5f;
+            uint32_t cy = y >= 0.5f;
+            uint32_t cz = z >= 0.5f;
+            x = 2 * x - cx;
+            y = 2 * y - cy;
+            z = 2 * z - cz;
+            nodeIdx = node.firstChild + (cx | (cy << 1) | (cz << 2));
+        }
+    }
+    
+    void SDTree::update(uint32_t numPasses, uint32_t numThreads) {
+        // JP: 記録数が閾値を超えた葉を分割する。子は親の構築中の分布を引き継ぎ、記録数は等分されたとみなして再帰的に判定する。
+        // EN: split leaves whose record counts exceed the threshold. Children inherit the parent's distribution under construction,
+        //     and they are recursively tested regarding the count as split equally.
+        float threshold = m_spatialThreshold * std::sqrt((float)numPasses);
+        for (uint32_t nodeIdx = 0; nodeIdx < m_nodes.size(); ++nodeIdx) {
+            SpatialNode node = m_nodes[nodeIdx];
+            if (node.firstChild != 0 || node.depth >= s_maxSpatialDepth)
+                continue;
+            uint32_t numSamples = m_leaves[node.leafIndex].numSamples.load(std::memory_order_relaxed);
+            if (numSamples <= threshold)
+                continue;
+            
+            uint32_t firstChild = (uint32_t)m_nodes.size();
+            m_leaves[node.leafIndex].numSamples.store(numSamples / 8, std::memory_order_relaxed);
+            for (int i = 0; i < 8; ++i) {
+                uint32_t leafIdx = node.leafIndex;
+                if (i > 0) {
+                    leafIdx = (uint32_t)m_leaves.size();
+                    m_leaves.push_back(m_leaves[node.leafIndex]);
+                }
+                m_nodes.push_back(SpatialNode{0, leafIdx, node.depth + 1});
+            }
+            m_nodes[nodeIdx].firstChild = firstChild;
+        }
+        
+        // JP: 各葉の構築中の分布をサンプリング用とし、それに従って細分化した空の分布で構築をやり直す。
+        // EN: make each leaf's distribution under construction the sampling one, and restart construction with an empty distribution subdivided according to it.
+        const uint32_t numLeavesPerJob = 64;
+        ThreadPool threadPool(numThreads);
+        for (uint32_t begin = 0; begin < m_leaves.size(); begin += numLeavesPerJob) {
+            uint32_t end = std::min(begin + numLeavesPerJob, (uint32_t)m_leaves.size());
+            threadPool.enqueue([this, begin, end](uint32_t threadID) {
+                for (uint32_t i = begin; i < end; ++i) {
+                    Leaf &leaf = m_leaves[i];
+                    leaf.sampling = leaf.building;
+                    leaf.building.refine(leaf.sampling, s_directionalThreshold, s_maxDirectionalDepth);
+                    leaf.numSamples.store(0, std::memory_order_relaxed);
+                }
+            });
+        }
+        threadPool.wait();
+        
+        ++m_numIterations;
+    }
+}
@@ -0,0 +1,183 @@
+//
+//  SDTree.h
+//
+//  Created by 渡部 心 on 2017/06/24.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#ifndef __SLR_SDTree__
+#define __SLR_SDTree__
+
+#include "../defines.h"
+#include "../declarations.h"
+#include "../BasicTypes/Point3D.h"
+#include "../BasicTypes/Vector3D.h"
+#include <atomic>
+
+namespace SLR {
+    // JP: 方向の分布を表す四分木。方向は(cosθ, φ)の正規化された正方形に面積を保って写される。
+    //     各ノードは4つの象限の値の和を持ち、記録はロックを用いずに原子的な加算で行う。
+    //     サンプリングと確率密度の評価は和の比に従って根から葉まで辿り、葉の中では一様とする。
+    // EN: a quadtree representing a directional distribution. Directions are mapped area-preservingly to the normalized square of (cos theta, phi).
+    //     Each node has the sums of values in its four quadrants, and recording is done by lock-free atomic additions.
+    //     Sampling and PDF evaluation descend from the root to a leaf according to the ratios of the sums, and are uniform within a leaf.
+    class SLR_API DirectionalQuadTree {
+        struct Node {
+            std::atomic<float> sums[4];
+            // JP: 0は子を持たない(葉である)ことを表す。
+            // EN: 0 means that the quadrant has no child (is a leaf).
+            uint32_t children[4];
+            
+            Node() {
+                for (int i = 0; i < 4; ++i) {
+                    sums[i].store(0.0f, std::memory_order_relaxed);
+                    children[i] = 0;
+                }
+            }
+            Node(const Node &n) {
+                *this = n;
+            }
+            Node &operator=(const Node &n) {
+                for (int i = 0; i < 4; ++i) {
+                    sums[i].store(n.sums[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+                    children[i] = n.children[i];
+                }
+                return *this;
+            }
+            float sum() const {
+                return (sums[0].load(std::memory_order_relaxed) + sums[1].load(std::memory_order_relaxed) +
+                        sums[2].load(std::memory_order_relaxed) + sums[3].load(std::memory_order_relaxed));
+            }
+        };
+        
+        std::vector<Node> m_nodes;
+    public:
+        DirectionalQuadTree() : m_nodes(1) {}
+        
+        void record(const Vector3D &dir, float value);
+        // JP: 分布が空の場合は球面上の一様分布となる。
+        // EN: This is the uniform distribution on the sphere if the distribution is empty.
+        Vector3D sample(float u0, float u1, float* dirPDF) const;
+        float evaluatePDF(const Vector3D &dir) const;
+        
+        float sum() const { return m_nodes[0].sum(); }
+        bool hasDistribution() const { return sum() > 0.0f; }
+        uint32_t numNodes() const { return (uint32_t)m_nodes.size(); }
+        
+        // JP: srcの分布に従って、全体に占める割合がthresholdを超える象限を細分化した構造を作る。値は0に初期化される。
+        // EN: build a structure in which quadrants whose fraction of the total in the distribution of src exceeds threshold are subdivided. Values are initialized to 0.
+        void refine(const DirectionalQuadTree &src, float threshold, uint32_t maxDepth);
+    };
+    
+    
+    
+    // JP: 空間方向木(SD-tree, Müller et al. 2017)。シーンを囲む立方体を分割する八分木の各葉が方向の四分木を持ち、入射放射輝度の分布を学習する。
+    //     各葉は描画中に参照するサンプリング用の分布と、記録を受け付ける構築中の分布の2つを持つ。
+    //     描画中はサンプリング用の分布は読み取り専用であり、記録は構築中の分布への原子的な加算なので、スレッド間の同期は不要である。
+    //     パスの間でupdate()を呼ぶと、構築中の分布をサンプリング用に切り替え、記録数に応じて空間と方向を細分化する。
+    // EN: Spatial-directional tree (SD-tree, Müller et al. 2017). Each leaf of an octree subdividing the cube bounding the scene
+    //     has a directional quadtree to learn the distribution of incident radiance.
+    //     Each leaf has two distributions: one for sampling referred to during rendering and one under construction which accepts records.
+    //     During rendering, the sampling distribution is read-only and recording is atomic addition to the distribution under construction,
+    //     so no synchronization between threads is required.
+    //     Calling update() between passes switches the distribution under construction to sampling and subdivides space and directions according to the record counts.
+    class SLR_API SDTree {
+        struct SpatialNode {
+            // JP: 0は子を持たない(葉である)ことを表す。子の8個のノードは連続して格納される。
+            // EN: 0 means that the node has no children (is a leaf). The 8 child nodes are stored contiguously.
+            uint32_t firstChild;
+            uint32_t leafIndex;
+            uint32_t depth;
+        };
+        
+        struct Leaf {
+            DirectionalQuadTree sampling;
+            DirectionalQuadTree building;
+            std::atomic<uint32_t> numSamples;
+            
+            Leaf() : numSamples(0) {}
+            Leaf(const Leaf &l) : sampling(l.sampling), building(l.building), numSamples(l.numSamples.load(std::memory_order_relaxed)) {}
+        };
+        
+        Point3D m_minP;
+        float m_size;
+        float m_spatialThreshold;
+        std::vector<SpatialNode> m_nodes;
+        std::vector<Leaf> m_leaves;
+        uint32_t m_numIterations;
+    public:
+        // JP: 方向を1サンプルMISで選ぶ際にBSDFを選ぶ確率。
+        // EN: probability to choose the BSDF when selecting a direction with one-sample MIS.
+        static const float BSDFSamplingFraction;
+        
+        // JP: spatialThresholdは1パスあたりの記録数に対する、空間の細分化を行う閾値である。
+        // EN: spatialThreshold is the threshold of the number of records per pass to subdivide space.
+        SDTree(const Point3D &center, float radius, float spatialThreshold = 12000);
+        
+        uint32_t findLeaf(const Point3D &p) const;
+        const DirectionalQuadTree &getSamplingDistribution(uint32_t leafIdx) const { return m_leaves[leafIdx].sampling; }
+        void record(uint32_t leafIdx, const Vector3D &dir, float value) {
+            Leaf &leaf = m_leaves[leafIdx];
+            if (value > 0.0f)
+                leaf.building.record(dir, value);
+            leaf.numSamples.fetch_add(1, std::memory_order_relaxed);
+        }
+        
+        // JP: numPassesはこの学習の反復で描画したパス数。描画中に呼んではならない。
+        // EN: numPasses is the number of passes rendered in this training iteration. This must not be called during rendering.
+        void update(uint32_t numPasses, uint32_t numThreads);
+        
+        uint32_t numLeaves() const { return (uint32_t)m_leaves.size(); }
+        uint32_t numIterations() const { return m_numIterations; }
+    };
+    
+    
+    
+    // JP: 1本のパスの頂点でサンプルした方向を保持し、以降に得られた寄与からその方向の入射放射輝度を推定してSD-treeに記録する。
+    // EN: holds directions sampled at the vertices of a path, estimates the incident radiance for the directions from contributions found later
+    //     and records them into an SD-tree.
+    class GuidingPathRecorder {
+        static const uint32_t MaxNumVertices = 128;
+        
+        struct Vertex {
+            Vector3D dir;
+            uint32_t leafIndex;
+            float throughput;
+            float dirPDF;
+            float radiance;
+        };
+        
+        Vertex m_vertices[MaxNumVertices];
+        uint32_t m_numVertices;
+    public:
+        GuidingPathRecorder() : m_numVertices(0) {}
+        
+        void clear() {
+            m_numVertices = 0;
+        }
+        
+        // JP: throughputは方向のサンプル後のパスのスループットである。
+        // EN: throughput is the path throughput after sampling the direction.
+        void addVertex(uint32_t leafIdx, const Vector3D &dir, float throughput, float dirPDF) {
+            if (m_numVertices == MaxNumVertices || !(throughput > 0.0f) || !std::isfinite(throughput))
+                return;
+            m_vertices[m_numVertices++] = Vertex{dir, leafIdx, throughput, dirPDF, 0.0f};
+        }
+        // JP: パス全体のスループットを含む寄与を各頂点の入射放射輝度へ加える。
+        // EN: add a contribution including the throughput of the whole path to the incident radiance of each vertex.
+        void addContribution(float contribution) {
+            if (!std::isfinite(contribution))
+                return;
+            for (int i = 0; i < m_numVertices; ++i)
+                m_vertices[i].radiance += contribution / m_vertices[i].throughput;
+        }
+        void commit(SDTree* tree) const {
+            for (int i = 0; i < m_numVertices; ++i) {
+                const Vertex &v = m_vertices[i];
+                tree->record(v.leafIndex, v.dir, v.radiance / v.dirPDF);
+            }
+        }
+    };
+}
+
+#endif /* __SLR_SDTree__ */
@@ -0,0 +1,236 @@
+//
+//  TextureCache.cpp
+//
+//  Created by 渡部 心 on 2017/07/02.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#include "TextureCache.h"
+
+#include <cstring>
+#include "RenderStatistics.h"
+
+namespace SLR {
+    static const char s_TextureCacheMagic[8] = {'S', 'L', 'R', 'T', 'E', 'X', '\0', '\0'};
+    // JP: タイルの並びをページ境界から始め、タイルごとに物理メモリーから追い出せるようにする。
+    // EN: start the tiles at a page boundary so that each tile can be evicted from physical memory.
+    static const uint64_t s_tilesAlignment = 4096;
+    
+    struct PagedImage2D::FileHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t log2TileWidth;
+        uint32_t width;
+        uint32_t height;
+        uint32_t colorFormat;
+        uint32_t spectrumType;
+        uint64_t tileSize;
+        uint64_t tilesOffset;
+        uint64_t fileSize;
+    };
+    
+    PagedImage2D::PagedImage2D() : m_tiles(nullptr) {
+    }
+    
+    PagedImage2D::~PagedImage2D() {
+        if (m_tiles)
+            TextureCache::unregisterImage(this);
+    }
+    
+    void PagedImage2D::evictTile(uint32_t tileIndex) {
+        m_file.discard(m_tilesOffset + (uint64_t)tileIndex * m_tileSize, m_tileSize);
+    }
+    
+    const void* PagedImage2D::getInternal(uint32_t x, uint32_t y) const {
+        uint32_t tileIndex = (y >> Log2TileWidth) * m_numTileX + (x >> Log2TileWidth);
+        uint32_t localIndex = ((y & (TileWidth - 1)) << Log2TileWidth) | (x & (TileWidth - 1));
+        
+        // JP: 同じタイルを読む複数のスレッドが同じキャッシュラインに書き続けないよう、記録は世代が変わった時だけ更新する。
+        // EN: update the record only when the generation has changed so that threads reading the same tile don't keep writing to the same cache line.
+        std::atomic<uint32_t> &stamp = m_tileStamps[tileIndex];
+        uint32_t curGeneration = TextureCache::generation();
+        uint32_t prevStamp = stamp.load(std::memory_order_relaxed);
+        bool faulted = false;
+        if (prevStamp != curGeneration && stamp.compare_exchange_strong(prevStamp, curGeneration, std::memory_order_relaxed))
+            faulted = prevStamp == 0;
+        if (ThreadStatistics* stats = currentThreadStatistics())
+            stats->add(faulted ? StatCounter::TextureTileFaults : StatCounter::TextureTileHits);
+        if (faulted)
+            TextureCache::onTileFaulted(m_tileSize);
+        
+        return m_tiles + (uint64_t)tileIndex * m_tileSize + localIndex * m_stride;
+    }
+    
+    bool PagedImage2D::write(const std::string &path, const Image2D &image) {
+        uint32_t width = image.width();
+        uint32_t height = image.height();
+        size_t stride = sizesOfColorFormats[(uint32_t)image.format()];
+        uint32_t numTileX = (width + TileWidth - 1) >> Log2TileWidth;
+        uint32_t numTileY = (height + TileWidth - 1) >> Log2TileWidth;
+        
+        FileHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, s_TextureCacheMagic, sizeof(s_TextureCacheMagic));
+        header.version = Version;
+        header.log2TileWidth = Log2TileWidth;
+        header.width = width;
+        header.height = height;
+        header.colorFormat = (uint32_t)image.format();
+        header.spectrumType = (uint32_t)image.spectrumType();
+        header.tileSize = TileWidth * TileWidth * stride;
+        header.tilesOffset = (sizeof(FileHeader) + s_tilesAlignment - 1) / s_tilesAlignment * s_tilesAlignment;
+        header.fileSize = header.tilesOffset + (uint64_t)numTileX * numTileY * header.tileSize;
+        
+        return writeFileAtomically(path, [&](FILE* fp) {
+            bool success = true;
+            std::vector<uint8_t> padding(header.tilesOffset - sizeof(FileHeader), 0);
+            success &= fwrite(&header, sizeof(header), 1, fp) == 1;
+            success &= fwrite(padding.data(), 1, padding.size(), fp) == padding.size();
+            
+            // JP: 画像の端からはみ出すタイルの部分は0で埋める。
+            // EN: fill the parts of tiles outside the image with zero.
+            std::vector<uint8_t> tile(header.tileSize);
+            for (int ty = 0; ty < numTileY && success; ++ty) {
+                for (int tx = 0; tx < numTileX && success; ++tx) {
+                    std::fill(tile.begin(), tile.end(), 0);
+                    uint32_t xEnd = std::min((tx + 1) * TileWidth, width);
+                    uint32_t yEnd = std::min((ty + 1) * TileWidth, height);
+                    for (uint32_t y = ty * TileWidth; y < yEnd; ++y) {
+                        for (uint32_t x = tx * TileWidth; x < xEnd; ++x) {
+                            uint32_t localIndex = ((y & (TileWidth - 1)) << Log2TileWidth) | (x & (TileWidth - 1));
+                            std::memcpy(tile.data() + localIndex * stride, &image.get<uint8_t>(x, y), stride);
+                        }
+                    }
+                    success &= fwrite(tile.data(), 1, tile.size(), fp) == tile.size();
+                }
+            }
+            return success;
+        });
+    }
+    
+    PagedImage2D* PagedImage2D::open(const std::string &path) {
+        std::unique_ptr<PagedImage2D> image(new PagedImage2D());
+        MappedFile &file = image->m_file;
+        if (!file.open(path))
+            return nullptr;
+        uint64_t size = file.size();
+        
+        if (size < sizeof(FileHeader))
+            return nullptr;
+        const FileHeader &header = *(const FileHeader*)file.data();
+        if (std::memcmp(header.magic, s_TextureCacheMagic, sizeof(s_TextureCacheMagic)) != 0 ||
+            header.version != Version || header.log2TileWidth != Log2TileWidth || header.fileSize != size ||
+            header.width == 0 || header.height == 0 || header.colorFormat >= (uint32_t)ColorFormat::Num ||
+            header.spectrumType > (uint32_t)SpectrumType::IndexOfRefraction)
+            return nullptr;
+        size_t stride = sizesOfColorFormats[header.colorFormat];
+        uint64_t numTileX = (header.width + TileWidth - 1) >> Log2TileWidth;
+        uint64_t numTileY = (header.height + TileWidth - 1) >> Log2TileWidth;
+        if (header.tileSize != TileWidth * TileWidth * stride || header.tilesOffset % s_tilesAlignment != 0 ||
+            header.tilesOffset > size || numTileX * numTileY * header.tileSize != size - header.tilesOffset)
+            return nullptr;
+        
+        image->m_width = header.width;
+        image->m_height = header.height;
+        image->m_colorFormat = (ColorFormat)header.colorFormat;
+        image->m_spType = (SpectrumType)header.spectrumType;
+        image->m_tiles = file.data() + header.tilesOffset;
+        image->m_tilesOffset = header.tilesOffset;
+        image->m_stride = stride;
+        image->m_tileSize = header.tileSize;
+        image->m_numTileX = (uint32_t)numTileX;
+        image->m_numTiles = (uint32_t)(numTileX * numTileY);
+        image->m_tileStamps.reset(new std::atomic<uint32_t>[image->m_numTiles]);
+        for (int i = 0; i < image->m_numTiles; ++i)
+            image->m_tileStamps[i].store(0, std::memory_order_relaxed);
+        TextureCache::registerImage(image.get());
+        
+        return image.release();
+    }
+    
+    
+    
+    std::string TextureCache::s_directory;
+    uint64_t TextureCache::s_capacity = 4ULL * 1024 * 1024 * 1024;
+    std::mutex TextureCache::s_mutex;
+    std::vector<PagedImage2D*> TextureCache::s_images;
+    // JP: 0はタイルが物理メモリー上に無いことを表すため、世代は1から始める。
+    // EN: the generation starts from 1 because 0 means that a tile is not in physical memory.
+    std::atomic<uint32_t> TextureCache::s_generation{1};
+    std::atomic<uint64_t> TextureCache::s_residentBytes{0};
+    std::atomic<uint64_t> TextureCache::s_numEvictedTiles{0};
+    
+    std::string TextureCache::cachePath(uint64_t key) {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.slrtex", (unsigned long long)key);
+        if (s_directory.empty() || s_directory.back() == '/')
+            return s_directory + name;
+        return s_directory + "/" + name;
+    }
+    
+    void TextureCache::registerImage(PagedImage2D* image) {
+        std::lock_guard<std::mutex> lock(s_mutex);
+        s_images.push_back(image);
+    }
+    
+    void TextureCache::unregisterImage(PagedImage2D* image) {
+        std::lock_guard<std::mutex> lock(s_mutex);
+        s_images.erase(std::remove(s_images.begin(), s_images.end(), image), s_images.end());
+        for (int i = 0; i < image->m_numTiles; ++i) {
+            if (image->m_tileStamps[i].exchange(0, std::memory_order_relaxed) != 0)
+                s_residentBytes.fetch_sub(image->m_tileSize, std::memory_order_relaxed);
+        }
+    }
+    
+    void TextureCache::onTileFaulted(size_t tileSize) {
+        uint64_t residentBytes = s_residentBytes.fetch_add(tileSize, std::memory_order_relaxed) + tileSize;
+        if (residentBytes <= s_capacity)
+            return;
+        // JP: 他のスレッドが追い出しを行っている間は待たずにレンダリングを続ける。
+        // EN: continue rendering without waiting while another thread is evicting.
+        std::unique_lock<std::mutex> lock(s_mutex, std::try_to_lock);
+        if (lock.owns_lock() && s_residentBytes.load(std::memory_order_relaxed) > s_capacity)
+            evict();
+    }
+    
+    void TextureCache::evict() {
+        struct Candidate {
+            uint32_t stamp;
+            uint32_t imageIndex;
+            uint32_t tileIndex;
+        };
+        
+        // JP: 世代を進めて、これ以降にアクセスされたタイルを候補より新しいものとして区別する。
+        // EN: advance the generation to distinguish tiles accessed after this as newer than the candidates.
+        s_generation.fetch_add(1, std::memory_order_relaxed);
+        
+        std::vector<Candidate> candidates;
+        for (int i = 0; i < s_images.size(); ++i) {
+            const PagedImage2D* image = s_images[i];
+            for (int j = 0; j < image->m_numTiles; ++j) {
+                uint32_t stamp = image->m_tileStamps[j].load(std::memory_order_relaxed);
+                if (stamp != 0)
+                    candidates.push_back(Candidate{stamp, (uint32_t)i, (uint32_t)j});
+            }
+        }
+        std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b) {
+            return a.stamp < b.stamp;
+        });
+        
+        uint64_t targetBytes = s_capacity / 100 * EvictionTargetPercentage;
+        for (int i = 0; i < candidates.size(); ++i) {
+            if (s_residentBytes.load(std::memory_order_relaxed) <= targetBytes)
+                break;
+            const Candidate &candidate = candidates[i];
+            PagedImage2D* image = s_images[candidate.imageIndex];
+            // JP: 候補を集めた後にアクセスされたタイルは残す。
+            // EN: keep tiles accessed after collecting the candidates.
+            uint32_t stamp = candidate.stamp;
+            if (!image->m_tileStamps[candidate.tileIndex].compare_exchange_strong(stamp, 0, std::memory_order_relaxed))
+                continue;
+            image->evictTile(candidate.tileIndex);
+            s_residentBytes.fetch_sub(image->m_tileSize, std::memory_order_relaxed);
+            s_numEvictedTiles.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
@@ -0,0 +1,112 @@
+//
+//  TextureCache.h
+//
+//  Created by 渡部 心 on 2017/07/02.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#ifndef __SLR_TextureCache__
+#define __SLR_TextureCache__
+
+#include "../defines.h"
+#include "../declarations.h"
+#include "image_2d.h"
+#include "MappedFile.h"
+#include <atomic>
+#include <mutex>
+
+namespace SLR {
+    // JP: タイル単位で並べた画像ファイルをメモリーマップし、アクセスされたタイルだけを読み込む画像。
+    //     タイルの読み込みはOSのページングに任せ、ここではタイルの最終アクセスの世代を記録して
+    //     TextureCacheが古いタイルを物理メモリーから追い出せるようにする。
+    // EN: an image which memory-maps a file laid out in tiles and reads only accessed tiles.
+    //     Reading tiles is left to the paging of the OS, and this records the generation of the last access of each tile
+    //     so that TextureCache can evict old tiles from physical memory.
+    class SLR_API PagedImage2D : public Image2D {
+        struct FileHeader;
+        friend class TextureCache;
+        
+        MappedFile m_file;
+        const uint8_t* m_tiles;
+        uint64_t m_tilesOffset;
+        size_t m_stride;
+        size_t m_tileSize;
+        uint32_t m_numTileX;
+        uint32_t m_numTiles;
+        // JP: 0は物理メモリー上に無いことを、それ以外はそのタイルに最後にアクセスした世代を表す。
+        // EN: 0 means that the tile is not in physical memory, otherwise the value is the generation when the tile was last accessed.
+        std::unique_ptr<std::atomic<uint32_t>[]> m_tileStamps;
+        
+        PagedImage2D();
+        
+        void evictTile(uint32_t tileIndex);
+        
+        const void* getInternal(uint32_t x, uint32_t y) const override;
+        void setInternal(uint32_t x, uint32_t y, const void* data, size_t size) override {
+            SLRAssert_NotImplemented();
+        }
+    public:
+        static const uint32_t Version = 1;
+        // JP: 64x64ピクセルのタイルは一般的な画素形式でページの大きさの倍数になる。
+        // EN: a tile of 64x64 pixels becomes a multiple of the page size for common pixel formats.
+        static const uint32_t Log2TileWidth = 6;
+        static const uint32_t TileWidth = 1 << Log2TileWidth;
+        
+        ~PagedImage2D();
+        
+        uint32_t numTiles() const { return m_numTiles; }
+        size_t tileSize() const { return m_tileSize; }
+        
+        // JP: 画像をタイル単位で並べてファイルに書き出す。
+        // EN: writes an image to a file laid out in tiles.
+        static bool write(const std::string &path, const Image2D &image);
+        // JP: ファイルを開いて内容を検証する。存在しない場合や検証に失敗した場合はnullptrを返す。
+        // EN: opens a file and validates its contents. This returns nullptr if it doesn't exist or the validation fails.
+        static PagedImage2D* open(const std::string &path);
+    };
+    
+    
+    
+    // JP: 画像テクスチャーをタイル状のファイルに一度変換して置いておき、レンダリング中はタイルを必要に応じて読み込む。
+    //     物理メモリー上のタイルの合計が容量を超えると、最後のアクセスが古いタイルから追い出す。
+    // EN: converts image textures once into tiled files to keep them, and reads tiles on demand during rendering.
+    //     When the total size of the tiles in physical memory exceeds the capacity, this evicts tiles from the least recently accessed ones.
+    class SLR_API TextureCache {
+        friend class PagedImage2D;
+        
+        static std::string s_directory;
+        static uint64_t s_capacity;
+        static std::mutex s_mutex;
+        static std::vector<PagedImage2D*> s_images;
+        static std::atomic<uint32_t> s_generation;
+        static std::atomic<uint64_t> s_residentBytes;
+        static std::atomic<uint64_t> s_numEvictedTiles;
+        
+        static void registerImage(PagedImage2D* image);
+        static void unregisterImage(PagedImage2D* image);
+        static uint32_t generation() { return s_generation.load(std::memory_order_relaxed); }
+        static void onTileFaulted(size_t tileSize);
+        static void evict();
+    public:
+        // JP: これより少ないピクセルの画像はメモリー上に置いたままにする。
+        // EN: images with fewer pixels than this are kept in memory.
+        static const uint32_t MinNumPixels = 512 * 512;
+        // JP: 追い出しは物理メモリー上のタイルが容量のこの割合に収まるまで行う。
+        // EN: eviction continues until the tiles in physical memory fit in this fraction of the capacity.
+        static const uint32_t EvictionTargetPercentage = 75;
+        
+        // JP: 変換したファイルを置くディレクトリ。空の場合(既定)はキャッシュを用いない。
+        // EN: the directory to put converted files. The cache is not used if empty (default).
+        static void setDirectory(const std::string &directory) { s_directory = directory; }
+        static const std::string &directory() { return s_directory; }
+        static void setCapacity(uint64_t bytes) { s_capacity = bytes; }
+        static uint64_t capacity() { return s_capacity; }
+        
+        static std::string cachePath(uint64_t key);
+        
+        static uint64_t residentBytes() { return s_residentBytes.load(std::memory_order_relaxed); }
+        static uint64_t numEvictedTiles() { return s_numEvictedTiles.load(std::memory_order_relaxed); }
+    };
+}
+
+#endif /* __SLR_TextureCache__ */
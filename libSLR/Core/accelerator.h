@@ -11,6 +11,7 @@
 #include "../defines.h"
 #include "../declarations.h"
 #include "../Core/geometry.h"
+#include "../Core/RenderStatistics.h"
 
 namespace SLR {
     class SLR_API Accelerator {
@@ -22,6 +23,34 @@ namespace SLR {
         virtual BoundingBox3D bounds() const = 0;
         
         virtual bool intersect(const Ray &ray, const RaySegment &segment, SurfaceInteraction* si, uint32_t* closestIndex) const = 0;
+        // JP: 葉に並んだ物体の列。交差判定が返す番号はこの列の位置を指す。
+        // EN: the sequence of objects in leaves. Indices returned by intersection point to positions in this sequence.
+        virtual const std::vector<const SurfaceObject*> &leafObjects() const = 0;
+        // JP: 最大32本の光線の束をまとめて交差判定する。activeMaskのビットが立った光線のみを判定し、交差した光線のビットを返す。
+        //     交差した光線のsegmentsの最大距離は交点までの距離に更新される。既定の実装は1本ずつ判定する。
+        // EN: intersect a packet of up to 32 rays at once. Only rays whose bits are set in activeMask are tested, and the bits of rays which hit something are returned.
+        //     The maximum distances of segments of the hit rays are updated to the distances to the intersections. The default implementation tests rays one by one.
+        virtual uint32_t intersectPacket(const Ray* rays, RaySegment* segments, SurfaceInteraction* sis, uint32_t* closestIndices, uint32_t activeMask) const {
+            uint32_t hitMask = 0;
+            for (uint32_t i = 0; i < 32 && (activeMask >> i) != 0; ++i) {
+                if (((activeMask >> i) & 0x1) == 0)
+                    continue;
+                if (intersect(rays[i], segments[i], &sis[i], &closestIndices[i])) {
+                    segments[i].distMax = sis[i].getDistance();
+                    hitMask |= 1u << i;
+                }
+            }
+            return hitMask;
+        }
+        
+        // JP: 交差判定で辿ったノードと判定したプリミティブの数を現在のスレッドの統計に加える。
+        // EN: add the numbers of nodes traversed and primitives tested in an intersection query to the current thread's statistics.
+        static void recordTraversal(uint32_t numNodes, uint32_t numPrimitives) {
+            if (ThreadStatistics* stats = currentThreadStatistics()) {
+                stats->add(StatCounter::BVHNodesVisited, numNodes);
+                stats->add(StatCounter::PrimitivesTested, numPrimitives);
+            }
+        }
         
         static bool traceTraverse;
         static std::string traceTraversePrefix;
@@ -0,0 +1,105 @@
+//
+//  bidirectional_mis_weights.h
+//
+//  Created by 渡部 心 on 2017/06/19.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#ifndef __SLR_bidirectional_mis_weights__
+#define __SLR_bidirectional_mis_weights__
+
+#include "../defines.h"
+#include "../declarations.h"
+
+namespace SLR {
+    // JP: 双方向パストレーシングのパワーヒューリスティック(指数2)によるMISウェイトを接続ごとに定数時間で計算するための関数群。
+    //     ある戦略のウェイトの逆数は、片方のサブパスの端点をもう片方のサブパスへ移した戦略との確率密度比の二乗和で与えられる。
+    //     サブパスを3頂点以上短縮する戦略の比は接続に依らない頂点の確率密度のみで決まるため、
+    //     サブパス生成時にその和を再帰的に各頂点に蓄積しておく。(VCMの部分MIS量と同様の考え方)
+    //     確率密度は全てロシアンルーレットの確率を掛けたものを渡す。
+    // EN: functions to calculate power-heuristic (exponent 2) MIS weights of bidirectional path tracing in constant time for each connection.
+    //     The reciprocal of a strategy's weight is given by the sum of squared PDF ratios to the strategies
+    //     which move end vertices of one subpath to the other subpath.
+    //     Ratios for strategies shortening a subpath by three or more vertices depend only on the PDFs of vertices independent of the connection,
+    //     so their sum is recursively accumulated to each vertex during subpath generation. (the same idea as the partial MIS quantities of VCM)
+    //     All PDFs should be passed multiplied by Russian roulette probabilities.
+    
+    // JP: 頂点の逆方向の確率密度が確定した際に、その頂点に蓄積する部分和を計算する。
+    //     prevPartialSumは1つ手前(光源またはレンズ側)の頂点の部分和、nextIsDeltaは1つ先の頂点がデルタ関数でサンプルされたかを表す。
+    // EN: calculate the partial sum accumulated to a vertex when the reverse PDF of the vertex is determined.
+    //     prevPartialSum is the partial sum of the previous vertex (on the light or lens side),
+    //     nextIsDelta indicates whether the next vertex was sampled by a delta function.
+    inline float calcPartialMISWeightSum(float prevPartialSum, float PDF, float revPDF, bool isDelta, bool nextIsDelta) {
+        float PDFRatio = revPDF / PDF;
+        return PDFRatio * PDFRatio * ((isDelta || nextIsDelta ? 0.0f : 1.0f) + prevPartialSum);
+    }
+    
+    // JP: 接続において、numVertices個の頂点を持つサブパスを短縮し、もう片方のサブパスを延長する全ての戦略の確率密度比の二乗和を返す。
+    //     extend1stPDF, extend2ndPDFは延長側から端点とその1つ手前の頂点を生成する確率密度、
+    //     endPDF, nextToEndPDFは端点とその1つ手前の頂点の(順方向の)確率密度、
+    //     partialSumは端点の2つ手前の頂点に蓄積された部分和である。
+    //     minNumVerticesより頂点数の少ない戦略は考慮しない。
+    // EN: return the sum of squared PDF ratios of all the strategies which shorten a subpath with numVertices vertices and extend the other subpath at a connection.
+    //     extend1stPDF and extend2ndPDF are the PDFs to generate the end vertex and the vertex next to it from the extending side,
+    //     endPDF and nextToEndPDF are the (forward) PDFs of the end vertex and the vertex next to it,
+    //     partialSum is the partial sum accumulated to the vertex two before the end vertex.
+    //     Strategies with fewer vertices than minNumVertices are not considered.
+    inline float calcShortenedMISWeightSum(float extend1stPDF, float extend2ndPDF, uint32_t numVertices, uint32_t minNumVertices,
+                                           float endPDF, bool endIsDelta, float nextToEndPDF, bool nextToEndIsDelta, float partialSum) {
+        if (numVertices <= minNumVertices)
+            return 0.0f;
+        float PDFRatio = extend1stPDF / endPDF;
+        float sum = endIsDelta ? 0.0f : PDFRatio * PDFRatio;
+        if (numVertices - 1 > minNumVertices) {
+            PDFRatio *= extend2ndPDF / nextToEndPDF;
+            float sqPDFRatio = PDFRatio * PDFRatio;
+            if (!endIsDelta && !nextToEndIsDelta)
+                sum += sqPDFRatio;
+            if (numVertices - 2 > minNumVertices)
+                sum += sqPDFRatio * partialSum;
+        }
+        return sum;
+    }
+    
+    // JP: calcShortenedMISWeightSum()と同じ和を、短縮するサブパスの全頂点を辿って求める。接続ごとにO(n)かかる以前の計算で、検証に用いる。
+    //     PDF(i), revPDF(i), isDelta(i)はサブパスのi番目の頂点の順方向・逆方向の確率密度とデルタ関数でサンプルされたかを返す。
+    // EN: calculate the same sum as calcShortenedMISWeightSum() by walking all the vertices of the subpath to shorten.
+    //     This is the previous calculation costing O(n) per connection and is used for validation.
+    //     PDF(i), revPDF(i) and isDelta(i) return the forward and reverse PDFs of the i-th vertex of the subpath and whether it was sampled by a delta function.
+    template <typename PDFFunc, typename RevPDFFunc, typename IsDeltaFunc>
+    inline float calcShortenedMISWeightSumByWalk(float extend1stPDF, float extend2ndPDF, uint32_t numVertices, uint32_t minNumVertices,
+                                                 const PDFFunc &PDF, const RevPDFFunc &revPDF, const IsDeltaFunc &isDelta) {
+        if (numVertices <= minNumVertices)
+            return 0.0f;
+        float sum = 0.0f;
+        float PDFRatio = extend1stPDF / PDF(numVertices - 1);
+        bool prevIsDelta = isDelta(numVertices - 1);
+        if (!prevIsDelta)
+            sum += PDFRatio * PDFRatio;
+        if (numVertices - 1 > minNumVertices) {
+            PDFRatio *= extend2ndPDF / PDF(numVertices - 2);
+            bool curIsDelta = isDelta(numVertices - 2);
+            if (!curIsDelta && !prevIsDelta)
+                sum += PDFRatio * PDFRatio;
+            prevIsDelta = curIsDelta;
+            for (int i = numVertices - 2; i > minNumVertices; --i) {
+                PDFRatio *= revPDF(i - 1) / PDF(i - 1);
+                curIsDelta = isDelta(i - 1);
+                if (!curIsDelta && !prevIsDelta)
+                    sum += PDFRatio * PDFRatio;
+                prevIsDelta = curIsDelta;
+            }
+        }
+        return sum;
+    }
+    
+    // JP: 定数時間の計算と全頂点を辿る計算によるウェイトが、浮動小数点の誤差の範囲で一致するかを返す。
+    // EN: return whether weights by the constant-time calculation and by walking all the vertices agree within floating-point errors.
+    inline bool MISWeightsAgree(float weight, float walkedWeight) {
+        if (std::isnan(weight) || std::isnan(walkedWeight))
+            return std::isnan(weight) && std::isnan(walkedWeight);
+        return weight == walkedWeight || std::fabs(weight - walkedWeight) <= 1e-4f * walkedWeight;
+    }
+}
+
+#endif /* __SLR_bidirectional_mis_weights__ */
@@ -60,9 +60,13 @@ namespace SLR {
     }
     
     SampledSpectrum BSDF::sample(const ABDFQuery* query, LightPathSampler &sampler, ArenaAllocator &mem, ABDFQueryResult** result) const {
+        return sample(query, sampler.getBSDFSample(), mem, result);
+    }
+    
+    SampledSpectrum BSDF::sample(const ABDFQuery* query, const BSDFSample &smp, ArenaAllocator &mem, ABDFQueryResult** result) const {
         BSDFQueryResult* concreteResult = mem.create<BSDFQueryResult>();
         // MEMO: *(const BSDFQuery*)query doesn't seem a good way.
-        SampledSpectrum ret = sample(*(const BSDFQuery*)query, sampler.getBSDFSample(), concreteResult);
+        SampledSpectrum ret = sample(*(const BSDFQuery*)query, smp, concreteResult);
         *result = concreteResult;
         return ret;
     }
@@ -78,9 +82,17 @@ namespace SLR {
     
     
     SampledSpectrum VolumetricBSDF::sample(const ABDFQuery* query, LightPathSampler &sampler, ArenaAllocator &mem, ABDFQueryResult** result) const {
+        return samplePF(query, sampler.getPFSample(), mem, result);
+    }
+    
+    SampledSpectrum VolumetricBSDF::sample(const ABDFQuery* query, const BSDFSample &smp, ArenaAllocator &mem, ABDFQueryResult** result) const {
+        return samplePF(query, PFSample(smp.uDir[0], smp.uDir[1]), mem, result);
+    }
+    
+    SampledSpectrum VolumetricBSDF::samplePF(const ABDFQuery* query, const PFSample &smp, ArenaAllocator &mem, ABDFQueryResult** result) const {
         PFQueryResult concreteResult;
         PFQuery pfQuery(-query->dirLocal, query->wlHint, query->dirTypeFilter, query->requestReverse);
-        SampledSpectrum ret = m_albedo * m_pf->sample(pfQuery, sampler.getPFSample(), &concreteResult);
+        SampledSpectrum ret = m_albedo * m_pf->sample(pfQuery, smp, &concreteResult);
         *result = mem.create<VolumetricBSDFQueryResult>(concreteResult);
         if (pfQuery.requestReverse) {
             (*result)->reverse.value = ret;
@@ -159,7 +171,7 @@ namespace SLR {
             }
         }
         return ret;
-        
+
 //        cosEnter = std::fabs(std::clamp(cosEnter, -1.0f, 1.0f));
 //        
 //        bool entering = cosEnter > 0.0f;
@@ -249,7 +261,7 @@ namespace SLR {
         float tiltFactor = std::sqrt(u1 / (1 - u1));
         float slope_x = m_alpha_gx * tiltFactor * std::cos(2 * M_PI * u0);
         float slope_y = m_alpha_gy * tiltFactor * std::sin(2 * M_PI * u0);
-
+        
         *m = Normal3D(-slope_x, -slope_y, 1.0f).normalize();
         
         float temp = m->x * m->x / (m_alpha_gx * m_alpha_gx) + m->y * m->y / (m_alpha_gy * m_alpha_gy) + m->z * m->z;
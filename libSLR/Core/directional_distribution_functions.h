@@ -215,7 +215,7 @@ namespace SLR {
         }
     };
     
-
+    
     
     struct SLR_API IDFSample {
         float uDir[2];
@@ -266,6 +266,9 @@ namespace SLR {
         virtual ~AbstractBDF() { }
         
         virtual SampledSpectrum sample(const ABDFQuery* query, LightPathSampler &sampler, ArenaAllocator &mem, ABDFQueryResult** result) const = 0;
+        // JP: 既に引いたサンプルを用いる。位相関数の場合は方向の2次元のみを用いる。
+        // EN: use a sample already drawn. Only the two dimensions for the direction are used for a phase function.
+        virtual SampledSpectrum sample(const ABDFQuery* query, const BSDFSample &smp, ArenaAllocator &mem, ABDFQueryResult** result) const = 0;
         virtual SampledSpectrum evaluate(const ABDFQuery* query, const Vector3D &dir, SampledSpectrum* rev_fs = nullptr) const = 0;
         virtual float evaluatePDF(const ABDFQuery* query, const Vector3D &dir, float* revPDF = nullptr) const = 0;
         
@@ -365,6 +368,7 @@ namespace SLR {
         }
         
         SampledSpectrum sample(const ABDFQuery* query, LightPathSampler &sampler, ArenaAllocator &mem, ABDFQueryResult** result) const override;
+        SampledSpectrum sample(const ABDFQuery* query, const BSDFSample &smp, ArenaAllocator &mem, ABDFQueryResult** result) const override;
         SampledSpectrum evaluate(const ABDFQuery* query, const Vector3D &dir, SampledSpectrum* rev_fs = nullptr) const override;
         float evaluatePDF(const ABDFQuery* query, const Vector3D &dir, float* revPDF = nullptr) const override;
     };
@@ -388,10 +392,13 @@ namespace SLR {
     class SLR_API VolumetricBSDF : public AbstractBDF {
         const PhaseFunction* m_pf;
         SampledSpectrum m_albedo;
+        
+        SampledSpectrum samplePF(const ABDFQuery* query, const PFSample &smp, ArenaAllocator &mem, ABDFQueryResult** result) const;
     public:
         VolumetricBSDF(const SampledSpectrum &albedo, const PhaseFunction* pf) : AbstractBDF(pf->directionType()), m_pf(pf), m_albedo(albedo) { }
         
         SampledSpectrum sample(const ABDFQuery* query, LightPathSampler &sampler, ArenaAllocator &mem, ABDFQueryResult** result) const override;
+        SampledSpectrum sample(const ABDFQuery* query, const BSDFSample &smp, ArenaAllocator &mem, ABDFQueryResult** result) const override;
         SampledSpectrum evaluate(const ABDFQuery* query, const Vector3D &dir, SampledSpectrum* rev_fs = nullptr) const override;
         float evaluatePDF(const ABDFQuery* query, const Vector3D &dir, float* revPDF = nullptr) const override;
     };
@@ -401,7 +408,7 @@ namespace SLR {
     class SLR_API IDF {
     protected:
         const DirectionType m_type;
-        
+    
     public:
         IDF(DirectionType type) : m_type(type) { }
         virtual ~IDF() { }
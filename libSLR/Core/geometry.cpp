@@ -11,8 +11,17 @@
 #include "transform.h"
 #include "surface_object.h"
 #include "medium_object.h"
+#include "BVHCache.h"
 
 namespace SLR {
+    uint64_t SurfaceShape::geometryHash() const {
+        BoundingBox3D bb = bounds();
+        float values[] = {bb.minP.x, bb.minP.y, bb.minP.z, bb.maxP.x, bb.maxP.y, bb.maxP.z, costForIntersect()};
+        return hashFNV1a64(values, sizeof(values));
+    }
+    
+    
+    
     void SurfaceInteraction::calculateSurfacePoint(SurfacePoint* surfPt) const {
         m_obj->calculateSurfacePoint(*this, surfPt);
     }
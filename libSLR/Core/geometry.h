@@ -196,6 +196,7 @@ namespace SLR {
         m_gNormal(si.m_gNormal), m_u(si.m_u), m_v(si.m_v), m_texCoord(si.m_texCoord), m_texCoord0Dir(texCoord0Dir) { }
         
         void setObject(const SingleSurfaceObject* obj) { m_obj = obj; }
+        const SingleSurfaceObject* getObject() const { return m_obj; }
         
         const Normal3D &getGeometricNormal() const { return m_gNormal; }
         void getSurfaceParameter(float* u, float* v) const {
@@ -338,6 +339,11 @@ namespace SLR {
             *bbox1 = baseBBox;
             bbox1->minP[splitAxis] = std::max(bbox1->minP[splitAxis], splitPos);
         }
+        // JP: 加速構造の構築が依存する幾何(境界、交差判定のコスト、分割した境界)を表すハッシュ。
+        //     既定の実装は境界とコストから計算するので、分割した境界を独自に計算する形状はオーバーライドする必要がある。
+        // EN: hash representing the geometry which accelerator construction depends on (bounds, intersection cost, split bounds).
+        //     The default implementation calculates it from the bounds and the cost, so a shape calculating split bounds on its own needs to override this.
+        virtual uint64_t geometryHash() const;
         virtual bool preTransformed() const = 0;
         virtual bool intersect(const Ray &ray, const RaySegment &segment, SurfaceInteraction* si) const = 0;
         virtual void calculateSurfacePoint(const SurfaceInteraction &si, SurfacePoint* surfPt) const = 0;
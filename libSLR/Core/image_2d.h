@@ -87,6 +87,8 @@ namespace SLR {
         size_t m_numTileX;
         size_t m_allocSize;
         uint8_t* m_data;
+        size_t m_srcStride;
+        std::function<void(const void*, int32_t, int32_t)> m_convertFunc;
         
         const void* getInternal(uint32_t x, uint32_t y) const override {
             uint32_t tx = x >> log2_tileWidth;
@@ -108,7 +110,7 @@ namespace SLR {
             
         }
         
-        TiledImage2DTemplate(uint32_t width, uint32_t height, ColorFormat fmt, Allocator* mem) {
+        TiledImage2DTemplate(uint32_t width, uint32_t height, ColorFormat fmt, Allocator* mem) : m_srcStride(0) {
             m_width = width;
             m_height = height;
             m_spType = SpectrumType::Reflectance;
@@ -123,20 +125,23 @@ namespace SLR {
             memset(m_data, 0, m_allocSize);
         }
         
-        TiledImage2DTemplate(const void* linearData, uint32_t width, uint32_t height, ColorFormat fmt, Allocator* mem, ImageStoreMode mode, SpectrumType spType) {
+        // JP: 変換元の形式と格納方法を決めて領域だけを確保する。中身はsetRows()で行のまとまりごとに変換して設定する。
+        // EN: this determines the source format and the storing method and only allocates the storage.
+        //     The contents are converted and set for each range of rows by setRows().
+        TiledImage2DTemplate(uint32_t width, uint32_t height, ColorFormat fmt, Allocator* mem, ImageStoreMode mode, SpectrumType spType) {
             m_width = width;
             m_height = height;
             m_spType = spType;
+            m_srcStride = sizesOfColorFormats[(uint32_t)fmt];
             
-            std::function<void(int32_t, int32_t)> convertFunc;
             switch (fmt) {
                 case ColorFormat::RGB8x3:
                     switch (mode) {
                         case ImageStoreMode::AsIs:
 #ifdef SLR_Use_Spectral_Representation
                             m_colorFormat = ColorFormat::uvs16Fx3;
-                            convertFunc = [this, &linearData, &spType](int32_t x, int32_t y) {
-                                const RGB8x3 &val = *((RGB8x3*)linearData + m_width * y + x);
+                            m_convertFunc = [this, spType](const void* src, int32_t x, int32_t y) {
+                                const RGB8x3 &val = *(const RGB8x3*)src;
                                 float RGB[3] = {val.r / 255.0f, val.g / 255.0f, val.b / 255.0f};
                                 float uvs[3];
                                 UpsampledContinuousSpectrum::sRGB_to_uvs(spType, RGB, uvs);
@@ -148,8 +153,8 @@ namespace SLR {
                             };
 #else
                             m_colorFormat = ColorFormat::RGB8x3;
-                            convertFunc = [this, &linearData, &spType](int32_t x, int32_t y) {
-                                const RGB8x3 &val = *((RGB8x3*)linearData + m_width * y + x);
+                            m_convertFunc = [this, spType](const void* src, int32_t x, int32_t y) {
+                                const RGB8x3 &val = *(const RGB8x3*)src;
                                 RGB8x3 storedVal{val.r, val.g, val.b};
                                 setInternal(x, y, &storedVal, m_stride);
                             };
@@ -157,16 +162,16 @@ namespace SLR {
                             break;
                         case ImageStoreMode::NormalTexture:
                             m_colorFormat = ColorFormat::RGB8x3;
-                            convertFunc = [this, &linearData, &spType](int32_t x, int32_t y) {
-                                const RGB8x3 &val = *((RGB8x3*)linearData + m_width * y + x);
+                            m_convertFunc = [this, spType](const void* src, int32_t x, int32_t y) {
+                                const RGB8x3 &val = *(const RGB8x3*)src;
                                 RGB8x3 storedVal{val.r, val.g, val.b};
                                 setInternal(x, y, &storedVal, m_stride);
                             };
                             break;
                         case ImageStoreMode::AlphaTexture:
                             m_colorFormat = ColorFormat::Gray8;
-                            convertFunc = [this, &linearData, &spType](int32_t x, int32_t y) {
-                                const RGB8x3 &val = *((RGB8x3*)linearData + m_width * y + x);
+                            m_convertFunc = [this, spType](const void* src, int32_t x, int32_t y) {
+                                const RGB8x3 &val = *(const RGB8x3*)src;
                                 Gray8 storedVal{val.r};
                                 setInternal(x, y, &storedVal, m_stride);
                             };
@@ -180,8 +185,8 @@ namespace SLR {
                         case ImageStoreMode::AsIs:
 #ifdef SLR_Use_Spectral_Representation
                             m_colorFormat = ColorFormat::uvs16Fx3;
-                            convertFunc = [this, &linearData, &spType](int32_t x, int32_t y) {
-                                const RGB_8x4 &val = *((RGB_8x4*)linearData + m_width * y + x);
+                            m_convertFunc = [this, spType](const void* src, int32_t x, int32_t y) {
+                                const RGB_8x4 &val = *(const RGB_8x4*)src;
                                 float RGB[3] = {val.r / 255.0f, val.g / 255.0f, val.b / 255.0f};
                                 float uvs[3];
                                 UpsampledContinuousSpectrum::sRGB_to_uvs(spType, RGB, uvs);
@@ -193,8 +198,8 @@ namespace SLR {
                             };
 #else
                             m_colorFormat = ColorFormat::RGB8x3;
-                            convertFunc = [this, &linearData, &spType](int32_t x, int32_t y) {
-                                const RGB_8x4 &val = *((RGB_8x4*)linearData + m_width * y + x);
+                            m_convertFunc = [this, spType](const void* src, int32_t x, int32_t y) {
+                                const RGB_8x4 &val = *(const RGB_8x4*)src;
                                 RGB8x3 storedVal{val.r, val.g, val.b};
                                 setInternal(x, y, &storedVal, m_stride);
                             };
@@ -202,16 +207,16 @@ namespace SLR {
                             break;
                         case ImageStoreMode::NormalTexture:
                             m_colorFormat = ColorFormat::RGB8x3;
-                            convertFunc = [this, &linearData, &spType](int32_t x, int32_t y) {
-                                const RGB_8x4 &val = *((RGB_8x4*)linearData + m_width * y + x);
+                            m_convertFunc = [this, spType](const void* src, int32_t x, int32_t y) {
+                                const RGB_8x4 &val = *(const RGB_8x4*)src;
                                 RGB8x3 storedVal{val.r, val.g, val.b};
                                 setInternal(x, y, &storedVal, m_stride);
                             };
                             break;
                         case ImageStoreMode::AlphaTexture:
                             m_colorFormat = ColorFormat::Gray8;
-                            convertFunc = [this, &linearData, &spType](int32_t x, int32_t y) {
-                                const RGB_8x4 &val = *((RGB_8x4*)linearData + m_width * y + x);
+                            m_convertFunc = [this, spType](const void* src, int32_t x, int32_t y) {
+                                const RGB_8x4 &val = *(const RGB_8x4*)src;
                                 Gray8 storedVal{val.r};
                                 setInternal(x, y, &storedVal, m_stride);
                             };
@@ -225,8 +230,8 @@ namespace SLR {
                         case ImageStoreMode::AsIs:
 #ifdef SLR_Use_Spectral_Representation
                             m_colorFormat = ColorFormat::uvsA16Fx4;
-                            convertFunc = [this, &linearData, &spType](int32_t x, int32_t y) {
-                                const RGBA8x4 &val = *((RGBA8x4*)linearData + m_width * y + x);
+                            m_convertFunc = [this, spType](const void* src, int32_t x, int32_t y) {
+                                const RGBA8x4 &val = *(const RGBA8x4*)src;
                                 float RGB[3] = {val.r / 255.0f, val.g / 255.0f, val.b / 255.0f};
                                 float uvs[3];
                                 UpsampledContinuousSpectrum::sRGB_to_uvs(spType, RGB, uvs);
@@ -238,8 +243,8 @@ namespace SLR {
                             };
 #else
                             m_colorFormat = ColorFormat::RGBA8x4;
-                            convertFunc = [this, &linearData, &spType](int32_t x, int32_t y) {
-                                const RGBA8x4 &val = *((RGBA8x4*)linearData + m_width * y + x);
+                            m_convertFunc = [this, spType](const void* src, int32_t x, int32_t y) {
+                                const RGBA8x4 &val = *(const RGBA8x4*)src;
                                 RGBA8x4 storedVal{val.r, val.g, val.b, val.a};
                                 setInternal(x, y, &storedVal, m_stride);
                             };
@@ -247,16 +252,16 @@ namespace SLR {
                             break;
                         case ImageStoreMode::NormalTexture:
                             m_colorFormat = ColorFormat::RGB8x3;
-                            convertFunc = [this, &linearData, &spType](int32_t x, int32_t y) {
-                                const RGBA8x4 &val = *((RGBA8x4*)linearData + m_width * y + x);
+                            m_convertFunc = [this, spType](const void* src, int32_t x, int32_t y) {
+                                const RGBA8x4 &val = *(const RGBA8x4*)src;
                                 RGB8x3 storedVal{val.r, val.g, val.b};
                                 setInternal(x, y, &storedVal, m_stride);
                             };
                             break;
                         case ImageStoreMode::AlphaTexture:
                             m_colorFormat = ColorFormat::Gray8;
-                            convertFunc = [this, &linearData, &spType](int32_t x, int32_t y) {
-                                const RGBA8x4 &val = *((RGBA8x4*)linearData + m_width * y + x);
+                            m_convertFunc = [this, spType](const void* src, int32_t x, int32_t y) {
+                                const RGBA8x4 &val = *(const RGBA8x4*)src;
                                 Gray8 storedVal{val.a};
                                 setInternal(x, y, &storedVal, m_stride);
                             };
@@ -270,8 +275,8 @@ namespace SLR {
                         case ImageStoreMode::AsIs:
 #ifdef SLR_Use_Spectral_Representation
                             m_colorFormat = ColorFormat::uvsA16Fx4;
-                            convertFunc = [this, &linearData, &spType](int32_t x, int32_t y) {
-                                const RGBA16Fx4 &val = *((RGBA16Fx4*)linearData + m_width * y + x);
+                            m_convertFunc = [this, spType](const void* src, int32_t x, int32_t y) {
+                                const RGBA16Fx4 &val = *(const RGBA16Fx4*)src;
                                 float RGB[3] = {val.r, val.g, val.b};
                                 float uvs[3];
                                 RGB[0] = std::max(RGB[0], 0.0f);
@@ -287,8 +292,8 @@ namespace SLR {
                             };
 #else
                             m_colorFormat = ColorFormat::RGBA16Fx4;
-                            convertFunc = [this, &linearData, &spType](int32_t x, int32_t y) {
-                                const RGBA16Fx4 &val = *((RGBA16Fx4*)linearData + m_width * y + x);
+                            m_convertFunc = [this, spType](const void* src, int32_t x, int32_t y) {
+                                const RGBA16Fx4 &val = *(const RGBA16Fx4*)src;
                                 RGBA16Fx4 storedVal{val.r, val.g, val.b, val.a};
                                 setInternal(x, y, &storedVal, m_stride);
                             };
@@ -299,8 +304,8 @@ namespace SLR {
                             break;
                         case ImageStoreMode::AlphaTexture:
                             m_colorFormat = ColorFormat::Gray8;
-                            convertFunc = [this, &linearData, &spType](int32_t x, int32_t y) {
-                                const RGBA16Fx4 &val = *((RGBA16Fx4*)linearData + m_width * y + x);
+                            m_convertFunc = [this, spType](const void* src, int32_t x, int32_t y) {
+                                const RGBA16Fx4 &val = *(const RGBA16Fx4*)src;
                                 SLRAssert(val.a > 0.0f, "Invalid alpha value.");
                                 Gray8 storedVal{(uint8_t)std::min(uint32_t(255 * val.a), uint32_t(255))};
                                 setInternal(x, y, &storedVal, m_stride);
@@ -314,8 +319,8 @@ namespace SLR {
                     switch (mode) {
                         case ImageStoreMode::AsIs:
                             m_colorFormat = ColorFormat::Gray8;
-                            convertFunc = [this, &linearData, &spType](int32_t x, int32_t y) {
-                                const Gray8 &val = *((Gray8*)linearData + m_width * y + x);
+                            m_convertFunc = [this, spType](const void* src, int32_t x, int32_t y) {
+                                const Gray8 &val = *(const Gray8*)src;
                                 setInternal(x, y, &val, m_stride);
                             };
                             break;
@@ -324,8 +329,8 @@ namespace SLR {
                             break;
                         case ImageStoreMode::AlphaTexture:
                             m_colorFormat = ColorFormat::Gray8;
-                            convertFunc = [this, &linearData, &spType](int32_t x, int32_t y) {
-                                const Gray8 &val = *((Gray8*)linearData + m_width * y + x);
+                            m_convertFunc = [this, spType](const void* src, int32_t x, int32_t y) {
+                                const Gray8 &val = *(const Gray8*)src;
                                 setInternal(x, y, &val, m_stride);
                             };
                             break;
@@ -343,11 +348,27 @@ namespace SLR {
             size_t tileSize = m_stride * tileWidth * tileWidth;
             m_allocSize = m_numTileX * numTileY * tileSize;
             m_data = (uint8_t*)mem->alloc(m_allocSize, SLR_L1_Cacheline_Size);
-            
-            for (int i = 0; i < m_height; ++i) {
+        }
+        
+        TiledImage2DTemplate(const void* linearData, uint32_t width, uint32_t height, ColorFormat fmt, Allocator* mem, ImageStoreMode mode, SpectrumType spType) :
+        TiledImage2DTemplate(width, height, fmt, mem, mode, spType) {
+            setRows(linearData, 0, height);
+        }
+        
+        // JP: 連続して並んだnumRows行の変換元の画素を変換して、yBegin行目から格納する。
+        //     異なる行の範囲に対する呼び出しは書き込む領域が重ならないので、複数のスレッドから同時に行ってよい。
+        // EN: converts source pixels of numRows rows arranged contiguously and stores them from the row yBegin.
+        //     Calls for different ranges of rows can be made concurrently from multiple threads since they write to disjoint areas.
+        void setRows(const void* rows, uint32_t yBegin, uint32_t numRows) {
+            const uint8_t* srcRow = (const uint8_t*)rows;
+            size_t srcRowSize = m_width * m_srcStride;
+            for (int i = 0; i < numRows; ++i) {
+                const uint8_t* src = srcRow;
                 for (int j = 0; j < m_width; ++j) {
-                    convertFunc(j, i);
+                    m_convertFunc(src, j, yBegin + i);
+                    src += m_srcStride;
                 }
+                srcRow += srcRowSize;
             }
         }
         
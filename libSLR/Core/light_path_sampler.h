@@ -15,6 +15,7 @@
 #include "surface_object.h"
 #include "medium_object.h"
 #include "../RNG/XORShiftRNG.h"
+#include "low_discrepancy_sequences.h"
 
 namespace SLR {
     struct SLR_API PixelPosition {
@@ -22,10 +23,30 @@ namespace SLR {
         PixelPosition(float xx, float yy) : x(xx), y(yy) { }
     };
     
+    enum class LightPathSamplerType {
+        Independent = 0,
+        Sobol,
+        Halton,
+    };
+    
     class SLR_API LightPathSampler {
     public:
         virtual ~LightPathSampler() { }
         
+        // JP: 各ピクセルサンプルの開始時に呼ばれる。低食い違い量サンプラーはここで次元を先頭に戻す。
+        // EN: called at the beginning of each pixel sample. Low-discrepancy samplers restart their dimensions here.
+        virtual void startPixelSample(uint32_t px, uint32_t py, uint32_t sampleIndex) { }
+        // JP: タイルの各パスの開始時に呼ばれ、疑似乱数の状態をtilePassSeed()で求めたシードで初期化し直す。
+        //     タイルを処理するスレッドは実行ごとに変わるので、列をスレッドではなくタイルとパスに結びつける。
+        // EN: called at the beginning of each pass over a tile, and reinitializes the PRNG state with a seed given by tilePassSeed().
+        //     The thread processing a tile changes from run to run, so the sequence is tied to the tile and the pass instead of the thread.
+        virtual void reseed(uint32_t seed) = 0;
+        
+        // JP: チェックポイントのために、ピクセルサンプルを跨いで保持される状態を読み書きする。
+        // EN: write / read the state kept across pixel samples for checkpoints.
+        virtual bool writeState(FILE* fp) const = 0;
+        virtual bool readState(FILE* fp) = 0;
+        
         virtual float getTimeSample(float timeBegin, float timeEnd) = 0;
         virtual PixelPosition getPixelPositionSample(uint32_t baseX, uint32_t baseY) = 0;
         virtual float getWavelengthSample() = 0;
@@ -42,6 +63,23 @@ namespace SLR {
         virtual EDFSample getEDFSample() = 0;
     };
     
+    
+    
+    // JP: 全スレッドで共通のシードとタイル、パスの番号を混ぜ合わせる。
+    // EN: mix the seed shared by all threads with the tile and pass indices.
+    inline uint32_t tilePassSeed(uint32_t seed, uint32_t tileIndex, uint32_t passIndex) {
+        auto mix = [](uint32_t x) {
+            x ^= x >> 16;
+            x *= 0x7feb352d;
+            x ^= x >> 15;
+            x *= 0x846ca68b;
+            return x ^ (x >> 16);
+        };
+        return mix(seed ^ mix(tileIndex ^ mix(passIndex + 0x9e3779b9)));
+    }
+    
+    
+    
     class SLR_API FreePathSampler {
         XORShiftRNG &m_rng;
     public:
@@ -52,13 +90,18 @@ namespace SLR {
     
     
     
-    class SLR_API IndependentLightPathSampler : public LightPathSampler {
+    class SLR_API IndependentLightPathSampler final : public LightPathSampler {
         XORShiftRNG m_rng;
         FreePathSampler m_freePathSampler;
     public:
         IndependentLightPathSampler() :m_rng() , m_freePathSampler(m_rng) { }
         IndependentLightPathSampler(uint32_t seed) : m_rng(seed), m_freePathSampler(m_rng) { }
         
+        void reseed(uint32_t seed) override { m_rng = XORShiftRNG(seed); }
+        
+        bool writeState(FILE* fp) const override { return m_rng.writeState(fp); }
+        bool readState(FILE* fp) override { return m_rng.readState(fp); }
+        
         float getTimeSample(float timeBegin, float timeEnd) override {
             float v = m_rng.getFloat0cTo1o();
             return timeBegin * (1 - v) + timeEnd * v;
@@ -77,6 +120,204 @@ namespace SLR {
         VolumetricLightPosSample getVolumetricLightPosSample() override { return VolumetricLightPosSample(m_rng.getFloat0cTo1o(), m_rng.getFloat0cTo1o(), m_rng.getFloat0cTo1o()); }
         EDFSample getEDFSample() override { return EDFSample(m_rng.getFloat0cTo1o(), m_rng.getFloat0cTo1o(), m_rng.getFloat0cTo1o()); }
     };
+    
+    
+    
+    // JP: 各サンプル種別に固定の次元を割り当てる低食い違い量サンプラーの基底クラス。
+    //     カメラに関する次元を先頭に置き、以降はバウンスごとに同じ配置の次元ブロックを割り当てる。
+    //     同じバウンス内で同じ種別が再度要求されたら次のブロックへ進むため、1サンプル内で次元が重複することはない。
+    //     自由行程サンプリングのように回数が不定のものは疑似乱数で補う。
+    // EN: base class of low-discrepancy samplers which assign fixed dimensions to each kind of sample.
+    //     Camera-related dimensions come first, followed by per-bounce dimension blocks with the same layout.
+    //     A request for a kind already used in the current bounce moves to the next block,
+    //     so no dimension is consumed twice within a pixel sample.
+    //     Samples with an unbounded count like free-path sampling are padded with the pseudo random number generator.
+    //     Derived classes provide sample1D() / sample2D() which are statically dispatched (CRTP).
+    template <typename Derived>
+    class LowDiscrepancyLightPathSampler : public LightPathSampler {
+        enum CameraDimension : uint32_t {
+            CameraDim_Time = 0,
+            CameraDim_PixelPosition = 1,
+            CameraDim_Wavelength = 3,
+            CameraDim_WLSelection = 4,
+            CameraDim_LensPosition = 5,
+            CameraDim_IDF = 7,
+            NumCameraDimensions = 9,
+        };
+        enum BounceDimension : uint32_t {
+            BounceDim_LightSelection = 0,
+            BounceDim_PathTermination = 1,
+            BounceDim_LightPosition = 2,
+            BounceDim_Direction = 5,
+            BounceDim_Component = 7,
+            NumBounceDimensions = 8,
+        };
+        enum BounceSlot : uint32_t {
+            BounceSlot_LightSelection = 1 << 0,
+            BounceSlot_PathTermination = 1 << 1,
+            BounceSlot_LightPosition = 1 << 2,
+            BounceSlot_Direction = 1 << 3,
+        };
+        
+        uint32_t m_bounceBaseDim;
+        uint32_t m_usedSlots;
+        
+        uint32_t bounceDimension(BounceSlot slot, uint32_t offset) {
+            if (m_usedSlots & slot) {
+                m_bounceBaseDim += NumBounceDimensions;
+                m_usedSlots = 0;
+            }
+            m_usedSlots |= slot;
+            return m_bounceBaseDim + offset;
+        }
+    protected:
+        XORShiftRNG m_rng;
+        FreePathSampler m_freePathSampler;
+        uint32_t m_scrambleSeed;
+        uint32_t m_px, m_py;
+        uint32_t m_sampleIndex;
+        
+        float sample1D(uint32_t dim) {
+            return static_cast<Derived*>(this)->generate1D(dim);
+        }
+        void sample2D(uint32_t dim, float* u0, float* u1) {
+            static_cast<Derived*>(this)->generate2D(dim, u0, u1);
+        }
+    public:
+        LowDiscrepancyLightPathSampler(uint32_t scrambleSeed, uint32_t rngSeed) :
+        m_bounceBaseDim(NumCameraDimensions), m_usedSlots(0),
+        m_rng(rngSeed), m_freePathSampler(m_rng), m_scrambleSeed(scrambleSeed), m_px(0), m_py(0), m_sampleIndex(0) { }
+        
+        void startPixelSample(uint32_t px, uint32_t py, uint32_t sampleIndex) override {
+            m_px = px;
+            m_py = py;
+            m_sampleIndex = sampleIndex;
+            m_bounceBaseDim = NumCameraDimensions;
+            m_usedSlots = 0;
+        }
+        void reseed(uint32_t seed) override { m_rng = XORShiftRNG(seed); }
+        
+        // JP: 次元の位置はピクセルサンプルごとに初期化されるため、疑似乱数の状態のみを保存すれば良い。
+        // EN: only the PRNG state needs to be saved since the dimension position is reset for each pixel sample.
+        bool writeState(FILE* fp) const override { return m_rng.writeState(fp); }
+        bool readState(FILE* fp) override { return m_rng.readState(fp); }
+        
+        float getTimeSample(float timeBegin, float timeEnd) override {
+            float v = sample1D(CameraDim_Time);
+            return timeBegin * (1 - v) + timeEnd * v;
+        }
+        PixelPosition getPixelPositionSample(uint32_t baseX, uint32_t baseY) override {
+            float u0, u1;
+            sample2D(CameraDim_PixelPosition, &u0, &u1);
+            return PixelPosition(baseX + u0, baseY + u1);
+        }
+        float getWavelengthSample() override { return sample1D(CameraDim_Wavelength); }
+        float getWLSelectionSample() override { return sample1D(CameraDim_WLSelection); }
+        LensPosSample getLensPosSample() override {
+            float u0, u1;
+            sample2D(CameraDim_LensPosition, &u0, &u1);
+            return LensPosSample(u0, u1);
+        }
+        IDFSample getIDFSample() override {
+            float u0, u1;
+            sample2D(CameraDim_IDF, &u0, &u1);
+            return IDFSample(u0, u1);
+        }
+        BSDFSample getBSDFSample() override {
+            uint32_t dim = bounceDimension(BounceSlot_Direction, BounceDim_Direction);
+            float u0, u1;
+            sample2D(dim, &u0, &u1);
+            return BSDFSample(sample1D(dim - BounceDim_Direction + BounceDim_Component), u0, u1);
+        }
+        PFSample getPFSample() override {
+            uint32_t dim = bounceDimension(BounceSlot_Direction, BounceDim_Direction);
+            float u0, u1;
+            sample2D(dim, &u0, &u1);
+            return PFSample(u0, u1);
+        }
+        FreePathSampler &getFreePathSampler() override { return m_freePathSampler; }
+        float getPathTerminationSample() override { return sample1D(bounceDimension(BounceSlot_PathTermination, BounceDim_PathTermination)); }
+        float getLightSelectionSample() override { return sample1D(bounceDimension(BounceSlot_LightSelection, BounceDim_LightSelection)); }
+        SurfaceLightPosSample getSurfaceLightPosSample() override {
+            uint32_t dim = bounceDimension(BounceSlot_LightPosition, BounceDim_LightPosition);
+            float u0, u1;
+            sample2D(dim, &u0, &u1);
+            return SurfaceLightPosSample(u0, u1);
+        }
+        VolumetricLightPosSample getVolumetricLightPosSample() override {
+            uint32_t dim = bounceDimension(BounceSlot_LightPosition, BounceDim_LightPosition);
+            float u0, u1;
+            sample2D(dim, &u0, &u1);
+            return VolumetricLightPosSample(u0, u1, sample1D(dim + 2));
+        }
+        EDFSample getEDFSample() override {
+            uint32_t dim = bounceDimension(BounceSlot_Direction, BounceDim_Direction);
+            float u0, u1;
+            sample2D(dim, &u0, &u1);
+            return EDFSample(sample1D(dim - BounceDim_Direction + BounceDim_Component), u0, u1);
+        }
+    };
+    
+    
+    
+    // JP: Owenスクランブルを施したSobol列の最初の2次元を次元ごとに独立にシャッフルして用いるサンプラー。
+    //     各次元・各ピクセルでスクランブルのシードが異なるため、次元数に上限が無い。
+    //     2次元の組は(0, 2)列となり、PMJ02と同等の層化特性を持つ。
+    // EN: sampler using the first two dimensions of Owen-scrambled Sobol sequence
+    //     with an independent index shuffle per dimension (padding).
+    //     Scrambling seeds differ for each dimension and pixel, so there is no upper limit of the number of dimensions.
+    //     Each 2D pair forms a (0, 2)-sequence which has the same stratification properties as PMJ02.
+    class SLR_API SobolLightPathSampler final : public LowDiscrepancyLightPathSampler<SobolLightPathSampler> {
+        friend class LowDiscrepancyLightPathSampler<SobolLightPathSampler>;
+        
+        float generate1D(uint32_t dim) {
+            uint32_t hash = hashPixelDimension(m_px, m_py, dim, m_scrambleSeed);
+            uint32_t index = nestedUniformScramble(m_sampleIndex, hash);
+            return uintToFloat0cTo1o(nestedUniformScramble(sobolDimension0(index), (uint32_t)mixBits(hash)));
+        }
+        void generate2D(uint32_t dim, float* u0, float* u1) {
+            uint32_t hash = hashPixelDimension(m_px, m_py, dim, m_scrambleSeed);
+            uint32_t index = nestedUniformScramble(m_sampleIndex, hash);
+            uint64_t seeds = mixBits(hash);
+            *u0 = uintToFloat0cTo1o(nestedUniformScramble(sobolDimension0(index), (uint32_t)seeds));
+            *u1 = uintToFloat0cTo1o(nestedUniformScramble(sobolDimension1(index), (uint32_t)(seeds >> 32)));
+        }
+    public:
+        SobolLightPathSampler(uint32_t scrambleSeed, uint32_t rngSeed) : LowDiscrepancyLightPathSampler<SobolLightPathSampler>(scrambleSeed, rngSeed) { }
+    };
+    
+    
+    
+    // JP: 桁ごとのランダム順列でスクランブルしたHalton列を用いるサンプラー。順列はピクセルごとに異なる。
+    //     素数表(64次元)を超える次元は疑似乱数で補う。カメラの9次元に続きバウンスごとに8次元を用いるため、
+    //     低食い違い量列が及ぶのは6バウンス目までで、それ以降は独立サンプラーと同じ収束になる。
+    // EN: sampler using Halton sequence scrambled by random digit permutations which differ for each pixel.
+    //     Dimensions beyond the prime table (64 dimensions) are padded with the pseudo random number generator.
+    //     With 9 camera dimensions followed by 8 dimensions per bounce, the low-discrepancy sequence covers
+    //     up to the 6th bounce and deeper bounces converge like the independent sampler.
+    class SLR_API HaltonLightPathSampler final : public LowDiscrepancyLightPathSampler<HaltonLightPathSampler> {
+        friend class LowDiscrepancyLightPathSampler<HaltonLightPathSampler>;
+        
+        float generate1D(uint32_t dim) {
+            if (dim >= NumHaltonPrimes)
+                return m_rng.getFloat0cTo1o();
+            return scrambledRadicalInverse(HaltonPrimes[dim], m_sampleIndex, hashPixelDimension(m_px, m_py, dim, m_scrambleSeed));
+        }
+        void generate2D(uint32_t dim, float* u0, float* u1) {
+            *u0 = generate1D(dim);
+            *u1 = generate1D(dim + 1);
+        }
+    public:
+        HaltonLightPathSampler(uint32_t scrambleSeed, uint32_t rngSeed) : LowDiscrepancyLightPathSampler<HaltonLightPathSampler>(scrambleSeed, rngSeed) { }
+    };
+    
+    
+    
+    // JP: スクランブルのシードは全スレッドで共通にする必要がある。
+    //     ピクセルごとの列はどのスレッドが処理しても同じでなければならないため。
+    // EN: The scramble seed must be shared by all threads
+    //     because the sequence for a pixel must be the same regardless of which thread processes it.
+    SLR_API LightPathSampler* createLightPathSampler(LightPathSamplerType type, uint32_t scrambleSeed, uint32_t rngSeed);
 }
 
 #endif /* __SLR_light_path_sampler__ */
@@ -0,0 +1,138 @@
+//
+//  low_discrepancy_sequences.h
+//
+//  Created by 渡部 心 on 2017/06/10.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#ifndef __SLR_low_discrepancy_sequences__
+#define __SLR_low_discrepancy_sequences__
+
+#include "../defines.h"
+#include "../declarations.h"
+
+namespace SLR {
+    // 0x1.fffffep-1: the largest float less than 1.
+    const float OneMinusEpsilonFloat = 0.99999994f;
+
+    inline float uintToFloat0cTo1o(uint32_t v) {
+        return std::min(v * 2.3283064365386963e-10f, OneMinusEpsilonFloat); // 2^-32
+    }
+
+    inline uint32_t reverseBits(uint32_t v) {
+        v = ((v >> 1) & 0x55555555) | ((v & 0x55555555) << 1);
+        v = ((v >> 2) & 0x33333333) | ((v & 0x33333333) << 2);
+        v = ((v >> 4) & 0x0F0F0F0F) | ((v & 0x0F0F0F0F) << 4);
+        v = ((v >> 8) & 0x00FF00FF) | ((v & 0x00FF00FF) << 8);
+        return (v >> 16) | (v << 16);
+    }
+
+    // 64-bit finalizer used to derive independent seeds from (pixel, dimension, seed) tuples.
+    inline uint64_t mixBits(uint64_t v) {
+        v ^= (v >> 31);
+        v *= 0x7fb5d329728ea185ULL;
+        v ^= (v >> 27);
+        v *= 0x81dadef4bc2dd44dULL;
+        v ^= (v >> 33);
+        return v;
+    }
+
+    inline uint32_t hashPixelDimension(uint32_t px, uint32_t py, uint32_t dim, uint32_t seed) {
+        uint64_t h = mixBits(((uint64_t)px << 32) | py);
+        h = mixBits(h ^ (((uint64_t)seed << 32) | dim));
+        return (uint32_t)h;
+    }
+
+    // JP: Laine-Karrasによる基数2のネストされた一様スクランブル(Owenスクランブル)のハッシュベース実装。
+    // EN: hash-based base-2 nested uniform (Owen) scrambling of Laine & Karras with the constants by Burley.
+    //     "Practical Hash-based Owen Scrambling", Burley 2020
+    inline uint32_t laineKarrasPermutation(uint32_t v, uint32_t seed) {
+        v += seed;
+        v ^= v * 0x6c50b47c;
+        v ^= v * 0xb82f1e52;
+        v ^= v * 0xc7afe638;
+        v ^= v * 0x8d22f6e6;
+        return v;
+    }
+
+    inline uint32_t nestedUniformScramble(uint32_t v, uint32_t seed) {
+        return reverseBits(laineKarrasPermutation(reverseBits(v), seed));
+    }
+
+    // JP: Sobol列の最初の2次元。1次元目はvan der Corput列、2次元目は原始多項式x + 1から生成される。
+    // EN: The first two dimensions of the Sobol sequence.
+    //     The first is the van der Corput sequence and the second is generated from the primitive polynomial x + 1.
+    inline uint32_t sobolDimension0(uint32_t index) {
+        return reverseBits(index);
+    }
+
+    inline uint32_t sobolDimension1(uint32_t index) {
+        uint32_t v = 1u << 31;
+        uint32_t ret = 0;
+        for (; index; index >>= 1, v ^= v >> 1) {
+            if (index & 1)
+                ret ^= v;
+        }
+        return ret;
+    }
+
+    // JP: 長さlの順列のi番目の要素をシードpから計算する。
+    // EN: returns the i-th element of a pseudo-random permutation of length l determined by a seed p.
+    //     "Correlated Multi-Jittered Sampling", Kensler 2013
+    inline uint32_t permutationElement(uint32_t i, uint32_t l, uint32_t p) {
+        uint32_t w = l - 1;
+        w |= w >> 1;
+        w |= w >> 2;
+        w |= w >> 4;
+        w |= w >> 8;
+        w |= w >> 16;
+        do {
+            i ^= p;
+            i *= 0xe170893d;
+            i ^= p >> 16;
+            i ^= (i & w) >> 4;
+            i ^= p >> 8;
+            i *= 0x0929eb3f;
+            i ^= p >> 23;
+            i ^= (i & w) >> 1;
+            i *= 1 | p >> 27;
+            i *= 0x6935fa69;
+            i ^= (i & w) >> 11;
+            i *= 0x74dcb303;
+            i ^= (i & w) >> 2;
+            i *= 0x9e501cc3;
+            i ^= (i & w) >> 2;
+            i *= 0xc860a3df;
+            i &= w;
+            i ^= i >> 5;
+        } while (i >= l);
+        return (i + p) % l;
+    }
+
+    const uint32_t NumHaltonPrimes = 64;
+    extern SLR_API const uint32_t HaltonPrimes[NumHaltonPrimes];
+
+    // JP: 各桁に独立なランダム順列を適用した基数baseの根基逆関数。
+    //     有効桁が尽きるまで上位の0の桁も順列を通すことで端数まで一様になる。
+    // EN: radical inverse in a given base with an independent random permutation applied to each digit.
+    //     Trailing zero digits are also permuted until the float precision is exhausted.
+    inline float scrambledRadicalInverse(uint32_t base, uint64_t index, uint32_t seed) {
+        const float invBase = 1.0f / base;
+        float invBaseM = 1.0f;
+        uint64_t reversedDigits = 0;
+        uint32_t digitIndex = 0;
+        while (1.0f - (base - 1) * invBaseM < 1.0f) {
+            uint64_t next = index / base;
+            uint32_t digitValue = uint32_t(index - next * base);
+            uint32_t digitSeed = (uint32_t)mixBits(((uint64_t)seed << 32) | digitIndex);
+            digitValue = permutationElement(digitValue, base, digitSeed);
+            reversedDigits = reversedDigits * base + digitValue;
+            invBaseM *= invBase;
+            ++digitIndex;
+            index = next;
+        }
+        return std::min(invBaseM * reversedDigits, OneMinusEpsilonFloat);
+    }
+}
+
+#endif /* __SLR_low_discrepancy_sequences__ */
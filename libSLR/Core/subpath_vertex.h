@@ -0,0 +1,156 @@
+//
+//  subpath_vertex.h
+//
+//  Created by 渡部 心 on 2017/06/20.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#ifndef __SLR_subpath_vertex__
+#define __SLR_subpath_vertex__
+
+#include "../defines.h"
+#include "../declarations.h"
+#include "geometry.h"
+#include "directional_distribution_functions.h"
+
+namespace SLR {
+    // JP: 双方向手法のサブパスの頂点のうち、接続に必要な幾何情報と方向分布関数。
+    //     方向分布関数は種類をタグとして持つ共用体で表し、仮想関数を介さずに評価する。
+    // EN: geometric information and a directional distribution function of a subpath vertex required for connections in bidirectional methods.
+    //     The directional distribution function is represented as a tagged union and evaluated without virtual calls.
+    struct SubPathVertex {
+        enum class DDFType : uint8_t {
+            BSDF = 0,
+            EDF,
+            IDF,
+        };
+        
+        Point3D position;
+        ReferenceFrame shadingFrame;
+        Normal3D gNormal;
+        // JP: BSDFの評価に用いる、シェーディング座標系での出射方向と幾何法線。
+        // EN: outgoing direction and geometric normal in the shading frame used to evaluate the BSDF.
+        Vector3D dirOut_sn;
+        Normal3D gNormal_sn;
+        union {
+            const BSDF* bsdf;
+            const EDF* edf;
+            const IDF* idf;
+        };
+        DDFType ddfType;
+        bool atInfinity;
+        bool adjoint;
+        
+        SubPathVertex(const SurfacePoint &surfPt, DDFType _ddfType) :
+        position(surfPt.getPosition()), shadingFrame(surfPt.getShadingFrame()), gNormal(surfPt.getGeometricNormal()),
+        ddfType(_ddfType), atInfinity(surfPt.atInfinity()), adjoint(false) {}
+        SubPathVertex(const SurfacePoint &surfPt, const BSDF* _bsdf, const BSDFQuery &query) :
+        SubPathVertex(surfPt, DDFType::BSDF) {
+            bsdf = _bsdf;
+            dirOut_sn = query.dirLocal;
+            gNormal_sn = query.gNormalLocal;
+            adjoint = query.adjoint;
+        }
+        SubPathVertex(const SurfacePoint &surfPt, const EDF* _edf) :
+        SubPathVertex(surfPt, DDFType::EDF) {
+            edf = _edf;
+        }
+        SubPathVertex(const SurfacePoint &surfPt, const IDF* _idf) :
+        SubPathVertex(surfPt, DDFType::IDF) {
+            idf = _idf;
+        }
+        
+        Vector3D getDirectionFrom(const Point3D &shadingPoint, float* dist2) const {
+            if (atInfinity) {
+                *dist2 = 1.0f;
+                return normalize(position - Point3D::Zero);
+            }
+            else {
+                Vector3D ret(position - shadingPoint);
+                *dist2 = ret.sqLength();
+                return ret / std::sqrt(*dist2);
+            }
+        }
+        Vector3D toLocal(const Vector3D &vecWorld) const { return shadingFrame.toLocal(vecWorld); }
+        Vector3D fromLocal(const Vector3D &vecLocal) const { return shadingFrame.fromLocal(vecLocal); }
+        float calcCosTerm(const Vector3D &vecWorld) const { return absDot(vecWorld, gNormal); }
+        
+        // JP: EDF, IDFは逆方向の値を持たないため、revValには0を返す。
+        // EN: EDF and IDF have no reverse values, so revVal is set to 0.
+        SampledSpectrum evaluateDDF(const Vector3D &dir_sn, int16_t wlHint, SampledSpectrum* revVal) const {
+            switch (ddfType) {
+                case DDFType::BSDF:
+                    return bsdf->evaluate(BSDFQuery(dirOut_sn, gNormal_sn, wlHint, DirectionType::All, true, adjoint), dir_sn, revVal);
+                case DDFType::EDF:
+                    *revVal = SampledSpectrum::Zero;
+                    return edf->evaluate(EDFQuery(), dir_sn);
+                case DDFType::IDF:
+                    *revVal = SampledSpectrum::Zero;
+                    return idf->evaluate(dir_sn);
+                default:
+                    SLRAssert_ShouldNotBeCalled();
+                    return SampledSpectrum::Zero;
+            }
+        }
+        float evaluateDDFPDF(const Vector3D &dir_sn, int16_t wlHint, float* revVal) const {
+            switch (ddfType) {
+                case DDFType::BSDF:
+                    return bsdf->evaluatePDF(BSDFQuery(dirOut_sn, gNormal_sn, wlHint, DirectionType::All, true, adjoint), dir_sn, revVal);
+                case DDFType::EDF:
+                    *revVal = 0.0f;
+                    return edf->evaluatePDF(EDFQuery(), dir_sn);
+                case DDFType::IDF:
+                    *revVal = 0.0f;
+                    return idf->evaluatePDF(dir_sn);
+                default:
+                    SLRAssert_ShouldNotBeCalled();
+                    return 0.0f;
+            }
+        }
+    };
+    
+    
+    
+    // JP: タイルやパスを跨いで再利用するサブパスの頂点配列。容量が足りない場合のみキャッシュライン境界に揃えた領域を確保し直す。
+    // EN: subpath vertex array reused across tiles and passes. It reallocates a cache-line-aligned area only when the capacity is insufficient.
+    template <typename VertexType>
+    class SubPath {
+        VertexType* m_vertices;
+        uint32_t m_numVertices;
+        uint32_t m_capacity;
+        
+        void reserve(uint32_t capacity) {
+            VertexType* vertices = (VertexType*)SLR_memalign(sizeof(VertexType) * capacity, SLR_L1_Cacheline_Size);
+            std::uninitialized_copy(m_vertices, m_vertices + m_numVertices, vertices);
+            if (m_vertices)
+                SLR_freealign(m_vertices);
+            m_vertices = vertices;
+            m_capacity = capacity;
+        }
+    public:
+        SubPath() : m_vertices(nullptr), m_numVertices(0), m_capacity(0) {
+            reserve(32);
+        }
+        ~SubPath() {
+            SLR_freealign(m_vertices);
+        }
+        SubPath(const SubPath &) = delete;
+        SubPath &operator=(const SubPath &) = delete;
+        
+        uint32_t size() const { return m_numVertices; }
+        void clear() { m_numVertices = 0; }
+        VertexType &operator[](uint32_t idx) { return m_vertices[idx]; }
+        const VertexType &operator[](uint32_t idx) const { return m_vertices[idx]; }
+        VertexType &back() { return m_vertices[m_numVertices - 1]; }
+        const VertexType &back() const { return m_vertices[m_numVertices - 1]; }
+        void pop_back() { --m_numVertices; }
+        template <typename ...ArgTypes>
+        void emplace_back(ArgTypes&&... args) {
+            if (m_numVertices == m_capacity)
+                reserve(2 * m_capacity);
+            new (m_vertices + m_numVertices++) VertexType(std::forward<ArgTypes>(args)...);
+        }
+    };
+}
+
+#endif /* __SLR_subpath_vertex__ */
@@ -16,10 +16,12 @@
 #include "../Accelerator/StandardBVH.h"
 #include "../Accelerator/SBVH.h"
 #include "../Accelerator/QBVH.h"
+#include "BVHCache.h"
 #include "../SurfaceShape/InfiniteSphereSurfaceShape.h"
 #include "../BSDF/basic_bsdfs.h"
 #include "../SurfaceMaterial/IBLEmitterSurfaceProperty.h"
 #include "../Scene/Scene.h"
+#include "../Helper/ThreadPool.h"
 
 namespace SLR {
     SampledSpectrum SurfaceLight::sample(const LightPosQuery &query, const SurfaceLightPosSample &smp, SurfaceLightPosQueryResult* result) const {
@@ -59,6 +61,25 @@ namespace SLR {
         return !intersect(ray, segment, &si);
     }
     
+    uint64_t SurfaceObject::geometryHash() const {
+        BoundingBox3D bb = bounds();
+        float values[] = {bb.minP.x, bb.minP.y, bb.minP.z, bb.maxP.x, bb.maxP.y, bb.maxP.z, costForIntersect()};
+        return hashFNV1a64(values, sizeof(values));
+    }
+    
+    uint32_t SurfaceObject::intersectPacket(const Ray* rays, RaySegment* segments, SurfaceInteraction* sis, uint32_t activeMask) const {
+        uint32_t hitMask = 0;
+        for (uint32_t i = 0; i < 32 && (activeMask >> i) != 0; ++i) {
+            if (((activeMask >> i) & 0x1) == 0)
+                continue;
+            if (intersect(rays[i], segments[i], &sis[i])) {
+                segments[i].distMax = sis[i].getDistance();
+                hitMask |= 1u << i;
+            }
+        }
+        return hitMask;
+    }
+    
     
     
     bool SingleSurfaceObject::isEmitting() const {
@@ -346,13 +367,37 @@ namespace SLR {
         return true;
     }
     
+    uint32_t TransformedSurfaceObject::intersectPacket(const Ray* rays, RaySegment* segments, SurfaceInteraction* sis, uint32_t activeMask) const {
+        // JP: 光線ごとに時刻が異なりうるので、変換は光線ごとにサンプルする。
+        // EN: rays can have different times, so the transform is sampled per ray.
+        Ray localRays[32];
+        StaticTransform sampledTFs[32];
+        for (uint32_t i = 0; i < 32 && (activeMask >> i) != 0; ++i) {
+            if (((activeMask >> i) & 0x1) == 0)
+                continue;
+            m_transform->sample(rays[i].time, &sampledTFs[i]);
+            localRays[i] = invert(sampledTFs[i]) * rays[i];
+        }
+        uint32_t hitMask = m_surfObj->intersectPacket(localRays, segments, sis, activeMask);
+        for (uint32_t i = 0; i < 32 && (hitMask >> i) != 0; ++i) {
+            if (((hitMask >> i) & 0x1) != 0)
+                sis[i].applyTransformFromLeft(sampledTFs[i]);
+        }
+        return hitMask;
+    }
+    
     
     
     SurfaceObjectAggregate::SurfaceObjectAggregate(std::vector<SurfaceObject*> &objs) {
-//        SBVH sbvh(objs);
-//        m_accelerator = new QBVH(sbvh);
-        m_accelerator = new SBVH(objs);
+        // JP: QBVHは光線の束による走査に対応する。
+        // EN: QBVH supports traversal with packets of rays.
+        // JP: BVHキャッシュが有効な場合は、同じ幾何に対して以前に構築したSBVHを読み込む。
+        // EN: load an SBVH previously built for the same geometry if the BVH cache is enabled.
+        std::unique_ptr<SBVH> sbvh(BVHCache::buildSBVH(objs));
+        m_accelerator = new QBVH(*sbvh);
+//        m_accelerator = new SBVH(objs);
 //        m_accelerator = new StandardBVH(objs, StandardBVH::Partitioning::BinnedSAH);
+        m_objs.assign(objs.begin(), objs.end());
         
         std::vector<uint32_t> lightIndices;
         std::vector<float> lightImportances;
@@ -450,4 +495,114 @@ namespace SLR {
 #endif
         return true;
     }
+    
+    uint32_t SurfaceObjectAggregate::intersectPacket(const Ray* rays, RaySegment* segments, SurfaceInteraction* sis, uint32_t activeMask) const {
+        uint32_t objIndices[32];
+        uint32_t hitMask = m_accelerator->intersectPacket(rays, segments, sis, objIndices, activeMask);
+        for (uint32_t i = 0; i < 32 && (hitMask >> i) != 0; ++i) {
+            if (((hitMask >> i) & 0x1) == 0)
+                continue;
+            if (m_objToLightMap.count(objIndices[i]) > 0) {
+                uint32_t lightIdx = m_objToLightMap.at(objIndices[i]);
+                sis[i].setLightProb(m_lightDist1D->evaluatePMF(lightIdx) * sis[i].getLightProb());
+            }
+        }
+        return hitMask;
+    }
+    
+    // JP: 空間分割により同じ物体が複数の葉に現れることがある。
+    //     物体のアドレスで整列した番号の表を二分探索して対応を求める。
+    // EN: the same object can appear in multiple leaves due to spatial splits.
+    //     Find the mapping by binary search in a table of indices sorted by object address.
+    void SurfaceObjectAggregate::buildLeafObjectIndices() const {
+        std::vector<std::pair<const SurfaceObject*, uint32_t>> objIndices(m_objs.size());
+        for (int i = 0; i < m_objs.size(); ++i)
+            objIndices[i] = std::make_pair(m_objs[i], (uint32_t)i);
+        std::sort(objIndices.begin(), objIndices.end());
+        const std::vector<const SurfaceObject*> &leafObjs = m_accelerator->leafObjects();
+        m_leafObjIndices.resize(leafObjs.size());
+        for (int i = 0; i < leafObjs.size(); ++i) {
+            auto it = std::lower_bound(objIndices.begin(), objIndices.end(), std::make_pair(leafObjs[i], 0u));
+            SLRAssert(it != objIndices.end() && it->first == leafObjs[i], "Leaf object is not found in the given objects.");
+            m_leafObjIndices[i] = it->second;
+        }
+    }
+    
+    void SurfaceObjectAggregate::intersectBatch(const RayBatch &rays, const RayBatchHits &hits, uint32_t numThreads) const {
+        const uint32_t PacketSize = 32;
+        const uint32_t NumRaysPerJob = 1024;
+        
+        std::call_once(m_leafObjIndicesFlag, &SurfaceObjectAggregate::buildLeafObjectIndices, this);
+        
+        auto intersectRange = [&](uint32_t rayBegin, uint32_t rayEnd) {
+            // JP: 範囲内の光線を方向の象限ごとに並べ替え、束の中の光線が同じ順番で子を辿るようにする。
+            // EN: sort rays in the range by direction octant so that rays in a packet visit children in the same order.
+            uint32_t numOctantRays[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+            uint8_t octants[NumRaysPerJob];
+            for (uint32_t i = rayBegin; i < rayEnd; ++i) {
+                uint8_t octant = (rays.dirX[i] < 0) | ((rays.dirY[i] < 0) << 1) | ((rays.dirZ[i] < 0) << 2);
+                octants[i - rayBegin] = octant;
+                ++numOctantRays[octant];
+            }
+            uint32_t octantOffsets[8];
+            uint32_t offset = 0;
+            for (int o = 0; o < 8; ++o) {
+                octantOffsets[o] = offset;
+                offset += numOctantRays[o];
+            }
+            uint32_t rayIndices[NumRaysPerJob];
+            for (uint32_t i = rayBegin; i < rayEnd; ++i)
+                rayIndices[octantOffsets[octants[i - rayBegin]]++] = i;
+            
+            Ray packetRays[PacketSize];
+            RaySegment segments[PacketSize];
+            SurfaceInteraction sis[PacketSize];
+            uint32_t closestIndices[PacketSize];
+            uint32_t numRangeRays = rayEnd - rayBegin;
+            for (uint32_t base = 0; base < numRangeRays; base += PacketSize) {
+                uint32_t numPacketRays = std::min(numRangeRays - base, PacketSize);
+                for (uint32_t i = 0; i < numPacketRays; ++i) {
+                    uint32_t rayIdx = rayIndices[base + i];
+                    packetRays[i] = Ray(Point3D(rays.orgX[rayIdx], rays.orgY[rayIdx], rays.orgZ[rayIdx]),
+                                        Vector3D(rays.dirX[rayIdx], rays.dirY[rayIdx], rays.dirZ[rayIdx]), rays.time);
+                    segments[i] = RaySegment(0.0f, rays.distMax ? rays.distMax[rayIdx] : INFINITY);
+                    sis[i] = SurfaceInteraction();
+                }
+                uint32_t activeMask = numPacketRays == PacketSize ? 0xFFFFFFFF : ((1u << numPacketRays) - 1);
+                uint32_t hitMask = m_accelerator->intersectPacket(packetRays, segments, sis, closestIndices, activeMask);
+                for (uint32_t i = 0; i < numPacketRays; ++i) {
+                    uint32_t rayIdx = rayIndices[base + i];
+                    bool hit = ((hitMask >> i) & 0x1) != 0;
+                    if (hits.dist)
+                        hits.dist[rayIdx] = hit ? sis[i].getDistance() : INFINITY;
+                    if (hits.primIDs)
+                        hits.primIDs[rayIdx] = hit ? m_leafObjIndices[closestIndices[i]] : UINT32_MAX;
+                    if (hits.normalX) {
+                        const Normal3D &n = sis[i].getGeometricNormal();
+                        hits.normalX[rayIdx] = hit ? n.x : 0.0f;
+                        hits.normalY[rayIdx] = hit ? n.y : 0.0f;
+                        hits.normalZ[rayIdx] = hit ? n.z : 0.0f;
+                    }
+                }
+            }
+        };
+        
+        uint32_t numJobs = (rays.numRays + NumRaysPerJob - 1) / NumRaysPerJob;
+        if (numThreads == 0)
+            numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+        numThreads = std::min(numThreads, numJobs);
+        if (numThreads <= 1) {
+            for (uint32_t i = 0; i < numJobs; ++i)
+                intersectRange(i * NumRaysPerJob, std::min((i + 1) * NumRaysPerJob, rays.numRays));
+            return;
+        }
+        
+        ThreadPool threadPool(numThreads);
+        for (uint32_t i = 0; i < numJobs; ++i) {
+            uint32_t rayBegin = i * NumRaysPerJob;
+            uint32_t rayEnd = std::min(rayBegin + NumRaysPerJob, rays.numRays);
+            threadPool.enqueue([&intersectRange, rayBegin, rayEnd](uint32_t threadID) { intersectRange(rayBegin, rayEnd); });
+        }
+        threadPool.wait();
+    }
 }
@@ -11,6 +11,7 @@
 #include "../defines.h"
 #include "../declarations.h"
 #include "object.h"
+#include <mutex>
 
 namespace SLR {
     struct SLR_API SurfaceLightPosSample {
@@ -75,8 +76,16 @@ namespace SLR {
         }
         
         virtual float costForIntersect() const = 0;
+        // JP: 加速構造の構築が依存する幾何を表すハッシュ。既定の実装は境界とコストから計算する。
+        // EN: hash representing the geometry which accelerator construction depends on. The default implementation calculates it from the bounds and the cost.
+        virtual uint64_t geometryHash() const;
         virtual bool contains(const Point3D &p, float time) const { return false; }
         virtual bool intersect(const Ray &ray, const RaySegment &segment, SurfaceInteraction* si) const = 0;
+        // JP: 最大32本の光線の束をまとめて交差判定する。activeMaskのビットが立った光線のみを判定し、交差した光線のビットを返す。
+        //     交差した光線のsegmentsの最大距離は交点までの距離に更新される。既定の実装は1本ずつ判定する。
+        // EN: intersect a packet of up to 32 rays at once. Only rays whose bits are set in activeMask are tested, and the bits of rays which hit something are returned.
+        //     The maximum distances of segments of the hit rays are updated to the distances to the intersections. The default implementation tests rays one by one.
+        virtual uint32_t intersectPacket(const Ray* rays, RaySegment* segments, SurfaceInteraction* sis, uint32_t activeMask) const;
         virtual void calculateSurfacePoint(const SurfaceInteraction &si, SurfacePoint* surfPt) const {
             SLRAssert_ShouldNotBeCalled();
         }
@@ -95,6 +104,8 @@ namespace SLR {
         SingleSurfaceObject(const SurfaceShape* surf, const SurfaceMaterial* mat) : m_surface(surf), m_material(mat) { }
         virtual ~SingleSurfaceObject() { }
         
+        const SurfaceMaterial* getMaterial() const { return m_material; }
+        
         virtual BSDF* createBSDF(const SurfacePoint &surfPt, const WavelengthSamples &wls, ArenaAllocator &mem) const;
         
         virtual float evaluateAreaPDF(const SurfacePoint& surfPt) const;
@@ -132,6 +143,7 @@ namespace SLR {
                        EDFQueryResult* edfResult, SampledSpectrum* Le1, Ray* ray, float* epsilon) const override;
         
         float costForIntersect() const override { return m_surface->costForIntersect(); }
+        uint64_t geometryHash() const override { return m_surface->geometryHash(); }
         bool intersect(const Ray &ray, const RaySegment &segment, SurfaceInteraction* si) const override;
         void calculateSurfacePoint(const SurfaceInteraction &si, SurfacePoint* surfPt) const override;
         
@@ -223,6 +235,7 @@ namespace SLR {
         float costForIntersect() const override { return m_surfObj->costForIntersect(); }
         bool contains(const Point3D &p, float time) const override;
         bool intersect(const Ray &ray, const RaySegment &segment, SurfaceInteraction* si) const override;
+        uint32_t intersectPacket(const Ray* rays, RaySegment* segments, SurfaceInteraction* sis, uint32_t activeMask) const override;
         
         // END: SurfaceObject's methods
         // ----------------------------------------------------------------
@@ -230,8 +243,51 @@ namespace SLR {
     
     
     
+    // JP: まとめて交差判定する光線の列。属性ごとの配列(SoA)で与える。
+    //     distMaxがnullptrの場合は無限遠まで判定する。方向が正規化されていれば距離はワールド空間の長さになる。
+    // EN: a sequence of rays to be intersected together, given as arrays per attribute (SoA).
+    //     Rays are tested to infinity if distMax is nullptr. Distances are lengths in world space if the directions are normalized.
+    struct SLR_API RayBatch {
+        const float* orgX;
+        const float* orgY;
+        const float* orgZ;
+        const float* dirX;
+        const float* dirY;
+        const float* dirZ;
+        const float* distMax;
+        float time;
+        uint32_t numRays;
+        
+        RayBatch() : orgX(nullptr), orgY(nullptr), orgZ(nullptr), dirX(nullptr), dirY(nullptr), dirZ(nullptr), distMax(nullptr), time(0.0f), numRays(0) { }
+    };
+    
+    // JP: 光線ごとの交差判定の結果を書き込む配列。交差しなかった光線の距離はINFINITY、プリミティブ番号はUINT32_MAXになる。
+    //     法線は幾何法線で、不要であればnullptrにできる。
+    // EN: arrays to which per-ray intersection results are written. Rays without intersection get INFINITY as the distance and UINT32_MAX as the primitive ID.
+    //     Normals are geometric normals and can be nullptr if unnecessary.
+    struct SLR_API RayBatchHits {
+        float* dist;
+        uint32_t* primIDs;
+        float* normalX;
+        float* normalY;
+        float* normalZ;
+        
+        RayBatchHits() : dist(nullptr), primIDs(nullptr), normalX(nullptr), normalY(nullptr), normalZ(nullptr) { }
+    };
+    
+    
+    
     class SLR_API SurfaceObjectAggregate : public SurfaceObject {
         Accelerator* m_accelerator;
+        // JP: 構築時に与えられた物体の列と、加速構造の葉の位置からその番号への対応。
+        //     対応は一括交差判定でのみ使うため、最初の一括交差判定の際に作る。
+        // EN: objects given at construction, and mapping from positions in the accelerator's leaves to their indices.
+        //     The mapping is only used by batch intersection, so it is built at the first batch intersection.
+        std::vector<const SurfaceObject*> m_objs;
+        mutable std::vector<uint32_t> m_leafObjIndices;
+        mutable std::once_flag m_leafObjIndicesFlag;
+        
+        void buildLeafObjectIndices() const;
         const SurfaceObject** m_lightList;
         std::map<uint32_t, uint32_t> m_objToLightMap;
         uint32_t m_numLights;
@@ -258,9 +314,18 @@ namespace SLR {
         float costForIntersect() const override;
         bool contains(const Point3D &p, float time) const override;
         bool intersect(const Ray &ray, const RaySegment &segment, SurfaceInteraction* si) const override;
+        uint32_t intersectPacket(const Ray* rays, RaySegment* segments, SurfaceInteraction* sis, uint32_t activeMask) const override;
         
         // END: SurfaceObject's methods
         // ----------------------------------------------------------------
+        
+        // JP: 任意の数の光線を複数のスレッドで交差判定する。光線は方向の象限ごとに32本の束にまとめて加速構造を辿る。
+        //     プリミティブ番号は構築時に与えられた物体の番号で、インスタンスの場合はインスタンスごとの番号になる。
+        //     numThreadsが0の場合はハードウェアのスレッド数を使う。
+        // EN: intersect any number of rays with multiple threads. Rays are grouped into packets of 32 rays per direction octant to traverse the accelerator.
+        //     The primitive ID is the index of an object given at construction, which is per instance for instances.
+        //     The number of hardware threads is used if numThreads is 0.
+        void intersectBatch(const RayBatch &rays, const RayBatchHits &hits, uint32_t numThreads = 0) const;
     };
 }
 
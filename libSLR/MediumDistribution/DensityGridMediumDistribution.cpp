@@ -8,6 +8,7 @@
 #include "DensityGridMediumDistribution.h"
 
 #include "../Core/light_path_sampler.h"
+#include "../Core/RenderStatistics.h"
 
 namespace SLR {
     float DensityGridMediumDistribution::calcDensity(const Point3D &param) const {
@@ -58,6 +59,7 @@ namespace SLR {
         float hitDistance = segment.distMax;
         FloatSum sampledDistance = segment.distMin;
         sampledDistance += -std::log(sampler.getSample()) / majorantSelected;
+        uint32_t numNullCollisions = 0;
         while (sampledDistance < segment.distMax) {
             Point3D queryPoint = ray.org + sampledDistance * ray.dir;
             Point3D param;
@@ -72,10 +74,13 @@ namespace SLR {
                 hitDistance = sampledDistance;
                 break;
             }
+            ++numNullCollisions;
             sampledDistance += -std::log(sampler.getSample()) / majorantSelected;
             
             // TODO: handle out of boundary.
         }
+        if (ThreadStatistics* stats = currentThreadStatistics())
+            stats->add(StatCounter::NullCollisions, numNullCollisions);
         
         // estimate Monte Carlo throughput T(s, wl_j)/p(s, wl_i) by ratio tracking.
         if (wls.wavelengthSelected()) {
@@ -63,4 +63,11 @@ namespace SLR {
             total += alloc.first;
         return total;
     }
+    
+    size_t ArenaAllocator::bytesInUse() const {
+        size_t total = m_currentBlockPos;
+        for (const auto &alloc : m_usedBlocks)
+            total += alloc.first;
+        return total;
+    }
 }
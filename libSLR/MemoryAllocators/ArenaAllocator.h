@@ -51,6 +51,9 @@ namespace SLR {
 
         void reset();
         size_t totalAllocated() const;
+        // JP: 最後のreset()以降に使用したバイト数。使い切った各ブロックは全体を使用したものとして数える。
+        // EN: the number of bytes used since the last reset(). Each exhausted block is counted as used entirely.
+        size_t bytesInUse() const;
     };    
 }
 
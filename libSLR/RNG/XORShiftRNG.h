@@ -27,6 +27,17 @@ namespace SLR {
         };
         
         typename TypeSet::UInt getUInt() override;
+        
+        bool writeState(FILE* fp) const {
+            return fwrite(m_state, sizeof(m_state), 1, fp) == 1;
+        }
+        bool readState(FILE* fp) {
+            typename TypeSet::UInt state[4];
+            if (fread(state, sizeof(state), 1, fp) != 1)
+                return false;
+            std::copy(state, state + 4, m_state);
+            return true;
+        }
     };
     
     template <> XORShiftRNGTemplate<Types32bit>::XORShiftRNGTemplate();
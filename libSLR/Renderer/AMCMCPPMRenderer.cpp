@@ -7,694 +7,557 @@
 
 #include "AMCMCPPMRenderer.h"
 
+#include "../MemoryAllocators/ArenaAllocator.h"
+#include "../Core/camera.h"
+#include "../Core/light_path_sampler.h"
+#include "../Core/low_discrepancy_sequences.h"
+#include "../Core/ImageSensor.h"
+#include "../Core/ImageExporter.h"
 #include "../Core/RenderSettings.h"
+#include "../Core/ProgressReporter.h"
+#include "../Core/RenderStatistics.h"
+#include "../Core/PassScheduler.h"
+#include "../Scene/Scene.h"
 #include "../Helper/ThreadPool.h"
-#include "../Core/XORShiftRNG.h"
-#include "../Core/ImageSensor.h"
-#include "../Core/RandomNumberGenerator.h"
-#include "../Memory/ArenaAllocator.h"
-#include "../Core/cameras.h"
-#include "../Core/geometry.h"
-#include "../Core/SurfaceObject.h"
-#include "../Core/directional_distribution_functions.h"
 
 namespace SLR {
-    void KDTree::initialize(uint64_t expectedSize) {
-        m_numStored = 0;
-        
-        m_ptrParticles.clear();
-        m_ptrParticles.reserve(expectedSize);
-        
-        m_ptrParticles.push_back(NULL);
-        
-        m_BBox = BoundingBox3D();
-    }
-    
-    void KDTree::balance() {
-        if (m_numStored > 1) {
-            std::vector<Particle*> balancedList(m_numStored + 1);
-            balanceSegment(balancedList, 1, 1, m_numStored);
-            std::copy(balancedList.begin(), balancedList.end(), m_ptrParticles.begin());
-        }
-        
-        m_numHalfStored = m_numStored / 2 - 1;
+    void AMCMCPPMRenderer::ReplicaExchangeSampler::startProposal(Mode mode, float mutationSize) {
+        m_uniform = mode == Mode::Uniform;
+        m_mutationSize = mutationSize;
+        m_numPropPathDims = 0;
     }
     
-    void KDTree::balanceSegment(std::vector<Particle*> &balanced, uint32_t index, uint32_t start, uint32_t end) {
-        int median = 1;
-        // medianを整列する領域の長さの半分に最も近い2のべき乗とする。（この段階では完全にそうはならない）
-        // length: 383, median: 128(128)
-        // length: 384, median: 128(128, 256)
-        // length: 385, median: 128(256)
-        // length: 511, median: 128(256)
-        // length: 512, median: 256(256)
-        // length: 513, median: 256(256)
-        // length: 640, median: 256(256)
-        // length: 768, median: 256(256, 512)
-        // length: 800, median: 256(512)
-        while ((4 * median) <= (end - start + 1))
-            median += median;
-        
-        // medianを領域の長さの半分に最も近い2のべき乗にして、適切なオフセットを加える。
-        // start: 1, end: 383, median: end - 128 + 1: 255
-        // start: 1, end: 384, median: 256 + start - 1: 256
-        // start: 1, end: 385, median: 256 + start - 1: 256
-        // start: 1, end: 511, median: 256 + start - 1: 256
-        // start: 1, end: 512, median: end - 256 + 1: 257
-        // start: 1, end: 513, median: end - 256 + 1: 258
-        // start: 1, end: 640, median: end - 256 + 1: 485
-        // start: 1, end: 768, median: 512 + start - 1: 512
-        // start: 1, end: 800, median: 512 + start - 1: 512
-        // length : 8 ~ 11: end-, 12 ~ 15: +start,
-        //         16 ~ 23: end-, 24 ~ 31: +start,
-        //         32 ~ 47: end-, 48 ~ 63: +start,
-        //         2^n ~ 2^n + 2^(n-1) - 1: end-
-        //         2^n + 2^(n-1) ~ 2^(n+1) - 1: +start
-        if ((3 * median) <= (end - start + 1)) {
-            median += median;
-            median += start - 1;
+    AMCMCPPMRenderer::LightPrimarySample AMCMCPPMRenderer::ReplicaExchangeSampler::getLightPrimarySample() {
+        if (m_uniform) {
+            m_propLightSample.init(*m_rng);
         }
         else {
-            median = end - median + 1;
-        }
-        
-        BoundingBox3D::Axis axis = m_BBox.widestAxis();
-        
-        // axis軸においてメディアンとなる値より小さい値を前に、大きい値を後ろに並べる。
-        auto compareFunc = [&axis](Particle* p0, Particle* p1) { return p0->position[axis] < p1->position[axis]; };
-        std::nth_element(m_ptrParticles.begin() + start, m_ptrParticles.begin() + median, m_ptrParticles.begin() + end + 1, compareFunc);
-        
-        balanced[index] = m_ptrParticles[median];
-        balanced[index]->plane = axis;
-        
-        // balance the left side segment.
-        if (start < median) {
-            if (start < median - 1) {
-                const float tmp = m_BBox.maxP[axis];
-                m_BBox.maxP[axis] = balanced[index]->position[axis];
-                balanceSegment(balanced, 2 * index, start, median - 1);
-                m_BBox.maxP[axis] = tmp;
-            }
-            else {
-                balanced[2 * index] = m_ptrParticles[start];
-            }
+            m_propLightSample = m_curLightSample;
+            m_propLightSample.adaptiveMutate(*m_rng, m_mutationSize);
         }
-        
-        // balance the right side segment.
-        if (median < end) {
-            if (median + 1 < end) {
-                const float tmp = m_BBox.minP[axis];
-                m_BBox.minP[axis] = balanced[index]->position[axis];
-                balanceSegment(balanced, 2 * index + 1, median + 1, end);
-                m_BBox.minP[axis] = tmp;
-            }
-            else {
-                balanced[2 * index + 1] = m_ptrParticles[end];
-            }
-        }
-    }
-    
-    void KDTree::locateParticlesInternal(uint32_t index, const Point3D &queryPos, float radius2, std::vector<Particle*> &particlesFound) const {
-        Particle* p = m_ptrParticles[index];
-        
-        // Recursively search.
-        if (index < m_numHalfStored) {
-            float vDist = queryPos[p->plane] - p->position[p->plane];
-            if (vDist > 0.0) {
-                locateParticlesInternal(2 * index + 1, queryPos, radius2, particlesFound);
-                if (vDist * vDist < radius2)
-                    locateParticlesInternal(2 * index, queryPos, radius2, particlesFound);
-            }
-            else {
-                locateParticlesInternal(2 * index, queryPos, radius2, particlesFound);
-                if (vDist * vDist < radius2)
-                    locateParticlesInternal(2 * index + 1, queryPos, radius2, particlesFound);
-            }
-        }
-        
-        // store the particle if it is in the search radius.
-        if (sqDistance(queryPos, p->position) < radius2)
-            particlesFound.push_back(p);
+        return m_propLightSample;
     }
     
-    
-    void AMCMCPPMRenderer::HitpointMap::initialize(uint32_t numThreads, uint32_t numPixels) {
-        KDTree::initialize(numPixels * 3);
-        m_numThreads = numThreads;
-        m_points.resize(m_numThreads);
-        for (int i = 0; i < m_numThreads; ++i) {
-            m_points[i].clear();
-            m_points[i].reserve(numPixels * 3 / numThreads);
+    AMCMCPPMRenderer::PathPrimarySample AMCMCPPMRenderer::ReplicaExchangeSampler::getPathPrimarySample() {
+        uint32_t dim = m_numPropPathDims++;
+        if (dim >= m_propPathSamples.size())
+            m_propPathSamples.emplace_back();
+        PathPrimarySample &sample = m_propPathSamples[dim];
+        if (m_uniform) {
+            sample.init(*m_rng);
         }
-    }
-    
-    void AMCMCPPMRenderer::HitpointMap::store(uint32_t thread, float imgX, float imgY,
-                                              const SampledSpectrum &weight, const Point3D &pos, const Normal3D &gn, const Vector3D &dir_sn,
-                                              const BSDF* f, const ReferenceFrame &frame) {
-        m_points[thread].emplace_back(imgX, imgY, pos, gn, dir_sn, weight, f, frame);
-    }
-    
-    void AMCMCPPMRenderer::HitpointMap::build() {
-        for (int i = 0; i < m_numThreads; ++i) {
-            for (int j = 0; j < m_points[i].size(); ++j) {
-                m_ptrParticles.push_back(&(m_points[i][j]));
-                m_BBox.unify(m_points[i][j].position);
+        else {
+            // JP: 現在の状態が使っていない次元は状態と独立な一様乱数とみなせるので、ここで生成してから変異させる。
+            // EN: dimensions unused by the current state can be regarded as uniform random numbers independent of the state, so generate them here and then mutate.
+            if (dim >= m_curPathSamples.size()) {
+                m_curPathSamples.emplace_back();
+                m_curPathSamples.back().init(*m_rng);
             }
-            m_numStored += m_points[i].size();
+            sample = m_curPathSamples[dim];
+            sample.adaptiveMutate(*m_rng, m_mutationSize);
         }
-        balance();
+        return sample;
     }
     
-    void AMCMCPPMRenderer::HitpointMap::queryHitpoints(const Point3D &pos, const Normal3D &gn, float radius, std::vector<Particle*> &pointsFound) const {
-        locateParticles(pos, radius * radius, pointsFound);
-        for (int i = 0; i < pointsFound.size(); ++i) {
-            Hitpoint &hp = *(Hitpoint*)pointsFound[i];
-            if (dot(Vector3D(gn), Vector3D(hp.gNormal)) < 0.707)
-                pointsFound[i] = nullptr;
-        }
+    void AMCMCPPMRenderer::ReplicaExchangeSampler::accept() {
+        m_curLightSample = m_propLightSample;
+        m_curPathSamples.assign(m_propPathSamples.begin(), m_propPathSamples.begin() + m_numPropPathDims);
     }
     
     
-    AMCMCPPMRenderer::ReplicaExchangeSampler::ReplicaExchangeSampler(RandomNumberGenerator* rng) : m_rng(rng) {
-        m_pathSamples.resize(100);
-        m_globalTime = 0;
-        m_curPathDim = 0;
-        m_mSizeHistory.resize(100);
-    };
     
-    AMCMCPPMRenderer::LightPrimarySample AMCMCPPMRenderer::ReplicaExchangeSampler::getLightPrimarySample() {
-        if (m_lightSample.modifiedTime < m_globalTime) {
-            if (m_uniform) {
-                m_lightStack = m_lightSample;
-                m_lightSample.init(*m_rng);
-                m_lightSample.modifiedTime = m_globalTime;
-            }
-            else {
-                if (m_lightSample.modifiedTime < m_uniformTime) {
-                    m_lightSample.init(*m_rng);
-                    m_lightSample.modifiedTime = m_uniformTime;
-                }
-                
-                int mIdx = 0;
-                while (m_lightSample.modifiedTime < m_globalTime - 1) {
-                    m_lightSample.adaptiveMutate(*m_rng, m_mSizeHistory[mIdx++]);
-                    ++m_lightSample.modifiedTime;
-                }
-                
-                m_lightStack = m_lightSample;
-                m_lightSample.adaptiveMutate(*m_rng, m_mSize);
-                ++m_lightSample.modifiedTime;
-            }
-        }
-        
-        return m_lightSample;
-    };
-    
-    AMCMCPPMRenderer::PathPrimarySample AMCMCPPMRenderer::ReplicaExchangeSampler::getPathPrimarySample() {
-        if (m_curPathDim >= m_pathSamples.size())
-            m_pathSamples.resize(m_pathSamples.size() * 1.5f);
-        
-        PathPrimarySample &curSample = m_pathSamples[m_curPathDim];
-        if (curSample.modifiedTime < m_globalTime) {
-            if (m_uniform) {
-                m_pathStack.push(curSample);
-                curSample.init(*m_rng);
-                curSample.modifiedTime = m_globalTime;
-            }
-            else {
-                if (curSample.modifiedTime < m_uniformTime) {
-                    curSample.init(*m_rng);
-                    curSample.modifiedTime = m_uniformTime;
-                }
-                
-                int mIdx = 0;
-                while (curSample.modifiedTime < m_globalTime - 1) {
-                    curSample.adaptiveMutate(*m_rng, m_mSizeHistory[mIdx++]);
-                    ++curSample.modifiedTime;
-                }
-                
-                m_pathStack.push(curSample);
-                curSample.adaptiveMutate(*m_rng, m_mSize);
-                ++curSample.modifiedTime;
-            }
-        }
-        
-        return m_pathSamples[m_curPathDim++];
-    };
-    
-    // パスの生成前に呼ばれる．
-    void AMCMCPPMRenderer::ReplicaExchangeSampler::initDimensions(Mode mode, float size) {
-        ++m_globalTime;
-        m_curPathDim = 0;
-        m_uniform = mode == Mode::Uniform;
-        m_mSize = size;
-    };
-    
-    // 採択時に呼ばれる．
-    void AMCMCPPMRenderer::ReplicaExchangeSampler::clearStack() {
-        while (m_pathStack.empty() == false)
-            m_pathStack.pop();
-        
-        if (m_uniform) {
-            // 一様サンプルとレプリカ交換を行った場合は時間を記録する．
-            m_uniformTime = m_globalTime;
-            m_histIdx = 0;
-        }
-        else {
-            // 変異させた場合は変異サイズの履歴を保存する．
-            m_mSizeHistory[m_histIdx++] = m_mSize;
-            if (m_histIdx >= m_mSizeHistory.size())
-                m_mSizeHistory.resize(m_mSizeHistory.size() * 1.5f);
-        }
-    };
-    
-    // 棄却時に呼ばれる．
-    void AMCMCPPMRenderer::ReplicaExchangeSampler::rollBack() {
-        m_lightSample = m_lightStack;
-        while (m_pathStack.empty() == false) {
-            m_pathSamples[--m_curPathDim] = m_pathStack.top();
-            m_pathStack.pop();
-        }
-        --m_globalTime;
-    };
-    
-    
-    AMCMCPPMRenderer::AMCMCPPMRenderer(uint32_t numPhotonsPerPass, uint32_t numPasses) : m_numPhotonsPerPass(numPhotonsPerPass), m_numPasses(numPasses) {
-    };
+    AMCMCPPMRenderer::AMCMCPPMRenderer(uint32_t numPhotonsPerPass, uint32_t numPasses, LightPathSamplerType samplerType, float initialRadius, float radiusReductionRate) :
+    m_numPhotonsPerPass(numPhotonsPerPass), m_numPasses(numPasses), m_samplerType(samplerType), m_initialRadius(initialRadius), m_radiusReductionRate(radiusReductionRate) {
+    }
     
-    void AMCMCPPMRenderer::render(const Scene &scene, const RenderSettings &settings) const {                
-#ifdef DEBUG
-        uint32_t numThreads = 1;
-#else
-        uint32_t numThreads = std::thread::hardware_concurrency();
-#endif
-        XORShiftRNG topRand(settings.getInt(RenderSettingItem::RNGSeed));
-        auto mems = std::unique_ptr<ArenaAllocator[]>(new ArenaAllocator[numThreads]);
-        auto memPTs = std::unique_ptr<ArenaAllocator[]>(new ArenaAllocator[numThreads]);
-        auto rngs = std::unique_ptr<XORShiftRNG[]>(new XORShiftRNG[numThreads]);
-        auto rngRefs = std::unique_ptr<RandomNumberGenerator*[]>(new RandomNumberGenerator*[numThreads]);
-        auto scales = std::unique_ptr<float[]>(new float[numThreads]);
-        for (int i = 0; i < numThreads; ++i) {
-            new (mems.get() + i) ArenaAllocator();
-            new (memPTs.get() + i) ArenaAllocator();
-            rngRefs[i] = new (rngs.get() + i) XORShiftRNG(topRand.getUInt());
+    void AMCMCPPMRenderer::render(const Scene &scene, const RenderSettings &settings) const {
+        uint32_t numThreads = settings.getInt(RenderSettingItem::NumThreads);
+        uint32_t seed = settings.getInt(RenderSettingItem::RNGSeed);
+        XORShiftRNG topRand(seed);
+        ArenaAllocator* eyeMems = new ArenaAllocator[numThreads];
+        LightPathSampler** samplers = new LightPathSampler*[numThreads];
+        for (int i = 0; i < numThreads; ++i)
+            samplers[i] = createLightPathSampler(m_samplerType, seed, topRand.getUInt());
+        // JP: ヒットポイントはスレッドごとの配列に格納し、全てのパスで再利用する。
+        // EN: store hitpoints to per-thread arrays, and reuse them for all the passes.
+        HitpointStorage* hitpointStorages = (HitpointStorage*)SLR_memalign(sizeof(HitpointStorage) * numThreads, SLR_L1_Cacheline_Size);
+        for (int i = 0; i < numThreads; ++i)
+            new (hitpointStorages + i) HitpointStorage();
+        
+        // JP: コアごとに1本のマルコフ連鎖を走らせる。
+        // EN: run one Markov chain per core.
+        uint32_t numChains = numThreads;
+        ArenaAllocator* chainMems = new ArenaAllocator[numChains];
+        MCMCChain* chains = (MCMCChain*)SLR_memalign(sizeof(MCMCChain) * numChains, SLR_L1_Cacheline_Size);
+        ChainStatistics* chainStats = new ChainStatistics[numChains];
+        for (int i = 0; i < numChains; ++i) {
+            MCMCChain &chain = *new (chains + i) MCMCChain();
+            chain.sampler = ReplicaExchangeSampler(&chain.rng);
+            chain.mem = &chainMems[i];
+            chainStats[i] = ChainStatistics{0, 0, 1.0f};
         }
         
         const Camera* camera = scene.getCamera();
         ImageSensor* sensor = camera->getSensor();
         
-        HitpointMap hitpointMap;
-        
-        DistributedRTJob jobDRT;
-        jobDRT.scene = &scene;
-        
-        jobDRT.mems = mems.get();
-        jobDRT.rngs = rngRefs.get();
-        jobDRT.hpMap = &hitpointMap;
-        
-        jobDRT.camera = scene.getCamera();
-        
-        jobDRT.sensor = sensor;
-        jobDRT.imageWidth = settings.getInt(RenderSettingItem::ImageWidth);
-        jobDRT.imageHeight = settings.getInt(RenderSettingItem::ImageHeight);
-        jobDRT.numPixelX = sensor->tileWidth();
-        jobDRT.numPixelY = sensor->tileHeight();
-        
-        float radius = 0.0025f;
-        const uint32_t numMCMCs = 16;
-        const uint32_t numPhotonsPerPass = 100000;
-        PhotonSplattingJob jobPSs[numMCMCs];
-        std::unique_ptr<XORShiftRNG[]> rngPSs = std::unique_ptr<XORShiftRNG[]>(new XORShiftRNG[numMCMCs]);
-        for (int i = 0; i < numMCMCs; ++i) {
-            PhotonSplattingJob &jobPS = jobPSs[i];
-            jobPS.scene = &scene;
-            jobPS.mems = memPTs.get();
-            jobPS.hpMap = &hitpointMap;
-            jobPS.numPhotons = m_numPhotonsPerPass;
-            
-            jobPS.sensor = sensor;
-            
-            jobPS.sampler = ReplicaExchangeSampler(rngPSs.get());
-            jobPS.uniformCount = 0;
-            jobPS.mutationCount = 0;
-            jobPS.acceptedCount = 0;
-            jobPS.mutationSize = 1;
+        void (Job::*eyeKernel)(uint32_t) = nullptr;
+        switch (m_samplerType) {
+            case LightPathSamplerType::Independent:
+                eyeKernel = &Job::eyeKernel<IndependentLightPathSampler>;
+                break;
+            case LightPathSamplerType::Sobol:
+                eyeKernel = &Job::eyeKernel<SobolLightPathSampler>;
+                break;
+            case LightPathSamplerType::Halton:
+                eyeKernel = &Job::eyeKernel<HaltonLightPathSampler>;
+                break;
+            default:
+                SLRAssert_ShouldNotBeCalled();
+                break;
         }
         
-        uint32_t imgIdx = 0;
-        uint32_t exportIdx = 1;
-        uint32_t endIdx = 16;
+        PointHashGrid<Hitpoint> hitpointGrid;
+        
+        Job job;
+        job.scene = &scene;
         
-        sensor->init(jobDRT.imageWidth, jobDRT.imageHeight);
-        sensor->addSeparatedBuffers(numThreads);
+        job.eyeMems = eyeMems;
+        job.pathSamplers = samplers;
+        job.hitpointStorages = hitpointStorages;
+        job.hitpointGrid = &hitpointGrid;
+        job.chains = chains;
+        job.chainStats = chainStats;
         
+        job.camera = camera;
+        job.sensor = sensor;
         float timeStart = settings.getFloat(RenderSettingItem::TimeStart);
         float timeEnd = settings.getFloat(RenderSettingItem::TimeEnd);
-        
-        for (int s = 0; s < m_numPasses; ++s) {
-            float time = timeStart + (timeEnd - timeStart) * topRand.getFloat0cTo1o();
-            jobDRT.time = time;
-            
-            // FIXME: wavelength selection should be done in each path.
-            float selectWLPDF;
-            WavelengthSamples wls = WavelengthSamples::createWithEqualOffsets(topRand.getFloat0cTo1o(), topRand.getFloat0cTo1o(), &selectWLPDF);
+        job.imageWidth = settings.getInt(RenderSettingItem::ImageWidth);
+        job.imageHeight = settings.getInt(RenderSettingItem::ImageHeight);
+        job.numPixelX = sensor->tileWidth();
+        job.numPixelY = sensor->tileHeight();
+        job.numPhotonsPerChain = (m_numPhotonsPerPass + numChains - 1) / numChains;
+        
+        // JP: フォトンの寄与は連鎖ごとの分離されたバッファに蓄積し、パスの終わりに正規化してから本体のバッファに加える。
+        // EN: photon contributions are accumulated to per-chain separated buffers, and added to the main buffer after normalization at the end of a pass.
+        sensor->init(job.imageWidth, job.imageHeight);
+        sensor->addSeparatedBuffers(numChains);
+        
+        float baseRadius = m_initialRadius * scene.getWorldRadius();
+        
+        printf("Adaptive MCMC Progressive Photon Mapping: %u passes, %u photons per pass, %u chains, initial radius: %g\n",
+               m_numPasses, job.numPhotonsPerChain * numChains, numChains, baseRadius);
+        RenderStatistics renderStats(numThreads);
+        job.renderStats = &renderStats;
+        ProgressReporter reporter(numThreads, settings.getInt(RenderSettingItem::ProgressFD));
+        job.reporter = &reporter;
+        
+        PassScheduler scheduler(settings, m_numPasses);
+        scheduler.addStateRegion(chainStats, sizeof(ChainStatistics) * numChains);
+        scheduler.begin(sensor, samplers, numThreads);
+        
+        uint32_t numTiles = sensor->numTileX() * sensor->numTileY();
+        uint32_t numWorksPerPass = numTiles + numChains;
+        uint32_t firstPass = std::min(scheduler.numPasses(), scheduler.maxNumPasses());
+        if (!scheduler.isProgressive())
+            reporter.pushJob("Rendering", (scheduler.maxNumPasses() - firstPass) * numWorksPerPass, scheduler.startTime());
+        char nextTitle[32];
+        snprintf(nextTitle, sizeof(nextTitle), "To %5upass", scheduler.nextExportPass());
+        reporter.pushJob(nextTitle, (scheduler.nextExportPass() - firstPass) * numWorksPerPass, scheduler.startTime());
+        uint32_t imgIdx = scheduler.numExportedImages();
+        ImageExporter exporter;
+        for (int s = firstPass; s < scheduler.maxNumPasses(); ++s) {
+            job.sampleIndex = s;
             
-            jobDRT.wls = wls;
+            // JP: パスで共有する時刻とスペクトルのサンプル。チェックポイントから再開しても同じ値となるようパス番号から決める。
+            // EN: the time and the wavelength samples shared in the pass. These are determined from the pass index to get the same values after resuming from a checkpoint.
+            job.time = timeStart + (timeEnd - timeStart) * scrambledRadicalInverse(HaltonPrimes[0], s, seed);
+            job.wls = WavelengthSamples::createWithEqualOffsets(scrambledRadicalInverse(HaltonPrimes[1], s, seed),
+                                                                scrambledRadicalInverse(HaltonPrimes[2], s, seed), &job.selectWLPDF);
             
-            wls.flags |= WavelengthSamples::LambdaIsSelected;
-            for (int i = 0; i < numMCMCs; ++i)
-                jobPSs[i].wls = wls;
+            float radius = baseRadius / std::pow(float(s + 1), 0.5f * (1 - m_radiusReductionRate));
             
-            hitpointMap.initialize(numThreads, jobDRT.imageWidth * jobDRT.imageHeight);
-            
-            // Distributed Ray Tracing Pass: record hitpoints in a k-d tree.
-            ThreadPool DRTPool(numThreads);
-            for (int ty = 0; ty < sensor->numTileY(); ++ty) {
-                for (int tx = 0; tx < sensor->numTileX(); ++tx) {
-                    jobDRT.basePixelX = tx * sensor->tileWidth();
-                    jobDRT.basePixelY = ty * sensor->tileHeight();
-                    DRTPool.enqueue(std::bind(&DistributedRTJob::kernel, jobDRT, std::placeholders::_1));
+            // Distributed ray tracing pass: record hitpoints.
+            {
+                ScopedPhaseTimer timer(&renderStats, StatPhase::Rendering);
+                ThreadPool threadPool(numThreads);
+                for (int ty = 0; ty < sensor->numTileY(); ++ty) {
+                    for (int tx = 0; tx < sensor->numTileX(); ++tx) {
+                        job.basePixelX = tx * sensor->tileWidth();
+                        job.basePixelY = ty * sensor->tileHeight();
+                        threadPool.enqueue(std::bind(eyeKernel, job, std::placeholders::_1));
+                    }
                 }
+                threadPool.wait();
             }
-            DRTPool.wait();
             
-            // Build a balanced k-d tree.
-            hitpointMap.build();
+            std::vector<std::pair<const Hitpoint*, uint32_t>> chunks;
+            for (int i = 0; i < numThreads; ++i) {
+                const SubPath<Hitpoint> &hitpoints = hitpointStorages[i].hitpoints;
+                if (hitpoints.size() > 0)
+                    chunks.emplace_back(&hitpoints[0], hitpoints.size());
+            }
+            hitpointGrid.build(chunks, radius, numThreads, [](const Hitpoint &hp) { return true; });
             
-            // Photon Tracing Pass: splatting photon's contribution to hitpoints near the photon.
-            ThreadPool PTPool(numThreads);
-            for (int i = 0; i < numMCMCs; ++i) {
-                jobPSs[i].time = time;
-                jobPSs[i].radius = radius;
-                PTPool.enqueue(std::bind(&PhotonSplattingJob::kernel, std::ref(jobPSs[i]), std::placeholders::_1));
+            // JP: 連鎖の乱数生成器はパス番号から初期化し、チェックポイントから再開しても同じ連鎖となるようにする。
+            // EN: initialize the random number generators of the chains from the pass index so that resuming from a checkpoint gives the same chains.
+            XORShiftRNG passRand(seed + 2654435761U * (s + 1));
+            for (int i = 0; i < numChains; ++i) {
+                chains[i].rng = XORShiftRNG(passRand.getUInt());
+                chains[i].numUniformSamples = 0;
+                chains[i].numVisibleUniformSamples = 0;
             }
-            PTPool.wait();
             
-            for (int i = 0; i < numThreads; ++i)
-                mems[i].reset();
+            // Photon tracing pass: splat photon contributions to nearby hitpoints.
+            {
+                ScopedPhaseTimer timer(&renderStats, StatPhase::LightTracing);
+                ThreadPool threadPool(numThreads);
+                for (int i = 0; i < numChains; ++i)
+                    threadPool.enqueue(std::bind(&Job::chainKernel, job, i, std::placeholders::_1));
+                threadPool.wait();
+            }
             
-            uint64_t numPasses = s + 1;
-            const float alpha = 2.0f / 3.0f;
-            radius = std::sqrt((numPasses + alpha) / (numPasses + 1)) * radius;
+            // JP: 連鎖のサンプルは可視なパスの上の一様分布に従うため、全連鎖の一様サンプルから推定した可視なパスの割合を掛けて正規化する。
+            // EN: samples of the chains follow the uniform distribution over visible paths,
+            //     so normalize them by multiplying the fraction of visible paths estimated from the uniform samples of all the chains.
+            uint64_t numUniformSamples = 0;
+            uint64_t numVisibleUniformSamples = 0;
+            for (int i = 0; i < numChains; ++i) {
+                numUniformSamples += chains[i].numUniformSamples;
+                numVisibleUniformSamples += chains[i].numVisibleUniformSamples;
+            }
+            float visibleFraction = numUniformSamples > 0 ? float(numVisibleUniformSamples) / numUniformSamples : 0.0f;
+            sensor->mergeSeparatedBuffers(visibleFraction / (job.numPhotonsPerChain * numChains));
             
-            uint64_t numPhotons = numPasses * numPhotonsPerPass * numMCMCs;
-            uint64_t uniformCount = 0;
-            for (int i = 0; i < numMCMCs; ++i) {
-                printf("MCMC: %2u: #uniform: %llu, #mutation: %llu, #accept: %llu, mutationSize: %g\n",
-                       i, jobPSs[i].uniformCount, jobPSs[i].mutationCount, jobPSs[i].acceptedCount, jobPSs[i].mutationSize);
-                uniformCount += jobPSs[i].uniformCount;
+            for (int i = 0; i < numThreads; ++i) {
+                hitpointStorages[i].hitpoints.clear();
+                eyeMems[i].reset();
             }
-            float scale = float(uniformCount) / numPhotons * (1.0f / (numPasses * numMCMCs));
-            for (int i = 0; i < numThreads; ++i)
-                scales[i] = scale;
-            printf("\n");
             
-            ++imgIdx;
-            if (imgIdx == exportIdx) {
-                exportIdx += exportIdx;
+            renderStats.finishPass();
+            bool finished;
+            {
+                ScopedPhaseTimer timer(&renderStats, StatPhase::PassFinalization);
+                finished = !scheduler.finishPass(sensor);
+            }
+            if (scheduler.shouldExport(finished)) {
+                reporter.skipRemainingWork();
+                reporter.popJob();
+                
+                uint64_t numMutations = 0;
+                uint64_t numAcceptedMutations = 0;
+                float meanMutationSize = 0.0f;
+                for (int i = 0; i < numChains; ++i) {
+                    numMutations += chainStats[i].numMutations;
+                    numAcceptedMutations += chainStats[i].numAcceptedMutations;
+                    meanMutationSize += chainStats[i].mutationSize / numChains;
+                }
+                
+                reporter.beginOtherThreadPrint();
                 char filename[256];
-                sprintf(filename, "%03u.bmp", imgIdx);
-                sensor->saveImage(filename, settings.getFloat(RenderSettingItem::Brightness) / (s + 1));
-                printf("%u samples: %s\n", s, filename);
+                sprintf(filename, "%03u.%s", imgIdx, sensor->imageFileExtension());
+                float elapsed = scheduler.elapsedTime();
+                {
+                    ScopedPhaseTimer timer(&renderStats, StatPhase::ImageOutput);
+                    exporter.exportImage(*sensor, filename, settings.getFloat(RenderSettingItem::Brightness) / (s + 1 - scheduler.firstPass()));
+                }
+                printf("%u passes: %s, %g[s], radius: %g, visible: %g, acceptance: %g, mutation size: %g\n", s + 1, filename, elapsed, radius,
+                       visibleFraction, numMutations > 0 ? double(numAcceptedMutations) / numMutations : 0.0, meanMutationSize);
+                sprintf(filename, "%03u.json", imgIdx);
+                renderStats.writeJSON(filename, "AMCMCPPM");
+                reporter.endOtherThreadPrint();
+                
                 ++imgIdx;
-                if (imgIdx == endIdx)
+                if (finished)
                     break;
+                scheduler.advanceExport();
+                snprintf(nextTitle, sizeof(nextTitle), "To %5upass", scheduler.nextExportPass());
+                reporter.pushJob(nextTitle, (scheduler.nextExportPass() - (s + 1)) * numWorksPerPass, scheduler.startTime());
             }
         }
-        
-        //    sensor.saveImage("output.png", settings.getFloat(RenderSettingItem::SensorResponse) / numSamples);
+        if (!scheduler.isProgressive()) {
+            reporter.skipRemainingWork();
+            reporter.popJob();
+        }
+        reporter.finish();
+        scheduler.printSummary();
+        
+        for (int i = 0; i < numChains; ++i)
+            chains[i].~MCMCChain();
+        SLR_freealign(chains);
+        delete[] chainStats;
+        delete[] chainMems;
+        for (int i = 0; i < numThreads; ++i) {
+            hitpointStorages[i].~HitpointStorage();
+            delete samplers[i];
+        }
+        SLR_freealign(hitpointStorages);
+        delete[] samplers;
+        delete[] eyeMems;
     }
     
-    
-    void AMCMCPPMRenderer::DistributedRTJob::kernel(uint32_t threadID) {
-        ArenaAllocator &mem = mems[threadID];
-        RandomNumberGenerator &rng = *rngs[threadID];
+    template <class SamplerType>
+    void AMCMCPPMRenderer::Job::eyeKernel(uint32_t threadID) {
+        ArenaAllocator &mem = eyeMems[threadID];
+        SamplerType &pathSampler = static_cast<SamplerType &>(*pathSamplers[threadID]);
+        SubPath<Hitpoint> &hitpoints = hitpointStorages[threadID].hitpoints;
+        const int16_t wlHint = wls.selectedLambdaIndex;
+        const DirectionType deltaType = DirectionType::WholeSphere | DirectionType::Delta;
+        ThreadStatistics &threadStats = *renderStats->threadStatistics(threadID);
+        ScopedThreadStatistics scopedStats(&threadStats);
         for (int ly = 0; ly < numPixelY; ++ly) {
             for (int lx = 0; lx < numPixelX; ++lx) {
-                float px = basePixelX + lx + rng.getFloat0cTo1o();
-                float py = basePixelY + ly + rng.getFloat0cTo1o();
+                uint32_t px = basePixelX + lx;
+                uint32_t py = basePixelY + ly;
+                if (px >= imageWidth || py >= imageHeight)
+                    continue;
+                pathSampler.startPixelSample(px, py, sampleIndex);
+                PixelPosition p = pathSampler.getPixelPositionSample(px, py);
                 
+                // sample a ray with its importances (spatial, directional) from the lens and its IDF.
                 LensPosQuery lensQuery(time, wls);
-                LensPosSample lensSample(rng.getFloat0cTo1o(), rng.getFloat0cTo1o());
                 LensPosQueryResult lensResult;
-                SampledSpectrum We0 = camera->sample(lensQuery, lensSample, &lensResult);
-                
-                IDFSample WeSample(px / imageWidth, py / imageHeight);
+                IDFSample WeSample(p.x / imageWidth, p.y / imageHeight);
                 IDFQueryResult WeResult;
-                IDF* idf = camera->createIDF(lensResult.surfPt, wls, mem);
-                SampledSpectrum We1 = idf->sample(WeSample, &WeResult);
+                IDF* idf;
+                SampledSpectrum We0, We1;
+                Ray ray;
+                float epsilon;
+                camera->sampleRay(lensQuery, pathSampler.getLensPosSample(), WeSample, mem,
+                                  &lensResult, &We0, &idf, &WeResult, &We1, &ray, &epsilon);
                 
-                Ray ray(lensResult.surfPt.p, lensResult.surfPt.shadingFrame.fromLocal(WeResult.dirLocal), time);
-                SampledSpectrum weight = (We0 * We1) * (WeResult.dirLocal.z / (lensResult.areaPDF * WeResult.dirPDF));
-                SampledSpectrum C = record(threadID, *scene, wls, px, py, ray, weight, rng, mem);
-                SLRAssert(weight.hasNaN() == false && weight.hasInf() == false,
-                          "Unexpected value detected: %s\n"
-                          "pix: (%f, %f)", weight.toString().c_str(), px, py);
-                SLRAssert(C.hasNaN() == false && C.hasInf() == false,
-                          "Unexpected value detected: %s\n"
-                          "pix: (%f, %f)", C.toString().c_str(), px, py);
+                SampledSpectrum alpha = We0 * We1 * (lensResult.surfPt.calcCosTerm(ray.dir) / (lensResult.areaPDF * WeResult.dirPDF * selectWLPDF));
                 
-                sensor->add(px, py, wls, C);
+                // JP: 非デルタ成分を持つ頂点にヒットポイントを格納し、デルタ関数の成分のみを追跡し続ける。
+                // EN: store a hitpoint at each vertex having non-delta components, and continue tracing only delta components.
+                WavelengthSamples pathWLs = wls;
+                RaySegment segment(epsilon);
+                SurfaceInteraction si;
+                SurfacePoint surfPt;
+                if (WeResult.dirPDF > 0.0f)
+                    threadStats.add(StatCounter::CameraRays);
+                while (WeResult.dirPDF > 0.0f && scene->intersect(ray, segment, &si)) {
+                    si.calculateSurfacePoint(&surfPt);
+                    Vector3D dirOut_sn = surfPt.toLocal(-ray.dir);
+                    Normal3D gNorm_sn = surfPt.getLocalGeometricNormal();
+                    
+                    // JP: 直接、もしくはデルタ関数のみを経由して見える光源の寄与はここで求める。
+                    // EN: contributions of lights seen directly or only through delta functions are computed here.
+                    if (surfPt.isEmitting()) {
+                        EDF* edf = surfPt.createEDF(pathWLs, mem);
+                        SampledSpectrum Le = surfPt.emittance(pathWLs) * edf->evaluate(EDFQuery(), dirOut_sn);
+                        SampledSpectrum contribution = alpha * Le;
+                        SLRAssert(contribution.allFinite() && !contribution.hasMinus(),
+                                  "Unexpected value detected: %s\n"
+                                  "pix: (%f, %f)", contribution.toString().c_str(), p.x, p.y);
+                        if (pathWLs.wavelengthSelected())
+                            contribution[wlHint] *= WavelengthSamples::NumComponents;
+                        sensor->add(p.x, p.y, pathWLs, contribution);
+                    }
+                    
+                    if (surfPt.atInfinity())
+                        break;
+                    
+                    BSDF* bsdf = surfPt.createBSDF(pathWLs, mem);
+                    if (bsdf->hasNonDelta())
+                        hitpoints.emplace_back(SubPathVertex(surfPt, bsdf, BSDFQuery(dirOut_sn, gNorm_sn, wlHint)), p.x, p.y, alpha, pathWLs.wavelengthSelected());
+                    if (!bsdf->matches(deltaType))
+                        break;
+                    
+                    BSDFQuery fsQuery(dirOut_sn, gNorm_sn, wlHint, deltaType);
+                    BSDFQueryResult fsResult;
+                    SampledSpectrum fs = bsdf->sample(fsQuery, pathSampler.getBSDFSample(), &fsResult);
+                    if (fs == SampledSpectrum::Zero || fsResult.dirPDF == 0.0f)
+                        break;
+                    if (fsResult.sampledType.isDispersive() && !pathWLs.wavelengthSelected())
+                        pathWLs.flags |= WavelengthSamples::WavelengthIsSelected;
+                    Vector3D vecIn = surfPt.fromLocal(fsResult.dirLocal);
+                    SampledSpectrum weight = fs * (surfPt.calcCosTerm(vecIn) / fsResult.dirPDF);
+                    
+                    // Russian roulette
+                    float RRProb = std::min(weight.importance(wlHint), 1.0f);
+                    if (pathSampler.getPathTerminationSample() < RRProb) {
+                        weight /= RRProb;
+                    }
+                    else {
+                        threadStats.add(StatCounter::RussianRouletteTerminations);
+                        break;
+                    }
+                    
+                    alpha *= weight;
+                    ray = Ray(surfPt.getPosition(), vecIn, ray.time);
+                    segment = RaySegment(Ray::Epsilon);
+                    si = SurfaceInteraction();
+                    threadStats.add(StatCounter::BounceRays);
+                }
             }
         }
+        threadStats.recordArenaUsage(mem.bytesInUse());
+        reporter->update(threadID);
     }
     
-    SampledSpectrum AMCMCPPMRenderer::DistributedRTJob::record(uint32_t threadID, const Scene &scene, const WavelengthSamples &initWLs, float px, float py, const Ray &initRay, const SampledSpectrum &initAlpha,
-                                                               RandomNumberGenerator &rng, ArenaAllocator &mem) const {
-        WavelengthSamples wls = initWLs;
-        Ray ray = initRay;
-        SurfacePoint surfPt;
-        SampledSpectrum alpha = initAlpha;
-        float initY = alpha.luminance();
-        SampledSpectrumSum sp(SampledSpectrum::Zero);
-        uint32_t pathLength = 0;
-        
-        Intersection isect;
-        if (!scene.intersect(ray, &isect))
-            return SampledSpectrum::Zero;
-        isect.getSurfacePoint(&surfPt);
-        
-        Vector3D dirOut_sn = surfPt.shadingFrame.toLocal(-ray.dir);
-        if (surfPt.isEmitting()) {
-            EDF* edf = surfPt.createEDF(wls, mem);
-            SampledSpectrum Le = surfPt.emittance(wls) * edf->evaluate(EDFQuery(), dirOut_sn);
-            sp += alpha * Le;
-        }
-        if (surfPt.atInfinity)
-            return sp;
-        
-        while (true) {
-            ++pathLength;
-            Normal3D gNorm_sn = surfPt.shadingFrame.toLocal(surfPt.gNormal);
-            BSDF* bsdf = surfPt.createBSDF(wls, mem);
-            
-            DirectionType receiveType = DirectionType(DirectionType::WholeSphere | DirectionType::NonDelta);
-            if (bsdf->matches(receiveType))
-                hpMap->store(threadID, px, py, alpha, surfPt.p, surfPt.gNormal, dirOut_sn, bsdf, surfPt.shadingFrame);
-            
-            DirectionType scatterType = DirectionType(DirectionType::WholeSphere | DirectionType::Delta);
-            if (!bsdf->matches(scatterType))
-                break;
-            
-            BSDFQuery fsQuery(dirOut_sn, gNorm_sn, wls.selectedLambda);
-            BSDFSample fsSample(rng.getFloat0cTo1o(), rng.getFloat0cTo1o(), rng.getFloat0cTo1o());
-            fsQuery.flags = scatterType;
-            BSDFQueryResult fsResult;
-            SampledSpectrum fs = bsdf->sample(fsQuery, fsSample, &fsResult);
-            if (fs == SampledSpectrum::Zero || fsResult.dirPDF == 0.0f)
-                break;
-            if (fsResult.dirType.isDispersive()) {
-                fsResult.dirPDF /= WavelengthSamples::NumComponents;
-                wls.flags |= WavelengthSamples::LambdaIsSelected;
+    void AMCMCPPMRenderer::Job::chainKernel(uint32_t chainIdx, uint32_t threadID) {
+        MCMCChain &chain = chains[chainIdx];
+        ChainStatistics &stats = chainStats[chainIdx];
+        ReplicaExchangeSampler &sampler = chain.sampler;
+        ScopedThreadStatistics scopedStats(renderStats->threadStatistics(threadID));
+        
+        // JP: 一様サンプリングで可視なパスが見つかるまで探索し、連鎖の初期状態とする。
+        //     可視なパスの上の一様分布からの厳密なサンプルとなるため、バーンインは不要である。
+        // EN: search for a visible path by uniform sampling, and use it as the initial state of the chain.
+        //     This is an exact sample from the uniform distribution over visible paths, so no burn-in is required.
+        bool found = false;
+        for (int i = 0; i < numPhotonsPerChain && !found; ++i) {
+            sampler.startProposal(ReplicaExchangeSampler::Mode::Uniform, 0.0f);
+            ++chain.numUniformSamples;
+            if (tracePhoton(chain, &chain.curResults)) {
+                ++chain.numVisibleUniformSamples;
+                sampler.accept();
+                found = true;
             }
-            alpha *= fs * (std::fabs(fsResult.dir_sn.z) / fsResult.dirPDF);
-            SLRAssert(!alpha.hasInf() && !alpha.hasNaN(), "alpha: unexpected value detected: %s", alpha.toString().c_str());
-            
-            Vector3D dirIn = surfPt.shadingFrame.fromLocal(fsResult.dir_sn);
-            ray = Ray(surfPt.p + Ray::Epsilon * dirIn, dirIn, ray.time);
-            
-            isect = Intersection();
-            if (!scene.intersect(ray, &isect))
-                break;
-            isect.getSurfacePoint(&surfPt);
-            
-            dirOut_sn = surfPt.shadingFrame.toLocal(-ray.dir);
-            
-            if (surfPt.isEmitting()) {
-                EDF* edf = surfPt.createEDF(wls, mem);
-                SampledSpectrum Le = surfPt.emittance(wls) * edf->evaluate(EDFQuery(), dirOut_sn);
-                SLRAssert(!Le.hasNaN() && !Le.hasInf(), "Le: unexpected value detected: %s", Le.toString().c_str());
-                
-                sp += alpha * Le;
-            }
-            if (surfPt.atInfinity)
-                break;
-            
-            // Russian roulette
-            float continueProb = std::min(alpha.luminance() / initY, 1.0f);
-            if (rng.getFloat0cTo1o() < continueProb)
-                alpha /= continueProb;
-            else
-                break;
         }
-        
-        return sp;
-    }
-    
-    
-    void AMCMCPPMRenderer::PhotonSplattingJob::kernel(uint32_t threadID) {
-        ArenaAllocator &mem = mems[threadID];
-        std::vector<ResultRecord> results;
-        
-        // 一様サンプリングでフォトンパスが可視になるまで続ける．
-        if (uniformCount == 0) {
-            while (true) {
-                results.clear();
-                sampler.initDimensions(ReplicaExchangeSampler::Mode::Uniform, 0);
-                if (photonTracing(wls, mem, results) != 0.0f) {
-                    sampler.clearStack();
-                    break;
-                }
-                sampler.rollBack();
-            }
-            uniformCount = 1;
-            acceptedCount = 1;
-            
-            prevResults.resize(results.size());
-            std::copy(results.begin(), results.end(), prevResults.begin());
+        if (!found) {
+            reporter->update(threadID);
+            return;
         }
         
-        FloatSum cMutationSize = mutationSize;
-        const float targetAcceptanceRate = 0.234f;
-        for (int i = 0; i < numPhotons; ++i) {
-            results.clear();
-            sampler.initDimensions(ReplicaExchangeSampler::Mode::Uniform, 0);
-            bool success = true;
-            float V = photonTracing(wls, mem, results);
-            if (V != 0.0f) {
-                // 一様サンプリングパスが可視だった場合．
-                ++uniformCount;
+        const float TargetAcceptanceRate = 0.234f;
+        const float MinMutationSize = 1.0f / 1024;
+        for (int i = 0; i < numPhotonsPerChain; ++i) {
+            // JP: 一様サンプルが可視ならば現在の状態と交換し、不可視ならば現在の状態を変異させる。
+            // EN: exchange the current state with a uniform sample if it is visible, otherwise mutate the current state.
+            sampler.startProposal(ReplicaExchangeSampler::Mode::Uniform, 0.0f);
+            ++chain.numUniformSamples;
+            bool accepted = tracePhoton(chain, &chain.propResults);
+            if (accepted) {
+                ++chain.numVisibleUniformSamples;
             }
             else {
-                // 一様サンプリングパスが不可視だった場合は，前回のパスに戻して変異を行う．
-                sampler.rollBack();
-                ++mutationCount;
-                
-                sampler.initDimensions(ReplicaExchangeSampler::Mode::Mutation, mutationSize < 0.0f ? 0.0f : mutationSize);
-                V = photonTracing(wls, mem, results);
-                if (V != 0.0f)
-                    ++acceptedCount;
-                else
-                    success = false;
+                sampler.startProposal(ReplicaExchangeSampler::Mode::Mutation, stats.mutationSize);
+                ++stats.numMutations;
+                accepted = tracePhoton(chain, &chain.propResults);
+                if (accepted)
+                    ++stats.numAcceptedMutations;
                 
-                // 変異サイズを採択率に応じて適応的に変更する．
-                float acceptanceRate = float(acceptedCount) / mutationCount;
-                cMutationSize += (acceptanceRate - targetAcceptanceRate) / mutationCount;
+                // JP: 採択率が目標値に近づくように変異の大きさを調整する。
+                // EN: adapt the mutation size so that the acceptance rate approaches the target.
+                float acceptanceRate = float(stats.numAcceptedMutations) / stats.numMutations;
+                stats.mutationSize += (acceptanceRate - TargetAcceptanceRate) / stats.numMutations;
+                stats.mutationSize = std::min(std::max(stats.mutationSize, MinMutationSize), 1.0f);
             }
             
-            if (success) {
-                // 一様サンプリングもしくは変異によってパスを変化させることに成功した場合．
-                // 新たなパスの寄与の蓄積と今後のための寄与の保存を行う．
-                for (int j = 0; j < results.size(); ++j)
-                    sensor->add(threadID, results[j].imgX, results[j].imgY, wls, results[j].contribution);
-                
-                prevResults.resize(results.size());
-                std::copy(results.begin(), results.end(), prevResults.begin());
-                
-                sampler.clearStack();
-            }
-            else {
-                // パスの変化に失敗した場合は前回の寄与をそのまま蓄積する．
-                for (int j = 0; j < prevResults.size(); ++j)
-                    sensor->add(threadID, prevResults[j].imgX, prevResults[j].imgY, wls, prevResults[j].contribution);
-                
-                sampler.rollBack();
+            if (accepted) {
+                sampler.accept();
+                std::swap(chain.curResults, chain.propResults);
             }
             
-            mem.reset();
+            // JP: 棄却された場合は現在の状態の寄与を再び蓄積する。
+            // EN: accumulate the contributions of the current state again when rejected.
+            for (int j = 0; j < chain.curResults.size(); ++j) {
+                const ResultRecord &record = chain.curResults[j];
+                sensor->add(chainIdx, record.imgX, record.imgY, wls, record.contribution);
+            }
         }
-        mutationSize = cMutationSize;
+        reporter->update(threadID);
     }
     
-    float AMCMCPPMRenderer::PhotonSplattingJob::photonTracing(const WavelengthSamples &wls, ArenaAllocator &mem, std::vector<ResultRecord> &results) {
-        float I = 0.0f;
+    bool AMCMCPPMRenderer::Job::tracePhoton(MCMCChain &chain, std::vector<ResultRecord>* results) const {
+        ReplicaExchangeSampler &sampler = chain.sampler;
+        ArenaAllocator &mem = *chain.mem;
+        const int16_t wlHint = wls.selectedLambdaIndex;
+        const float kernelNormalization = 1.0f / (M_PI * hitpointGrid->radius() * hitpointGrid->radius());
+        results->clear();
         
         LightPrimarySample psLight = sampler.getLightPrimarySample();
-        Light light;
-        float lightProb;
-        scene->selectLight(psLight.uLight, &light, &lightProb);
-        
-        LightPosQuery xpQuery(time, wls);
-        LightPosSample xpSample(psLight.uPosition[0], psLight.uPosition[1]);
-        LightPosQueryResult xpResult;
-        EDFQuery LeQuery;
-        EDFSample LeSample(psLight.uComponent, psLight.uDirection[0], psLight.uDirection[1]);
-        EDFQueryResult LeResult;
-        SampledSpectrum M = light.sample(xpQuery, xpSample, &xpResult);
-        EDF* edf = xpResult.surfPt.createEDF(wls, mem);
-        SampledSpectrum Le = M * edf->sample(LeQuery, LeSample, &LeResult);
         
-        SampledSpectrum alpha = Le / (lightProb * xpResult.areaPDF * LeResult.dirPDF) * std::fabs(LeResult.dir_sn.z) / numPhotons;
-        Vector3D dirOut = xpResult.surfPt.shadingFrame.fromLocal(LeResult.dir_sn);
-        Ray ray(xpResult.surfPt.p + Ray::Epsilon * dirOut, dirOut, time);
-        float initY = alpha.luminance();
-        uint32_t pathLength = 0;
-        
-        std::vector<Particle*> hitpoints;
-        while (true) {
-            ++pathLength;
-            Intersection isect;
-            SurfacePoint surfPt;
-            if (!scene->intersect(ray, &isect) || std::isinf(ray.distMax))
+        // select one light from all the lights in the scene.
+        float lightProb;
+        SurfaceLight light;
+        scene->selectSurfaceLight(psLight.uLight, time, &light, &lightProb);
+        SLRAssert(std::isfinite(lightProb), "lightProb: unexpected value detected: %f", lightProb);
+        
+        // sample a ray with its radiance (emittance, EDF value) from the selected light.
+        LightPosQuery lightPosQuery(time, wls);
+        SurfaceLightPosQueryResult lightPosResult;
+        EDFQuery edfQuery;
+        EDFQueryResult edfResult;
+        EDF* edf;
+        SampledSpectrum Le0, Le1;
+        Ray ray;
+        float epsilon;
+        light.sampleRay(lightPosQuery, SurfaceLightPosSample(psLight.uPosition[0], psLight.uPosition[1]),
+                        edfQuery, EDFSample(psLight.uComponent, psLight.uDirection[0], psLight.uDirection[1]), mem,
+                        &lightPosResult, &Le0, &edf, &edfResult, &Le1, &ray, &epsilon);
+        
+        SampledSpectrum alpha = Le0 * Le1 * (lightPosResult.surfPt.calcCosTerm(ray.dir) / (lightProb * lightPosResult.areaPDF * edfResult.dirPDF));
+        
+        WavelengthSamples pathWLs = wls;
+        RaySegment segment(epsilon);
+        SurfaceInteraction si;
+        SurfacePoint surfPt;
+        ThreadStatistics &threadStats = *currentThreadStatistics();
+        if (edfResult.dirPDF > 0.0f)
+            threadStats.add(StatCounter::LightRays);
+        while (edfResult.dirPDF > 0.0f && scene->intersect(ray, segment, &si)) {
+            si.calculateSurfacePoint(&surfPt);
+            if (surfPt.atInfinity())
                 break;
-            isect.getSurfacePoint(&surfPt);
             
-            // FIXME: should I consider the delta check using hitpoint's BSDF?
-            BSDF* bsdf = surfPt.createBSDF(wls, mem);
+            Vector3D dirOut_sn = surfPt.toLocal(-ray.dir);
+            Normal3D gNorm_sn = surfPt.getLocalGeometricNormal();
+            BSDF* bsdf = surfPt.createBSDF(pathWLs, mem);
+            
+            // JP: 向きの大きく異なる面のヒットポイントには寄与を与えない。
+            // EN: do not give contributions to hitpoints on surfaces with largely different orientations.
             if (bsdf->hasNonDelta()) {
-                hpMap->queryHitpoints(surfPt.p, surfPt.gNormal, radius, hitpoints);
-                float kernelWeight = 1.0f / (M_PI * radius * radius);
-                for (int i = 0; i < hitpoints.size(); ++i) {
-                    if (!hitpoints[i])
-                        continue;
-                    Hitpoint &hp = *(Hitpoint*)hitpoints[i];
-                    Vector3D dirIn_sn = hp.shadingFrame.toLocal(-ray.dir);
-                    Normal3D gNorm_sn = hp.shadingFrame.toLocal(hp.gNormal);
-                    BSDFQuery queryBSDF(dirIn_sn, gNorm_sn, wls.selectedLambda);
-                    SampledSpectrum fs = hp.bsdf->evaluate(queryBSDF, hp.dirOut_sn);
-                    SampledSpectrum contribution = hp.weight * fs * alpha * kernelWeight * std::fabs(dirIn_sn.z / dot(Vector3D(surfPt.gNormal), ray.dir));
-                    SLRAssert(!contribution.hasInf() && !contribution.hasNaN(), "contribution: unexpected value detected: %s",
-                              contribution.toString().c_str());
-                    results.emplace_back(hp.imgX, hp.imgY, contribution);
-                    I = 1.0;
-                }
+                Normal3D gNormal = surfPt.getGeometricNormal();
+                Vector3D dirIn = -ray.dir;
+                auto splat = [&](const Hitpoint &hp) {
+                    if (dot(Vector3D(hp.gNormal), gNormal) < 0.707f || hp.calcCosTerm(dirIn) == 0.0f)
+                        return;
+                    SampledSpectrum revFs;
+                    SampledSpectrum fs = hp.evaluateDDF(hp.toLocal(dirIn), wlHint, &revFs);
+                    if (fs == SampledSpectrum::Zero)
+                        return;
+                    SampledSpectrum contribution = hp.weight * fs * alpha * kernelNormalization;
+                    SLRAssert(contribution.allFinite(), "contribution: unexpected value detected: %s", contribution.toString().c_str());
+                    if (hp.lambdaSelected || pathWLs.wavelengthSelected())
+                        contribution[wlHint] *= WavelengthSamples::NumComponents;
+                    results->emplace_back(hp.imgX, hp.imgY, contribution);
+                };
+                hitpointGrid->query(surfPt.getPosition(), splat);
             }
             
-            Vector3D dirIn_sn = surfPt.shadingFrame.toLocal(-ray.dir);
-            Normal3D gNorm_sn = surfPt.shadingFrame.toLocal(surfPt.gNormal);
-            
-            // TODO: consider adjoint correction.
             PathPrimarySample psPath = sampler.getPathPrimarySample();
-            BSDFQuery fsQuery(dirIn_sn, gNorm_sn, wls.selectedLambda);
-            BSDFSample fsSample(psPath.uComponent, psPath.uDirection[0], psPath.uDirection[1]);
+            BSDFQuery fsQuery(dirOut_sn, gNorm_sn, wlHint, DirectionType::All, false, true);
             BSDFQueryResult fsResult;
-            SampledSpectrum fs = bsdf->sample(fsQuery, fsSample, &fsResult);
+            SampledSpectrum fs = bsdf->sample(fsQuery, BSDFSample(psPath.uComponent, psPath.uDirection[0], psPath.uDirection[1]), &fsResult);
             if (fs == SampledSpectrum::Zero || fsResult.dirPDF == 0.0f)
                 break;
-            alpha *= fs * (std::fabs(fsResult.dir_sn.z) / fsResult.dirPDF);
-            SLRAssert(!alpha.hasInf() && !alpha.hasNaN(), "alpha: unexpected value detected: %s", alpha.toString().c_str());
-            
-            dirOut = surfPt.shadingFrame.fromLocal(fsResult.dir_sn);
-            ray = Ray(surfPt.p + Ray::Epsilon * dirOut, dirOut, ray.time);
+            if (fsResult.sampledType.isDispersive() && !pathWLs.wavelengthSelected())
+                pathWLs.flags |= WavelengthSamples::WavelengthIsSelected;
+            Vector3D vecIn = surfPt.fromLocal(fsResult.dirLocal);
+            SampledSpectrum weight = fs * (surfPt.calcCosTerm(vecIn) / fsResult.dirPDF);
             
             // Russian roulette
-            float continueProb = std::min(alpha.luminance() / initY, 1.0f);
-            if (psPath.uRR < continueProb)
-                alpha /= continueProb;
-            else
+            float RRProb = std::min(weight.importance(wlHint), 1.0f);
+            if (psPath.uRR < RRProb) {
+                weight /= RRProb;
+            }
+            else {
+                threadStats.add(StatCounter::RussianRouletteTerminations);
                 break;
+            }
+            
+            alpha *= weight;
+            ray = Ray(surfPt.getPosition(), vecIn, ray.time);
+            segment = RaySegment(Ray::Epsilon);
+            si = SurfaceInteraction();
+            threadStats.add(StatCounter::LightRays);
         }
         
-        return I;
-    }    
+        threadStats.recordArenaUsage(mem.bytesInUse());
+        mem.reset();
+        return !results->empty();
+    }
 }
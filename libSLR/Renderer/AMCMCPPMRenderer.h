@@ -5,94 +5,61 @@
 //  Copyright (c) 2015年 渡部 心. All rights reserved.
 //
 
-#ifndef __SLR__AMCMCPPMRenderer__
-#define __SLR__AMCMCPPMRenderer__
+#ifndef __SLR_AMCMCPPMRenderer__
+#define __SLR_AMCMCPPMRenderer__
 
 #include "../defines.h"
-#include "../references.h"
-#include "../Core/Renderer.h"
+#include "../declarations.h"
+#include "../Core/renderer.h"
+#include "../Core/light_path_sampler.h"
 
-#include "../Core/geometry.h"
-#include "../Core/RandomNumberGenerator.h"
-#include "../Core/directional_distribution_functions.h"
+#include "../Core/subpath_vertex.h"
+#include "../Core/PointHashGrid.h"
+#include "../RNG/XORShiftRNG.h"
 
 namespace SLR {
-    struct SLR_API Particle {
-        Point3D position;
-        BoundingBox3D::Axis plane;
-        Particle() { };
-        Particle(const Point3D &pos) : position(pos) { };
-    };
-    
-    class SLR_API KDTree {
-    protected:
-        BoundingBox3D m_BBox;
-        uint32_t m_numStored;
-        uint32_t m_numHalfStored;
-        
-        std::vector<Particle*> m_ptrParticles;
-        
-        void balanceSegment(std::vector<Particle*> &balanced, uint32_t index, uint32_t start, uint32_t end);
-        void locateParticlesInternal(uint32_t index, const Point3D &queryPos, float radius2, std::vector<Particle*> &particlesFound) const;
-    public:
-        void initialize(uint64_t expectedSize);
-        uint32_t numStored() const { return m_numStored; };
-        void balance();
-        void locateParticles(const Point3D &queryPos, float radius2, std::vector<Particle*> &particlesFound) const {
-            particlesFound.clear();
-            if (m_numStored < 1)
-                return;
-            locateParticlesInternal(1, queryPos, radius2, particlesFound);
-        };
-    };
-    
+    // JP: Adaptive Markov Chain Monte Carlo Progressive Photon Mapping。(Hachisuka and Jensen 2011)
+    //     各パスで視点からのレイトレーシングによりピクセルごとにヒットポイントを格納した後、
+    //     コアごとに1本のマルコフ連鎖でフォトンパスを生成し、近傍のヒットポイントに寄与をスプラットする。
+    //     各連鎖はヒットポイントに寄与する(可視な)フォトンパスを目標分布とし、一様サンプルとのレプリカ交換と
+    //     採択率に応じて大きさを調整する変異を組み合わせる。可視なパスの割合は一様サンプルから推定して正規化に用いる。
+    //     ヒットポイントはパスごとに変わるため、各連鎖はパスの始めに可視な一様サンプルから開始し直す。
+    // EN: Adaptive Markov Chain Monte Carlo Progressive Photon Mapping. (Hachisuka and Jensen 2011)
+    //     Each pass stores hitpoints per pixel by ray tracing from the eye,
+    //     then generates photon paths with one Markov chain per core and splats their contributions to nearby hitpoints.
+    //     Each chain targets photon paths contributing to hitpoints (visible paths), combining replica exchange with uniform samples
+    //     and mutations whose size is adapted to the acceptance rate. The fraction of visible paths is estimated from the uniform samples for normalization.
+    //     Since hitpoints change in each pass, each chain restarts from a visible uniform sample at the beginning of a pass.
     class SLR_API AMCMCPPMRenderer : public Renderer {
-        struct Hitpoint : public Particle {
+        struct Hitpoint : public SubPathVertex {
             float imgX, imgY;
-            Normal3D gNormal;
-            Vector3D dirOut_sn;
             SampledSpectrum weight;
-            const BSDF* bsdf;
-            ReferenceFrame shadingFrame;
+            bool lambdaSelected;
             
-            Hitpoint(float px, float py, const Point3D &pos, const Normal3D &gn, const Vector3D &dirO_sn, const SampledSpectrum &w, const BSDF* f, const ReferenceFrame &frame) :
-            Particle(pos), imgX(px), imgY(py), gNormal(gn), dirOut_sn(dirO_sn), weight(w), bsdf(f), shadingFrame(frame) { };
+            Hitpoint(const SubPathVertex &vertex, float px, float py, const SampledSpectrum &_weight, bool _lambdaSelected) :
+            SubPathVertex(vertex), imgX(px), imgY(py), weight(_weight), lambdaSelected(_lambdaSelected) {}
         };
         
-        class HitpointMap : public KDTree {
-            std::vector<std::vector<Hitpoint>> m_points;
-            uint32_t m_numThreads;
-        public:
-            HitpointMap() {};
-            ~HitpointMap() {};
-            
-            void initialize(uint32_t numThreads, uint32_t numPixels);
-            void store(uint32_t thread, float imgX, float imgY,
-                       const SampledSpectrum &weight, const Point3D &pos, const Normal3D &gn, const Vector3D &dir_sn,
-                       const BSDF* f, const ReferenceFrame &frame);
-            void build();
-            void queryHitpoints(const Point3D &pos, const Normal3D &gn_sn, float radius, std::vector<Particle*> &pointsFound) const;
+        // JP: スレッドごとに1パス分のヒットポイントを保持する配列。偽共有を避けるためキャッシュラインの大きさに揃える。
+        // EN: per-thread array holding hitpoints for one pass. This is aligned to the cache line size to avoid false sharing.
+        struct alignas(SLR_L1_Cacheline_Size) HitpointStorage {
+            SubPath<Hitpoint> hitpoints;
         };
         
         struct PrimarySample {
         protected:
-            void adaptiveMutateElement(float *value, float u1, float u2, float size) {
+            static void adaptiveMutateElement(float* value, float u1, float u2, float size) {
                 if (u1 < 0.5f) {
-                    *value -= powf(u2, 1.0f / size + 1.0f);
-                    if (*value < 0.0f) *value += 1.0f;
+                    *value -= std::pow(u2, 1.0f / size + 1.0f);
+                    if (*value < 0.0f)
+                        *value += 1.0f;
                 }
                 else {
-                    *value += powf(u2, 1.0f / size + 1.0f);
-                    if (*value >= 1.0f) *value -= 1.0f;
+                    *value += std::pow(u2, 1.0f / size + 1.0f);
+                    if (*value >= 1.0f)
+                        *value -= 1.0f;
                 }
-            };
-        public:
-            uint64_t modifiedTime;
-            
-            PrimarySample() : modifiedTime(0) { };
-            
-            virtual void init(RandomNumberGenerator &rng) = 0;
-            virtual void adaptiveMutate(RandomNumberGenerator &rng, float size) = 0;
+            }
         };
         
         struct PathPrimarySample : public PrimarySample {
@@ -105,14 +72,14 @@ namespace SLR {
                 uDirection[0] = rng.getFloat0cTo1o();
                 uDirection[1] = rng.getFloat0cTo1o();
                 uRR = rng.getFloat0cTo1o();
-            };
+            }
             
             void adaptiveMutate(RandomNumberGenerator &rng, float size) {
                 adaptiveMutateElement(&uComponent, rng.getFloat0cTo1o(), rng.getFloat0cTo1o(), size);
                 adaptiveMutateElement(&uDirection[0], rng.getFloat0cTo1o(), rng.getFloat0cTo1o(), size);
                 adaptiveMutateElement(&uDirection[1], rng.getFloat0cTo1o(), rng.getFloat0cTo1o(), size);
                 adaptiveMutateElement(&uRR, rng.getFloat0cTo1o(), rng.getFloat0cTo1o(), size);
-            };
+            }
         };
         
         struct LightPrimarySample : public PrimarySample {
@@ -128,7 +95,7 @@ namespace SLR {
                 uComponent = rng.getFloat0cTo1o();
                 uDirection[0] = rng.getFloat0cTo1o();
                 uDirection[1] = rng.getFloat0cTo1o();
-            };
+            }
             
             void adaptiveMutate(RandomNumberGenerator &rng, float size) {
                 adaptiveMutateElement(&uLight, rng.getFloat0cTo1o(), rng.getFloat0cTo1o(), size);
@@ -137,51 +104,80 @@ namespace SLR {
                 adaptiveMutateElement(&uComponent, rng.getFloat0cTo1o(), rng.getFloat0cTo1o(), size);
                 adaptiveMutateElement(&uDirection[0], rng.getFloat0cTo1o(), rng.getFloat0cTo1o(), size);
                 adaptiveMutateElement(&uDirection[1], rng.getFloat0cTo1o(), rng.getFloat0cTo1o(), size);
-            };
+            }
         };
         
+        // JP: 現在の状態と提案状態の主標本を保持する。
+        //     パスの次元は遅延評価され、現在の状態がまだ持たない次元は変異の前に一様乱数で補う。
+        // EN: holds the primary samples of the current state and the proposed state.
+        //     Path dimensions are lazily evaluated, and dimensions the current state does not have yet are filled with uniform random numbers before mutation.
         class ReplicaExchangeSampler {
             RandomNumberGenerator* m_rng;
-            uint64_t m_globalTime;
-            uint64_t m_uniformTime;
             bool m_uniform;
-            float m_mSize;
-            std::vector<float> m_mSizeHistory;
-            uint32_t m_histIdx;
+            float m_mutationSize;
             
-            LightPrimarySample m_lightSample;
-            LightPrimarySample m_lightStack;
-            
-            uint32_t m_curPathDim;
-            std::vector<PathPrimarySample> m_pathSamples;
-            std::stack<PathPrimarySample> m_pathStack;
+            LightPrimarySample m_curLightSample;
+            LightPrimarySample m_propLightSample;
+            std::vector<PathPrimarySample> m_curPathSamples;
+            std::vector<PathPrimarySample> m_propPathSamples;
+            uint32_t m_numPropPathDims;
         public:
             enum class Mode {
                 Uniform,
                 Mutation
             };
             
-            ReplicaExchangeSampler() { };
-            ReplicaExchangeSampler(RandomNumberGenerator* rng);
-            ~ReplicaExchangeSampler() { };
+            ReplicaExchangeSampler() : m_rng(nullptr), m_uniform(true), m_mutationSize(1.0f), m_numPropPathDims(0) {}
+            ReplicaExchangeSampler(RandomNumberGenerator* rng) : m_rng(rng), m_uniform(true), m_mutationSize(1.0f), m_numPropPathDims(0) {}
             
+            // JP: パスの生成前に呼ぶ。
+            // EN: call before generating a path.
+            void startProposal(Mode mode, float mutationSize);
             LightPrimarySample getLightPrimarySample();
-            PathPrimarySample getPathPrimarySample() ;
-            void initDimensions(Mode mode, float size);
-            void clearStack();
-            void rollBack();
+            PathPrimarySample getPathPrimarySample();
+            // JP: 提案状態を採択して現在の状態とする。棄却時は何もしなくてよい。
+            // EN: accept the proposed state as the current state. Nothing needs to be done on rejection.
+            void accept();
         };
         
-        struct DistributedRTJob {
+        struct ResultRecord {
+            float imgX, imgY;
+            SampledSpectrum contribution;
+            ResultRecord(float px, float py, const SampledSpectrum &c) : imgX(px), imgY(py), contribution(c) {}
+        };
+        
+        // JP: 1本のマルコフ連鎖の状態とパス内の一様サンプルの統計。連鎖ごとに独立した乱数生成器とメモリアロケーターを持つ。
+        // EN: state of a Markov chain and statistics of uniform samples in a pass. Each chain has its own random number generator and memory allocator.
+        struct alignas(SLR_L1_Cacheline_Size) MCMCChain {
+            XORShiftRNG rng;
+            ReplicaExchangeSampler sampler;
+            ArenaAllocator* mem;
+            std::vector<ResultRecord> curResults;
+            std::vector<ResultRecord> propResults;
+            
+            uint64_t numUniformSamples;
+            uint64_t numVisibleUniformSamples;
+        };
+        
+        // JP: パスを跨いで引き継ぐ連鎖の変異の統計と大きさ。チェックポイントに含める。
+        // EN: statistics and size of mutations of a chain carried over across passes. This is included in checkpoints.
+        struct ChainStatistics {
+            uint64_t numMutations;
+            uint64_t numAcceptedMutations;
+            float mutationSize;
+        };
+        
+        struct Job {
             const Scene* scene;
-            WavelengthSamples wls;
-            ArenaAllocator* mems;
-            RandomNumberGenerator** rngs;
-            HitpointMap* hpMap;
             
-            const Camera* camera;
-            float time;
+            ArenaAllocator* eyeMems;
+            LightPathSampler** pathSamplers;
+            HitpointStorage* hitpointStorages;
+            const PointHashGrid<Hitpoint>* hitpointGrid;
+            MCMCChain* chains;
+            ChainStatistics* chainStats;
             
+            const Camera* camera;
             ImageSensor* sensor;
             uint32_t imageWidth;
             uint32_t imageHeight;
@@ -189,45 +185,38 @@ namespace SLR {
             uint32_t numPixelY;
             uint32_t basePixelX;
             uint32_t basePixelY;
-            
-            void kernel(uint32_t threadID);
-            SampledSpectrum record(uint32_t threadID, const Scene &scene, const WavelengthSamples &initWLs, float px, float py, const Ray &initRay, const SampledSpectrum &initAlpha,
-                                   RandomNumberGenerator &rng, ArenaAllocator &mem) const;
-        };
-        struct PhotonSplattingJob {
-            struct ResultRecord {
-                float imgX, imgY;
-                SampledSpectrum contribution;
-                ResultRecord() { };
-                ResultRecord(float px, float py, const SampledSpectrum &c) : imgX(px), imgY(py), contribution(c) { };
-            };
-            const Scene* scene;
+            uint32_t sampleIndex;
+            uint32_t numPhotonsPerChain;
+            float time;
             WavelengthSamples wls;
-            float radius;
-            ArenaAllocator* mems;
-            HitpointMap* hpMap;
-            uint32_t numPhotons;
+            float selectWLPDF;
             
-            ImageSensor* sensor;
-            float time;
+            RenderStatistics* renderStats;
+            ProgressReporter* reporter;
             
-            ReplicaExchangeSampler sampler;
-            uint64_t uniformCount;
-            uint64_t mutationCount;
-            uint64_t acceptedCount;
-            float mutationSize;
-            std::vector<ResultRecord> prevResults;
+            template <class SamplerType>
+            void eyeKernel(uint32_t threadID);
+            void chainKernel(uint32_t chainIdx, uint32_t threadID);
             
-            void kernel(uint32_t threadID);
-            float photonTracing(const WavelengthSamples &wls, ArenaAllocator &mem, std::vector<ResultRecord> &results);
+            // JP: 連鎖の提案状態からフォトンパスを生成し、ヒットポイントへの寄与を記録する。寄与があった(可視な)場合にtrueを返す。
+            // EN: generate a photon path from the proposed state of a chain and record its contributions to hitpoints. This returns true if it has contributions (visible).
+            bool tracePhoton(MCMCChain &chain, std::vector<ResultRecord>* results) const;
         };
         
         uint32_t m_numPhotonsPerPass;
         uint32_t m_numPasses;
+        LightPathSamplerType m_samplerType;
+        float m_initialRadius;
+        float m_radiusReductionRate;
     public:
-        AMCMCPPMRenderer(uint32_t numPhotonsPerPass, uint32_t numPasses);
+        // JP: initialRadiusはシーンの外接球の半径に対する初期半径の比率、
+        //     radiusReductionRateはパスごとの半径縮小の度合いを決めるプログレッシブフォトンマッピングのα(0, 1)である。
+        // EN: initialRadius is the ratio of the initial radius to the radius of the scene's bounding sphere,
+        //     radiusReductionRate is the alpha (0, 1) of progressive photon mapping which determines how the radius is reduced in each pass.
+        AMCMCPPMRenderer(uint32_t numPhotonsPerPass, uint32_t numPasses, LightPathSamplerType samplerType = LightPathSamplerType::Independent,
+                         float initialRadius = 0.003f, float radiusReductionRate = 2.0f / 3.0f);
         void render(const Scene &scene, const RenderSettings &settings) const override;
-    };    
+    };
 }
 
-#endif
+#endif /* __SLR_AMCMCPPMRenderer__ */
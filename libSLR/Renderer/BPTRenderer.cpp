@@ -12,99 +12,186 @@
 #include "../Core/camera.h"
 #include "../Core/light_path_sampler.h"
 #include "../Core/ImageSensor.h"
+#include "../Core/ImageExporter.h"
 #include "../Core/RenderSettings.h"
 #include "../Core/ProgressReporter.h"
+#include "../Core/RenderStatistics.h"
+#include "../Core/PassScheduler.h"
+#include "../Core/bidirectional_mis_weights.h"
 #include "../RNG/XORShiftRNG.h"
 #include "../Scene/Scene.h"
 #include "../Helper/ThreadPool.h"
 
 namespace SLR {
-    BPTRenderer::BPTRenderer(uint32_t spp) : m_samplesPerPixel(spp) {
+    BPTRenderer::BPTRenderer(uint32_t spp, LightPathSamplerType samplerType) : m_samplesPerPixel(spp), m_samplerType(samplerType) {
     }
     
     void BPTRenderer::render(const Scene &scene, const RenderSettings &settings) const {
         uint32_t numThreads = settings.getInt(RenderSettingItem::NumThreads);
         XORShiftRNG topRand(settings.getInt(RenderSettingItem::RNGSeed));
         ArenaAllocator* mems = new ArenaAllocator[numThreads];
-        IndependentLightPathSampler* samplers = new IndependentLightPathSampler[numThreads];
+        LightPathSampler** samplers = new LightPathSampler*[numThreads];
         for (int i = 0; i < numThreads; ++i) {
             new (mems + i) ArenaAllocator();
-            new (samplers + i) IndependentLightPathSampler(topRand.getUInt());
+            samplers[i] = createLightPathSampler(m_samplerType, settings.getInt(RenderSettingItem::RNGSeed), topRand.getUInt());
         }
+        // JP: サブパスの頂点配列はスレッドごとに確保し、全てのタイル・パスで再利用する。
+        // EN: allocate subpath vertex arrays per thread, and reuse them for all the tiles and passes.
+        SubPathStorage* subPathStorages = (SubPathStorage*)SLR_memalign(sizeof(SubPathStorage) * numThreads, SLR_L1_Cacheline_Size);
+        for (int i = 0; i < numThreads; ++i)
+            new (subPathStorages + i) SubPathStorage();
         
         const Camera* camera = scene.getCamera();
         ImageSensor* sensor = camera->getSensor();
         
+        // JP: サンプラーの具体的な型に特殊化したカーネルをここで選択する。
+        //     カーネル内のサンプラー呼び出しは静的に束縛されてインライン化される。
+        // EN: select the kernel specialized for the concrete sampler type here.
+        //     Sampler calls in the kernel are statically bound and inlined.
+        void (Job::*kernel)(uint32_t) = nullptr;
+        switch (m_samplerType) {
+            case LightPathSamplerType::Independent:
+                kernel = &Job::kernel<IndependentLightPathSampler>;
+                break;
+            case LightPathSamplerType::Sobol:
+                kernel = &Job::kernel<SobolLightPathSampler>;
+                break;
+            case LightPathSamplerType::Halton:
+                kernel = &Job::kernel<HaltonLightPathSampler>;
+                break;
+            default:
+                SLRAssert_ShouldNotBeCalled();
+                break;
+        }
+        
         Job job;
         job.scene = &scene;
         
         job.mems = mems;
         job.pathSamplers = samplers;
+        job.subPathStorages = subPathStorages;
         
         job.camera = camera;
         job.sensor = sensor;
+        job.rngSeed = settings.getInt(RenderSettingItem::RNGSeed);
         job.timeStart = settings.getFloat(RenderSettingItem::TimeStart);
         job.timeEnd = settings.getFloat(RenderSettingItem::TimeEnd);
         job.imageWidth = settings.getInt(RenderSettingItem::ImageWidth);
         job.imageHeight = settings.getInt(RenderSettingItem::ImageHeight);
+        job.validateMISWeights = settings.getBool(RenderSettingItem::ValidateMISWeights);
         job.numPixelX = sensor->tileWidth();
         job.numPixelY = sensor->tileHeight();
         
         sensor->init(job.imageWidth, job.imageHeight);
-        sensor->addSeparatedBuffers(numThreads);
+        // JP: ライトトレーシングの寄与はタイルごとに記録し、パスの終わりにタイルの順で1つの分離されたバッファへ加算する。
+        //     どのスレッドがどのタイルを処理しても加算の順序が変わらず、スレッド数によらず同じ画像になる。
+        // EN: record light tracing contributions per tile, and add them to a single separated buffer in tile order at the end of a pass.
+        //     The order of additions doesn't depend on which thread processes which tile, so the image is the same regardless of the number of threads.
+        sensor->addSeparatedBuffers(1);
+        std::vector<SensorSplat>* tileSplats = new std::vector<SensorSplat>[sensor->numTileX() * sensor->numTileY()];
+        job.tileSplats = tileSplats;
         
         printf("Bidirectional Path Tracing: %u[spp]\n", m_samplesPerPixel);
-        ProgressReporter reporter;
+        RenderStatistics stats(numThreads);
+        job.stats = &stats;
+        ProgressReporter reporter(numThreads, settings.getInt(RenderSettingItem::ProgressFD));
         job.reporter = &reporter;
         
-        reporter.pushJob("Rendering", m_samplesPerPixel * sensor->numTileX() * sensor->numTileY());
+        PassScheduler scheduler(settings, m_samplesPerPixel);
+        scheduler.begin(sensor, samplers, numThreads);
+        
+        // JP: プログレッシブモードでは総作業量が分からないため、次の画像出力までの作業のみを表示する。
+        // EN: The total work is unknown in progressive mode, so only the work until the next export is shown.
+        uint32_t numTiles = sensor->numTileX() * sensor->numTileY();
+        uint32_t firstPass = std::min(scheduler.numPasses(), scheduler.maxNumPasses());
+        if (!scheduler.isProgressive())
+            reporter.pushJob("Rendering", (scheduler.maxNumPasses() - firstPass) * numTiles, scheduler.startTime());
         char nextTitle[32];
-        snprintf(nextTitle, sizeof(nextTitle), "To %5uspp", 1);
-        reporter.pushJob(nextTitle, 1 * sensor->numTileX() * sensor->numTileY());
-        uint32_t imgIdx = 0;
-        uint32_t exportPass = 1;
-        for (int s = 0; s < m_samplesPerPixel; ++s) {
-            ThreadPool threadPool(numThreads);
-            for (int ty = 0; ty < sensor->numTileY(); ++ty) {
-                for (int tx = 0; tx < sensor->numTileX(); ++tx) {
-                    job.basePixelX = tx * sensor->tileWidth();
-                    job.basePixelY = ty * sensor->tileHeight();
-                    threadPool.enqueue(std::bind(&Job::kernel, job, std::placeholders::_1));
+        snprintf(nextTitle, sizeof(nextTitle), "To %5uspp", scheduler.nextExportPass());
+        reporter.pushJob(nextTitle, (scheduler.nextExportPass() - firstPass) * numTiles, scheduler.startTime());
+        uint32_t imgIdx = scheduler.numExportedImages();
+        ImageExporter exporter;
+        for (int s = firstPass; s < scheduler.maxNumPasses(); ++s) {
+            job.sampleIndex = s;
+            {
+                ScopedPhaseTimer timer(&stats, StatPhase::Rendering);
+                ThreadPool threadPool(numThreads);
+                for (int ty = 0; ty < sensor->numTileY(); ++ty) {
+                    for (int tx = 0; tx < sensor->numTileX(); ++tx) {
+                        job.basePixelX = tx * sensor->tileWidth();
+                        job.basePixelY = ty * sensor->tileHeight();
+                        threadPool.enqueue(std::bind(kernel, job, std::placeholders::_1));
+                    }
+                }
+                threadPool.wait();
+                for (int i = 0; i < numTiles; ++i) {
+                    sensor->addSplats(0, tileSplats[i]);
+                    tileSplats[i].clear();
                 }
             }
-            threadPool.wait();
             
-            if ((s + 1) == exportPass) {
+            stats.finishPass();
+            bool finished;
+            {
+                ScopedPhaseTimer timer(&stats, StatPhase::PassFinalization);
+                finished = !scheduler.finishPass(sensor);
+            }
+            if (scheduler.shouldExport(finished)) {
+                reporter.skipRemainingWork();
                 reporter.popJob();
                 
                 reporter.beginOtherThreadPrint();
                 char filename[256];
-                sprintf(filename, "%03u.bmp", imgIdx);
-                double elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(reporter.elapsed()).count();
-                sensor->saveImage(filename, settings.getFloat(RenderSettingItem::Brightness) / (s + 1));
-                printf("%u samples: %s, %g[s]\n", exportPass, filename, elapsed * 0.001f);
+                sprintf(filename, "%03u.%s", imgIdx, sensor->imageFileExtension());
+                float elapsed = scheduler.elapsedTime();
+                {
+                    ScopedPhaseTimer timer(&stats, StatPhase::ImageOutput);
+                    exporter.exportImage(*sensor, filename, settings.getFloat(RenderSettingItem::Brightness) / (s + 1 - scheduler.firstPass()));
+                }
+                printf("%u samples: %s, %g[s]\n", s + 1, filename, elapsed);
+                sprintf(filename, "%03u.json", imgIdx);
+                stats.writeJSON(filename, "BPT");
                 reporter.endOtherThreadPrint();
                 
                 ++imgIdx;
-                if ((s + 1) == m_samplesPerPixel)
+                if (finished)
                     break;
-                exportPass += exportPass;
-                snprintf(nextTitle, sizeof(nextTitle), "To %5uspp", exportPass);
-                reporter.pushJob(nextTitle, (exportPass >> 1) * sensor->numTileX() * sensor->numTileY());
+                scheduler.advanceExport();
+                snprintf(nextTitle, sizeof(nextTitle), "To %5uspp", scheduler.nextExportPass());
+                reporter.pushJob(nextTitle, (scheduler.nextExportPass() - (s + 1)) * numTiles, scheduler.startTime());
             }
         }
-        reporter.popJob();
+        if (!scheduler.isProgressive()) {
+            reporter.skipRemainingWork();
+            reporter.popJob();
+        }
         reporter.finish();
+        scheduler.printSummary();
         
+        for (int i = 0; i < numThreads; ++i)
+            delete samplers[i];
         delete[] samplers;
+        delete[] tileSplats;
+        for (int i = 0; i < numThreads; ++i)
+            subPathStorages[i].~SubPathStorage();
+        SLR_freealign(subPathStorages);
         delete[] mems;
     }
     
+    template <class SamplerType>
     void BPTRenderer::Job::kernel(uint32_t threadID) {
         ArenaAllocator &mem = mems[threadID];
-        IndependentLightPathSampler &pathSampler = pathSamplers[threadID];
+        SamplerType &pathSampler = static_cast<SamplerType &>(*pathSamplers[threadID]);
+        uint32_t tileIndex = (basePixelY / numPixelY) * sensor->numTileX() + basePixelX / numPixelX;
+        pathSampler.reseed(tilePassSeed(rngSeed, tileIndex, sampleIndex));
+        std::vector<SensorSplat> &splats = tileSplats[tileIndex];
+        BPTSubPath &lightVertices = subPathStorages[threadID].lightVertices;
+        BPTSubPath &eyeVertices = subPathStorages[threadID].eyeVertices;
+        threadStats = stats->threadStatistics(threadID);
+        ScopedThreadStatistics scopedStats(threadStats);
         for (int ly = 0; ly < numPixelY; ++ly) {
             for (int lx = 0; lx < numPixelX; ++lx) {
+                pathSampler.startPixelSample(basePixelX + lx, basePixelY + ly, sampleIndex);
                 float time = pathSampler.getTimeSample(timeStart, timeEnd);
                 PixelPosition p = pathSampler.getPixelPositionSample(basePixelX + lx, basePixelY + ly);
                 
@@ -140,12 +227,12 @@ namespace SLR {
                     
                     // register the first light vertex.
                     float lightAreaPDF = lightProb * lightPosResult.areaPDF;
-                    lightVertices.emplace_back(lightPosResult.surfPt, mem.create<EDFProxy>(edf, edfQuery),
+                    lightVertices.emplace_back(SubPathVertex(lightPosResult.surfPt, edf),
                                                Le0 / lightAreaPDF, 0.0f, lightAreaPDF, 1.0f, lightPosResult.posType, false);
                     
                     // create subsequent light subpath vertices by tracing in the scene.
                     SampledSpectrum alpha = lightVertices.back().alpha * Le1 * (lightPosResult.surfPt.calcCosTerm(ray.dir) / edfResult.dirPDF);
-                    generateSubPath(wls, alpha, ray, epsilon, edfResult.dirPDF, edfResult.dirType, edfResult.dir_sn.z, true, pathSampler, mem);
+                    generateSubPath(wls, alpha, ray, epsilon, edfResult.dirPDF, edfResult.dirType, edfResult.dir_sn.z, true, lightVertices, eyeVertices, pathSampler, mem);
                 }
                 
                 // eye subpath generation
@@ -163,12 +250,12 @@ namespace SLR {
                                       &lensResult, &We0, &idf, &WeResult, &We1, &ray, &epsilon);
                     
                     // register the first eye vertex.
-                    eyeVertices.emplace_back(lensResult.surfPt, mem.create<IDFProxy>(idf),
+                    eyeVertices.emplace_back(SubPathVertex(lensResult.surfPt, idf),
                                              We0 / (lensResult.areaPDF * selectWLPDF), 0.0f, lensResult.areaPDF, 1.0f, lensResult.posType, false);
                     
                     // create subsequent eye subpath vertices by tracing in the scene.
                     SampledSpectrum alpha = eyeVertices.back().alpha * We1 * (lensResult.surfPt.calcCosTerm(ray.dir) / WeResult.dirPDF);
-                    generateSubPath(wls, alpha, ray, epsilon, WeResult.dirPDF, WeResult.dirType, WeResult.dirLocal.z, false, pathSampler, mem);
+                    generateSubPath(wls, alpha, ray, epsilon, WeResult.dirPDF, WeResult.dirType, WeResult.dirLocal.z, false, lightVertices, eyeVertices, pathSampler, mem);
                 }
                 
                 // connection
@@ -182,28 +269,29 @@ namespace SLR {
                         // that are not included in the precomputed weights.
                         
                         float connectDist2;
-                        Vector3D connectionVector = lVtx.surfPt.getDirectionFrom(eVtx.surfPt.getPosition(), &connectDist2);
-                        float cosLightEnd = lVtx.surfPt.calcCosTerm(connectionVector);
-                        float cosEyeEnd = eVtx.surfPt.calcCosTerm(connectionVector);
+                        Vector3D connectionVector = lVtx.getDirectionFrom(eVtx.position, &connectDist2);
+                        float cosLightEnd = lVtx.calcCosTerm(connectionVector);
+                        float cosEyeEnd = eVtx.calcCosTerm(connectionVector);
                         float G = cosEyeEnd * cosLightEnd / connectDist2;
                         
-                        Vector3D lConnectVector = lVtx.surfPt.toLocal(-connectionVector);
+                        Vector3D lConnectVector = lVtx.toLocal(-connectionVector);
                         SampledSpectrum lRevDDF;
-                        SampledSpectrum lDDF = lVtx.ddf->evaluate(lConnectVector, &lRevDDF);
+                        SampledSpectrum lDDF = lVtx.evaluateDDF(lConnectVector, wlHint, &lRevDDF);
                         float eExtend2ndDirPDF;
-                        float lExtend1stDirPDF = lVtx.ddf->evaluatePDF(lConnectVector, &eExtend2ndDirPDF);
+                        float lExtend1stDirPDF = lVtx.evaluateDDFPDF(lConnectVector, wlHint, &eExtend2ndDirPDF);
                         
-                        Vector3D eConnectVector = eVtx.surfPt.toLocal(connectionVector);
+                        Vector3D eConnectVector = eVtx.toLocal(connectionVector);
                         SampledSpectrum eRevDDF;
-                        SampledSpectrum eDDF = eVtx.ddf->evaluate(eConnectVector, &eRevDDF);
+                        SampledSpectrum eDDF = eVtx.evaluateDDF(eConnectVector, wlHint, &eRevDDF);
                         float lExtend2ndDirPDF;
-                        float eExtend1stDirPDF = eVtx.ddf->evaluatePDF(eConnectVector, &lExtend2ndDirPDF);
+                        float eExtend1stDirPDF = eVtx.evaluateDDFPDF(eConnectVector, wlHint, &lExtend2ndDirPDF);
                         
                         SampledSpectrum connectionTerm = lDDF * G * eDDF;
                         if (connectionTerm == SampledSpectrum::Zero)
                             continue;
                         
-                        if (!scene->testVisibility(eVtx.surfPt, lVtx.surfPt, time))
+                        threadStats->add(StatCounter::ShadowRays);
+                        if (!scene->testVisibility(eVtx.position, lVtx.position, lVtx.atInfinity, time))
                             continue;
                         
                         if (lVtx.lambdaSelected || eVtx.lambdaSelected)
@@ -223,10 +311,10 @@ namespace SLR {
                             lExtend1stRRProb = s > 1 ? std::min((lDDF * cosLightEnd / lExtend1stDirPDF).importance(wlHint), 1.0f) : 1.0f;
                             
                             if (t > 1) {
-                                BPTVertex &eVtxNextToEnd = eyeVertices[t - 2];
+                                const BPTVertex &eVtxNextToEnd = eyeVertices[t - 2];
                                 float dist2;
-                                Vector3D dir2nd = eVtx.surfPt.getDirectionFrom(eVtxNextToEnd.surfPt.getPosition(), &dist2);
-                                lExtend2ndAreaPDF = lExtend2ndDirPDF * eVtxNextToEnd.surfPt.calcCosTerm(dir2nd) / dist2;
+                                Vector3D dir2nd = eVtx.getDirectionFrom(eVtxNextToEnd.position, &dist2);
+                                lExtend2ndAreaPDF = lExtend2ndDirPDF * eVtxNextToEnd.calcCosTerm(dir2nd) / dist2;
                                 lExtend2ndRRProb = std::min((eRevDDF * eVtx.cosIn / lExtend2ndDirPDF).importance(wlHint), 1.0f);
                             }
                         }
@@ -236,10 +324,10 @@ namespace SLR {
                             eExtend1stRRProb = t > 1 ? std::min((eDDF * cosEyeEnd / eExtend1stDirPDF).importance(wlHint), 1.0f) : 1.0f;
                             
                             if (s > 1) {
-                                BPTVertex &lVtxNextToEnd = lightVertices[s - 2];
+                                const BPTVertex &lVtxNextToEnd = lightVertices[s - 2];
                                 float dist2;
-                                Vector3D dir2nd = lVtxNextToEnd.surfPt.getDirectionFrom(lVtx.surfPt.getPosition(), &dist2);
-                                eExtend2ndAreaPDF = eExtend2ndDirPDF * lVtxNextToEnd.surfPt.calcCosTerm(dir2nd) / dist2;
+                                Vector3D dir2nd = lVtxNextToEnd.getDirectionFrom(lVtx.position, &dist2);
+                                eExtend2ndAreaPDF = eExtend2ndDirPDF * lVtxNextToEnd.calcCosTerm(dir2nd) / dist2;
                                 eExtend2ndRRProb = std::min((lRevDDF * lVtx.cosIn / eExtend2ndDirPDF).importance(wlHint), 1.0f);
                             }
                         }
@@ -252,7 +340,8 @@ namespace SLR {
                         // calculate MIS weight and store weighted contribution to a sensor.
                         
                         float MISWeight = calculateMISWeight(lExtend1stAreaPDF, lExtend1stRRProb, lExtend2ndAreaPDF, lExtend2ndRRProb,
-                                                             eExtend1stAreaPDF, eExtend1stRRProb, eExtend2ndAreaPDF, eExtend2ndRRProb, s, t);
+                                                             eExtend1stAreaPDF, eExtend1stRRProb, eExtend2ndAreaPDF, eExtend2ndRRProb,
+                                                             lightVertices, s, eyeVertices, t);
                         if (std::isinf(MISWeight) || std::isnan(MISWeight))
                             continue;
                         SLRAssert(MISWeight >= 0 && MISWeight <= 1.0f, "invalid MIS weight: %g", MISWeight);
@@ -264,25 +353,29 @@ namespace SLR {
                             sensor->add(p.x, p.y, wls, contribution);
                         }
                         else {
-                            const IDF* idf = (const IDF*)eVtx.ddf->getDDF();
                             float hitPx, hitPy;
-                            idf->calculatePixel(eConnectVector, &hitPx, &hitPy);
-                            sensor->add(threadID, hitPx, hitPy, wls, contribution);
+                            eVtx.idf->calculatePixel(eConnectVector, &hitPx, &hitPy);
+                            splats.push_back(SensorSplat{hitPx, hitPy, wls, contribution});
                         }
                         
                         // ----------------------------------------------------------------
                     }
                 }
                 
+                // JP: 経路長はカメラ上の頂点を除いた視点側サブパスの頂点数とする。
+                // EN: path length is the number of eye subpath vertices excluding the one on the camera.
+                threadStats->addPathLength((uint32_t)eyeVertices.size() - 1);
+                threadStats->recordArenaUsage(mem.bytesInUse());
                 mem.reset();
             }
         }
-        reporter->update();
+        reporter->update(threadID);
     }
     
+    template <class SamplerType>
     void BPTRenderer::Job::generateSubPath(const WavelengthSamples &initWLs, const SampledSpectrum &initAlpha, const Ray &initRay, float initEpsilon, float dirPDF, DirectionType sampledType,
-                                           float cosLast, bool adjoint, IndependentLightPathSampler &pathSampler, ArenaAllocator &mem) {
-        std::vector<BPTVertex> &vertices = adjoint ? lightVertices : eyeVertices;
+                                           float cosLast, bool adjoint, BPTSubPath &lightVertices, BPTSubPath &eyeVertices, SamplerType &pathSampler, ArenaAllocator &mem) {
+        BPTSubPath &vertices = adjoint ? lightVertices : eyeVertices;
         
         // reject invalid values.
         if (dirPDF == 0.0f)
@@ -296,10 +389,12 @@ namespace SLR {
         SurfaceInteraction si;
         SurfacePoint surfPt;
         float RRProb = 1.0f;
+        threadStats->add(adjoint ? StatCounter::LightRays : StatCounter::CameraRays);
         while (scene->intersect(ray, segment, &si)) {
             si.calculateSurfacePoint(&surfPt);
             
-            float dist2 = squaredDistance(vertices.back().surfPt, surfPt);
+            const BPTVertex &lastVtx = vertices.back();
+            float dist2 = (lastVtx.atInfinity || surfPt.atInfinity()) ? 1.0f : sqDistance(lastVtx.position, surfPt.getPosition());
             Vector3D dirOut_sn = surfPt.toLocal(-ray.dir);
             Normal3D gNorm_sn = surfPt.getLocalGeometricNormal();
             float cosOut = surfPt.calcCosTerm(-ray.dir);
@@ -307,7 +402,7 @@ namespace SLR {
             BSDFQuery fsQuery(dirOut_sn, gNorm_sn, wls.selectedLambdaIndex, DirectionType::All, true, adjoint);
             
             float areaPDF = dirPDF * cosOut / dist2;
-            vertices.emplace_back(surfPt, mem.create<BSDFProxy>(bsdf, fsQuery), alpha, cosOut, 
+            vertices.emplace_back(SubPathVertex(surfPt, bsdf, fsQuery), alpha, cosOut, 
                                   areaPDF, RRProb, sampledType, wls.wavelengthSelected());
             
             // implicit path (zero light subpath vertices, s = 0)
@@ -321,7 +416,7 @@ namespace SLR {
                 
                 float MISWeight = calculateMISWeight(extend1stAreaPDF, 1.0f, extend2ndAreaPDF, 1.0f,
                                                      0.0f, 0.0f, 0.0f, 0.0f,
-                                                     0, (uint32_t)vertices.size());
+                                                     lightVertices, 0, eyeVertices, vertices.size());
                 if (!std::isinf(MISWeight) && !std::isnan(MISWeight)) {
                     SampledSpectrum contribution = MISWeight * alpha * Le0 * Le1;
                     SLRAssert(MISWeight >= 0 && MISWeight <= 1.0f, "invalid MIS weight: %g", MISWeight);
@@ -338,7 +433,7 @@ namespace SLR {
                 vertices.pop_back();
                 break;
             }
-
+            
             BSDFQueryResult fsResult;
             SampledSpectrum fs = bsdf->sample(fsQuery, pathSampler.getBSDFSample(), &fsResult);
             if (fs == SampledSpectrum::Zero || fsResult.dirPDF == 0.0f)
@@ -351,10 +446,13 @@ namespace SLR {
             
             // Russian roulette
             RRProb = std::min(weight.importance(wlHint), 1.0f);
-            if (pathSampler.getPathTerminationSample() < RRProb)
+            if (pathSampler.getPathTerminationSample() < RRProb) {
                 weight /= RRProb;
-            else
+            }
+            else {
+                threadStats->add(StatCounter::RussianRouletteTerminations);
                 break;
+            }
             
             alpha *= weight;
             ray = Ray(surfPt.getPosition(), vecIn, ray.time);
@@ -367,46 +465,50 @@ namespace SLR {
             vtxNextToLast.revAreaPDF = fsResult.reverse.dirPDF * cosLast / dist2;
             vtxNextToLast.revRRProb = std::min((fsResult.reverse.value * cosOut / fsResult.reverse.dirPDF).importance(wlHint), 1.0f);
             
+            // JP: 逆方向の確率密度が確定したので、MISウェイトの部分和を頂点に蓄積する。
+            // EN: accumulate the partial sum for MIS weights to the vertex since its reverse PDF has been determined.
+            const uint32_t minNumVertices = adjoint ? 0 : 1;
+            if (vertices.size() - 1 > minNumVertices) {
+                float prevPartialSum = vertices.size() > 2 ? vertices[vertices.size() - 3].partialMISWeightSum : 0.0f;
+                vtxNextToLast.partialMISWeightSum = calcPartialMISWeightSum(prevPartialSum, vtxNextToLast.areaPDF * vtxNextToLast.RRProb,
+                                                                            vtxNextToLast.revAreaPDF * vtxNextToLast.revRRProb,
+                                                                            vtxNextToLast.sampledType.isDelta(), vertices.back().sampledType.isDelta());
+            }
+            
             cosLast = cosIn;
             dirPDF = fsResult.dirPDF;
             sampledType = fsResult.sampledType;
             si = SurfaceInteraction();
+            threadStats->add(adjoint ? StatCounter::LightRays : StatCounter::BounceRays);
         }
     }
     
     // calculate power heuristic MIS weight
     float BPTRenderer::Job::calculateMISWeight(float lExtend1stAreaPDF, float lExtend1stRRProb, float lExtend2ndAreaPDF, float lExtend2ndRRProb,
                                                float eExtend1stAreaPDF, float eExtend1stRRProb, float eExtend2ndAreaPDF, float eExtend2ndRRProb,
-                                               uint32_t numLVtx, uint32_t numEVtx) const {
+                                               const BPTSubPath &lightVertices, uint32_t numLVtx, const BPTSubPath &eyeVertices, uint32_t numEVtx) const {
+        // JP: 端点付近の頂点と、サブパス生成時に蓄積した部分和から短縮戦略の寄与を定数時間で求める。
+        // EN: calculate the contribution of the shortening strategies in constant time
+        //     from vertices near the end and the partial sum accumulated during subpath generation.
         const auto extendAndShorten = [](float extend1stAreaPDF, float extend1stRRProb, float extend2ndAreaPDF, float extend2ndRRProb,
-                                         const std::vector<BPTVertex> &subPathToShorten, uint32_t numVertices, uint32_t minNumVertices,
+                                         const BPTSubPath &subPathToShorten, uint32_t numVertices, uint32_t minNumVertices,
                                          FloatSum* recMISWeight) {
-            if (numVertices > minNumVertices) {
-                const BPTVertex &endVtx = subPathToShorten[numVertices - 1];
-                float PDFRatio = extend1stAreaPDF * extend1stRRProb / (endVtx.areaPDF * endVtx.RRProb);
-                bool shortenIsDeltaSampled = endVtx.sampledType.isDelta();
-                if (!shortenIsDeltaSampled)
-                    *recMISWeight += PDFRatio * PDFRatio;
-                bool prevIsDeltaSampled = shortenIsDeltaSampled;
-                
-                if (numVertices - 1 > minNumVertices) {
-                    const BPTVertex &newVtx = subPathToShorten[numVertices - 2];
-                    PDFRatio *= extend2ndAreaPDF * extend2ndRRProb / (newVtx.areaPDF * newVtx.RRProb);
-                    shortenIsDeltaSampled = newVtx.sampledType.isDelta();
-                    if (!shortenIsDeltaSampled && !prevIsDeltaSampled)
-                        *recMISWeight += PDFRatio * PDFRatio;
-                    prevIsDeltaSampled = shortenIsDeltaSampled;
-                    
-                    for (int i = numVertices - 2; i > minNumVertices; --i) {
-                        const BPTVertex &newVtx = subPathToShorten[i - 1];
-                        PDFRatio *= newVtx.revAreaPDF * newVtx.revRRProb / (newVtx.areaPDF * newVtx.RRProb);
-                        shortenIsDeltaSampled = newVtx.sampledType.isDelta();
-                        if (!shortenIsDeltaSampled && !prevIsDeltaSampled)
-                            *recMISWeight += PDFRatio * PDFRatio;
-                        prevIsDeltaSampled = shortenIsDeltaSampled;
-                    }
-                }
+            if (numVertices <= minNumVertices)
+                return;
+            const BPTVertex &endVtx = subPathToShorten[numVertices - 1];
+            float extend2ndPDF = 0.0f;
+            float nextToEndPDF = 1.0f;
+            bool nextToEndIsDelta = false;
+            if (numVertices - 1 > minNumVertices) {
+                const BPTVertex &nextToEndVtx = subPathToShorten[numVertices - 2];
+                extend2ndPDF = extend2ndAreaPDF * extend2ndRRProb;
+                nextToEndPDF = nextToEndVtx.areaPDF * nextToEndVtx.RRProb;
+                nextToEndIsDelta = nextToEndVtx.sampledType.isDelta();
             }
+            float partialSum = numVertices > minNumVertices + 2 ? subPathToShorten[numVertices - 3].partialMISWeightSum : 0.0f;
+            *recMISWeight += calcShortenedMISWeightSum(extend1stAreaPDF * extend1stRRProb, extend2ndPDF, numVertices, minNumVertices,
+                                                       endVtx.areaPDF * endVtx.RRProb, endVtx.sampledType.isDelta(),
+                                                       nextToEndPDF, nextToEndIsDelta, partialSum);
         };
         
         // initialize the reciprocal of MISWeight by 1. This corresponds to the current strategy (numLVtx, numEVtx).
@@ -422,6 +524,23 @@ namespace SLR {
         extendAndShorten(eExtend1stAreaPDF, eExtend1stRRProb, eExtend2ndAreaPDF, eExtend2ndRRProb,
                          lightVertices, numLVtx, minLightVertices, &recMISWeight);
         
-        return 1.0f / recMISWeight;
+        float MISWeight = 1.0f / recMISWeight;
+        if (validateMISWeights) {
+            // JP: 全頂点を辿る以前の計算でもウェイトを求め、一致しない接続を数える。
+            // EN: also calculate the weight by the previous calculation walking all the vertices, and count connections where they disagree.
+            const auto walk = [](float extend1stPDF, float extend2ndPDF, const BPTSubPath &subPath, uint32_t numVertices, uint32_t minNumVertices) {
+                return calcShortenedMISWeightSumByWalk(extend1stPDF, extend2ndPDF, numVertices, minNumVertices,
+                                                       [&subPath](uint32_t i) { return subPath[i].areaPDF * subPath[i].RRProb; },
+                                                       [&subPath](uint32_t i) { return subPath[i].revAreaPDF * subPath[i].revRRProb; },
+                                                       [&subPath](uint32_t i) { return subPath[i].sampledType.isDelta(); });
+            };
+            FloatSum walkedRecMISWeight = 1;
+            walkedRecMISWeight += walk(lExtend1stAreaPDF * lExtend1stRRProb, lExtend2ndAreaPDF * lExtend2ndRRProb, eyeVertices, numEVtx, minEyeVertices);
+            walkedRecMISWeight += walk(eExtend1stAreaPDF * eExtend1stRRProb, eExtend2ndAreaPDF * eExtend2ndRRProb, lightVertices, numLVtx, minLightVertices);
+            threadStats->add(StatCounter::MISWeightValidations);
+            if (!MISWeightsAgree(MISWeight, 1.0f / walkedRecMISWeight))
+                threadStats->add(StatCounter::MISWeightMismatches);
+        }
+        return MISWeight;
     }
 }
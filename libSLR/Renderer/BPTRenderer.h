@@ -11,83 +11,44 @@
 #include "../defines.h"
 #include "../declarations.h"
 #include "../Core/renderer.h"
+#include "../Core/light_path_sampler.h"
 
-#include "../Core/geometry.h"
-#include "../Core/directional_distribution_functions.h"
+#include "../Core/subpath_vertex.h"
 
 namespace SLR {
     class SLR_API BPTRenderer : public Renderer {
-        struct DDFProxy {
-            virtual const void* getDDF() const = 0;
-            virtual SampledSpectrum evaluate(const Vector3D &dir_sn, SampledSpectrum* revVal) const = 0;
-            virtual float evaluatePDF(const Vector3D &dir_sn, float* revVal = nullptr) const = 0;
-        };
-        
-        struct EDFProxy : public DDFProxy {
-            const EDF* edf;
-            EDFQuery query;
-            
-            EDFProxy(const EDF* _edf, const EDFQuery &_query) : edf(_edf), query(_query) {}
-            const void* getDDF() const override { return edf; }
-            SampledSpectrum evaluate(const Vector3D &dir_sn, SampledSpectrum* revVal) const override {
-                return edf->evaluate(query, dir_sn);
-            }
-            float evaluatePDF(const Vector3D &dir_sn, float* revVal) const override {
-                return edf->evaluatePDF(query, dir_sn);
-            }
-        };
-        
-        struct BSDFProxy : public DDFProxy {
-            const BSDF* bsdf;
-            BSDFQuery query;
-            
-            BSDFProxy(const BSDF* _bsdf, const BSDFQuery &_query) : bsdf(_bsdf), query(_query) {}
-            const void* getDDF() const override { return bsdf; }
-            SampledSpectrum evaluate(const Vector3D &dir_sn, SampledSpectrum* revVal) const override {
-                return bsdf->evaluate(query, dir_sn, revVal);
-            }
-            float evaluatePDF(const Vector3D &dir_sn, float* revVal) const override {
-                return bsdf->evaluatePDF(query, dir_sn, revVal);
-            }
-        };
-        
-        struct IDFProxy : public DDFProxy {
-            const IDF* idf;
-            
-            IDFProxy(const IDF* _idf) : idf(_idf) {}
-            const void* getDDF() const override { return idf; }
-            SampledSpectrum evaluate(const Vector3D &dir_sn, SampledSpectrum* revVal) const override {
-                return idf->evaluate(dir_sn);
-            }
-            float evaluatePDF(const Vector3D &dir_sn, float* revVal) const override {
-                return idf->evaluatePDF(dir_sn);
-            }
-        };
-        
-        struct BPTVertex {
-            SurfacePoint surfPt;
-            const DDFProxy* ddf;
+        struct BPTVertex : public SubPathVertex {
             SampledSpectrum alpha;
             float cosIn;
             float areaPDF;
             float RRProb;
             float revAreaPDF;
             float revRRProb;
+            float partialMISWeightSum;
             DirectionType sampledType;
             bool lambdaSelected;
-            BPTVertex(const SurfacePoint &_surfPt, const DDFProxy* _ddf,
-                      const SampledSpectrum &_alpha, float _cosIn, float _areaPDF, float _RRProb, 
+            
+            BPTVertex(const SubPathVertex &vertex,
+                      const SampledSpectrum &_alpha, float _cosIn, float _areaPDF, float _RRProb,
                       DirectionType _sampledType, bool _lambdaSelected) :
-            surfPt(_surfPt), ddf(_ddf),
-            alpha(_alpha), cosIn(_cosIn), areaPDF(_areaPDF), RRProb(_RRProb), revAreaPDF(NAN), revRRProb(NAN), 
+            SubPathVertex(vertex),
+            alpha(_alpha), cosIn(_cosIn), areaPDF(_areaPDF), RRProb(_RRProb), revAreaPDF(NAN), revRRProb(NAN), partialMISWeightSum(0.0f),
             sampledType(_sampledType), lambdaSelected(_lambdaSelected) {}
         };
+        typedef SubPath<BPTVertex> BPTSubPath;
+        
+        // JP: スレッドごとのサブパスの頂点配列。偽共有を避けるためキャッシュラインの大きさに揃える。
+        // EN: per-thread subpath vertex arrays. This is aligned to the cache line size to avoid false sharing.
+        struct alignas(SLR_L1_Cacheline_Size) SubPathStorage {
+            BPTSubPath lightVertices;
+            BPTSubPath eyeVertices;
+        };
         
         struct Job {
             const Scene* scene;
             
             ArenaAllocator* mems;
-            IndependentLightPathSampler* pathSamplers;
+            LightPathSampler** pathSamplers;
             
             const Camera* camera;
             ImageSensor* sensor;
@@ -99,26 +60,35 @@ namespace SLR {
             uint32_t numPixelY;
             uint32_t basePixelX;
             uint32_t basePixelY;
+            uint32_t sampleIndex;
+            uint32_t rngSeed;
+            std::vector<SensorSplat>* tileSplats;
+            bool validateMISWeights;
+            
+            SubPathStorage* subPathStorages;
             
             // working area
             float curPx, curPy;
             int16_t wlHint;
-            std::vector<BPTVertex> lightVertices;
-            std::vector<BPTVertex> eyeVertices;
+            ThreadStatistics* threadStats;
             
+            RenderStatistics* stats;
             ProgressReporter* reporter;
             
+            template <class SamplerType>
             void kernel(uint32_t threadID);
+            template <class SamplerType>
             void generateSubPath(const WavelengthSamples &initWLs, const SampledSpectrum &initAlpha, const Ray &initRay, float initEpsilon, float dirPDF, DirectionType sampledType,
-                                 float cosLast, bool adjoint, IndependentLightPathSampler &pathSampler, ArenaAllocator &mem);
+                                 float cosLast, bool adjoint, BPTSubPath &lightVertices, BPTSubPath &eyeVertices, SamplerType &pathSampler, ArenaAllocator &mem);
             float calculateMISWeight(float lExtend1stAreaPDF, float lExtend1stRRProb, float lExtend2ndAreaPDF, float lExtend2ndRRProb,
                                      float eExtend1stAreaPDF, float eExtend1stRRProb, float eExtend2ndAreaPDF, float eExtend2ndRRProb,
-                                     uint32_t numLVtx, uint32_t numEVtx) const;
+                                     const BPTSubPath &lightVertices, uint32_t numLVtx, const BPTSubPath &eyeVertices, uint32_t numEVtx) const;
         };
         
         uint32_t m_samplesPerPixel;
+        LightPathSamplerType m_samplerType;
     public:
-        BPTRenderer(uint32_t spp);
+        BPTRenderer(uint32_t spp, LightPathSamplerType samplerType = LightPathSamplerType::Independent);
         void render(const Scene &scene, const RenderSettings &settings) const override;
     };
 }
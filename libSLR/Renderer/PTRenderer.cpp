@@ -12,30 +12,59 @@
 #include "../Core/camera.h"
 #include "../Core/light_path_sampler.h"
 #include "../Core/ImageSensor.h"
+#include "../Core/ImageExporter.h"
 #include "../Core/RenderSettings.h"
 #include "../Core/ProgressReporter.h"
+#include "../Core/RenderStatistics.h"
+#include "../Core/PassScheduler.h"
 #include "../RNG/XORShiftRNG.h"
 #include "../Scene/Scene.h"
 #include "../Helper/ThreadPool.h"
 
 namespace SLR {
-    PTRenderer::PTRenderer(uint32_t spp) : m_samplesPerPixel(spp) {
-        
+    // JP: 誤差推定が信頼できるようになるまでは、タイルを終了させない。
+    // EN: Don't retire tiles until the error estimate becomes reliable.
+    static const uint32_t s_minSamplesForRetirement = 16;
+    
+    PTRenderer::PTRenderer(uint32_t spp, LightPathSamplerType samplerType, float adaptiveThreshold, uint32_t maxSPP, uint32_t guidingTrainingPasses) :
+    m_samplesPerPixel(spp), m_samplerType(samplerType), m_adaptiveThreshold(adaptiveThreshold), m_maxSamplesPerPixel(maxSPP > 0 ? maxSPP : 4 * spp),
+    m_guidingTrainingPasses(guidingTrainingPasses) {
+    
     }
     
     void PTRenderer::render(const Scene &scene, const RenderSettings &settings) const {
         uint32_t numThreads = settings.getInt(RenderSettingItem::NumThreads);
         XORShiftRNG topRand(settings.getInt(RenderSettingItem::RNGSeed));
         ArenaAllocator* mems = new ArenaAllocator[numThreads];
-        IndependentLightPathSampler* samplers = new IndependentLightPathSampler[numThreads];
+        LightPathSampler** samplers = new LightPathSampler*[numThreads];
         for (int i = 0; i < numThreads; ++i) {
             new (mems + i) ArenaAllocator();
-            new (samplers + i) IndependentLightPathSampler(topRand.getUInt());
+            samplers[i] = createLightPathSampler(m_samplerType, settings.getInt(RenderSettingItem::RNGSeed), topRand.getUInt());
         }
         
         const Camera* camera = scene.getCamera();
         ImageSensor* sensor = camera->getSensor();
         
+        // JP: サンプラーの具体的な型に特殊化したカーネルをここで選択する。
+        //     カーネル内のサンプラー呼び出しは静的に束縛されてインライン化される。
+        // EN: select the kernel specialized for the concrete sampler type here.
+        //     Sampler calls in the kernel are statically bound and inlined.
+        void (Job::*kernel)(uint32_t) = nullptr;
+        switch (m_samplerType) {
+            case LightPathSamplerType::Independent:
+                kernel = &Job::kernel<IndependentLightPathSampler>;
+                break;
+            case LightPathSamplerType::Sobol:
+                kernel = &Job::kernel<SobolLightPathSampler>;
+                break;
+            case LightPathSamplerType::Halton:
+                kernel = &Job::kernel<HaltonLightPathSampler>;
+                break;
+            default:
+                SLRAssert_ShouldNotBeCalled();
+                break;
+        }
+        
         Job job;
         job.scene = &scene;
         
@@ -44,6 +73,7 @@ namespace SLR {
         
         job.camera = camera;
         job.sensor = sensor;
+        job.rngSeed = settings.getInt(RenderSettingItem::RNGSeed);
         job.timeStart = settings.getFloat(RenderSettingItem::TimeStart);
         job.timeEnd = settings.getFloat(RenderSettingItem::TimeEnd);
         job.imageWidth = settings.getInt(RenderSettingItem::ImageWidth);
@@ -53,60 +83,220 @@ namespace SLR {
         
         sensor->init(job.imageWidth, job.imageHeight);
         
-        printf("Path Tracing: %u[spp]\n", m_samplesPerPixel);
-        ProgressReporter reporter;
+        bool adaptive = m_adaptiveThreshold > 0;
+        uint32_t numTiles = sensor->numTileX() * sensor->numTileY();
+        bool* activeTiles = new bool[numTiles];
+        std::fill(activeTiles, activeTiles + numTiles, true);
+        uint32_t numActiveTiles = numTiles;
+        if (adaptive)
+            sensor->enableVarianceEstimation();
+        job.activeTiles = activeTiles;
+        job.adaptiveThreshold = m_adaptiveThreshold;
+        job.brightness = settings.getFloat(RenderSettingItem::Brightness);
+        
+        // JP: SD-treeの状態はチェックポイントに含めないので、再開した場合は学習をやり直す。
+        // EN: The state of the SD-tree is not included in checkpoints, so training restarts when resuming.
+        SDTree* guidingTree = nullptr;
+        if (m_guidingTrainingPasses > 0)
+            guidingTree = new SDTree(scene.getWorldCenter(), scene.getWorldRadius());
+        job.guidingTree = guidingTree;
+        
+        RenderStatistics stats(numThreads);
+        job.stats = &stats;
+        
+        // JP: 総サンプル数の予算はタイル単位のパス数で数える。
+        //     プログレッシブモードではパス数と予算はスケジューラーの終了条件に委ねる。
+        // EN: count the total sample budget in tile passes.
+        //     In progressive mode, the number of passes and the budget are left to the scheduler's termination conditions.
+        uint32_t maxPasses = adaptive ? std::max(m_maxSamplesPerPixel, m_samplesPerPixel) : m_samplesPerPixel;
+        PassScheduler scheduler(settings, maxPasses);
+        maxPasses = scheduler.maxNumPasses();
+        uint64_t tilePassBudget = scheduler.isProgressive() ? UINT64_MAX : (uint64_t)m_samplesPerPixel * numTiles;
+        uint64_t numTilePasses = 0;
+        
+        if (adaptive)
+            printf("Path Tracing: %u[spp] (adaptive, threshold: %g, max: %u[spp])\n", m_samplesPerPixel, m_adaptiveThreshold, maxPasses);
+        else
+            printf("Path Tracing: %u[spp]\n", m_samplesPerPixel);
+        if (guidingTree)
+            printf("Path Guiding: training over %u passes\n", m_guidingTrainingPasses);
+        // JP: 適応的サンプリングではピクセルごとにサンプル数が異なるため、パス単位の誤差推定は使わずタイルの終了に任せる。
+        // EN: Pass-level error estimation is not used with adaptive sampling since the sample count differs per pixel, tile retirement is relied on instead.
+        scheduler.addStateRegion(activeTiles, sizeof(bool) * numTiles);
+        scheduler.addStateRegion(&numTilePasses, sizeof(numTilePasses));
+        scheduler.begin(sensor, samplers, numThreads, !adaptive);
+        numActiveTiles = (uint32_t)std::count(activeTiles, activeTiles + numTiles, true);
+        
+        ProgressReporter reporter(numThreads, settings.getInt(RenderSettingItem::ProgressFD));
         job.reporter = &reporter;
         
-        reporter.pushJob("Rendering", m_samplesPerPixel * sensor->numTileX() * sensor->numTileY());
+        uint32_t firstPass = std::min(scheduler.numPasses(), maxPasses);
+        if (!scheduler.isProgressive())
+            reporter.pushJob("Rendering", tilePassBudget - numTilePasses, scheduler.startTime());
         char nextTitle[32];
-        snprintf(nextTitle, sizeof(nextTitle), "To %5uspp", 1);
-        reporter.pushJob(nextTitle, 1 * sensor->numTileX() * sensor->numTileY());
-        uint32_t imgIdx = 0;
-        uint32_t exportPass = 1;
-        for (int s = 0; s < m_samplesPerPixel; ++s) {
+        snprintf(nextTitle, sizeof(nextTitle), "To %5uspp", scheduler.nextExportPass());
+        reporter.pushJob(nextTitle, (scheduler.nextExportPass() - firstPass) * numActiveTiles, scheduler.startTime());
+        uint32_t imgIdx = scheduler.numExportedImages();
+        ImageExporter exporter;
+        uint32_t numPasses = firstPass;
+        uint32_t iterationStartPass = firstPass;
+        for (int s = firstPass; s < maxPasses; ++s) {
+            job.sampleIndex = s;
+            job.trainGuiding = guidingTree && s < m_guidingTrainingPasses;
+            auto passStart = std::chrono::system_clock::now();
             ThreadPool threadPool(numThreads);
             for (int ty = 0; ty < sensor->numTileY(); ++ty) {
                 for (int tx = 0; tx < sensor->numTileX(); ++tx) {
+                    if (!activeTiles[ty * sensor->numTileX() + tx])
+                        continue;
                     job.basePixelX = tx * sensor->tileWidth();
                     job.basePixelY = ty * sensor->tileHeight();
-                    threadPool.enqueue(std::bind(&Job::kernel, job, std::placeholders::_1));
+                    threadPool.enqueue(std::bind(kernel, job, std::placeholders::_1));
+                    ++numTilePasses;
                 }
             }
             threadPool.wait();
+            stats.addPhaseTime(StatPhase::Rendering, std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now() - passStart).count() * 1e-6);
+            stats.finishPass();
+            ++numPasses;
+            
+            // JP: 学習の反復はパス数が2の冪に達するごとに区切り、学習した分布を次の反復のサンプリングに用いる。
+            // EN: A training iteration ends each time the number of passes reaches a power of two, and the learned distribution is used for sampling in the next iteration.
+            if (job.trainGuiding && ((s + 1) & s) == 0) {
+                guidingTree->update(s + 1 - iterationStartPass, numThreads);
+                iterationStartPass = s + 1;
+            }
             
-            if ((s + 1) == exportPass) {
+            if (adaptive)
+                numActiveTiles = (uint32_t)std::count(activeTiles, activeTiles + numTiles, true);
+            // JP: 予算はパスの区切りでのみ確認する。パスの途中で打ち切ると最後のパスが行優先で先頭のタイルにだけ偏るため、
+            //     残りの予算で全ての有効なタイルを処理できなければ終了し、端数は使わない。
+            // EN: check the budget only at pass boundaries. Stopping in the middle of a pass would bias the last pass
+            //     to the first tiles in row-major order, so finish when the remaining budget cannot cover all active tiles
+            //     and leave the remainder unused.
+            bool finished;
+            {
+                ScopedPhaseTimer timer(&stats, StatPhase::PassFinalization);
+                finished = !scheduler.finishPass(sensor) || numActiveTiles == 0 || tilePassBudget - numTilePasses < numActiveTiles;
+            }
+            
+            if (scheduler.shouldExport(finished)) {
+                // JP: 終了したタイルの分の作業は行われないので完了扱いにする。
+                // EN: regard the work for retired tiles as done since it will never be performed.
+                reporter.skipRemainingWork();
                 reporter.popJob();
                 
                 reporter.beginOtherThreadPrint();
                 char filename[256];
-                sprintf(filename, "%03u.bmp", imgIdx);
-                double elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(reporter.elapsed()).count();
-                sensor->saveImage(filename, settings.getFloat(RenderSettingItem::Brightness) / (s + 1));
-                printf("%u samples: %s, %g[s]\n", exportPass, filename, elapsed * 0.001f);
+                sprintf(filename, "%03u.%s", imgIdx, sensor->imageFileExtension());
+                float elapsed = scheduler.elapsedTime();
+                float brightness = settings.getFloat(RenderSettingItem::Brightness);
+                {
+                    ScopedPhaseTimer timer(&stats, StatPhase::ImageOutput);
+                    exporter.exportImage(*sensor, filename, adaptive ? brightness : brightness / (s + 1 - scheduler.firstPass()));
+                }
+                printf("%u samples: %s, %g[s]\n", s + 1, filename, elapsed);
+                sprintf(filename, "%03u.json", imgIdx);
+                stats.writeJSON(filename, "PT");
                 reporter.endOtherThreadPrint();
                 
                 ++imgIdx;
-                if ((s + 1) == m_samplesPerPixel)
+                if (finished)
                     break;
-                exportPass += exportPass;
-                snprintf(nextTitle, sizeof(nextTitle), "To %5uspp", exportPass);
-                reporter.pushJob(nextTitle, (exportPass >> 1) * sensor->numTileX() * sensor->numTileY());
+                scheduler.advanceExport();
+                snprintf(nextTitle, sizeof(nextTitle), "To %5uspp", scheduler.nextExportPass());
+                reporter.pushJob(nextTitle, (scheduler.nextExportPass() - (s + 1)) * numActiveTiles, scheduler.startTime());
             }
         }
-        reporter.popJob();
+        double elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now() - scheduler.startTime()).count() * 0.001;
+        if (!scheduler.isProgressive()) {
+            reporter.skipRemainingWork();
+            reporter.popJob();
+        }
         reporter.finish();
+        scheduler.printSummary();
         
+        double renderTime = stats.phaseTime(StatPhase::Rendering);
+        printf("Throughput: %llu rays in %g[s], %g[Mrays/s]\n", (unsigned long long)stats.numRays(), renderTime, stats.numRays() / renderTime * 1e-6);
+        
+        if (adaptive) {
+            // JP: 最大spp到達までに一様にサンプルした場合の時間を、タイルパスあたりの平均時間から見積もる。
+            // EN: estimate the time to render uniformly up to the max spp reached from the average time per tile pass.
+            double uniformTime = elapsed / numTilePasses * ((uint64_t)numPasses * numTiles);
+            printf("Adaptive sampling: %llu / %llu tile passes, %u / %u tiles retired, max %u[spp]\n",
+                   (unsigned long long)numTilePasses, (unsigned long long)tilePassBudget, numTiles - numActiveTiles, numTiles, numPasses);
+            printf("Elapsed: %g[s], estimated time for uniform %u[spp]: %g[s] (saved %g[s])\n",
+                   elapsed, numPasses, uniformTime, uniformTime - elapsed);
+            sensor->saveSampleCountImage("spp.bmp");
+            printf("Samples per pixel heatmap: spp.bmp\n");
+        }
+        delete[] activeTiles;
+        if (guidingTree) {
+            printf("Path Guiding: %u iterations, %u spatial leaves\n", guidingTree->numIterations(), guidingTree->numLeaves());
+            delete guidingTree;
+        }
+        
+        for (int i = 0; i < numThreads; ++i)
+            delete samplers[i];
         delete[] samplers;
         delete[] mems;
     }
     
+    // JP: 束の中の全ての光線の方向の八分円が揃っている場合のみ束として辿り、そうでなければ1本ずつ交差判定する。
+    // EN: trace rays as a packet only when the direction octants of all the rays in the packet agree, otherwise intersect them one by one.
+    static void intersectCameraRays(const Scene &scene, const Ray* rays, RaySegment* segments, SurfaceInteraction* sis, uint32_t numRays, bool* hits) {
+        auto calcOctant = [](const Vector3D &dir) {
+            return (dir.x < 0) | ((dir.y < 0) << 1) | ((dir.z < 0) << 2);
+        };
+        bool coherent = numRays > 1;
+        uint32_t octant = calcOctant(rays[0].dir);
+        for (int i = 1; i < numRays && coherent; ++i)
+            coherent = calcOctant(rays[i].dir) == octant;
+        
+        if (coherent) {
+            uint32_t activeMask = numRays == 32 ? 0xFFFFFFFF : ((1u << numRays) - 1);
+            uint32_t hitMask = scene.intersectPacket(rays, segments, sis, activeMask);
+            for (int i = 0; i < numRays; ++i)
+                hits[i] = ((hitMask >> i) & 0x1) != 0;
+        }
+        else {
+            for (int i = 0; i < numRays; ++i)
+                hits[i] = scene.intersect(rays[i], segments[i], &sis[i]);
+        }
+    }
+    
+    template <class SamplerType>
     void PTRenderer::Job::kernel(uint32_t threadID) {
         ArenaAllocator &mem = mems[threadID];
-        IndependentLightPathSampler &pathSampler = pathSamplers[threadID];
-        for (int ly = 0; ly < numPixelY; ++ly) {
-            for (int lx = 0; lx < numPixelX; ++lx) {
+        SamplerType &pathSampler = static_cast<SamplerType &>(*pathSamplers[threadID]);
+        uint32_t tileIndex = (basePixelY / numPixelY) * sensor->numTileX() + basePixelX / numPixelX;
+        pathSampler.reseed(tilePassSeed(rngSeed, tileIndex, sampleIndex));
+        GuidingPathRecorder recorder;
+        ThreadStatistics &threadStats = *stats->threadStatistics(threadID);
+        ScopedThreadStatistics scopedStats(&threadStats);
+        
+        // JP: タイル内のカメラレイを32本ずつの束にまとめて最初の交差を求め、その後ピクセルごとに経路を追跡する。
+        //     低食い違い量サンプラーのカメラの次元は固定なので、経路の追跡前にピクセルのサンプルを開始し直してもバウンスの次元は変わらない。
+        // EN: intersect camera rays in the tile as packets of 32 rays to find their first hits, then trace paths per pixel.
+        //     Camera dimensions of low-discrepancy samplers are fixed, so restarting a pixel sample before tracing the path doesn't change the bounce dimensions.
+        const uint32_t PacketSize = 32;
+        Ray rays[PacketSize];
+        RaySegment segments[PacketSize];
+        SurfaceInteraction sis[PacketSize];
+        bool hits[PacketSize];
+        float pixelXs[PacketSize];
+        float pixelYs[PacketSize];
+        WavelengthSamples wlsList[PacketSize];
+        SampledSpectrum weights[PacketSize];
+        uint32_t numTilePixels = numPixelX * numPixelY;
+        for (uint32_t base = 0; base < numTilePixels; base += PacketSize) {
+            uint32_t numPacketRays = std::min(numTilePixels - base, PacketSize);
+            for (uint32_t i = 0; i < numPacketRays; ++i) {
+                uint32_t px = basePixelX + (base + i) % numPixelX;
+                uint32_t py = basePixelY + (base + i) / numPixelX;
+                pathSampler.startPixelSample(px, py, sampleIndex);
                 float time = pathSampler.getTimeSample(timeStart, timeEnd);
-                PixelPosition p = pathSampler.getPixelPositionSample(basePixelX + lx, basePixelY + ly);
+                PixelPosition p = pathSampler.getPixelPositionSample(px, py);
                 
                 float selectWLPDF;
                 WavelengthSamples wls = WavelengthSamples::createWithEqualOffsets(pathSampler.getWavelengthSample(), pathSampler.getWLSelectionSample(), &selectWLPDF);
@@ -120,37 +310,71 @@ namespace SLR {
                 IDF* idf = camera->createIDF(lensResult.surfPt, wls, mem);
                 SampledSpectrum We1 = idf->sample(WeSample, &WeResult);
                 
-                Ray ray(lensResult.surfPt.getPosition(), lensResult.surfPt.fromLocal(WeResult.dirLocal), time);
-                SampledSpectrum C = contribution(*scene, wls, ray, pathSampler, mem);
-                SLRAssert(C.hasNaN() == false && C.hasInf() == false && C.hasMinus() == false,
+                Ray &ray = rays[i];
+                ray = Ray(lensResult.surfPt.getPosition(), lensResult.surfPt.fromLocal(WeResult.dirLocal), time);
+                segments[i] = RaySegment();
+                sis[i] = SurfaceInteraction();
+                pixelXs[i] = p.x;
+                pixelYs[i] = p.y;
+                wlsList[i] = wls;
+                weights[i] = (We0 * We1) * (lensResult.surfPt.calcCosTerm(ray.dir) / (lensResult.areaPDF * WeResult.dirPDF * selectWLPDF));
+                SLRAssert(weights[i].hasNaN() == false && weights[i].hasInf() == false && weights[i].hasMinus() == false,
                           "Unexpected value detected: %s\n"
-                          "pix: (%f, %f)", C.toString().c_str(), p.x, p.y);
+                          "pix: (%f, %f)", weights[i].toString().c_str(), p.x, p.y);
                 
-                SampledSpectrum weight = (We0 * We1) * (lensResult.surfPt.calcCosTerm(ray.dir) / (lensResult.areaPDF * WeResult.dirPDF * selectWLPDF));
-                SLRAssert(weight.hasNaN() == false && weight.hasInf() == false && weight.hasMinus() == false,
+                mem.reset();
+            }
+            
+            threadStats.add(StatCounter::CameraRays, numPacketRays);
+            intersectCameraRays(*scene, rays, segments, sis, numPacketRays, hits);
+            
+            for (uint32_t i = 0; i < numPacketRays; ++i) {
+                pathSampler.startPixelSample(basePixelX + (base + i) % numPixelX, basePixelY + (base + i) / numPixelX, sampleIndex);
+                recorder.clear();
+                SampledSpectrum C = contribution(*scene, wlsList[i], rays[i], hits[i], sis[i], pathSampler, mem, trainGuiding ? &recorder : nullptr, threadStats);
+                if (trainGuiding)
+                    recorder.commit(guidingTree);
+                SLRAssert(C.hasNaN() == false && C.hasInf() == false && C.hasMinus() == false,
                           "Unexpected value detected: %s\n"
-                          "pix: (%f, %f)", weight.toString().c_str(), p.x, p.y);
-                sensor->add(p.x, p.y, wls, weight * C);
+                          "pix: (%f, %f)", C.toString().c_str(), pixelXs[i], pixelYs[i]);
                 
+                if (adaptiveThreshold > 0)
+                    sensor->addPixelSample(pixelXs[i], pixelYs[i], wlsList[i], weights[i] * C);
+                else
+                    sensor->add(pixelXs[i], pixelYs[i], wlsList[i], weights[i] * C);
+                
+                threadStats.recordArenaUsage(mem.bytesInUse());
                 mem.reset();
             }
         }
-        reporter->update();
+        
+        if (adaptiveThreshold > 0 && sampleIndex + 1 >= s_minSamplesForRetirement) {
+            uint32_t tx = basePixelX / numPixelX;
+            uint32_t ty = basePixelY / numPixelY;
+            if (sensor->estimateTileError(tx, ty, brightness) < adaptiveThreshold)
+                activeTiles[ty * sensor->numTileX() + tx] = false;
+        }
+        reporter->update(threadID);
     }
     
-    SampledSpectrum PTRenderer::Job::contribution(const Scene &scene, const WavelengthSamples &initWLs, const Ray &initRay, IndependentLightPathSampler &pathSampler, ArenaAllocator &mem) const {
+    template <class SamplerType>
+    SampledSpectrum PTRenderer::Job::contribution(const Scene &scene, const WavelengthSamples &initWLs, const Ray &initRay, bool initHit, const SurfaceInteraction &initSI,
+                                                  SamplerType &pathSampler, ArenaAllocator &mem, GuidingPathRecorder* recorder, ThreadStatistics &threadStats) const {
         WavelengthSamples wls = initWLs;
         Ray ray = initRay;
         RaySegment segment;
         SurfacePoint surfPt;
         SampledSpectrum alpha = SampledSpectrum::One;
         float initY = alpha.importance(wls.selectedLambdaIndex);
+        float rrScale = 1.0f;
         SampledSpectrumSum sp(SampledSpectrum::Zero);
         uint32_t pathLength = 0;
         
-        SurfaceInteraction si;
-        if (!scene.intersect(ray, segment, &si))
+        if (!initHit) {
+            threadStats.addPathLength(0);
             return SampledSpectrum::Zero;
+        }
+        SurfaceInteraction si = initSI;
         si.calculateSurfacePoint(&surfPt);
         
         Vector3D dirOut_sn = surfPt.toLocal(-ray.dir);
@@ -159,9 +383,11 @@ namespace SLR {
             SampledSpectrum Le = surfPt.emittance(wls) * edf->evaluate(EDFQuery(), dirOut_sn);
             sp += alpha * Le;
         }
-        if (surfPt.atInfinity())
+        if (surfPt.atInfinity()) {
+            threadStats.addPathLength(0);
             return sp;
-
+        }
+        
         while (true) {
             ++pathLength;
             if (pathLength >= 100)
@@ -170,6 +396,18 @@ namespace SLR {
             BSDF* bsdf = surfPt.createBSDF(wls, mem);
             BSDFQuery fsQuery(dirOut_sn, gNorm_sn, wls.selectedLambdaIndex);
             
+            // JP: 非デルタ成分を持つ頂点ではSD-treeの葉を求める。学習済みの分布があればBSDFと混合してサンプルする。
+            // EN: find the SD-tree leaf at a vertex having non-delta components. If the leaf has a learned distribution, mix it with the BSDF for sampling.
+            uint32_t guidingLeafIdx = 0;
+            const DirectionalQuadTree* guide = nullptr;
+            if (guidingTree && bsdf->hasNonDelta()) {
+                guidingLeafIdx = guidingTree->findLeaf(surfPt.getPosition());
+                guide = &guidingTree->getSamplingDistribution(guidingLeafIdx);
+                if (!guide->hasDistribution())
+                    guide = nullptr;
+            }
+            const float bsdfFrac = SDTree::BSDFSamplingFraction;
+            
             // Next Event Estimation (explicit light sampling)
             if (bsdf->hasNonDelta()) {
                 SurfaceLight light;
@@ -182,6 +420,7 @@ namespace SLR {
                 SampledSpectrum M = light.sample(lpQuery, pathSampler.getSurfaceLightPosSample(), &lpResult);
                 SLRAssert(!std::isnan(lpResult.areaPDF)/* && !std::isinf(xpResult.areaPDF)*/, "areaPDF: unexpected value detected: %f", lpResult.areaPDF);
                 
+                threadStats.add(StatCounter::ShadowRays);
                 if (scene.testVisibility(surfPt, lpResult.surfPt, ray.time)) {
                     float dist2;
                     Vector3D shadowDir = lpResult.surfPt.getDirectionFrom(surfPt.getPosition(), &dist2);
@@ -195,7 +434,10 @@ namespace SLR {
                     
                     SampledSpectrum fs = bsdf->evaluate(fsQuery, shadowDir_sn);
                     float cosLight = lpResult.surfPt.calcCosTerm(-shadowDir);
-                    float bsdfPDF = bsdf->evaluatePDF(fsQuery, shadowDir_sn) * cosLight / dist2;
+                    float bsdfPDF = bsdf->evaluatePDF(fsQuery, shadowDir_sn);
+                    if (guide)
+                        bsdfPDF = bsdfFrac * bsdfPDF + (1 - bsdfFrac) * guide->evaluatePDF(shadowDir);
+                    bsdfPDF *= cosLight / dist2;
                     
                     float MISWeight = 1.0f;
                     if (!lpResult.posType.isDelta() && !std::isinf(lpResult.areaPDF))
@@ -203,14 +445,56 @@ namespace SLR {
                     SLRAssert(MISWeight <= 1.0f, "Invalid MIS weight: %g", MISWeight);
                     
                     float G = absDot(shadowDir_sn, gNorm_sn) * cosLight / dist2;
-                    sp += alpha * Le * fs * (G * MISWeight / lightPDF);
                     SLRAssert(std::isfinite(G), "G: unexpected value detected: %f", G);
+                    // JP: 光源上の点から同じ光源をサンプルした場合など、幾何項が0の接続ではシェーディング法線の補正が不定となるため棄却する。
+                    // EN: reject connections with zero geometric term, e.g. sampling a light from a point on the same light, since the shading normal correction is undefined.
+                    if (G > 0.0f) {
+                        SampledSpectrum C = alpha * Le * fs * (G * MISWeight / lightPDF);
+                        sp += C;
+                        if (recorder)
+                            recorder->addContribution(C.importance(wls.selectedLambdaIndex));
+                    }
                 }
             }
             
             // get a next direction by sampling BSDF.
+            // JP: 学習済みの分布がある場合は1サンプルMISとしてBSDFと分布のいずれかを選び、非デルタ方向の密度は両者の混合とする。
+            // EN: With a learned distribution, choose either the BSDF or the distribution as one-sample MIS, the density of a non-delta direction is the mixture of both.
             BSDFQueryResult fsResult;
-            SampledSpectrum fs = bsdf->sample(fsQuery, pathSampler.getBSDFSample(), &fsResult);
+            SampledSpectrum fs;
+            BSDFSample fsSample = pathSampler.getBSDFSample();
+            if (guide) {
+                float bsdfDirPDF;
+                float guideDirPDF;
+                if (fsSample.uComponent < bsdfFrac) {
+                    fsSample.uComponent /= bsdfFrac;
+                    fs = bsdf->sample(fsQuery, fsSample, &fsResult);
+                    bsdfDirPDF = fsResult.dirPDF;
+                    guideDirPDF = 0.0f;
+                    if (!fsResult.sampledType.isDelta() && fsResult.dirPDF > 0.0f) {
+                        fs = bsdf->evaluate(fsQuery, fsResult.dirLocal);
+                        bsdfDirPDF = bsdf->evaluatePDF(fsQuery, fsResult.dirLocal);
+                        guideDirPDF = guide->evaluatePDF(surfPt.fromLocal(fsResult.dirLocal));
+                    }
+                }
+                else {
+                    Vector3D dirIn = guide->sample(fsSample.uDir[0], fsSample.uDir[1], &guideDirPDF);
+                    fsResult.dirLocal = surfPt.toLocal(dirIn);
+                    fsResult.sampledType = DirectionType::LowFreq | (fsResult.dirLocal.z * dirOut_sn.z > 0 ? DirectionType::Reflection : DirectionType::Transmission);
+                    fs = bsdf->evaluate(fsQuery, fsResult.dirLocal);
+                    bsdfDirPDF = bsdf->evaluatePDF(fsQuery, fsResult.dirLocal);
+                }
+                fsResult.dirPDF = bsdfFrac * bsdfDirPDF + (1 - bsdfFrac) * guideDirPDF;
+                // JP: 分布に導かれた方向はスループットが小さくなりやすく、そのままではロシアンルーレットで打ち切られてしまうため、
+                //     BSDFのみでサンプルした場合のスループットで生存確率を決める。
+                // EN: Directions guided by the distribution tend to have smaller throughputs which would be terminated by Russian roulette,
+                //     so the survival probability is determined by the throughput as if sampled by the BSDF alone.
+                if (bsdfDirPDF > 0.0f)
+                    rrScale *= fsResult.dirPDF / bsdfDirPDF;
+            }
+            else {
+                fs = bsdf->sample(fsQuery, fsSample, &fsResult);
+            }
             if (fs == SampledSpectrum::Zero || fsResult.dirPDF == 0.0f)
                 break;
             if (fsResult.sampledType.isDispersive() && !wls.wavelengthSelected()) {
@@ -223,11 +507,14 @@ namespace SLR {
                       alpha.toString().c_str(), pathLength, absDot(fsResult.dirLocal, gNorm_sn), fsResult.dirPDF);
             
             Vector3D dirIn = surfPt.fromLocal(fsResult.dirLocal);
+            if (recorder && guidingTree && bsdf->hasNonDelta() && !fsResult.sampledType.isDelta())
+                recorder->addVertex(guidingLeafIdx, dirIn, alpha.importance(wls.selectedLambdaIndex), fsResult.dirPDF);
             ray = Ray(surfPt.getPosition(), dirIn, ray.time);
             segment = RaySegment(Ray::Epsilon);
             
             // find a next intersection point.
             si = SurfaceInteraction();
+            threadStats.add(StatCounter::BounceRays);
             if (!scene.intersect(ray, segment, &si))
                 break;
             si.calculateSurfacePoint(&surfPt);
@@ -250,18 +537,25 @@ namespace SLR {
                     MISWeight = (bsdfPDF * bsdfPDF) / (lightPDF * lightPDF + bsdfPDF * bsdfPDF);
                 SLRAssert(MISWeight <= 1.0f, "Invalid MIS weight: %g", MISWeight);
                 
-                sp += alpha * Le * MISWeight;
+                SampledSpectrum C = alpha * Le * MISWeight;
+                sp += C;
+                if (recorder)
+                    recorder->addContribution(C.importance(wls.selectedLambdaIndex));
             }
             if (surfPt.atInfinity())
                 break;
             
             // Russian roulette
-            float continueProb = std::min(alpha.importance(wls.selectedLambdaIndex) / initY, 1.0f);
-            if (pathSampler.getPathTerminationSample() < continueProb)
+            float continueProb = std::min(alpha.importance(wls.selectedLambdaIndex) * rrScale / initY, 1.0f);
+            if (pathSampler.getPathTerminationSample() < continueProb) {
                 alpha /= continueProb;
-            else
+            }
+            else {
+                threadStats.add(StatCounter::RussianRouletteTerminations);
                 break;
+            }
         }
+        threadStats.addPathLength(pathLength);
         
         return sp;
     }
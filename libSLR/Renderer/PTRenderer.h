@@ -11,6 +11,8 @@
 #include "../defines.h"
 #include "../declarations.h"
 #include "../Core/renderer.h"
+#include "../Core/light_path_sampler.h"
+#include "../Core/SDTree.h"
 
 namespace SLR {
     class SLR_API PTRenderer : public Renderer {
@@ -18,7 +20,7 @@ namespace SLR {
             const Scene* scene;
             
             ArenaAllocator* mems;
-            IndependentLightPathSampler* pathSamplers;
+            LightPathSampler** pathSamplers;
             
             const Camera* camera;
             ImageSensor* sensor;
@@ -30,16 +32,45 @@ namespace SLR {
             uint32_t numPixelY;
             uint32_t basePixelX;
             uint32_t basePixelY;
+            uint32_t sampleIndex;
+            uint32_t rngSeed;
+            
+            // adaptive sampling
+            bool* activeTiles;
+            float adaptiveThreshold;
+            float brightness;
+            
+            // path guiding
+            SDTree* guidingTree;
+            bool trainGuiding;
+            
+            RenderStatistics* stats;
             
             ProgressReporter* reporter;
             
+            template <class SamplerType>
             void kernel(uint32_t threadID);
-            SampledSpectrum contribution(const Scene &scene, const WavelengthSamples &initWLs, const Ray &initRay, IndependentLightPathSampler &pathSampler, ArenaAllocator &mem) const;
+            template <class SamplerType>
+            SampledSpectrum contribution(const Scene &scene, const WavelengthSamples &initWLs, const Ray &initRay, bool initHit, const SurfaceInteraction &initSI,
+                                         SamplerType &pathSampler, ArenaAllocator &mem, GuidingPathRecorder* recorder, ThreadStatistics &threadStats) const;
         };
         
         uint32_t m_samplesPerPixel;
+        LightPathSamplerType m_samplerType;
+        float m_adaptiveThreshold;
+        uint32_t m_maxSamplesPerPixel;
+        uint32_t m_guidingTrainingPasses;
     public:
-        PTRenderer(uint32_t spp);
+        // JP: adaptiveThresholdが正の場合、推定誤差が閾値を下回ったタイルはそれ以上サンプルされず、
+        //     余ったサンプル(spp x ピクセル数)は残りのタイルにmaxSPPまで割り当てられる。
+        //     guidingTrainingPassesが正の場合、入射放射輝度を学習するSD-treeとBSDFを混合して方向をサンプルし、
+        //     SD-treeは最初のguidingTrainingPassesパスの間、長さが倍々になる反復で学習する。
+        // EN: If adaptiveThreshold is positive, tiles whose estimated error falls below the threshold are retired,
+        //     and the remaining sample budget (spp x #pixels) is redistributed to the other tiles up to maxSPP.
+        //     If guidingTrainingPasses is positive, directions are sampled by mixing the BSDF with an SD-tree learning incident radiance,
+        //     and the SD-tree is trained over the first guidingTrainingPasses passes in iterations doubling their lengths.
+        PTRenderer(uint32_t spp, LightPathSamplerType samplerType = LightPathSamplerType::Independent,
+                   float adaptiveThreshold = 0.0f, uint32_t maxSPP = 0, uint32_t guidingTrainingPasses = 0);
         void render(const Scene &scene, const RenderSettings &settings) const override;
     };    
 }
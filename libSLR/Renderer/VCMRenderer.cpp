@@ -0,0 +1,612 @@
+//
+//  VCMRenderer.cpp
+//
+//  Created by 渡部 心 on 2017/06/20.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#include "VCMRenderer.h"
+
+#include "../MemoryAllocators/ArenaAllocator.h"
+#include "../Core/random_number_generator.h"
+#include "../Core/camera.h"
+#include "../Core/light_path_sampler.h"
+#include "../Core/low_discrepancy_sequences.h"
+#include "../Core/ImageSensor.h"
+#include "../Core/ImageExporter.h"
+#include "../Core/RenderSettings.h"
+#include "../Core/ProgressReporter.h"
+#include "../Core/RenderStatistics.h"
+#include "../Core/PassScheduler.h"
+#include "../RNG/XORShiftRNG.h"
+#include "../Scene/Scene.h"
+#include "../Helper/ThreadPool.h"
+
+namespace SLR {
+    // JP: パワーヒューリスティック(指数2)のための確率密度(の比)の変換。
+    // EN: conversion of a PDF (ratio) for the power heuristic (exponent 2).
+    static inline float calcMISTerm(float value) {
+        return value * value;
+    }
+    
+    // JP: 頂点で方向をサンプルした後にMISの量を更新する。ロシアンルーレットの確率はウェイトに含めない。
+    // EN: update the MIS quantities after sampling a direction at a vertex. Russian roulette probabilities are not included in weights.
+    static inline void updateMISQuantities(float dirPDF, float revDirPDF, float cosIn, bool deltaSampled, const float VMWeightFactor, const float VCWeightFactor,
+                                           float* dVCM, float* dVC, float* dVM) {
+        float cosInByPDF = calcMISTerm(cosIn / dirPDF);
+        if (deltaSampled) {
+            *dVC = cosInByPDF * *dVC * calcMISTerm(revDirPDF);
+            *dVM = cosInByPDF * *dVM * calcMISTerm(revDirPDF);
+            *dVCM = 0.0f;
+        }
+        else {
+            *dVC = cosInByPDF * (*dVC * calcMISTerm(revDirPDF) + *dVCM + VMWeightFactor);
+            *dVM = cosInByPDF * (*dVM * calcMISTerm(revDirPDF) + *dVCM * VCWeightFactor + 1.0f);
+            *dVCM = calcMISTerm(1.0f / dirPDF);
+        }
+    }
+    
+    // JP: 頂点に到達した際に、直前の辺の距離と到達点のコサインをMISの量に反映する。
+    // EN: reflect the distance of the last edge and the cosine at the reached point to the MIS quantities when reaching a vertex.
+    static inline void updateMISQuantitiesOnHit(float dist2, float cosOut, float* dVCM, float* dVC, float* dVM) {
+        float invCosTerm = 1.0f / calcMISTerm(cosOut);
+        *dVCM *= calcMISTerm(dist2) * invCosTerm;
+        *dVC *= invCosTerm;
+        *dVM *= invCosTerm;
+    }
+    
+    VCMRenderer::VCMRenderer(uint32_t spp, LightPathSamplerType samplerType, float initialRadius, float radiusReductionRate) :
+    m_samplesPerPixel(spp), m_samplerType(samplerType), m_initialRadius(initialRadius), m_radiusReductionRate(radiusReductionRate) {
+    }
+    
+    void VCMRenderer::render(const Scene &scene, const RenderSettings &settings) const {
+        uint32_t numThreads = settings.getInt(RenderSettingItem::NumThreads);
+        uint32_t seed = settings.getInt(RenderSettingItem::RNGSeed);
+        XORShiftRNG topRand(seed);
+        ArenaAllocator* lightMems = new ArenaAllocator[numThreads];
+        ArenaAllocator* eyeMems = new ArenaAllocator[numThreads];
+        LightPathSampler** samplers = new LightPathSampler*[numThreads];
+        for (int i = 0; i < numThreads; ++i)
+            samplers[i] = createLightPathSampler(m_samplerType, seed, topRand.getUInt());
+        // JP: 光源頂点はスレッドごとの配列に格納し、全てのパスで再利用する。
+        // EN: store light vertices to per-thread arrays, and reuse them for all the passes.
+        LightVertexStorage* lightVertexStorages = (LightVertexStorage*)SLR_memalign(sizeof(LightVertexStorage) * numThreads, SLR_L1_Cacheline_Size);
+        for (int i = 0; i < numThreads; ++i)
+            new (lightVertexStorages + i) LightVertexStorage();
+        
+        const Camera* camera = scene.getCamera();
+        ImageSensor* sensor = camera->getSensor();
+        
+        void (Job::*lightKernel)(uint32_t) = nullptr;
+        void (Job::*eyeKernel)(uint32_t) = nullptr;
+        switch (m_samplerType) {
+            case LightPathSamplerType::Independent:
+                lightKernel = &Job::lightKernel<IndependentLightPathSampler>;
+                eyeKernel = &Job::eyeKernel<IndependentLightPathSampler>;
+                break;
+            case LightPathSamplerType::Sobol:
+                lightKernel = &Job::lightKernel<SobolLightPathSampler>;
+                eyeKernel = &Job::eyeKernel<SobolLightPathSampler>;
+                break;
+            case LightPathSamplerType::Halton:
+                lightKernel = &Job::lightKernel<HaltonLightPathSampler>;
+                eyeKernel = &Job::eyeKernel<HaltonLightPathSampler>;
+                break;
+            default:
+                SLRAssert_ShouldNotBeCalled();
+                break;
+        }
+        
+        PointHashGrid<VCMVertex> lightVertexGrid;
+        
+        Job job;
+        job.scene = &scene;
+        
+        job.lightMems = lightMems;
+        job.eyeMems = eyeMems;
+        job.pathSamplers = samplers;
+        job.lightVertexStorages = lightVertexStorages;
+        job.lightVertexGrid = &lightVertexGrid;
+        
+        job.camera = camera;
+        job.sensor = sensor;
+        float timeStart = settings.getFloat(RenderSettingItem::TimeStart);
+        float timeEnd = settings.getFloat(RenderSettingItem::TimeEnd);
+        job.imageWidth = settings.getInt(RenderSettingItem::ImageWidth);
+        job.imageHeight = settings.getInt(RenderSettingItem::ImageHeight);
+        job.numPixelX = sensor->tileWidth();
+        job.numPixelY = sensor->tileHeight();
+        
+        // JP: ピクセルごとに1本の光源サブパスを生成する。
+        // EN: generate one light subpath per pixel.
+        uint32_t numLightSubPaths = job.imageWidth * job.imageHeight;
+        LightSubPathRange* lightSubPathRanges = new LightSubPathRange[numLightSubPaths];
+        job.lightSubPathRanges = lightSubPathRanges;
+        
+        sensor->init(job.imageWidth, job.imageHeight);
+        sensor->addSeparatedBuffers(numThreads);
+        
+        float baseRadius = m_initialRadius * scene.getWorldRadius();
+        
+        printf("Vertex Connection and Merging: %u[spp], initial radius: %g\n", m_samplesPerPixel, baseRadius);
+        RenderStatistics stats(numThreads);
+        job.stats = &stats;
+        ProgressReporter reporter(numThreads, settings.getInt(RenderSettingItem::ProgressFD));
+        job.reporter = &reporter;
+        
+        PassScheduler scheduler(settings, m_samplesPerPixel);
+        scheduler.begin(sensor, samplers, numThreads);
+        
+        uint32_t numTiles = sensor->numTileX() * sensor->numTileY();
+        uint32_t firstPass = std::min(scheduler.numPasses(), scheduler.maxNumPasses());
+        if (!scheduler.isProgressive())
+            reporter.pushJob("Rendering", (scheduler.maxNumPasses() - firstPass) * numTiles, scheduler.startTime());
+        char nextTitle[32];
+        snprintf(nextTitle, sizeof(nextTitle), "To %5uspp", scheduler.nextExportPass());
+        reporter.pushJob(nextTitle, (scheduler.nextExportPass() - firstPass) * numTiles, scheduler.startTime());
+        uint32_t imgIdx = scheduler.numExportedImages();
+        ImageExporter exporter;
+        for (int s = firstPass; s < scheduler.maxNumPasses(); ++s) {
+            job.sampleIndex = s;
+            
+            // JP: パスで共有する時刻とスペクトルのサンプル。チェックポイントから再開しても同じ値となるようパス番号から決める。
+            // EN: the time and the wavelength samples shared in the pass. These are determined from the pass index to get the same values after resuming from a checkpoint.
+            job.time = timeStart + (timeEnd - timeStart) * scrambledRadicalInverse(HaltonPrimes[0], s, seed);
+            job.wls = WavelengthSamples::createWithEqualOffsets(scrambledRadicalInverse(HaltonPrimes[1], s, seed),
+                                                                scrambledRadicalInverse(HaltonPrimes[2], s, seed), &job.selectWLPDF);
+            
+            // JP: マージ半径を縮小し、マージをパス密度推定とみなした際の係数を求める。
+            // EN: reduce the merging radius, and calculate coefficients when regarding merging as path density estimation.
+            float radius = baseRadius / std::pow(float(s + 1), 0.5f * (1 - m_radiusReductionRate));
+            float etaVCM = M_PI * radius * radius * numLightSubPaths;
+            job.misFactors.VMWeightFactor = calcMISTerm(etaVCM);
+            job.misFactors.VCWeightFactor = calcMISTerm(1.0f / etaVCM);
+            job.misFactors.VMNormalization = 1.0f / etaVCM;
+            
+            {
+                ScopedPhaseTimer timer(&stats, StatPhase::LightTracing);
+                ThreadPool threadPool(numThreads);
+                for (int ty = 0; ty < sensor->numTileY(); ++ty) {
+                    for (int tx = 0; tx < sensor->numTileX(); ++tx) {
+                        job.basePixelX = tx * sensor->tileWidth();
+                        job.basePixelY = ty * sensor->tileHeight();
+                        threadPool.enqueue(std::bind(lightKernel, job, std::placeholders::_1));
+                    }
+                }
+                threadPool.wait();
+            }
+            
+            // JP: 光源上の頂点はマージに用いないので格納しない。
+            // EN: vertices on lights are not stored since they are not used for merging.
+            std::vector<std::pair<const VCMVertex*, uint32_t>> chunks;
+            for (int i = 0; i < numThreads; ++i) {
+                const VCMSubPath &vertices = lightVertexStorages[i].vertices;
+                if (vertices.size() > 0)
+                    chunks.emplace_back(&vertices[0], vertices.size());
+            }
+            lightVertexGrid.build(chunks, radius, numThreads, [](const VCMVertex &vtx) { return vtx.pathLength > 0; });
+            
+            {
+                ScopedPhaseTimer timer(&stats, StatPhase::Rendering);
+                ThreadPool threadPool(numThreads);
+                for (int ty = 0; ty < sensor->numTileY(); ++ty) {
+                    for (int tx = 0; tx < sensor->numTileX(); ++tx) {
+                        job.basePixelX = tx * sensor->tileWidth();
+                        job.basePixelY = ty * sensor->tileHeight();
+                        threadPool.enqueue(std::bind(eyeKernel, job, std::placeholders::_1));
+                    }
+                }
+                threadPool.wait();
+            }
+            
+            for (int i = 0; i < numThreads; ++i) {
+                lightVertexStorages[i].vertices.clear();
+                lightMems[i].reset();
+            }
+            
+            stats.finishPass();
+            bool finished;
+            {
+                ScopedPhaseTimer timer(&stats, StatPhase::PassFinalization);
+                finished = !scheduler.finishPass(sensor);
+            }
+            if (scheduler.shouldExport(finished)) {
+                reporter.skipRemainingWork();
+                reporter.popJob();
+                
+                reporter.beginOtherThreadPrint();
+                char filename[256];
+                sprintf(filename, "%03u.%s", imgIdx, sensor->imageFileExtension());
+                float elapsed = scheduler.elapsedTime();
+                {
+                    ScopedPhaseTimer timer(&stats, StatPhase::ImageOutput);
+                    exporter.exportImage(*sensor, filename, settings.getFloat(RenderSettingItem::Brightness) / (s + 1 - scheduler.firstPass()));
+                }
+                printf("%u samples: %s, %g[s], radius: %g\n", s + 1, filename, elapsed, radius);
+                sprintf(filename, "%03u.json", imgIdx);
+                stats.writeJSON(filename, "VCM");
+                reporter.endOtherThreadPrint();
+                
+                ++imgIdx;
+                if (finished)
+                    break;
+                scheduler.advanceExport();
+                snprintf(nextTitle, sizeof(nextTitle), "To %5uspp", scheduler.nextExportPass());
+                reporter.pushJob(nextTitle, (scheduler.nextExportPass() - (s + 1)) * numTiles, scheduler.startTime());
+            }
+        }
+        if (!scheduler.isProgressive()) {
+            reporter.skipRemainingWork();
+            reporter.popJob();
+        }
+        reporter.finish();
+        scheduler.printSummary();
+        
+        delete[] lightSubPathRanges;
+        for (int i = 0; i < numThreads; ++i) {
+            lightVertexStorages[i].~LightVertexStorage();
+            delete samplers[i];
+        }
+        SLR_freealign(lightVertexStorages);
+        delete[] samplers;
+        delete[] eyeMems;
+        delete[] lightMems;
+    }
+    
+    template <class SamplerType>
+    void VCMRenderer::Job::lightKernel(uint32_t threadID) {
+        ArenaAllocator &mem = lightMems[threadID];
+        SamplerType &pathSampler = static_cast<SamplerType &>(*pathSamplers[threadID]);
+        VCMSubPath &lightVertices = lightVertexStorages[threadID].vertices;
+        const int16_t wlHint = wls.selectedLambdaIndex;
+        threadStats = stats->threadStatistics(threadID);
+        ScopedThreadStatistics scopedStats(threadStats);
+        for (int ly = 0; ly < numPixelY; ++ly) {
+            for (int lx = 0; lx < numPixelX; ++lx) {
+                uint32_t px = basePixelX + lx;
+                uint32_t py = basePixelY + ly;
+                if (px >= imageWidth || py >= imageHeight)
+                    continue;
+                // JP: 同じピクセルの視点サブパスと異なるサンプルを用いるため、偶数番目のサンプル番号を用いる。
+                // EN: use even sample indices to use samples different from the eye subpath of the same pixel.
+                pathSampler.startPixelSample(px, py, 2 * sampleIndex);
+                
+                LightSubPathRange &range = lightSubPathRanges[py * imageWidth + px];
+                range.threadID = threadID;
+                range.begin = lightVertices.size();
+                
+                // select one light from all the lights in the scene.
+                float lightProb;
+                SurfaceLight light;
+                scene->selectSurfaceLight(pathSampler.getLightSelectionSample(), time, &light, &lightProb);
+                SLRAssert(std::isfinite(lightProb), "lightProb: unexpected value detected: %f", lightProb);
+                
+                // sample a ray with its radiance (emittance, EDF value) from the selected light.
+                LightPosQuery lightPosQuery(time, wls);
+                SurfaceLightPosQueryResult lightPosResult;
+                EDFQuery edfQuery;
+                EDFQueryResult edfResult;
+                EDF* edf;
+                SampledSpectrum Le0, Le1;
+                Ray ray;
+                float epsilon;
+                light.sampleRay(lightPosQuery, pathSampler.getSurfaceLightPosSample(), edfQuery, pathSampler.getEDFSample(), mem,
+                                &lightPosResult, &Le0, &edf, &edfResult, &Le1, &ray, &epsilon);
+                
+                // JP: 位置か方向がデルタ関数の光源には視点サブパスが到達できない。
+                // EN: eye subpaths cannot reach a light whose position or direction is a delta function.
+                float lightAreaPDF = lightProb * lightPosResult.areaPDF;
+                bool deltaLight = lightPosResult.posType.isDelta() || edfResult.dirType.isDelta();
+                lightVertices.emplace_back(SubPathVertex(lightPosResult.surfPt, edf), Le0 / lightAreaPDF,
+                                           deltaLight ? 0.0f : calcMISTerm(1.0f / lightAreaPDF), 0.0f, 0.0f, 0, false);
+                
+                float cosLight = lightPosResult.surfPt.calcCosTerm(ray.dir);
+                SampledSpectrum alpha = lightVertices.back().alpha * Le1 * (cosLight / edfResult.dirPDF);
+                float dVCM = calcMISTerm(1.0f / edfResult.dirPDF);
+                float dVC = deltaLight ? 0.0f : calcMISTerm(cosLight / (lightAreaPDF * edfResult.dirPDF));
+                float dVM = dVC * misFactors.VCWeightFactor;
+                
+                // create subsequent light subpath vertices by tracing in the scene.
+                WavelengthSamples pathWLs = wls;
+                RaySegment segment(epsilon);
+                SurfaceInteraction si;
+                SurfacePoint surfPt;
+                Point3D lastPosition = lightPosResult.surfPt.getPosition();
+                bool lastAtInfinity = lightPosResult.surfPt.atInfinity();
+                uint32_t pathLength = 0;
+                if (edfResult.dirPDF > 0.0f)
+                    threadStats->add(StatCounter::LightRays);
+                while (edfResult.dirPDF > 0.0f && scene->intersect(ray, segment, &si)) {
+                    si.calculateSurfacePoint(&surfPt);
+                    if (surfPt.atInfinity())
+                        break;
+                    ++pathLength;
+                    
+                    float dist2 = lastAtInfinity ? 1.0f : sqDistance(lastPosition, surfPt.getPosition());
+                    Vector3D dirOut_sn = surfPt.toLocal(-ray.dir);
+                    Normal3D gNorm_sn = surfPt.getLocalGeometricNormal();
+                    updateMISQuantitiesOnHit(dist2, surfPt.calcCosTerm(-ray.dir), &dVCM, &dVC, &dVM);
+                    
+                    BSDF* bsdf = surfPt.createBSDF(pathWLs, mem);
+                    BSDFQuery fsQuery(dirOut_sn, gNorm_sn, wlHint, DirectionType::All, true, true);
+                    
+                    // JP: デルタ関数のみからなるBSDFを持つ頂点は接続にもマージにも使えないため格納しない。
+                    // EN: a vertex with a BSDF consisting only of delta functions is not stored since it can be used for neither connection nor merging.
+                    if (bsdf->hasNonDelta())
+                        lightVertices.emplace_back(SubPathVertex(surfPt, bsdf, fsQuery), alpha, dVCM, dVC, dVM, pathLength, pathWLs.wavelengthSelected());
+                    
+                    BSDFQueryResult fsResult;
+                    SampledSpectrum fs = bsdf->sample(fsQuery, pathSampler.getBSDFSample(), &fsResult);
+                    if (fs == SampledSpectrum::Zero || fsResult.dirPDF == 0.0f)
+                        break;
+                    if (fsResult.sampledType.isDispersive() && !pathWLs.wavelengthSelected())
+                        pathWLs.flags |= WavelengthSamples::WavelengthIsSelected;
+                    Vector3D vecIn = surfPt.fromLocal(fsResult.dirLocal);
+                    float cosIn = surfPt.calcCosTerm(vecIn);
+                    SampledSpectrum weight = fs * (cosIn / fsResult.dirPDF);
+                    
+                    // Russian roulette
+                    float RRProb = std::min(weight.importance(wlHint), 1.0f);
+                    if (pathSampler.getPathTerminationSample() < RRProb) {
+                        weight /= RRProb;
+                    }
+                    else {
+                        threadStats->add(StatCounter::RussianRouletteTerminations);
+                        break;
+                    }
+                    
+                    alpha *= weight;
+                    updateMISQuantities(fsResult.dirPDF, fsResult.reverse.dirPDF, cosIn, fsResult.sampledType.isDelta(),
+                                        misFactors.VMWeightFactor, misFactors.VCWeightFactor, &dVCM, &dVC, &dVM);
+                    
+                    lastPosition = surfPt.getPosition();
+                    lastAtInfinity = false;
+                    ray = Ray(surfPt.getPosition(), vecIn, ray.time);
+                    segment = RaySegment(Ray::Epsilon);
+                    si = SurfaceInteraction();
+                    threadStats->add(StatCounter::LightRays);
+                }
+                
+                range.numVertices = lightVertices.size() - range.begin;
+            }
+        }
+    }
+    
+    template <class SamplerType>
+    void VCMRenderer::Job::eyeKernel(uint32_t threadID) {
+        ArenaAllocator &mem = eyeMems[threadID];
+        SamplerType &pathSampler = static_cast<SamplerType &>(*pathSamplers[threadID]);
+        const int16_t wlHint = wls.selectedLambdaIndex;
+        threadStats = stats->threadStatistics(threadID);
+        ScopedThreadStatistics scopedStats(threadStats);
+        for (int ly = 0; ly < numPixelY; ++ly) {
+            for (int lx = 0; lx < numPixelX; ++lx) {
+                uint32_t px = basePixelX + lx;
+                uint32_t py = basePixelY + ly;
+                if (px >= imageWidth || py >= imageHeight)
+                    continue;
+                pathSampler.startPixelSample(px, py, 2 * sampleIndex + 1);
+                PixelPosition p = pathSampler.getPixelPositionSample(px, py);
+                
+                const LightSubPathRange &range = lightSubPathRanges[py * imageWidth + px];
+                const VCMSubPath &lightVertices = lightVertexStorages[range.threadID].vertices;
+                
+                // sample a ray with its importances (spatial, directional) from the lens and its IDF.
+                LensPosQuery lensQuery(time, wls);
+                LensPosQueryResult lensResult;
+                IDFSample WeSample(p.x / imageWidth, p.y / imageHeight);
+                IDFQueryResult WeResult;
+                IDF* idf;
+                SampledSpectrum We0, We1;
+                Ray ray;
+                float epsilon;
+                camera->sampleRay(lensQuery, pathSampler.getLensPosSample(), WeSample, mem,
+                                  &lensResult, &We0, &idf, &WeResult, &We1, &ray, &epsilon);
+                
+                VCMVertex lensVtx(SubPathVertex(lensResult.surfPt, idf), We0 / (lensResult.areaPDF * selectWLPDF), 0.0f, 0.0f, 0.0f, 0, false);
+                
+                // JP: 光源サブパスの各頂点をレンズ上の頂点に接続する。(ライトトレーシング)
+                // EN: connect each vertex of the light subpath to the vertex on the lens. (light tracing)
+                for (int i = 0; i < range.numVertices; ++i) {
+                    const VCMVertex &lVtx = lightVertices[range.begin + i];
+                    Vector3D eConnectVector;
+                    SampledSpectrum contribution = connectVertices(lVtx, lensVtx, wlHint, &eConnectVector);
+                    if (contribution == SampledSpectrum::Zero)
+                        continue;
+                    contribution *= lVtx.alpha * lensVtx.alpha;
+                    float hitPx, hitPy;
+                    idf->calculatePixel(eConnectVector, &hitPx, &hitPy);
+                    sensor->add(threadID, hitPx, hitPy, wls, contribution);
+                }
+                
+                SampledSpectrum alpha = lensVtx.alpha * We1 * (lensResult.surfPt.calcCosTerm(ray.dir) / WeResult.dirPDF);
+                float dVCM = calcMISTerm(1.0f / WeResult.dirPDF);
+                float dVC = 0.0f;
+                float dVM = 0.0f;
+                
+                // create subsequent eye subpath vertices by tracing in the scene.
+                WavelengthSamples pathWLs = wls;
+                RaySegment segment(epsilon);
+                SurfaceInteraction si;
+                SurfacePoint surfPt;
+                Point3D lastPosition = lensResult.surfPt.getPosition();
+                uint32_t pathLength = 0;
+                if (WeResult.dirPDF > 0.0f)
+                    threadStats->add(StatCounter::CameraRays);
+                while (WeResult.dirPDF > 0.0f && scene->intersect(ray, segment, &si)) {
+                    si.calculateSurfacePoint(&surfPt);
+                    ++pathLength;
+                    
+                    float dist2 = surfPt.atInfinity() ? 1.0f : sqDistance(lastPosition, surfPt.getPosition());
+                    Vector3D dirOut_sn = surfPt.toLocal(-ray.dir);
+                    Normal3D gNorm_sn = surfPt.getLocalGeometricNormal();
+                    updateMISQuantitiesOnHit(dist2, surfPt.calcCosTerm(-ray.dir), &dVCM, &dVC, &dVM);
+                    
+                    // implicit path (zero light subpath vertices, s = 0)
+                    if (surfPt.isEmitting()) {
+                        EDF* edf = surfPt.createEDF(pathWLs, mem);
+                        SampledSpectrum Le0 = surfPt.emittance(pathWLs);
+                        SampledSpectrum Le1 = edf->evaluate(EDFQuery(), dirOut_sn);
+                        
+                        float lightAreaPDF = si.getLightProb() * surfPt.evaluateAreaPDF();
+                        float emitDirPDF = edf->evaluatePDF(EDFQuery(), dirOut_sn);
+                        float recMISWeight = 1.0f + calcMISTerm(lightAreaPDF) * (dVCM + calcMISTerm(emitDirPDF) * dVC);
+                        float MISWeight = 1.0f / recMISWeight;
+                        if (!std::isinf(MISWeight) && !std::isnan(MISWeight)) {
+                            SampledSpectrum contribution = MISWeight * alpha * Le0 * Le1;
+                            SLRAssert(contribution.allFinite() && !contribution.hasMinus(),
+                                      "Unexpected value detected: %s\n"
+                                      "pix: (%f, %f)", contribution.toString().c_str(), p.x, p.y);
+                            if (pathWLs.wavelengthSelected())
+                                contribution[wlHint] *= WavelengthSamples::NumComponents;
+                            sensor->add(p.x, p.y, pathWLs, contribution);
+                        }
+                    }
+                    
+                    if (surfPt.atInfinity())
+                        break;
+                    
+                    BSDF* bsdf = surfPt.createBSDF(pathWLs, mem);
+                    BSDFQuery fsQuery(dirOut_sn, gNorm_sn, wlHint, DirectionType::All, true, false);
+                    
+                    if (bsdf->hasNonDelta()) {
+                        VCMVertex eVtx(SubPathVertex(surfPt, bsdf, fsQuery), alpha, dVCM, dVC, dVM, pathLength, pathWLs.wavelengthSelected());
+                        
+                        // JP: 同じピクセルの光源サブパスの各頂点と接続する。
+                        // EN: connect to each vertex of the light subpath of the same pixel.
+                        for (int i = 0; i < range.numVertices; ++i) {
+                            const VCMVertex &lVtx = lightVertices[range.begin + i];
+                            Vector3D eConnectVector;
+                            SampledSpectrum contribution = connectVertices(lVtx, eVtx, wlHint, &eConnectVector);
+                            if (contribution == SampledSpectrum::Zero)
+                                continue;
+                            sensor->add(p.x, p.y, wls, contribution * lVtx.alpha * eVtx.alpha);
+                        }
+                        
+                        SampledSpectrum contribution = mergeLightVertices(eVtx, wlHint);
+                        if (contribution != SampledSpectrum::Zero)
+                            sensor->add(p.x, p.y, wls, contribution * eVtx.alpha);
+                    }
+                    
+                    BSDFQueryResult fsResult;
+                    SampledSpectrum fs = bsdf->sample(fsQuery, pathSampler.getBSDFSample(), &fsResult);
+                    if (fs == SampledSpectrum::Zero || fsResult.dirPDF == 0.0f)
+                        break;
+                    if (fsResult.sampledType.isDispersive() && !pathWLs.wavelengthSelected())
+                        pathWLs.flags |= WavelengthSamples::WavelengthIsSelected;
+                    Vector3D vecIn = surfPt.fromLocal(fsResult.dirLocal);
+                    float cosIn = surfPt.calcCosTerm(vecIn);
+                    SampledSpectrum weight = fs * (cosIn / fsResult.dirPDF);
+                    
+                    // Russian roulette
+                    float RRProb = std::min(weight.importance(wlHint), 1.0f);
+                    if (pathSampler.getPathTerminationSample() < RRProb) {
+                        weight /= RRProb;
+                    }
+                    else {
+                        threadStats->add(StatCounter::RussianRouletteTerminations);
+                        break;
+                    }
+                    
+                    alpha *= weight;
+                    updateMISQuantities(fsResult.dirPDF, fsResult.reverse.dirPDF, cosIn, fsResult.sampledType.isDelta(),
+                                        misFactors.VMWeightFactor, misFactors.VCWeightFactor, &dVCM, &dVC, &dVM);
+                    
+                    lastPosition = surfPt.getPosition();
+                    ray = Ray(surfPt.getPosition(), vecIn, ray.time);
+                    segment = RaySegment(Ray::Epsilon);
+                    si = SurfaceInteraction();
+                    threadStats->add(StatCounter::BounceRays);
+                }
+                
+                threadStats->addPathLength(pathLength);
+                threadStats->recordArenaUsage(mem.bytesInUse());
+                mem.reset();
+            }
+        }
+        reporter->update(threadID);
+    }
+    
+    SampledSpectrum VCMRenderer::Job::connectVertices(const VCMVertex &lVtx, const VCMVertex &eVtx, int16_t wlHint, Vector3D* eConnectVector) const {
+        float connectDist2;
+        Vector3D connectionVector = lVtx.getDirectionFrom(eVtx.position, &connectDist2);
+        float cosLightEnd = lVtx.calcCosTerm(connectionVector);
+        float cosEyeEnd = eVtx.calcCosTerm(connectionVector);
+        float G = cosEyeEnd * cosLightEnd / connectDist2;
+        // JP: 同一平面上の頂点同士など、幾何項が0の接続ではシェーディング法線の補正が不定となるため棄却する。
+        // EN: reject connections with zero geometric term, e.g. between vertices on the same plane, since the shading normal correction is undefined.
+        if (G == 0.0f)
+            return SampledSpectrum::Zero;
+        
+        Vector3D lConnectVector = lVtx.toLocal(-connectionVector);
+        SampledSpectrum lRevDDF;
+        SampledSpectrum lDDF = lVtx.evaluateDDF(lConnectVector, wlHint, &lRevDDF);
+        float lRevDirPDF;
+        float lDirPDF = lVtx.evaluateDDFPDF(lConnectVector, wlHint, &lRevDirPDF);
+        
+        *eConnectVector = eVtx.toLocal(connectionVector);
+        SampledSpectrum eRevDDF;
+        SampledSpectrum eDDF = eVtx.evaluateDDF(*eConnectVector, wlHint, &eRevDDF);
+        float eRevDirPDF;
+        float eDirPDF = eVtx.evaluateDDFPDF(*eConnectVector, wlHint, &eRevDirPDF);
+        
+        SampledSpectrum connectionTerm = lDDF * G * eDDF;
+        if (connectionTerm == SampledSpectrum::Zero)
+            return SampledSpectrum::Zero;
+        
+        threadStats->add(StatCounter::ShadowRays);
+        if (!scene->testVisibility(eVtx.position, lVtx.position, lVtx.atInfinity, time))
+            return SampledSpectrum::Zero;
+        
+        // JP: 光源・視点サブパスの端点を相手側のサブパスが生成する面積測度の確率密度。
+        //     光源上の頂点とレンズ上の頂点ではマージできず、レンズ上の頂点を光源サブパスが生成する戦略は考慮しない。
+        // EN: area-measure PDFs of the opposite subpath generating the end vertices of the light/eye subpaths.
+        //     Merging is not possible at a vertex on a light or on the lens, and the strategy where the light subpath generates the vertex on the lens is not considered.
+        float eExtendAreaPDF = eDirPDF * cosLightEnd / connectDist2;
+        float lExtendAreaPDF = lDirPDF * cosEyeEnd / connectDist2;
+        float wLight = calcMISTerm(eExtendAreaPDF) * (lVtx.dVCM + lVtx.dVC * calcMISTerm(lRevDirPDF) + (lVtx.pathLength > 0 ? misFactors.VMWeightFactor : 0.0f));
+        float wEye = 0.0f;
+        if (eVtx.pathLength > 0)
+            wEye = calcMISTerm(lExtendAreaPDF) * (eVtx.dVCM + eVtx.dVC * calcMISTerm(eRevDirPDF) + misFactors.VMWeightFactor);
+        float MISWeight = 1.0f / (wLight + 1.0f + wEye);
+        if (std::isinf(MISWeight) || std::isnan(MISWeight))
+            return SampledSpectrum::Zero;
+        SLRAssert(MISWeight >= 0 && MISWeight <= 1.0f, "invalid MIS weight: %g", MISWeight);
+        
+        if (lVtx.lambdaSelected || eVtx.lambdaSelected)
+            connectionTerm[wlHint] *= WavelengthSamples::NumComponents;
+        
+        return MISWeight * connectionTerm;
+    }
+    
+    SampledSpectrum VCMRenderer::Job::mergeLightVertices(const VCMVertex &eVtx, int16_t wlHint) const {
+        SampledSpectrum contribution = SampledSpectrum::Zero;
+        auto merge = [this, &eVtx, wlHint, &contribution](const VCMVertex &lVtx) {
+            // JP: 光源頂点への入射方向で視点頂点のBSDFを評価する。
+            // EN: evaluate the BSDF of the eye vertex with the incident direction to the light vertex.
+            Vector3D dirIn = lVtx.fromLocal(lVtx.dirOut_sn);
+            if (eVtx.calcCosTerm(dirIn) == 0.0f)
+                return;
+            Vector3D dirIn_sn = eVtx.toLocal(dirIn);
+            SampledSpectrum revFs;
+            SampledSpectrum fs = eVtx.evaluateDDF(dirIn_sn, wlHint, &revFs);
+            if (fs == SampledSpectrum::Zero)
+                return;
+            float eRevDirPDF;
+            float eDirPDF = eVtx.evaluateDDFPDF(dirIn_sn, wlHint, &eRevDirPDF);
+            
+            float wLight = lVtx.dVCM * misFactors.VCWeightFactor + lVtx.dVM * calcMISTerm(eDirPDF);
+            float wEye = eVtx.dVCM * misFactors.VCWeightFactor + eVtx.dVM * calcMISTerm(eRevDirPDF);
+            float MISWeight = 1.0f / (wLight + 1.0f + wEye);
+            if (std::isinf(MISWeight) || std::isnan(MISWeight))
+                return;
+            
+            SampledSpectrum value = MISWeight * fs * lVtx.alpha;
+            if (lVtx.lambdaSelected || eVtx.lambdaSelected)
+                value[wlHint] *= WavelengthSamples::NumComponents;
+            contribution += value;
+        };
+        lightVertexGrid->query(eVtx.position, merge);
+        return misFactors.VMNormalization * contribution;
+    }
+}
@@ -0,0 +1,131 @@
+//
+//  VCMRenderer.h
+//
+//  Created by 渡部 心 on 2017/06/20.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#ifndef __SLR_VCMRenderer__
+#define __SLR_VCMRenderer__
+
+#include "../defines.h"
+#include "../declarations.h"
+#include "../Core/renderer.h"
+#include "../Core/light_path_sampler.h"
+
+#include "../Core/subpath_vertex.h"
+#include "../Core/PointHashGrid.h"
+
+namespace SLR {
+    // JP: Vertex Connection and Merging。
+    //     各パスでピクセルごとに1本の光源サブパスを生成して全頂点をハッシュグリッドに格納した後、
+    //     視点サブパスを生成し、同じピクセルの光源サブパスとの接続(双方向パストレーシング)と
+    //     格納された全光源頂点とのマージ(プログレッシブフォトンマッピング)をMISで組み合わせる。
+    //     マージ半径はパスごとに縮小する。
+    //     光源・視点サブパスがスペクトルのサンプルと時刻を共有する必要があるため、これらはパスごとに1つ選ぶ。
+    // EN: Vertex Connection and Merging.
+    //     Each pass generates one light subpath per pixel and stores all of their vertices to a hash grid,
+    //     then generates eye subpaths and combines, with MIS, connections to the light subpath of the same pixel (bidirectional path tracing)
+    //     and merging with all the stored light vertices (progressive photon mapping).
+    //     The merging radius is reduced in each pass.
+    //     Light and eye subpaths need to share the wavelength samples and the time, so these are chosen once per pass.
+    class SLR_API VCMRenderer : public Renderer {
+        // JP: MISウェイトを再帰的に求めるための量dVCM, dVC, dVMを持つ頂点。
+        //     pathLengthはサブパスの起点からの辺の数で、光源上の頂点は0となる。
+        // EN: a vertex having the quantities dVCM, dVC and dVM to recursively calculate MIS weights.
+        //     pathLength is the number of edges from the origin of the subpath, and it is 0 for a vertex on a light.
+        struct VCMVertex : public SubPathVertex {
+            SampledSpectrum alpha;
+            float dVCM;
+            float dVC;
+            float dVM;
+            uint32_t pathLength;
+            bool lambdaSelected;
+            
+            VCMVertex(const SubPathVertex &vertex, const SampledSpectrum &_alpha,
+                      float _dVCM, float _dVC, float _dVM, uint32_t _pathLength, bool _lambdaSelected) :
+            SubPathVertex(vertex), alpha(_alpha), dVCM(_dVCM), dVC(_dVC), dVM(_dVM), pathLength(_pathLength), lambdaSelected(_lambdaSelected) {}
+        };
+        typedef SubPath<VCMVertex> VCMSubPath;
+        
+        // JP: スレッドごとに1パス分の光源頂点を保持する配列。偽共有を避けるためキャッシュラインの大きさに揃える。
+        // EN: per-thread array holding light vertices for one pass. This is aligned to the cache line size to avoid false sharing.
+        struct alignas(SLR_L1_Cacheline_Size) LightVertexStorage {
+            VCMSubPath vertices;
+        };
+        
+        // JP: ピクセルに対応する光源サブパスの頂点の位置。
+        // EN: location of the vertices of the light subpath corresponding to a pixel.
+        struct LightSubPathRange {
+            uint32_t threadID;
+            uint32_t begin;
+            uint32_t numVertices;
+        };
+        
+        // JP: パスの間で不変な、MISウェイトの計算に用いる係数。
+        // EN: coefficients used for MIS weight calculation which are constant during a pass.
+        struct MISFactors {
+            float VMWeightFactor;
+            float VCWeightFactor;
+            float VMNormalization;
+        };
+        
+        struct Job {
+            const Scene* scene;
+            
+            ArenaAllocator* lightMems;
+            ArenaAllocator* eyeMems;
+            LightPathSampler** pathSamplers;
+            LightVertexStorage* lightVertexStorages;
+            LightSubPathRange* lightSubPathRanges;
+            const PointHashGrid<VCMVertex>* lightVertexGrid;
+            
+            const Camera* camera;
+            ImageSensor* sensor;
+            uint32_t imageWidth;
+            uint32_t imageHeight;
+            uint32_t numPixelX;
+            uint32_t numPixelY;
+            uint32_t basePixelX;
+            uint32_t basePixelY;
+            uint32_t sampleIndex;
+            float time;
+            WavelengthSamples wls;
+            float selectWLPDF;
+            MISFactors misFactors;
+            
+            // working area
+            ThreadStatistics* threadStats;
+            
+            RenderStatistics* stats;
+            ProgressReporter* reporter;
+            
+            template <class SamplerType>
+            void lightKernel(uint32_t threadID);
+            template <class SamplerType>
+            void eyeKernel(uint32_t threadID);
+            
+            // JP: 光源頂点と視点頂点を接続し、両端のアルファを除くMISウェイト付きの寄与を返す。
+            // EN: connect a light vertex and an eye vertex, and return the MIS-weighted contribution excluding the alphas of both ends.
+            SampledSpectrum connectVertices(const VCMVertex &lVtx, const VCMVertex &eVtx, int16_t wlHint, Vector3D* eConnectVector) const;
+            // JP: 視点頂点の周囲の光源頂点とマージし、視点頂点のアルファを除くMISウェイト付きの寄与を返す。
+            // EN: merge the light vertices around an eye vertex, and return the MIS-weighted contribution excluding the alpha of the eye vertex.
+            SampledSpectrum mergeLightVertices(const VCMVertex &eVtx, int16_t wlHint) const;
+        };
+        
+        uint32_t m_samplesPerPixel;
+        LightPathSamplerType m_samplerType;
+        float m_initialRadius;
+        float m_radiusReductionRate;
+    public:
+        // JP: initialRadiusはシーンの外接球の半径に対する初期マージ半径の比率、
+        //     radiusReductionRateはパスごとの半径縮小の度合いを決めるプログレッシブフォトンマッピングのα(0, 1)である。
+        // EN: initialRadius is the ratio of the initial merging radius to the radius of the scene's bounding sphere,
+        //     radiusReductionRate is the alpha (0, 1) of progressive photon mapping which determines how the radius is reduced in each pass.
+        VCMRenderer(uint32_t spp, LightPathSamplerType samplerType = LightPathSamplerType::Independent,
+                    float initialRadius = 0.003f, float radiusReductionRate = 0.75f);
+        void render(const Scene &scene, const RenderSettings &settings) const override;
+    };
+}
+
+#endif /* __SLR_VCMRenderer__ */
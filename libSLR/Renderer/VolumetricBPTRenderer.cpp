@@ -12,29 +12,53 @@
 #include "../Core/camera.h"
 #include "../Core/light_path_sampler.h"
 #include "../Core/ImageSensor.h"
+#include "../Core/ImageExporter.h"
 #include "../Core/RenderSettings.h"
 #include "../Core/ProgressReporter.h"
+#include "../Core/RenderStatistics.h"
+#include "../Core/PassScheduler.h"
+#include "../Core/bidirectional_mis_weights.h"
 #include "../RNG/XORShiftRNG.h"
 #include "../Scene/Scene.h"
 #include "../Helper/ThreadPool.h"
 
 namespace SLR {
-    VolumetricBPTRenderer::VolumetricBPTRenderer(uint32_t spp) : m_samplesPerPixel(spp) {
+    VolumetricBPTRenderer::VolumetricBPTRenderer(uint32_t spp, LightPathSamplerType samplerType) : m_samplesPerPixel(spp), m_samplerType(samplerType) {
     }
     
     void VolumetricBPTRenderer::render(const Scene &scene, const RenderSettings &settings) const {
         uint32_t numThreads = settings.getInt(RenderSettingItem::NumThreads);
         XORShiftRNG topRand(settings.getInt(RenderSettingItem::RNGSeed));
         ArenaAllocator* mems = new ArenaAllocator[numThreads];
-        IndependentLightPathSampler* samplers = new IndependentLightPathSampler[numThreads];
+        LightPathSampler** samplers = new LightPathSampler*[numThreads];
         for (int i = 0; i < numThreads; ++i) {
             new (mems + i) ArenaAllocator();
-            new (samplers + i) IndependentLightPathSampler(topRand.getUInt());
+            samplers[i] = createLightPathSampler(m_samplerType, settings.getInt(RenderSettingItem::RNGSeed), topRand.getUInt());
         }
         
         const Camera* camera = scene.getCamera();
         ImageSensor* sensor = camera->getSensor();
         
+        // JP: サンプラーの具体的な型に特殊化したカーネルをここで選択する。
+        //     カーネル内のサンプラー呼び出しは静的に束縛されてインライン化される。
+        // EN: select the kernel specialized for the concrete sampler type here.
+        //     Sampler calls in the kernel are statically bound and inlined.
+        void (Job::*kernel)(uint32_t) = nullptr;
+        switch (m_samplerType) {
+            case LightPathSamplerType::Independent:
+                kernel = &Job::kernel<IndependentLightPathSampler>;
+                break;
+            case LightPathSamplerType::Sobol:
+                kernel = &Job::kernel<SobolLightPathSampler>;
+                break;
+            case LightPathSamplerType::Halton:
+                kernel = &Job::kernel<HaltonLightPathSampler>;
+                break;
+            default:
+                SLRAssert_ShouldNotBeCalled();
+                break;
+        }
+        
         Job job;
         job.scene = &scene;
         
@@ -43,68 +67,120 @@ namespace SLR {
         
         job.camera = camera;
         job.sensor = sensor;
+        job.rngSeed = settings.getInt(RenderSettingItem::RNGSeed);
         job.timeStart = settings.getFloat(RenderSettingItem::TimeStart);
         job.timeEnd = settings.getFloat(RenderSettingItem::TimeEnd);
         job.imageWidth = settings.getInt(RenderSettingItem::ImageWidth);
         job.imageHeight = settings.getInt(RenderSettingItem::ImageHeight);
+        job.validateMISWeights = settings.getBool(RenderSettingItem::ValidateMISWeights);
         job.numPixelX = sensor->tileWidth();
         job.numPixelY = sensor->tileHeight();
         
         sensor->init(job.imageWidth, job.imageHeight);
-        sensor->addSeparatedBuffers(numThreads);
+        // JP: ライトトレーシングの寄与はタイルごとに記録し、パスの終わりにタイルの順で1つの分離されたバッファへ加算する。
+        //     どのスレッドがどのタイルを処理しても加算の順序が変わらず、スレッド数によらず同じ画像になる。
+        // EN: record light tracing contributions per tile, and add them to a single separated buffer in tile order at the end of a pass.
+        //     The order of additions doesn't depend on which thread processes which tile, so the image is the same regardless of the number of threads.
+        sensor->addSeparatedBuffers(1);
+        std::vector<SensorSplat>* tileSplats = new std::vector<SensorSplat>[sensor->numTileX() * sensor->numTileY()];
+        job.tileSplats = tileSplats;
         
         printf("Volumetric Bidirectional Path Tracing: %u[spp]\n", m_samplesPerPixel);
-        ProgressReporter reporter;
+        RenderStatistics stats(numThreads);
+        job.stats = &stats;
+        ProgressReporter reporter(numThreads, settings.getInt(RenderSettingItem::ProgressFD));
         job.reporter = &reporter;
         
-        reporter.pushJob("Rendering", m_samplesPerPixel * sensor->numTileX() * sensor->numTileY());
+        PassScheduler scheduler(settings, m_samplesPerPixel);
+        scheduler.begin(sensor, samplers, numThreads);
+        
+        // JP: プログレッシブモードでは総作業量が分からないため、次の画像出力までの作業のみを表示する。
+        // EN: The total work is unknown in progressive mode, so only the work until the next export is shown.
+        uint32_t numTiles = sensor->numTileX() * sensor->numTileY();
+        uint32_t firstPass = std::min(scheduler.numPasses(), scheduler.maxNumPasses());
+        if (!scheduler.isProgressive())
+            reporter.pushJob("Rendering", (scheduler.maxNumPasses() - firstPass) * numTiles, scheduler.startTime());
         char nextTitle[32];
-        snprintf(nextTitle, sizeof(nextTitle), "To %5uspp", 1);
-        reporter.pushJob(nextTitle, 1 * sensor->numTileX() * sensor->numTileY());
-        uint32_t imgIdx = 0;
-        uint32_t exportPass = 1;
-        for (int s = 0; s < m_samplesPerPixel; ++s) {
-            ThreadPool threadPool(numThreads);
-            for (int ty = 0; ty < sensor->numTileY(); ++ty) {
-                for (int tx = 0; tx < sensor->numTileX(); ++tx) {
-                    job.basePixelX = tx * sensor->tileWidth();
-                    job.basePixelY = ty * sensor->tileHeight();
-                    threadPool.enqueue(std::bind(&Job::kernel, job, std::placeholders::_1));
+        snprintf(nextTitle, sizeof(nextTitle), "To %5uspp", scheduler.nextExportPass());
+        reporter.pushJob(nextTitle, (scheduler.nextExportPass() - firstPass) * numTiles, scheduler.startTime());
+        uint32_t imgIdx = scheduler.numExportedImages();
+        ImageExporter exporter;
+        for (int s = firstPass; s < scheduler.maxNumPasses(); ++s) {
+            job.sampleIndex = s;
+            {
+                ScopedPhaseTimer timer(&stats, StatPhase::Rendering);
+                ThreadPool threadPool(numThreads);
+                for (int ty = 0; ty < sensor->numTileY(); ++ty) {
+                    for (int tx = 0; tx < sensor->numTileX(); ++tx) {
+                        job.basePixelX = tx * sensor->tileWidth();
+                        job.basePixelY = ty * sensor->tileHeight();
+                        threadPool.enqueue(std::bind(kernel, job, std::placeholders::_1));
+                    }
+                }
+                threadPool.wait();
+                for (int i = 0; i < numTiles; ++i) {
+                    sensor->addSplats(0, tileSplats[i]);
+                    tileSplats[i].clear();
                 }
             }
-            threadPool.wait();
             
-            if ((s + 1) == exportPass) {
+            stats.finishPass();
+            bool finished;
+            {
+                ScopedPhaseTimer timer(&stats, StatPhase::PassFinalization);
+                finished = !scheduler.finishPass(sensor);
+            }
+            if (scheduler.shouldExport(finished)) {
+                reporter.skipRemainingWork();
                 reporter.popJob();
                 
                 reporter.beginOtherThreadPrint();
                 char filename[256];
-                sprintf(filename, "%03u.bmp", imgIdx);
-                double elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(reporter.elapsed()).count();
-                sensor->saveImage(filename, settings.getFloat(RenderSettingItem::Brightness) / (s + 1));
-                printf("%u samples: %s, %g[s]\n", exportPass, filename, elapsed * 0.001f);
+                sprintf(filename, "%03u.%s", imgIdx, sensor->imageFileExtension());
+                float elapsed = scheduler.elapsedTime();
+                {
+                    ScopedPhaseTimer timer(&stats, StatPhase::ImageOutput);
+                    exporter.exportImage(*sensor, filename, settings.getFloat(RenderSettingItem::Brightness) / (s + 1 - scheduler.firstPass()));
+                }
+                printf("%u samples: %s, %g[s]\n", s + 1, filename, elapsed);
+                sprintf(filename, "%03u.json", imgIdx);
+                stats.writeJSON(filename, "VolumetricBPT");
                 reporter.endOtherThreadPrint();
                 
                 ++imgIdx;
-                if ((s + 1) == m_samplesPerPixel)
+                if (finished)
                     break;
-                exportPass += exportPass;
-                snprintf(nextTitle, sizeof(nextTitle), "To %5uspp", exportPass);
-                reporter.pushJob(nextTitle, (exportPass >> 1) * sensor->numTileX() * sensor->numTileY());
+                scheduler.advanceExport();
+                snprintf(nextTitle, sizeof(nextTitle), "To %5uspp", scheduler.nextExportPass());
+                reporter.pushJob(nextTitle, (scheduler.nextExportPass() - (s + 1)) * numTiles, scheduler.startTime());
             }
         }
-        reporter.popJob();
+        if (!scheduler.isProgressive()) {
+            reporter.skipRemainingWork();
+            reporter.popJob();
+        }
         reporter.finish();
+        scheduler.printSummary();
         
+        for (int i = 0; i < numThreads; ++i)
+            delete samplers[i];
         delete[] samplers;
+        delete[] tileSplats;
         delete[] mems;
     }
     
+    template <class SamplerType>
     void VolumetricBPTRenderer::Job::kernel(uint32_t threadID) {
         ArenaAllocator &mem = mems[threadID];
-        IndependentLightPathSampler &pathSampler = pathSamplers[threadID];
+        SamplerType &pathSampler = static_cast<SamplerType &>(*pathSamplers[threadID]);
+        uint32_t tileIndex = (basePixelY / numPixelY) * sensor->numTileX() + basePixelX / numPixelX;
+        pathSampler.reseed(tilePassSeed(rngSeed, tileIndex, sampleIndex));
+        std::vector<SensorSplat> &splats = tileSplats[tileIndex];
+        threadStats = stats->threadStatistics(threadID);
+        ScopedThreadStatistics scopedStats(threadStats);
         for (int ly = 0; ly < numPixelY; ++ly) {
             for (int lx = 0; lx < numPixelX; ++lx) {
+                pathSampler.startPixelSample(basePixelX + lx, basePixelY + ly, sampleIndex);
                 float time = pathSampler.getTimeSample(timeStart, timeEnd);
                 PixelPosition p = pathSampler.getPixelPositionSample(basePixelX + lx, basePixelY + ly);
                 
@@ -207,6 +283,7 @@ namespace SLR {
                         
                         SampledSpectrum visibility;
                         bool singleWavelength;
+                        threadStats->add(StatCounter::ShadowRays);
                         if (!scene->testVisibility(eVtx.interPt, lVtx.interPt, time, wls, pathSampler, &visibility, &singleWavelength))
                             continue;
                         
@@ -272,21 +349,26 @@ namespace SLR {
                             const IDF* idf = (const IDF*)eVtx.ddf->getDDF();
                             float hitPx, hitPy;
                             idf->calculatePixel(eConnectVector, &hitPx, &hitPy);
-                            sensor->add(threadID, hitPx, hitPy, wls, contribution);
+                            splats.push_back(SensorSplat{hitPx, hitPy, wls, contribution});
                         }
                         
                         // ----------------------------------------------------------------
                     }
                 }
                 
+                // JP: 経路長はカメラ上の頂点を除いた視点側サブパスの頂点数とする。
+                // EN: path length is the number of eye subpath vertices excluding the one on the camera.
+                threadStats->addPathLength((uint32_t)eyeVertices.size() - 1);
+                threadStats->recordArenaUsage(mem.bytesInUse());
                 mem.reset();
             }
         }
-        reporter->update();
+        reporter->update(threadID);
     }
     
+    template <class SamplerType>
     void VolumetricBPTRenderer::Job::generateSubPath(const WavelengthSamples &initWLs, const SampledSpectrum &initAlpha, const Ray &initRay, float initEpsilon, float dirPDF, DirectionType sampledType,
-                                                     float cosLast, bool adjoint, IndependentLightPathSampler &pathSampler, ArenaAllocator &mem) {
+                                                     float cosLast, bool adjoint, SamplerType &pathSampler, ArenaAllocator &mem) {
         std::vector<VBPTVertex> &vertices = adjoint ? lightVertices : eyeVertices;
         
         // reject invalid values.
@@ -304,6 +386,7 @@ namespace SLR {
         InteractionPoint* interPt;
         
         float RRProb = 1.0f;
+        threadStats->add(adjoint ? StatCounter::LightRays : StatCounter::CameraRays);
         while (scene->interact(ray, segment, wls, pathSampler, mem, &interact, &medThroughput, &singleWavelength)) {
             if (singleWavelength && !wls.wavelengthSelected())
                 wls.flags |= WavelengthSamples::WavelengthIsSelected;
@@ -363,10 +446,13 @@ namespace SLR {
             
             // Russian roulette
             RRProb = std::min(weight.importance(wlHint), 1.0f);
-            if (pathSampler.getPathTerminationSample() < RRProb)
+            if (pathSampler.getPathTerminationSample() < RRProb) {
                 weight /= RRProb;
-            else
+            }
+            else {
+                threadStats->add(StatCounter::RussianRouletteTerminations);
                 break;
+            }
             
             alpha *= weight;
             ray = Ray(interPt->getPosition(), vecIn, ray.time);
@@ -379,9 +465,20 @@ namespace SLR {
             vtxNextToLast.revSpatialPDF = abdfResult->reverseDirPDF() * cosLast / dist2;
             vtxNextToLast.revRRProb = std::min((abdfResult->reverseValue() * cosOut / abdfResult->reverseDirPDF()).importance(wlHint), 1.0f);
             
+            // JP: 逆方向の確率密度が確定したので、MISウェイトの部分和を頂点に蓄積する。
+            // EN: accumulate the partial sum for MIS weights to the vertex since its reverse PDF has been determined.
+            const uint32_t minNumVertices = adjoint ? 0 : 1;
+            if (vertices.size() - 1 > minNumVertices) {
+                float prevPartialSum = vertices.size() > 2 ? vertices[vertices.size() - 3].partialMISWeightSum : 0.0f;
+                vtxNextToLast.partialMISWeightSum = calcPartialMISWeightSum(prevPartialSum, vtxNextToLast.spatialPDF * vtxNextToLast.RRProb,
+                                                                            vtxNextToLast.revSpatialPDF * vtxNextToLast.revRRProb,
+                                                                            vtxNextToLast.sampledType.isDelta(), vertices.back().sampledType.isDelta());
+            }
+            
             cosLast = cosIn;
             dirPDF = abdfResult->dirPDF;
             sampledType = abdfResult->sampledType;
+            threadStats->add(adjoint ? StatCounter::LightRays : StatCounter::BounceRays);
         }
     }
     
@@ -389,35 +486,28 @@ namespace SLR {
     float VolumetricBPTRenderer::Job::calculateMISWeight(float lExtend1stSpatialPDF, float lExtend1stRRProb, float lExtend2ndSpatialPDF, float lExtend2ndRRProb,
                                                          float eExtend1stSpatialPDF, float eExtend1stRRProb, float eExtend2ndSpatialPDF, float eExtend2ndRRProb,
                                                          uint32_t numLVtx, uint32_t numEVtx) const {
+        // JP: 端点付近の頂点と、サブパス生成時に蓄積した部分和から短縮戦略の寄与を定数時間で求める。
+        // EN: calculate the contribution of the shortening strategies in constant time
+        //     from vertices near the end and the partial sum accumulated during subpath generation.
         const auto extendAndShorten = [](float extend1stSpatialPDF, float extend1stRRProb, float extend2ndSpatialPDF, float extend2ndRRProb,
                                          const std::vector<VBPTVertex> &subPathToShorten, uint32_t numVertices, uint32_t minNumVertices,
                                          FloatSum* recMISWeight) {
-            if (numVertices > minNumVertices) {
-                const VBPTVertex &endVtx = subPathToShorten[numVertices - 1];
-                float PDFRatio = extend1stSpatialPDF * extend1stRRProb / (endVtx.spatialPDF * endVtx.RRProb);
-                bool shortenIsDeltaSampled = endVtx.sampledType.isDelta();
-                if (!shortenIsDeltaSampled)
-                    *recMISWeight += PDFRatio * PDFRatio;
-                bool prevIsDeltaSampled = shortenIsDeltaSampled;
-                
-                if (numVertices - 1 > minNumVertices) {
-                    const VBPTVertex &newVtx = subPathToShorten[numVertices - 2];
-                    PDFRatio *= extend2ndSpatialPDF * extend2ndRRProb / (newVtx.spatialPDF * newVtx.RRProb);
-                    shortenIsDeltaSampled = newVtx.sampledType.isDelta();
-                    if (!shortenIsDeltaSampled && !prevIsDeltaSampled)
-                        *recMISWeight += PDFRatio * PDFRatio;
-                    prevIsDeltaSampled = shortenIsDeltaSampled;
-                    
-                    for (int i = numVertices - 2; i > minNumVertices; --i) {
-                        const VBPTVertex &newVtx = subPathToShorten[i - 1];
-                        PDFRatio *= newVtx.revSpatialPDF * newVtx.revRRProb / (newVtx.spatialPDF * newVtx.RRProb);
-                        shortenIsDeltaSampled = newVtx.sampledType.isDelta();
-                        if (!shortenIsDeltaSampled && !prevIsDeltaSampled)
-                            *recMISWeight += PDFRatio * PDFRatio;
-                        prevIsDeltaSampled = shortenIsDeltaSampled;
-                    }
-                }
+            if (numVertices <= minNumVertices)
+                return;
+            const VBPTVertex &endVtx = subPathToShorten[numVertices - 1];
+            float extend2ndPDF = 0.0f;
+            float nextToEndPDF = 1.0f;
+            bool nextToEndIsDelta = false;
+            if (numVertices - 1 > minNumVertices) {
+                const VBPTVertex &nextToEndVtx = subPathToShorten[numVertices - 2];
+                extend2ndPDF = extend2ndSpatialPDF * extend2ndRRProb;
+                nextToEndPDF = nextToEndVtx.spatialPDF * nextToEndVtx.RRProb;
+                nextToEndIsDelta = nextToEndVtx.sampledType.isDelta();
             }
+            float partialSum = numVertices > minNumVertices + 2 ? subPathToShorten[numVertices - 3].partialMISWeightSum : 0.0f;
+            *recMISWeight += calcShortenedMISWeightSum(extend1stSpatialPDF * extend1stRRProb, extend2ndPDF, numVertices, minNumVertices,
+                                                       endVtx.spatialPDF * endVtx.RRProb, endVtx.sampledType.isDelta(),
+                                                       nextToEndPDF, nextToEndIsDelta, partialSum);
         };
         
         // initialize the reciprocal of MISWeight by 1. This corresponds to the current strategy (numLVtx, numEVtx).
@@ -433,6 +523,23 @@ namespace SLR {
         extendAndShorten(eExtend1stSpatialPDF, eExtend1stRRProb, eExtend2ndSpatialPDF, eExtend2ndRRProb,
                          lightVertices, numLVtx, minLightVertices, &recMISWeight);
         
-        return 1.0f / recMISWeight;
+        float MISWeight = 1.0f / recMISWeight;
+        if (validateMISWeights) {
+            // JP: 全頂点を辿る以前の計算でもウェイトを求め、一致しない接続を数える。
+            // EN: also calculate the weight by the previous calculation walking all the vertices, and count connections where they disagree.
+            const auto walk = [](float extend1stPDF, float extend2ndPDF, const std::vector<VBPTVertex> &subPath, uint32_t numVertices, uint32_t minNumVertices) {
+                return calcShortenedMISWeightSumByWalk(extend1stPDF, extend2ndPDF, numVertices, minNumVertices,
+                                                       [&subPath](uint32_t i) { return subPath[i].spatialPDF * subPath[i].RRProb; },
+                                                       [&subPath](uint32_t i) { return subPath[i].revSpatialPDF * subPath[i].revRRProb; },
+                                                       [&subPath](uint32_t i) { return subPath[i].sampledType.isDelta(); });
+            };
+            FloatSum walkedRecMISWeight = 1;
+            walkedRecMISWeight += walk(lExtend1stSpatialPDF * lExtend1stRRProb, lExtend2ndSpatialPDF * lExtend2ndRRProb, eyeVertices, numEVtx, minEyeVertices);
+            walkedRecMISWeight += walk(eExtend1stSpatialPDF * eExtend1stRRProb, eExtend2ndSpatialPDF * eExtend2ndRRProb, lightVertices, numLVtx, minLightVertices);
+            threadStats->add(StatCounter::MISWeightValidations);
+            if (!MISWeightsAgree(MISWeight, 1.0f / walkedRecMISWeight))
+                threadStats->add(StatCounter::MISWeightMismatches);
+        }
+        return MISWeight;
     }
 }
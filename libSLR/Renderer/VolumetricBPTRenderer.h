@@ -11,6 +11,7 @@
 #include "../defines.h"
 #include "../declarations.h"
 #include "../Core/renderer.h"
+#include "../Core/light_path_sampler.h"
 
 #include "../Core/geometry.h"
 #include "../Core/directional_distribution_functions.h"
@@ -73,13 +74,14 @@ namespace SLR {
             float RRProb;
             float revSpatialPDF;
             float revRRProb;
+            float partialMISWeightSum;
             DirectionType sampledType;
             bool lambdaSelected;
             VBPTVertex(const InteractionPoint* _interPt, const DDFProxy* _ddf,
                        const SampledSpectrum &_alpha, float _cosIn, float _spatialPDF, float _RRProb, 
                        DirectionType _sampledType, bool _lambdaSelected) :
             interPt(_interPt), ddf(_ddf),
-            alpha(_alpha), cosIn(_cosIn), spatialPDF(_spatialPDF), RRProb(_RRProb), revSpatialPDF(NAN), revRRProb(NAN), 
+            alpha(_alpha), cosIn(_cosIn), spatialPDF(_spatialPDF), RRProb(_RRProb), revSpatialPDF(NAN), revRRProb(NAN), partialMISWeightSum(0.0f), 
             sampledType(_sampledType), lambdaSelected(_lambdaSelected) {}
         };
         
@@ -87,7 +89,7 @@ namespace SLR {
             const Scene* scene;
             
             ArenaAllocator* mems;
-            IndependentLightPathSampler* pathSamplers;
+            LightPathSampler** pathSamplers;
             
             const Camera* camera;
             ImageSensor* sensor;
@@ -99,26 +101,35 @@ namespace SLR {
             uint32_t numPixelY;
             uint32_t basePixelX;
             uint32_t basePixelY;
+            uint32_t sampleIndex;
+            uint32_t rngSeed;
+            std::vector<SensorSplat>* tileSplats;
+            bool validateMISWeights;
             
             // working area
             float curPx, curPy;
             int16_t wlHint;
             std::vector<VBPTVertex> lightVertices;
             std::vector<VBPTVertex> eyeVertices;
+            ThreadStatistics* threadStats;
             
+            RenderStatistics* stats;
             ProgressReporter* reporter;
             
+            template <class SamplerType>
             void kernel(uint32_t threadID);
+            template <class SamplerType>
             void generateSubPath(const WavelengthSamples &initWLs, const SampledSpectrum &initAlpha, const Ray &initRay, float initEpsilon, float dirPDF, DirectionType sampledType,
-                                 float cosLast, bool adjoint, IndependentLightPathSampler &pathSampler, ArenaAllocator &mem);
+                                 float cosLast, bool adjoint, SamplerType &pathSampler, ArenaAllocator &mem);
             float calculateMISWeight(float lExtend1stSpatialPDF, float lExtend1stRRProb, float lExtend2ndSpatialPDF, float lExtend2ndRRProb,
                                      float eExtend1stSpatialPDF, float eExtend1stRRProb, float eExtend2ndSpatialPDF, float eExtend2ndRRProb,
                                      uint32_t numLVtx, uint32_t numEVtx) const;
         };
         
         uint32_t m_samplesPerPixel;
+        LightPathSamplerType m_samplerType;
     public:
-        VolumetricBPTRenderer(uint32_t spp);
+        VolumetricBPTRenderer(uint32_t spp, LightPathSamplerType samplerType = LightPathSamplerType::Independent);
         void render(const Scene &scene, const RenderSettings &settings) const override;
     };
 }
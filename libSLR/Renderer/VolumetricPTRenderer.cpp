@@ -12,30 +12,54 @@
 #include "../Core/camera.h"
 #include "../Core/light_path_sampler.h"
 #include "../Core/ImageSensor.h"
+#include "../Core/ImageExporter.h"
 #include "../Core/RenderSettings.h"
 #include "../Core/ProgressReporter.h"
+#include "../Core/RenderStatistics.h"
+#include "../Core/PassScheduler.h"
 #include "../RNG/XORShiftRNG.h"
 #include "../Scene/Scene.h"
 #include "../Helper/ThreadPool.h"
 
 namespace SLR {
-    VolumetricPTRenderer::VolumetricPTRenderer(uint32_t spp) : m_samplesPerPixel(spp) {
-        
+    VolumetricPTRenderer::VolumetricPTRenderer(uint32_t spp, LightPathSamplerType samplerType, uint32_t guidingTrainingPasses) :
+    m_samplesPerPixel(spp), m_samplerType(samplerType), m_guidingTrainingPasses(guidingTrainingPasses) {
+    
     }
     
     void VolumetricPTRenderer::render(const Scene &scene, const RenderSettings &settings) const {
         uint32_t numThreads = settings.getInt(RenderSettingItem::NumThreads);
         XORShiftRNG topRand(settings.getInt(RenderSettingItem::RNGSeed));
         ArenaAllocator* mems = new ArenaAllocator[numThreads];
-        IndependentLightPathSampler* samplers = new IndependentLightPathSampler[numThreads];
+        LightPathSampler** samplers = new LightPathSampler*[numThreads];
         for (int i = 0; i < numThreads; ++i) {
             new (mems + i) ArenaAllocator();
-            new (samplers + i) IndependentLightPathSampler(topRand.getUInt());
+            samplers[i] = createLightPathSampler(m_samplerType, settings.getInt(RenderSettingItem::RNGSeed), topRand.getUInt());
         }
         
         const Camera* camera = scene.getCamera();
         ImageSensor* sensor = camera->getSensor();
         
+        // JP: サンプラーの具体的な型に特殊化したカーネルをここで選択する。
+        //     カーネル内のサンプラー呼び出しは静的に束縛されてインライン化される。
+        // EN: select the kernel specialized for the concrete sampler type here.
+        //     Sampler calls in the kernel are statically bound and inlined.
+        void (Job::*kernel)(uint32_t) = nullptr;
+        switch (m_samplerType) {
+            case LightPathSamplerType::Independent:
+                kernel = &Job::kernel<IndependentLightPathSampler>;
+                break;
+            case LightPathSamplerType::Sobol:
+                kernel = &Job::kernel<SobolLightPathSampler>;
+                break;
+            case LightPathSamplerType::Halton:
+                kernel = &Job::kernel<HaltonLightPathSampler>;
+                break;
+            default:
+                SLRAssert_ShouldNotBeCalled();
+                break;
+        }
+        
         Job job;
         job.scene = &scene;
         
@@ -44,6 +68,7 @@ namespace SLR {
         
         job.camera = camera;
         job.sensor = sensor;
+        job.rngSeed = settings.getInt(RenderSettingItem::RNGSeed);
         job.timeStart = settings.getFloat(RenderSettingItem::TimeStart);
         job.timeEnd = settings.getFloat(RenderSettingItem::TimeEnd);
         job.imageWidth = settings.getInt(RenderSettingItem::ImageWidth);
@@ -53,58 +78,118 @@ namespace SLR {
         
         sensor->init(job.imageWidth, job.imageHeight);
         
+        // JP: SD-treeの状態はチェックポイントに含めないので、再開した場合は学習をやり直す。
+        // EN: The state of the SD-tree is not included in checkpoints, so training restarts when resuming.
+        SDTree* guidingTree = nullptr;
+        if (m_guidingTrainingPasses > 0)
+            guidingTree = new SDTree(scene.getWorldCenter(), scene.getWorldRadius());
+        job.guidingTree = guidingTree;
+        
         printf("Volumetric Path Tracing: %u[spp]\n", m_samplesPerPixel);
-        ProgressReporter reporter;
+        if (guidingTree)
+            printf("Path Guiding: training over %u passes\n", m_guidingTrainingPasses);
+        RenderStatistics stats(numThreads);
+        job.stats = &stats;
+        ProgressReporter reporter(numThreads, settings.getInt(RenderSettingItem::ProgressFD));
         job.reporter = &reporter;
         
-        reporter.pushJob("Rendering", m_samplesPerPixel * sensor->numTileX() * sensor->numTileY());
+        PassScheduler scheduler(settings, m_samplesPerPixel);
+        scheduler.begin(sensor, samplers, numThreads);
+        
+        // JP: プログレッシブモードでは総作業量が分からないため、次の画像出力までの作業のみを表示する。
+        // EN: The total work is unknown in progressive mode, so only the work until the next export is shown.
+        uint32_t numTiles = sensor->numTileX() * sensor->numTileY();
+        uint32_t firstPass = std::min(scheduler.numPasses(), scheduler.maxNumPasses());
+        if (!scheduler.isProgressive())
+            reporter.pushJob("Rendering", (scheduler.maxNumPasses() - firstPass) * numTiles, scheduler.startTime());
         char nextTitle[32];
-        snprintf(nextTitle, sizeof(nextTitle), "To %5uspp", 1);
-        reporter.pushJob(nextTitle, 1 * sensor->numTileX() * sensor->numTileY());
-        uint32_t imgIdx = 0;
-        uint32_t exportPass = 1;
-        for (int s = 0; s < m_samplesPerPixel; ++s) {
-            ThreadPool threadPool(numThreads);
-            for (int ty = 0; ty < sensor->numTileY(); ++ty) {
-                for (int tx = 0; tx < sensor->numTileX(); ++tx) {
-                    job.basePixelX = tx * sensor->tileWidth();
-                    job.basePixelY = ty * sensor->tileHeight();
-                    threadPool.enqueue(std::bind(&Job::kernel, job, std::placeholders::_1));
+        snprintf(nextTitle, sizeof(nextTitle), "To %5uspp", scheduler.nextExportPass());
+        reporter.pushJob(nextTitle, (scheduler.nextExportPass() - firstPass) * numTiles, scheduler.startTime());
+        uint32_t imgIdx = scheduler.numExportedImages();
+        ImageExporter exporter;
+        uint32_t iterationStartPass = firstPass;
+        for (int s = firstPass; s < scheduler.maxNumPasses(); ++s) {
+            job.sampleIndex = s;
+            job.trainGuiding = guidingTree && s < m_guidingTrainingPasses;
+            {
+                ScopedPhaseTimer timer(&stats, StatPhase::Rendering);
+                ThreadPool threadPool(numThreads);
+                for (int ty = 0; ty < sensor->numTileY(); ++ty) {
+                    for (int tx = 0; tx < sensor->numTileX(); ++tx) {
+                        job.basePixelX = tx * sensor->tileWidth();
+                        job.basePixelY = ty * sensor->tileHeight();
+                        threadPool.enqueue(std::bind(kernel, job, std::placeholders::_1));
+                    }
                 }
+                threadPool.wait();
             }
-            threadPool.wait();
             
-            if ((s + 1) == exportPass) {
+            if (job.trainGuiding && ((s + 1) & s) == 0) {
+                guidingTree->update(s + 1 - iterationStartPass, numThreads);
+                iterationStartPass = s + 1;
+            }
+            
+            stats.finishPass();
+            bool finished;
+            {
+                ScopedPhaseTimer timer(&stats, StatPhase::PassFinalization);
+                finished = !scheduler.finishPass(sensor);
+            }
+            if (scheduler.shouldExport(finished)) {
+                reporter.skipRemainingWork();
                 reporter.popJob();
                 
                 reporter.beginOtherThreadPrint();
                 char filename[256];
-                sprintf(filename, "%03u.bmp", imgIdx);
-                double elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(reporter.elapsed()).count();
-                sensor->saveImage(filename, settings.getFloat(RenderSettingItem::Brightness) / (s + 1));
-                printf("%u samples: %s, %g[s]\n", exportPass, filename, elapsed * 0.001f);
+                sprintf(filename, "%03u.%s", imgIdx, sensor->imageFileExtension());
+                float elapsed = scheduler.elapsedTime();
+                {
+                    ScopedPhaseTimer timer(&stats, StatPhase::ImageOutput);
+                    exporter.exportImage(*sensor, filename, settings.getFloat(RenderSettingItem::Brightness) / (s + 1 - scheduler.firstPass()));
+                }
+                printf("%u samples: %s, %g[s]\n", s + 1, filename, elapsed);
+                sprintf(filename, "%03u.json", imgIdx);
+                stats.writeJSON(filename, "VolumetricPT");
                 reporter.endOtherThreadPrint();
                 
                 ++imgIdx;
-                if ((s + 1) == m_samplesPerPixel)
+                if (finished)
                     break;
-                exportPass += exportPass;
-                snprintf(nextTitle, sizeof(nextTitle), "To %5uspp", exportPass);
-                reporter.pushJob(nextTitle, (exportPass >> 1) * sensor->numTileX() * sensor->numTileY());
+                scheduler.advanceExport();
+                snprintf(nextTitle, sizeof(nextTitle), "To %5uspp", scheduler.nextExportPass());
+                reporter.pushJob(nextTitle, (scheduler.nextExportPass() - (s + 1)) * numTiles, scheduler.startTime());
             }
         }
-        reporter.popJob();
+        if (!scheduler.isProgressive()) {
+            reporter.skipRemainingWork();
+            reporter.popJob();
+        }
         reporter.finish();
+        scheduler.printSummary();
+        
+        if (guidingTree) {
+            printf("Path Guiding: %u iterations, %u spatial leaves\n", guidingTree->numIterations(), guidingTree->numLeaves());
+            delete guidingTree;
+        }
         
+        for (int i = 0; i < numThreads; ++i)
+            delete samplers[i];
         delete[] samplers;
         delete[] mems;
     }
     
+    template <class SamplerType>
     void VolumetricPTRenderer::Job::kernel(uint32_t threadID) {
         ArenaAllocator &mem = mems[threadID];
-        IndependentLightPathSampler &pathSampler = pathSamplers[threadID];
+        SamplerType &pathSampler = static_cast<SamplerType &>(*pathSamplers[threadID]);
+        uint32_t tileIndex = (basePixelY / numPixelY) * sensor->numTileX() + basePixelX / numPixelX;
+        pathSampler.reseed(tilePassSeed(rngSeed, tileIndex, sampleIndex));
+        GuidingPathRecorder recorder;
+        ThreadStatistics &threadStats = *stats->threadStatistics(threadID);
+        ScopedThreadStatistics scopedStats(&threadStats);
         for (int ly = 0; ly < numPixelY; ++ly) {
             for (int lx = 0; lx < numPixelX; ++lx) {
+                pathSampler.startPixelSample(basePixelX + lx, basePixelY + ly, sampleIndex);
                 float time = pathSampler.getTimeSample(timeStart, timeEnd);
                 PixelPosition p = pathSampler.getPixelPositionSample(basePixelX + lx, basePixelY + ly);
                 
@@ -121,7 +206,10 @@ namespace SLR {
                 SampledSpectrum We1 = idf->sample(WeSample, &WeResult);
                 
                 Ray ray(lensResult.surfPt.getPosition(), lensResult.surfPt.fromLocal(WeResult.dirLocal), time);
-                SampledSpectrum C = contribution(*scene, wls, ray, pathSampler, mem);
+                recorder.clear();
+                SampledSpectrum C = contribution(*scene, wls, ray, pathSampler, mem, trainGuiding ? &recorder : nullptr, threadStats);
+                if (trainGuiding)
+                    recorder.commit(guidingTree);
                 SLRAssert(C.hasNaN() == false && C.hasInf() == false && C.hasMinus() == false,
                           "Unexpected value detected: %s\n"
                           "pix: (%f, %f)", C.toString().c_str(), p.x, p.y);
@@ -132,19 +220,22 @@ namespace SLR {
                           "pix: (%f, %f)", weight.toString().c_str(), p.x, p.y);
                 sensor->add(p.x, p.y, wls, weight * C);
                 
+                threadStats.recordArenaUsage(mem.bytesInUse());
                 mem.reset();
             }
         }
-        reporter->update();
+        reporter->update(threadID);
     }
     
+    template <class SamplerType>
     SampledSpectrum VolumetricPTRenderer::Job::contribution(const Scene &scene, const WavelengthSamples &initWLs, const Ray &initRay,
-                                                            IndependentLightPathSampler &pathSampler, ArenaAllocator &mem) const {
+                                                            SamplerType &pathSampler, ArenaAllocator &mem, GuidingPathRecorder* recorder, ThreadStatistics &threadStats) const {
         WavelengthSamples wls = initWLs;
         Ray ray = initRay;
         RaySegment segment;
         SampledSpectrum alpha = SampledSpectrum::One;
         float initY = alpha.importance(wls.selectedLambdaIndex);
+        float rrScale = 1.0f;
         SampledSpectrumSum sp(SampledSpectrum::Zero);
         uint32_t pathLength = 0;
         
@@ -153,8 +244,11 @@ namespace SLR {
         bool singleWavelength;
         InteractionPoint* interPt;
         
-        if (!scene.interact(ray, segment, wls, pathSampler, mem, &interact, &medThroughput, &singleWavelength))
+        threadStats.add(StatCounter::CameraRays);
+        if (!scene.interact(ray, segment, wls, pathSampler, mem, &interact, &medThroughput, &singleWavelength)) {
+            threadStats.addPathLength(0);
             return SampledSpectrum::Zero;
+        }
         
         if (singleWavelength && !wls.wavelengthSelected()) {
             medThroughput[wls.selectedLambdaIndex] *= WavelengthSamples::NumComponents;
@@ -173,8 +267,10 @@ namespace SLR {
             SampledSpectrum Le = interPt->emittance(wls) * edf->evaluate(EDFQuery(), dirOut_local);
             sp += alpha * Le;
         }
-        if (interPt->atInfinity())
+        if (interPt->atInfinity()) {
+            threadStats.addPathLength(0);
             return sp;
+        }
         
         while (true) {
             ++pathLength;
@@ -184,6 +280,18 @@ namespace SLR {
             AbstractBDF* abdf = interPt->createAbstractBDF(wls, mem);
             ABDFQuery* abdfQuery = interPt->createABDFQuery(dirOut_local, wls.selectedLambdaIndex, DirectionType::All, false, false, mem);
             
+            // JP: 非デルタ成分を持つ頂点ではSD-treeの葉を求める。学習済みの分布があれば方向分布関数と混合してサンプルする。
+            // EN: find the SD-tree leaf at a vertex having non-delta components. If the leaf has a learned distribution, mix it with the directional distribution function for sampling.
+            uint32_t guidingLeafIdx = 0;
+            const DirectionalQuadTree* guide = nullptr;
+            if (guidingTree && abdf->hasNonDelta()) {
+                guidingLeafIdx = guidingTree->findLeaf(interPt->getPosition());
+                guide = &guidingTree->getSamplingDistribution(guidingLeafIdx);
+                if (!guide->hasDistribution())
+                    guide = nullptr;
+            }
+            const float abdfFrac = SDTree::BSDFSamplingFraction;
+            
             // Next Event Estimation (explicit light sampling)
             if (abdf->hasNonDelta()) {
                 Light* light;
@@ -199,6 +307,7 @@ namespace SLR {
                 
                 InteractionPoint* lightPt = lpResult->getInteractionPoint();
                 SampledSpectrum visibility;
+                threadStats.add(StatCounter::ShadowRays);
                 if (scene.testVisibility(interPt, lightPt, ray.time, wls, pathSampler, &visibility, &singleWavelength)) {
                     if (singleWavelength && !wls.wavelengthSelected())
                         visibility[wls.selectedLambdaIndex] *= WavelengthSamples::NumComponents;
@@ -215,7 +324,10 @@ namespace SLR {
                     
                     SampledSpectrum abdfValue = abdf->evaluate(abdfQuery, shadowDir_sn);
                     float cosLight = lightPt->calcCosTerm(-shadowDir);
-                    float abdfPDF = abdf->evaluatePDF(abdfQuery, shadowDir_sn) * cosLight / dist2;
+                    float abdfPDF = abdf->evaluatePDF(abdfQuery, shadowDir_sn);
+                    if (guide)
+                        abdfPDF = abdfFrac * abdfPDF + (1 - abdfFrac) * guide->evaluatePDF(shadowDir);
+                    abdfPDF *= cosLight / dist2;
                     
                     float MISWeight = 1.0f;
                     if (!lpResult->sampledPositionType().isDelta() && !std::isinf(lpResult->spatialPDF()))
@@ -223,14 +335,59 @@ namespace SLR {
                     SLRAssert(MISWeight <= 1.0f, "Invalid MIS weight: %g", MISWeight);
                     
                     float G = interPt->calcCosTerm(shadowDir) * cosLight / dist2;
-                    sp += alpha * visibility * Le * abdfValue * (G * MISWeight / lightPDF);
                     SLRAssert(std::isfinite(G), "G: unexpected value detected: %f", G);
+                    // JP: 光源上の点から同じ光源をサンプルした場合など、幾何項が0の接続ではシェーディング法線の補正が不定となるため棄却する。
+                    // EN: reject connections with zero geometric term, e.g. sampling a light from a point on the same light, since the shading normal correction is undefined.
+                    if (G > 0.0f) {
+                        SampledSpectrum C = alpha * visibility * Le * abdfValue * (G * MISWeight / lightPDF);
+                        sp += C;
+                        if (recorder)
+                            recorder->addContribution(C.importance(wls.selectedLambdaIndex));
+                    }
                 }
             }
             
             // get a next direction by sampling AbstractBDF.
+            // JP: 学習済みの分布がある場合は1サンプルMISとして方向分布関数と分布のいずれかを選び、非デルタ方向の密度は両者の混合とする。
+            // EN: With a learned distribution, choose either the directional distribution function or the distribution as one-sample MIS,
+            //     the density of a non-delta direction is the mixture of both.
             ABDFQueryResult* abdfResult;
-            SampledSpectrum abdfValue = abdf->sample(abdfQuery, pathSampler, mem, &abdfResult);
+            ABDFQueryResult guidedResult;
+            SampledSpectrum abdfValue;
+            if (guide) {
+                BSDFSample guideSample = pathSampler.getBSDFSample();
+                float abdfDirPDF;
+                float guideDirPDF;
+                if (guideSample.uComponent < abdfFrac) {
+                    // JP: 戦略の選択に用いた成分の乱数を再利用し、バウンスごとに余計な次元を消費しないようにする。
+                    // EN: reuse the component variable used for choosing the strategy so that no extra dimensions are consumed per bounce.
+                    guideSample.uComponent /= abdfFrac;
+                    abdfValue = abdf->sample(abdfQuery, guideSample, mem, &abdfResult);
+                    abdfDirPDF = abdfResult->dirPDF;
+                    guideDirPDF = 0.0f;
+                    if (!abdfResult->sampledType.isDelta() && abdfResult->dirPDF > 0.0f) {
+                        abdfValue = abdf->evaluate(abdfQuery, abdfResult->dirLocal);
+                        abdfDirPDF = abdf->evaluatePDF(abdfQuery, abdfResult->dirLocal);
+                        guideDirPDF = guide->evaluatePDF(interPt->fromLocal(abdfResult->dirLocal));
+                    }
+                }
+                else {
+                    Vector3D dirIn = guide->sample(guideSample.uDir[0], guideSample.uDir[1], &guideDirPDF);
+                    guidedResult.dirLocal = interPt->toLocal(dirIn);
+                    guidedResult.sampledType = DirectionType::LowFreq | (guidedResult.dirLocal.z * dirOut_local.z > 0 ? DirectionType::Reflection : DirectionType::Transmission);
+                    abdfValue = abdf->evaluate(abdfQuery, guidedResult.dirLocal);
+                    abdfDirPDF = abdf->evaluatePDF(abdfQuery, guidedResult.dirLocal);
+                    abdfResult = &guidedResult;
+                }
+                abdfResult->dirPDF = abdfFrac * abdfDirPDF + (1 - abdfFrac) * guideDirPDF;
+                // JP: ロシアンルーレットの生存確率は方向分布関数のみでサンプルした場合のスループットで決める。
+                // EN: The survival probability of Russian roulette is determined by the throughput as if sampled by the directional distribution function alone.
+                if (abdfDirPDF > 0.0f)
+                    rrScale *= abdfResult->dirPDF / abdfDirPDF;
+            }
+            else {
+                abdfValue = abdf->sample(abdfQuery, pathSampler, mem, &abdfResult);
+            }
             if (abdfValue == SampledSpectrum::Zero || abdfResult->dirPDF == 0.0f)
                 break;
             if (abdfResult->sampledType.isDispersive() && !wls.wavelengthSelected()) {
@@ -242,11 +399,14 @@ namespace SLR {
             SLRAssert(alpha.allFinite(),
                       "alpha: %s\nlength: %u, cos: %g, dirPDF: %g",
                       alpha.toString().c_str(), pathLength, interPt->calcCosTerm(dirIn), abdfResult->dirPDF);
+            if (recorder && guidingTree && abdf->hasNonDelta() && !abdfResult->sampledType.isDelta())
+                recorder->addVertex(guidingLeafIdx, dirIn, alpha.importance(wls.selectedLambdaIndex), abdfResult->dirPDF);
             
             ray = Ray(interPt->getPosition(), dirIn, ray.time); // No need to add the epsilon for medium.
             segment = RaySegment(Ray::Epsilon);
             
             // find a next intersection point.
+            threadStats.add(StatCounter::BounceRays);
             if (!scene.interact(ray, segment, wls, pathSampler, mem, &interact, &medThroughput, &singleWavelength))
                 break;
             
@@ -276,18 +436,25 @@ namespace SLR {
                     MISWeight = (abdfPDF * abdfPDF) / (lightPDF * lightPDF + abdfPDF * abdfPDF);
                 SLRAssert(MISWeight <= 1.0f, "Invalid MIS weight: %g", MISWeight);
                 
-                sp += alpha * Le * MISWeight;
+                SampledSpectrum C = alpha * Le * MISWeight;
+                sp += C;
+                if (recorder)
+                    recorder->addContribution(C.importance(wls.selectedLambdaIndex));
             }
             if (interPt->atInfinity())
                 break;
             
             // Russian roulette
-            float continueProb = std::min(alpha.importance(wls.selectedLambdaIndex) / initY, 1.0f);
-            if (pathSampler.getPathTerminationSample() < continueProb)
+            float continueProb = std::min(alpha.importance(wls.selectedLambdaIndex) * rrScale / initY, 1.0f);
+            if (pathSampler.getPathTerminationSample() < continueProb) {
                 alpha /= continueProb;
-            else
+            }
+            else {
+                threadStats.add(StatCounter::RussianRouletteTerminations);
                 break;
+            }
         }
+        threadStats.addPathLength(pathLength);
         
         return sp;
     }
@@ -11,6 +11,8 @@
 #include "../defines.h"
 #include "../declarations.h"
 #include "../Core/renderer.h"
+#include "../Core/light_path_sampler.h"
+#include "../Core/SDTree.h"
 
 namespace SLR {
     class SLR_API VolumetricPTRenderer : public Renderer {
@@ -18,7 +20,7 @@ namespace SLR {
             const Scene* scene;
             
             ArenaAllocator* mems;
-            IndependentLightPathSampler* pathSamplers;
+            LightPathSampler** pathSamplers;
             
             const Camera* camera;
             ImageSensor* sensor;
@@ -30,17 +32,31 @@ namespace SLR {
             uint32_t numPixelY;
             uint32_t basePixelX;
             uint32_t basePixelY;
+            uint32_t sampleIndex;
+            uint32_t rngSeed;
             
+            // path guiding
+            SDTree* guidingTree;
+            bool trainGuiding;
+            
+            RenderStatistics* stats;
             ProgressReporter* reporter;
             
+            template <class SamplerType>
             void kernel(uint32_t threadID);
+            template <class SamplerType>
             SampledSpectrum contribution(const Scene &scene, const WavelengthSamples &initWLs, const Ray &initRay,
-                                         IndependentLightPathSampler &pathSampler, ArenaAllocator &mem) const;
+                                         SamplerType &pathSampler, ArenaAllocator &mem, GuidingPathRecorder* recorder, ThreadStatistics &threadStats) const;
         };
         
         uint32_t m_samplesPerPixel;
+        LightPathSamplerType m_samplerType;
+        uint32_t m_guidingTrainingPasses;
     public:
-        VolumetricPTRenderer(uint32_t spp);
+        // JP: guidingTrainingPassesが正の場合、表面と媒質中の頂点で入射放射輝度を学習するSD-treeと方向分布関数を混合して方向をサンプルする。
+        // EN: If guidingTrainingPasses is positive, directions at surface and medium vertices are sampled
+        //     by mixing the directional distribution function with an SD-tree learning incident radiance.
+        VolumetricPTRenderer(uint32_t spp, LightPathSamplerType samplerType = LightPathSamplerType::Independent, uint32_t guidingTrainingPasses = 0);
         void render(const Scene &scene, const RenderSettings &settings) const override;
     };
 }
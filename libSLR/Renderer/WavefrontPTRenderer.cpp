@@ -0,0 +1,502 @@
+//
+//  WavefrontPTRenderer.cpp
+//
+//  Created by 渡部 心 on 2017/06/25.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#include "WavefrontPTRenderer.h"
+
+#include "../MemoryAllocators/ArenaAllocator.h"
+#include "../Core/random_number_generator.h"
+#include "../Core/camera.h"
+#include "../Core/light_path_sampler.h"
+#include "../Core/ImageSensor.h"
+#include "../Core/ImageExporter.h"
+#include "../Core/RenderSettings.h"
+#include "../Core/ProgressReporter.h"
+#include "../Core/RenderStatistics.h"
+#include "../Core/PassScheduler.h"
+#include "../Core/surface_object.h"
+#include "../RNG/XORShiftRNG.h"
+#include "../Scene/Scene.h"
+#include "../Helper/ThreadPool.h"
+
+namespace SLR {
+    // JP: 10ビットの値の各ビットの間に2ビットの隙間を空ける。
+    // EN: insert two-bit gaps between the bits of a 10-bit value.
+    static inline uint32_t expandBits(uint32_t v) {
+        v = (v * 0x00010001u) & 0xFF0000FFu;
+        v = (v * 0x00000101u) & 0x0F00F00Fu;
+        v = (v * 0x00000011u) & 0xC30C30C3u;
+        v = (v * 0x00000005u) & 0x49249249u;
+        return v;
+    }
+    
+    static inline uint32_t calcOctant(const Vector3D &dir) {
+        return (dir.x < 0) | ((dir.y < 0) << 1) | ((dir.z < 0) << 2);
+    }
+    
+    WavefrontPTRenderer::WavefrontPTRenderer(uint32_t spp, bool sortRays, uint32_t packetSize) :
+    m_samplesPerPixel(spp), m_sortRays(sortRays), m_packetSize(std::min(std::max(packetSize, 1u), 32u)) {
+    
+    }
+    
+    void WavefrontPTRenderer::render(const Scene &scene, const RenderSettings &settings) const {
+        uint32_t numThreads = settings.getInt(RenderSettingItem::NumThreads);
+        XORShiftRNG topRand(settings.getInt(RenderSettingItem::RNGSeed));
+        ArenaAllocator* mems = new ArenaAllocator[numThreads];
+        LightPathSampler** samplers = new LightPathSampler*[numThreads];
+        for (int i = 0; i < numThreads; ++i)
+            samplers[i] = createLightPathSampler(LightPathSamplerType::Independent, settings.getInt(RenderSettingItem::RNGSeed), topRand.getUInt());
+        WavefrontStorage* storages = (WavefrontStorage*)SLR_memalign(sizeof(WavefrontStorage) * numThreads, SLR_L1_Cacheline_Size);
+        for (int i = 0; i < numThreads; ++i) {
+            new (storages + i) WavefrontStorage();
+            storages[i].numPacketRays = 0;
+        }
+        
+        const Camera* camera = scene.getCamera();
+        ImageSensor* sensor = camera->getSensor();
+        
+        Job job;
+        job.scene = &scene;
+        
+        job.mems = mems;
+        job.pathSamplers = samplers;
+        job.storages = storages;
+        
+        job.camera = camera;
+        job.sensor = sensor;
+        job.timeStart = settings.getFloat(RenderSettingItem::TimeStart);
+        job.timeEnd = settings.getFloat(RenderSettingItem::TimeEnd);
+        job.imageWidth = settings.getInt(RenderSettingItem::ImageWidth);
+        job.imageHeight = settings.getInt(RenderSettingItem::ImageHeight);
+        job.numPixelX = sensor->tileWidth();
+        job.numPixelY = sensor->tileHeight();
+        
+        job.sortRays = m_sortRays;
+        job.packetSize = m_packetSize;
+        float worldRadius = scene.getWorldRadius();
+        job.sortBoundsMin = scene.getWorldCenter() - Vector3D(worldRadius, worldRadius, worldRadius);
+        job.sortBoundsSize = 2 * worldRadius;
+        
+        sensor->init(job.imageWidth, job.imageHeight);
+        
+        printf("Wavefront Path Tracing: %u[spp], %u paths per wave, packet size: %u%s\n",
+               m_samplesPerPixel, job.numPixelX * job.numPixelY, m_packetSize, m_sortRays ? ", sorted rays" : "");
+        RenderStatistics stats(numThreads);
+        job.stats = &stats;
+        ProgressReporter reporter(numThreads, settings.getInt(RenderSettingItem::ProgressFD));
+        job.reporter = &reporter;
+        
+        PassScheduler scheduler(settings, m_samplesPerPixel);
+        scheduler.begin(sensor, samplers, numThreads);
+        
+        uint32_t numTiles = sensor->numTileX() * sensor->numTileY();
+        uint32_t firstPass = std::min(scheduler.numPasses(), scheduler.maxNumPasses());
+        if (!scheduler.isProgressive())
+            reporter.pushJob("Rendering", (scheduler.maxNumPasses() - firstPass) * numTiles, scheduler.startTime());
+        char nextTitle[32];
+        snprintf(nextTitle, sizeof(nextTitle), "To %5uspp", scheduler.nextExportPass());
+        reporter.pushJob(nextTitle, (scheduler.nextExportPass() - firstPass) * numTiles, scheduler.startTime());
+        uint32_t imgIdx = scheduler.numExportedImages();
+        ImageExporter exporter;
+        for (int s = firstPass; s < scheduler.maxNumPasses(); ++s) {
+            job.sampleIndex = s;
+            auto passStart = std::chrono::system_clock::now();
+            ThreadPool threadPool(numThreads);
+            for (int ty = 0; ty < sensor->numTileY(); ++ty) {
+                for (int tx = 0; tx < sensor->numTileX(); ++tx) {
+                    job.basePixelX = tx * sensor->tileWidth();
+                    job.basePixelY = ty * sensor->tileHeight();
+                    threadPool.enqueue(std::bind(&Job::kernel, job, std::placeholders::_1));
+                }
+            }
+            threadPool.wait();
+            stats.addPhaseTime(StatPhase::Rendering, std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now() - passStart).count() * 1e-6);
+            
+            stats.finishPass();
+            bool finished;
+            {
+                ScopedPhaseTimer timer(&stats, StatPhase::PassFinalization);
+                finished = !scheduler.finishPass(sensor);
+            }
+            if (scheduler.shouldExport(finished)) {
+                reporter.skipRemainingWork();
+                reporter.popJob();
+                
+                reporter.beginOtherThreadPrint();
+                char filename[256];
+                sprintf(filename, "%03u.%s", imgIdx, sensor->imageFileExtension());
+                float elapsed = scheduler.elapsedTime();
+                {
+                    ScopedPhaseTimer timer(&stats, StatPhase::ImageOutput);
+                    exporter.exportImage(*sensor, filename, settings.getFloat(RenderSettingItem::Brightness) / (s + 1 - scheduler.firstPass()));
+                }
+                printf("%u samples: %s, %g[s]\n", s + 1, filename, elapsed);
+                sprintf(filename, "%03u.json", imgIdx);
+                stats.writeJSON(filename, "WPT");
+                reporter.endOtherThreadPrint();
+                
+                ++imgIdx;
+                if (finished)
+                    break;
+                scheduler.advanceExport();
+                snprintf(nextTitle, sizeof(nextTitle), "To %5uspp", scheduler.nextExportPass());
+                reporter.pushJob(nextTitle, (scheduler.nextExportPass() - (s + 1)) * numTiles, scheduler.startTime());
+            }
+        }
+        if (!scheduler.isProgressive()) {
+            reporter.skipRemainingWork();
+            reporter.popJob();
+        }
+        reporter.finish();
+        scheduler.printSummary();
+        
+        uint64_t numRays = stats.numRays();
+        uint64_t numPacketRays = 0;
+        for (int i = 0; i < numThreads; ++i)
+            numPacketRays += storages[i].numPacketRays;
+        double renderTime = stats.phaseTime(StatPhase::Rendering);
+        printf("Throughput: %llu rays in %g[s], %g[Mrays/s], %.1f%% traced in packets\n",
+               (unsigned long long)numRays, renderTime, numRays / renderTime * 1e-6, 100.0 * numPacketRays / std::max(numRays, (uint64_t)1));
+        
+        for (int i = 0; i < numThreads; ++i) {
+            storages[i].~WavefrontStorage();
+            delete samplers[i];
+        }
+        SLR_freealign(storages);
+        delete[] samplers;
+        delete[] mems;
+    }
+    
+    void WavefrontPTRenderer::Job::kernel(uint32_t threadID) {
+        ArenaAllocator &mem = mems[threadID];
+        IndependentLightPathSampler &pathSampler = static_cast<IndependentLightPathSampler &>(*pathSamplers[threadID]);
+        WavefrontStorage &storage = storages[threadID];
+        storage.statistics = stats->threadStatistics(threadID);
+        ScopedThreadStatistics scopedStats(storage.statistics);
+        
+        generatePaths(storage, pathSampler, mem);
+        while (!storage.activePaths.empty()) {
+            intersectPaths(storage);
+            shadePaths(storage, pathSampler, mem);
+            testShadowRays(storage);
+        }
+        
+        for (int i = 0; i < storage.paths.size(); ++i) {
+            const PathState &path = storage.paths[i];
+            SampledSpectrum C = path.sp;
+            SLRAssert(C.hasNaN() == false && C.hasInf() == false && C.hasMinus() == false,
+                      "Unexpected value detected: %s\n"
+                      "pix: (%f, %f)", C.toString().c_str(), path.p.x, path.p.y);
+            sensor->add(path.p.x, path.p.y, path.initWLs, path.weight * C);
+            storage.statistics->addPathLength(path.pathLength);
+        }
+        
+        reporter->update(threadID);
+    }
+    
+    void WavefrontPTRenderer::Job::generatePaths(WavefrontStorage &storage, IndependentLightPathSampler &pathSampler, ArenaAllocator &mem) const {
+        storage.paths.resize(numPixelX * numPixelY);
+        storage.activePaths.clear();
+        for (int ly = 0; ly < numPixelY; ++ly) {
+            for (int lx = 0; lx < numPixelX; ++lx) {
+                uint32_t pathIdx = ly * numPixelX + lx;
+                PathState &path = storage.paths[pathIdx];
+                
+                float time = pathSampler.getTimeSample(timeStart, timeEnd);
+                path.p = pathSampler.getPixelPositionSample(basePixelX + lx, basePixelY + ly);
+                
+                float selectWLPDF;
+                path.initWLs = WavelengthSamples::createWithEqualOffsets(pathSampler.getWavelengthSample(), pathSampler.getWLSelectionSample(), &selectWLPDF);
+                path.wls = path.initWLs;
+                
+                LensPosQuery lensQuery(time, path.wls);
+                LensPosQueryResult lensResult;
+                SampledSpectrum We0 = camera->sample(lensQuery, pathSampler.getLensPosSample(), &lensResult);
+                
+                IDFSample WeSample(path.p.x / imageWidth, path.p.y / imageHeight);
+                IDFQueryResult WeResult;
+                IDF* idf = camera->createIDF(lensResult.surfPt, path.wls, mem);
+                SampledSpectrum We1 = idf->sample(WeSample, &WeResult);
+                
+                path.ray = Ray(lensResult.surfPt.getPosition(), lensResult.surfPt.fromLocal(WeResult.dirLocal), time);
+                path.weight = (We0 * We1) * (lensResult.surfPt.calcCosTerm(path.ray.dir) / (lensResult.areaPDF * WeResult.dirPDF * selectWLPDF));
+                SLRAssert(path.weight.hasNaN() == false && path.weight.hasInf() == false && path.weight.hasMinus() == false,
+                          "Unexpected value detected: %s\n"
+                          "pix: (%f, %f)", path.weight.toString().c_str(), path.p.x, path.p.y);
+                
+                path.alpha = SampledSpectrum::One;
+                path.sp = SampledSpectrumSum(SampledSpectrum::Zero);
+                path.initY = path.alpha.importance(path.wls.selectedLambdaIndex);
+                path.dirPDF = 0.0f;
+                path.deltaSampled = false;
+                path.pathLength = 0;
+                
+                storage.activePaths.push_back(pathIdx);
+                
+                mem.reset();
+            }
+        }
+    }
+    
+    void WavefrontPTRenderer::Job::intersectPaths(WavefrontStorage &storage) const {
+        std::vector<uint32_t> &activePaths = storage.activePaths;
+        if (sortRays) {
+            storage.sortKeys.clear();
+            for (int i = 0; i < activePaths.size(); ++i)
+                storage.sortKeys.emplace_back(calcSortKey(storage.paths[activePaths[i]].ray), activePaths[i]);
+            std::sort(storage.sortKeys.begin(), storage.sortKeys.end());
+            for (int i = 0; i < activePaths.size(); ++i)
+                activePaths[i] = storage.sortKeys[i].second;
+        }
+        
+        uint32_t numRays = (uint32_t)activePaths.size();
+        storage.rays.resize(numRays);
+        storage.segments.resize(numRays);
+        for (int i = 0; i < numRays; ++i) {
+            const PathState &path = storage.paths[activePaths[i]];
+            storage.rays[i] = path.ray;
+            storage.segments[i] = path.pathLength == 0 ? RaySegment() : RaySegment(Ray::Epsilon);
+            storage.statistics->add(path.pathLength == 0 ? StatCounter::CameraRays : StatCounter::BounceRays);
+        }
+        intersectRays(storage);
+        
+        // JP: 交差しなかったパスを取り除き、交差したパスの交点を詰めて格納する。
+        // EN: remove paths which did not hit anything, and store the intersections of the remaining paths compactly.
+        uint32_t numHits = 0;
+        for (int i = 0; i < numRays; ++i) {
+            if (!storage.hits[i])
+                continue;
+            activePaths[numHits] = activePaths[i];
+            storage.interactions[numHits] = storage.interactions[i];
+            ++numHits;
+        }
+        activePaths.resize(numHits);
+        storage.interactions.resize(numHits);
+    }
+    
+    void WavefrontPTRenderer::Job::shadePaths(WavefrontStorage &storage, IndependentLightPathSampler &pathSampler, ArenaAllocator &mem) const {
+        std::vector<uint32_t> &activePaths = storage.activePaths;
+        uint32_t numHits = (uint32_t)activePaths.size();
+        
+        // JP: 同じ材質の交点が連続するように並べ替え、BSDFの生成とテクスチャ参照の局所性を高める。
+        // EN: sort intersections so that the ones with the same material are consecutive to improve locality of BSDF creation and texture lookups.
+        storage.surfacePoints.resize(numHits);
+        storage.sortKeys.clear();
+        for (int i = 0; i < numHits; ++i) {
+            SurfacePoint &surfPt = storage.surfacePoints[i];
+            storage.interactions[i].calculateSurfacePoint(&surfPt);
+            storage.sortKeys.emplace_back((uintptr_t)surfPt.getObject()->getMaterial(), i);
+        }
+        std::sort(storage.sortKeys.begin(), storage.sortKeys.end());
+        
+        storage.shadowRays.clear();
+        storage.nextActivePaths.clear();
+        for (int i = 0; i < numHits; ++i) {
+            uint32_t hitIdx = storage.sortKeys[i].second;
+            uint32_t pathIdx = activePaths[hitIdx];
+            const SurfaceInteraction &si = storage.interactions[hitIdx];
+            const SurfacePoint &surfPt = storage.surfacePoints[hitIdx];
+            PathState &path = storage.paths[pathIdx];
+            const WavelengthSamples &wls = path.wls;
+            
+            Vector3D dirOut_sn = surfPt.toLocal(-path.ray.dir);
+            if (surfPt.isEmitting()) {
+                EDF* edf = surfPt.createEDF(wls, mem);
+                SampledSpectrum Le = surfPt.emittance(wls) * edf->evaluate(EDFQuery(), dirOut_sn);
+                SLRAssert(Le.allFinite(), "Le: unexpected value detected: %s", Le.toString().c_str());
+                
+                // implicit light sampling
+                float MISWeight = 1.0f;
+                if (path.pathLength > 0 && !path.deltaSampled) {
+                    float bsdfPDF = path.dirPDF;
+                    float dist2 = surfPt.getSquaredDistance(path.ray.org);
+                    float lightPDF = si.getLightProb() * surfPt.evaluateAreaPDF() * dist2 / surfPt.calcCosTerm(path.ray.dir);
+                    SLRAssert(!std::isnan(lightPDF)/* && !std::isinf(lightPDF)*/, "lightPDF: unexpected value detected: %f", lightPDF);
+                    MISWeight = (bsdfPDF * bsdfPDF) / (lightPDF * lightPDF + bsdfPDF * bsdfPDF);
+                }
+                SLRAssert(MISWeight <= 1.0f, "Invalid MIS weight: %g", MISWeight);
+                
+                path.sp += path.alpha * Le * MISWeight;
+            }
+            if (surfPt.atInfinity())
+                continue;
+            
+            // Russian roulette
+            if (path.pathLength > 0) {
+                float continueProb = std::min(path.alpha.importance(wls.selectedLambdaIndex) / path.initY, 1.0f);
+                if (pathSampler.getPathTerminationSample() < continueProb) {
+                    path.alpha /= continueProb;
+                }
+                else {
+                    storage.statistics->add(StatCounter::RussianRouletteTerminations);
+                    continue;
+                }
+            }
+            
+            ++path.pathLength;
+            if (path.pathLength >= 100)
+                continue;
+            Normal3D gNorm_sn = surfPt.getLocalGeometricNormal();
+            BSDF* bsdf = surfPt.createBSDF(wls, mem);
+            BSDFQuery fsQuery(dirOut_sn, gNorm_sn, wls.selectedLambdaIndex);
+            
+            // Next Event Estimation (explicit light sampling)
+            // JP: 可視判定はシャドウレイとしてまとめて後で行う。
+            // EN: the visibility test is performed later together with other shadow rays.
+            if (bsdf->hasNonDelta()) {
+                SurfaceLight light;
+                float lightProb;
+                scene->selectSurfaceLight(pathSampler.getLightSelectionSample(), path.ray.time, &light, &lightProb);
+                SLRAssert(std::isfinite(lightProb), "lightProb: unexpected value detected: %f", lightProb);
+                
+                LightPosQuery lpQuery(path.ray.time, wls);
+                SurfaceLightPosQueryResult lpResult;
+                SampledSpectrum M = light.sample(lpQuery, pathSampler.getSurfaceLightPosSample(), &lpResult);
+                SLRAssert(!std::isnan(lpResult.areaPDF)/* && !std::isinf(xpResult.areaPDF)*/, "areaPDF: unexpected value detected: %f", lpResult.areaPDF);
+                
+                float dist2;
+                Vector3D shadowDir = lpResult.surfPt.getDirectionFrom(surfPt.getPosition(), &dist2);
+                Vector3D shadowDir_l = lpResult.surfPt.toLocal(-shadowDir);
+                Vector3D shadowDir_sn = surfPt.toLocal(shadowDir);
+                
+                EDF* edf = lpResult.surfPt.createEDF(wls, mem);
+                SampledSpectrum Le = M * edf->evaluate(EDFQuery(), shadowDir_l);
+                float lightPDF = lightProb * lpResult.areaPDF;
+                SLRAssert(Le.allFinite(), "Le: unexpected value detected: %s", Le.toString().c_str());
+                
+                SampledSpectrum fs = bsdf->evaluate(fsQuery, shadowDir_sn);
+                float cosLight = lpResult.surfPt.calcCosTerm(-shadowDir);
+                float bsdfPDF = bsdf->evaluatePDF(fsQuery, shadowDir_sn) * cosLight / dist2;
+                
+                float MISWeight = 1.0f;
+                if (!lpResult.posType.isDelta() && !std::isinf(lpResult.areaPDF))
+                    MISWeight = (lightPDF * lightPDF) / (lightPDF * lightPDF + bsdfPDF * bsdfPDF);
+                SLRAssert(MISWeight <= 1.0f, "Invalid MIS weight: %g", MISWeight);
+                
+                float G = absDot(shadowDir_sn, gNorm_sn) * cosLight / dist2;
+                SLRAssert(std::isfinite(G), "G: unexpected value detected: %f", G);
+                // JP: 光源上の点から同じ光源をサンプルした場合など、幾何項が0の接続ではシェーディング法線の補正が不定となるため棄却する。
+                // EN: reject connections with zero geometric term, e.g. sampling a light from a point on the same light, since the shading normal correction is undefined.
+                if (G > 0.0f) {
+                    // JP: Scene::testVisibility()と同じ光線を作る。
+                    // EN: make the same ray as Scene::testVisibility().
+                    ShadowRay shadowRay;
+                    const Point3D &shdP = surfPt.getPosition();
+                    const Point3D &lightP = lpResult.surfPt.getPosition();
+                    if (lpResult.surfPt.atInfinity()) {
+                        shadowRay.ray = Ray(shdP, normalize(lightP - Point3D::Zero), path.ray.time);
+                        shadowRay.segment = RaySegment(Ray::Epsilon, FLT_MAX);
+                    }
+                    else {
+                        float dist = distance(lightP, shdP);
+                        shadowRay.ray = Ray(shdP, (lightP - shdP) / dist, path.ray.time);
+                        shadowRay.segment = RaySegment(Ray::Epsilon, dist * (1 - Ray::Epsilon));
+                    }
+                    shadowRay.contribution = path.alpha * Le * fs * (G * MISWeight / lightPDF);
+                    shadowRay.pathIndex = pathIdx;
+                    storage.shadowRays.push_back(shadowRay);
+                }
+            }
+            
+            // get a next direction by sampling BSDF.
+            BSDFQueryResult fsResult;
+            SampledSpectrum fs = bsdf->sample(fsQuery, pathSampler.getBSDFSample(), &fsResult);
+            if (fs == SampledSpectrum::Zero || fsResult.dirPDF == 0.0f)
+                continue;
+            if (fsResult.sampledType.isDispersive() && !wls.wavelengthSelected()) {
+                fsResult.dirPDF /= WavelengthSamples::NumComponents;
+                path.wls.flags |= WavelengthSamples::WavelengthIsSelected;
+            }
+            path.alpha *= fs * absDot(fsResult.dirLocal, gNorm_sn) / fsResult.dirPDF;
+            SLRAssert(path.alpha.allFinite(),
+                      "alpha: %s\nlength: %u, cos: %g, dirPDF: %g",
+                      path.alpha.toString().c_str(), path.pathLength, absDot(fsResult.dirLocal, gNorm_sn), fsResult.dirPDF);
+            
+            path.ray = Ray(surfPt.getPosition(), surfPt.fromLocal(fsResult.dirLocal), path.ray.time);
+            path.dirPDF = fsResult.dirPDF;
+            path.deltaSampled = fsResult.sampledType.isDelta();
+            
+            storage.nextActivePaths.push_back(pathIdx);
+        }
+        std::swap(activePaths, storage.nextActivePaths);
+        
+        storage.statistics->recordArenaUsage(mem.bytesInUse());
+        mem.reset();
+    }
+    
+    void WavefrontPTRenderer::Job::testShadowRays(WavefrontStorage &storage) const {
+        std::vector<ShadowRay> &shadowRays = storage.shadowRays;
+        if (sortRays) {
+            storage.sortKeys.clear();
+            for (int i = 0; i < shadowRays.size(); ++i)
+                storage.sortKeys.emplace_back(calcSortKey(shadowRays[i].ray), i);
+            std::sort(storage.sortKeys.begin(), storage.sortKeys.end());
+        }
+        
+        uint32_t numRays = (uint32_t)shadowRays.size();
+        storage.rays.resize(numRays);
+        storage.segments.resize(numRays);
+        for (int i = 0; i < numRays; ++i) {
+            const ShadowRay &shadowRay = shadowRays[sortRays ? storage.sortKeys[i].second : i];
+            storage.rays[i] = shadowRay.ray;
+            storage.segments[i] = shadowRay.segment;
+        }
+        storage.statistics->add(StatCounter::ShadowRays, numRays);
+        intersectRays(storage);
+        
+        for (int i = 0; i < numRays; ++i) {
+            if (storage.hits[i])
+                continue;
+            const ShadowRay &shadowRay = shadowRays[sortRays ? storage.sortKeys[i].second : i];
+            storage.paths[shadowRay.pathIndex].sp += shadowRay.contribution;
+        }
+        shadowRays.clear();
+    }
+    
+    void WavefrontPTRenderer::Job::intersectRays(WavefrontStorage &storage) const {
+        uint32_t numRays = (uint32_t)storage.rays.size();
+        const Ray* rays = storage.rays.data();
+        RaySegment* segments = storage.segments.data();
+        storage.interactions.resize(numRays);
+        storage.hits.resize(numRays);
+        for (int i = 0; i < numRays; ++i)
+            storage.interactions[i] = SurfaceInteraction();
+        SurfaceInteraction* sis = storage.interactions.data();
+        
+        for (uint32_t base = 0; base < numRays; base += packetSize) {
+            uint32_t numPacketRays = std::min(packetSize, numRays - base);
+            
+            // JP: 束の中の全ての光線の方向の八分円が揃っている場合のみ束として辿る。
+            // EN: trace rays as a packet only when the direction octants of all the rays in the packet agree.
+            bool coherent = numPacketRays > 1;
+            uint32_t octant = calcOctant(rays[base].dir);
+            for (int i = 1; i < numPacketRays && coherent; ++i)
+                coherent = calcOctant(rays[base + i].dir) == octant;
+            
+            if (coherent) {
+                uint32_t activeMask = numPacketRays == 32 ? 0xFFFFFFFF : ((1u << numPacketRays) - 1);
+                uint32_t hitMask = scene->intersectPacket(rays + base, segments + base, sis + base, activeMask);
+                for (int i = 0; i < numPacketRays; ++i)
+                    storage.hits[base + i] = ((hitMask >> i) & 0x1) != 0;
+                storage.numPacketRays += numPacketRays;
+            }
+            else {
+                for (int i = 0; i < numPacketRays; ++i)
+                    storage.hits[base + i] = scene->intersect(rays[base + i], segments[base + i], &sis[base + i]);
+            }
+        }
+    }
+    
+    uint64_t WavefrontPTRenderer::Job::calcSortKey(const Ray &ray) const {
+        uint32_t octant = calcOctant(ray.dir);
+        Vector3D rel = (ray.org - sortBoundsMin) / sortBoundsSize;
+        uint32_t ix = (uint32_t)std::min(std::max(rel.x * 1024, 0.0f), 1023.0f);
+        uint32_t iy = (uint32_t)std::min(std::max(rel.y * 1024, 0.0f), 1023.0f);
+        uint32_t iz = (uint32_t)std::min(std::max(rel.z * 1024, 0.0f), 1023.0f);
+        uint32_t morton = (expandBits(ix) << 2) | (expandBits(iy) << 1) | expandBits(iz);
+        return ((uint64_t)octant << 30) | morton;
+    }
+}
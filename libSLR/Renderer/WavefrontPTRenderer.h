@@ -0,0 +1,129 @@
+//
+//  WavefrontPTRenderer.h
+//
+//  Created by 渡部 心 on 2017/06/25.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#ifndef __SLR_WavefrontPTRenderer__
+#define __SLR_WavefrontPTRenderer__
+
+#include "../defines.h"
+#include "../declarations.h"
+#include "../Core/renderer.h"
+#include "../Core/light_path_sampler.h"
+#include "../Core/geometry.h"
+#include "../BasicTypes/Ray.h"
+#include "../BasicTypes/CompensatedSum.h"
+
+namespace SLR {
+    // JP: ウェーブフロント(ストリーム)方式のパストレーシング。
+    //     タイル内の全ピクセルのパスを同時に進め、1バウンスごとに全光線の交差判定、材質ごとにまとめたシェーディング、
+    //     シャドウレイの可視判定をそれぞれまとめて行う。交差判定の前に光線を方向の八分円と始点のモートン符号で並べ替えることもでき、
+    //     方向の八分円が揃った連続する光線は束として辿る。
+    //     段階ごとに同種の処理が続くためキャッシュの局所性が良くなる。PTRendererと同じ推定量を用いる。
+    //     多数のパスの乱数要求が交互に行われるため、次元を固定で割り当てる低食い違い量サンプラーは使えず、独立なサンプラーのみを用いる。
+    // EN: Wavefront (stream) path tracing.
+    //     Paths of all the pixels in a tile advance together, and for each bounce intersection tests of all the rays,
+    //     shading grouped by material and visibility tests of shadow rays are performed in batches.
+    //     Rays can be sorted by their direction octant and the Morton code of their origin before intersection tests,
+    //     and consecutive rays sharing a direction octant are traced as a packet.
+    //     Each stage runs the same kind of work in a row, which improves cache locality. This uses the same estimator as PTRenderer.
+    //     Sample requests of many paths are interleaved, so low-discrepancy samplers assigning fixed dimensions cannot be used,
+    //     only the independent sampler is used.
+    class SLR_API WavefrontPTRenderer : public Renderer {
+        struct PathState {
+            WavelengthSamples initWLs;
+            WavelengthSamples wls;
+            PixelPosition p;
+            SampledSpectrum weight;
+            SampledSpectrum alpha;
+            SampledSpectrumSum sp;
+            Ray ray;
+            float initY;
+            // JP: 直前の頂点で方向をサンプルした確率密度。陰的な光源サンプリングのMISウェイトに用いる。
+            // EN: PDF of the direction sampled at the previous vertex. This is used for MIS weights of implicit light sampling.
+            float dirPDF;
+            bool deltaSampled;
+            uint32_t pathLength;
+            
+            PathState() : p(0, 0), sp(SampledSpectrum::Zero) {}
+        };
+        
+        struct ShadowRay {
+            Ray ray;
+            RaySegment segment;
+            SampledSpectrum contribution;
+            uint32_t pathIndex;
+        };
+        
+        // JP: スレッドごとのパスと光線のキュー。タイルを跨いで再利用する。偽共有を避けるためキャッシュラインの大きさに揃える。
+        // EN: per-thread queues of paths and rays. These are reused across tiles. This is aligned to the cache line size to avoid false sharing.
+        struct alignas(SLR_L1_Cacheline_Size) WavefrontStorage {
+            std::vector<PathState> paths;
+            std::vector<uint32_t> activePaths;
+            std::vector<uint32_t> nextActivePaths;
+            std::vector<SurfaceInteraction> interactions;
+            std::vector<SurfacePoint> surfacePoints;
+            std::vector<ShadowRay> shadowRays;
+            std::vector<std::pair<uint64_t, uint32_t>> sortKeys;
+            std::vector<Ray> rays;
+            std::vector<RaySegment> segments;
+            std::vector<bool> hits;
+            ThreadStatistics* statistics;
+            uint64_t numPacketRays;
+        };
+        
+        struct Job {
+            const Scene* scene;
+            
+            ArenaAllocator* mems;
+            LightPathSampler** pathSamplers;
+            WavefrontStorage* storages;
+            
+            const Camera* camera;
+            ImageSensor* sensor;
+            float timeStart;
+            float timeEnd;
+            uint32_t imageWidth;
+            uint32_t imageHeight;
+            uint32_t numPixelX;
+            uint32_t numPixelY;
+            uint32_t basePixelX;
+            uint32_t basePixelY;
+            uint32_t sampleIndex;
+            
+            bool sortRays;
+            uint32_t packetSize;
+            Point3D sortBoundsMin;
+            float sortBoundsSize;
+            
+            RenderStatistics* stats;
+            ProgressReporter* reporter;
+            
+            void kernel(uint32_t threadID);
+            
+            void generatePaths(WavefrontStorage &storage, IndependentLightPathSampler &pathSampler, ArenaAllocator &mem) const;
+            void intersectPaths(WavefrontStorage &storage) const;
+            void shadePaths(WavefrontStorage &storage, IndependentLightPathSampler &pathSampler, ArenaAllocator &mem) const;
+            void testShadowRays(WavefrontStorage &storage) const;
+            // JP: storageのraysとsegmentsの光線を交差判定し、結果をinteractionsとhitsに格納する。
+            // EN: intersect the rays in rays and segments of the storage, and store the results to interactions and hits.
+            void intersectRays(WavefrontStorage &storage) const;
+            // JP: 光線を方向の八分円、続いて始点のモートン符号で並べ替えるためのキー。
+            // EN: a key to sort rays by their direction octant, then by the Morton code of their origin.
+            uint64_t calcSortKey(const Ray &ray) const;
+        };
+        
+        uint32_t m_samplesPerPixel;
+        bool m_sortRays;
+        uint32_t m_packetSize;
+    public:
+        // JP: packetSizeは交差判定で束ねる光線の数(1から32)で、1の場合は光線を1本ずつ辿る。
+        // EN: packetSize is the number of rays bundled for intersection tests (1 to 32), rays are traced one by one when it is 1.
+        WavefrontPTRenderer(uint32_t spp, bool sortRays = true, uint32_t packetSize = 16);
+        void render(const Scene &scene, const RenderSettings &settings) const override;
+    };
+}
+
+#endif /* __SLR_WavefrontPTRenderer__ */
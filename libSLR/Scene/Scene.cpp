@@ -63,6 +63,32 @@ namespace SLR {
         return false;
     }
     
+    uint32_t Scene::intersectPacket(const Ray* rays, RaySegment* segments, SurfaceInteraction* sis, uint32_t activeMask) const {
+        float importances[2] = {m_surfaceAggregate->importance(), 0.0f};
+        if (m_envSphere)
+            importances[1] = m_envSphere->importance();
+        
+        uint32_t hitMask = m_surfaceAggregate->intersectPacket(rays, segments, sis, activeMask);
+        for (uint32_t i = 0; i < 32 && (activeMask >> i) != 0; ++i) {
+            if (((activeMask >> i) & 0x1) == 0)
+                continue;
+            if (((hitMask >> i) & 0x1) != 0) {
+                sis[i].setLightProb(evaluateProbability(importances, 2, 0) * sis[i].getLightProb());
+            }
+            else if (m_envSphere) {
+                if (m_envSphere->intersect(rays[i], segments[i], &sis[i])) {
+                    sis[i].setLightProb(evaluateProbability(importances, 2, 1) * sis[i].getLightProb());
+                    hitMask |= 1u << i;
+                }
+            }
+        }
+        return hitMask;
+    }
+    
+    void Scene::intersectBatch(const RayBatch &rays, const RayBatchHits &hits, uint32_t numThreads) const {
+        m_surfaceAggregate->intersectBatch(rays, hits, numThreads);
+    }
+    
     bool Scene::interact(const Ray &ray, const RaySegment &segment, const WavelengthSamples &wls, LightPathSampler &pathSampler, ArenaAllocator &mem,
                          Interaction** interact, SampledSpectrum* medThroughput, bool* singleWavelength) const {
         float importances[3] = {m_surfaceAggregate->importance(), m_mediumAggregate->importance(), 0.0f};
@@ -95,15 +121,19 @@ namespace SLR {
     
     bool Scene::testVisibility(const SurfacePoint &shdP, const SurfacePoint &lightP, float time) const {
         SLRAssert(shdP.atInfinity() == false, "Shading point must be in finite region.");
+        return testVisibility(shdP.getPosition(), lightP.getPosition(), lightP.atInfinity(), time);
+    }
+    
+    bool Scene::testVisibility(const Point3D &shdP, const Point3D &lightP, bool lightAtInfinity, float time) const {
         Ray ray;
         RaySegment segment;
-        if (lightP.atInfinity()) {
-            ray = Ray(shdP.getPosition(), normalize(lightP.getPosition() - Point3D::Zero), time);
+        if (lightAtInfinity) {
+            ray = Ray(shdP, normalize(lightP - Point3D::Zero), time);
             segment = RaySegment(Ray::Epsilon, FLT_MAX);
         }
         else {
-            float dist = distance(lightP.getPosition(), shdP.getPosition());
-            ray = Ray(shdP.getPosition(), (lightP.getPosition() - shdP.getPosition()) / dist, time);
+            float dist = distance(lightP, shdP);
+            ray = Ray(shdP, (lightP - shdP) / dist, time);
             segment = RaySegment(Ray::Epsilon, dist * (1 - Ray::Epsilon));
         }
         SurfaceInteraction si;
@@ -41,9 +41,16 @@ namespace SLR {
         float getWorldDiscArea() const { return m_worldDiscArea; }
         
         bool intersect(const Ray &ray, const RaySegment &segment, SurfaceInteraction* si) const;
+        // JP: 方向の揃った最大32本の光線の束をまとめて交差判定する。activeMaskのビットが立った光線のみを判定し、交差した光線のビットを返す。
+        // EN: intersect a packet of up to 32 rays with aligned directions at once. Only rays whose bits are set in activeMask are tested, and the bits of rays which hit something are returned.
+        uint32_t intersectPacket(const Ray* rays, RaySegment* segments, SurfaceInteraction* sis, uint32_t activeMask) const;
+        // JP: レンダラーを使わずに任意の数の光線をシーンの表面とまとめて交差判定する。環境光の球は判定しない。
+        // EN: intersect any number of rays with the surfaces of the scene at once without a renderer. The environment sphere is not tested.
+        void intersectBatch(const RayBatch &rays, const RayBatchHits &hits, uint32_t numThreads = 0) const;
         bool interact(const Ray &ray, const RaySegment &segment, const WavelengthSamples &wls, LightPathSampler &pathSampler, ArenaAllocator &mem,
                       Interaction** interact, SampledSpectrum* medThroughput, bool* singleWavelength) const;
         bool testVisibility(const SurfacePoint &shdP, const SurfacePoint &lightP, float time) const;
+        bool testVisibility(const Point3D &shdP, const Point3D &lightP, bool lightAtInfinity, float time) const;
         bool testVisibility(const InteractionPoint* shdP, const InteractionPoint* lightP, float time,
                             const WavelengthSamples &wls, LightPathSampler &pathSampler, SampledSpectrum* fractionalVisibility, bool* singleWavelength) const;
         void selectSurfaceLight(float u, float time, SurfaceLight* light, float* prob) const;
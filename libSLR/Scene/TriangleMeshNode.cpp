@@ -11,12 +11,18 @@
 #include "../Core/transform.h"
 #include "../Core/surface_object.h"
 #include "../Core/medium_object.h"
+#include "../Core/MeshCache.h"
 #include "../SurfaceShape/TriangleSurfaceShape.h"
 #include "../Scene/medium_nodes.h"
 
 namespace SLR {
-    void MaterialGroupInTriangleMesh::setTriangles(std::unique_ptr<Vertex*[]> &_vertexReferences, uint32_t _numTriangles) {
-        vertexReferences = std::move(_vertexReferences);
+    void MaterialGroupInTriangleMesh::setTriangles(std::unique_ptr<uint32_t[]> &_indices, uint32_t _numTriangles) {
+        ownedIndices = std::move(_indices);
+        setTriangles(ownedIndices.get(), _numTriangles);
+    }
+    
+    void MaterialGroupInTriangleMesh::setTriangles(const uint32_t* _indices, uint32_t _numTriangles) {
+        indices = _indices;
         numTriangles = _numTriangles;
         triangles = new TriangleSurfaceShape[_numTriangles];
         for (int i = 0; i < numTriangles; ++i) {
@@ -32,21 +38,42 @@ namespace SLR {
 
     
     
+    void TriangleMeshNode::allocateVertexArrays() {
+        m_ownedPositions = std::unique_ptr<Point3D[]>(new Point3D[m_numVertices]);
+        m_ownedNormals = std::unique_ptr<Normal3D[]>(new Normal3D[m_numVertices]);
+        m_ownedTangents = std::unique_ptr<Tangent3D[]>(new Tangent3D[m_numVertices]);
+        m_ownedTexCoords = std::unique_ptr<TexCoord2D[]>(new TexCoord2D[m_numVertices]);
+        m_positions = m_ownedPositions.get();
+        m_normals = m_ownedNormals.get();
+        m_tangents = m_ownedTangents.get();
+        m_texCoords = m_ownedTexCoords.get();
+    }
+    
     TriangleMeshNode::TriangleMeshNode(uint32_t numVertices, uint32_t numMatGroups, bool onlyForBoundary, int8_t axisForRadialTangent) : 
     m_numVertices(numVertices), m_numMatGroups(numMatGroups), m_onlyForBoundary(onlyForBoundary), m_axisForRadialTangent(axisForRadialTangent) {
-        m_vertices = new Vertex[m_numVertices];
+        allocateVertexArrays();
         m_matGroups = new MaterialGroupInTriangleMesh[m_numMatGroups];
         for (int i = 0; i < m_numMatGroups; ++i)
             m_matGroups[i].parent = this;
     }
     
+    TriangleMeshNode::TriangleMeshNode(const std::shared_ptr<const MeshCache> &meshCache, uint32_t meshIndex, bool onlyForBoundary, int8_t axisForRadialTangent) :
+    m_meshCache(meshCache), m_numMatGroups(1), m_onlyForBoundary(onlyForBoundary), m_axisForRadialTangent(axisForRadialTangent) {
+        const MeshCache::Mesh &mesh = m_meshCache->mesh(meshIndex);
+        m_positions = mesh.positions;
+        m_normals = mesh.normals;
+        m_tangents = mesh.tangents;
+        m_texCoords = mesh.texCoords;
+        m_numVertices = mesh.numVertices;
+        m_matGroups = new MaterialGroupInTriangleMesh[m_numMatGroups];
+        m_matGroups[0].parent = this;
+        m_matGroups[0].setTriangles(mesh.indices, mesh.numTriangles);
+    }
+    
     TriangleMeshNode::~TriangleMeshNode() {
         if (m_matGroups)
             delete[] m_matGroups;
-        if (m_vertices)
-            delete[] m_vertices;
         m_matGroups = nullptr;
-        m_vertices = nullptr;
     }
     
     void TriangleMeshNode::createRenderingData(Allocator* mem, const Transform* subTF, RenderingData* data) {
@@ -65,12 +92,23 @@ namespace SLR {
         }
         m_appliedTFIsIdentity = m_appliedTransform.isIdentity();
         if (!m_appliedTFIsIdentity) {
+            // JP: メッシュキャッシュを参照している場合はここで初めて自身の配列に複製する。
+            // EN: copy to the node's own arrays here for the first time if this references a mesh cache.
+            if (!m_ownedPositions) {
+                const Point3D* positions = m_positions;
+                const Normal3D* normals = m_normals;
+                const Tangent3D* tangents = m_tangents;
+                const TexCoord2D* texCoords = m_texCoords;
+                allocateVertexArrays();
+                std::copy(positions, positions + m_numVertices, m_ownedPositions.get());
+                std::copy(normals, normals + m_numVertices, m_ownedNormals.get());
+                std::copy(tangents, tangents + m_numVertices, m_ownedTangents.get());
+                std::copy(texCoords, texCoords + m_numVertices, m_ownedTexCoords.get());
+            }
             for (int i = 0; i < m_numVertices; ++i) {
-                Vertex &v = m_vertices[i];
-                v.position = m_appliedTransform * v.position;
-                v.normal = normalize(m_appliedTransform * v.normal);
-                v.tangent = normalize(m_appliedTransform * v.tangent);
-                v.texCoord = v.texCoord;
+                m_ownedPositions[i] = m_appliedTransform * m_ownedPositions[i];
+                m_ownedNormals[i] = normalize(m_appliedTransform * m_ownedNormals[i]);
+                m_ownedTangents[i] = normalize(m_appliedTransform * m_ownedTangents[i]);
             }
         }
         
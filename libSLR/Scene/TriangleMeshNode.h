@@ -19,24 +19,42 @@ namespace SLR {
         const SurfaceMaterial* material;
         const NormalTexture* normalMap;
         const FloatTexture* alphaMap;
-        std::unique_ptr<Vertex*[]> vertexReferences;
+        const uint32_t* indices;
+        std::unique_ptr<uint32_t[]> ownedIndices;
         TriangleSurfaceShape* triangles;
         uint32_t numTriangles;
         
         MaterialGroupInTriangleMesh() :
-        material(nullptr), normalMap(nullptr), alphaMap(nullptr),
+        material(nullptr), normalMap(nullptr), alphaMap(nullptr), indices(nullptr),
         triangles(nullptr), numTriangles(0) {
         }
         ~MaterialGroupInTriangleMesh();
         
-        void setTriangles(std::unique_ptr<Vertex*[]> &vertexReferences, uint32_t numTriangles);
+        // JP: 三角形ごとに3つの頂点添字を与える。添字の配列を所有するか、外部(メッシュキャッシュ)の配列を参照する。
+        // EN: give three vertex indices per triangle. The group owns the index array or references an external one (mesh cache).
+        void setTriangles(std::unique_ptr<uint32_t[]> &indices, uint32_t numTriangles);
+        void setTriangles(const uint32_t* indices, uint32_t numTriangles);
     };
     
     
     
+    // JP: 頂点属性は属性ごとの配列(SoA)として保持する。
+    //     配列は自身で確保するか、メッシュキャッシュのマップされた領域を直接参照する。
+    //     後者の場合、変換を適用する必要があるときに限り自身の配列に複製する。
+    // EN: vertex attributes are held as per-attribute arrays (SoA).
+    //     The arrays are allocated by the node itself or directly reference the mapped region of a mesh cache.
+    //     In the latter case, they are copied to the node's own arrays only when a transform needs to be applied.
     class SLR_API TriangleMeshNode : public SurfaceNode {        
-        Vertex* m_vertices;
+        const Point3D* m_positions;
+        const Normal3D* m_normals;
+        const Tangent3D* m_tangents;
+        const TexCoord2D* m_texCoords;
         uint32_t m_numVertices;
+        std::unique_ptr<Point3D[]> m_ownedPositions;
+        std::unique_ptr<Normal3D[]> m_ownedNormals;
+        std::unique_ptr<Tangent3D[]> m_ownedTangents;
+        std::unique_ptr<TexCoord2D[]> m_ownedTexCoords;
+        std::shared_ptr<const MeshCache> m_meshCache;
         MaterialGroupInTriangleMesh* m_matGroups;
         uint32_t m_numMatGroups;
         // Should these be the member of SurfaceNode?
@@ -46,12 +64,34 @@ namespace SLR {
         StaticTransform m_appliedTransform;
         
         std::vector<SurfaceObject*> m_objs;
+        
+        void allocateVertexArrays();
     public:
         TriangleMeshNode(uint32_t numVertices, uint32_t numMatGroups, bool onlyForBoundary, int8_t axisForRadialTangent);
+        // JP: メッシュキャッシュ内のメッシュを1つの材質グループとして、頂点配列と添字を複製せずに参照する。
+        // EN: references the vertex arrays and the indices of a mesh in a mesh cache without copying, as a single material group.
+        TriangleMeshNode(const std::shared_ptr<const MeshCache> &meshCache, uint32_t meshIndex, bool onlyForBoundary, int8_t axisForRadialTangent);
         ~TriangleMeshNode();
         
-        Vertex* getVertexArray() {
-            return m_vertices;
+        // JP: 自身で頂点配列を確保したノードにのみ用いる。
+        // EN: use this only for a node which allocated its own vertex arrays.
+        void setVertex(uint32_t index, const Vertex &v) {
+            m_ownedPositions[index] = v.position;
+            m_ownedNormals[index] = v.normal;
+            m_ownedTangents[index] = v.tangent;
+            m_ownedTexCoords[index] = v.texCoord;
+        }
+        const Point3D &getPosition(uint32_t index) const {
+            return m_positions[index];
+        }
+        const Normal3D &getNormal(uint32_t index) const {
+            return m_normals[index];
+        }
+        const Tangent3D &getTangent(uint32_t index) const {
+            return m_tangents[index];
+        }
+        const TexCoord2D &getTexCoord(uint32_t index) const {
+            return m_texCoords[index];
         }
         MaterialGroupInTriangleMesh* getMaterialGroupArray() {
             return m_matGroups;
@@ -11,21 +11,19 @@
 #include "../Core/distributions.h"
 #include "../Core/surface_object.h"
 #include "../Core/textures.h"
+#include "../Core/BVHCache.h"
 #include "../Scene/TriangleMeshNode.h"
 
 namespace SLR {
     TriangleSurfaceShape::TriangleSurfaceShape(const MaterialGroupInTriangleMesh* matGroup, uint32_t index) :
     m_matGroup(matGroup), m_index(index) {
-        Vertex** v = m_matGroup->vertexReferences.get() + m_index;
+        const TriangleMeshNode &mesh = *m_matGroup->parent;
+        const uint32_t* idx = m_matGroup->indices + m_index;
         
-        const Vertex &v0 = *v[0];
-        const Vertex &v1 = *v[1];
-        const Vertex &v2 = *v[2];
-        
-        Vector3D dP0 = v0.position - v2.position;
-        Vector3D dP1 = v1.position - v2.position;
-        TexCoord2D dTC0 = v0.texCoord - v2.texCoord;
-        TexCoord2D dTC1 = v1.texCoord - v2.texCoord;
+        Vector3D dP0 = mesh.getPosition(idx[0]) - mesh.getPosition(idx[2]);
+        Vector3D dP1 = mesh.getPosition(idx[1]) - mesh.getPosition(idx[2]);
+        TexCoord2D dTC0 = mesh.getTexCoord(idx[0]) - mesh.getTexCoord(idx[2]);
+        TexCoord2D dTC1 = mesh.getTexCoord(idx[1]) - mesh.getTexCoord(idx[2]);
         float detTC = dTC0.u * dTC1.v - dTC0.v * dTC1.u;
         if (detTC != 0)
             m_texCoord0Dir = normalize((1.0f / detTC) * Vector3D(dTC1.v * dP0.x - dTC0.v * dP1.x,
@@ -36,15 +34,17 @@ namespace SLR {
     }
     
     BoundingBox3D TriangleSurfaceShape::bounds() const {
-        Vertex** v = m_matGroup->vertexReferences.get() + m_index;
-        return BoundingBox3D(v[0]->position).unify(v[1]->position).unify(v[2]->position);
+        const TriangleMeshNode &mesh = *m_matGroup->parent;
+        const uint32_t* idx = m_matGroup->indices + m_index;
+        return BoundingBox3D(mesh.getPosition(idx[0])).unify(mesh.getPosition(idx[1])).unify(mesh.getPosition(idx[2]));
     }
     
     BoundingBox3D TriangleSurfaceShape::choppedBounds(BoundingBox3D::Axis chopAxis, float minChopPos, float maxChopPos) const {
-        Vertex** v = m_matGroup->vertexReferences.get() + m_index;
+        const TriangleMeshNode &mesh = *m_matGroup->parent;
+        const uint32_t* idx = m_matGroup->indices + m_index;
         const float chopPos[2] = {minChopPos, maxChopPos};
         
-        Point3D p[3] = {v[0]->position, v[1]->position, v[2]->position};
+        Point3D p[3] = {mesh.getPosition(idx[0]), mesh.getPosition(idx[1]), mesh.getPosition(idx[2])};
         std::sort(p, p + 3, [chopAxis](const Point3D &pa, const Point3D &pb) { return pa[chopAxis] < pb[chopAxis]; });
         float minPos = p[0][chopAxis];
         float maxPos = p[2][chopAxis];
@@ -97,10 +97,26 @@ namespace SLR {
         return ret;
     }
     
+    uint64_t TriangleSurfaceShape::geometryHash() const {
+        const TriangleMeshNode &mesh = *m_matGroup->parent;
+        const uint32_t* idx = m_matGroup->indices + m_index;
+        
+        float values[10];
+        for (int i = 0; i < 3; ++i) {
+            const Point3D &p = mesh.getPosition(idx[i]);
+            values[3 * i + 0] = p.x;
+            values[3 * i + 1] = p.y;
+            values[3 * i + 2] = p.z;
+        }
+        values[9] = costForIntersect();
+        return hashFNV1a64(values, sizeof(values));
+    }
+    
     void TriangleSurfaceShape::splitBounds(BoundingBox3D::Axis splitAxis, float splitPos, BoundingBox3D* bbox0, BoundingBox3D* bbox1) const {
-        Vertex** v = m_matGroup->vertexReferences.get() + m_index;
+        const TriangleMeshNode &mesh = *m_matGroup->parent;
+        const uint32_t* idx = m_matGroup->indices + m_index;
         
-        Point3D p[3] = {v[0]->position, v[1]->position, v[2]->position};
+        Point3D p[3] = {mesh.getPosition(idx[0]), mesh.getPosition(idx[1]), mesh.getPosition(idx[2])};
         std::sort(p, p + 3, [splitAxis](const Point3D &pa, const Point3D &pb) { return pa[splitAxis] < pb[splitAxis]; });
         float minPos = p[0][splitAxis];
         float maxPos = p[2][splitAxis];
@@ -156,14 +172,12 @@ namespace SLR {
     }
     
     bool TriangleSurfaceShape::intersect(const Ray &ray, const RaySegment &segment, SurfaceInteraction* si) const {
-        Vertex** v = m_matGroup->vertexReferences.get() + m_index;
-        
-        const Vertex &v0 = *v[0];
-        const Vertex &v1 = *v[1];
-        const Vertex &v2 = *v[2];
+        const TriangleMeshNode &mesh = *m_matGroup->parent;
+        const uint32_t* idx = m_matGroup->indices + m_index;
         
-        Vector3D edge01 = v1.position - v0.position;
-        Vector3D edge02 = v2.position - v0.position;
+        const Point3D &p0 = mesh.getPosition(idx[0]);
+        Vector3D edge01 = mesh.getPosition(idx[1]) - p0;
+        Vector3D edge02 = mesh.getPosition(idx[2]) - p0;
         
         Vector3D p = cross(ray.dir, edge02);
         float det = dot(edge01, p);
@@ -171,7 +185,7 @@ namespace SLR {
             return false;
         float invDet = 1.0f / det;
         
-        Vector3D d = ray.org - v0.position;
+        Vector3D d = ray.org - p0;
         
         float b1 = dot(d, p) * invDet;
         if (b1 < 0.0f || b1 > 1.0f)
@@ -188,7 +202,7 @@ namespace SLR {
             return false;
         
         float b0 = 1.0f - b1 - b2;
-        TexCoord2D texCoord = b0 * v0.texCoord + b1 * v1.texCoord + b2 * v2.texCoord;
+        TexCoord2D texCoord = b0 * mesh.getTexCoord(idx[0]) + b1 * mesh.getTexCoord(idx[1]) + b2 * mesh.getTexCoord(idx[2]);
         
         // JP: 交叉点のアルファ値がゼロかどうかチェックする。ゼロの場合交叉は起こらない。
         // EN: Check if an alpha value at the intersection point is zero or not. If zero, intersection doesn't occur.
@@ -209,27 +223,24 @@ namespace SLR {
     }
     
     void TriangleSurfaceShape::calculateSurfacePoint(const SurfaceInteraction &si, SurfacePoint* surfPt) const {
-        Vertex** v = m_matGroup->vertexReferences.get() + m_index;
-        
-        const Vertex &v0 = *v[0];
-        const Vertex &v1 = *v[1];
-        const Vertex &v2 = *v[2];
+        const TriangleMeshNode &mesh = *m_matGroup->parent;
+        const uint32_t* idx = m_matGroup->indices + m_index;
         
         float b0, b1;
         si.getSurfaceParameter(&b0, &b1);
         float b2 = 1.0f - b0 - b1;
         
         ReferenceFrame shadingFrame;
-        shadingFrame.z = normalize(b0 * v0.normal + b1 * v1.normal + b2 * v2.normal);
-        int8_t axisForRadialTangent = m_matGroup->parent->getAxisForRadialTangent(); 
+        shadingFrame.z = normalize(b0 * mesh.getNormal(idx[0]) + b1 * mesh.getNormal(idx[1]) + b2 * mesh.getNormal(idx[2]));
+        int8_t axisForRadialTangent = mesh.getAxisForRadialTangent(); 
         if (axisForRadialTangent == -1) {
-            shadingFrame.x = normalize(b0 * v0.tangent + b1 * v1.tangent + b2 * v2.tangent);
+            shadingFrame.x = normalize(b0 * mesh.getTangent(idx[0]) + b1 * mesh.getTangent(idx[1]) + b2 * mesh.getTangent(idx[2]));
         }
         else {
             // JP: 接線ベクトルを衝突点のローカル座標に基づいて生成する。
             // EN: generate a tangent vector based on the local coordinates of the intersection point.
-            const StaticTransform &appliedTF = m_matGroup->parent->getAppliedTransform();
-            Point3D p = invert(appliedTF) * (b0 * v0.position + b1 * v1.position + b2 * v2.position);
+            const StaticTransform &appliedTF = mesh.getAppliedTransform();
+            Point3D p = invert(appliedTF) * (b0 * mesh.getPosition(idx[0]) + b1 * mesh.getPosition(idx[1]) + b2 * mesh.getPosition(idx[2]));
             if (axisForRadialTangent == 0) {
                 float dist = std::sqrt(p.y * p.y + p.z * p.z);
                 shadingFrame.x = dist > 0 ? Vector3D(0, -p.z, p.y) / dist : Vector3D(0, 1, 0);
@@ -257,37 +268,39 @@ namespace SLR {
     }
     
     float TriangleSurfaceShape::area() const {
-        Vertex** v = m_matGroup->vertexReferences.get() + m_index;
+        const TriangleMeshNode &mesh = *m_matGroup->parent;
+        const uint32_t* idx = m_matGroup->indices + m_index;
         
-        const Point3D &p0 = v[0]->position;
-        const Point3D &p1 = v[1]->position;
-        const Point3D &p2 = v[2]->position;
+        const Point3D &p0 = mesh.getPosition(idx[0]);
+        const Point3D &p1 = mesh.getPosition(idx[1]);
+        const Point3D &p2 = mesh.getPosition(idx[2]);
         return 0.5f * cross(p1 - p0, p2 - p0).length();
     }
     
     void TriangleSurfaceShape::sample(float u0, float u1, SurfacePoint* surfPt, float* areaPDF, DirectionType* posType) const {
-        Vertex** v = m_matGroup->vertexReferences.get() + m_index;
+        const TriangleMeshNode &mesh = *m_matGroup->parent;
+        const uint32_t* idx = m_matGroup->indices + m_index;
         
         //    const SurfaceMaterial* mat = m_mat;
         float b0, b1, b2;
         uniformSampleTriangle(u0, u1, &b0, &b1);
         b2 = 1.0f - b0 - b1;
         
-        const Vertex &v0 = *v[0];
-        const Vertex &v1 = *v[1];
-        const Vertex &v2 = *v[2];
+        const Point3D &p0 = mesh.getPosition(idx[0]);
+        const Point3D &p1 = mesh.getPosition(idx[1]);
+        const Point3D &p2 = mesh.getPosition(idx[2]);
         
         ReferenceFrame shadingFrame;
-        shadingFrame.z = normalize(b0 * v0.normal + b1 * v1.normal + b2 * v2.normal);
-        int8_t axisForRadialTangent = m_matGroup->parent->getAxisForRadialTangent();
+        shadingFrame.z = normalize(b0 * mesh.getNormal(idx[0]) + b1 * mesh.getNormal(idx[1]) + b2 * mesh.getNormal(idx[2]));
+        int8_t axisForRadialTangent = mesh.getAxisForRadialTangent();
         if (axisForRadialTangent == -1) {
-            shadingFrame.x = normalize(b0 * v0.tangent + b1 * v1.tangent + b2 * v2.tangent);   
+            shadingFrame.x = normalize(b0 * mesh.getTangent(idx[0]) + b1 * mesh.getTangent(idx[1]) + b2 * mesh.getTangent(idx[2]));   
         }
         else {
             // JP: 接線ベクトルを衝突点のローカル座標に基づいて生成する。
             // EN: generate a tangent vector based on the local coordinates of the intersection point.
-            const StaticTransform &appliedTF = m_matGroup->parent->getAppliedTransform();
-            Point3D p = invert(appliedTF) * (b0 * v0.position + b1 * v1.position + b2 * v2.position);
+            const StaticTransform &appliedTF = mesh.getAppliedTransform();
+            Point3D p = invert(appliedTF) * (b0 * mesh.getPosition(idx[0]) + b1 * mesh.getPosition(idx[1]) + b2 * mesh.getPosition(idx[2]));
             if (axisForRadialTangent == 0) {
                 float dist = std::sqrt(p.y * p.y + p.z * p.z);
                 shadingFrame.x = dist > 0 ? Vector3D(0, -p.z, p.y) / dist : Vector3D(0, 1, 0);
@@ -311,12 +324,12 @@ namespace SLR {
             shadingFrame.x = normalize(shadingFrame.x - dotNT * shadingFrame.z);
         shadingFrame.y = cross(shadingFrame.z, shadingFrame.x);
         
-        *surfPt = SurfacePoint(b0 * v0.position + b1 * v1.position + b2 * v2.position,
+        *surfPt = SurfacePoint(b0 * p0 + b1 * p1 + b2 * p2,
                                false,
                                shadingFrame,
-                               cross(v1.position - v0.position, v2.position - v0.position).normalize(),
+                               cross(p1 - p0, p2 - p0).normalize(),
                                b0, b1,
-                               b0 * v0.texCoord + b1 * v1.texCoord + b2 * v2.texCoord,
+                               b0 * mesh.getTexCoord(idx[0]) + b1 * mesh.getTexCoord(idx[1]) + b2 * mesh.getTexCoord(idx[2]),
                                m_texCoord0Dir
                                );
         *areaPDF = 1.0f / area();
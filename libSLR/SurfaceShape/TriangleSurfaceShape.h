@@ -26,6 +26,7 @@ namespace SLR {
         BoundingBox3D bounds() const override;
         BoundingBox3D choppedBounds(BoundingBox3D::Axis chopAxis, float minChopPos, float maxChopPos) const override;
         void splitBounds(BoundingBox3D::Axis splitAxis, float splitPos, BoundingBox3D* bbox0, BoundingBox3D* bbox1) const override;
+        uint64_t geometryHash() const override;
         bool preTransformed() const override;
         bool intersect(const Ray &ray, const RaySegment &segment, SurfaceInteraction* si) const override;
         void calculateSurfacePoint(const SurfaceInteraction &si, SurfacePoint* surfPt) const override;
@@ -210,6 +210,8 @@ namespace SLR {
     // Surface Object
     struct SurfaceLightPosSample;
     struct SurfaceLightPosQueryResult;
+    struct RayBatch;
+    struct RayBatchHits;
     class SurfaceLight;
     class SurfaceObject;
     class SingleSurfaceObject;
@@ -272,12 +274,21 @@ namespace SLR {
     typedef TiledImage2DTemplate<> TiledImage2D;
     
     // Image Sensor
+    struct SensorSplat;
     class ImageSensor;
     
     // Renderer
     class Renderer;
     class RenderSettings;
     class ProgressReporter;
+    class PassScheduler;
+    class RenderStatistics;
+    struct ThreadStatistics;
+    class MeshCache;
+    class MeshCacheWriter;
+    class MappedFile;
+    class BVHCache;
+    class SDTree;
     
     // END: Core
     // ----------------------------------------------------------------
@@ -318,7 +329,7 @@ namespace SLR {
     
     // END: Medium Distribution
     // ----------------------------------------------------------------
-
+    
     
     
     // ----------------------------------------------------------------
@@ -449,7 +460,7 @@ namespace SLR {
     
     // END: Camera
     // ----------------------------------------------------------------
-
+    
     
     
     // ----------------------------------------------------------------
@@ -482,6 +493,7 @@ namespace SLR {
     
     class PTRenderer;
     class BPTRenderer;
+    class VCMRenderer;
     class AMCMCPPMRenderer;
     class VolumetricPTRenderer;
     class VolumetricBPTRenderer;
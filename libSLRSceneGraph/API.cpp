@@ -8,17 +8,22 @@
 #include "API.h"
 
 #include <thread>
+#include <chrono>
 
 #include <libSLR/MemoryAllocators/ArenaAllocator.h>
 #include <libSLR/BasicTypes/spectrum_library.h>
 #include <libSLR/Core/transform.h>
 #include <libSLR/Core/image_2d.h>
+#include <libSLR/Core/surface_object.h>
 #include <libSLR/RNG/XORShiftRNG.h>
 #include <libSLR/SurfaceShape/TriangleSurfaceShape.h>
 #include <libSLR/Scene/Scene.h>
 #include <libSLR/Renderer/DebugRenderer.h>
 #include <libSLR/Renderer/PTRenderer.h>
+#include <libSLR/Renderer/WavefrontPTRenderer.h>
 #include <libSLR/Renderer/BPTRenderer.h>
+#include <libSLR/Renderer/VCMRenderer.h>
+#include <libSLR/Renderer/AMCMCPPMRenderer.h>
 #include <libSLR/Renderer/VolumetricPTRenderer.h>
 #include <libSLR/Renderer/VolumetricBPTRenderer.h>
 
@@ -30,9 +35,12 @@
 #include "Scene/camera_nodes.h"
 #include "Scene/TriangleMeshNode.h"
 #include "Scene/medium_nodes.h"
+#include "Scene/ScanAccelerator.h"
 #include "node_constructor.h"
+#include "asset_loader.h"
 
 #include "Parser/SceneParsingDriver.h"
+#include "Parser/SceneBytecode.h"
 #include "Parser/BuiltinFunctions/builtin_math.h"
 #include "Parser/BuiltinFunctions/builtin_transform.h"
 #include "Parser/BuiltinFunctions/builtin_texture.h"
@@ -76,7 +84,43 @@ namespace SLRSceneGraph {
         return true;
     }
     
-    SLR_SCENEGRAPH_API bool readScene(const std::string &filePath, const SceneRef &scene, RenderingContext* context) {
+    static bool strToLightPathSamplerType(const std::string &str, SLR::LightPathSamplerType* type) {
+        if (str == "Independent")
+            *type = SLR::LightPathSamplerType::Independent;
+        else if (str == "Sobol")
+            *type = SLR::LightPathSamplerType::Sobol;
+        else if (str == "Halton")
+            *type = SLR::LightPathSamplerType::Halton;
+        else
+            return false;
+        return true;
+    }
+    
+    // JP: 非同期に読み込み中のアセットを要求された順にすべて確定させる。
+    //     後処理が新たな読み込みを要求した場合はそれも確定させる。
+    // EN: resolve all the assets being loaded asynchronously in the requested order.
+    //     This also resolves loads requested by the post-processes.
+    static bool resolvePendingLoads(ExecuteContext &context, ErrorMessage* err) {
+        while (!context.pendingLoads.empty()) {
+            std::function<bool(ExecuteContext &, ErrorMessage*)> resolve = context.pendingLoads.front();
+            context.pendingLoads.pop_front();
+            if (!resolve(context, err))
+                return false;
+        }
+        return true;
+    }
+    
+    // JP: スクリプトの処理の各段階に掛かった時間[s]。
+    // EN: time [s] spent in each stage of processing a script.
+    struct ScriptTimings {
+        double parse;
+        double compile;
+        double execute;
+        double resolve;
+    };
+    
+    static bool readScene(const std::string &filePath, const SceneRef &scene, RenderingContext* context, ScriptTimings* timings) {
+        using namespace std::chrono;
         TypeInfo::init();
         ExecuteContext executeContext;
         ErrorMessage errMsg;
@@ -91,21 +135,21 @@ namespace SLRSceneGraph {
         executeContext.scene = scene;
         executeContext.renderingContext = context;
         {
-            LocalVariables &stack = executeContext.stackVariables.current();
+            GlobalVariables &stack = executeContext.globals;
             stack["root"] = Element::createFromReference<TypeMap::InternalNode>(scene->rootNode());
             
             stack["print"] =
-            Element::create<TypeMap::Function>(1,
+            Element::create<TypeMap::Function>(
                                                std::vector<ArgInfo>{{"value", Type::Any}},
-                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                               [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                    std::cout << args.at("value") << std::endl;
                                                    return Element();
                                                }
                                                );
             stack["addItem"] =
-            Element::create<TypeMap::Function>(1,
+            Element::create<TypeMap::Function>(
                                                std::vector<ArgInfo>{{"tuple", Type::Tuple}, {"key", Type::String, Element::create<TypeMap::String>("")}, {"item", Type::Any}},
-                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                               [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                    auto tuple = args.at("tuple").rawRef<TypeMap::Tuple>();
                                                    auto key = args.at("key").raw<TypeMap::String>();
                                                    tuple->add(key, args.at("item"));
@@ -114,17 +158,17 @@ namespace SLRSceneGraph {
                                                }
                                                );
             stack["numElements"] =
-            Element::create<TypeMap::Function>(1,
+            Element::create<TypeMap::Function>(
                                                std::vector<ArgInfo>{{"tuple", Type::Tuple}},
-                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                               [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                    auto tuple = args.at("tuple").rawRef<TypeMap::Tuple>();
                                                    return Element((TypeMap::Integer::InternalType)tuple->numParams());
                                                }
                                                );
             stack["Point"] =
-            Element::create<TypeMap::Function>(1,
+            Element::create<TypeMap::Function>(
                                                std::vector<ArgInfo>{{"x", Type::RealNumber}, {"y", Type::RealNumber}, {"z", Type::RealNumber}},
-                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                               [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                    auto x = args.at("x").raw<TypeMap::RealNumber>();
                                                    auto y = args.at("y").raw<TypeMap::RealNumber>();
                                                    auto z = args.at("z").raw<TypeMap::RealNumber>();
@@ -132,9 +176,9 @@ namespace SLRSceneGraph {
                                                }
                                                );
             stack["Vector"] =
-            Element::create<TypeMap::Function>(1,
+            Element::create<TypeMap::Function>(
                                                std::vector<ArgInfo>{{"x", Type::RealNumber}, {"y", Type::RealNumber}, {"z", Type::RealNumber}},
-                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                               [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                    auto x = args.at("x").raw<TypeMap::RealNumber>();
                                                    auto y = args.at("y").raw<TypeMap::RealNumber>();
                                                    auto z = args.at("z").raw<TypeMap::RealNumber>();
@@ -142,66 +186,66 @@ namespace SLRSceneGraph {
                                                }
                                                );
             stack["getX"] =
-            Element::create<TypeMap::Function>(1,
+            Element::create<TypeMap::Function>(
                                                std::vector<std::vector<ArgInfo>>{
                                                    {{"point", Type::Point}},
                                                    {{"vector", Type::Vector}},
                                                    {{"normal", Type::Normal}}
                                                },
                                                std::vector<Function::Procedure>{
-                                                   [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                   [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                        const auto &point = args.at("point").raw<TypeMap::Point>();
                                                        return Element(point.x);
                                                    },
-                                                   [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                   [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                        const auto &vector = args.at("vector").raw<TypeMap::Vector>();
                                                        return Element(vector.x);
                                                    },
-                                                   [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                   [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                        const auto &normal = args.at("normal").raw<TypeMap::Normal>();
                                                        return Element(normal.x);
                                                    }
                                                }
                                                );
             stack["getY"] =
-            Element::create<TypeMap::Function>(1,
+            Element::create<TypeMap::Function>(
                                                std::vector<std::vector<ArgInfo>>{
                                                    {{"point", Type::Point}},
                                                    {{"vector", Type::Vector}},
                                                    {{"normal", Type::Normal}}
                                                },
                                                std::vector<Function::Procedure>{
-                                                   [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                   [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                        const auto &point = args.at("point").raw<TypeMap::Point>();
                                                        return Element(point.y);
                                                    },
-                                                   [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                   [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                        const auto &vector = args.at("vector").raw<TypeMap::Vector>();
                                                        return Element(vector.y);
                                                    },
-                                                   [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                   [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                        const auto &normal = args.at("normal").raw<TypeMap::Normal>();
                                                        return Element(normal.y);
                                                    }
                                                }
                                                );
             stack["getZ"] =
-            Element::create<TypeMap::Function>(1,
+            Element::create<TypeMap::Function>(
                                                std::vector<std::vector<ArgInfo>>{
                                                    {{"point", Type::Point}},
                                                    {{"vector", Type::Vector}},
                                                    {{"normal", Type::Normal}}
                                                },
                                                std::vector<Function::Procedure>{
-                                                   [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                   [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                        const auto &point = args.at("point").raw<TypeMap::Point>();
                                                        return Element(point.z);
                                                    },
-                                                   [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                   [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                        const auto &vector = args.at("vector").raw<TypeMap::Vector>();
                                                        return Element(vector.z);
                                                    },
-                                                   [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                   [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                        const auto &normal = args.at("normal").raw<TypeMap::Normal>();
                                                        return Element(normal.z);
                                                    }
@@ -209,9 +253,9 @@ namespace SLRSceneGraph {
                                                );
             
             stack["HSVtoRGB"] =
-            Element::create<TypeMap::Function>(1,
+            Element::create<TypeMap::Function>(
                                                std::vector<ArgInfo>{{"H", Type::RealNumber}, {"S", Type::RealNumber}, {"V", Type::RealNumber}},
-                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                               [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                    auto H = args.at("H").raw<TypeMap::RealNumber>();
                                                    auto S = args.at("S").raw<TypeMap::RealNumber>();
                                                    auto V = args.at("V").raw<TypeMap::RealNumber>();
@@ -263,9 +307,9 @@ namespace SLRSceneGraph {
                                                );
             
             stack["random"] =
-            Element::create<TypeMap::Function>(1,
+            Element::create<TypeMap::Function>(
                                                std::vector<ArgInfo>{},
-                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                               [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                    static SLR::XORShiftRNG rng{2112984105};
                                                    return Element(rng.getFloat0cTo1o());
                                                }
@@ -307,23 +351,23 @@ namespace SLRSceneGraph {
             stack["FloatTexture"] = BuiltinFunctions::Texture::FloatTexture;
             
             stack["createVertex"] =
-            Element::create<TypeMap::Function>(1,
+            Element::create<TypeMap::Function>(
                                                std::vector<ArgInfo>{{"position", Type::Tuple}, {"normal", Type::Tuple}, {"tangent", Type::Tuple}, {"texCoord", Type::Tuple}},
-                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
-                                                   static const Function sigPosition = Function(1, {{"x", Type::RealNumber}, {"y", Type::RealNumber}, {"z", Type::RealNumber}});
-                                                   static const Function sigNormal = Function(1, {{"x", Type::RealNumber}, {"y", Type::RealNumber}, {"z", Type::RealNumber}});
-                                                   static const Function sigTangent = Function(1, {{"x", Type::RealNumber}, {"y", Type::RealNumber}, {"z", Type::RealNumber}});
-                                                   static const Function sigTexCoord = Function(1, {{"u", Type::RealNumber}, {"v", Type::RealNumber}});
-                                                   static const auto procPosition = [](const std::map<std::string, Element> &arg) {
+                                               [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
+                                                   static const Function sigPosition = Function({{"x", Type::RealNumber}, {"y", Type::RealNumber}, {"z", Type::RealNumber}});
+                                                   static const Function sigNormal = Function({{"x", Type::RealNumber}, {"y", Type::RealNumber}, {"z", Type::RealNumber}});
+                                                   static const Function sigTangent = Function({{"x", Type::RealNumber}, {"y", Type::RealNumber}, {"z", Type::RealNumber}});
+                                                   static const Function sigTexCoord = Function({{"u", Type::RealNumber}, {"v", Type::RealNumber}});
+                                                   static const auto procPosition = [](const ArgumentList &arg) {
                                                        return SLR::Point3D(arg.at("x").raw<TypeMap::RealNumber>(), arg.at("y").raw<TypeMap::RealNumber>(), arg.at("z").raw<TypeMap::RealNumber>());
                                                    };
-                                                   static const auto procNormal = [](const std::map<std::string, Element> &arg) {
+                                                   static const auto procNormal = [](const ArgumentList &arg) {
                                                        return SLR::Normal3D(arg.at("x").raw<TypeMap::RealNumber>(), arg.at("y").raw<TypeMap::RealNumber>(), arg.at("z").raw<TypeMap::RealNumber>());
                                                    };
-                                                   static const auto procTangent = [](const std::map<std::string, Element> &arg) {
+                                                   static const auto procTangent = [](const ArgumentList &arg) {
                                                        return SLR::Tangent3D(arg.at("x").raw<TypeMap::RealNumber>(), arg.at("y").raw<TypeMap::RealNumber>(), arg.at("z").raw<TypeMap::RealNumber>());
                                                    };
-                                                   static const auto procTexCoord = [](const std::map<std::string, Element> &arg) {
+                                                   static const auto procTexCoord = [](const ArgumentList &arg) {
                                                        return SLR::TexCoord2D(arg.at("u").raw<TypeMap::RealNumber>(), arg.at("v").raw<TypeMap::RealNumber>());
                                                    };
                                                    return Element::create<TypeMap::Vertex>(sigPosition.perform<SLR::Point3D>(procPosition, args.at("position").raw<TypeMap::Tuple>()),
@@ -333,7 +377,7 @@ namespace SLRSceneGraph {
                                                }
                                                );
             stack["Spectrum"] =
-            Element::create<TypeMap::Function>(1,
+            Element::create<TypeMap::Function>(
                                                std::vector<std::vector<ArgInfo>>{
                                                    {
                                                        {"type", Type::String},
@@ -364,7 +408,7 @@ namespace SLRSceneGraph {
                                                    }
                                                },
                                                std::vector<Function::Procedure>{
-                                                   [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                   [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                        std::string typeStr = args.at("type").raw<TypeMap::String>();
                                                        SLR::SpectrumType type;
                                                        if (!strToSpectrumType(typeStr, &type)) {
@@ -375,7 +419,7 @@ namespace SLRSceneGraph {
                                                        
                                                        return Element::createFromReference<TypeMap::Spectrum>(Spectrum::create(type, SLR::ColorSpace::sRGB, value, value, value));
                                                    },
-                                                   [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                   [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                        std::string typeStr = args.at("type").raw<TypeMap::String>();
                                                        SLR::SpectrumType type;
                                                        if (!strToSpectrumType(typeStr, &type)) {
@@ -394,7 +438,7 @@ namespace SLRSceneGraph {
                                                        
                                                        return Element::createFromReference<TypeMap::Spectrum>(Spectrum::create(type, space, e0, e1, e2));
                                                    },
-                                                   [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                   [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                        std::string typeStr = args.at("type").raw<TypeMap::String>();
                                                        SLR::SpectrumType type;
                                                        if (!strToSpectrumType(typeStr, &type)) {
@@ -414,7 +458,7 @@ namespace SLRSceneGraph {
                                                        
                                                        return Element::createFromReference<TypeMap::Spectrum>(Spectrum::create(type, minWL, maxWL, values.data(), (uint32_t)numSamples));
                                                    },
-                                                   [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                   [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                        std::string typeStr = args.at("type").raw<TypeMap::String>();
                                                        SLR::SpectrumType type;
                                                        if (!strToSpectrumType(typeStr, &type)) {
@@ -441,7 +485,7 @@ namespace SLRSceneGraph {
                                                        
                                                        return Element::createFromReference<TypeMap::Spectrum>(Spectrum::create(type, wls.data(), values.data(), (uint32_t)numSamples));
                                                    },
-                                                   [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err)  {
+                                                   [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err)  {
                                                        using namespace SLR;
                                                        AssetSpectrumRef spectrum;
                                                        std::string type = args.at("type").raw<TypeMap::String>();
@@ -477,13 +521,13 @@ namespace SLRSceneGraph {
                                                }
                                                );
             stack["scaleAndOffset"] =
-            Element::create<TypeMap::Function>(1,
+            Element::create<TypeMap::Function>(
                                                std::vector<ArgInfo>{
                                                    {"spectrum", Type::Spectrum},
                                                    {"scale", Type::RealNumber},
                                                    {"offset", Type::RealNumber}
                                                },
-                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                               [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                    AssetSpectrumRef spectrum = args.at("spectrum").rawRef<TypeMap::Spectrum>();
                                                    float scale = args.at("scale").raw<TypeMap::RealNumber>();
                                                    float offset = args.at("offset").raw<TypeMap::RealNumber>();
@@ -491,13 +535,13 @@ namespace SLRSceneGraph {
                                                }
                                                );
             stack["Image2D"] =
-            Element::create<TypeMap::Function>(1,
+            Element::create<TypeMap::Function>(
                                                std::vector<ArgInfo>{
                                                    {"path", Type::String},
                                                    {"mode", Type::String, Element::create<TypeMap::String>("AsIs")},
                                                    {"type", Type::String, Element::create<TypeMap::String>("Reflectance")}
                                                },
-                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                               [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                    std::string path = args.at("path").raw<TypeMap::String>();
                                                    std::string modeStr = args.at("mode").raw<TypeMap::String>();
                                                    std::string typeStr = args.at("type").raw<TypeMap::String>();
@@ -517,18 +561,18 @@ namespace SLRSceneGraph {
                                                );
             
             stack["createSurfaceMaterial"] =
-            Element::create<TypeMap::Function>(1,
+            Element::create<TypeMap::Function>(
                                                std::vector<ArgInfo>{{"type", Type::String}, {"params", Type::Tuple}},
-                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                               [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                    std::string type = args.at("type").raw<TypeMap::String>();
                                                    const ParameterList &params = args.at("params").raw<TypeMap::Tuple>();
                                                    if (type == "matte") {
                                                        const static Function configFunc{
-                                                           0, {
+                                                           {
                                                                {"reflectance", Type::SpectrumTexture},
                                                                {"sigma", Type::FloatTexture, Element::createFromReference<TypeMap::FloatTexture>(nullptr)}
                                                            },
-                                                           [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                           [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                                SpectrumTextureRef reflectance = args.at("reflectance").rawRef<TypeMap::SpectrumTexture>();
                                                                FloatTextureRef sigma = args.at("sigma").rawRef<TypeMap::FloatTexture>();
                                                                return Element::createFromReference<TypeMap::SurfaceMaterial>(SurfaceMaterial::createMatte(reflectance, sigma));
@@ -538,11 +582,11 @@ namespace SLRSceneGraph {
                                                    }
                                                    else if (type == "metal") {
                                                        const static Function configFunc{
-                                                           0, {
+                                                           {
                                                                {"coeffR", Type::SpectrumTexture},
                                                                {"eta", Type::SpectrumTexture}, {"k", Type::SpectrumTexture}
                                                            },
-                                                           [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                           [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                                SpectrumTextureRef coeffR = args.at("coeffR").rawRef<TypeMap::SpectrumTexture>();
                                                                SpectrumTextureRef eta = args.at("eta").rawRef<TypeMap::SpectrumTexture>();
                                                                SpectrumTextureRef k = args.at("k").rawRef<TypeMap::SpectrumTexture>();
@@ -553,11 +597,11 @@ namespace SLRSceneGraph {
                                                    }
                                                    else if (type == "glass") {
                                                        const static Function configFunc{
-                                                           0, {
+                                                           {
                                                                {"coeff", Type::SpectrumTexture},
                                                                {"etaExt", Type::SpectrumTexture}, {"etaInt", Type::SpectrumTexture}
                                                            },
-                                                           [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                           [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                                SpectrumTextureRef coeff = args.at("coeff").rawRef<TypeMap::SpectrumTexture>();
                                                                SpectrumTextureRef etaExt = args.at("etaExt").rawRef<TypeMap::SpectrumTexture>();
                                                                SpectrumTextureRef etaInt = args.at("etaInt").rawRef<TypeMap::SpectrumTexture>();
@@ -568,11 +612,11 @@ namespace SLRSceneGraph {
                                                    }
                                                    else if (type == "Ward") {
                                                        const static Function configFunc{
-                                                           0, {
+                                                           {
                                                                {"R", Type::SpectrumTexture},
                                                                {"anisoX", Type::FloatTexture}, {"anisoY", Type::FloatTexture}
                                                            },
-                                                           [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                           [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                                SpectrumTextureRef R = args.at("R").rawRef<TypeMap::SpectrumTexture>();
                                                                FloatTextureRef anisoX = args.at("anisoX").rawRef<TypeMap::FloatTexture>();
                                                                FloatTextureRef anisoY = args.at("anisoY").rawRef<TypeMap::FloatTexture>();
@@ -583,11 +627,11 @@ namespace SLRSceneGraph {
                                                    }
                                                    else if (type == "Ashikhmin") {
                                                        const static Function configFunc{
-                                                           0, {
+                                                           {
                                                                {"Rd", Type::SpectrumTexture}, {"Rs", Type::SpectrumTexture},
                                                                {"nx", Type::FloatTexture}, {"ny", Type::FloatTexture}
                                                            },
-                                                           [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                           [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                                SpectrumTextureRef Rd = args.at("Rd").rawRef<TypeMap::SpectrumTexture>();
                                                                SpectrumTextureRef Rs = args.at("Rs").rawRef<TypeMap::SpectrumTexture>();
                                                                FloatTextureRef nx = args.at("nx").rawRef<TypeMap::FloatTexture>();
@@ -599,11 +643,11 @@ namespace SLRSceneGraph {
                                                    }
                                                    else if (type == "microfacet metal") {
                                                        const static Function configFunc{
-                                                           0, {
+                                                           {
                                                                {"eta", Type::SpectrumTexture}, {"k", Type::SpectrumTexture},
                                                                {"alpha_gx", Type::FloatTexture}, {"alpha_gy", Type::FloatTexture}
                                                            },
-                                                           [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                           [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                                SpectrumTextureRef eta = args.at("eta").rawRef<TypeMap::SpectrumTexture>();
                                                                SpectrumTextureRef k = args.at("k").rawRef<TypeMap::SpectrumTexture>();
                                                                FloatTextureRef alpha_gx = args.at("alpha_gx").rawRef<TypeMap::FloatTexture>();
@@ -615,11 +659,11 @@ namespace SLRSceneGraph {
                                                    }
                                                    else if (type == "microfacet glass") {
                                                        const static Function configFunc{
-                                                           0, {
+                                                           {
                                                                {"etaExt", Type::SpectrumTexture}, {"etaInt", Type::SpectrumTexture},
                                                                {"alpha_gx", Type::FloatTexture}, {"alpha_gy", Type::FloatTexture}
                                                            },
-                                                           [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                           [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                                SpectrumTextureRef etaExt = args.at("etaExt").rawRef<TypeMap::SpectrumTexture>();
                                                                SpectrumTextureRef etaInt = args.at("etaInt").rawRef<TypeMap::SpectrumTexture>();
                                                                FloatTextureRef alpha_gx = args.at("alpha_gx").rawRef<TypeMap::FloatTexture>();
@@ -631,7 +675,7 @@ namespace SLRSceneGraph {
                                                    }
                                                    else if (type == "disney reflection") {
                                                        const static Function configFunc{
-                                                           0, {
+                                                           {
                                                                {"baseColor", Type::SpectrumTexture},
                                                                {"subsurface", Type::FloatTexture, Element::createFromReference<TypeMap::FloatTexture>(createShared<ConstantFloatTexture>(0.0f))}, 
                                                                {"metallic", Type::FloatTexture, Element::createFromReference<TypeMap::FloatTexture>(createShared<ConstantFloatTexture>(0.0f))}, 
@@ -644,7 +688,7 @@ namespace SLRSceneGraph {
                                                                {"clearcoat", Type::FloatTexture, Element::createFromReference<TypeMap::FloatTexture>(createShared<ConstantFloatTexture>(0.0f))}, 
                                                                {"clearcoatGloss", Type::FloatTexture, Element::createFromReference<TypeMap::FloatTexture>(createShared<ConstantFloatTexture>(1.0f))}, 
                                                            },
-                                                           [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                           [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                                SpectrumTextureRef baseColor = args.at("baseColor").rawRef<TypeMap::SpectrumTexture>();
                                                                FloatTextureRef subsurface = args.at("subsurface").rawRef<TypeMap::FloatTexture>();
                                                                FloatTextureRef metallic = args.at("metallic").rawRef<TypeMap::FloatTexture>();
@@ -670,10 +714,10 @@ namespace SLRSceneGraph {
                                                    }
                                                    else if (type == "flipped") {
                                                        const static Function configFunc{
-                                                           0, {
+                                                           {
                                                                {"base", Type::SurfaceMaterial}
                                                            },
-                                                           [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                           [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                                SurfaceMaterialRef base = args.at("base").rawRef<TypeMap::SurfaceMaterial>();
                                                                return Element::createFromReference<TypeMap::SurfaceMaterial>(SurfaceMaterial::createFlippedMaterial(base));
                                                            }
@@ -682,11 +726,11 @@ namespace SLRSceneGraph {
                                                    }
                                                    else if (type == "emitter") {
                                                        const static Function configFunc{
-                                                           0, {
+                                                           {
                                                                {"scatter", Type::SurfaceMaterial},
                                                                {"emitter", Type::EmitterSurfaceProperty}
                                                            },
-                                                           [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                           [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                                SurfaceMaterialRef scatter = args.at("scatter").rawRef<TypeMap::SurfaceMaterial>();
                                                                EmitterSurfacePropertyRef emitter = args.at("emitter").rawRef<TypeMap::EmitterSurfaceProperty>();
                                                                return Element::createFromReference<TypeMap::SurfaceMaterial>(SurfaceMaterial::createEmitterSurfaceMaterial(scatter, emitter));
@@ -696,11 +740,11 @@ namespace SLRSceneGraph {
                                                    }
                                                    else if (type == "mix") {
                                                        const static Function configFunc{
-                                                           0, {
+                                                           {
                                                                {"mat0", Type::SurfaceMaterial}, {"mat1", Type::SurfaceMaterial},
                                                                {"factor", Type::FloatTexture}
                                                            },
-                                                           [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                           [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                                SurfaceMaterialRef mat0 = args.at("mat0").rawRef<TypeMap::SurfaceMaterial>();
                                                                SurfaceMaterialRef mat1 = args.at("mat1").rawRef<TypeMap::SurfaceMaterial>();
                                                                FloatTextureRef factor = args.at("factor").rawRef<TypeMap::FloatTexture>();
@@ -711,10 +755,10 @@ namespace SLRSceneGraph {
                                                    }
                                                    else if (type == "sum") {
                                                        const static Function configFunc{
-                                                           0, {
+                                                           {
                                                                {"mat0", Type::SurfaceMaterial}, {"mat1", Type::SurfaceMaterial}
                                                            },
-                                                           [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                           [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                                SurfaceMaterialRef mat0 = args.at("mat0").rawRef<TypeMap::SurfaceMaterial>();
                                                                SurfaceMaterialRef mat1 = args.at("mat1").rawRef<TypeMap::SurfaceMaterial>();
                                                                return Element::createFromReference<TypeMap::SurfaceMaterial>(SurfaceMaterial::createSummedMaterial(mat0, mat1));
@@ -727,17 +771,17 @@ namespace SLRSceneGraph {
                                                }
                                                );
             stack["createEmitterSurfaceProperty"] =
-            Element::create<TypeMap::Function>(1,
+            Element::create<TypeMap::Function>(
                                                std::vector<ArgInfo>{{"type", Type::String}, {"params", Type::Tuple}},
-                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                               [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                    std::string type = args.at("type").raw<TypeMap::String>();
                                                    const ParameterList &params = args.at("params").raw<TypeMap::Tuple>();
                                                    if (type == "diffuse") {
                                                        const static Function configFunc{
-                                                           0, {
+                                                           {
                                                                {"emittance", Type::SpectrumTexture}
                                                            },
-                                                           [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                           [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                                SpectrumTextureRef emittance = args.at("emittance").rawRef<TypeMap::SpectrumTexture>();
                                                                return Element::createFromReference<TypeMap::EmitterSurfaceProperty>(SurfaceMaterial::createDiffuseEmitter(emittance));
                                                            }
@@ -746,11 +790,11 @@ namespace SLRSceneGraph {
                                                    }
                                                    else if (type == "ideal directional") {
                                                        const static Function configFunc{
-                                                           0, {
+                                                           {
                                                                {"emittance", Type::SpectrumTexture},
                                                                {"direction", Type::Vector, SLR::Vector3D(0, 0, 1)}
                                                            },
-                                                           [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                           [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                                SpectrumTextureRef emittance = args.at("emittance").rawRef<TypeMap::SpectrumTexture>();
                                                                SLR::Vector3D direction = SLR::normalize(args.at("direction").raw<TypeMap::Vector>());
                                                                return Element::createFromReference<TypeMap::EmitterSurfaceProperty>(SurfaceMaterial::createIdealDirectionalEmitter(emittance, direction));
@@ -763,15 +807,15 @@ namespace SLRSceneGraph {
                                                }
                                                );
             stack["createMediumMaterial"] =
-            Element::create<TypeMap::Function>(1,
+            Element::create<TypeMap::Function>(
                                                std::vector<ArgInfo>{{"type", Type::String}, {"params", Type::Tuple}},
-                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                               [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                    std::string type = args.at("type").raw<TypeMap::String>();
                                                    const ParameterList &params = args.at("params").raw<TypeMap::Tuple>();
                                                    if (type == "isotropic") {
                                                        const static Function configFunc{
-                                                           0, {},
-                                                           [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                           {},
+                                                           [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                                return Element::createFromReference<TypeMap::MediumMaterial>(MediumMaterial::createIsotropic());
                                                            }
                                                        };
@@ -779,8 +823,8 @@ namespace SLRSceneGraph {
                                                    }
                                                    else if (type == "Henyey-Greenstein") {
                                                        const static Function configFunc{
-                                                           0, {{"g", Type::FloatTexture}},
-                                                           [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                           {{"g", Type::FloatTexture}},
+                                                           [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                                FloatTextureRef g = args.at("g").rawRef<TypeMap::FloatTexture>();
                                                                return Element::createFromReference<TypeMap::MediumMaterial>(MediumMaterial::createHenyeyGreenstein(g));
                                                            }
@@ -792,13 +836,13 @@ namespace SLRSceneGraph {
                                                }
                                                );
             stack["createMesh"] =
-            Element::create<TypeMap::Function>(1,
+            Element::create<TypeMap::Function>(
                                                std::vector<ArgInfo>{
                                                    {"vertices", Type::Tuple},
                                                    {"matGroups", Type::Tuple},
                                                    {"axisForRadialTangent", Type::Integer, -1}
                                                },
-                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                               [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                    const std::vector<Element> &vertices = args.at("vertices").raw<TypeMap::Tuple>().unnamed;
                                                    const std::vector<Element> &matGroups = args.at("matGroups").raw<TypeMap::Tuple>().unnamed;
                                                    int32_t axisForRadialTangent = args.at("axisForRadialTangent").raw<TypeMap::Integer>();
@@ -806,22 +850,22 @@ namespace SLRSceneGraph {
                                                    TriangleMeshNode::MaterialGroup resultMatGroup;
                                                    
                                                    static const Function sigMatGroup{
-                                                       1, {
+                                                       {
                                                            {"mat", Type::SurfaceMaterial},
                                                            {"normal", Type::NormalTexture, Element::createFromReference<TypeMap::NormalTexture>(nullptr)},
                                                            {"alpha", Type::FloatTexture, Element::createFromReference<TypeMap::FloatTexture>(nullptr)},
                                                            {"triangles", Type::Tuple}
                                                        }
                                                    };
-                                                   static const auto procMatGroup = [&resultMatGroup, &err](const std::map<std::string, Element> &args) {
+                                                   static const auto procMatGroup = [&resultMatGroup, &err](const ArgumentList &args) {
                                                        resultMatGroup.material = args.at("mat").rawRef<TypeMap::SurfaceMaterial>();
                                                        resultMatGroup.normalMap = args.at("normal").rawRef<TypeMap::NormalTexture>();
                                                        resultMatGroup.alphaMap = args.at("alpha").rawRef<TypeMap::FloatTexture>();
                                                        
                                                        static const Function sigTriangle{
-                                                           1, {{"v0", Type::Integer}, {"v1", Type::Integer}, {"v2", Type::Integer}}
+                                                           {{"v0", Type::Integer}, {"v1", Type::Integer}, {"v2", Type::Integer}}
                                                        };
-                                                       static const auto procTriangle = [](const std::map<std::string, Element> &args) {
+                                                       static const auto procTriangle = [](const ArgumentList &args) {
                                                            return Triangle(args.at("v0").raw<TypeMap::Integer>(),
                                                                            args.at("v1").raw<TypeMap::Integer>(),
                                                                            args.at("v2").raw<TypeMap::Integer>());
@@ -841,7 +885,7 @@ namespace SLRSceneGraph {
                                                            mesh->addVertex(vertices[i].raw<TypeMap::Vertex>());
                                                        }
                                                        else {
-                                                           const Function &CreateVertex = context.stackVariables["createVertex"].raw<TypeMap::Function>();
+                                                           const Function &CreateVertex = context.globals.at("createVertex").raw<TypeMap::Function>();
                                                            Element vtx = CreateVertex(vertices[i].raw<TypeMap::Tuple>(), context, err);
                                                            if (err->error)
                                                                return Element();
@@ -867,9 +911,9 @@ namespace SLRSceneGraph {
                                                }
                                                );
             stack["createInfinitesimalPoint"] =
-            Element::create<TypeMap::Function>(1,
+            Element::create<TypeMap::Function>(
                                                std::vector<ArgInfo>{{"position", Type::Point}, {"direction", Type::Vector}, {"material", Type::SurfaceMaterial}},
-                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                               [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                    const auto &position = args.at("position").raw<TypeMap::Point>();
                                                    const auto &direction = args.at("direction").raw<TypeMap::Point>();
                                                    const SurfaceMaterialRef material = args.at("material").rawRef<TypeMap::SurfaceMaterial>();
@@ -880,9 +924,9 @@ namespace SLRSceneGraph {
                                                }
                                                );
             stack["createVacuum"] =
-            Element::create<TypeMap::Function>(1,
+            Element::create<TypeMap::Function>(
                                                std::vector<ArgInfo>{{"min", Type::Point}, {"max", Type::Point}},
-                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                               [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                    const auto &minP = args.at("min").raw<TypeMap::Point>();
                                                    const auto &maxP = args.at("max").raw<TypeMap::Point>();
                                                    MediumNodeRef mediumNode = createShared<VacuumMediumNode>(SLR::BoundingBox3D(minP, maxP));
@@ -890,9 +934,9 @@ namespace SLRSceneGraph {
                                                }
                                                );
             stack["createHomogeneousMedium"] =
-            Element::create<TypeMap::Function>(1,
+            Element::create<TypeMap::Function>(
                                                std::vector<ArgInfo>{{"min", Type::Point}, {"max", Type::Point}, {"sigma_s", Type::Spectrum}, {"sigma_e", Type::Spectrum}, {"mat", Type::MediumMaterial}},
-                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                               [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                    const auto &minP = args.at("min").raw<TypeMap::Point>();
                                                    const auto &maxP = args.at("max").raw<TypeMap::Point>();
                                                    AssetSpectrumRef sigma_s = args.at("sigma_s").rawRef<TypeMap::Spectrum>();
@@ -903,7 +947,7 @@ namespace SLRSceneGraph {
                                                }
                                                );
             stack["createGridMedium"] =
-            Element::create<TypeMap::Function>(1,
+            Element::create<TypeMap::Function>(
                                                std::vector<std::vector<ArgInfo>>{
                                                    {
                                                        {"min", Type::Point}, {"max", Type::Point},
@@ -917,7 +961,7 @@ namespace SLRSceneGraph {
                                                    }
                                                },
                                                std::vector<Function::Procedure>{
-                                                   [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                   [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                        const auto &minP = args.at("min").raw<TypeMap::Point>();
                                                        const auto &maxP = args.at("max").raw<TypeMap::Point>();
                                                        AssetSpectrumRef base_sigma_s = args.at("base_sigma_s").rawRef<TypeMap::Spectrum>();
@@ -947,41 +991,43 @@ namespace SLRSceneGraph {
                                                                                                                       std::move(densityArray), numX, numY, numZ, mat);
                                                        return Element::createFromReference<TypeMap::MediumNode>(mediumNode);
                                                    },
-                                                   [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                   [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                        SLRAssert_NotImplemented();
                                                        return Element();
                                                    }
                                                }
                                                );
             stack["createNode"] =
-            Element::create<TypeMap::Function>(1,
+            Element::create<TypeMap::Function>(
                                                std::vector<ArgInfo>{},
-                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                               [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                    return Element::create<TypeMap::InternalNode>(createShared<SLR::StaticTransform>());
                                                }
                                                );
             stack["copyNode"] =
-            Element::create<TypeMap::Function>(1,
+            Element::create<TypeMap::Function>(
                                                std::vector<ArgInfo>{{"src", Type::Node}},
-                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                               [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                    NodeRef node = args.at("src").rawRef<TypeMap::Node>();
+                                                   if (!resolvePendingLoads(context, err))
+                                                       return Element();
                                                    NodeRef copied = std::dynamic_pointer_cast<Node>(node->copy());
                                                    return Element::createFromReference<TypeMap::Node>(copied);
                                                }
                                                );
             stack["createReferenceNode"] =
-            Element::create<TypeMap::Function>(1,
+            Element::create<TypeMap::Function>(
                                                std::vector<ArgInfo>{{"node", Type::Node}},
-                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                               [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                    NodeRef node = args.at("node").rawRef<TypeMap::Node>();
                                                    NodeRef refNode = createShared<ReferenceNode>(node);
                                                    return Element::createFromReference<TypeMap::Node>(refNode);
                                                }
                                                );
             stack["setTransform"] =
-            Element::create<TypeMap::Function>(1,
+            Element::create<TypeMap::Function>(
                                                std::vector<ArgInfo>{{"node", Type::InternalNode}, {"transform", Type::Transform}},
-                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                               [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                    InternalNodeRef node = args.at("node").rawRef<TypeMap::InternalNode>();
                                                    TransformRef tf = args.at("transform").rawRef<TypeMap::Transform>();
                                                    node->setTransform(tf);
@@ -989,9 +1035,9 @@ namespace SLRSceneGraph {
                                                }
                                                );
             stack["addChild"] =
-            Element::create<TypeMap::Function>(1,
+            Element::create<TypeMap::Function>(
                                                std::vector<ArgInfo>{{"parent", Type::InternalNode}, {"child", Type::Node}},
-                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                               [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                    InternalNodeRef parent = args.at("parent").rawRef<TypeMap::InternalNode>();
                                                    NodeRef child = args.at("child").rawRef<TypeMap::Node>();
                                                    parent->addChildNode(child);
@@ -999,9 +1045,9 @@ namespace SLRSceneGraph {
                                                }
                                                );
             stack["setInternalMedium"] =
-            Element::create<TypeMap::Function>(1,
+            Element::create<TypeMap::Function>(
                                                std::vector<ArgInfo>{{"surface", Type::SurfaceNode}, {"medium", Type::MediumNode}},
-                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                               [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                    SurfaceNodeRef surface = args.at("surface").rawRef<TypeMap::SurfaceNode>();
                                                    MediumNodeRef medium = args.at("medium").rawRef<TypeMap::MediumNode>();
                                                    surface->setInternalMedium(medium);
@@ -1009,43 +1055,82 @@ namespace SLRSceneGraph {
                                                }
                                                );
             stack["load3DModel"] =
-            Element::create<TypeMap::Function>(1,
+            Element::create<TypeMap::Function>(
                                                std::vector<ArgInfo>{
                                                    {"path", Type::String},
                                                    {"matProc", Type::Function, Element::createFromReference<TypeMap::Function>(nullptr)},
                                                    {"meshProc", Type::Function, Element::createFromReference<TypeMap::Function>(nullptr)}},
-                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                               [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                    std::string path = context.absFileDirPath + args.at("path").raw<TypeMap::String>();
                                                    auto userMatProcRef = args.at("matProc").rawRef<TypeMap::Function>();
                                                    auto meshProcRef = args.at("meshProc").rawRef<TypeMap::Function>();
                                                    
-                                                   CreateMaterialFunction matProc = createMaterialDefaultFunction;
-                                                   if (userMatProcRef) {
-                                                       matProc = [&userMatProcRef, &context, &err](const aiMaterial* aiMat, const std::string &pathPrefix, SLR::Allocator* mem) {
-                                                           return createMaterialFunction(*userMatProcRef.get(), context, err, aiMat, pathPrefix, mem);
-                                                       };
-                                                   }
+                                                   // JP: ファイルの読み込みは共有スレッドプールで行い、ここでは中身が空のノードを返す。
+                                                   //     ノードの中身が必要になった時かスクリプトの最後にこのスレッドで構築する。
+                                                   // EN: reading the file is performed on the shared thread pool, and this returns an empty node here.
+                                                   //     Construction is done on this thread when the node contents are needed or at the end of the script.
+                                                   std::shared_future<ModelSourceRef> source = loadAssetAsync<ModelSourceRef>([path]() {
+                                                       return readModel(path);
+                                                   }).share();
+                                                   TransformRef initialTransform = createShared<SLR::StaticTransform>();
+                                                   InternalNodeRef modelNode = createShared<InternalNode>(initialTransform);
+                                                   modelNode->setName(path);
                                                    
-                                                   MeshCallback meshCallback = meshCallbackDefaultFunction;
-                                                   if (meshProcRef) {
-                                                       meshCallback = [&meshProcRef, &context, &err](const std::string &name, const TriangleMeshNodeRef &mesh, const SLR::Point3D &minP, const SLR::Point3D &maxP) {
-                                                           return meshCallbackFunction(*meshProcRef.get(), context, err, name, mesh, minP, maxP);
-                                                       };
-                                                   }
+                                                   std::function<bool(ExecuteContext &, ErrorMessage*)> constructModel = [path, source, userMatProcRef, meshProcRef, initialTransform, modelNode](ExecuteContext &context, ErrorMessage* err) {
+                                                       CreateMaterialFunction matProc = createMaterialDefaultFunction;
+                                                       if (userMatProcRef) {
+                                                           matProc = [&userMatProcRef, &context, &err](const aiMaterial* aiMat, const std::string &pathPrefix, SLR::Allocator* mem) {
+                                                               return createMaterialFunction(*userMatProcRef.get(), context, err, aiMat, pathPrefix, mem);
+                                                           };
+                                                       }
+                                                       
+                                                       MeshCallback meshCallback = meshCallbackDefaultFunction;
+                                                       if (meshProcRef) {
+                                                           meshCallback = [&meshProcRef, &context, &err](const std::string &name, const TriangleMeshNodeRef &mesh, const SLR::Point3D &minP, const SLR::Point3D &maxP) {
+                                                               return meshCallbackFunction(*meshProcRef.get(), context, err, name, mesh, minP, maxP);
+                                                           };
+                                                       }
+                                                       
+                                                       InternalNodeRef constructedNode;
+                                                       construct(source.get(), constructedNode, matProc, meshCallback);
+                                                       if (err->error)
+                                                           return false;
+                                                       if (!constructedNode) {
+                                                           *err = ErrorMessage("Some errors occur during loading a 3D model: " + path);
+                                                           return false;
+                                                       }
+                                                       
+                                                       // JP: 以前と同様にモデルのルートの変換は返したノードが持ち、スクリプトが設定した変換はそれを置き換える。
+                                                       //     構築が早まったかどうかに関わらず同じ結果になるよう、構築したノードの変換は常に恒等変換とする。
+                                                       // EN: the returned node has the transform of the model root as before, and a transform set by the script replaces it.
+                                                       //     The constructed node always has the identity transform so that the result is the same regardless of whether construction was forced earlier.
+                                                       if (modelNode->getTransform() == initialTransform)
+                                                           modelNode->setTransform(constructedNode->getTransform());
+                                                       constructedNode->setTransform(createShared<SLR::StaticTransform>());
+                                                       modelNode->addChildNode(constructedNode);
+                                                       
+                                                       return true;
+                                                   };
                                                    
-                                                   InternalNodeRef modelNode;
-                                                   construct(path, modelNode, matProc, meshCallback);
-                                                   if (!modelNode) {
-                                                       *err = ErrorMessage("Some errors occur during loading a 3D model.");
-                                                       return Element();
+                                                   // JP: 材質生成関数やメッシュのコールバックは呼び出し時点の変数を参照する必要がある。
+                                                   //     構築を遅らせるとループ変数などがスクリプトの後の値になってしまうため、その場合はここで構築する。
+                                                   //     要求された順序を保つため、先に以前の読み込みを確定させる。
+                                                   // EN: the material function and the mesh callback must see variables as of this call.
+                                                   //     Deferring construction would make them see later values such as of loop variables, so construct here in that case.
+                                                   //     Earlier loads are resolved first to keep the requested order.
+                                                   if (userMatProcRef || meshProcRef) {
+                                                       if (!resolvePendingLoads(context, err) || !constructModel(context, err))
+                                                           return Element();
+                                                   }
+                                                   else {
+                                                       context.pendingLoads.push_back(constructModel);
                                                    }
-                                                   modelNode->setName(path);
                                                    
                                                    return Element::createFromReference<TypeMap::Node>(modelNode);
                                                }
                                                );
             stack["scanXZFromYPlus"] =
-            Element::create<TypeMap::Function>(1,
+            Element::create<TypeMap::Function>(
                                                std::vector<ArgInfo>{
                                                    {"node", Type::Node},
                                                    {"numX", Type::Integer},
@@ -1053,7 +1138,7 @@ namespace SLRSceneGraph {
                                                    {"randomness", Type::RealNumber, 0.0f},
                                                    {"callback", Type::Function}
                                                },
-                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                               [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                    using namespace SLR;
                                                    NodeRef node = args.at("node").rawRef<TypeMap::Node>();
                                                    uint32_t numX = args.at("numX").raw<TypeMap::Integer>();
@@ -1061,53 +1146,137 @@ namespace SLRSceneGraph {
                                                    float randomness = args.at("randomness").raw<TypeMap::RealNumber>();
                                                    const Function &callback = args.at("callback").raw<TypeMap::Function>();
                                                    
-                                                   SLR::XORShiftRNG rng(50287412);
-                                                   
-                                                   node->prepareForRendering();
-                                                   SLR::Node &rawNode = *node->getRaw();
-                                                   SLR::RenderingData renderingData(nullptr);
-                                                   SLR::ArenaAllocator mem;
-                                                   rawNode.createRenderingData(&mem, nullptr, &renderingData);
-                                                   auto aggregate = createUnique<SurfaceObjectAggregate>(renderingData.surfObjs);
+                                                   if (!resolvePendingLoads(context, err))
+                                                       return Element();
+                                                   const ScanAccelerator &accelerator = context.scene->getScanAccelerator(node);
                                                    
-                                                   SLR::BoundingBox3D bounds = aggregate->bounds();
+                                                   // JP: 乱数の消費順を保つため、光線は逐次的に生成する。交差判定は並列に行い、コールバックは元の順序で呼ぶ。
+                                                   // EN: generate rays serially to keep the order of random number consumption.
+                                                   //     Intersection tests run in parallel, and the callback is called in the original order.
+                                                   SLR::XORShiftRNG rng(50287412);
+                                                   SLR::BoundingBox3D bounds = accelerator.bounds();
+                                                   std::vector<Ray> rays;
+                                                   rays.reserve(numX * numY);
                                                    for (int i = 0; i < numY; ++i) {
                                                        for (int j = 0; j < numX; ++j) {
                                                            float purturbX = randomness * (rng.getFloat0cTo1o() - 0.5f);
                                                            float purturbZ = randomness * (rng.getFloat0cTo1o() - 0.5f);
-                                                           Ray ray(SLR::Point3D(bounds.minP.x + (bounds.maxP.x - bounds.minP.x) * (j + 0.5f + purturbX) / numX,
-                                                                           bounds.maxP.y * 1.5f,
-                                                                           bounds.minP.z + (bounds.maxP.z - bounds.minP.z) * (i + 0.5f + purturbZ) / numY),
-                                                                   SLR::Vector3D(0, -1, 0), 0.0f);
-                                                           SurfaceInteraction si;
-                                                           if (!aggregate->intersect(ray, RaySegment(), &si))
-                                                               continue;
-                                                           SurfacePoint surfPt;
-                                                           si.calculateSurfacePoint(&surfPt);
-                                                           
-                                                           ParameterList params;
-                                                           
-                                                           SLR::ReferenceFrame shadingFrame = surfPt.getShadingFrame();
-                                                           Element elPosition = Element(surfPt.getPosition());
-                                                           Element elNormal = Element(Normal3D(shadingFrame.z));
-                                                           Element elTangent = Element(shadingFrame.x);
-                                                           Element elBitangent = Element(shadingFrame.y);
-                                                           params.add("", elPosition);
-                                                           params.add("", elTangent);
-                                                           params.add("", elBitangent);
-                                                           params.add("", elNormal);
-                                                           
-                                                           callback(params, context, err);
+                                                           rays.emplace_back(SLR::Point3D(bounds.minP.x + (bounds.maxP.x - bounds.minP.x) * (j + 0.5f + purturbX) / numX,
+                                                                                          bounds.maxP.y * 1.5f,
+                                                                                          bounds.minP.z + (bounds.maxP.z - bounds.minP.z) * (i + 0.5f + purturbZ) / numY),
+                                                                             SLR::Vector3D(0, -1, 0), 0.0f);
                                                        }
                                                    }
+                                                   std::vector<SurfacePoint> surfPts(rays.size());
+                                                   std::unique_ptr<bool[]> hits(new bool[rays.size()]);
+                                                   accelerator.intersect(rays.data(), (uint32_t)rays.size(), surfPts.data(), hits.get());
                                                    
-                                                   rawNode.destroyRenderingData(&mem);
+                                                   for (int i = 0; i < rays.size(); ++i) {
+                                                       if (!hits[i])
+                                                           continue;
+                                                       const SurfacePoint &surfPt = surfPts[i];
+                                                       
+                                                       ParameterList params;
+                                                       
+                                                       SLR::ReferenceFrame shadingFrame = surfPt.getShadingFrame();
+                                                       Element elPosition = Element(surfPt.getPosition());
+                                                       Element elNormal = Element(Normal3D(shadingFrame.z));
+                                                       Element elTangent = Element(shadingFrame.x);
+                                                       Element elBitangent = Element(shadingFrame.y);
+                                                       params.add("", elPosition);
+                                                       params.add("", elTangent);
+                                                       params.add("", elBitangent);
+                                                       params.add("", elNormal);
+                                                       
+                                                       callback(params, context, err);
+                                                   }
                                                    
                                                    return Element();
                                                }
                                                );
+            stack["castRays"] =
+            Element::create<TypeMap::Function>(
+                                               std::vector<ArgInfo>{
+                                                   {"node", Type::Node},
+                                                   {"origins", Type::Tuple},
+                                                   {"directions", Type::Tuple},
+                                                   {"distMax", Type::RealNumber, Element((double)INFINITY)}
+                                               },
+                                               [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
+                                                   using namespace SLR;
+                                                   NodeRef node = args.at("node").rawRef<TypeMap::Node>();
+                                                   const ParameterList &originList = args.at("origins").raw<TypeMap::Tuple>();
+                                                   const ParameterList &directionList = args.at("directions").raw<TypeMap::Tuple>();
+                                                   float distMax = args.at("distMax").raw<TypeMap::RealNumber>();
+                                                   
+                                                   size_t numRays = originList.numUnnamed();
+                                                   if (directionList.numUnnamed() != numRays) {
+                                                       *err = ErrorMessage("The numbers of origins and directions do not match.");
+                                                       return Element();
+                                                   }
+                                                   
+                                                   // JP: 光線をSoAに詰める。方向は正規化し、距離がワールド空間の長さになるようにする。
+                                                   // EN: pack rays into SoA. Directions are normalized so that distances are lengths in world space.
+                                                   std::vector<float> orgX(numRays), orgY(numRays), orgZ(numRays);
+                                                   std::vector<float> dirX(numRays), dirY(numRays), dirZ(numRays);
+                                                   for (int i = 0; i < numRays; ++i) {
+                                                       const Element &elOrigin = originList(i);
+                                                       const Element &elDirection = directionList(i);
+                                                       if (!elOrigin.isConvertibleTo<TypeMap::Point>() || !elDirection.isConvertibleTo<TypeMap::Vector>()) {
+                                                           *err = ErrorMessage("Origins must be points and directions must be vectors.");
+                                                           return Element();
+                                                       }
+                                                       Point3D org = elOrigin.asRaw<TypeMap::Point>();
+                                                       Vector3D dir = normalize(elDirection.asRaw<TypeMap::Vector>());
+                                                       orgX[i] = org.x;
+                                                       orgY[i] = org.y;
+                                                       orgZ[i] = org.z;
+                                                       dirX[i] = dir.x;
+                                                       dirY[i] = dir.y;
+                                                       dirZ[i] = dir.z;
+                                                   }
+                                                   std::vector<float> distMaxes(numRays, distMax);
+                                                   RayBatch rays;
+                                                   rays.orgX = orgX.data();
+                                                   rays.orgY = orgY.data();
+                                                   rays.orgZ = orgZ.data();
+                                                   rays.dirX = dirX.data();
+                                                   rays.dirY = dirY.data();
+                                                   rays.dirZ = dirZ.data();
+                                                   rays.distMax = distMaxes.data();
+                                                   rays.numRays = (uint32_t)numRays;
+                                                   
+                                                   std::vector<float> dists(numRays), normalX(numRays), normalY(numRays), normalZ(numRays);
+                                                   std::vector<uint32_t> primIDs(numRays);
+                                                   RayBatchHits hits;
+                                                   hits.dist = dists.data();
+                                                   hits.primIDs = primIDs.data();
+                                                   hits.normalX = normalX.data();
+                                                   hits.normalY = normalY.data();
+                                                   hits.normalZ = normalZ.data();
+                                                   
+                                                   if (!resolvePendingLoads(context, err))
+                                                       return Element();
+                                                   context.scene->getScanAccelerator(node).intersectBatch(rays, hits);
+                                                   
+                                                   // JP: 光線ごとに交差の有無、距離、プリミティブ番号、法線を持つタプルを返す。
+                                                   // EN: return a tuple per ray which has whether it hits, the distance, the primitive ID and the normal.
+                                                   ParameterListRef results = createShared<ParameterList>();
+                                                   for (int i = 0; i < numRays; ++i) {
+                                                       bool hit = primIDs[i] != UINT32_MAX;
+                                                       ParameterListRef result = createShared<ParameterList>();
+                                                       result->add("hit", Element(hit));
+                                                       result->add("distance", Element((double)dists[i]));
+                                                       result->add("primitive", Element(hit ? (int32_t)primIDs[i] : -1));
+                                                       result->add("normal", Element(Normal3D(normalX[i], normalY[i], normalZ[i])));
+                                                       results->add("", Element::createFromReference<TypeMap::Tuple>(result));
+                                                   }
+                                                   
+                                                   return Element::createFromReference<TypeMap::Tuple>(results);
+                                               }
+                                               );
             stack["createPerspectiveCamera"] =
-            Element::create<TypeMap::Function>(1,
+            Element::create<TypeMap::Function>(
                                                std::vector<ArgInfo>{
                                                    {"sensitivity", Type::RealNumber, Element(0.0)},
                                                    {"aspect", Type::RealNumber, Element(1.0)},
@@ -1116,7 +1285,7 @@ namespace SLRSceneGraph {
                                                    {"imgDist", Type::RealNumber, Element(0.02)},
                                                    {"objDist", Type::RealNumber, Element(5.0)}
                                                },
-                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                               [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                    float sensitivity = args.at("sensitivity").raw<TypeMap::RealNumber>();
                                                    float aspect = args.at("aspect").raw<TypeMap::RealNumber>();
                                                    float fovY = args.at("fovY").raw<TypeMap::RealNumber>();
@@ -1129,13 +1298,13 @@ namespace SLRSceneGraph {
                                                }
                                                );
             stack["createEquirectangularCamera"] =
-            Element::create<TypeMap::Function>(1,
+            Element::create<TypeMap::Function>(
                                                std::vector<ArgInfo>{
                                                    {"sensitivity", Type::RealNumber, Element(0.0)},
                                                    {"phi", Type::RealNumber},
                                                    {"theta", Type::RealNumber}
                                                },
-                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                               [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                    float sensitivity = args.at("sensitivity").raw<TypeMap::RealNumber>();
                                                    float phi = args.at("phi").raw<TypeMap::RealNumber>();
                                                    float theta = args.at("theta").raw<TypeMap::RealNumber>();
@@ -1145,41 +1314,162 @@ namespace SLRSceneGraph {
                                                }
                                                );
             stack["setRenderer"] =
-            Element::create<TypeMap::Function>(1,
+            Element::create<TypeMap::Function>(
                                                std::vector<ArgInfo>{
                                                    {"method", Type::String}, {"config", Type::Tuple, Element::create<TypeMap::Tuple>()}
                                                },
-                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                               [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                    std::string method = args.at("method").raw<TypeMap::String>();
                                                    const ParameterList &config = args.at("config").raw<TypeMap::Tuple>();
                                                    if (method == "PT") {
                                                        const static Function configPT{
-                                                           0, {{"samples", Type::Integer, Element(8)}},
-                                                           [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                           {
+                                                               {"samples", Type::Integer, Element(8)},
+                                                               {"sampler", Type::String, Element::create<TypeMap::String>("Independent")},
+                                                               {"adaptive threshold", Type::RealNumber, Element(0.0)},
+                                                               {"max samples", Type::Integer, Element(0)},
+                                                               {"guiding passes", Type::Integer, Element(0)}
+                                                           },
+                                                           [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                                uint32_t spp = args.at("samples").raw<TypeMap::Integer>();
-                                                               context.renderingContext->renderer = createUnique<SLR::PTRenderer>(spp);
+                                                               SLR::LightPathSamplerType samplerType;
+                                                               if (!strToLightPathSamplerType(args.at("sampler").raw<TypeMap::String>(), &samplerType)) {
+                                                                   *err = ErrorMessage("Specified sampler is invalid.");
+                                                                   return Element();
+                                                               }
+                                                               float adaptiveThreshold = args.at("adaptive threshold").raw<TypeMap::RealNumber>();
+                                                               int32_t maxSPP = args.at("max samples").raw<TypeMap::Integer>();
+                                                               if (adaptiveThreshold < 0 || maxSPP < 0) {
+                                                                   *err = ErrorMessage("Adaptive sampling parameters must be non-negative.");
+                                                                   return Element();
+                                                               }
+                                                               int32_t guidingPasses = args.at("guiding passes").raw<TypeMap::Integer>();
+                                                               if (guidingPasses < 0) {
+                                                                   *err = ErrorMessage("The number of guiding passes must be non-negative.");
+                                                                   return Element();
+                                                               }
+                                                               context.renderingContext->renderer = createUnique<SLR::PTRenderer>(spp, samplerType, adaptiveThreshold, maxSPP, guidingPasses);
                                                                return Element();
                                                            }
                                                        };
                                                        return configPT(config, context, err);
                                                    }
+                                                   else if (method == "Wavefront PT") {
+                                                       const static Function configWavefrontPT{
+                                                           {
+                                                               {"samples", Type::Integer, Element(8)},
+                                                               {"sort rays", Type::Bool, Element(true)},
+                                                               {"packet size", Type::Integer, Element(16)}
+                                                           },
+                                                           [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
+                                                               uint32_t spp = args.at("samples").raw<TypeMap::Integer>();
+                                                               bool sortRays = args.at("sort rays").raw<TypeMap::Bool>();
+                                                               int32_t packetSize = args.at("packet size").raw<TypeMap::Integer>();
+                                                               if (packetSize < 1 || packetSize > 32) {
+                                                                   *err = ErrorMessage("Packet size must be in the range [1, 32].");
+                                                                   return Element();
+                                                               }
+                                                               context.renderingContext->renderer = createUnique<SLR::WavefrontPTRenderer>(spp, sortRays, packetSize);
+                                                               return Element();
+                                                           }
+                                                       };
+                                                       return configWavefrontPT(config, context, err);
+                                                   }
                                                    else if (method == "BPT") {
                                                        const static Function configBPT{
-                                                           0, {{"samples", Type::Integer, Element(8)}},
-                                                           [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                           {
+                                                               {"samples", Type::Integer, Element(8)},
+                                                               {"sampler", Type::String, Element::create<TypeMap::String>("Independent")}
+                                                           },
+                                                           [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                                uint32_t spp = args.at("samples").raw<TypeMap::Integer>();
-                                                               context.renderingContext->renderer = createUnique<SLR::BPTRenderer>(spp);
+                                                               SLR::LightPathSamplerType samplerType;
+                                                               if (!strToLightPathSamplerType(args.at("sampler").raw<TypeMap::String>(), &samplerType)) {
+                                                                   *err = ErrorMessage("Specified sampler is invalid.");
+                                                                   return Element();
+                                                               }
+                                                               context.renderingContext->renderer = createUnique<SLR::BPTRenderer>(spp, samplerType);
                                                                return Element();
                                                            }
                                                        };
                                                        return configBPT(config, context, err);
                                                    }
+                                                   else if (method == "VCM") {
+                                                       const static Function configVCM{
+                                                           {
+                                                               {"samples", Type::Integer, Element(8)},
+                                                               {"sampler", Type::String, Element::create<TypeMap::String>("Independent")},
+                                                               {"radius", Type::RealNumber, Element(0.003)},
+                                                               {"radius reduction", Type::RealNumber, Element(0.75)}
+                                                           },
+                                                           [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
+                                                               uint32_t spp = args.at("samples").raw<TypeMap::Integer>();
+                                                               SLR::LightPathSamplerType samplerType;
+                                                               if (!strToLightPathSamplerType(args.at("sampler").raw<TypeMap::String>(), &samplerType)) {
+                                                                   *err = ErrorMessage("Specified sampler is invalid.");
+                                                                   return Element();
+                                                               }
+                                                               float radius = args.at("radius").raw<TypeMap::RealNumber>();
+                                                               float radiusReduction = args.at("radius reduction").raw<TypeMap::RealNumber>();
+                                                               if (radius <= 0 || radiusReduction <= 0 || radiusReduction >= 1) {
+                                                                   *err = ErrorMessage("Radius must be positive and radius reduction must be in (0, 1).");
+                                                                   return Element();
+                                                               }
+                                                               context.renderingContext->renderer = createUnique<SLR::VCMRenderer>(spp, samplerType, radius, radiusReduction);
+                                                               return Element();
+                                                           }
+                                                       };
+                                                       return configVCM(config, context, err);
+                                                   }
+                                                   else if (method == "AMCMCPPM") {
+                                                       const static Function configAMCMCPPM{
+                                                           {
+                                                               {"passes", Type::Integer, Element(16)},
+                                                               {"photons", Type::Integer, Element(1000000)},
+                                                               {"sampler", Type::String, Element::create<TypeMap::String>("Independent")},
+                                                               {"radius", Type::RealNumber, Element(0.003)},
+                                                               {"radius reduction", Type::RealNumber, Element(2.0 / 3.0)}
+                                                           },
+                                                           [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
+                                                               uint32_t numPasses = args.at("passes").raw<TypeMap::Integer>();
+                                                               uint32_t numPhotons = args.at("photons").raw<TypeMap::Integer>();
+                                                               SLR::LightPathSamplerType samplerType;
+                                                               if (!strToLightPathSamplerType(args.at("sampler").raw<TypeMap::String>(), &samplerType)) {
+                                                                   *err = ErrorMessage("Specified sampler is invalid.");
+                                                                   return Element();
+                                                               }
+                                                               float radius = args.at("radius").raw<TypeMap::RealNumber>();
+                                                               float radiusReduction = args.at("radius reduction").raw<TypeMap::RealNumber>();
+                                                               if (radius <= 0 || radiusReduction <= 0 || radiusReduction >= 1) {
+                                                                   *err = ErrorMessage("Radius must be positive and radius reduction must be in (0, 1).");
+                                                                   return Element();
+                                                               }
+                                                               context.renderingContext->renderer = createUnique<SLR::AMCMCPPMRenderer>(numPhotons, numPasses, samplerType, radius, radiusReduction);
+                                                               return Element();
+                                                           }
+                                                       };
+                                                       return configAMCMCPPM(config, context, err);
+                                                   }
                                                    else if (method == "Volumetric PT") {
                                                        const static Function configVolumetricPT{
-                                                           0, {{"samples", Type::Integer, Element(8)}},
-                                                           [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                           {
+                                                               {"samples", Type::Integer, Element(8)},
+                                                               {"sampler", Type::String, Element::create<TypeMap::String>("Independent")},
+                                                               {"guiding passes", Type::Integer, Element(0)}
+                                                           },
+                                                           [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                                uint32_t spp = args.at("samples").raw<TypeMap::Integer>();
-                                                               context.renderingContext->renderer = createUnique<SLR::VolumetricPTRenderer>(spp);
+                                                               SLR::LightPathSamplerType samplerType;
+                                                               if (!strToLightPathSamplerType(args.at("sampler").raw<TypeMap::String>(), &samplerType)) {
+                                                                   *err = ErrorMessage("Specified sampler is invalid.");
+                                                                   return Element();
+                                                               }
+                                                               int32_t guidingPasses = args.at("guiding passes").raw<TypeMap::Integer>();
+                                                               if (guidingPasses < 0) {
+                                                                   *err = ErrorMessage("The number of guiding passes must be non-negative.");
+                                                                   return Element();
+                                                               }
+                                                               context.renderingContext->renderer = createUnique<SLR::VolumetricPTRenderer>(spp, samplerType, guidingPasses);
                                                                return Element();
                                                            }
                                                        };
@@ -1187,10 +1477,18 @@ namespace SLRSceneGraph {
                                                    }
                                                    else if (method == "Volumetric BPT") {
                                                        const static Function configVolumetricBPT{
-                                                           0, {{"samples", Type::Integer, Element(8)}},
-                                                           [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                           {
+                                                               {"samples", Type::Integer, Element(8)},
+                                                               {"sampler", Type::String, Element::create<TypeMap::String>("Independent")}
+                                                           },
+                                                           [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                                uint32_t spp = args.at("samples").raw<TypeMap::Integer>();
-                                                               context.renderingContext->renderer = createUnique<SLR::VolumetricBPTRenderer>(spp);
+                                                               SLR::LightPathSamplerType samplerType;
+                                                               if (!strToLightPathSamplerType(args.at("sampler").raw<TypeMap::String>(), &samplerType)) {
+                                                                   *err = ErrorMessage("Specified sampler is invalid.");
+                                                                   return Element();
+                                                               }
+                                                               context.renderingContext->renderer = createUnique<SLR::VolumetricBPTRenderer>(spp, samplerType);
                                                                return Element();
                                                            }
                                                        };
@@ -1198,8 +1496,8 @@ namespace SLRSceneGraph {
                                                    }
                                                    else if (method == "debug") {
                                                        const static Function configDebug{
-                                                           0, {{"outputs", Type::Tuple}},
-                                                           [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                           {{"outputs", Type::Tuple}},
+                                                           [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                                const ParameterList &outputs = args.at("outputs").raw<TypeMap::Tuple>();
                                                                bool chFlags[(int)SLR::ExtraChannel::NumChannels];
                                                                for (int i = 0; i < (int)SLR::ExtraChannel::NumChannels; ++i)
@@ -1231,7 +1529,7 @@ namespace SLRSceneGraph {
                                                }
                                                );
             stack["setRenderSettings"] =
-            Element::create<TypeMap::Function>(1,
+            Element::create<TypeMap::Function>(
                                                std::vector<ArgInfo>{
                                                    {"numThreads", Type::Integer, Element((int32_t)std::thread::hardware_concurrency())},
                                                    {"width", Type::Integer, Element(1024)},
@@ -1239,9 +1537,16 @@ namespace SLRSceneGraph {
                                                    {"timeStart", Type::RealNumber, Element(0.0)},
                                                    {"timeEnd", Type::RealNumber, Element(0.0)},
                                                    {"brightness", Type::RealNumber, Element(1.0f)},
-                                                   {"rngSeed", Type::Integer, Element(1509761209)}
+                                                   {"rngSeed", Type::Integer, Element(1509761209)},
+                                                   {"timeLimit", Type::RealNumber, Element(0.0)},
+                                                   {"targetNoise", Type::RealNumber, Element(0.0)},
+                                                   {"checkpoint", Type::String, Element::create<TypeMap::String>("")},
+                                                   {"checkpointInterval", Type::RealNumber, Element(0.0)},
+                                                   {"resume", Type::String, Element::create<TypeMap::String>("")},
+                                                   {"exportInterval", Type::Integer, Element(0)},
+                                                   {"exportTimeInterval", Type::RealNumber, Element(0.0)}
                                                },
-                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                               [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                    RenderingContext* renderCtx = context.renderingContext;
                                                    renderCtx->width = args.at("width").raw<TypeMap::Integer>();
                                                    renderCtx->height = args.at("height").raw<TypeMap::Integer>();
@@ -1249,12 +1554,19 @@ namespace SLRSceneGraph {
                                                    renderCtx->timeEnd = args.at("timeEnd").raw<TypeMap::RealNumber>();
                                                    renderCtx->brightness = args.at("brightness").raw<TypeMap::RealNumber>();
                                                    renderCtx->rngSeed = args.at("rngSeed").raw<TypeMap::Integer>();
+                                                   renderCtx->timeLimit = args.at("timeLimit").raw<TypeMap::RealNumber>();
+                                                   renderCtx->targetNoise = args.at("targetNoise").raw<TypeMap::RealNumber>();
+                                                   renderCtx->checkpointPath = args.at("checkpoint").raw<TypeMap::String>();
+                                                   renderCtx->checkpointInterval = args.at("checkpointInterval").raw<TypeMap::RealNumber>();
+                                                   renderCtx->resumePath = args.at("resume").raw<TypeMap::String>();
+                                                   renderCtx->exportInterval = args.at("exportInterval").raw<TypeMap::Integer>();
+                                                   renderCtx->exportTimeInterval = args.at("exportTimeInterval").raw<TypeMap::RealNumber>();
                                                    
                                                    return Element();
                                                }
                                                );
             stack["setEnvironment"] =
-            Element::create<TypeMap::Function>(1,
+            Element::create<TypeMap::Function>(
                                                std::vector<std::vector<ArgInfo>>{
                                                    {
                                                        {"path", Type::String}, 
@@ -1266,21 +1578,27 @@ namespace SLRSceneGraph {
                                                    }
                                                },
                                                std::vector<Function::Procedure>{
-                                                   [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                   [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                        std::string path = context.absFileDirPath + args.at("path").raw<TypeMap::String>();
                                                        float scale = args.at("scale").raw<TypeMap::RealNumber>();
                                                        
+                                                       // JP: 画像のデコードを待たないよう、テクスチャーと環境ノードの生成は画像が必要になるまで遅らせる。
+                                                       // EN: defer creating the texture and the environment node until the image is needed so as not to wait for decoding it.
                                                        Image2DRef img = createImage2D(path, SLR::ImageStoreMode::AsIs, SLR::SpectrumType::Illuminant, false);
-                                                       const Texture2DMappingRef &mapping = Texture2DMapping::sharedInstanceRef();
-                                                       SpectrumTextureRef IBLTex = createShared<ImageSpectrumTexture>(mapping, img);
-                                                       std::weak_ptr<Scene> sceneWRef = context.scene;
-                                                       InfiniteSphereNodeRef infSphere = createShared<InfiniteSphereNode>(sceneWRef, IBLTex, scale);
-                                                       
-                                                       context.scene->setEnvironmentNode(infSphere);
+                                                       context.pendingLoads.push_back([img, scale](ExecuteContext &context, ErrorMessage* err) {
+                                                           const Texture2DMappingRef &mapping = Texture2DMapping::sharedInstanceRef();
+                                                           SpectrumTextureRef IBLTex = createShared<ImageSpectrumTexture>(mapping, img);
+                                                           std::weak_ptr<Scene> sceneWRef = context.scene;
+                                                           InfiniteSphereNodeRef infSphere = createShared<InfiniteSphereNode>(sceneWRef, IBLTex, scale);
+                                                           
+                                                           context.scene->setEnvironmentNode(infSphere);
+                                                           
+                                                           return true;
+                                                       });
                                                        
                                                        return Element();
                                                    },
-                                                   [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                   [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                        SpectrumTextureRef image = args.at("image").rawRef<TypeMap::SpectrumTexture>();
                                                        float scale = args.at("scale").raw<TypeMap::RealNumber>();
 
@@ -1295,6 +1613,17 @@ namespace SLRSceneGraph {
                                                );
         }
         
+        auto stageTime = [](high_resolution_clock::time_point &startTime) {
+            high_resolution_clock::time_point endTime = high_resolution_clock::now();
+            double time = duration_cast<microseconds>(endTime - startTime).count() * 1e-6;
+            startTime = endTime;
+            return time;
+        };
+        ScriptTimings localTimings;
+        if (!timings)
+            timings = &localTimings;
+        high_resolution_clock::time_point startTime = high_resolution_clock::now();
+        
         SceneParsingDriver parser;
 //        parser.traceParsing = true;
         StatementsRef statements = parser.parse(filePath);
@@ -1302,14 +1631,58 @@ namespace SLRSceneGraph {
             printf("Failed to parse scene file: %s\n", filePath.c_str());
             return false;
         }
+        timings->parse = stageTime(startTime);
         
-        for (int i = 0; i < statements->size(); ++i) {
-            StatementRef statement = statements->at(i);
-            if (!statement->perform(executeContext, &errMsg)) {
-                printf("%s\n", errMsg.message.c_str());
+        FunctionPrototypeRef script = compileScript(statements, executeContext.globals, &errMsg);
+        if (!script) {
+            printf("%s\n", errMsg.message.c_str());
+            return false;
+        }
+        timings->compile = stageTime(startTime);
+        
+        Element result;
+        if (!executeFunction(*script, nullptr, executeContext, &result, &errMsg)) {
+            printf("%s\n", errMsg.message.c_str());
+            return false;
+        }
+        timings->execute = stageTime(startTime);
+        
+        if (!resolvePendingLoads(executeContext, &errMsg)) {
+            printf("%s\n", errMsg.message.c_str());
+            return false;
+        }
+        timings->resolve = stageTime(startTime);
+        return true;
+    }
+    
+    SLR_SCENEGRAPH_API bool readScene(const std::string &filePath, const SceneRef &scene, RenderingContext* context) {
+        return readScene(filePath, scene, context, nullptr);
+    }
+    
+    SLR_SCENEGRAPH_API bool benchmarkScript(const std::string &filePath, uint32_t numIterations) {
+        const char* stageNames[] = {"parse", "compile", "execute", "resolve"};
+        const uint32_t numStages = sizeof(stageNames) / sizeof(stageNames[0]);
+        double minTimes[numStages];
+        double sumTimes[numStages];
+        std::fill_n(minTimes, numStages, INFINITY);
+        std::fill_n(sumTimes, numStages, 0.0);
+        numIterations = std::max(numIterations, 1u);
+        for (int i = 0; i < numIterations; ++i) {
+            SceneRef scene = createShared<Scene>();
+            RenderingContext context;
+            ScriptTimings timings;
+            if (!readScene(filePath, scene, &context, &timings))
                 return false;
+            const double times[] = {timings.parse, timings.compile, timings.execute, timings.resolve};
+            for (int s = 0; s < numStages; ++s) {
+                minTimes[s] = std::min(minTimes[s], times[s]);
+                sumTimes[s] += times[s];
             }
         }
+        
+        printf("%s: %u iterations\n", filePath.c_str(), numIterations);
+        for (int s = 0; s < numStages; ++s)
+            printf("%8s: min %g [s], mean %g [s]\n", stageNames[s], minTimes[s], sumTimes[s] / numIterations);
         return true;
     }
 
@@ -17,6 +17,13 @@
 
 namespace SLRSceneGraph {
     SLR_SCENEGRAPH_API bool readScene(const std::string &filePath, const SceneRef &scene, RenderingContext* context);
+    // JP: シーンファイルを指定回数読み込み、構文解析、コンパイル、実行、アセットの確定の各段階に掛かった時間を表示する。
+    // EN: reads a scene file the specified number of times, and prints the time spent in each stage of parsing, compiling, executing and resolving assets.
+    SLR_SCENEGRAPH_API bool benchmarkScript(const std::string &filePath, uint32_t numIterations);
+    
+    // JP: Assimpで読み込んだモデルをメッシュキャッシュとして書き出し、両者の読み込み時間を表示する。
+    // EN: writes a model loaded by Assimp as a mesh cache, and prints the load times of both.
+    SLR_SCENEGRAPH_API bool writeMeshCache(const std::string &srcPath, const std::string &dstPath);
     
     namespace Spectrum {
         using namespace SLR;
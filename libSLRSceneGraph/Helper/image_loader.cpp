@@ -9,10 +9,12 @@
 #include <libpng16/png.h>
 #include <ImfInputFile.h>
 #include <ImfRgbaFile.h>
-#include <ImfArray.h>
+#include <ImfThreading.h>
 #include <cstdlib>
 #include <string>
 #include <cassert>
+#include <mutex>
+#include <thread>
 
 enum EXRType {
     Plane = 0,
@@ -35,26 +37,28 @@ bool getEXRInfo(const std::string &filePath, uint32_t* width, uint32_t* height,
     return true;
 }
 
-bool loadEXR(const std::string &filePath, uint8_t* storage) {
+bool loadEXR(const std::string &filePath, uint32_t rowsPerChunk, const ImageRowsCallback &processRows) {
     using namespace Imf;
     using namespace Imath;
-    RgbaInputFile file(filePath.c_str());
+    // JP: OpenEXRのスレッドを使い、まとまりの中の行ブロックを並列に展開する。
+    // EN: use threads of OpenEXR to decompress line blocks in a chunk in parallel.
+    static std::once_flag s_threadCountFlag;
+    std::call_once(s_threadCountFlag, []() {
+        setGlobalThreadCount(std::thread::hardware_concurrency());
+    });
+    RgbaInputFile file(filePath.c_str(), globalThreadCount());
     Imf::Header header = file.header();
     
     Box2i dw = file.dataWindow();
     long width = dw.max.x - dw.min.x + 1;
     long height = dw.max.y - dw.min.y + 1;
-    Array2D<Rgba> pixels{height, width};
-    pixels.resizeErase(height, width);
-    file.setFrameBuffer(&pixels[0][0] - dw.min.x - dw.min.y * width, 1, width);
-    file.readPixels(dw.min.y, dw.max.y);
-    
-    long rowSize = width * sizeof(Rgba);
-    uint8_t* orgDataHead = storage;
-    uint8_t* curDataHead = orgDataHead;
-    for (int i = 0; i < height; ++i) {
-        memcpy(curDataHead, pixels[i], rowSize);
-        curDataHead += rowSize;
+    
+    for (long y = 0; y < height; y += rowsPerChunk) {
+        long numRows = std::min<long>(rowsPerChunk, height - y);
+        std::vector<uint8_t> rows(numRows * width * sizeof(Rgba));
+        file.setFrameBuffer((Rgba*)rows.data() - dw.min.x - (dw.min.y + y) * width, 1, width);
+        file.readPixels(dw.min.y + y, dw.min.y + y + numRows - 1);
+        processRows(std::move(rows), (uint32_t)y, (uint32_t)numRows);
     }
     
     return true;
@@ -65,7 +69,7 @@ bool getJPEGInfo(const std::string &filePath, uint32_t* width, uint32_t* height,
     return false;
 }
 
-bool loadJPEG(const std::string &filePath, uint8_t* storage) {
+bool loadJPEG(const std::string &filePath, uint32_t rowsPerChunk, const ImageRowsCallback &processRows) {
     return false;
 }
 
@@ -183,7 +187,7 @@ bool getPNGInfo(const std::string &filePath, uint32_t* width, uint32_t* height,
     return true;
 }
 
-bool loadPNG(const std::string &filePath, uint8_t* storage, bool gammaCorrection) {
+bool loadPNG(const std::string &filePath, bool gammaCorrection, uint32_t rowsPerChunk, const ImageRowsCallback &processRows) {
     FILE* fp;
     PNGStructures pngStructures;
     
@@ -260,10 +264,15 @@ bool loadPNG(const std::string &filePath, uint8_t* storage, bool gammaCorrection
     else
         stride = 1;
     size_t rowSize = width * stride * sizeof(uint8_t);
-    uint8_t* dataHead = storage;
-    for (int i = 0; i < height; ++i) {
-        png_read_row(pngStructures.pngStruct, dataHead, nullptr);
-        dataHead += rowSize;
+    for (uint32_t y = 0; y < height; y += rowsPerChunk) {
+        uint32_t numRows = std::min(rowsPerChunk, height - y);
+        std::vector<uint8_t> rows(numRows * rowSize);
+        uint8_t* dataHead = rows.data();
+        for (int i = 0; i < numRows; ++i) {
+            png_read_row(pngStructures.pngStruct, dataHead, nullptr);
+            dataHead += rowSize;
+        }
+        processRows(std::move(rows), y, numRows);
     }
     
     png_read_end(pngStructures.pngStruct, pngStructures.pngEndInfo);
@@ -296,20 +305,20 @@ bool getImageInfo(const std::string &filePath, uint32_t* width, uint32_t* height
     return false;
 }
 
-bool loadImage(const std::string &filePath, uint8_t* storage, bool gammaCorrection) {
+bool loadImage(const std::string &filePath, bool gammaCorrection, uint32_t rowsPerChunk, const ImageRowsCallback &processRows) {
     size_t extPos = filePath.find_last_of(".");
     if (extPos == std::string::npos)
         return false;
     
     std::string ext = filePath.substr(extPos + 1);
     if (!ext.compare("jpg") || !ext.compare("jpeg")) {
-        return loadJPEG(filePath, storage);
+        return loadJPEG(filePath, rowsPerChunk, processRows);
     }
     else if (!ext.compare("png")) {
-        return loadPNG(filePath, storage, gammaCorrection);
+        return loadPNG(filePath, gammaCorrection, rowsPerChunk, processRows);
     }
     else if (!ext.compare("exr")) {
-        return loadEXR(filePath, storage);
+        return loadEXR(filePath, rowsPerChunk, processRows);
     }
     
     return false;
@@ -25,6 +25,12 @@ enum class ColorFormat {
 };
 
 bool getImageInfo(const std::string &filePath, uint32_t* width, uint32_t* height, uint64_t* requiredSize, ColorFormat* color);
-bool loadImage(const std::string &filePath, uint8_t* storage, bool gammaCorrection);
+
+// JP: 画像を上からrowsPerChunk行ずつデコードし、まとまりごとにprocessRowsを呼ぶ。最後のまとまりはrowsPerChunk行より少ない場合がある。
+//     画像全体の一時的な領域を確保しないよう、まとまりのデータの所有権はprocessRowsに移る。
+// EN: decodes an image from the top by rowsPerChunk rows and calls processRows for each chunk. The last chunk may have fewer rows.
+//     The ownership of chunk data moves to processRows so as not to allocate temporary storage for the entire image.
+typedef std::function<void(std::vector<uint8_t> &&rows, uint32_t yBegin, uint32_t numRows)> ImageRowsCallback;
+bool loadImage(const std::string &filePath, bool gammaCorrection, uint32_t rowsPerChunk, const ImageRowsCallback &processRows);
 
 #endif /* __SLR_image_loader__ */
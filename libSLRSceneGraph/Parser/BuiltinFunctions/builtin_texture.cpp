@@ -16,11 +16,11 @@ namespace SLRSceneGraph {
             static const Element worldPos3DMapSharedInstance = Element::createFromReference<TypeMap::Texture3DMapping>(WorldPosition3DMapping::sharedInstanceRef()); 
             
             const Element Texture2DMapping = 
-            Element::create<TypeMap::Function>(1,
+            Element::create<TypeMap::Function>(
                                                std::vector<ArgInfo>{
                                                    {"type", Type::String, Element::create<TypeMap::String>("texcoord 2D")}, {"params", Type::Tuple, Element::create<TypeMap::Tuple>()}
                                                },
-                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                               [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                    std::string type = args.at("type").raw<TypeMap::String>();
                                                    const ParameterList &params = args.at("params").raw<TypeMap::Tuple>();
                                                    (void)params;
@@ -32,11 +32,11 @@ namespace SLRSceneGraph {
                                                    return Element();
                                                });
             const Element Texture3DMapping = 
-            Element::create<TypeMap::Function>(1,
+            Element::create<TypeMap::Function>(
                                                std::vector<ArgInfo>{
                                                    {"type", Type::String, Element::create<TypeMap::String>("texcoord 2D")}, {"params", Type::Tuple, Element::create<TypeMap::Tuple>()}
                                                },
-                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                               [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                    std::string type = args.at("type").raw<TypeMap::String>();
                                                    const ParameterList &params = args.at("params").raw<TypeMap::Tuple>();
                                                    (void)params;
@@ -52,33 +52,33 @@ namespace SLRSceneGraph {
                                                    return Element();
                                                });
             const Element SpectrumTexture = 
-            Element::create<TypeMap::Function>(1,
+            Element::create<TypeMap::Function>(
                                                std::vector<std::vector<ArgInfo>>{
                                                    {{"spectrum", Type::Spectrum}},
                                                    {{"image", Type::Image2D}, {"mapping", Type::Texture2DMapping, tex2DMapSharedInstance}},
                                                    {{"procedure", Type::String}, {"params", Type::Tuple}}
                                                },
                                                std::vector<Function::Procedure>{
-                                                   [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                   [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                        AssetSpectrumRef spectrum = args.at("spectrum").rawRef<TypeMap::Spectrum>();
                                                        SpectrumTextureRef rawRef = createShared<ConstantSpectrumTexture>(spectrum);
                                                        return Element::createFromReference<TypeMap::SpectrumTexture>(rawRef);
                                                    },
-                                                   [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                   [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                        const auto &image = args.at("image").rawRef<TypeMap::Image2D>();
                                                        const auto &mapping = args.at("mapping").rawRef<TypeMap::Texture2DMapping>();
                                                        SpectrumTextureRef rawRef = createShared<ImageSpectrumTexture>(mapping, image);
                                                        return Element::createFromReference<TypeMap::SpectrumTexture>(rawRef);
                                                    },
-                                                   [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                   [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                        std::string procedure = args.at("procedure").raw<TypeMap::String>();
                                                        const ParameterList &params = args.at("params").raw<TypeMap::Tuple>();
                                                        if (procedure == "checker board") {
                                                            const static Function configFunc{
-                                                               0, {
+                                                               {
                                                                    {"c0", Type::Spectrum}, {"c1", Type::Spectrum}, {"mapping", Type::Texture2DMapping, tex2DMapSharedInstance}
                                                                },
-                                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                               [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                                    const AssetSpectrumRef c0 = args.at("c0").rawRef<TypeMap::Spectrum>();
                                                                    const AssetSpectrumRef c1 = args.at("c1").rawRef<TypeMap::Spectrum>();
                                                                    const auto &mapping = args.at("mapping").rawRef<TypeMap::Texture2DMapping>();
@@ -90,10 +90,10 @@ namespace SLRSceneGraph {
                                                        }
                                                        else if (procedure == "voronoi") {
                                                            const static Function configFunc{
-                                                               0, {
+                                                               {
                                                                    {"scale", Type::RealNumber}, {"brightness", Type::RealNumber, Element::create<TypeMap::RealNumber>(0.8f)}, {"mapping", Type::Texture3DMapping, worldPos3DMapSharedInstance}
                                                                },
-                                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                               [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                                    float scale = args.at("scale").raw<TypeMap::RealNumber>();
                                                                    float brightness = args.at("brightness").raw<TypeMap::RealNumber>();
                                                                    const auto &mapping = args.at("mapping").rawRef<TypeMap::Texture3DMapping>();
@@ -105,14 +105,14 @@ namespace SLRSceneGraph {
                                                        }
                                                        else if (procedure == "sky") {
                                                            const static Function configFunc{
-                                                               0, {
+                                                               {
                                                                    {"solar elevation", Type::RealNumber},
                                                                    {"turbidity", Type::RealNumber},
                                                                    {"ground albedo", Type::Spectrum},
                                                                    {"solar radius", Type::RealNumber, 0.5f * 0.51f * M_PI / 180},
                                                                    {"mapping", Type::Texture2DMapping, tex2DMapSharedInstance}                                                                                        
                                                                },
-                                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                               [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                                    float solarElevation = args.at("solar elevation").raw<TypeMap::RealNumber>();
                                                                    float turbidity = args.at("turbidity").raw<TypeMap::RealNumber>();
                                                                    AssetSpectrumRef groundAlbedo = args.at("ground albedo").rawRef<TypeMap::Spectrum>();
@@ -129,29 +129,29 @@ namespace SLRSceneGraph {
                                                    }
                                                });
             const Element NormalTexture = 
-            Element::create<TypeMap::Function>(1,
+            Element::create<TypeMap::Function>(
                                                std::vector<std::vector<ArgInfo>>{
                                                    {{"image", Type::Image2D}, {"mapping", Type::Texture2DMapping, tex2DMapSharedInstance}},
                                                    {{"procedure", Type::String}, {"params", Type::Tuple}}
                                                },
                                                std::vector<Function::Procedure>{
-                                                   [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                   [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                        const auto &image = args.at("image").rawRef<TypeMap::Image2D>();
                                                        const auto &mapping = args.at("mapping").rawRef<TypeMap::Texture2DMapping>();
                                                        NormalTextureRef rawRef = createShared<ImageNormalTexture>(mapping, image);
                                                        return Element::createFromReference<TypeMap::NormalTexture>(rawRef);
                                                    },
-                                                   [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                   [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                        std::string procedure = args.at("procedure").raw<TypeMap::String>();
                                                        const ParameterList &params = args.at("params").raw<TypeMap::Tuple>();
                                                        if (procedure == "checker board") {
                                                            const static Function configFunc{
-                                                               0, {
+                                                               {
                                                                    {"stepWidth", Type::RealNumber, Element(0.05)},
                                                                    {"reverse", Type::Bool, Element(false)},
                                                                    {"mapping", Type::Texture2DMapping, tex2DMapSharedInstance}
                                                                },
-                                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                               [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                                    float stepWidth = args.at("stepWidth").raw<TypeMap::RealNumber>();
                                                                    bool reverse = args.at("reverse").raw<TypeMap::Bool>();
                                                                    const auto &mapping = args.at("mapping").rawRef<TypeMap::Texture2DMapping>();
@@ -163,12 +163,12 @@ namespace SLRSceneGraph {
                                                        }
                                                        else if (procedure == "voronoi") {
                                                            const static Function configFunc{
-                                                               0, {
+                                                               {
                                                                    {"scale", Type::RealNumber},
                                                                    {"thetaMax", Type::RealNumber, Element(M_PI / 6)},
                                                                    {"mapping", Type::Texture3DMapping, worldPos3DMapSharedInstance}
                                                                },
-                                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                               [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                                    float scale = args.at("scale").raw<TypeMap::RealNumber>();
                                                                    float thetaMax = args.at("thetaMax").raw<TypeMap::RealNumber>();
                                                                    const auto &mapping = args.at("mapping").rawRef<TypeMap::Texture3DMapping>();
@@ -180,7 +180,7 @@ namespace SLRSceneGraph {
                                                        }
                                                        else if (procedure == "perlin") {
                                                            const static Function configFunc{
-                                                               0, {
+                                                               {
                                                                    {"thetaMax", Type::RealNumber, Element(M_PI / 6)},
                                                                    {"octaves", Type::Integer},
                                                                    {"init freq phi", Type::RealNumber},
@@ -190,7 +190,7 @@ namespace SLRSceneGraph {
                                                                    {"repeat", Type::Integer},
                                                                    {"mapping", Type::Texture3DMapping, worldPos3DMapSharedInstance}                                                                                        
                                                                },
-                                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                               [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                                    float thetaMax = args.at("thetaMax").raw<TypeMap::RealNumber>();
                                                                    uint32_t numOctaves = args.at("octaves").raw<TypeMap::Integer>();
                                                                    float initFreqPhi = args.at("init freq phi").raw<TypeMap::RealNumber>();
@@ -210,33 +210,33 @@ namespace SLRSceneGraph {
                                                    }
                                                });
             const Element FloatTexture = 
-            Element::create<TypeMap::Function>(1,
+            Element::create<TypeMap::Function>(
                                                std::vector<std::vector<ArgInfo>>{
                                                    {{"value", Type::RealNumber}},
                                                    {{"image", Type::Image2D}, {"mapping", Type::Texture2DMapping, tex2DMapSharedInstance}},
                                                    {{"procedure", Type::String}, {"params", Type::Tuple}}
                                                },
                                                std::vector<Function::Procedure>{
-                                                   [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                   [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                        auto value = args.at("value").raw<TypeMap::RealNumber>();
                                                        FloatTextureRef rawRef = createShared<ConstantFloatTexture>(value);
                                                        return Element::createFromReference<TypeMap::FloatTexture>(rawRef);
                                                    },
-                                                   [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                   [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                        const auto &image = args.at("image").rawRef<TypeMap::Image2D>();
                                                        const auto &mapping = args.at("mapping").rawRef<TypeMap::Texture2DMapping>();
                                                        FloatTextureRef rawRef = createShared<ImageFloatTexture>(mapping, image);
                                                        return Element::createFromReference<TypeMap::FloatTexture>(rawRef);
                                                    },
-                                                   [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                   [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                        std::string procedure = args.at("procedure").raw<TypeMap::String>();
                                                        const ParameterList &params = args.at("params").raw<TypeMap::Tuple>();
                                                        if (procedure == "checker board") {
                                                            const static Function configFunc{
-                                                               0, {
+                                                               {
                                                                    {"c0", Type::RealNumber}, {"c1", Type::RealNumber}, {"mapping", Type::Texture2DMapping, tex2DMapSharedInstance}
                                                                },
-                                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                               [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                                    float c0 = args.at("c0").raw<TypeMap::RealNumber>();
                                                                    float c1 = args.at("c1").raw<TypeMap::RealNumber>();
                                                                    const auto &mapping = args.at("mapping").rawRef<TypeMap::Texture2DMapping>();
@@ -248,13 +248,13 @@ namespace SLRSceneGraph {
                                                        }
                                                        else if (procedure == "voronoi") {
                                                            const static Function configFunc{
-                                                               0, {
+                                                               {
                                                                    {"scale", Type::RealNumber},
                                                                    {"valueScale", Type::RealNumber, Element(1.0)},
                                                                    {"flat", Type::Bool, Element(true)},
                                                                    {"mapping", Type::Texture3DMapping, worldPos3DMapSharedInstance}
                                                                },
-                                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                               [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                                    float scale = args.at("scale").raw<TypeMap::RealNumber>();
                                                                    float valueScale = args.at("valueScale").raw<TypeMap::RealNumber>();
                                                                    bool flat = args.at("flat").raw<TypeMap::Bool>();
@@ -267,7 +267,7 @@ namespace SLRSceneGraph {
                                                        }
                                                        else if (procedure == "perlin") {
                                                            const static Function configFunc{
-                                                               0, {
+                                                               {
                                                                    {"octaves", Type::Integer},
                                                                    {"init freq", Type::RealNumber},
                                                                    {"sup or init amp", Type::RealNumber},
@@ -277,7 +277,7 @@ namespace SLRSceneGraph {
                                                                    {"repeat", Type::Integer},
                                                                    {"mapping", Type::Texture3DMapping, worldPos3DMapSharedInstance}                                                                                        
                                                                },
-                                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                               [](const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) {
                                                                    uint32_t numOctaves = args.at("octaves").raw<TypeMap::Integer>();
                                                                    float initFreq = args.at("init freq").raw<TypeMap::RealNumber>();
                                                                    float supOrInitAmp = args.at("sup or init amp").raw<TypeMap::RealNumber>();
@@ -0,0 +1,542 @@
+//
+//  SceneBytecode.cpp
+//
+//  Created by 渡部 心 on 2017/07/02.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#include "SceneBytecode.h"
+
+namespace SLRSceneGraph {
+    CodeGenerator::CodeGenerator(FunctionPrototype* prototype, GlobalVariables* globals, bool topLevel) :
+    m_prototype(prototype), m_globals(globals), m_topLevel(topLevel), m_conditionalDepth(0) {
+        // JP: 最も外側のスコープはトップレベルではグローバル変数に、関数では引数に対応する。
+        // EN: the outermost scope corresponds to global variables at the top level, and to arguments in a function.
+        m_scopes.push_back(Scope{{}, 0});
+    }
+    
+    uint32_t CodeGenerator::allocateRegisters(uint32_t num, RegisterState state) {
+        uint32_t first = 0;
+        uint32_t numFound = 0;
+        for (uint32_t i = 0; i < m_registerStates.size() && numFound < num; ++i) {
+            if (m_registerStates[i] == Free) {
+                if (numFound == 0)
+                    first = i;
+                ++numFound;
+            }
+            else {
+                numFound = 0;
+            }
+        }
+        if (numFound < num) {
+            if (numFound == 0)
+                first = (uint32_t)m_registerStates.size();
+            m_registerStates.resize(first + num, Free);
+            m_alwaysDefined.resize(first + num, false);
+            m_registerNames.resize(first + num);
+        }
+        for (uint32_t i = 0; i < num; ++i)
+            m_registerStates[first + i] = state;
+        return first;
+    }
+    
+    uint32_t CodeGenerator::declareVariable(const std::string &name, bool alwaysDefined) {
+        // JP: 変数のレジスターは再利用せず、エラーメッセージで名前を引けるようにする。
+        // EN: registers of variables are not reused so that names can be looked up for error messages.
+        uint32_t reg = allocateRegisters(1, Variable);
+        m_scopes.back().variables[name] = reg;
+        m_alwaysDefined[reg] = alwaysDefined;
+        m_registerNames[reg] = name;
+        return reg;
+    }
+    
+    void CodeGenerator::pushScope() {
+        m_scopes.push_back(Scope{{}, m_conditionalDepth});
+    }
+    
+    void CodeGenerator::popScope() {
+        // JP: ブロックを抜ける時に変数を未定義に戻して値を解放する。
+        // EN: make variables undefined and release their values when leaving a block.
+        for (const auto &it : m_scopes.back().variables)
+            emit(OpCode::Clear, it.second);
+        m_scopes.pop_back();
+    }
+    
+    void CodeGenerator::release(uint32_t operand) {
+        if ((operand & (ConstantBit | GlobalBit)) == 0 && m_registerStates[operand] == Temporary)
+            m_registerStates[operand] = Free;
+    }
+    
+    void CodeGenerator::release(uint32_t firstOperand, uint32_t num) {
+        for (uint32_t i = 0; i < num; ++i)
+            release(firstOperand + i);
+    }
+    
+    uint32_t CodeGenerator::addConstant(const Element &value) {
+        m_prototype->constants.push_back(value);
+        return ConstantBit | uint32_t(m_prototype->constants.size() - 1);
+    }
+    
+    uint32_t CodeGenerator::addArgumentSite(const ArgumentSite &site) {
+        m_prototype->argumentSites.push_back(site);
+        return uint32_t(m_prototype->argumentSites.size() - 1);
+    }
+    
+    uint32_t CodeGenerator::addPrototype(const FunctionPrototypeRef &prototype) {
+        m_prototype->prototypes.push_back(prototype);
+        return uint32_t(m_prototype->prototypes.size() - 1);
+    }
+    
+    void CodeGenerator::declareArgument(const std::string &name) {
+        m_prototype->argumentNames.push_back(name);
+        declareVariable(name, true);
+    }
+    
+    uint32_t CodeGenerator::resolveVariable(const std::string &name) const {
+        int32_t minScope = m_topLevel ? 1 : 0;
+        for (int32_t i = (int32_t)m_scopes.size() - 1; i >= minScope; --i) {
+            auto it = m_scopes[i].variables.find(name);
+            if (it != m_scopes[i].variables.end())
+                return it->second;
+        }
+        return GlobalBit | m_globals->slot(name);
+    }
+    
+    bool CodeGenerator::isAlwaysDefined(uint32_t variable) const {
+        if (variable & GlobalBit)
+            return false;
+        return m_alwaysDefined[variable];
+    }
+    
+    uint32_t CodeGenerator::resolveWrite(const std::string &name, bool assigning) {
+        int32_t minScope = m_topLevel ? 1 : 0;
+        for (int32_t i = (int32_t)m_scopes.size() - 1; i >= minScope; --i) {
+            auto it = m_scopes[i].variables.find(name);
+            if (it != m_scopes[i].variables.end())
+                return it->second;
+        }
+        if (m_topLevel) {
+            if (m_scopes.size() == 1) {
+                m_declaredGlobals.insert(name);
+                return GlobalBit | m_globals->slot(name);
+            }
+            if (m_declaredGlobals.count(name) || m_globals->exists(name))
+                return GlobalBit | m_globals->slot(name);
+        }
+        return declareVariable(name, assigning && m_conditionalDepth == m_scopes.back().conditionalDepth);
+    }
+    
+    uint32_t CodeGenerator::emit(OpCode op, uint32_t a, uint32_t b, uint32_t c) {
+        m_prototype->code.push_back(Instruction{op, a, b, c});
+        return uint32_t(m_prototype->code.size() - 1);
+    }
+    
+    void CodeGenerator::finish() {
+        emit(OpCode::Return, NoRegister);
+        m_prototype->numRegisters = (uint32_t)m_registerStates.size();
+        m_prototype->registerNames = m_registerNames;
+    }
+    
+    
+    
+    FunctionPrototypeRef compileScript(const StatementsRef &statements, GlobalVariables &globals, ErrorMessage* errMsg) {
+        FunctionPrototypeRef prototype = createShared<FunctionPrototype>();
+        CodeGenerator gen(prototype.get(), &globals, true);
+        for (int i = 0; i < statements->size(); ++i) {
+            if (!statements->at(i)->compile(gen, errMsg))
+                return nullptr;
+        }
+        gen.finish();
+        return prototype;
+    }
+    
+    // JP: 呼び出しの引数を関数のシグネチャーに対応付ける。
+    // EN: maps the arguments of a call to a signature of the function.
+    static bool bindCall(const ArgumentSite &site, const Element &funcElem, const Element* regs,
+                         uint32_t* sigIdx, ArgumentList* args, ErrorMessage* errMsg) {
+        const Function &func = funcElem.raw<TypeMap::Function>();
+        const Element* values = regs + site.firstRegister;
+        if (!site.hasDynamicKeys && site.cachedFunction == funcElem.valueRef) {
+            bool hit = true;
+            for (int i = 0; i < site.numArgs; ++i) {
+                if (values[i].type != site.cachedTypes[i]) {
+                    hit = false;
+                    break;
+                }
+            }
+            if (hit) {
+                *sigIdx = site.cachedSignature;
+                bindArgs(func.signature(*sigIdx), values, site.cachedMapping.data(), args);
+                return true;
+            }
+        }
+        
+        const std::string* keys = site.keys.data();
+        std::vector<std::string> dynamicKeys;
+        if (site.hasDynamicKeys) {
+            dynamicKeys = site.keys;
+            for (int i = 0; i < site.numArgs; ++i) {
+                if (site.keyRegisters[i] == NoRegister)
+                    continue;
+                const Element &key = regs[site.keyRegisters[i]];
+                if (key.type != Type::String) {
+                    *errMsg = ErrorMessage("Key expression must results in string type.");
+                    return false;
+                }
+                dynamicKeys[i] = key.raw<TypeMap::String>();
+            }
+            keys = dynamicKeys.data();
+        }
+        
+        std::vector<int32_t> mapping;
+        for (uint32_t i = 0; i < func.numSignatures(); ++i) {
+            const std::vector<ArgInfo> &signature = func.signature(i);
+            mapping.resize(signature.size());
+            if (mapParamsToArgs(signature, keys, values, site.numArgs, mapping.data())) {
+                *sigIdx = i;
+                bindArgs(signature, values, mapping.data(), args);
+                if (!site.hasDynamicKeys) {
+                    site.cachedFunction = funcElem.valueRef;
+                    site.cachedTypes.resize(site.numArgs);
+                    for (int j = 0; j < site.numArgs; ++j)
+                        site.cachedTypes[j] = values[j].type;
+                    site.cachedSignature = i;
+                    site.cachedMapping = mapping;
+                }
+                return true;
+            }
+        }
+        *errMsg = ErrorMessage("Parameters are invalid.");
+        return false;
+    }
+    
+    bool executeFunction(const FunctionPrototype &prototype, const ArgumentList* args, ExecuteContext &context, Element* result, ErrorMessage* errMsg) {
+        std::vector<Element> &registers = context.registers;
+        std::vector<uint8_t> &definedFlags = context.definedFlags;
+        GlobalVariables &globals = context.globals;
+        
+        // JP: フレームを積む。呼び出し先が同じ配列に積むとアドレスが変わり得るため、呼び出しの後はポインターを取り直す。
+        // EN: push a frame. Since a callee pushes onto the same arrays and the addresses can change, re-fetch the pointers after calls.
+        size_t base = registers.size();
+        registers.resize(base + prototype.numRegisters);
+        definedFlags.resize(base + prototype.numRegisters, false);
+        struct FrameGuard {
+            std::vector<Element> &registers;
+            std::vector<uint8_t> &definedFlags;
+            size_t base;
+            ~FrameGuard() {
+                registers.resize(base);
+                definedFlags.resize(base);
+            }
+        } frameGuard{registers, definedFlags, base};
+        Element* regs = registers.data() + base;
+        uint8_t* defined = definedFlags.data() + base;
+        if (args) {
+            for (int i = 0; i < args->size(); ++i) {
+                regs[i] = (*args)[i];
+                defined[i] = true;
+            }
+        }
+        
+        const Element* constants = prototype.constants.data();
+        auto operand = [&regs, constants](uint32_t x) -> const Element & {
+            return (x & ConstantBit) ? constants[x & ~ConstantBit] : regs[x];
+        };
+        auto variableName = [&globals, &prototype](uint32_t v) -> const std::string & {
+            return (v & GlobalBit) ? globals.name(v & ~GlobalBit) : prototype.registerNames[v];
+        };
+        auto variable = [&regs, &defined, &globals](uint32_t v, bool* isDefined) -> Element & {
+            if (v & GlobalBit) {
+                *isDefined = globals.isDefined(v & ~GlobalBit);
+                return globals.value(v & ~GlobalBit);
+            }
+            *isDefined = defined[v];
+            return regs[v];
+        };
+        auto checkError = [errMsg](const Element &value) {
+            if (value.type == Type::Error) {
+                *errMsg = value.raw<TypeMap::Error>();
+                return false;
+            }
+            return true;
+        };
+        
+        const Instruction* code = prototype.code.data();
+        for (uint32_t pc = 0; ; ) {
+            const Instruction &inst = code[pc++];
+            switch (inst.op) {
+                case OpCode::Move:
+                    regs[inst.a] = operand(inst.b);
+                    break;
+                case OpCode::LoadGlobal:
+                    if (!globals.isDefined(inst.b)) {
+                        *errMsg = ErrorMessage("Undefined variable: %s", globals.name(inst.b).c_str());
+                        return false;
+                    }
+                    regs[inst.a] = globals.value(inst.b);
+                    break;
+                case OpCode::CheckDefined:
+                    if (!defined[inst.a]) {
+                        *errMsg = ErrorMessage("Undefined variable: %s", prototype.registerNames[inst.a].c_str());
+                        return false;
+                    }
+                    break;
+                case OpCode::Clear:
+                    regs[inst.a] = Element();
+                    defined[inst.a] = false;
+                    break;
+                case OpCode::Assign:
+                case OpCode::AddAssign:
+                case OpCode::SubAssign:
+                case OpCode::MulAssign:
+                case OpCode::DivAssign:
+                case OpCode::RemAssign: {
+                    bool isDefined;
+                    Element &var = variable(inst.a, &isDefined);
+                    const Element &value = operand(inst.b);
+                    if (inst.op == OpCode::Assign) {
+                        var.substitute(value);
+                        if (inst.a & GlobalBit)
+                            globals.define(inst.a & ~GlobalBit);
+                        else
+                            defined[inst.a] = true;
+                    }
+                    else {
+                        if (!isDefined) {
+                            *errMsg = ErrorMessage("Undefined variable: %s", variableName(inst.a).c_str());
+                            return false;
+                        }
+                        if (inst.op == OpCode::AddAssign)
+                            var += value;
+                        else if (inst.op == OpCode::SubAssign)
+                            var -= value;
+                        else if (inst.op == OpCode::MulAssign)
+                            var *= value;
+                        else if (inst.op == OpCode::DivAssign)
+                            var /= value;
+                        else
+                            var %= value;
+                    }
+                    if (!checkError(var))
+                        return false;
+                    if (inst.c != NoRegister)
+                        regs[inst.c] = var;
+                    break;
+                }
+                case OpCode::PreIncrement:
+                case OpCode::PreDecrement:
+                case OpCode::PostIncrement:
+                case OpCode::PostDecrement: {
+                    bool isDefined;
+                    Element &var = variable(inst.a, &isDefined);
+                    if (!isDefined) {
+                        *errMsg = ErrorMessage("Undefined variable: %s", variableName(inst.a).c_str());
+                        return false;
+                    }
+                    Element value;
+                    if (inst.op == OpCode::PreIncrement)
+                        value = ++var;
+                    else if (inst.op == OpCode::PreDecrement)
+                        value = --var;
+                    else if (inst.op == OpCode::PostIncrement)
+                        value = var++;
+                    else
+                        value = var--;
+                    if (!checkError(var) || !checkError(value))
+                        return false;
+                    if (inst.b != NoRegister)
+                        regs[inst.b] = value;
+                    break;
+                }
+                case OpCode::Affirm:
+                    regs[inst.a] = +operand(inst.b);
+                    if (!checkError(regs[inst.a]))
+                        return false;
+                    break;
+                case OpCode::Negate:
+                    regs[inst.a] = -operand(inst.b);
+                    if (!checkError(regs[inst.a]))
+                        return false;
+                    break;
+                case OpCode::LogicNot:
+                    regs[inst.a] = !operand(inst.b);
+                    if (!checkError(regs[inst.a]))
+                        return false;
+                    break;
+                case OpCode::Multiply:
+                case OpCode::Divide:
+                case OpCode::Remainder:
+                case OpCode::Add:
+                case OpCode::Subtract:
+                case OpCode::Less:
+                case OpCode::Greater:
+                case OpCode::LessEqual:
+                case OpCode::GreaterEqual:
+                case OpCode::Equal:
+                case OpCode::NotEqual:
+                case OpCode::LogicAnd:
+                case OpCode::LogicOr: {
+                    const Element &left = operand(inst.b);
+                    const Element &right = operand(inst.c);
+                    Element value;
+                    switch (inst.op) {
+                        case OpCode::Multiply:
+                            value = left * right;
+                            break;
+                        case OpCode::Divide:
+                            value = left / right;
+                            break;
+                        case OpCode::Remainder:
+                            value = left % right;
+                            break;
+                        case OpCode::Add:
+                            value = left + right;
+                            break;
+                        case OpCode::Subtract:
+                            value = left - right;
+                            break;
+                        case OpCode::Less:
+                            value = left < right;
+                            break;
+                        case OpCode::Greater:
+                            value = left > right;
+                            break;
+                        case OpCode::LessEqual:
+                            value = left <= right;
+                            break;
+                        case OpCode::GreaterEqual:
+                            value = left >= right;
+                            break;
+                        case OpCode::Equal:
+                            value = left == right;
+                            break;
+                        case OpCode::NotEqual:
+                            value = left != right;
+                            break;
+                        case OpCode::LogicAnd:
+                            value = left && right;
+                            break;
+                        default:
+                            value = left || right;
+                            break;
+                    }
+                    if (!checkError(value))
+                        return false;
+                    regs[inst.a] = value;
+                    break;
+                }
+                case OpCode::GetElement: {
+                    const Element &tuple = operand(inst.b);
+                    const Element &idx = operand(inst.c);
+                    if (!tuple.isConvertibleTo<TypeMap::Tuple>()) {
+                        *errMsg = ErrorMessage("Element access operator [] cannot be used to non tuple value.");
+                        return false;
+                    }
+                    const ParameterList &paramList = tuple.raw<TypeMap::Tuple>();
+                    Element value;
+                    if (idx.isConvertibleTo<TypeMap::Integer>()) {
+                        value = paramList(idx.asRaw<TypeMap::Integer>());
+                        if (value.type == Type::Void) {
+                            *errMsg = ErrorMessage("Index value is out or range.");
+                            return false;
+                        }
+                    }
+                    else if (idx.isConvertibleTo<TypeMap::String>()) {
+                        value = paramList(idx.asRaw<TypeMap::String>());
+                        if (value.type == Type::Void) {
+                            *errMsg = ErrorMessage("Index value is invalid.");
+                            return false;
+                        }
+                    }
+                    else {
+                        *errMsg = ErrorMessage("Index value must be integer or string compatible type.");
+                        return false;
+                    }
+                    regs[inst.a] = value;
+                    break;
+                }
+                case OpCode::MakeTuple: {
+                    const ArgumentSite &site = prototype.argumentSites[inst.b];
+                    ParameterListRef params = createShared<ParameterList>();
+                    for (int i = 0; i < site.numArgs; ++i) {
+                        const Element &value = regs[site.firstRegister + i];
+                        if (site.keyRegisters[i] == NoRegister) {
+                            params->add(site.keys[i], value);
+                            continue;
+                        }
+                        const Element &key = regs[site.keyRegisters[i]];
+                        if (key.type != Type::String) {
+                            *errMsg = ErrorMessage("Key expression must results in string type.");
+                            return false;
+                        }
+                        params->add(key.raw<TypeMap::String>(), value);
+                    }
+                    regs[inst.a] = Element::createFromReference<TypeMap::Tuple>(params);
+                    break;
+                }
+                case OpCode::MakeFunction: {
+                    const FunctionPrototypeRef &funcProto = prototype.prototypes[inst.b];
+                    std::vector<ArgInfo> signature;
+                    for (int i = 0; i < funcProto->argumentNames.size(); ++i)
+                        signature.push_back(ArgInfo{funcProto->argumentNames[i], Type::Any, regs[inst.c + i]});
+                    bool isDefined;
+                    variable(inst.a, &isDefined) = Element::create<TypeMap::Function>(signature, funcProto);
+                    if (inst.a & GlobalBit)
+                        globals.define(inst.a & ~GlobalBit);
+                    else
+                        defined[inst.a] = true;
+                    break;
+                }
+                case OpCode::Call: {
+                    bool isDefined;
+                    const Element &callee = variable(inst.b, &isDefined);
+                    if (!isDefined || callee.type != Type::Function) {
+                        *errMsg = ErrorMessage("Function %s is not defined.", variableName(inst.b).c_str());
+                        return false;
+                    }
+                    // JP: 呼び出し中に変数が書き換えられても関数が破棄されないよう参照を保持する。
+                    // EN: hold a reference so that the function isn't destroyed even if the variable is overwritten during the call.
+                    Element funcElem = callee;
+                    uint32_t sigIdx;
+                    ArgumentList funcArgs;
+                    if (!bindCall(prototype.argumentSites[inst.c], funcElem, regs, &sigIdx, &funcArgs, errMsg))
+                        return false;
+                    Element value = funcElem.raw<TypeMap::Function>().call(sigIdx, funcArgs, context, errMsg);
+                    if (errMsg->error)
+                        return false;
+                    regs = registers.data() + base;
+                    defined = definedFlags.data() + base;
+                    if (inst.a != NoRegister)
+                        regs[inst.a] = value;
+                    break;
+                }
+                case OpCode::Jump:
+                    pc = inst.a;
+                    break;
+                case OpCode::JumpIfFalse: {
+                    const Element &cond = operand(inst.a);
+                    bool condition;
+                    if (cond.type == Type::Bool) {
+                        condition = cond.raw<TypeMap::Bool>();
+                    }
+                    else if (cond.isConvertibleTo<TypeMap::Bool>()) {
+                        condition = cond.asRaw<TypeMap::Bool>();
+                    }
+                    else {
+                        *errMsg = ErrorMessage("Must provide a boolean value.");
+                        return false;
+                    }
+                    if (!condition)
+                        pc = inst.b;
+                    break;
+                }
+                case OpCode::Return:
+                    *result = inst.a != NoRegister ? operand(inst.a) : Element();
+                    return true;
+                default:
+                    SLRAssert_ShouldNotBeCalled();
+                    return false;
+            }
+        }
+    }
+}
@@ -0,0 +1,176 @@
+//
+//  SceneBytecode.h
+//
+//  Created by 渡部 心 on 2017/07/02.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#ifndef __SLRSceneGraph_SceneBytecode__
+#define __SLRSceneGraph_SceneBytecode__
+
+#include <libSLR/defines.h>
+#include "../declarations.h"
+
+#include "SceneParser.h"
+
+namespace SLRSceneGraph {
+    // JP: オペランドは通常レジスターの番号を表す。
+    //     ConstantBitが立っている場合は定数の番号、GlobalBitが立っている場合はグローバル変数のスロットを表す。
+    // EN: an operand usually represents the index of a register.
+    //     It represents the index of a constant if ConstantBit is set, or the slot of a global variable if GlobalBit is set.
+    const uint32_t NoRegister = 0xFFFFFFFF;
+    const uint32_t ConstantBit = 0x80000000;
+    const uint32_t GlobalBit = 0x40000000;
+    
+    // JP: R: レジスター、K: 定数、G: グローバル変数、V: レジスターかグローバル変数の変数。
+    // EN: R: register, K: constant, G: global variable, V: variable which is either a register or a global variable.
+    enum class OpCode : uint32_t {
+        Move = 0, // R[a] = RK(b)
+        LoadGlobal, // R[a] = G[b]
+        CheckDefined, // error if R[a] is undefined
+        Clear, // R[a] = undefined
+        Assign, // V(a) = RK(b), R[c] = V(a)
+        AddAssign, // V(a) += RK(b), R[c] = V(a)
+        SubAssign, // V(a) -= RK(b), R[c] = V(a)
+        MulAssign, // V(a) *= RK(b), R[c] = V(a)
+        DivAssign, // V(a) /= RK(b), R[c] = V(a)
+        RemAssign, // V(a) %= RK(b), R[c] = V(a)
+        PreIncrement, // R[b] = ++V(a)
+        PreDecrement, // R[b] = --V(a)
+        PostIncrement, // R[b] = V(a)++
+        PostDecrement, // R[b] = V(a)--
+        Affirm, // R[a] = +RK(b)
+        Negate, // R[a] = -RK(b)
+        LogicNot, // R[a] = !RK(b)
+        Multiply, // R[a] = RK(b) * RK(c)
+        Divide, // R[a] = RK(b) / RK(c)
+        Remainder, // R[a] = RK(b) % RK(c)
+        Add, // R[a] = RK(b) + RK(c)
+        Subtract, // R[a] = RK(b) - RK(c)
+        Less, // R[a] = RK(b) < RK(c)
+        Greater, // R[a] = RK(b) > RK(c)
+        LessEqual, // R[a] = RK(b) <= RK(c)
+        GreaterEqual, // R[a] = RK(b) >= RK(c)
+        Equal, // R[a] = RK(b) == RK(c)
+        NotEqual, // R[a] = RK(b) != RK(c)
+        LogicAnd, // R[a] = RK(b) && RK(c)
+        LogicOr, // R[a] = RK(b) || RK(c)
+        GetElement, // R[a] = RK(b)[RK(c)]
+        MakeTuple, // R[a] = (arguments of site b)
+        MakeFunction, // V(a) = function of prototype b with default values in R[c...]
+        Call, // R[a] = V(b)(arguments of site c)
+        Jump, // pc = a
+        JumpIfFalse, // if (!RK(a)) pc = b
+        Return, // return RK(a)
+    };
+    
+    struct Instruction {
+        OpCode op;
+        uint32_t a, b, c;
+    };
+    
+    // JP: 関数呼び出しやタプルの引数。値は連続したレジスターに置かれる。
+    //     呼び出しの場合は直前に対応付けた関数と引数の型を覚えておき、同じであれば対応付けを再利用する。
+    // EN: arguments of a function call or a tuple. The values are put in consecutive registers.
+    //     For a call, this remembers the function and the argument types mapped last time, and reuses the mapping if they are the same.
+    struct ArgumentSite {
+        uint32_t firstRegister;
+        uint32_t numArgs;
+        std::vector<std::string> keys;
+        // JP: キーが式の場合はそれを置いたレジスター、それ以外はNoRegister。
+        // EN: the register holding the key if it is an expression, otherwise NoRegister.
+        std::vector<uint32_t> keyRegisters;
+        bool hasDynamicKeys;
+        
+        mutable std::shared_ptr<void> cachedFunction;
+        mutable std::vector<Type> cachedTypes;
+        mutable uint32_t cachedSignature;
+        mutable std::vector<int32_t> cachedMapping;
+    };
+    
+    struct FunctionPrototype {
+        std::string name;
+        std::vector<std::string> argumentNames;
+        uint32_t numRegisters;
+        std::vector<Instruction> code;
+        std::vector<Element> constants;
+        std::vector<ArgumentSite> argumentSites;
+        std::vector<FunctionPrototypeRef> prototypes;
+        // JP: 変数のレジスターの名前。エラーメッセージに用いる。
+        // EN: names of the registers of variables, used for error messages.
+        std::vector<std::string> registerNames;
+    };
+    
+    // JP: 構文木から関数一つ分のバイトコードを生成する。
+    //     変数はコンパイル時にレジスターかグローバル変数のスロットに解決する。
+    //     関数の中で見つからない名前はグローバル変数を参照し、トップレベルのブロックの外で代入した名前はグローバル変数になる。
+    // EN: generates the bytecode of a function from the syntax tree.
+    //     Variables are resolved to registers or slots of global variables at compile time.
+    //     Names not found in a function refer to global variables, and names assigned outside blocks at the top level become global variables.
+    class CodeGenerator {
+        enum RegisterState : uint8_t {
+            Free = 0,
+            Temporary,
+            Variable,
+        };
+        struct Scope {
+            std::map<std::string, uint32_t> variables;
+            uint32_t conditionalDepth;
+        };
+        
+        FunctionPrototype* m_prototype;
+        GlobalVariables* m_globals;
+        bool m_topLevel;
+        std::set<std::string> m_declaredGlobals;
+        std::vector<Scope> m_scopes;
+        std::vector<uint8_t> m_registerStates;
+        std::vector<uint8_t> m_alwaysDefined;
+        std::vector<std::string> m_registerNames;
+        uint32_t m_conditionalDepth;
+        
+        uint32_t allocateRegisters(uint32_t num, RegisterState state);
+        uint32_t declareVariable(const std::string &name, bool alwaysDefined);
+    public:
+        CodeGenerator(FunctionPrototype* prototype, GlobalVariables* globals, bool topLevel);
+        
+        GlobalVariables &globals() const { return *m_globals; }
+        
+        void pushScope();
+        void popScope();
+        // JP: 実行されるとは限らない範囲。ここで宣言された変数は読み出しの度に定義済みかを確かめる。
+        // EN: a range which is not necessarily executed. Variables declared here are checked for being defined on each read.
+        void beginConditional() { ++m_conditionalDepth; }
+        void endConditional() { --m_conditionalDepth; }
+        
+        uint32_t allocateTemporary() { return allocateRegisters(1, Temporary); }
+        uint32_t allocateTemporaries(uint32_t num) { return allocateRegisters(num, Temporary); }
+        void release(uint32_t operand);
+        void release(uint32_t firstOperand, uint32_t num);
+        
+        uint32_t addConstant(const Element &value);
+        uint32_t addArgumentSite(const ArgumentSite &site);
+        uint32_t addPrototype(const FunctionPrototypeRef &prototype);
+        
+        void declareArgument(const std::string &name);
+        // JP: 読み出す変数をレジスターかGlobalBitを立てたスロットに解決する。
+        // EN: resolves a variable to read to a register or a slot with GlobalBit set.
+        uint32_t resolveVariable(const std::string &name) const;
+        bool isAlwaysDefined(uint32_t variable) const;
+        // JP: 書き込む変数を解決する。見つからない場合は現在のスコープに宣言する。
+        // EN: resolves a variable to write. This declares it in the current scope if not found.
+        uint32_t resolveWrite(const std::string &name, bool assigning);
+        
+        uint32_t emit(OpCode op, uint32_t a = 0, uint32_t b = 0, uint32_t c = 0);
+        uint32_t position() const { return (uint32_t)m_prototype->code.size(); }
+        Instruction &instruction(uint32_t pos) { return m_prototype->code[pos]; }
+        
+        void finish();
+    };
+    
+    FunctionPrototypeRef compileScript(const StatementsRef &statements, GlobalVariables &globals, ErrorMessage* errMsg);
+    // JP: 関数のバイトコードを実行する。argsはプロトタイプの引数の順に並んでいる必要がある。
+    // EN: executes the bytecode of a function. args need to be arranged in the order of the arguments of the prototype.
+    bool executeFunction(const FunctionPrototype &prototype, const ArgumentList* args, ExecuteContext &context, Element* result, ErrorMessage* errMsg);
+}
+
+#endif /* __SLRSceneGraph_SceneBytecode__ */
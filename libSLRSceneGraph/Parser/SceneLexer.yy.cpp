@@ -2360,18 +2360,34 @@ void yyfree (void * ptr )
 
 
 namespace SLRSceneGraph {
+    static YY_BUFFER_STATE s_sourceBuffer = nullptr;
+
+    // JP: 行コメントの規則は改行で終わることを前提とするため、ファイル全体を読み込み、改行で終わらない場合は末尾に補う。
+    // EN: the rule of line comments assumes a trailing newline, so this reads the whole file and appends one if it doesn't end with a newline.
     void SceneParsingDriver::beginScan() {
         yy_flex_debug = traceScanning;
+        FILE* fp;
         if (file.empty() || file == "-")
-            yyin = stdin;
-        else if (!(yyin = fopen(file.c_str(), "r"))) {
+            fp = stdin;
+        else if (!(fp = fopen(file.c_str(), "r"))) {
             error("cannot open " + file + ": " + strerror(errno));
             exit(EXIT_FAILURE);
         }
+        std::string source;
+        char chunk[4096];
+        size_t readSize;
+        while ((readSize = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+            source.append(chunk, readSize);
+        if (fp != stdin)
+            fclose(fp);
+        if (source.empty() || source.back() != '\n')
+            source += '\n';
+        s_sourceBuffer = yy_scan_bytes(source.data(), (int)source.size());
     }
 
     void SceneParsingDriver::endScan() {
-        fclose(yyin);
+        yy_delete_buffer(s_sourceBuffer);
+        s_sourceBuffer = nullptr;
     }
 }
 
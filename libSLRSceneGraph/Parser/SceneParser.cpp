@@ -6,6 +6,7 @@
 //
 
 #include "SceneParser.h"
+#include "SceneBytecode.h"
 
 #include <libSLR/SurfaceShape/TriangleSurfaceShape.h>
 #include "../API.h"
@@ -211,7 +212,7 @@ namespace SLRSceneGraph {
     
     Element &Element::operator--() {
         const TypeInfo &leftType = TypeInfo::infos[(uint32_t)type];
-        if (!leftType.preDecOperator)
+        if (leftType.preDecOperator)
             leftType.preDecOperator(*this);
         else
             *this = Element(ErrorMessage("Left type does not have the prefix -- operator definition."));
@@ -384,115 +385,122 @@ namespace SLRSceneGraph {
         return *this;
     }
     
-    bool mapParamsToArgs(const ParameterList &params, const std::vector<ArgInfo> signature, std::map<std::string, Element>* args) {
-        args->clear();
+    bool mapParamsToArgs(const std::vector<ArgInfo> &signature, const std::string* keys, const Element* values, uint32_t numParams, int32_t* mapping) {
+        const int32_t Unassigned = -2;
         size_t numArgs = signature.size();
-        std::vector<bool> assignedFlags(numArgs, false);
-        std::map<std::string, bool> namedUsedFlags;
-        for (auto &it : params.named)
-            namedUsedFlags[it.first] = false;
-        
+        for (int i = 0; i < numArgs; ++i)
+            mapping[i] = Unassigned;
+        uint32_t numUnnamed = 0;
+        std::vector<bool> namedUsedFlags(numParams, false);
+        for (int i = 0; i < numParams; ++i) {
+            if (keys[i].empty())
+                ++numUnnamed;
+        }
+
         // find key-matched arguments defined in the function signature.
-        for (auto it = std::begin(signature); it != std::end(signature); ++it) {
-            int argIdx = (int)std::distance(std::begin(signature), it);
-            const ArgInfo argInfo = *it;
-            // not found
-            if (params(argInfo.name).type == Type::Void)
-                continue;
-            const Element &value = params(argInfo.name, argInfo.expectedType);
-            // found, but not compatible
-            if (value.type == Type::Void) {
-                args->clear();
-                return false;
+        // A later parameter with the same key is ignored as ParameterList does.
+        if (numUnnamed < numParams) {
+            for (int argIdx = 0; argIdx < numArgs; ++argIdx) {
+                const ArgInfo &argInfo = signature[argIdx];
+                int32_t paramIdx = -1;
+                for (int i = 0; i < numParams; ++i) {
+                    if (keys[i] == argInfo.name) {
+                        if (paramIdx < 0)
+                            paramIdx = i;
+                        namedUsedFlags[i] = true;
+                    }
+                }
+                // not found
+                if (paramIdx < 0)
+                    continue;
+                if (values[paramIdx].type == Type::Void)
+                    return false;
+                // found, but not compatible
+                if (!values[paramIdx].isConvertibleTo(argInfo.expectedType))
+                    return false;
+                mapping[argIdx] = paramIdx;
             }
-            (*args)[argInfo.name] = value;
-            assignedFlags[argIdx] = true;
-            namedUsedFlags[argInfo.name] = true;
-        }
-        // There is an unnecessary named parameter.
-        for (const auto &it : namedUsedFlags) {
-            if (!it.second) {
-                args->clear();
-                return false;
+            // There is an unnecessary named parameter.
+            for (int i = 0; i < numParams; ++i) {
+                if (!keys[i].empty() && !namedUsedFlags[i])
+                    return false;
             }
         }
+
         // find arguments which have not assigned a value.
-        int unnamedParamIdx = 0;
-        for (auto it = std::begin(signature); it != std::end(signature); ++it) {
-            int argIdx = (int)std::distance(std::begin(signature), it);
-            if (assignedFlags[argIdx])
+        uint32_t unnamedParamIdx = 0;
+        uint32_t numUsedUnnamed = 0;
+        for (int argIdx = 0; argIdx < numArgs; ++argIdx) {
+            if (mapping[argIdx] != Unassigned)
                 continue;
-            const ArgInfo argInfo = *it;
-            if (unnamedParamIdx < params.numUnnamed()) {
-                if (params(unnamedParamIdx).isConvertibleTo(argInfo.expectedType)) {
-                    (*args)[argInfo.name] = params(unnamedParamIdx, argInfo.expectedType);
+            const ArgInfo &argInfo = signature[argIdx];
+            if (numUsedUnnamed < numUnnamed) {
+                while (!keys[unnamedParamIdx].empty())
                     ++unnamedParamIdx;
+                if (values[unnamedParamIdx].isConvertibleTo(argInfo.expectedType)) {
+                    mapping[argIdx] = unnamedParamIdx;
+                    ++unnamedParamIdx;
+                    ++numUsedUnnamed;
+                    continue;
                 }
-                else {
-                    // If there are arguments they have not been assigned yet and does not have default values, the mapping fails.
-                    if (argInfo.defaultValue.type == Type::Void) {
-                        args->clear();
-                        return false;
-                    }
-                    (*args)[argInfo.name] = argInfo.defaultValue;
-                }
-            }
-            else {
-                // If there are arguments they have not been assigned yet and does not have default values, the mapping fails.
-                if (argInfo.defaultValue.type == Type::Void) {
-                    args->clear();
-                    return false;
-                }
-                (*args)[argInfo.name] = argInfo.defaultValue;
             }
-            assignedFlags[argIdx] = true;
+            // If there are arguments they have not been assigned yet and does not have default values, the mapping fails.
+            if (argInfo.defaultValue.type == Type::Void)
+                return false;
+            mapping[argIdx] = -1;
         }
         // There is an unnecessary unnamed parameter.
-        if (unnamedParamIdx < params.numUnnamed()) {
-            args->clear();
+        if (numUsedUnnamed < numUnnamed)
             return false;
-        }
 
-        for (int i = 0; i < numArgs; ++i) {
-            if (assignedFlags[i] == false) {
-                args->clear();
-                return false;
+        return true;
+    }
+
+    void bindArgs(const std::vector<ArgInfo> &signature, const Element* values, const int32_t* mapping, ArgumentList* args) {
+        args->reset(signature);
+        for (int i = 0; i < signature.size(); ++i) {
+            const ArgInfo &argInfo = signature[i];
+            if (mapping[i] < 0) {
+                args->add(argInfo.defaultValue);
+                continue;
             }
+            const Element &value = values[mapping[i]];
+            if (argInfo.expectedType == Type::Any || value.type == argInfo.expectedType)
+                args->add(value);
+            else
+                args->add(value.as(argInfo.expectedType));
+        }
+    }
+
+    bool mapParamsToArgs(const ParameterList &params, const std::vector<ArgInfo> &signature, ArgumentList* args) {
+        std::vector<std::string> keys(params.numUnnamed());
+        std::vector<Element> values = params.unnamed;
+        for (const auto &it : params.named) {
+            keys.push_back(it.first);
+            values.push_back(it.second);
         }
-        
+        std::vector<int32_t> mapping(signature.size());
+        if (!mapParamsToArgs(signature, keys.data(), values.data(), (uint32_t)values.size(), mapping.data()))
+            return false;
+        bindArgs(signature, values.data(), mapping.data(), args);
         return true;
     }
-    
+
+    Element Function::call(uint32_t sigIdx, const ArgumentList &args, ExecuteContext &context, ErrorMessage* errMsg) const {
+        if (m_prototype) {
+            Element retValue;
+            if (!executeFunction(*m_prototype, &args, context, &retValue, errMsg))
+                return Element();
+            return retValue;
+        }
+        return m_nativeProcs[sigIdx](args, context, errMsg);
+    }
+
     Element Function::operator()(const ParameterList &params, ExecuteContext &context, ErrorMessage* errMsg) const {
-        std::map<std::string, Element> args;
+        ArgumentList args;
         for (int i = 0; i < m_signatures.size(); ++i) {
-            std::vector<ArgInfo> signature = m_signatures[i];
-            const StatementRef &stmt = m_stmts[i];
-            const Procedure &nativeProc = m_nativeProcs[i];
-            
-            if (mapParamsToArgs(params, signature, &args)) {
-                context.stackVariables.current().saveFrom(m_depth);
-                context.stackVariables.push();
-                LocalVariables &current = context.stackVariables.current();
-                for (auto &keyValue : args)
-                    current[keyValue.first] = keyValue.second;
-                
-                Element retValue;
-                context.returnFlag = false;
-                if (stmt) {
-                    stmt->perform(context, errMsg);
-                    retValue = context.returnValue;
-                }
-                else {
-                    retValue = nativeProc(args, context, errMsg);
-                }
-                context.returnValue = Element();
-                context.returnFlag = false;
-                
-                context.stackVariables.pop();
-                context.stackVariables.current().restore();
-                return retValue;
-            }
+            if (mapParamsToArgs(params, m_signatures[i], &args))
+                return call(i, args, context, errMsg);
         }
         *errMsg = ErrorMessage("Parameters are invalid.");
         return Element();
@@ -931,333 +939,400 @@ namespace SLRSceneGraph {
         }
     }
     
+    bool Expression::compileOperand(CodeGenerator &gen, uint32_t* operand, ErrorMessage* errMsg) const {
+        uint32_t reg = gen.allocateTemporary();
+        if (!compileTo(gen, reg, errMsg))
+            return false;
+        *operand = reg;
+        return true;
+    }
+
+    bool Expression::compile(CodeGenerator &gen, ErrorMessage* errMsg) const {
+        return compileTo(gen, NoRegister, errMsg);
+    }
+
+    // JP: 引数の値を連続したレジスターに置くコードを生成する。キーが文字列の定数でない場合は実行時に評価する。
+    // EN: generates code putting the values of arguments in consecutive registers. A key is evaluated at run time if it is not a constant string.
+    static bool compileArguments(CodeGenerator &gen, const ParameterVecRef &params, ArgumentSite* site, ErrorMessage* errMsg) {
+        site->numArgs = (uint32_t)params->size();
+        site->firstRegister = gen.allocateTemporaries(site->numArgs);
+        site->keys.resize(site->numArgs);
+        site->keyRegisters.resize(site->numArgs, NoRegister);
+        site->hasDynamicKeys = false;
+        site->cachedSignature = 0;
+        for (int i = 0; i < site->numArgs; ++i) {
+            const ParameterRef &param = params->at(i);
+            const ExpressionRef &keyExpr = param->keyExpression();
+            Element key;
+            if (keyExpr && keyExpr->getConstant(&key) && key.type == Type::String) {
+                site->keys[i] = key.raw<TypeMap::String>();
+            }
+            else if (keyExpr) {
+                site->keyRegisters[i] = gen.allocateTemporary();
+                site->hasDynamicKeys = true;
+                if (!keyExpr->compileTo(gen, site->keyRegisters[i], errMsg))
+                    return false;
+            }
+            if (!param->valueExpression()->compileTo(gen, site->firstRegister + i, errMsg))
+                return false;
+        }
+        return true;
+    }
+
+    static void releaseArguments(CodeGenerator &gen, const ArgumentSite &site) {
+        gen.release(site.firstRegister, site.numArgs);
+        for (int i = 0; i < site.numArgs; ++i) {
+            if (site.keyRegisters[i] != NoRegister)
+                gen.release(site.keyRegisters[i]);
+        }
+    }
+
     BlockStatement::BlockStatement(const StatementsRef &statements) {
         for (int i = 0; i < statements->size(); ++i) {
             StatementRef &statement = statements->at(i);
             m_statements.push_back(statement);
         }
     }
-    
-    bool BlockStatement::perform(SLRSceneGraph::ExecuteContext &context, SLRSceneGraph::ErrorMessage *errMsg) {
-        context.stackVariables.current().pushDepth();
+
+    bool BlockStatement::compile(CodeGenerator &gen, ErrorMessage* errMsg) const {
+        gen.pushScope();
         for (int i = 0; i < m_statements.size(); ++i) {
-            if (!m_statements[i]->perform(context, errMsg))
+            if (!m_statements[i]->compile(gen, errMsg))
                 return false;
-            if (context.returnFlag)
-                break;
         }
-        context.stackVariables.current().popDepth();
-        
+        gen.popScope();
+
         return true;
     }
-    
-    bool IfElseStatement::perform(SLRSceneGraph::ExecuteContext &context, SLRSceneGraph::ErrorMessage *errMsg) {
-        if (!m_condExpr->perform(context, errMsg))
+
+    bool IfElseStatement::compile(CodeGenerator &gen, ErrorMessage* errMsg) const {
+        uint32_t cond;
+        if (!m_condExpr->compileOperand(gen, &cond, errMsg))
             return false;
-        if (!m_condExpr->result().isConvertibleTo<TypeMap::Bool>()) {
-            *errMsg = ErrorMessage("Must provide a boolean value.");
+        uint32_t jumpToFalse = gen.emit(OpCode::JumpIfFalse, cond);
+        gen.release(cond);
+
+        gen.beginConditional();
+        if (!m_trueBlockStmt->compile(gen, errMsg))
             return false;
-        }
-        bool condition = m_condExpr->result().asRaw<TypeMap::Bool>();
-        if (condition) {
-            if (!m_trueBlockStmt->perform(context, errMsg))
+        gen.endConditional();
+        if (m_falseBlockStmt) {
+            uint32_t jumpToEnd = gen.emit(OpCode::Jump);
+            gen.instruction(jumpToFalse).b = gen.position();
+            gen.beginConditional();
+            if (!m_falseBlockStmt->compile(gen, errMsg))
                 return false;
+            gen.endConditional();
+            gen.instruction(jumpToEnd).a = gen.position();
         }
-        else if (m_falseBlockStmt) {
-            if (!m_falseBlockStmt->perform(context, errMsg))
-                return false;
+        else {
+            gen.instruction(jumpToFalse).b = gen.position();
         }
-        
+
         return true;
     }
-    
-    bool ForStatement::perform(ExecuteContext &context, ErrorMessage* errMsg) {
-        if (!m_preExpr->perform(context, errMsg))
+
+    bool ForStatement::compile(CodeGenerator &gen, ErrorMessage* errMsg) const {
+        if (!m_preExpr->compile(gen, errMsg))
+            return false;
+
+        uint32_t loopTop = gen.position();
+        uint32_t cond;
+        if (!m_condExpr->compileOperand(gen, &cond, errMsg))
             return false;
-        
-        if (!m_condExpr->perform(context, errMsg))
+        uint32_t jumpToEnd = gen.emit(OpCode::JumpIfFalse, cond);
+        gen.release(cond);
+
+        gen.beginConditional();
+        if (!m_blockStmt->compile(gen, errMsg))
             return false;
-        if (!m_condExpr->result().isConvertibleTo<TypeMap::Bool>()) {
-            *errMsg = ErrorMessage("Must provide a boolean value.");
+        if (!m_postExpr->compile(gen, errMsg))
             return false;
-        }
-        bool condition = m_condExpr->result().asRaw<TypeMap::Bool>();
-        while (condition) {
-            if (!m_blockStmt->perform(context, errMsg))
-                return false;
-            
-            if (!m_postExpr->perform(context, errMsg))
-                return false;
-            
-            if (!m_condExpr->perform(context, errMsg))
-                return false;
-            condition = m_condExpr->result().asRaw<TypeMap::Bool>();
-        }
-        
+        gen.endConditional();
+        gen.emit(OpCode::Jump, loopTop);
+        gen.instruction(jumpToEnd).b = gen.position();
+
         return true;
     }
-    
-    bool FunctionDefinitionStatement::perform(SLRSceneGraph::ExecuteContext &context, SLRSceneGraph::ErrorMessage *errMsg) {
-        std::vector<ArgInfo> args;
-        for (int i = 0; i < m_argDefs->size(); ++i) {
-            args.emplace_back();
-            
-            ArgumentDefinitionRef argDef = m_argDefs->at(i);
-            argDef->perform(context, errMsg);
-            argDef->getArgInfo(&args.back());
+
+    bool FunctionDefinitionStatement::compile(CodeGenerator &gen, ErrorMessage* errMsg) const {
+        FunctionPrototypeRef prototype = createShared<FunctionPrototype>();
+        prototype->name = m_funcName;
+        CodeGenerator funcGen(prototype.get(), &gen.globals(), false);
+        for (int i = 0; i < m_argDefs->size(); ++i)
+            funcGen.declareArgument(m_argDefs->at(i)->name());
+        if (!m_blockStmt->compile(funcGen, errMsg))
+            return false;
+        funcGen.finish();
+
+        // JP: 既定値は関数を定義する時点で評価する。
+        // EN: default values are evaluated at the time of defining the function.
+        uint32_t numArgs = (uint32_t)m_argDefs->size();
+        uint32_t firstDefault = gen.allocateTemporaries(numArgs);
+        for (int i = 0; i < numArgs; ++i) {
+            const ExpressionRef &defaultValueExpr = m_argDefs->at(i)->defaultValueExpression();
+            if (defaultValueExpr) {
+                if (!defaultValueExpr->compileTo(gen, firstDefault + i, errMsg))
+                    return false;
+            }
+            else {
+                gen.emit(OpCode::Move, firstDefault + i, gen.addConstant(Element()));
+            }
         }
-        
-        LocalVariables &current = context.stackVariables.current();
-        current[m_funcName] = Element::create<TypeMap::Function>(context.stackVariables.current().depth(), args, m_blockStmt);
+        uint32_t var = gen.resolveWrite(m_funcName, true);
+        gen.emit(OpCode::MakeFunction, var, gen.addPrototype(prototype), firstDefault);
+        gen.release(firstDefault, numArgs);
+
         return true;
     }
-    
-    bool ReturnStatement::perform(SLRSceneGraph::ExecuteContext &context, SLRSceneGraph::ErrorMessage *errMsg) {
+
+    bool ReturnStatement::compile(CodeGenerator &gen, ErrorMessage* errMsg) const {
         if (!m_expr) {
-            context.returnValue = Element();
-            context.returnFlag = true;
+            gen.emit(OpCode::Return, NoRegister);
             return true;
         }
-        if (!m_expr->perform(context, errMsg))
+        uint32_t value;
+        if (!m_expr->compileOperand(gen, &value, errMsg))
             return false;
-        context.returnValue = m_expr->result();
-        context.returnFlag = true;
+        gen.emit(OpCode::Return, value);
+        gen.release(value);
         return true;
     }
-    
-    bool BinaryExpression::perform(ExecuteContext &context, ErrorMessage *errMsg) {
-        if (!m_left->perform(context, errMsg))
-            return false;
-        if (!m_right->perform(context, errMsg))
-            return false;
-        
+
+    bool BinaryExpression::compileTo(CodeGenerator &gen, uint32_t dstReg, ErrorMessage* errMsg) const {
+        OpCode op;
         if (m_op == "+")
-            m_result = m_left->result() + m_right->result();
+            op = OpCode::Add;
         else if (m_op == "-")
-            m_result = m_left->result() - m_right->result();
+            op = OpCode::Subtract;
         else if (m_op == "<")
-            m_result = m_left->result() < m_right->result();
+            op = OpCode::Less;
         else if (m_op == ">")
-            m_result = m_left->result() > m_right->result();
+            op = OpCode::Greater;
         else if (m_op == "<=")
-            m_result = m_left->result() <= m_right->result();
+            op = OpCode::LessEqual;
         else if (m_op == ">=")
-            m_result = m_left->result() >= m_right->result();
+            op = OpCode::GreaterEqual;
         else if (m_op == "==")
-            m_result = m_left->result() == m_right->result();
+            op = OpCode::Equal;
         else if (m_op == "!=")
-            m_result = m_left->result() != m_right->result();
+            op = OpCode::NotEqual;
         else if (m_op == "&&")
-            m_result = m_left->result() && m_right->result();
+            op = OpCode::LogicAnd;
         else if (m_op == "||")
-            m_result = m_left->result() || m_right->result();
-        if (m_result.type == Type::Error) {
-            *errMsg = m_result.raw<TypeMap::Error>();
+            op = OpCode::LogicOr;
+        else {
+            *errMsg = ErrorMessage("Unknown operator: %s", m_op.c_str());
             return false;
         }
-        
-        return true;
-    }
 
-    bool SubstitutionExpression::perform(ExecuteContext &context, ErrorMessage *errMsg) {
-        if (!m_right->perform(context, errMsg))
+        uint32_t left, right;
+        if (!m_left->compileOperand(gen, &left, errMsg))
             return false;
-        if (m_op != "=" && context.stackVariables.exists(m_varName) == false) {
-            *errMsg = ErrorMessage("Undefined variable: %s", m_varName.c_str());
+        if (!m_right->compileOperand(gen, &right, errMsg))
             return false;
-        }
-        LocalVariables &current = context.stackVariables.current();
-        Element &var = current[m_varName];
-        
+        uint32_t dst = dstReg != NoRegister ? dstReg : gen.allocateTemporary();
+        gen.emit(op, dst, left, right);
+        gen.release(left);
+        gen.release(right);
+        if (dstReg == NoRegister)
+            gen.release(dst);
+
+        return true;
+    }
+
+    bool SubstitutionExpression::compileTo(CodeGenerator &gen, uint32_t dstReg, ErrorMessage* errMsg) const {
+        OpCode op;
         if (m_op == "=")
-            var.substitute(m_right->result());
+            op = OpCode::Assign;
         else if (m_op == "+=")
-            var += m_right->result();
+            op = OpCode::AddAssign;
         else if (m_op == "-=")
-            var -= m_right->result();
+            op = OpCode::SubAssign;
         else if (m_op == "*=")
-            var *= m_right->result();
+            op = OpCode::MulAssign;
         else if (m_op == "/=")
-            var /= m_right->result();
+            op = OpCode::DivAssign;
         else if (m_op == "%=")
-            var %= m_right->result();
-        if (var.type == Type::Error) {
-            *errMsg = var.raw<TypeMap::Error>();
+            op = OpCode::RemAssign;
+        else {
+            *errMsg = ErrorMessage("Unknown operator: %s", m_op.c_str());
             return false;
         }
-        
-        m_result = var;
+
+        uint32_t value;
+        if (!m_right->compileOperand(gen, &value, errMsg))
+            return false;
+        uint32_t var = gen.resolveWrite(m_varName, op == OpCode::Assign);
+        gen.emit(op, var, value, dstReg);
+        gen.release(value);
+
         return true;
     }
-    
-    bool UnaryTerm::perform(ExecuteContext &context, ErrorMessage *errMsg) {
-        if (!m_term->perform(context, errMsg))
-            return false;
+
+    bool UnaryTerm::compileTo(CodeGenerator &gen, uint32_t dstReg, ErrorMessage* errMsg) const {
+        OpCode op;
         if (m_op == "+")
-            m_result = +m_term->result();
+            op = OpCode::Affirm;
         else if (m_op == "-")
-            m_result = -m_term->result();
+            op = OpCode::Negate;
         else if (m_op == "!")
-            m_result = !m_term->result();
-        return true;
-    }
-    
-    bool UnarySubstitutionTerm::perform(SLRSceneGraph::ExecuteContext &context, SLRSceneGraph::ErrorMessage *errMsg) {
-        if (context.stackVariables.exists(m_varName) == false) {
-            *errMsg = ErrorMessage("Undefined variable: %s", m_varName.c_str());
+            op = OpCode::LogicNot;
+        else {
+            *errMsg = ErrorMessage("Unknown operator: %s", m_op.c_str());
             return false;
         }
-        LocalVariables &current = context.stackVariables.current();
-        Element &var = current.at(m_varName);
+
+        uint32_t value;
+        if (!m_term->compileOperand(gen, &value, errMsg))
+            return false;
+        uint32_t dst = dstReg != NoRegister ? dstReg : gen.allocateTemporary();
+        gen.emit(op, dst, value);
+        gen.release(value);
+        if (dstReg == NoRegister)
+            gen.release(dst);
+
+        return true;
+    }
+
+    bool UnarySubstitutionTerm::compileTo(CodeGenerator &gen, uint32_t dstReg, ErrorMessage* errMsg) const {
+        OpCode op;
         if (m_op == "++*")
-            m_result = ++var;
+            op = OpCode::PreIncrement;
         else if (m_op == "--*")
-            m_result = --var;
+            op = OpCode::PreDecrement;
         else if (m_op == "*++")
-            m_result = var++;
+            op = OpCode::PostIncrement;
         else if (m_op == "*--")
-            m_result = var--;
+            op = OpCode::PostDecrement;
+        else {
+            *errMsg = ErrorMessage("Unknown operator: %s", m_op.c_str());
+            return false;
+        }
+
+        gen.emit(op, gen.resolveVariable(m_varName), dstReg);
+
         return true;
     }
-    
-    bool BinaryTerm::perform(ExecuteContext &context, ErrorMessage *errMsg) {
-        if (!m_left->perform(context, errMsg))
-            return false;
-        if (!m_right->perform(context, errMsg))
-            return false;
 
+    bool BinaryTerm::compileTo(CodeGenerator &gen, uint32_t dstReg, ErrorMessage* errMsg) const {
+        OpCode op;
         if (m_op == "*")
-            m_result = m_left->result() * m_right->result();
+            op = OpCode::Multiply;
         else if (m_op == "/")
-            m_result = m_left->result() / m_right->result();
+            op = OpCode::Divide;
         else if (m_op == "%")
-            m_result = m_left->result() % m_right->result();
-        if (m_result.type == Type::Error) {
-            *errMsg = m_result.raw<TypeMap::Error>();
+            op = OpCode::Remainder;
+        else {
+            *errMsg = ErrorMessage("Unknown operator: %s", m_op.c_str());
             return false;
         }
+
+        uint32_t left, right;
+        if (!m_left->compileOperand(gen, &left, errMsg))
+            return false;
+        if (!m_right->compileOperand(gen, &right, errMsg))
+            return false;
+        uint32_t dst = dstReg != NoRegister ? dstReg : gen.allocateTemporary();
+        gen.emit(op, dst, left, right);
+        gen.release(left);
+        gen.release(right);
+        if (dstReg == NoRegister)
+            gen.release(dst);
+
         return true;
     }
-    
-    bool FunctionCallSingleTerm::perform(ExecuteContext &context, ErrorMessage* errMsg) {
-        if (context.stackVariables.exists(m_funcID)) {
-            const Element &funcElem = context.stackVariables.at(m_funcID);
-            if (funcElem.type == Type::Function) {
-                ParameterList params;
-                for (int i = 0; i < m_args->size(); ++i) {
-                    ParameterRef arg = m_args->at(i);
-                    if (!arg->perform(context, errMsg))
-                        return false;
-                    Element key, value;
-                    arg->getKeyAndValue(&key, &value);
-                    if (key.type != Type::String) {
-                        *errMsg = ErrorMessage("Key expression must results in string type.");
-                        return false;
-                    }
-                    params.add(key.raw<TypeMap::String>(), value);
-                }
-                
-                const Function &func = funcElem.raw<TypeMap::Function>();
-                m_result = func(params, context, errMsg);
-                if (errMsg->error)
-                    return false;
-                
-                return true;
-            }
-        }
-        *errMsg = ErrorMessage("Function %s is not defined.", m_funcID.c_str());
-        return false;
-    }
-    
-    bool EnclosedSingleTerm::perform(ExecuteContext &context, ErrorMessage *errMsg) {
-        if (!m_expr->perform(context, errMsg))
+
+    bool FunctionCallSingleTerm::compileTo(CodeGenerator &gen, uint32_t dstReg, ErrorMessage* errMsg) const {
+        ArgumentSite site;
+        if (!compileArguments(gen, m_args, &site, errMsg))
             return false;
-        m_result = m_expr->result();
+        uint32_t siteIdx = gen.addArgumentSite(site);
+        gen.emit(OpCode::Call, dstReg, gen.resolveVariable(m_funcID), siteIdx);
+        releaseArguments(gen, site);
+
         return true;
     }
-    
-    bool TupleElementSingleTerm::perform(SLRSceneGraph::ExecuteContext &context, SLRSceneGraph::ErrorMessage *errMsg) {
-        if (!m_tuple->perform(context, errMsg))
-            return false;
-        if (!m_idxExpr->perform(context, errMsg))
+
+    bool EnclosedSingleTerm::compileTo(CodeGenerator &gen, uint32_t dstReg, ErrorMessage* errMsg) const {
+        return m_expr->compileTo(gen, dstReg, errMsg);
+    }
+
+    bool EnclosedSingleTerm::compileOperand(CodeGenerator &gen, uint32_t* operand, ErrorMessage* errMsg) const {
+        return m_expr->compileOperand(gen, operand, errMsg);
+    }
+
+    bool TupleElementSingleTerm::compileTo(CodeGenerator &gen, uint32_t dstReg, ErrorMessage* errMsg) const {
+        uint32_t tuple, idx;
+        if (!m_tuple->compileOperand(gen, &tuple, errMsg))
             return false;
-        const Element &tuple = m_tuple->result();
-        const Element &idx = m_idxExpr->result();
-        if (!tuple.isConvertibleTo<TypeMap::Tuple>()) {
-            *errMsg = ErrorMessage("Element access operator [] cannot be used to non tuple value.");
+        if (!m_idxExpr->compileOperand(gen, &idx, errMsg))
             return false;
-        }
-        
-        const ParameterList &paramList = tuple.raw<TypeMap::Tuple>();
-        if (idx.isConvertibleTo<TypeMap::Integer>()) {
-            m_result = paramList(idx.raw<TypeMap::Integer>());
-            if (m_result.type == Type::Void) {
-                *errMsg = ErrorMessage("Index value is out or range.");
-                return false;
-            }
-            return true;
-        }
-        else if (idx.isConvertibleTo<TypeMap::String>()) {
-            m_result = paramList(idx.raw<TypeMap::String>());
-            if (m_result.type == Type::Void) {
-                *errMsg = ErrorMessage("Index value is invalid.");
-                return false;
-            }
-            return true;
-        }
-        *errMsg = ErrorMessage("Index value must be integer or string compatible type.");
-        return false;
+        uint32_t dst = dstReg != NoRegister ? dstReg : gen.allocateTemporary();
+        gen.emit(OpCode::GetElement, dst, tuple, idx);
+        gen.release(tuple);
+        gen.release(idx);
+        if (dstReg == NoRegister)
+            gen.release(dst);
+
+        return true;
     }
-    
-    bool TupleValue::perform(ExecuteContext &context, ErrorMessage *errMsg) {
-        ParameterListRef params = createShared<ParameterList>();
-        for (int i = 0; i < m_elements->size(); ++i) {
-            ParameterRef arg = m_elements->at(i);
-            if (!arg->perform(context, errMsg))
-                return false;
-            Element key, value;
-            arg->getKeyAndValue(&key, &value);
-            if (key.type != Type::String) {
-                *errMsg = ErrorMessage("Key expression must results in string type.");
-                return false;
-            }
-            params->add(key.raw<TypeMap::String>(), value);
-        }
-        m_result = Element::createFromReference<TypeMap::Tuple>(params);
+
+    bool ImmediateValue::compileTo(CodeGenerator &gen, uint32_t dstReg, ErrorMessage* errMsg) const {
+        if (dstReg != NoRegister)
+            gen.emit(OpCode::Move, dstReg, gen.addConstant(m_value));
         return true;
     }
-    
-    bool VariableValue::perform(ExecuteContext &context, ErrorMessage *errMsg) {
-        if (!context.stackVariables.exists(m_varName)) {
-            *errMsg = ErrorMessage("Undefined variable is used.");
-            return false;
-        }
-        m_result = context.stackVariables.at(m_varName);
+
+    bool ImmediateValue::compileOperand(CodeGenerator &gen, uint32_t* operand, ErrorMessage* errMsg) const {
+        *operand = gen.addConstant(m_value);
         return true;
     }
-    
-    bool ArgumentDefinition::perform(SLRSceneGraph::ExecuteContext &context, SLRSceneGraph::ErrorMessage *errMsg) {
-        if (m_defaultValueExpr && !m_defaultValueExpr->perform(context, errMsg))
+
+    bool TupleValue::compileTo(CodeGenerator &gen, uint32_t dstReg, ErrorMessage* errMsg) const {
+        ArgumentSite site;
+        if (!compileArguments(gen, m_elements, &site, errMsg))
             return false;
+        uint32_t dst = dstReg != NoRegister ? dstReg : gen.allocateTemporary();
+        gen.emit(OpCode::MakeTuple, dst, gen.addArgumentSite(site));
+        releaseArguments(gen, site);
+        if (dstReg == NoRegister)
+            gen.release(dst);
+
         return true;
     }
-    
-    void ArgumentDefinition::getArgInfo(ArgInfo* info) const {
-        info->name = m_name;
-        info->defaultValue = m_defaultValueExpr ? m_defaultValueExpr->result() : Element();
-        info->expectedType = Type::Any;
-    }
-    
-    bool Parameter::perform(ExecuteContext &context, ErrorMessage *errMsg) {
-        if (m_keyExpr && !m_keyExpr->perform(context, errMsg))
-            return false;
-        if (!m_valueExpr->perform(context, errMsg))
-            return false;
+
+    bool VariableValue::compileTo(CodeGenerator &gen, uint32_t dstReg, ErrorMessage* errMsg) const {
+        if (dstReg == NoRegister) {
+            uint32_t operand;
+            if (!compileOperand(gen, &operand, errMsg))
+                return false;
+            gen.release(operand);
+            return true;
+        }
+        uint32_t var = gen.resolveVariable(m_varName);
+        if (var & GlobalBit) {
+            gen.emit(OpCode::LoadGlobal, dstReg, var & ~GlobalBit);
+        }
+        else {
+            if (!gen.isAlwaysDefined(var))
+                gen.emit(OpCode::CheckDefined, var);
+            gen.emit(OpCode::Move, dstReg, var);
+        }
         return true;
     }
-    
-    void Parameter::getKeyAndValue(Element* key, Element* value) const {
-        *key = m_keyExpr ? m_keyExpr->result() : Element::create<TypeMap::String>("");
-        *value = m_valueExpr->result();
+
+    bool VariableValue::compileOperand(CodeGenerator &gen, uint32_t* operand, ErrorMessage* errMsg) const {
+        uint32_t var = gen.resolveVariable(m_varName);
+        if (var & GlobalBit) {
+            *operand = gen.allocateTemporary();
+            gen.emit(OpCode::LoadGlobal, *operand, var & ~GlobalBit);
+        }
+        else {
+            if (!gen.isAlwaysDefined(var))
+                gen.emit(OpCode::CheckDefined, var);
+            *operand = var;
+        }
+        return true;
     }
 }
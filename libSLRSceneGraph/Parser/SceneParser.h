@@ -238,35 +238,75 @@ namespace SLRSceneGraph {
         Element defaultValue;
     };
     
-    bool mapParamsToArgs(const ParameterList &params, const std::vector<ArgInfo> signature, std::map<std::string, Element>* args);
+    // JP: シグネチャーの順に並べた引数。名前による参照はシグネチャーを線形に探す。
+    // EN: arguments arranged in the order of a signature. Access by name linearly searches the signature.
+    class ArgumentList {
+        const std::vector<ArgInfo>* m_signature;
+        std::vector<Element> m_values;
+    public:
+        ArgumentList() : m_signature(nullptr) { }
+        
+        void reset(const std::vector<ArgInfo> &signature) {
+            m_signature = &signature;
+            m_values.clear();
+            m_values.reserve(signature.size());
+        }
+        void add(const Element &value) { m_values.push_back(value); }
+        
+        size_t size() const { return m_values.size(); }
+        const Element &operator[](uint32_t idx) const { return m_values[idx]; }
+        const Element &at(const std::string &name) const {
+            for (int i = 0; i < m_values.size(); ++i) {
+                if ((*m_signature)[i].name == name)
+                    return m_values[i];
+            }
+            throw std::out_of_range("Argument " + name + " is not in the signature.");
+        }
+        size_t count(const std::string &name) const {
+            for (int i = 0; i < m_values.size(); ++i) {
+                if ((*m_signature)[i].name == name)
+                    return 1;
+            }
+            return 0;
+        }
+    };
+    
+    // JP: 渡された引数(空のキーは名前無し)がシグネチャーのどの引数に対応するかを求める。
+    //     mapping[i]はi番目の引数に対応する値のインデックス、既定値を用いる場合は-1になる。
+    // EN: determine which arguments of a signature the given parameters (an empty key means unnamed) correspond to.
+    //     mapping[i] becomes the index of the value corresponding to the i-th argument, or -1 when using the default value.
+    bool mapParamsToArgs(const std::vector<ArgInfo> &signature, const std::string* keys, const Element* values, uint32_t numParams, int32_t* mapping);
+    void bindArgs(const std::vector<ArgInfo> &signature, const Element* values, const int32_t* mapping, ArgumentList* args);
+    bool mapParamsToArgs(const ParameterList &params, const std::vector<ArgInfo> &signature, ArgumentList* args);
     
     class Function {
     public:
-        typedef std::function<Element(const std::map<std::string, Element> &, ExecuteContext &, ErrorMessage*)> Procedure;
+        typedef std::function<Element(const ArgumentList &, ExecuteContext &, ErrorMessage*)> Procedure;
     private:
-        
-        const uint32_t m_depth;
         const std::vector<std::vector<ArgInfo>> m_signatures;
         const std::vector<Procedure> m_nativeProcs;
-        const std::vector<StatementRef> m_stmts;
+        const FunctionPrototypeRef m_prototype;
         
-        static Element NoOpProcedure(const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) { SLRAssert_NotImplemented(); return Element(); };
+        static Element NoOpProcedure(const ArgumentList &args, ExecuteContext &context, ErrorMessage* err) { SLRAssert_NotImplemented(); return Element(); };
     public:
-        Function(uint32_t depth, const std::vector<ArgInfo> &sig, const StatementRef &stmt = nullptr) :
-        m_depth(depth), m_signatures{sig}, m_nativeProcs{NoOpProcedure}, m_stmts{stmt} { }
-        Function(uint32_t depth, const std::vector<ArgInfo> &sig, const Procedure &proc) :
-        m_depth(depth), m_signatures{sig}, m_nativeProcs{proc}, m_stmts{nullptr} { }
-        Function(uint32_t depth, const std::vector<std::vector<ArgInfo>> &sigs, const std::vector<Procedure> &procs) :
-        m_depth(depth), m_signatures{sigs}, m_nativeProcs{procs}, m_stmts{m_signatures.size(), nullptr} { }
+        Function(const std::vector<ArgInfo> &sig, const FunctionPrototypeRef &prototype) :
+        m_signatures{sig}, m_nativeProcs{NoOpProcedure}, m_prototype(prototype) { }
+        Function(const std::vector<ArgInfo> &sig, const Procedure &proc = NoOpProcedure) :
+        m_signatures{sig}, m_nativeProcs{proc}, m_prototype(nullptr) { }
+        Function(const std::vector<std::vector<ArgInfo>> &sigs, const std::vector<Procedure> &procs) :
+        m_signatures{sigs}, m_nativeProcs{procs}, m_prototype(nullptr) { }
         
+        uint32_t numSignatures() const { return (uint32_t)m_signatures.size(); }
+        const std::vector<ArgInfo> &signature(uint32_t idx) const { return m_signatures[idx]; }
+        
+        Element call(uint32_t sigIdx, const ArgumentList &args, ExecuteContext &context, ErrorMessage* errMsg) const;
         Element operator()(const ParameterList &params, ExecuteContext &context, ErrorMessage* errMsg) const;
         
         template <typename T>
-        T perform(const std::function<T(const std::map<std::string, Element> &)> &proc, const ParameterList &params, const T &failValue = T(), ErrorMessage* errMsg = nullptr) const {
-            std::map<std::string, Element> args;
-
-            std::vector<ArgInfo> signature = m_signatures[0];
-            if (mapParamsToArgs(params, signature, &args)) {
+        T perform(const std::function<T(const ArgumentList &)> &proc, const ParameterList &params, const T &failValue = T(), ErrorMessage* errMsg = nullptr) const {
+            ArgumentList args;
+            
+            if (mapParamsToArgs(params, m_signatures[0], &args)) {
                 if (errMsg)
                     *errMsg = ErrorMessage();
                 return proc(args);
@@ -340,108 +380,83 @@ namespace SLRSceneGraph {
         return func(*this).raw<Map>();
     };
     
-    class LocalVariables {
-        std::vector<std::map<std::string, Element>> m_depthwiseVariables;
-        uint32_t m_maxDepth;
+    // JP: スクリプトのトップレベルの変数。コンパイル時に名前をスロットに解決し、実行時はスロットで参照する。
+    // EN: top-level variables of a script. Names are resolved to slots at compile time, and are accessed by slots at run time.
+    class GlobalVariables {
+        std::map<std::string, uint32_t> m_slots;
+        std::vector<std::string> m_names;
+        std::vector<Element> m_values;
+        std::vector<uint8_t> m_defined;
     public:
-        LocalVariables() : m_maxDepth(UINT32_MAX) { m_depthwiseVariables.emplace_back(); }
-        void pushDepth() { m_depthwiseVariables.emplace_back(); }
-        void popDepth() { m_depthwiseVariables.pop_back(); }
-        bool exists(const std::string &key) const {
-            uint32_t maxDepth = std::min(uint32_t(m_depthwiseVariables.size()), m_maxDepth) - 1;
-            for (int i = maxDepth; i >=0 ; --i)
-                if (m_depthwiseVariables[i].count(key) > 0)
-                    return true;
-            return false;
-        }
-        uint32_t depth() const { return (uint32_t)m_depthwiseVariables.size(); }
-        
-        void saveFrom(uint32_t depth) { m_maxDepth = depth; }
-        void restore() { m_maxDepth = UINT32_MAX; }
-        
-        const Element &operator[](const std::string &key) const {
-            uint32_t maxDepth = std::min(uint32_t(m_depthwiseVariables.size()), m_maxDepth) - 1;
-            for (int i = maxDepth; i >=0 ; --i)
-                if (m_depthwiseVariables[i].count(key) > 0)
-                    return m_depthwiseVariables[i].at(key);
-            return m_depthwiseVariables.back().at(key);
-        }
-        Element &operator[](const std::string &key) {
-            uint32_t maxDepth = std::min(uint32_t(m_depthwiseVariables.size()), m_maxDepth) - 1;
-            for (int i = maxDepth; i >=0 ; --i)
-                if (m_depthwiseVariables[i].count(key) > 0)
-                    return m_depthwiseVariables[i].at(key);
-            return m_depthwiseVariables.back()[key];
-        }
-        const Element &at(const std::string &key) const {
-            return (*this)[key];
-        }
-        Element &at(const std::string &key) {
-            uint32_t maxDepth = std::min(uint32_t(m_depthwiseVariables.size()), m_maxDepth) - 1;
-            for (int i = maxDepth; i >=0 ; --i)
-                if (m_depthwiseVariables[i].count(key) > 0)
-                    return m_depthwiseVariables[i].at(key);
-            return m_depthwiseVariables.back().at(key);
+        uint32_t slot(const std::string &name) {
+            auto it = m_slots.find(name);
+            if (it != m_slots.end())
+                return it->second;
+            uint32_t idx = (uint32_t)m_names.size();
+            m_slots[name] = idx;
+            m_names.push_back(name);
+            m_values.emplace_back();
+            m_defined.push_back(false);
+            return idx;
         }
-    };
-    
-    class StackVariables {
-        std::vector<LocalVariables> m_stack;
-    public:
-        StackVariables() { m_stack.emplace_back(); }
-        LocalVariables &current() { return m_stack.back(); }
         
-        void push() { m_stack.emplace_back(); }
-        void pop() { m_stack.pop_back(); }
+        const std::string &name(uint32_t slot) const { return m_names[slot]; }
+        bool isDefined(uint32_t slot) const { return m_defined[slot] != 0; }
+        Element &value(uint32_t slot) { return m_values[slot]; }
+        void define(uint32_t slot) { m_defined[slot] = true; }
         
         bool exists(const std::string &key) const {
-            for (int i = int(m_stack.size() - 1); i >= 0; --i) {
-                const LocalVariables &layer = m_stack[i];
-                if (layer.exists(key))
-                    return true;
-            }
-            return false;
+            auto it = m_slots.find(key);
+            return it != m_slots.end() && m_defined[it->second];
         }
-        
-        const Element &operator[](const std::string &key) const {
-            for (int i = int(m_stack.size() - 1); i >= 0; --i) {
-                const LocalVariables &layer = m_stack[i];
-                if (layer.exists(key))
-                    return layer.at(key);
-            }
-            return m_stack.back().at(key);
+        Element &operator[](const std::string &key) {
+            uint32_t idx = slot(key);
+            m_defined[idx] = true;
+            return m_values[idx];
         }
         const Element &at(const std::string &key) const {
-            for (int i = int(m_stack.size() - 1); i >= 0; --i) {
-                const LocalVariables &layer = m_stack[i];
-                if (layer.exists(key))
-                    return layer.at(key);
-            }
-            return m_stack.back().at(key);
+            return m_values[m_slots.at(key)];
         }
     };
     
     struct ExecuteContext {
-        StackVariables stackVariables;
-        Element returnValue;
-        bool returnFlag;
+        GlobalVariables globals;
+        // JP: 仮想マシンのレジスター。関数の呼び出しごとに末尾にフレームを積む。
+        // EN: registers of the virtual machine. A frame is pushed at the end for each function call.
+        std::vector<Element> registers;
+        std::vector<uint8_t> definedFlags;
         
         std::string absFileDirPath;
         SceneRef scene;
         RenderingContext* renderingContext;
+        
+        // JP: 非同期に読み込み中のアセットの後処理。値の中身が実際に必要になった時かスクリプトの最後に、要求された順に実行される。
+        // EN: post-processes of assets being loaded asynchronously.
+        //     These are performed in the requested order when the contents of the values are actually needed or at the end of the script.
+        std::deque<std::function<bool(ExecuteContext &, ErrorMessage*)>> pendingLoads;
     };
     
     
+    // JP: 構文木の各ノードは実行する代わりにバイトコードを生成する。
+    // EN: each node of the syntax tree generates bytecode instead of being executed.
     class Statement {
     public:
-        virtual bool perform(ExecuteContext &context, ErrorMessage* errMsg) = 0;
+        virtual bool compile(CodeGenerator &gen, ErrorMessage* errMsg) const = 0;
     };
     
     class Expression : public Statement {
-    protected:
-        Element m_result;
     public:
-        const Element &result() const { return m_result; };
+        // JP: 式の値をレジスターdstRegに置くコードを生成する。NoRegisterの場合は値を捨てる。
+        // EN: generates code putting the value of the expression in the register dstReg. The value is discarded if NoRegister.
+        virtual bool compileTo(CodeGenerator &gen, uint32_t dstReg, ErrorMessage* errMsg) const = 0;
+        // JP: 式の値を参照するオペランドを返す。変数と定数は複製せずに参照する。
+        // EN: returns an operand referring to the value of the expression. Variables and constants are referred to without copying.
+        virtual bool compileOperand(CodeGenerator &gen, uint32_t* operand, ErrorMessage* errMsg) const;
+        // JP: 定数の場合に値を返す。
+        // EN: returns the value if constant.
+        virtual bool getConstant(Element* value) const { return false; }
+        
+        bool compile(CodeGenerator &gen, ErrorMessage* errMsg) const override;
     };
     
     class Term : public Expression {
@@ -458,7 +473,7 @@ namespace SLRSceneGraph {
     public:
         BlockStatement(const StatementsRef &statements);
         
-        bool perform(ExecuteContext &context, ErrorMessage* errMsg) override;
+        bool compile(CodeGenerator &gen, ErrorMessage* errMsg) const override;
     };
     
     class IfElseStatement : public Statement {
@@ -469,7 +484,7 @@ namespace SLRSceneGraph {
         IfElseStatement(const ExpressionRef &condExpr, const StatementRef &trueBlockStmt, const StatementRef &falseBlockStmt = nullptr) :
         m_condExpr(condExpr), m_trueBlockStmt(trueBlockStmt), m_falseBlockStmt(falseBlockStmt) { }
         
-        bool perform(ExecuteContext &context, ErrorMessage* errMsg) override;
+        bool compile(CodeGenerator &gen, ErrorMessage* errMsg) const override;
     };
     
     class ForStatement : public Statement {
@@ -481,7 +496,7 @@ namespace SLRSceneGraph {
         ForStatement(const ExpressionRef &preExpr, const ExpressionRef &condExpr, const ExpressionRef &postExpr, const StatementRef &blockStmt) :
         m_preExpr(preExpr), m_condExpr(condExpr), m_postExpr(postExpr), m_blockStmt(blockStmt) { }
         
-        bool perform(ExecuteContext &context, ErrorMessage* errMsg) override;
+        bool compile(CodeGenerator &gen, ErrorMessage* errMsg) const override;
     };
     
     class FunctionDefinitionStatement : public Statement {
@@ -492,7 +507,7 @@ namespace SLRSceneGraph {
         FunctionDefinitionStatement(const std::string &funcName, const ArgumentDefinitionVecRef &argDefs, const StatementRef &blockStmt) :
         m_funcName(funcName), m_argDefs(argDefs), m_blockStmt(blockStmt) { }
         
-        bool perform(ExecuteContext &context, ErrorMessage* errMsg) override;
+        bool compile(CodeGenerator &gen, ErrorMessage* errMsg) const override;
     };
     
     class ReturnStatement : public Statement {
@@ -500,7 +515,7 @@ namespace SLRSceneGraph {
     public:
         ReturnStatement(const ExpressionRef &expr = nullptr) : m_expr(expr) { }
         
-        bool perform(ExecuteContext &context, ErrorMessage* errMsg) override;
+        bool compile(CodeGenerator &gen, ErrorMessage* errMsg) const override;
     };
     
     class BinaryExpression : public Expression {
@@ -510,7 +525,7 @@ namespace SLRSceneGraph {
     public:
         BinaryExpression(const ExpressionRef &left, const std::string &op, const ExpressionRef &right) : m_left(left), m_op(op), m_right(right) { }
         
-        bool perform(ExecuteContext &context, ErrorMessage* errMsg) override;
+        bool compileTo(CodeGenerator &gen, uint32_t dstReg, ErrorMessage* errMsg) const override;
     };
     
     class SubstitutionExpression : public Expression {
@@ -521,7 +536,7 @@ namespace SLRSceneGraph {
         SubstitutionExpression(const std::string &varName, const std::string &op, const ExpressionRef &right) :
         m_varName(varName), m_op(op), m_right(right) { }
         
-        bool perform(ExecuteContext &context, ErrorMessage* errMsg) override;
+        bool compileTo(CodeGenerator &gen, uint32_t dstReg, ErrorMessage* errMsg) const override;
     };
     
     class UnaryTerm : public Term {
@@ -530,7 +545,7 @@ namespace SLRSceneGraph {
     public:
         UnaryTerm(const std::string &op, const TermRef &term) : m_op(op), m_term(term) { }
         
-        bool perform(ExecuteContext &context, ErrorMessage* errMsg) override;
+        bool compileTo(CodeGenerator &gen, uint32_t dstReg, ErrorMessage* errMsg) const override;
     };
     
     class UnarySubstitutionTerm : public Term {
@@ -539,7 +554,7 @@ namespace SLRSceneGraph {
     public:
         UnarySubstitutionTerm(const std::string &op, const std::string &varName) : m_op(op), m_varName(varName) { }
         
-        bool perform(ExecuteContext &context, ErrorMessage* errMsg) override;
+        bool compileTo(CodeGenerator &gen, uint32_t dstReg, ErrorMessage* errMsg) const override;
     };
     
     class BinaryTerm : public Term {
@@ -549,7 +564,7 @@ namespace SLRSceneGraph {
     public:
         BinaryTerm(const TermRef &left, const std::string &op, const TermRef &right) : m_left(left), m_op(op), m_right(right) { }
         
-        bool perform(ExecuteContext &context, ErrorMessage* errMsg) override;
+        bool compileTo(CodeGenerator &gen, uint32_t dstReg, ErrorMessage* errMsg) const override;
     };
     
     class FunctionCallSingleTerm : public SingleTerm {
@@ -558,7 +573,7 @@ namespace SLRSceneGraph {
     public:
         FunctionCallSingleTerm(const std::string &funcID, const ParameterVecRef &args) : m_funcID(funcID), m_args(args) { }
         
-        bool perform(ExecuteContext &context, ErrorMessage* errMsg) override;
+        bool compileTo(CodeGenerator &gen, uint32_t dstReg, ErrorMessage* errMsg) const override;
     };
     
     class EnclosedSingleTerm : public SingleTerm {
@@ -566,7 +581,9 @@ namespace SLRSceneGraph {
     public:
         EnclosedSingleTerm(const ExpressionRef &expr) : m_expr(expr) { }
         
-        bool perform(ExecuteContext &context, ErrorMessage* errMsg) override;
+        bool compileTo(CodeGenerator &gen, uint32_t dstReg, ErrorMessage* errMsg) const override;
+        bool compileOperand(CodeGenerator &gen, uint32_t* operand, ErrorMessage* errMsg) const override;
+        bool getConstant(Element* value) const override { return m_expr->getConstant(value); }
     };
     
     class TupleElementSingleTerm : public SingleTerm {
@@ -575,14 +592,17 @@ namespace SLRSceneGraph {
     public:
         TupleElementSingleTerm(const SingleTermRef &tuple, const ExpressionRef &idxExpr) : m_tuple(tuple), m_idxExpr(idxExpr) { }
         
-        bool perform(ExecuteContext &context, ErrorMessage* errMsg) override;
+        bool compileTo(CodeGenerator &gen, uint32_t dstReg, ErrorMessage* errMsg) const override;
     };
     
     class ImmediateValue : public Value {
+        Element m_value;
     public:
-        ImmediateValue(const Element &value) { m_result = value; }
+        ImmediateValue(const Element &value) : m_value(value) { }
         
-        bool perform(ExecuteContext &context, ErrorMessage* errMsg) override { return true; }
+        bool compileTo(CodeGenerator &gen, uint32_t dstReg, ErrorMessage* errMsg) const override;
+        bool compileOperand(CodeGenerator &gen, uint32_t* operand, ErrorMessage* errMsg) const override;
+        bool getConstant(Element* value) const override { *value = m_value; return true; }
     };
     
     class TupleValue : public Value {
@@ -590,7 +610,7 @@ namespace SLRSceneGraph {
     public:
         TupleValue(const ParameterVecRef &elements) : m_elements(elements) { }
         
-        bool perform(ExecuteContext &context, ErrorMessage* errMsg) override;
+        bool compileTo(CodeGenerator &gen, uint32_t dstReg, ErrorMessage* errMsg) const override;
     };
     
     class VariableValue : public Value {
@@ -598,7 +618,8 @@ namespace SLRSceneGraph {
     public:
         VariableValue(const std::string &varName) : m_varName(varName) { }
         
-        bool perform(ExecuteContext &context, ErrorMessage* errMsg) override;
+        bool compileTo(CodeGenerator &gen, uint32_t dstReg, ErrorMessage* errMsg) const override;
+        bool compileOperand(CodeGenerator &gen, uint32_t* operand, ErrorMessage* errMsg) const override;
     };
     
     class ArgumentDefinition {
@@ -607,8 +628,8 @@ namespace SLRSceneGraph {
     public:
         ArgumentDefinition(const std::string &name, const ExpressionRef &defaultValueExpr = nullptr) : m_name(name), m_defaultValueExpr(defaultValueExpr) { }
         
-        bool perform(ExecuteContext &context, ErrorMessage* errMsg);
-        void getArgInfo(ArgInfo* info) const;
+        const std::string &name() const { return m_name; }
+        const ExpressionRef &defaultValueExpression() const { return m_defaultValueExpr; }
     };
     
     class Parameter {
@@ -617,8 +638,8 @@ namespace SLRSceneGraph {
     public:
         Parameter(const ExpressionRef &keyExpr, const ExpressionRef &valueExpr) : m_keyExpr(keyExpr), m_valueExpr(valueExpr) { }
         
-        bool perform(ExecuteContext &context, ErrorMessage* errMsg);
-        void getKeyAndValue(Element* key, Element* value) const;
+        const ExpressionRef &keyExpression() const { return m_keyExpr; }
+        const ExpressionRef &valueExpression() const { return m_valueExpr; }
     };
 }
 
@@ -0,0 +1,81 @@
+//
+//  ScanAccelerator.cpp
+//
+//  Created by 渡部 心 on 2017/07/02.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#include "ScanAccelerator.h"
+
+#include <libSLR/MemoryAllocators/ArenaAllocator.h>
+#include <libSLR/Core/surface_object.h>
+#include <libSLR/Scene/node.h>
+#include <libSLR/Helper/ThreadPool.h>
+#include "node.h"
+
+namespace SLRSceneGraph {
+    ScanAccelerator::ScanAccelerator(const NodeRef &node) :
+    m_node(node), m_revision(node->subtreeRevision()), m_mem(new SLR::ArenaAllocator()) {
+        m_node->prepareForRendering();
+        SLR::RenderingData renderingData(nullptr);
+        m_node->getRaw()->createRenderingData(m_mem.get(), nullptr, &renderingData);
+        m_aggregate = createUnique<SLR::SurfaceObjectAggregate>(renderingData.surfObjs);
+    }
+    
+    ScanAccelerator::~ScanAccelerator() {
+        m_aggregate = nullptr;
+        m_node->getRaw()->destroyRenderingData(m_mem.get());
+    }
+    
+    bool ScanAccelerator::isUpToDate(const NodeRef &node) const {
+        return node == m_node && node->subtreeRevision() == m_revision;
+    }
+    
+    SLR::BoundingBox3D ScanAccelerator::bounds() const {
+        return m_aggregate->bounds();
+    }
+    
+    void ScanAccelerator::intersect(const SLR::Ray* rays, uint32_t numRays, SLR::SurfacePoint* surfPts, bool* hits) const {
+        const uint32_t PacketSize = 32;
+        const uint32_t NumPacketsPerJob = 32;
+        
+        auto intersectRange = [=](uint32_t rayBegin, uint32_t rayEnd) {
+            SLR::RaySegment segments[PacketSize];
+            SLR::SurfaceInteraction sis[PacketSize];
+            for (uint32_t base = rayBegin; base < rayEnd; base += PacketSize) {
+                uint32_t numPacketRays = std::min(rayEnd - base, PacketSize);
+                for (uint32_t i = 0; i < numPacketRays; ++i) {
+                    segments[i] = SLR::RaySegment();
+                    sis[i] = SLR::SurfaceInteraction();
+                }
+                uint32_t activeMask = numPacketRays == 32 ? 0xFFFFFFFF : ((1u << numPacketRays) - 1);
+                uint32_t hitMask = m_aggregate->intersectPacket(rays + base, segments, sis, activeMask);
+                for (uint32_t i = 0; i < numPacketRays; ++i) {
+                    hits[base + i] = ((hitMask >> i) & 0x1) != 0;
+                    if (hits[base + i])
+                        sis[i].calculateSurfacePoint(&surfPts[base + i]);
+                }
+            }
+        };
+        
+        const uint32_t NumRaysPerJob = PacketSize * NumPacketsPerJob;
+        uint32_t numJobs = (numRays + NumRaysPerJob - 1) / NumRaysPerJob;
+        uint32_t numThreads = std::min(std::max(std::thread::hardware_concurrency(), 1u), numJobs);
+        if (numThreads <= 1) {
+            intersectRange(0, numRays);
+            return;
+        }
+        
+        ThreadPool threadPool(numThreads);
+        for (uint32_t i = 0; i < numJobs; ++i) {
+            uint32_t rayBegin = i * NumRaysPerJob;
+            uint32_t rayEnd = std::min(rayBegin + NumRaysPerJob, numRays);
+            threadPool.enqueue([=](uint32_t threadID) { intersectRange(rayBegin, rayEnd); });
+        }
+        threadPool.wait();
+    }
+    
+    void ScanAccelerator::intersectBatch(const SLR::RayBatch &rays, const SLR::RayBatchHits &hits) const {
+        m_aggregate->intersectBatch(rays, hits);
+    }
+}
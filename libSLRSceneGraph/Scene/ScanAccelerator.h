@@ -0,0 +1,42 @@
+//
+//  ScanAccelerator.h
+//
+//  Created by 渡部 心 on 2017/07/02.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#ifndef __SLRSceneGraph_ScanAccelerator__
+#define __SLRSceneGraph_ScanAccelerator__
+
+#include <libSLR/defines.h>
+#include <libSLR/Core/geometry.h>
+#include "../declarations.h"
+
+namespace SLRSceneGraph {
+    // JP: スクリプトからノードの形状を走査するための加速構造。
+    //     ノードのレンダリング用データを作って集約を構築し、ノード以下が変更されるかシーンがレンダリングの準備をするまで保持する。
+    // EN: an accelerator for scanning a node's geometry from a script.
+    //     This creates the node's rendering data, builds an aggregate,
+    //     and keeps them until the node or below is modified or the scene prepares for rendering.
+    class SLR_SCENEGRAPH_API ScanAccelerator {
+        NodeRef m_node;
+        uint64_t m_revision;
+        std::unique_ptr<SLR::ArenaAllocator> m_mem;
+        std::unique_ptr<SLR::SurfaceObjectAggregate> m_aggregate;
+    public:
+        ScanAccelerator(const NodeRef &node);
+        ~ScanAccelerator();
+        
+        bool isUpToDate(const NodeRef &node) const;
+        SLR::BoundingBox3D bounds() const;
+        
+        // JP: 光線を32本ずつのパケットに分け、複数のスレッドで交差判定する。交差しなかった光線のhitsはfalseになる。
+        // EN: split rays into packets of 32 rays and test intersections with multiple threads. hits is false for rays without intersection.
+        void intersect(const SLR::Ray* rays, uint32_t numRays, SLR::SurfacePoint* surfPts, bool* hits) const;
+        // JP: SoAで与えた光線をまとめて交差判定し、距離、プリミティブ番号、幾何法線を返す。
+        // EN: intersect rays given as SoA at once, and return distances, primitive IDs and geometric normals.
+        void intersectBatch(const SLR::RayBatch &rays, const SLR::RayBatchHits &hits) const;
+    };
+}
+
+#endif /* __SLRSceneGraph_ScanAccelerator__ */
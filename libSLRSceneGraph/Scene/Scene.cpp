@@ -11,6 +11,7 @@
 #include <libSLR/Core/renderer.h>
 #include <libSLR/Scene/Scene.h>
 #include "node.h"
+#include "ScanAccelerator.h"
 
 namespace SLRSceneGraph {
     Scene::Scene() : m_envNode(nullptr) {
@@ -28,7 +29,20 @@ namespace SLRSceneGraph {
         m_raw->setEnvironmentNode((SLR::InfiniteSphereNode*)node->getRaw());
     }
     
+    const ScanAccelerator &Scene::getScanAccelerator(const NodeRef &node) {
+        if (m_scanAccelerator && m_scanAccelerator->isUpToDate(node))
+            return *m_scanAccelerator;
+        // JP: 他のノードの走査でレンダリング用データが作り直される前に、古い加速構造を破棄する。
+        // EN: destroy the old accelerator before scanning another node recreates the rendering data.
+        m_scanAccelerator = nullptr;
+        m_scanAccelerator = createUnique<ScanAccelerator>(node);
+        return *m_scanAccelerator;
+    }
+    
     void Scene::prepareForRendering() {
+        // JP: レンダリングの準備でノードのレンダリング用データが作り直されるため、走査用の加速構造を先に破棄する。
+        // EN: destroy the accelerator for scanning first since preparing for rendering recreates the rendering data of nodes.
+        m_scanAccelerator = nullptr;
         m_rootNode->prepareForRendering();
         if (m_envNode)
             m_envNode->prepareForRendering();
@@ -36,7 +50,8 @@ namespace SLRSceneGraph {
     
     
     
-    RenderingContext::RenderingContext() {
+    RenderingContext::RenderingContext() :
+    timeLimit(0.0f), targetNoise(0.0f), checkpointInterval(0.0f), exportInterval(0), exportTimeInterval(0.0f) {
         
     }
     
@@ -52,6 +67,13 @@ namespace SLRSceneGraph {
         timeEnd = ctx.timeEnd;
         brightness = ctx.brightness;
         rngSeed = ctx.rngSeed;
+        timeLimit = ctx.timeLimit;
+        targetNoise = ctx.targetNoise;
+        checkpointPath = ctx.checkpointPath;
+        checkpointInterval = ctx.checkpointInterval;
+        resumePath = ctx.resumePath;
+        exportInterval = ctx.exportInterval;
+        exportTimeInterval = ctx.exportTimeInterval;
         
         return *this;
     }
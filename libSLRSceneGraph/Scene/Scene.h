@@ -16,6 +16,9 @@ namespace SLRSceneGraph {
         SLR::Scene* m_raw;
         InternalNodeRef m_rootNode;
         InfiniteSphereNodeRef m_envNode;
+        // JP: 直前に走査したノードの加速構造。同じノードを繰り返し走査する間は再構築しない。
+        // EN: the accelerator of the most recently scanned node. It is not rebuilt while the same node is scanned repeatedly.
+        std::unique_ptr<ScanAccelerator> m_scanAccelerator;
     public:
         Scene();
         ~Scene();
@@ -25,6 +28,8 @@ namespace SLRSceneGraph {
         }
         void setEnvironmentNode(const InfiniteSphereNodeRef &node);
         
+        const ScanAccelerator &getScanAccelerator(const NodeRef &node);
+        
         void prepareForRendering();
         SLR::Scene* getRaw() const { return m_raw; }
     };
@@ -37,6 +42,13 @@ namespace SLRSceneGraph {
         float timeEnd;
         float brightness;
         int32_t rngSeed;
+        float timeLimit;
+        float targetNoise;
+        std::string checkpointPath;
+        float checkpointInterval;
+        std::string resumePath;
+        int32_t exportInterval;
+        float exportTimeInterval;
         
         RenderingContext();
         ~RenderingContext();
@@ -9,6 +9,7 @@
 
 #include <libSLR/Core/transform.h>
 #include <libSLR/Core/surface_object.h>
+#include <libSLR/Core/MeshCache.h>
 #include <libSLR/SurfaceShape/TriangleSurfaceShape.h>
 #include <libSLR/Scene/TriangleMeshNode.h>
 #include "../textures.h"
@@ -21,16 +22,17 @@ namespace SLRSceneGraph {
     }
     
     void TriangleMeshNode::setupRawData() {
-        new (m_rawData) SLR::TriangleMeshNode((uint32_t)m_vertices.size(), (uint32_t)m_matGroups.size(), m_onlyForBoundary, m_axisForRadialTangent);
+        if (m_meshCache)
+            new (m_rawData) SLR::TriangleMeshNode(m_meshCache, m_meshCacheIndex, m_onlyForBoundary, m_axisForRadialTangent);
+        else
+            new (m_rawData) SLR::TriangleMeshNode((uint32_t)m_vertices.size(), (uint32_t)m_matGroups.size(), m_onlyForBoundary, m_axisForRadialTangent);
         
         SLR::TriangleMeshNode &raw = *(SLR::TriangleMeshNode*)getRaw();
         
-        uint32_t numVertices = (uint32_t)m_vertices.size();
-        SLR::Vertex* vertices = raw.getVertexArray();
-        for (int i = 0; i < numVertices; ++i) {
-            SLR::Vertex &vertex = vertices[i];
-            const Vertex &srcVtx = m_vertices[i];
-            vertex = SLR::Vertex(srcVtx.position, srcVtx.normal, srcVtx.tangent, srcVtx.texCoord);
+        if (!m_meshCache) {
+            uint32_t numVertices = (uint32_t)m_vertices.size();
+            for (int i = 0; i < numVertices; ++i)
+                raw.setVertex(i, m_vertices[i]);
         }
         
         uint32_t numMatGroups = (uint32_t)m_matGroups.size();
@@ -41,18 +43,18 @@ namespace SLRSceneGraph {
             matGroup.material = srcMatGroup.material->getRaw();
             matGroup.normalMap = srcMatGroup.normalMap ? srcMatGroup.normalMap->getRaw() : nullptr;
             matGroup.alphaMap = srcMatGroup.alphaMap ? srcMatGroup.alphaMap->getRaw() : nullptr;
+            if (m_meshCache)
+                continue;
             
             uint32_t numTriangles = (uint32_t)srcMatGroup.triangles.size();
-            SLR::Vertex** vertexReferences = new SLR::Vertex*[3 * numTriangles];
+            std::unique_ptr<uint32_t[]> indices(new uint32_t[3 * numTriangles]);
             for (int j = 0; j < numTriangles; ++j) {
                 const Triangle &srcTri = srcMatGroup.triangles[j];
-                vertexReferences[3 * j + 0] = &vertices[srcTri.vIdx[0]];
-                vertexReferences[3 * j + 1] = &vertices[srcTri.vIdx[1]];
-                vertexReferences[3 * j + 2] = &vertices[srcTri.vIdx[2]];
+                indices[3 * j + 0] = (uint32_t)srcTri.vIdx[0];
+                indices[3 * j + 1] = (uint32_t)srcTri.vIdx[1];
+                indices[3 * j + 2] = (uint32_t)srcTri.vIdx[2];
             }
-            
-            std::unique_ptr<SLR::Vertex*[]> vertexReferencesHolder(vertexReferences);
-            matGroup.setTriangles(vertexReferencesHolder, numTriangles);
+            matGroup.setTriangles(indices, numTriangles);
         }
         
         if (m_enclosedMediumNode) {
@@ -70,23 +72,41 @@ namespace SLRSceneGraph {
         m_setup = false;
     }
     
-    TriangleMeshNode::TriangleMeshNode() : m_onlyForBoundary(false) {
+    void TriangleMeshNode::detachMeshCache() {
+        if (!m_meshCache)
+            return;
+        const SLR::MeshCache::Mesh &mesh = m_meshCache->mesh(m_meshCacheIndex);
+        m_vertices.resize(mesh.numVertices);
+        for (int i = 0; i < mesh.numVertices; ++i)
+            m_vertices[i] = Vertex(mesh.positions[i], mesh.normals[i], mesh.tangents[i], mesh.texCoords[i]);
+        std::vector<Triangle> &triangles = m_matGroups[0].triangles;
+        triangles.resize(mesh.numTriangles);
+        for (int i = 0; i < mesh.numTriangles; ++i)
+            triangles[i] = Triangle(mesh.indices[3 * i + 0], mesh.indices[3 * i + 1], mesh.indices[3 * i + 2]);
+        m_meshCache = nullptr;
+    }
+    
+    TriangleMeshNode::TriangleMeshNode() : m_onlyForBoundary(false), m_meshCacheIndex(0) {
         allocateRawData();
     }
 
     uint64_t TriangleMeshNode::addVertex(const SLR::Vertex &v) {
+        detachMeshCache();
         m_vertices.push_back(v);
+        markModified();
         return m_vertices.size() - 1;
     }
     
     void TriangleMeshNode::addMaterialGroup(const SurfaceMaterialRef &mat, const NormalTextureRef &normalMap, const FloatTextureRef &alphaMap,
                                             const std::vector<Triangle> &&triangles) {
+        detachMeshCache();
         m_matGroups.emplace_back();
         MaterialGroup &matGroup = m_matGroups.back();
         matGroup.material = mat;
         matGroup.normalMap = normalMap;
         matGroup.alphaMap = alphaMap;
         matGroup.triangles = triangles;
+        markModified();
         
         for (int i = 0; i < matGroup.triangles.size(); ++i) {
             const Triangle &tri = matGroup.triangles[i];
@@ -103,20 +123,38 @@ namespace SLRSceneGraph {
         }
     }
     
+    void TriangleMeshNode::setMeshCache(const std::shared_ptr<const SLR::MeshCache> &meshCache, uint32_t meshIndex,
+                                        const SurfaceMaterialRef &mat, const NormalTextureRef &normalMap, const FloatTextureRef &alphaMap) {
+        m_vertices.clear();
+        m_matGroups.clear();
+        m_matGroups.emplace_back();
+        MaterialGroup &matGroup = m_matGroups.back();
+        matGroup.material = mat;
+        matGroup.normalMap = normalMap;
+        matGroup.alphaMap = alphaMap;
+        m_meshCache = meshCache;
+        m_meshCacheIndex = meshIndex;
+        markModified();
+    }
+    
     NodeRef TriangleMeshNode::copy() const {
         TriangleMeshNodeRef ret = createShared<TriangleMeshNode>();
         ret->m_vertices = m_vertices;
         ret->m_matGroups = m_matGroups;
+        ret->m_meshCache = m_meshCache;
+        ret->m_meshCacheIndex = m_meshCacheIndex;
         return ret;
     }
     
     void TriangleMeshNode::applyTransform(const SLR::StaticTransform &t) {
+        detachMeshCache();
         for (int i = 0; i < m_vertices.size(); ++i) {
             Vertex &v = m_vertices[i];
             v.position = t * v.position;
             v.normal = normalize(t * v.normal);
             v.tangent = normalize(t * v.tangent);
         }
+        markModified();
     }
     
     void TriangleMeshNode::prepareForRendering() {
@@ -37,6 +37,14 @@ namespace SLRSceneGraph {
         std::vector<MaterialGroup> m_matGroups;
         bool m_onlyForBoundary;
         int8_t m_axisForRadialTangent; // -1: don't use radial tangent, 0:X, 1:Y, 2:Z
+        // JP: メッシュキャッシュから読み込んだ場合、頂点と三角形はキャッシュ内のメッシュを参照し、m_verticesとm_matGroupsの三角形は空のままとする。
+        // EN: when loaded from a mesh cache, vertices and triangles reference the mesh in the cache, and m_vertices and triangles in m_matGroups are left empty.
+        std::shared_ptr<const SLR::MeshCache> m_meshCache;
+        uint32_t m_meshCacheIndex;
+        
+        // JP: 頂点を編集する前に、キャッシュ内のメッシュを自身の配列に複製する。
+        // EN: copy the mesh in the cache to the node's own arrays before editing vertices.
+        void detachMeshCache();
         
         void allocateRawData() override;
         void setupRawData() override;
@@ -47,11 +55,15 @@ namespace SLRSceneGraph {
         uint64_t addVertex(const SLR::Vertex &v);
         void addMaterialGroup(const SurfaceMaterialRef &mat, const NormalTextureRef &normalMap, const FloatTextureRef &alphaMap, 
                               const std::vector<Triangle> &&triangles);
+        void setMeshCache(const std::shared_ptr<const SLR::MeshCache> &meshCache, uint32_t meshIndex,
+                          const SurfaceMaterialRef &mat, const NormalTextureRef &normalMap, const FloatTextureRef &alphaMap);
         void useOnlyForBoundary(bool b) {
             m_onlyForBoundary = b;
+            markModified();
         }
         void setAxisForRadialTangent(int8_t axisForRadialTangent) {
             m_axisForRadialTangent = axisForRadialTangent;
+            markModified();
         }
         
         NodeRef copy() const override;
@@ -53,7 +53,7 @@ namespace SLRSceneGraph {
             return false;
         }
         if (node->isUniqueInTree()) {
-            if (contains(node)) {
+            if (node->m_numParents > 0 && contains(node)) {
                 printf("This node already has the given node.\n");
                 return false;
             }
@@ -67,6 +67,8 @@ namespace SLRSceneGraph {
             }
         }
         m_childNodes.push_back(node);
+        ++node->m_numParents;
+        markModified();
         return true;
     }
     
@@ -80,6 +82,7 @@ namespace SLRSceneGraph {
     
     void InternalNode::setTransform(const TransformRef &tf) {
         m_localToWorld = tf;
+        markModified();
     }
     
     const TransformRef InternalNode::getTransform() const {
@@ -98,12 +101,20 @@ namespace SLRSceneGraph {
         return m_childNodes.size() > 0;
     }
     
+    uint64_t InternalNode::subtreeRevision() const {
+        uint64_t revision = m_revision;
+        for (int i = 0; i < m_childNodes.size(); ++i)
+            revision += m_childNodes[i]->subtreeRevision();
+        return revision;
+    }
+    
     NodeRef InternalNode::copy() const {
         InternalNodeRef ret = createShared<InternalNode>(m_localToWorld);
         ret->m_name = m_name;
         for (int i = 0; i < m_childNodes.size(); ++i) {
             NodeRef c = m_childNodes[i]->copy();
             ret->m_childNodes.push_back(c);
+            ++c->m_numParents;
         }
         ret->setupRawData();
         return ret;
@@ -126,6 +137,7 @@ namespace SLRSceneGraph {
             for (int i = 0; i < m_childNodes.size(); ++i)
                 m_childNodes[i]->applyTransform(*(SLR::StaticTransform*)tf.get());
             m_localToWorld = createShared<SLR::StaticTransform>(SLR::Matrix4x4::Identity);
+            markModified();
         }
         else {
             SLRAssert(false, "Non static transform cannot be applied.");
@@ -14,16 +14,25 @@
 
 namespace SLRSceneGraph {    
     class SLR_SCENEGRAPH_API Node {
+        // JP: このノードを子に持つ中間ノードの数。親を持たないノードは木に含まれないため、重複の確認を省ける。
+        // EN: the number of internal nodes having this node as a child. A node without parents is not in any tree, so the duplication check can be skipped.
+        uint32_t m_numParents;
+        friend class InternalNode;
     protected:
         SLR::Node* m_rawData;
         bool m_setup;
         std::string m_name;
+        // JP: ノードの内容を変更するたびに増える値。走査用の加速構造が古くなったかの判定に使う。
+        // EN: a value incremented each time the node's contents are modified. Used to determine whether an accelerator for scanning is outdated.
+        uint32_t m_revision;
+        
+        void markModified() { ++m_revision; }
         
         virtual void allocateRawData() = 0;
         virtual void setupRawData() = 0;
         virtual void terminateRawData() = 0;
     public:
-        Node() : m_rawData(nullptr), m_setup(false) { }
+        Node() : m_numParents(0), m_rawData(nullptr), m_setup(false), m_revision(0) { }
         virtual ~Node();
 
         SLR::Node* getRaw() const {
@@ -37,6 +46,9 @@ namespace SLRSceneGraph {
         virtual bool contains(const NodeRef &obj) const { return this == obj.get(); }
         virtual bool hasChildren() const { return false; }
         virtual NodeRef copy() const = 0;
+        // JP: このノード以下の変更回数の合計。値が変わっていなければ部分木は変更されていない。
+        // EN: the total modification count of this node and below. The subtree has not been modified if the value is unchanged.
+        virtual uint64_t subtreeRevision() const { return m_revision; }
         
         virtual void applyTransform(const SLR::StaticTransform &tf) { SLRAssert_NotImplemented(); }
         virtual void applyTransformToLeaf(const SLR::StaticTransform &tf) { SLRAssert_NotImplemented(); }
@@ -66,6 +78,7 @@ namespace SLRSceneGraph {
         bool contains(const NodeRef &obj) const override;
         bool hasChildren() const override;
         NodeRef copy() const override;
+        uint64_t subtreeRevision() const override;
 
         void applyTransform(const SLR::StaticTransform &tf) override;
         void applyTransformToLeaf(const SLR::StaticTransform &tf) override;
@@ -89,6 +102,7 @@ namespace SLRSceneGraph {
         bool isUniqueInTree() const override { return false; }
         
         NodeRef copy() const override;
+        uint64_t subtreeRevision() const override { return m_revision + m_node->subtreeRevision(); }
         
         void prepareForRendering() override;
     };
@@ -101,6 +115,7 @@ namespace SLRSceneGraph {
     public:
         void setInternalMedium(const MediumNodeRef &medium) {
             m_enclosedMediumNode = medium;
+            markModified();
         }
     };
     
@@ -0,0 +1,39 @@
+//
+//  asset_loader.cpp
+//
+//  Created by 渡部 心 on 2017/06/30.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#include "asset_loader.h"
+#include <libSLR/Helper/ThreadPool.h>
+
+namespace SLRSceneGraph {
+    SLR_SCENEGRAPH_API void enqueueAssetLoad(const std::function<void()> &task) {
+        // JP: 読み込みはI/O待ちを含むため、コア数が少ない場合でも複数のスレッドを用意する。
+        //     終了時にワーカーの終了を待たないよう、プールは意図的に破棄しない。
+        // EN: prepare multiple threads even when the number of cores is small since loading includes waiting for I/O.
+        //     The pool is intentionally not destroyed so as not to wait for the workers at exit.
+        static ThreadPool* s_pool = new ThreadPool(std::max(std::thread::hardware_concurrency(), 4u));
+        s_pool->enqueue([task](uint32_t threadID) {
+            task();
+        });
+    }
+    
+    static ThreadPool* getConversionPool() {
+        // JP: 読み込みが並列に走っていてもスレッド数がコア数を超えないよう、変換は1つのプールで行う。
+        // EN: conversions run on one pool so that the number of threads does not exceed the number of cores even with parallel loads.
+        static ThreadPool* s_pool = new ThreadPool();
+        return s_pool;
+    }
+    
+    SLR_SCENEGRAPH_API void enqueueAssetConversion(const std::function<void()> &task) {
+        getConversionPool()->enqueue([task](uint32_t threadID) {
+            task();
+        });
+    }
+    
+    SLR_SCENEGRAPH_API uint32_t numAssetConversionThreads() {
+        return getConversionPool()->numThreads();
+    }
+}
@@ -0,0 +1,40 @@
+//
+//  asset_loader.h
+//
+//  Created by 渡部 心 on 2017/06/30.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#ifndef __SLRSceneGraph_asset_loader__
+#define __SLRSceneGraph_asset_loader__
+
+#include <libSLR/defines.h>
+#include "declarations.h"
+#include <future>
+
+namespace SLRSceneGraph {
+    // JP: ファイルの読み込みとデコードを行う共有スレッドプールにタスクを投入する。
+    //     タスクはシーングラフやスクリプトの状態に触れてはならない。
+    // EN: submits a task to the shared thread pool which reads and decodes files.
+    //     A task must not touch the state of the scene graph or the script.
+    SLR_SCENEGRAPH_API void enqueueAssetLoad(const std::function<void()> &task);
+    
+    // JP: 読み込みタスクが完了を待つ計算主体の処理を、全ての読み込みで共有するスレッドプールに投入する。
+    //     読み込み用とは別のプールなので、読み込みタスクがここに投入した処理を待っても詰まらない。
+    // EN: submits compute-bound work which a loading task waits for to the thread pool shared by all loads.
+    //     This pool is separate from the loading one, so a loading task waiting for work submitted here never deadlocks.
+    SLR_SCENEGRAPH_API void enqueueAssetConversion(const std::function<void()> &task);
+    SLR_SCENEGRAPH_API uint32_t numAssetConversionThreads();
+    
+    template <typename T>
+    std::future<T> loadAssetAsync(const std::function<T()> &task) {
+        std::shared_ptr<std::packaged_task<T()>> packagedTask = createShared<std::packaged_task<T()>>(task);
+        std::future<T> ret = packagedTask->get_future();
+        enqueueAssetLoad([packagedTask]() {
+            (*packagedTask)();
+        });
+        return ret;
+    }
+}
+
+#endif /* __SLRSceneGraph_asset_loader__ */
@@ -49,8 +49,11 @@ namespace SLRSceneGraph {
     class Function;
     struct TypeInfo;
     
-    class LocalVariables;
+    class GlobalVariables;
     struct ExecuteContext;
+    struct FunctionPrototype;
+    typedef std::shared_ptr<FunctionPrototype> FunctionPrototypeRef;
+    class CodeGenerator;
     
     
     
@@ -113,6 +116,7 @@ namespace SLRSceneGraph {
     typedef std::shared_ptr<InfiniteSphereNode> InfiniteSphereNodeRef;
     typedef std::shared_ptr<TriangleMeshNode> TriangleMeshNodeRef;
     
+    class ScanAccelerator;
     class Scene;
     typedef std::shared_ptr<Scene> SceneRef;
     typedef std::weak_ptr<Scene> SceneWRef;
@@ -8,12 +8,34 @@
 #include "images.h"
 
 #include <libSLR/Core/image_2d.h>
+#include <libSLR/Core/TextureCache.h>
+#include <libSLR/Core/BVHCache.h>
 
 #include "Helper/image_loader.h"
+#include "asset_loader.h"
+#include <mutex>
+#include <condition_variable>
+
+#include <sys/stat.h>
 
 namespace SLRSceneGraph {
     std::map<Image2DLoadParams, Image2DRef> s_imageDB;
     
+    // JP: 元の画像の大きさと更新時刻、読み込み方をキーに含め、いずれかが変わると別のキャッシュを用いる。
+    // EN: include the size and the modification time of the source image and the way to load in the key, so that another cache is used if any of them changes.
+    static std::string textureCachePath(const std::string &filePath, SLR::ImageStoreMode storeMode, SLR::SpectrumType spectrumType, bool gammaCorrection) {
+        struct stat st;
+        if (stat(filePath.c_str(), &st) != 0)
+            return "";
+        uint64_t values[] = {
+            SLR::PagedImage2D::Version, (uint64_t)st.st_size, (uint64_t)st.st_mtime,
+            (uint64_t)storeMode, (uint64_t)spectrumType, (uint64_t)gammaCorrection
+        };
+        uint64_t key = SLR::hashFNV1a64(values, sizeof(values));
+        key = SLR::hashFNV1a64(filePath.data(), filePath.size(), key);
+        return SLR::TextureCache::cachePath(key);
+    }
+    
     SLR_SCENEGRAPH_API Image2DRef createImage2D(const std::string &filepath, SLR::ImageStoreMode mode, SLR::SpectrumType spType, bool gammaCorrection) {
         Image2DLoadParams params{filepath, mode, spType, gammaCorrection};
         if (s_imageDB.count(params) > 0) {
@@ -36,22 +58,96 @@ namespace SLRSceneGraph {
     
     TiledImage2D::TiledImage2D(const std::string &filePath, SLR::ImageStoreMode storeMode, SLR::SpectrumType spectrumType, bool gammaCorrection) : 
     m_filePath(filePath), m_storeMode(storeMode), m_spectrumType(spectrumType), m_gammaCorrection(gammaCorrection) {
-        uint64_t requiredSize;
-        bool imgSuccess;
-        uint32_t width, height;
-        ::ColorFormat colorFormat;
-        imgSuccess = getImageInfo(m_filePath, &width, &height, &requiredSize, &colorFormat);
-        SLRAssert(imgSuccess, "Error occured during getting image information.\n%s", m_filePath.c_str());
-        
-        void* linearData = malloc(requiredSize);
-        imgSuccess = loadImage(m_filePath, (uint8_t*)linearData, m_gammaCorrection);
-        SLRAssert(imgSuccess, "failed to load the image\n%s", m_filePath.c_str());
-        
-        SLR::ColorFormat internalFormat = (SLR::ColorFormat)colorFormat;
-        
-        // TODO: ?? make a memory allocator selectable.
-        SLR::DefaultAllocator &defMem = SLR::DefaultAllocator::instance();
-        m_rawData = new SLR::TiledImage2D(linearData, width, height, internalFormat, &defMem, storeMode, spectrumType);
-        free(linearData);
+        m_loading = loadAssetAsync<SLR::Image2D*>([filePath, storeMode, spectrumType, gammaCorrection]() -> SLR::Image2D* {
+            uint64_t requiredSize;
+            bool imgSuccess;
+            uint32_t width, height;
+            ::ColorFormat colorFormat;
+            imgSuccess = getImageInfo(filePath, &width, &height, &requiredSize, &colorFormat);
+            SLRAssert(imgSuccess, "Error occured during getting image information.\n%s", filePath.c_str());
+            
+            SLR::ColorFormat internalFormat = (SLR::ColorFormat)colorFormat;
+            
+            // JP: 大きな画像はテクスチャーキャッシュに変換済みであれば、デコードせずにタイル状のファイルを開く。
+            // EN: open a tiled file without decoding for a large image if it has been converted into the texture cache.
+            std::string cachePath;
+            if (!SLR::TextureCache::directory().empty() && (uint64_t)width * height >= SLR::TextureCache::MinNumPixels) {
+                cachePath = textureCachePath(filePath, storeMode, spectrumType, gammaCorrection);
+                if (!cachePath.empty()) {
+                    if (SLR::PagedImage2D* pagedImage = SLR::PagedImage2D::open(cachePath))
+                        return pagedImage;
+                }
+            }
+            
+            // TODO: ?? make a memory allocator selectable.
+            SLR::DefaultAllocator &defMem = SLR::DefaultAllocator::instance();
+            SLR::TiledImage2D* rawData = new SLR::TiledImage2D(width, height, internalFormat, &defMem, storeMode, spectrumType);
+            
+            // JP: デコードした行のまとまりを直接タイル状の配置に変換し、画像全体の線形な一時領域を作らない。
+            //     大きな画像では変換を別のスレッドで行って次のまとまりのデコードと重ね、
+            //     変換待ちのまとまりの数を制限して一時的なメモリーを抑える。
+            // EN: convert decoded chunks of rows directly into the tiled layout without making a linear temporary storage for the entire image.
+            //     For a large image, conversion is performed on other threads to overlap with decoding the next chunk,
+            //     and the number of chunks waiting for conversion is limited to keep temporary memory small.
+            //     The conversion threads are shared with other images loaded in parallel.
+            const uint32_t RowsPerChunk = 128;
+            const uint64_t MinNumPixelsForParallelConversion = 1024 * 1024;
+            if ((uint64_t)width * height >= MinNumPixelsForParallelConversion) {
+                const uint32_t maxNumChunksInFlight = numAssetConversionThreads() + 1;
+                uint32_t numChunksInFlight = 0;
+                std::mutex chunkMutex;
+                std::condition_variable chunkCondVar;
+                imgSuccess = loadImage(filePath, gammaCorrection, RowsPerChunk, [&](std::vector<uint8_t> &&rows, uint32_t yBegin, uint32_t numRows) {
+                    {
+                        std::unique_lock<std::mutex> lock(chunkMutex);
+                        chunkCondVar.wait(lock, [&]() { return numChunksInFlight < maxNumChunksInFlight; });
+                        ++numChunksInFlight;
+                    }
+                    std::shared_ptr<std::vector<uint8_t>> chunk = createShared<std::vector<uint8_t>>(std::move(rows));
+                    enqueueAssetConversion([&, chunk, yBegin, numRows]() {
+                        rawData->setRows(chunk->data(), yBegin, numRows);
+                        std::vector<uint8_t>().swap(*chunk);
+                        // JP: 待っているスレッドがこの関数を抜けて状態を破棄しうるので、ロックを持ったまま通知する。
+                        // EN: notify while holding the lock since the waiting thread can leave this function and destroy the state.
+                        std::lock_guard<std::mutex> lock(chunkMutex);
+                        --numChunksInFlight;
+                        chunkCondVar.notify_all();
+                    });
+                });
+                std::unique_lock<std::mutex> lock(chunkMutex);
+                chunkCondVar.wait(lock, [&]() { return numChunksInFlight == 0; });
+            }
+            else {
+                imgSuccess = loadImage(filePath, gammaCorrection, RowsPerChunk, [rawData](std::vector<uint8_t> &&rows, uint32_t yBegin, uint32_t numRows) {
+                    rawData->setRows(rows.data(), yBegin, numRows);
+                });
+            }
+            SLRAssert(imgSuccess, "failed to load the image\n%s", filePath.c_str());
+            
+            if (!cachePath.empty()) {
+                SLR::PagedImage2D* pagedImage = nullptr;
+                if (SLR::PagedImage2D::write(cachePath, *rawData))
+                    pagedImage = SLR::PagedImage2D::open(cachePath);
+                if (pagedImage) {
+                    printf("cached texture: %s -> %s\n", filePath.c_str(), cachePath.c_str());
+                    delete rawData;
+                    return pagedImage;
+                }
+                printf("Failed to write a texture cache: %s\n", cachePath.c_str());
+            }
+            
+            return rawData;
+        });
+    }
+    
+    TiledImage2D::~TiledImage2D() {
+        // JP: 使われなかった画像も読み込みの完了を待ってから破棄する。
+        // EN: wait for the completion of loading to destroy even an image which was not used.
+        if (m_loading.valid())
+            m_rawData = m_loading.get();
+    }
+    
+    void TiledImage2D::resolve() const {
+        m_rawData = m_loading.get();
     }
 }
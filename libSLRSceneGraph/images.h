@@ -12,6 +12,7 @@
 #include "declarations.h"
 
 #include <libSLR/Core/image_2d.h>
+#include <future>
 
 namespace SLRSceneGraph {
     struct Image2DLoadParams {
@@ -50,10 +51,17 @@ namespace SLRSceneGraph {
     
     class SLR_SCENEGRAPH_API Image2D {
     protected:
-        SLR::Image2D* m_rawData;
+        mutable SLR::Image2D* m_rawData;
+        
+        // JP: 画像の中身を遅れて用意する派生クラスは、最初にgetRaw()が呼ばれた時にこれでm_rawDataを設定する。
+        // EN: a derived class which prepares the image contents lately sets m_rawData by this when getRaw() is called first.
+        virtual void resolve() const { }
     public:
+        Image2D() : m_rawData(nullptr) { }
         virtual ~Image2D();
         const SLR::Image2D* getRaw() const {
+            if (!m_rawData)
+                resolve();
             return m_rawData;
         };
     };
@@ -65,8 +73,15 @@ namespace SLRSceneGraph {
         SLR::ImageStoreMode m_storeMode;
         SLR::SpectrumType m_spectrumType;
         bool m_gammaCorrection;
+        mutable std::future<SLR::Image2D*> m_loading;
+        
+        void resolve() const override;
     public:
+        // JP: ファイルの読み込みとデコードは共有スレッドプールで非同期に行い、getRaw()が最初に呼ばれた時に完了を待つ。
+        // EN: reading and decoding the file is performed asynchronously on the shared thread pool,
+        //     and getRaw() waits for its completion when called first.
         TiledImage2D(const std::string &filePath, SLR::ImageStoreMode storeMode, SLR::SpectrumType spectrumType, bool gammaCorrection);
+        ~TiledImage2D();
     };
 }
 
@@ -11,6 +11,7 @@
 #include <assimp/postprocess.h>
 #include <libSLR/MemoryAllocators/Allocator.h>
 #include <libSLR/Core/transform.h>
+#include <libSLR/Core/MeshCache.h>
 #include <libSLR/SurfaceShape/TriangleSurfaceShape.h>
 #include "images.h"
 #include "textures.h"
@@ -18,6 +19,10 @@
 #include "Scene/TriangleMeshNode.h"
 #include "API.h"
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <chrono>
+
 template <typename RealType>
 inline void makeTangent(RealType nx, RealType ny, RealType nz, RealType* s) {
     if (std::fabs(nx) > std::fabs(ny)) {
@@ -35,6 +40,23 @@ inline void makeTangent(RealType nx, RealType ny, RealType nz, RealType* s) {
 }
 
 namespace SLRSceneGraph {
+    static SLR::Vertex convertVertex(const aiMesh* mesh, uint32_t v) {
+        const aiVector3D &p = mesh->mVertices[v];
+        const aiVector3D &n = mesh->mNormals[v];
+        float tangent[3];
+        if (mesh->mTangents == nullptr)
+            makeTangent(n.x, n.y, n.z, tangent);
+        const aiVector3D &t = mesh->mTangents ? mesh->mTangents[v] : aiVector3D(tangent[0], tangent[1], tangent[2]);
+        const aiVector3D &uv = mesh->mNumUVComponents[0] > 0 ? mesh->mTextureCoords[0][v] : aiVector3D(0, 0, 0);
+        
+        SLR::Vertex outVtx{SLR::Point3D(p.x, p.y, p.z), SLR::Normal3D(n.x, n.y, n.z), SLR::Tangent3D(t.x, t.y, t.z), SLR::TexCoord2D(uv.x, uv.y)};
+        float dotNT = dot(outVtx.normal, outVtx.tangent);
+        if (std::fabs(dotNT) >= 0.01f)
+            outVtx.tangent = SLR::normalize(outVtx.tangent - dotNT * outVtx.normal);
+        //SLRAssert(absDot(outVtx.normal, outVtx.tangent) < 0.01f, "shading normal and tangent must be orthogonal: %g", absDot(outVtx.normal, outVtx.tangent));
+        return outVtx;
+    }
+    
     static void recursiveConstruct(const aiScene* objSrc, const aiNode* nodeSrc,
                                    const std::vector<SurfaceMaterialRef> &materials, const std::vector<NormalTextureRef> &normalMaps, const std::vector<FloatTextureRef> &alphaMaps,
                                    const MeshCallback &meshCallback, InternalNodeRef &nodeOut) {
@@ -67,22 +89,8 @@ namespace SLRSceneGraph {
             const NormalTextureRef &normalMap = normalMaps[mesh->mMaterialIndex];
             const FloatTextureRef &alphaMap = alphaMaps[mesh->mMaterialIndex];
             
-            for (int v = 0; v < mesh->mNumVertices; ++v) {
-                const aiVector3D &p = mesh->mVertices[v];
-                const aiVector3D &n = mesh->mNormals[v];
-                float tangent[3];
-                if (mesh->mTangents == nullptr)
-                    makeTangent(n.x, n.y, n.z, tangent);
-                const aiVector3D &t = mesh->mTangents ? mesh->mTangents[v] : aiVector3D(tangent[0], tangent[1], tangent[2]);
-                const aiVector3D &uv = mesh->mNumUVComponents[0] > 0 ? mesh->mTextureCoords[0][v] : aiVector3D(0, 0, 0);
-                
-                SLR::Vertex outVtx{SLR::Point3D(p.x, p.y, p.z), SLR::Normal3D(n.x, n.y, n.z), SLR::Tangent3D(t.x, t.y, t.z), SLR::TexCoord2D(uv.x, uv.y)};
-                float dotNT = dot(outVtx.normal, outVtx.tangent);
-                if (std::fabs(dotNT) >= 0.01f)
-                    outVtx.tangent = SLR::normalize(outVtx.tangent - dotNT * outVtx.normal);
-                //SLRAssert(absDot(outVtx.normal, outVtx.tangent) < 0.01f, "shading normal and tangent must be orthogonal: %g", absDot(outVtx.normal, outVtx.tangent));
-                surfMesh->addVertex(outVtx);
-            }
+            for (int v = 0; v < mesh->mNumVertices; ++v)
+                surfMesh->addVertex(convertVertex(mesh, v));
             
             SLR::BoundingBox3D bbox;
             meshIndices.clear();
@@ -115,6 +123,122 @@ namespace SLRSceneGraph {
         }
     }
     
+    static void recursiveConstructFromMeshCache(const std::shared_ptr<const SLR::MeshCache> &cache, uint32_t* nodeIndex,
+                                                const std::vector<SurfaceMaterialRef> &materials, const std::vector<NormalTextureRef> &normalMaps, const std::vector<FloatTextureRef> &alphaMaps,
+                                                const MeshCallback &meshCallback, InternalNodeRef &nodeOut) {
+        const SLR::MeshCache::Node &nodeSrc = cache->node((*nodeIndex)++);
+        if (nodeSrc.numMeshes == 0 && nodeSrc.numChildren == 0) {
+            nodeOut = nullptr;
+            return;
+        }
+        
+        float tfElems[16];
+        std::copy(nodeSrc.transform, nodeSrc.transform + 16, tfElems);
+        nodeOut = createShared<InternalNode>(createShared<SLR::StaticTransform>(SLR::Matrix4x4(tfElems)));
+        nodeOut->setName(nodeSrc.name);
+        
+        for (int m = 0; m < nodeSrc.numMeshes; ++m) {
+            uint32_t meshIndex = nodeSrc.meshIndices[m];
+            const SLR::MeshCache::Mesh &mesh = cache->mesh(meshIndex);
+            
+            TriangleMeshNodeRef surfMesh = createShared<TriangleMeshNode>();
+            surfMesh->setMeshCache(cache, meshIndex, materials[mesh.materialIndex], normalMaps[mesh.materialIndex], alphaMaps[mesh.materialIndex]);
+            
+            MeshAttributeTuple meshAttr = meshCallback(surfMesh->getName(), surfMesh, mesh.bounds.minP, mesh.bounds.maxP);
+            
+            surfMesh->setName(mesh.name);
+            
+            surfMesh->useOnlyForBoundary(!meshAttr.render);
+            surfMesh->setAxisForRadialTangent(meshAttr.axisForRadialTangent);
+            
+            nodeOut->addChildNode(surfMesh);
+        }
+        
+        for (int c = 0; c < nodeSrc.numChildren; ++c) {
+            InternalNodeRef subNode;
+            recursiveConstructFromMeshCache(cache, nodeIndex, materials, normalMaps, alphaMaps, meshCallback, subNode);
+            if (subNode != nullptr)
+                nodeOut->addChildNode(subNode);
+        }
+    }
+    
+    // JP: 材質はAssimpのaiMaterialのプロパティをそのまま並べてキャッシュに格納し、読み込み時にaiMaterialを復元して材質生成関数に渡す。
+    // EN: materials are stored in the cache as the properties of Assimp's aiMaterial as is,
+    //     and aiMaterial is restored at loading to be passed to the material creation function.
+    static void serializeMaterial(const aiMaterial* aiMat, std::vector<uint8_t>* data) {
+        auto append = [data](const void* src, size_t size) {
+            const uint8_t* bytes = (const uint8_t*)src;
+            data->insert(data->end(), bytes, bytes + size);
+        };
+        append(&aiMat->mNumProperties, sizeof(uint32_t));
+        for (int i = 0; i < aiMat->mNumProperties; ++i) {
+            const aiMaterialProperty* prop = aiMat->mProperties[i];
+            uint32_t values[] = {(uint32_t)prop->mKey.length, prop->mSemantic, prop->mIndex, (uint32_t)prop->mType, prop->mDataLength};
+            append(values, sizeof(values));
+            append(prop->mKey.C_Str(), prop->mKey.length);
+            append(prop->mData, prop->mDataLength);
+        }
+    }
+    
+    static bool deserializeMaterial(const uint8_t* data, uint64_t size, aiMaterial* aiMat) {
+        uint64_t pos = 0;
+        auto read = [&](void* dst, uint64_t readSize) {
+            if (readSize > size - pos)
+                return false;
+            std::memcpy(dst, data + pos, readSize);
+            pos += readSize;
+            return true;
+        };
+        uint32_t numProperties;
+        if (!read(&numProperties, sizeof(numProperties)))
+            return false;
+        for (int i = 0; i < numProperties; ++i) {
+            uint32_t values[5];
+            if (!read(values, sizeof(values)))
+                return false;
+            std::string key(values[0], '\0');
+            if (!read(&key[0], values[0]) || values[4] > size - pos)
+                return false;
+            aiMat->AddBinaryProperty(data + pos, values[4], key.c_str(), values[1], values[2], (aiPropertyTypeInfo)values[3]);
+            pos += values[4];
+        }
+        return true;
+    }
+    
+    static bool getFileStamp(const std::string &path, uint64_t* size, int64_t* modifiedTime) {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0)
+            return false;
+        *size = st.st_size;
+        *modifiedTime = st.st_mtime;
+        return true;
+    }
+    
+    static bool endsWith(const std::string &str, const std::string &suffix) {
+        return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+    
+    static void recursiveWriteMeshCache(const aiNode* nodeSrc, const std::vector<int32_t> &meshIndexMap, SLR::MeshCacheWriter* writer) {
+        const aiMatrix4x4 &tf = nodeSrc->mTransformation;
+        float tfElems[] = {
+            tf.a1, tf.a2, tf.a3, tf.a4,
+            tf.b1, tf.b2, tf.b3, tf.b4,
+            tf.c1, tf.c2, tf.c3, tf.c4,
+            tf.d1, tf.d2, tf.d3, tf.d4,
+        };
+        
+        std::vector<uint32_t> meshIndices;
+        for (int m = 0; m < nodeSrc->mNumMeshes; ++m) {
+            int32_t meshIndex = meshIndexMap[nodeSrc->mMeshes[m]];
+            if (meshIndex >= 0)
+                meshIndices.push_back(meshIndex);
+        }
+        writer->addNode(nodeSrc->mName.C_Str(), tfElems, meshIndices, nodeSrc->mNumChildren);
+        
+        for (int c = 0; c < nodeSrc->mNumChildren; ++c)
+            recursiveWriteMeshCache(nodeSrc->mChildren[c], meshIndexMap, writer);
+    }
+    
     SurfaceAttributeTuple createMaterialDefaultFunction(const aiMaterial* aiMat, const std::string &pathPrefix, SLR::Allocator* mem) {
         using namespace SLR;
         aiReturn ret;
@@ -310,19 +434,107 @@ namespace SLRSceneGraph {
         return meshCallbackDefaultFunction(name, mesh, minP, maxP);
     }
     
-    SLR_SCENEGRAPH_API void construct(const std::string &filePath, InternalNodeRef &nodeOut,
-                                      const CreateMaterialFunction &materialFunc, const MeshCallback &meshCallback) {
+    static void constructFromMeshCache(const std::shared_ptr<const SLR::MeshCache> &cache, const std::string &filePath, InternalNodeRef &nodeOut,
+                                       const CreateMaterialFunction &materialFunc, const MeshCallback &meshCallback) {
         using namespace SLR;
         DefaultAllocator &defMem = DefaultAllocator::instance();
         
-        Assimp::Importer importer;
-        const aiScene* scene = importer.ReadFile(filePath, 0);
-        if (!scene) {
+        std::string pathPrefix = filePath.substr(0, filePath.find_last_of("/") + 1);
+        
+        // create materials
+        std::vector<SurfaceMaterialRef> materials;
+        std::vector<NormalTextureRef> normalMaps;
+        std::vector<FloatTextureRef> alphaMaps;
+        for (int m = 0; m < cache->numMaterials(); ++m) {
+            uint64_t size;
+            const uint8_t* data = cache->materialData(m, &size);
+            aiMaterial aiMat;
+            if (!deserializeMaterial(data, size, &aiMat)) {
+                printf("Invalid material data in the mesh cache.\n");
+                nodeOut = nullptr;
+                return;
+            }
+            
+            SurfaceAttributeTuple surfAttr = materialFunc(&aiMat, pathPrefix, &defMem);
+            materials.push_back(surfAttr.material);
+            normalMaps.push_back(surfAttr.normalMap);
+            alphaMaps.push_back(surfAttr.alphaMap);
+        }
+        
+        uint32_t nodeIndex = 0;
+        if (cache->numNodes() > 0)
+            recursiveConstructFromMeshCache(cache, &nodeIndex, materials, normalMaps, alphaMaps, meshCallback, nodeOut);
+        if (!nodeOut)
+            nodeOut = createShared<InternalNode>(createShared<SLR::StaticTransform>());
+    }
+    
+    struct ModelSource {
+        std::string filePath;
+        std::unique_ptr<Assimp::Importer> importer;
+        const aiScene* scene;
+        std::shared_ptr<const SLR::MeshCache> cache;
+    };
+    
+    SLR_SCENEGRAPH_API ModelSourceRef readModel(const std::string &filePath) {
+        using namespace SLR;
+        
+        std::shared_ptr<ModelSource> source = createShared<ModelSource>();
+        source->filePath = filePath;
+        source->scene = nullptr;
+        
+        // JP: メッシュキャッシュが直接指定された場合、もしくは元のファイルと同じ状態から作られたキャッシュが隣にある場合はそれを用いる。
+        // EN: use a mesh cache if it is directly specified, or if a cache made from the same state of the source file is located next to it.
+        if (endsWith(filePath, MeshCacheExtension)) {
+            source->cache = MeshCache::open(filePath);
+            if (!source->cache) {
+                printf("Failed to load %s.\n", filePath.c_str());
+                return nullptr;
+            }
+        }
+        else {
+            uint64_t fileSize;
+            int64_t modifiedTime;
+            std::shared_ptr<const MeshCache> sideCache = MeshCache::open(filePath + MeshCacheExtension);
+            if (sideCache && getFileStamp(filePath, &fileSize, &modifiedTime) &&
+                sideCache->sourceFileSize() == fileSize && sideCache->sourceModifiedTime() == modifiedTime)
+                source->cache = sideCache;
+        }
+        if (source->cache) {
+            printf("Reading: %s (mesh cache) done.\n", filePath.c_str());
+            return source;
+        }
+        
+        source->importer = createUnique<Assimp::Importer>();
+        source->scene = source->importer->ReadFile(filePath, 0);
+        if (!source->scene) {
             printf("Failed to load %s.\n", filePath.c_str());
-            return;
+            return nullptr;
         }
         printf("Reading: %s done.\n", filePath.c_str());
         
+        return source;
+    }
+    
+    SLR_SCENEGRAPH_API void construct(const ModelSourceRef &source, InternalNodeRef &nodeOut,
+                                      const CreateMaterialFunction &materialFunc, const MeshCallback &meshCallback) {
+        using namespace SLR;
+        DefaultAllocator &defMem = DefaultAllocator::instance();
+        
+        if (!source)
+            return;
+        const std::string &filePath = source->filePath;
+        
+        if (source->cache) {
+            constructFromMeshCache(source->cache, filePath, nodeOut, materialFunc, meshCallback);
+            if (!nodeOut)
+                return;
+            nodeOut->setName(filePath);
+            printf("Constructing: %s done.\n", filePath.c_str());
+            return;
+        }
+        
+        const aiScene* scene = source->scene;
+        
         std::string pathPrefix = filePath.substr(0, filePath.find_last_of("/") + 1);
         
         // create materials
@@ -344,4 +556,77 @@ namespace SLRSceneGraph {
         
         printf("Constructing: %s done.\n", filePath.c_str());
     }
+    
+    SLR_SCENEGRAPH_API void construct(const std::string &filePath, InternalNodeRef &nodeOut,
+                                      const CreateMaterialFunction &materialFunc, const MeshCallback &meshCallback) {
+        construct(readModel(filePath), nodeOut, materialFunc, meshCallback);
+    }
+    
+    SLR_SCENEGRAPH_API bool writeMeshCache(const std::string &srcPath, const std::string &dstPath) {
+        using namespace std::chrono;
+        auto startTime = high_resolution_clock::now();
+        Assimp::Importer importer;
+        const aiScene* scene = importer.ReadFile(srcPath, 0);
+        if (!scene) {
+            printf("Failed to load %s.\n", srcPath.c_str());
+            return false;
+        }
+        double importTime = duration_cast<microseconds>(high_resolution_clock::now() - startTime).count() * 1e-6;
+        
+        SLR::MeshCacheWriter writer;
+        uint64_t fileSize;
+        int64_t modifiedTime;
+        if (getFileStamp(srcPath, &fileSize, &modifiedTime))
+            writer.setSource(fileSize, modifiedTime);
+        
+        for (int m = 0; m < scene->mNumMaterials; ++m) {
+            std::vector<uint8_t> data;
+            serializeMaterial(scene->mMaterials[m], &data);
+            writer.addMaterial(data);
+        }
+        
+        std::vector<int32_t> meshIndexMap(scene->mNumMeshes, -1);
+        std::vector<SLR::Vertex> vertices;
+        std::vector<uint32_t> indices;
+        for (int m = 0; m < scene->mNumMeshes; ++m) {
+            const aiMesh* mesh = scene->mMeshes[m];
+            if (mesh->mPrimitiveTypes != aiPrimitiveType_TRIANGLE) {
+                printf("ignored non triangle mesh.\n");
+                continue;
+            }
+            
+            vertices.resize(mesh->mNumVertices);
+            for (int v = 0; v < mesh->mNumVertices; ++v)
+                vertices[v] = convertVertex(mesh, v);
+            indices.resize(3 * mesh->mNumFaces);
+            for (int f = 0; f < mesh->mNumFaces; ++f) {
+                const aiFace &face = mesh->mFaces[f];
+                indices[3 * f + 0] = face.mIndices[0];
+                indices[3 * f + 1] = face.mIndices[1];
+                indices[3 * f + 2] = face.mIndices[2];
+            }
+            meshIndexMap[m] = writer.addMesh(mesh->mName.C_Str(), vertices.data(), mesh->mNumVertices, indices.data(), mesh->mNumFaces, mesh->mMaterialIndex);
+        }
+        
+        recursiveWriteMeshCache(scene->mRootNode, meshIndexMap, &writer);
+        
+        if (!writer.write(dstPath)) {
+            printf("Failed to write %s.\n", dstPath.c_str());
+            return false;
+        }
+        
+        // JP: 書き出したキャッシュを読み込み、Assimpによる元のファイルの読み込みと時間を比べる。
+        // EN: load the written cache and compare its time with loading the source file by Assimp.
+        startTime = high_resolution_clock::now();
+        std::shared_ptr<SLR::MeshCache> cache = SLR::MeshCache::open(dstPath);
+        double cacheLoadTime = duration_cast<microseconds>(high_resolution_clock::now() - startTime).count() * 1e-6;
+        if (!cache) {
+            printf("Failed to load the written mesh cache %s.\n", dstPath.c_str());
+            return false;
+        }
+        printf("Mesh cache: %s, %u meshes, %u nodes, %u materials\n", dstPath.c_str(), cache->numMeshes(), cache->numNodes(), cache->numMaterials());
+        printf("Load time: Assimp %g [s], mesh cache %g [s]\n", importTime, cacheLoadTime);
+        
+        return true;
+    }
 }
@@ -38,9 +38,34 @@ namespace SLRSceneGraph {
     MeshAttributeTuple meshCallbackFunction(const Function &meshProc, ExecuteContext &context, ErrorMessage* err,
                                             const std::string &name, const TriangleMeshNodeRef &mesh, const SLR::Point3D &minP, const SLR::Point3D &maxP);
     
+    // JP: メッシュキャッシュの拡張子。元のファイル名にこれを付けたキャッシュが隣にあれば、元のファイルの代わりに読み込む。
+    // EN: the extension of mesh caches. A cache next to the source file named with this appended is loaded instead of the source file.
+    static const char* const MeshCacheExtension = ".slrmesh";
+    
+    // JP: filePathがメッシュキャッシュの場合はメモリーマップして読み込み、メッシュは頂点配列を複製せずにキャッシュを参照する。
+    //     それ以外の場合、元のファイルと同じ状態から作られたキャッシュが隣にあればそれを用い、なければAssimpで読み込む。
+    // EN: if filePath is a mesh cache, this loads it by memory-mapping, and meshes reference the cache without copying vertex arrays.
+    //     Otherwise, a cache made from the same state of the source file next to it is used if exists, or the file is loaded by Assimp.
     SLR_SCENEGRAPH_API void construct(const std::string &filePath, InternalNodeRef &nodeOut,
                                       const CreateMaterialFunction &materialFunc = createMaterialDefaultFunction,
                                       const MeshCallback &meshCallback = meshCallbackDefaultFunction);
+    
+    // JP: 読み込んだ3Dモデルのファイル。Assimpで読み込んだシーンかメッシュキャッシュのいずれかを保持する。
+    // EN: a read 3D model file. This holds either a scene read by Assimp or a mesh cache.
+    struct ModelSource;
+    typedef std::shared_ptr<const ModelSource> ModelSourceRef;
+    
+    // JP: constructをファイルの読み込みとノードの構築に分けたもの。
+    //     readModelはシーングラフに触れないので別スレッドで実行できる。失敗した場合はnullptrを返す。
+    //     材質生成関数やメッシュのコールバックはスクリプトを実行しうるため、構築はスクリプトのスレッドで行う。
+    // EN: construct split into reading the file and constructing the nodes.
+    //     readModel can be executed on another thread since it doesn't touch the scene graph. This returns nullptr on failure.
+    //     Construction should be done on the thread of the script because the material function and the mesh callback may execute the script.
+    SLR_SCENEGRAPH_API ModelSourceRef readModel(const std::string &filePath);
+    SLR_SCENEGRAPH_API void construct(const ModelSourceRef &source, InternalNodeRef &nodeOut,
+                                      const CreateMaterialFunction &materialFunc = createMaterialDefaultFunction,
+                                      const MeshCallback &meshCallback = meshCallbackDefaultFunction);
+
 }
 
 #endif /* __SLRSceneGraph_node_constructor__ */